@@ -10,6 +10,11 @@
 #include <fc/crypto/aes.hpp>
 #include <fc/crypto/base58.hpp>
 #include <fc/crypto/hex.hpp>
+#include <fc/thread/thread.hpp>
+
+#include <deque>
+#include <memory>
+#include <thread>
 
 #include <db_cxx.h>
 #include <openssl/aes.h>
@@ -132,35 +137,17 @@ namespace bts {
          }
    };
 
-   // unencrypted / encrypted keys
+   /** a key as stored in the wallet, decoded by decode_keys */
    struct wallet_key
    {
          bool _encrypted;
-         std::string _address_compressed;
-         std::string _address_uncompressed;
          std::vector<unsigned char> _pubkey;
-         fc::ecc::private_key _privkey;
-         std::vector<unsigned char> _encprivkey;
-
-         wallet_key( std::vector<unsigned char>& pubkey, fc::ecc::private_key& privkey ):_pubkey(pubkey)
-         {
-            set_private_key( privkey );
-         }
-
-         wallet_key( std::vector<unsigned char>& pubkey, std::vector<unsigned char>& encprivkey )
-         :_encrypted(true),_pubkey(pubkey),_encprivkey(encprivkey){}
-
-         void set_private_key( fc::ecc::private_key& privkey )
-         {
-            _encrypted = false;
-            _privkey = privkey;
-            bts::pts_address a_c( privkey.get_public_key(), true );
-            bts::pts_address a_uc( privkey.get_public_key(), false );
-            _address_compressed = a_c;
-            _address_uncompressed = a_uc;
-         }
+         std::vector<unsigned char> _privkey;    ///< the 32 byte secret, or the encrypted secret
    };
 
+   /** the number of keys decoded by one task of the import pool */
+   const uint32_t decode_batch_size = 1000;
+
    static bool decrypt( std::vector<unsigned char>& privkey, std::vector<unsigned char>& key,
                         std::vector<unsigned char> iv, std::vector<unsigned char>& plainkey )
    { try {
@@ -197,10 +184,85 @@ namespace bts {
       return false;
    }
 
-   static std::vector<fc::ecc::private_key> collect_keys(  wallet_db &db, const std::string& passphrase )
+   /** @return the private keys of keys that match their public key, decrypted with mkeys if encrypted */
+   static std::vector<fc::ecc::private_key> decode_keys( std::vector<wallet_key>& keys,
+                                                         std::vector<std::vector<unsigned char>>& mkeys )
    {
-      std::vector<wallet_key> keys;
-      std::vector<std::string> names;
+      std::vector<fc::ecc::private_key> ekeys;
+      ekeys.reserve( keys.size() );
+      for( auto &key : keys )
+      {
+         if( key._encrypted == false )
+         {
+            fc::sha256 hash( fc::to_hex( (char*)&key._privkey[0], 32 ) );
+            fc::ecc::private_key privkey = fc::ecc::private_key::regenerate( hash );
+            if( private_key_matches_public( privkey, key._pubkey ) )
+               ekeys.push_back( privkey );
+            continue;
+         }
+
+         for( auto &mkey : mkeys )
+         {
+            try {
+               //  encrypted keys are decrypted by using the masterkey and IV=sha256(sha256(pubkey))
+               auto h = fc::sha256::hash( (char*)&key._pubkey[0], key._pubkey.size() );
+               h = fc::sha256::hash( h );
+
+               std::vector<unsigned char> iv( h.data(), h.data() + 16 );
+               std::vector<unsigned char> privkeydata;
+               if( decrypt( key._privkey, mkey, iv, privkeydata ) == false )
+                  continue;
+
+               fc::sha256 hash( fc::to_hex( (char*)&privkeydata[0], 32 ) );
+               fc::ecc::private_key privkey = fc::ecc::private_key::regenerate( hash );
+               if( private_key_matches_public( privkey, key._pubkey ) )
+               {
+                  ekeys.push_back( privkey );
+                  break;
+               }
+            }
+            catch ( const fc::exception& e )
+            {
+               wlog( "${e}", ("e",e.to_detail_string()) );
+            }
+         }
+         // keys that are still encrypted are skipped
+      }
+      return ekeys;
+   }
+
+   /**
+    *  Reads the records of db in cursor order and hands batches of keys to a pool of threads
+    *  that decode them while the cursor moves on.  Encrypted keys are stored before the master
+    *  key that decrypts them, so they are only decoded once the cursor is done.
+    */
+   static void collect_keys( wallet_db &db, const std::string& passphrase, const import_key_handler& handle )
+   {
+      std::vector<std::unique_ptr<fc::thread>> pool( std::max( 1u, std::thread::hardware_concurrency() ) );
+      for( auto &thread : pool ) thread.reset( new fc::thread( "bitcoin_import" ) );
+
+      std::deque<fc::future<std::vector<fc::ecc::private_key>>> decoded;
+      uint64_t next_worker = 0;
+      auto dispatch = [&]( std::vector<wallet_key>& batch, const std::vector<std::vector<unsigned char>>& mkeys )
+      {
+         if( batch.empty() ) return;
+         auto keys = std::make_shared<std::vector<wallet_key>>( std::move( batch ) );
+         auto masters = std::make_shared<std::vector<std::vector<unsigned char>>>( mkeys );
+         batch.clear();
+         decoded.push_back( pool[next_worker++ % pool.size()]->async( [keys,masters]()
+         {
+            return decode_keys( *keys, *masters );
+         } ) );
+         // keeps every thread busy without holding more than a couple of batches each
+         while( decoded.size() > pool.size() * 2 )
+         {
+            handle( decoded.front().wait() );
+            decoded.pop_front();
+         }
+      };
+
+      std::vector<wallet_key> plain;
+      std::vector<wallet_key> encrypted;
       std::vector<std::vector<unsigned char>> mkeys;
       wallet_db_blob key, value;
 
@@ -210,7 +272,9 @@ namespace bts {
 
             if( cmd == "key" || cmd == "wkey" )
             {
-               std::vector<unsigned char> pubkey = key.get_data();
+               wallet_key k;
+               k._encrypted = false;
+               k._pubkey = key.get_data();
                // both 'key' and 'wkey' start off with the private key blob which is the
                // only thing we are interested in
                // the private key blob is an ASN.1 encoded representation, but we can
@@ -222,21 +286,17 @@ namespace bts {
                unsigned char seqlen = value.get_uint8();
                FC_ASSERT( seqlen == 0x81 || seqlen == 0x82 );
                value.skip( (seqlen == 0x81) ? 6 : 7 );
-               std::vector<unsigned char> privkeydata = value.get_data( 32 );
-               fc::sha256 hash( fc::to_hex( (char*)&privkeydata[0], 32 ) );
-               fc::ecc::private_key privkey = fc::ecc::private_key::regenerate( hash );
-               if( private_key_matches_public( privkey, pubkey ) )
-               {
-                  wallet_key key( pubkey, privkey );
-                  keys.push_back( key );
-               }
+               k._privkey = value.get_data( 32 );
+               plain.push_back( std::move( k ) );
+               if( plain.size() == decode_batch_size ) dispatch( plain, mkeys );
             }
             else if( cmd == "ckey" )
             {
-               std::vector<unsigned char> pubkey = key.get_data();
-               std::vector<unsigned char> encprivkey = value.get_data();
-               wallet_key key( pubkey, encprivkey );
-               keys.push_back( key );
+               wallet_key k;
+               k._encrypted = true;
+               k._pubkey = key.get_data();
+               k._privkey = value.get_data();
+               encrypted.push_back( std::move( k ) );
             }
             else if( cmd == "mkey" )
             {
@@ -269,72 +329,36 @@ namespace bts {
                   elog( "error decrypting key" );
                }
             }
-            else if( cmd == "name" )
-            {
-               std::string b58name = key.get_string();
-               names.push_back( b58name );
-            }
       } // while...
 
-      std::vector<fc::ecc::private_key> ekeys;
-
-      // decrypt encrypted keys
-      for( auto &key : keys )
+      dispatch( plain, mkeys );
+      for( size_t i = 0; i < encrypted.size(); i += decode_batch_size )
       {
-         if( key._encrypted == false )
-            continue;
-
-         for( auto &mkey : mkeys )
-         {
-            try {
-               //  encrypted keys are decrypted by using the masterkey and IV=sha256(sha256(pubkey))
-               auto h = fc::sha256::hash( (char*)&key._pubkey[0], key._pubkey.size() );
-               h = fc::sha256::hash( h );
-
-               std::vector<unsigned char> iv( h.data(), h.data() + 16 );
-               std::vector<unsigned char> privkeydata;
-               if( decrypt( key._encprivkey, mkey, iv, privkeydata ) == false )
-                  continue;
-
-               fc::sha256 hash( fc::to_hex( (char*)&privkeydata[0], 32 ) );
-               fc::ecc::private_key privkey = fc::ecc::private_key::regenerate( hash );
-               if( private_key_matches_public( privkey, key._pubkey ) )
-               {
-                  key.set_private_key( privkey );
-                  break;
-               }
-            }
-            catch ( const fc::exception& e )
-            {
-               wlog( "${e}", ("e",e.to_detail_string()) );
-            }
-         }
+         std::vector<wallet_key> batch( encrypted.begin() + i,
+                                        encrypted.begin() + std::min<size_t>( i + decode_batch_size, encrypted.size() ) );
+         dispatch( batch, mkeys );
       }
+      for( auto &keys : decoded )
+         handle( keys.wait() );
+   }
 
-      // collect all the keys
-      for( auto &key : keys )
-      {
-         // skip still encrypted keys
-         if( key._encrypted )
-            continue;
+   void import_bitcoin_wallet( const fc::path& wallet_dat, const std::string& passphrase, const import_key_handler& handle )
+   { try {
 
-         // add only named keys
-       //  if( std::find( names.begin(), names.end(), key._address_compressed ) != names.end() ||
-       //      std::find( names.begin(), names.end(), key._address_uncompressed ) != names.end() )
-         {
-            ekeys.push_back(key._privkey);
-         }
-      }
-      //ilog( "keys: ${keys}", ("keys",ekeys) );
+      wallet_db db( wallet_dat.to_native_ansi_path().c_str() );
+      collect_keys( db, passphrase, handle );
 
-      return ekeys;
-   }
+   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
    std::vector<fc::ecc::private_key> import_bitcoin_wallet( const fc::path& wallet_dat, const std::string& passphrase )
    { try {
 
-      wallet_db db( wallet_dat.to_native_ansi_path().c_str() );
-      return collect_keys( db, passphrase );
+      std::vector<fc::ecc::private_key> ekeys;
+      import_bitcoin_wallet( wallet_dat, passphrase, [&]( const std::vector<fc::ecc::private_key>& keys )
+      {
+         ekeys.insert( ekeys.end(), keys.begin(), keys.end() );
+      } );
+      return ekeys;
 
    } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 }
@@ -15,4 +15,9 @@ namespace bts {
    { try {
       FC_ASSERT( !"Support for Importing Bitcoin Core wallets was not compiled in.", "Unable to load wallet ${wallet}", ("wallet",wallet_dat) );
    } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+   void import_bitcoin_wallet( const fc::path& wallet_dat, const std::string& passphrase, const import_key_handler& handle )
+   { try {
+      FC_ASSERT( !"Support for Importing Bitcoin Core wallets was not compiled in.", "Unable to load wallet ${wallet}", ("wallet",wallet_dat) );
+   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 }
@@ -2,6 +2,17 @@
 #include <fc/crypto/elliptic.hpp>
 #include <fc/filesystem.hpp>
 
+#include <functional>
+
 namespace bts  {
+      typedef std::function<void( const std::vector<fc::ecc::private_key>& )> import_key_handler;
+
       std::vector<fc::ecc::private_key> import_bitcoin_wallet( const fc::path& wallet_dat, const std::string& passphrase );
+
+      /**
+       *  Decodes the keys of wallet_dat on a pool of threads and passes them to handle, on the
+       *  calling thread, in batches as they are decoded so that the whole wallet is never held
+       *  in memory at once.
+       */
+      void import_bitcoin_wallet( const fc::path& wallet_dat, const std::string& passphrase, const import_key_handler& handle );
 }
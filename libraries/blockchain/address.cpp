@@ -1,24 +1,101 @@
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
-#include <fc/crypto/base58.hpp>
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/crypto/sha512.hpp>
 #include <fc/crypto/elliptic.hpp>
 #include <fc/exception/exception.hpp>
 
 #include <bts/blockchain/address.hpp>
+#include <bts/blockchain/base58.hpp>
 #include <bts/blockchain/small_hash.hpp>
 
 namespace bts {
   namespace blockchain {
+   namespace detail
+   {
+      /**
+       *  The string forms of memoized addresses, both ways.  Until an address is memoized a
+       *  lookup doesn't take the mutex, so processes without a wallet never do.
+       */
+      class address_memo
+      {
+         public:
+            address_memo():_size(0){}
+
+            static address_memo& instance()
+            {
+               static address_memo memo;
+               return memo;
+            }
+
+            bool find( const address& a, std::string& str )
+            {
+               if( _size.load( std::memory_order_acquire ) == 0 ) return false;
+               std::unique_lock<std::mutex> lock( _mutex );
+               auto itr = _strings.find( a );
+               if( itr == _strings.end() ) return false;
+               str = itr->second;
+               return true;
+            }
+
+            bool find( const std::string& str, address& a )
+            {
+               if( _size.load( std::memory_order_acquire ) == 0 ) return false;
+               std::unique_lock<std::mutex> lock( _mutex );
+               auto itr = _addresses.find( str );
+               if( itr == _addresses.end() ) return false;
+               a = itr->second;
+               return true;
+            }
+
+            void insert( const address& a, const std::string& str )
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               _strings[a]     = str;
+               _addresses[str] = a;
+               _size.store( _strings.size(), std::memory_order_release );
+            }
+
+         private:
+            std::atomic<size_t>                     _size;
+            std::mutex                              _mutex;
+            std::unordered_map<address,std::string> _strings;
+            std::unordered_map<std::string,address> _addresses;
+      };
+
+      static std::string encode( const address& a )
+      {
+         fc::array<char,24> bin_addr;
+         memcpy( (char*)&bin_addr, (char*)&a.addr, sizeof(a.addr) );
+         auto checksum = fc::ripemd160::hash( (char*)&a.addr, sizeof(a.addr) );
+         memcpy( ((char*)&bin_addr)+20, (char*)&checksum._hash[0], 4 );
+         return base58_encode( bin_addr.data, sizeof(bin_addr) );
+      }
+
+      /** the base58 string decoded with its checksum checked */
+      static std::vector<char> decode( const std::string& base58str )
+      {
+         std::vector<char> v = base58_decode( base58str );
+         FC_ASSERT( v.size() == sizeof(fc::ripemd160) + 4, "an address is 20 bytes and a 4 byte checksum",
+                    ("size",v.size()) );
+         auto checksum = fc::ripemd160::hash( v.data(), v.size() - 4 );
+         FC_ASSERT( memcmp( v.data()+v.size()-4, (char*)checksum._hash, 4 ) == 0, "address checksum mismatch" );
+         return v;
+      }
+   }
+
    address::address(){}
 
    address::address( const std::string& base58str )
-   { 
-      std::vector<char> v = fc::from_base58( fc::string(base58str) );
-      FC_ASSERT( is_valid( base58str ) );
-      memcpy( (char*)addr._hash, v.data(), std::min<size_t>( v.size()-4, sizeof(addr) ) );
-   }
+   { try {
+      if( detail::address_memo::instance().find( base58str, *this ) )
+         return;
+      std::vector<char> v = detail::decode( base58str );
+      memcpy( (char*)addr._hash, v.data(), sizeof(addr) );
+   } FC_RETHROW_EXCEPTIONS( warn, "invalid address '${a}'", ("a", base58str) ) }
 
 
    /**
@@ -28,11 +105,10 @@ namespace bts {
     */
    bool address::is_valid(const std::string& base58str )
    { try {
-      std::vector<char> v = fc::from_base58( fc::string(base58str) );
-      FC_ASSERT( v.size() > 4, "all addresses must have a 4 byte checksum" );
-      FC_ASSERT(v.size() <= sizeof(fc::ripemd160) + 4, "all addresses are less than 24 bytes");
-      auto checksum = fc::ripemd160::hash( v.data(), v.size() - 4 );
-      FC_ASSERT( memcmp( v.data()+20, (char*)checksum._hash, 4 ) == 0, "address checksum mismatch" );
+      address memoized;
+      if( detail::address_memo::instance().find( base58str, memoized ) )
+         return true;
+      detail::decode( base58str );
       return true;
    } FC_RETHROW_EXCEPTIONS( warn, "invalid address '${a}'", ("a", base58str) ) }
 
@@ -44,11 +120,17 @@ namespace bts {
 
    address::operator std::string()const
    {
-        fc::array<char,24> bin_addr;
-        memcpy( (char*)&bin_addr, (char*)&addr, sizeof(addr) );
-        auto checksum = fc::ripemd160::hash( (char*)&addr, sizeof(addr) );
-        memcpy( ((char*)&bin_addr)+20, (char*)&checksum._hash[0], 4 );
-        return fc::to_base58( bin_addr.data, sizeof(bin_addr) );
+        std::string str;
+        if( detail::address_memo::instance().find( *this, str ) )
+           return str;
+        return detail::encode( *this );
+   }
+
+   void address::memoize( const address& a )
+   {
+        std::string str;
+        if( !detail::address_memo::instance().find( a, str ) )
+           detail::address_memo::instance().insert( a, detail::encode( a ) );
    }
 
 } } // namespace bts::blockchain
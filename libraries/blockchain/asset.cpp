@@ -1,6 +1,7 @@
 #define __STDC_CONSTANT_MACROS
 #include <bts/blockchain/asset.hpp>
 #include <bts/blockchain/config.hpp>
+#include <bts/blockchain/fixed_point.hpp>
 #include <fc/exception/exception.hpp>
 #include <fc/crypto/bigint.hpp>
 #include <fc/log/logger.hpp>
@@ -42,12 +43,18 @@ namespace bts { namespace blockchain {
      return *this;
   }
 
+  /** the high 64 bits of the 128.64 product, as fc::uint128(bigint).high_bits() gave */
   asset  asset::operator *  ( const fc::uint128_t& fix6464 )const
   {
+#ifdef BTS_HAS_INT128
+      auto product = fixed_point::multiply( amount, fixed_point::to_native( fix6464 ) );
+      return asset( uint64_t(product.high), unit );
+#else
       fc::bigint bi(amount);
       bi *= fix6464;
       bi >>= 64;
       return asset( fc::uint128(bi).high_bits(), unit );
+#endif
   }
 
   asset& asset::operator -= ( const asset& o )
@@ -138,20 +145,24 @@ namespace bts { namespace blockchain {
   {
     try 
     {
-        ilog( "${a} / ${b}", ("a",a)("b",b) );
         price p;
         auto l = a; auto r = b;
         if( l.unit < r.unit ) { std::swap(l,r); }
-        ilog( "${a} / ${b}", ("a",l)("b",r) );
 
         p.base_unit = r.unit;
         p.quote_unit = l.unit;
 
+#ifdef BTS_HAS_INT128
+        fixed_point::uint128_type result;
+        FC_ASSERT( fixed_point::divide_shift64( l.amount, r.amount, result ), "division by zero" );
+        p.ratio = fixed_point::to_fc( result );
+#else
         fc::bigint bl = l.amount;
         fc::bigint br = r.amount;
         fc::bigint result = (bl <<= 64) / br;
 
         p.ratio = result;
+#endif
         return p;
     } FC_RETHROW_EXCEPTIONS( warn, "${a} / ${b}", ("a",a)("b",b) );
   }
@@ -167,6 +178,26 @@ namespace bts { namespace blockchain {
   asset operator * ( const asset& a, const price& p )
   {
     try {
+#ifdef BTS_HAS_INT128
+        if( a.unit == p.base_unit )
+        {
+            fixed_point::uint128_type amnt; // 128.64 >> 64
+            if( !fixed_point::multiply_shift64( a.amount, fixed_point::to_native( p.ratio ), amnt ) || (amnt >> 64) )
+            {
+               FC_THROW_EXCEPTION( exception, "overflow ${a} * ${p}", ("a",a)("p",p) );
+            }
+            return asset( uint64_t(amnt), p.quote_unit );
+        }
+        else if( a.unit == p.quote_unit )
+        {
+            fixed_point::uint128_type result; // 64.128 / 64.64
+            if( !fixed_point::divide_shift64( a.amount, fixed_point::to_native( p.ratio ), result ) || (result >> 64) )
+            {
+               FC_THROW_EXCEPTION( exception, "overflow ${a} / ${p}", ("a",a)("p",p) );
+            }
+            return asset( uint64_t(result), p.base_unit );
+        }
+#else
         if( a.unit == p.base_unit )
         {
             fc::bigint ba( a.amount ); // 64.64
@@ -186,7 +217,6 @@ namespace bts { namespace blockchain {
             rtn.amount = amnt;
             rtn.unit = p.quote_unit;
 
-            ilog( "${a} * ${p} => ${rtn}", ("a", a)("p",p )("rtn",rtn) );
             return rtn;
         }
         else if( a.unit == p.quote_unit )
@@ -210,9 +240,9 @@ namespace bts { namespace blockchain {
             asset r;
             r.amount = result;
             r.unit   = p.base_unit;
-            ilog( "${a} * ${p} => ${rtn}", ("a", a)("p",p )("rtn",r) );
             return r;
         }
+#endif
         FC_THROW_EXCEPTION( exception, "type mismatch multiplying asset ${a} by price ${p}", 
                                             ("a",a)("p",p) );
     } FC_RETHROW_EXCEPTIONS( warn, "type mismatch multiplying asset ${a} by price ${p}", 
@@ -0,0 +1,127 @@
+#include <bts/blockchain/base58.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <algorithm>
+#include <array>
+#include <stdint.h>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     static const char     base58_digits[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+     static const uint32_t base58_pow5     = 58u*58u*58u*58u*58u; ///< the largest power of 58 that fits a limb
+     static const size_t   max_limbs       = max_base58_size / 4 + 1;
+
+     /** the value of each character, -1 for those that are not base58 */
+     struct base58_table
+     {
+        base58_table()
+        {
+           std::fill( values, values + 256, -1 );
+           for( int i = 0; i < 58; ++i ) values[uint8_t(base58_digits[i])] = i;
+        }
+        int values[256];
+     };
+     static const base58_table base58_values;
+  }
+
+  std::string base58_encode( const char* data, size_t len )
+  {
+     FC_ASSERT( len <= max_base58_size, "unable to base58 encode ${len} bytes", ("len",len) );
+     const uint8_t* bytes = (const uint8_t*)data;
+     size_t zeros = 0;
+     while( zeros < len && bytes[zeros] == 0 ) ++zeros;
+
+     // most significant limb first, the first one takes what doesn't fill a whole limb
+     std::array<uint32_t, detail::max_limbs> limbs;
+     size_t n      = len - zeros;
+     size_t nlimbs = (n + 3) / 4;
+     size_t pos    = zeros;
+     for( size_t i = 0; i < nlimbs; ++i )
+     {
+        size_t take = i == 0 && n % 4 ? n % 4 : 4;
+        uint32_t limb = 0;
+        for( size_t b = 0; b < take; ++b ) limb = (limb << 8) | bytes[pos++];
+        limbs[i] = limb;
+     }
+
+     // every division by 58^5 yields five digits, least significant first
+     char   digits[max_base58_size * 2];
+     size_t ndigits = 0;
+     size_t first   = 0;
+     while( first < nlimbs )
+     {
+        uint64_t rem = 0;
+        for( size_t i = first; i < nlimbs; ++i )
+        {
+           uint64_t cur = (rem << 32) | limbs[i];
+           limbs[i] = uint32_t( cur / detail::base58_pow5 );
+           rem      = cur % detail::base58_pow5;
+        }
+        while( first < nlimbs && limbs[first] == 0 ) ++first;
+        for( int d = 0; d < 5; ++d )
+        {
+           digits[ndigits++] = detail::base58_digits[rem % 58];
+           rem /= 58;
+        }
+     }
+     // the last group is padded with zero digits
+     while( ndigits && digits[ndigits-1] == '1' ) --ndigits;
+
+     std::string result( zeros, '1' );
+     result.reserve( zeros + ndigits );
+     for( size_t i = ndigits; i > 0; --i ) result.push_back( digits[i-1] );
+     return result;
+  }
+
+  std::vector<char> base58_decode( const std::string& s )
+  {
+     size_t zeros = 0;
+     while( zeros < s.size() && s[zeros] == '1' ) ++zeros;
+
+     // least significant limb first, the characters are taken five at a time
+     std::array<uint32_t, detail::max_limbs> limbs;
+     size_t nlimbs = 0;
+     size_t pos    = zeros;
+     while( pos < s.size() )
+     {
+        uint32_t group = 0, scale = 1;
+        for( size_t end = std::min( pos + 5, s.size() ); pos < end; ++pos )
+        {
+           int v = detail::base58_values.values[uint8_t(s[pos])];
+           FC_ASSERT( v >= 0, "invalid base58 character in '${s}'", ("s",s) );
+           group = group * 58 + uint32_t(v);
+           scale *= 58;
+        }
+        uint64_t carry = group;
+        for( size_t i = 0; i < nlimbs; ++i )
+        {
+           uint64_t cur = uint64_t(limbs[i]) * scale + carry;
+           limbs[i] = uint32_t( cur );
+           carry    = cur >> 32;
+        }
+        if( carry )
+        {
+           FC_ASSERT( nlimbs < detail::max_limbs, "base58 string '${s}' is too long", ("s",s) );
+           limbs[nlimbs++] = uint32_t( carry );
+        }
+     }
+
+     std::vector<char> result( zeros, 0 );
+     bool leading = true;
+     for( size_t i = nlimbs; i > 0; --i )
+     {
+        for( int shift = 24; shift >= 0; shift -= 8 )
+        {
+           char byte = char( limbs[i-1] >> shift );
+           if( leading && byte == 0 ) continue;
+           leading = false;
+           result.push_back( byte );
+        }
+     }
+     FC_ASSERT( result.size() <= max_base58_size, "base58 string '${s}' is too long", ("s",s) );
+     return result;
+  }
+
+} } // bts::blockchain
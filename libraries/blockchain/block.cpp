@@ -6,6 +6,7 @@
 #include <bts/blockchain/block.hpp>
 #include <bts/blockchain/config.hpp>
 #include <bts/blockchain/small_hash.hpp>
+#include <bts/blockchain/parallel.hpp>
 
 #include <bts/blockchain/difficulty.hpp>
 namespace bts { namespace blockchain  {
@@ -17,41 +18,149 @@ namespace bts { namespace blockchain  {
    :signed_block_header(b)
    {
       trx_ids.reserve( trxs.size() );
-      for( auto trx : trxs ) 
+      for( const signed_transaction& trx : trxs ) 
          trx_ids.push_back( trx.id() );
-      for( auto trx : determinstic_trxs) 
+      deterministic_ids.reserve( determinstic_trxs.size() );
+      for( const signed_transaction& trx : determinstic_trxs ) 
          deterministic_ids.push_back( trx.id() );
    }
 
 
-  uint160 trx_block::calculate_merkle_root( const signed_transactions& determinstic_trxs )const
+  /**
+   *  Reduces the leaves to their merkle root in place, an odd layer is padded
+   *  with a null hash.  leaves must have capacity for one extra element so that
+   *  padding does not allocate.
+   */
+  static uint160 reduce_merkle_root( std::vector<uint160>& leaves )
   {
-     if( trxs.size() == 0 ) return uint160();
-     if( trxs.size() == 1 ) return trxs.front().id();
+     static_assert( sizeof(uint160[2]) == 40, "validate there is no padding between array items" );
+     size_t count = leaves.size();
+     while( count > 1 )
+     {
+        if( count % 2 == 1 )
+        {
+           leaves.resize( count + 1 );
+           leaves[count++] = uint160();
+        }
 
-     std::vector<uint160> layer_one;
-     for( const signed_transaction& trx : trxs )
-        layer_one.push_back( trx.id() );
-     for( const signed_transaction& trx : determinstic_trxs )
-        layer_one.push_back( trx.id() );
+        // element i/2 is written after elements i and i+1 are read
+        for( size_t i = 0; i < count; i += 2 )
+        {
+           leaves[i/2] = small_hash( (char*)&leaves[i], 2*sizeof(uint160) );
+        }
+        count /= 2;
+     }
+     return leaves.front();
+  }
+
+  /**
+   *  Records the sibling of index at each layer while reducing the leaves the
+   *  same way reduce_merkle_root does.
+   */
+  static merkle_branch reduce_merkle_branch( std::vector<uint160>& leaves, uint32_t index )
+  {
+     FC_ASSERT( index < leaves.size(), "", ("index",index)("leaves",leaves.size()) );
+     merkle_branch branch;
+     branch.index = index;
 
-     std::vector<uint160> layer_two;
-     while( layer_one.size() > 1 )
+     size_t count = leaves.size();
+     while( count > 1 )
      {
-        if( layer_one.size() % 2 == 1 )
+        if( count % 2 == 1 )
         {
-          layer_one.push_back( uint160() );
+           leaves.resize( count + 1 );
+           leaves[count++] = uint160();
         }
+        branch.hashes.push_back( leaves[index ^ 1] );
 
-        static_assert( sizeof(uint160[2]) == 40, "validate there is no padding between array items" );
-        for( uint32_t i = 0; i < layer_one.size(); i += 2 )
+        for( size_t i = 0; i < count; i += 2 )
         {
-            layer_two.push_back(  small_hash( (char*)&layer_one[i], 2*sizeof(uint160) ) );
+           leaves[i/2] = small_hash( (char*)&leaves[i], 2*sizeof(uint160) );
         }
+        count /= 2;
+        index /= 2;
+     }
+     return branch;
+  }
 
-        layer_one = std::move(layer_two);
+  uint160 merkle_branch::calculate_root( const uint160& leaf )const
+  {
+     uint160 pair[2];
+     pair[0] = leaf;
+     uint32_t i = index;
+     for( auto itr = hashes.begin(); itr != hashes.end(); ++itr )
+     {
+        if( i % 2 == 0 ) pair[1] = *itr;
+        else             { pair[1] = pair[0]; pair[0] = *itr; }
+        pair[0] = small_hash( (char*)pair, sizeof(pair) );
+        i /= 2;
      }
-     return layer_one.front();
+     return pair[0];
+  }
+
+  /** blocks with fewer transactions than this compute their ids on the calling thread */
+  static const size_t MERKLE_PARALLEL_MIN_TRXS = 512;
+  static const size_t MERKLE_LEAVES_PER_THREAD = 256;
+
+  uint160 trx_block::calculate_merkle_root( const signed_transactions& determinstic_trxs )const
+  {
+     if( trxs.size() == 0 ) return uint160();
+     if( trxs.size() == 1 ) return trxs.front().id();
+
+     std::vector<uint160> leaves;
+     leaves.reserve( trxs.size() + determinstic_trxs.size() + 1 );
+     leaves.resize( trxs.size() + determinstic_trxs.size() );
+
+     // ids are cached on the transactions so this only hashes those not seen before
+     size_t min_range = trxs.size() < MERKLE_PARALLEL_MIN_TRXS ? trxs.size() : MERKLE_LEAVES_PER_THREAD;
+     parallel_for( trxs.size(), min_range, [&]( size_t begin, size_t end )
+     {
+        for( size_t i = begin; i < end; ++i )
+           leaves[i] = trxs[i].id();
+     });
+     for( size_t i = 0; i < determinstic_trxs.size(); ++i )
+        leaves[trxs.size() + i] = determinstic_trxs[i].id();
+
+     return reduce_merkle_root( leaves );
+  }
+
+  /** a block with one transaction uses its id as the root, so the branch is empty */
+  merkle_branch trx_block::calculate_merkle_branch( uint32_t trx_idx, const signed_transactions& determinstic_trxs )const
+  {
+     FC_ASSERT( trx_idx < trxs.size() + determinstic_trxs.size() );
+     if( trxs.size() <= 1 ) { merkle_branch b; b.index = trx_idx; return b; }
+
+     std::vector<uint160> leaves;
+     leaves.reserve( trxs.size() + determinstic_trxs.size() + 1 );
+     for( auto itr = trxs.begin(); itr != trxs.end(); ++itr )
+        leaves.push_back( itr->id() );
+     for( auto itr = determinstic_trxs.begin(); itr != determinstic_trxs.end(); ++itr )
+        leaves.push_back( itr->id() );
+     return reduce_merkle_branch( leaves, trx_idx );
+  }
+
+  merkle_branch digest_block::calculate_merkle_branch( uint32_t trx_idx )const
+  {
+     FC_ASSERT( trx_idx < trx_ids.size() + deterministic_ids.size() );
+     if( trx_ids.size() <= 1 ) { merkle_branch b; b.index = trx_idx; return b; }
+
+     std::vector<uint160> leaves;
+     leaves.reserve( trx_ids.size() + deterministic_ids.size() + 1 );
+     leaves.insert( leaves.end(), trx_ids.begin(), trx_ids.end() );
+     leaves.insert( leaves.end(), deterministic_ids.begin(), deterministic_ids.end() );
+     return reduce_merkle_branch( leaves, trx_idx );
+  }
+
+  uint160 digest_block::calculate_merkle_root()const
+  {
+     if( trx_ids.size() == 0 ) return uint160();
+     if( trx_ids.size() == 1 ) return trx_ids.front();
+
+     std::vector<uint160> leaves;
+     leaves.reserve( trx_ids.size() + deterministic_ids.size() + 1 );
+     leaves.insert( leaves.end(), trx_ids.begin(), trx_ids.end() );
+     leaves.insert( leaves.end(), deterministic_ids.begin(), deterministic_ids.end() );
+     return reduce_merkle_root( leaves );
   }
 
   /**
@@ -73,11 +182,27 @@ namespace bts { namespace blockchain  {
   }
 
 
+  void trx_block::add_transaction( const signed_transaction& trx )
+  {
+     trxs.push_back( trx );
+  }
+
   size_t trx_block::block_size()const
   {
+     // every field of the header has a fixed packed size
+     static const size_t header_size = []() -> size_t {
+        fc::datastream<size_t> ds;
+        fc::raw::pack( ds, signed_block_header() );
+        return ds.tellp();
+     }();
+
+     size_t trxs_size = 0;
+     for( const signed_transaction& trx : trxs )
+        trxs_size += trx.size();
+
      fc::datastream<size_t> ds;
-     fc::raw::pack( ds, *this );
-     return ds.tellp();
+     fc::raw::pack( ds, fc::unsigned_int( trxs.size() ) );
+     return header_size + ds.tellp() + trxs_size;
   }
 
   /**
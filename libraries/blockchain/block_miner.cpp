@@ -1,9 +1,14 @@
 #include <bts/blockchain/block_miner.hpp>
-#include <bts/blockchain/momentum.hpp>
+#include <bts/blockchain/miner_backend.hpp>
+#include <bts/db/executor.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/log/logger.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
 namespace bts { namespace blockchain {
 
   namespace detail 
@@ -12,17 +17,27 @@ namespace bts { namespace blockchain {
      {
         public:
            block_miner_impl()
-           :_miner_votes(0),_min_votes(1),_effort(0){}
+           :_miner_votes(0),_min_votes(1),_effort(0),_threads(1),_block_version(0),_backend_name("cpu"),_device(0),_backend_version(0),_created_version(0){}
 
            block_miner::callback _callback;
            fc::thread*           _main_thread;
-           fc::thread            _mining_thread;
            uint64_t              _miner_votes;
            uint64_t              _min_votes;
            block_header          _current_block;
            fc::future<void>      _mining_loop_complete;
            float                 _effort;
            block_header          _prev_header;
+           uint32_t              _threads;
+           /** incremented by set_block so that a search for an older block stops */
+           std::atomic<uint64_t> _block_version;
+           /** reused across attempts, recreated when the backend, device or thread count changes */
+           miner_backend_ptr     _backend;
+           std::string           _backend_name;
+           uint32_t              _device;
+           /** incremented by set_backend and set_threads, _backend_mutex guards it with the name and device */
+           uint32_t              _backend_version;
+           uint32_t              _created_version;
+           std::mutex            _backend_mutex;
 
            void mining_loop()
            {
@@ -47,26 +62,48 @@ namespace bts { namespace blockchain {
                     tmp.nonceb = 0;
                     auto tmp_id = tmp.id();
                     auto seed = fc::sha256::hash( (char*)&tmp_id, sizeof(tmp_id) );
-                    auto pairs = momentum_search( seed );
-                    for( auto collision : pairs )
                     {
-                       tmp.noncea = collision.first;
-                       tmp.nonceb = collision.second;
+                       std::unique_lock<std::mutex> lock( _backend_mutex );
+                       if( !_backend || _created_version != _backend_version )
+                       {
+                          _created_version = _backend_version;
+                          _backend.reset();
+                          _backend = create_miner_backend( _backend_name, _device, _threads );
+                       }
+                    }
+
+                    // stop as soon as set_block installs a new block or a collision is good enough
+                    uint64_t block_version = _block_version;
+                    auto canceled = [&]() { return _block_version != block_version || _mining_loop_complete.canceled(); };
+                    auto on_collision = [&]( uint32_t noncea, uint32_t nonceb ) -> bool
+                    {
+                       // a device may report false candidates
+                       if( !momentum_verify( seed, noncea, nonceb ) )
+                       {
+                          wlog( "${backend} found a collision that doesn't verify: ${a} ${b}",
+                                ("backend",_backend->name())("a",noncea)("b",nonceb) );
+                          return false;
+                       }
+                       tmp.noncea = noncea;
+                       tmp.nonceb = nonceb;
                        FC_ASSERT( _min_votes > 0 );
                        FC_ASSERT( _prev_header.next_difficulty > 0 );
                        ilog( "difficlty ${d}  target ${t}  tmp.get_difficulty ${dd}  mv ${mv} min: ${min}  block:\n${block}", ("min",_min_votes)("mv",_miner_votes)("dd",tmp.get_difficulty())
                                                                                              ("d",(tmp.get_difficulty() * _miner_votes)/_min_votes)("t",_prev_header.next_difficulty)("block",_current_block) );
                        if( (tmp.get_difficulty() * _miner_votes)/_min_votes  >= _prev_header.next_difficulty )
                        {
-                          if( _callback )
+                          if( _callback && !canceled() )
                           {
                              auto cb = _callback; 
-                             _main_thread->async( [cb,tmp](){cb( tmp );} );
+                             auto found = tmp;
+                             _main_thread->async( [cb,found](){cb( found );} );
                           }
                           _effort = 0;
-                          break;
+                          return true;
                        }
-                    }
+                       return false;
+                    };
+                    _backend->search( seed, on_collision, canceled );
                    
                     // search space...
                     
@@ -104,8 +141,8 @@ namespace bts { namespace blockchain {
   :my( new detail::block_miner_impl() )
   {
      my->_main_thread = &fc::thread::current();
-     my->_mining_thread.set_name( "mining" );
-     my->_mining_loop_complete = my->_mining_thread.async( [=](){ my->mining_loop(); } );
+     // the loop waits on the searches it starts, which lets them share its thread
+     my->_mining_loop_complete = bts::db::executor::instance().pool( "mining" ).thread( 0 ).async( [=](){ my->mining_loop(); } );
   }
 
   block_miner::~block_miner()
@@ -128,12 +165,30 @@ namespace bts { namespace blockchain {
      my->_prev_header   = prev_header;
      my->_miner_votes   = miner_votes;
      my->_min_votes     = min_votes;
+     ++my->_block_version;
   }
 
   void block_miner::set_effort( float effort )
   {
      my->_effort = effort;
   }
+  void block_miner::set_threads( uint32_t num_threads )
+  {
+     std::unique_lock<std::mutex> lock( my->_backend_mutex );
+     my->_threads = num_threads;
+     ++my->_backend_version;
+  }
+
+  void block_miner::set_backend( const std::string& name, uint32_t device )
+  {
+     auto names = miner_backend_names();
+     FC_ASSERT( std::find( names.begin(), names.end(), name ) != names.end(), "no miner backend named ${name}", ("name",name) );
+     std::unique_lock<std::mutex> lock( my->_backend_mutex );
+     my->_backend_name = name;
+     my->_device       = device;
+     ++my->_backend_version;
+  }
+
   void block_miner::set_callback( const callback& cb )
   {
      my->_callback = cb;
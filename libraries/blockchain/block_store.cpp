@@ -0,0 +1,308 @@
+#include <bts/blockchain/block_store.hpp>
+#include <fc/interprocess/file_mapping.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      /** a read only mapping of a segment, remapped once the segment grows past it */
+      struct mapped_segment
+      {
+         mapped_segment():size(0){}
+
+         std::unique_ptr<fc::file_mapping>   file;
+         std::unique_ptr<fc::mapped_region>  region;
+         uint64_t                            size;
+      };
+
+      class block_store_impl
+      {
+         public:
+            block_store_impl():_open(false){}
+
+            static const uint32_t record_prefix = sizeof(uint32_t);
+
+            fc::path                             _dir;
+            bool                                 _open;
+            /** the offset of every block within its segment */
+            std::vector<uint64_t>                _offsets;
+            std::vector<uint64_t>                _segment_sizes;
+            std::ofstream                        _index;
+            /** the last segment, open while blocks are appended to it */
+            std::ofstream                        _segment;
+            std::vector<mapped_segment>          _maps;
+
+            fc::path index_file()const { return _dir / "index"; }
+
+            fc::path segment_file( uint32_t segment )const
+            {
+               std::stringstream name;
+               name << "segment_" << std::setw(6) << std::setfill('0') << segment << ".dat";
+               return _dir / name.str();
+            }
+
+            uint32_t segment_count()const
+            {
+               return (_offsets.size() + block_store::blocks_per_segment - 1) / block_store::blocks_per_segment;
+            }
+
+            /** [begin,end) of the record of block_num within its segment */
+            void record( uint32_t block_num, uint64_t& begin, uint64_t& end )const
+            {
+               begin = _offsets[block_num];
+               if( block_num + 1 < _offsets.size() && (block_num + 1) % block_store::blocks_per_segment )
+                  end = _offsets[block_num + 1];
+               else
+                  end = _segment_sizes[block_num / block_store::blocks_per_segment];
+            }
+
+            const char* map( uint32_t segment, uint64_t end )
+            {
+               if( _maps.size() <= segment ) _maps.resize( segment + 1 );
+               auto& m = _maps[segment];
+               if( !m.region || m.size < end )
+               {
+                  m.region.reset();
+                  m.file.reset();
+                  m.size = _segment_sizes[segment];
+                  m.file.reset( new fc::file_mapping( segment_file( segment ).generic_string().c_str(), fc::read_only ) );
+                  m.region.reset( new fc::mapped_region( *m.file, fc::read_only, 0, m.size ) );
+               }
+               return (const char*)m.region->get_address();
+            }
+
+            /** a mapping must not outlive the part of the file it maps */
+            void unmap_from( uint32_t segment )
+            {
+               if( _maps.size() > segment ) _maps.resize( segment );
+            }
+
+            void load_index()
+            {
+               _offsets.clear();
+               if( !fc::exists( index_file() ) ) return;
+
+               _offsets.resize( fc::file_size( index_file() ) / sizeof(uint64_t) );
+               if( _offsets.size() )
+               {
+                  fc::file_mapping  fm( index_file().generic_string().c_str(), fc::read_only );
+                  fc::mapped_region mr( fm, fc::read_only, 0, _offsets.size() * sizeof(uint64_t) );
+                  memcpy( _offsets.data(), mr.get_address(), _offsets.size() * sizeof(uint64_t) );
+               }
+            }
+
+            /**
+             *  Drops the blocks of the last segment whose records were not completely written
+             *  and whatever follows the last indexed record.
+             */
+            void recover()
+            {
+               _segment_sizes.clear();
+               uint32_t segments = segment_count();
+               for( uint32_t s = 0; s < segments; ++s )
+               {
+                  auto file = segment_file( s );
+                  _segment_sizes.push_back( fc::exists( file ) ? fc::file_size( file ) : 0 );
+               }
+
+               if( segments )
+               {
+                  uint32_t last  = segments - 1;
+                  uint32_t first = last * block_store::blocks_per_segment;
+                  uint64_t file_size = _segment_sizes[last];
+                  uint64_t end   = 0;
+                  uint32_t valid = first;
+                  if( file_size )
+                  {
+                     fc::file_mapping  fm( segment_file( last ).generic_string().c_str(), fc::read_only );
+                     fc::mapped_region mr( fm, fc::read_only, 0, file_size );
+                     const char* data = (const char*)mr.get_address();
+                     for( ; valid < _offsets.size(); ++valid )
+                     {
+                        uint64_t begin = _offsets[valid];
+                        if( begin != end || file_size - begin < record_prefix ) break;
+                        uint32_t size = 0;
+                        memcpy( (char*)&size, data + begin, sizeof(size) );
+                        if( file_size - begin - record_prefix < size ) break;
+                        end = begin + record_prefix + size;
+                     }
+                  }
+                  if( valid < _offsets.size() )
+                     wlog( "dropping ${n} incompletely written blocks from ${dir}", ("n",_offsets.size() - valid)("dir",_dir) );
+                  _offsets.resize( valid );
+                  _segment_sizes.resize( segment_count() );
+                  if( _segment_sizes.size() > last )
+                  {
+                     _segment_sizes[last] = end;
+                     if( file_size != end ) fc::resize_file( segment_file( last ), end );
+                  }
+               }
+
+               for( uint32_t s = segment_count(); fc::exists( segment_file( s ) ); ++s )
+                  fc::remove( segment_file( s ) );
+               if( fc::exists( index_file() ) && fc::file_size( index_file() ) != _offsets.size() * sizeof(uint64_t) )
+                  fc::resize_file( index_file(), _offsets.size() * sizeof(uint64_t) );
+            }
+
+            void open_index()
+            {
+               _index.open( index_file().generic_string().c_str(), std::ios::binary | std::ios::app );
+               FC_ASSERT( _index.good(), "unable to open ${file}", ("file",index_file()) );
+            }
+
+            void open_segment( uint32_t segment, bool create )
+            {
+               auto mode = std::ios::binary | (create ? std::ios::trunc : std::ios::app);
+               _segment.open( segment_file( segment ).generic_string().c_str(), mode );
+               FC_ASSERT( _segment.good(), "unable to open ${file}", ("file",segment_file( segment )) );
+            }
+      };
+
+   } // namespace detail
+
+   block_store::block_store()
+   :my( new detail::block_store_impl() )
+   {
+   }
+
+   block_store::~block_store()
+   {
+      close();
+   }
+
+   void block_store::open( const fc::path& dir )
+   { try {
+      close();
+      if( !fc::exists( dir ) ) fc::create_directories( dir );
+      my->_dir = dir;
+      my->load_index();
+      my->recover();
+      my->open_index();
+      my->_open = true;
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to open block store ${dir}", ("dir",dir) ) }
+
+   void block_store::close()
+   {
+      my->_segment.close();
+      my->_index.close();
+      my->_maps.clear();
+      my->_offsets.clear();
+      my->_segment_sizes.clear();
+      my->_open = false;
+   }
+
+   bool block_store::is_open()const
+   {
+      return my->_open;
+   }
+
+   uint32_t block_store::size()const
+   {
+      return my->_offsets.size();
+   }
+
+   void block_store::append( const trx_block& blk )
+   { try {
+      FC_ASSERT( my->_open );
+      FC_ASSERT( blk.block_num == my->_offsets.size(), "blocks are appended in order",
+                 ("block_num",blk.block_num)("size",my->_offsets.size()) );
+
+      uint32_t segment = blk.block_num / blocks_per_segment;
+      if( blk.block_num % blocks_per_segment == 0 )
+      {
+         my->_segment.close();
+         my->open_segment( segment, true );
+         my->_segment_sizes.push_back( 0 );
+      }
+      else if( !my->_segment.is_open() )
+      {
+         my->open_segment( segment, false );
+      }
+
+      auto     packed = fc::raw::pack( blk );
+      uint32_t size   = packed.size();
+      my->_segment.write( (const char*)&size, sizeof(size) );
+      my->_segment.write( packed.data(), packed.size() );
+      my->_segment.flush();
+      FC_ASSERT( my->_segment.good(), "unable to write ${file}", ("file",my->segment_file( segment )) );
+
+      uint64_t offset = my->_segment_sizes[segment];
+      my->_index.write( (const char*)&offset, sizeof(offset) );
+      my->_index.flush();
+      FC_ASSERT( my->_index.good(), "unable to write ${file}", ("file",my->index_file()) );
+
+      my->_offsets.push_back( offset );
+      my->_segment_sizes[segment] += sizeof(size) + size;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",blk.block_num) ) }
+
+   void block_store::truncate( uint32_t block_count )
+   { try {
+      FC_ASSERT( my->_open );
+      if( block_count >= my->_offsets.size() ) return;
+
+      my->_segment.close();
+      my->_index.close();
+
+      uint32_t segments = (block_count + blocks_per_segment - 1) / blocks_per_segment;
+      my->unmap_from( block_count / blocks_per_segment );
+      for( uint32_t s = segments; s < my->segment_count(); ++s )
+         fc::remove( my->segment_file( s ) );
+      if( block_count % blocks_per_segment )
+      {
+         // block_count is in the same segment as the last block that is kept
+         uint64_t end = my->_offsets[block_count];
+         fc::resize_file( my->segment_file( segments - 1 ), end );
+         my->_segment_sizes[segments - 1] = end;
+      }
+      my->_offsets.resize( block_count );
+      my->_segment_sizes.resize( segments );
+
+      fc::resize_file( my->index_file(), block_count * sizeof(uint64_t) );
+      my->open_index();
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_count",block_count) ) }
+
+   trx_block block_store::fetch( uint32_t block_num )
+   { try {
+      if( block_num >= my->_offsets.size() )
+         FC_THROW_EXCEPTION( key_not_found_exception, "unable to find block ${block_num}", ("block_num",block_num) );
+
+      uint64_t begin, end;
+      my->record( block_num, begin, end );
+      const char* data = my->map( block_num / blocks_per_segment, end ) + begin;
+
+      uint32_t size = 0;
+      memcpy( (char*)&size, data, sizeof(size) );
+      FC_ASSERT( begin + sizeof(size) + size == end, "corrupt block record" );
+
+      trx_block blk;
+      fc::datastream<const char*> ds( data + sizeof(size), size );
+      fc::raw::unpack( ds, blk );
+      return blk;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   void block_store::write_records( uint32_t first, uint32_t last, std::ostream& out )
+   { try {
+      FC_ASSERT( first <= last && last < my->_offsets.size() );
+      while( first <= last )
+      {
+         uint32_t segment  = first / blocks_per_segment;
+         uint32_t seg_last = std::min<uint32_t>( last, (segment + 1) * blocks_per_segment - 1 );
+
+         uint64_t begin, end, unused;
+         my->record( first, begin, unused );
+         my->record( seg_last, unused, end );
+         const char* data = my->map( segment, end );
+         out.write( data + begin, end - begin );
+         first = seg_last + 1;
+      }
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("first",first)("last",last) ) }
+
+} } // bts::blockchain
@@ -0,0 +1,137 @@
+#include <bts/blockchain/block_template.hpp>
+#include <bts/blockchain/config.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      class block_template_impl
+      {
+         public:
+            block_template_impl( chain_database& db, const transaction_pool& pool )
+            :_db(db),_pool(pool),_block_size(0),_fee_rate(0),_pool_removals(0),_lowest_fee_rate(0),_needs_reset(true){}
+
+            chain_database&             _db;
+            const transaction_pool&     _pool;
+            trx_block                   _block;
+            size_t                      _block_size;      ///< of _block, kept as transactions are added
+            block_evaluation_state_ptr  _block_state;
+            transaction_summary         _summary;
+            block_id_type               _head_block_id;   ///< the block the template builds on
+            uint64_t                    _fee_rate;        ///< of the head block
+            uint64_t                    _pool_removals;   ///< _pool.removal_count() when the template was reset
+            uint64_t                    _lowest_fee_rate; ///< of the included transactions
+            bool                        _needs_reset;     ///< a transaction that didn't fit pays more than one that did
+      };
+   }
+
+   block_template::block_template( chain_database& db, const transaction_pool& pool )
+   :my( new detail::block_template_impl( db, pool ) )
+   {
+   }
+
+   block_template::~block_template()
+   {
+   }
+
+   void block_template::reset()
+   {
+      my->_block          = trx_block();
+      my->_block_size     = my->_block.block_size();
+      my->_block_state    = my->_db.get_transaction_validator()->create_block_state();
+      my->_summary        = transaction_summary();
+      my->_head_block_id  = my->_db.head_block_id();
+      my->_fee_rate       = my->_db.get_fee_rate();
+      my->_pool_removals  = my->_pool.removal_count();
+      my->_lowest_fee_rate = 0;
+      my->_needs_reset    = false;
+
+      transaction_pool_snapshot pending = my->_pool.snapshot();
+      for( const pooled_transaction_ptr& trx : *pending )
+         add( trx );
+   }
+
+   bool block_template::add( const pooled_transaction_ptr& trx )
+   {
+      if( !my->_block_state ) return false; // reset() will consider it
+
+      if( my->_block_size + trx->size > BTS_BLOCKCHAIN_MAX_BLOCK_SIZE )
+      {
+         if( trx->fee_rate() > my->_lowest_fee_rate ) my->_needs_reset = true;
+         return false;
+      }
+
+      // the fees as evaluated when the transaction was pooled, the fee rate may have risen since
+      if( trx->fees < 0 || uint64_t(trx->fees) < (trx->size * my->_fee_rate)/1000 )
+      {
+         wlog( "transaction ${id} doesn't pay the minimum fee ${f}",
+               ("id",trx->id)("f",(trx->size * my->_fee_rate)/1000) );
+         return false;
+      }
+
+      try {
+         my->_summary += my->_db.get_transaction_validator()->evaluate( trx->trx, my->_block_state );
+      }
+      catch ( const fc::exception& e )
+      {
+         wlog( "unable to include transaction ${id} in the block template: ${e}", ("id",trx->id)("e",e.to_detail_string()) );
+         return false;
+      }
+
+      my->_block.add_transaction( trx->trx );
+      // the count of trxs in front of them is a varint that may grow by a byte
+      fc::datastream<size_t> count_before, count_after;
+      fc::raw::pack( count_before, fc::unsigned_int( my->_block.trxs.size() - 1 ) );
+      fc::raw::pack( count_after, fc::unsigned_int( my->_block.trxs.size() ) );
+      my->_block_size += trx->size + count_after.tellp() - count_before.tellp();
+      if( my->_block.trxs.size() == 1 || trx->fee_rate() < my->_lowest_fee_rate )
+         my->_lowest_fee_rate = trx->fee_rate();
+      return true;
+   }
+
+   trx_block block_template::generate_block()
+   { try {
+      if( my->_needs_reset ||
+          my->_pool_removals != my->_pool.removal_count() ||
+          my->_head_block_id != my->_db.head_block_id() )
+         reset();
+
+      auto deterministic_trxs = my->_db.generate_deterministic_transactions();
+      auto head_block = my->_db.get_head_block();
+
+      trx_block result = my->_block;
+      result.block_num    = my->_db.head_block_num() + 1;
+      result.prev         = my->_head_block_id;
+      result.trx_mroot    = result.calculate_merkle_root( deterministic_trxs );
+      result.next_fee     = result.calculate_next_fee( my->_fee_rate, result.block_size() );
+      result.total_shares = head_block.total_shares - my->_summary.fees;
+      result.timestamp    = my->_db.get_pow_validator()->get_time();
+      return result;
+   } FC_RETHROW_EXCEPTIONS( warn, "error generating new block" ) }
+
+   block_evaluation_state_ptr block_template::release_block_state( transaction_summary& summary )
+   {
+      FC_ASSERT( my->_block_state, "the block template was not generated" );
+      summary = my->_summary;
+      my->_needs_reset = true;
+      return std::move( my->_block_state );
+   }
+
+   size_t block_template::size()const
+   {
+      return my->_block.trxs.size();
+   }
+
+   size_t block_template::block_size()const
+   {
+      return my->_block_size;
+   }
+
+   int64_t block_template::fees()const
+   {
+      return my->_summary.fees;
+   }
+
+} } // bts::blockchain
@@ -2,13 +2,21 @@
 #include <bts/blockchain/transaction_validator.hpp>
 #include <bts/blockchain/chain_database.hpp>
 #include <bts/blockchain/asset.hpp>
-#include <leveldb/db.h>
+#include <bts/blockchain/signature_cache.hpp>
+#include <bts/blockchain/block_store.hpp>
+#include <bts/blockchain/output_keys.hpp>
+#include <bts/blockchain/flat_hash.hpp>
+#include <bts/blockchain/parallel.hpp>
 #include <bts/db/level_pod_map.hpp>
 #include <bts/db/level_map.hpp>
+#include <bts/db/cached_level_map.hpp>
+#include <bts/db/state_snapshot.hpp>
+#include <bts/db/trace.hpp>
 #include <fc/io/enum_type.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/interprocess/mmap_struct.hpp>
+#include <fc/interprocess/file_mapping.hpp>
 
 #include <fc/filesystem.hpp>
 #include <fc/log/logger.hpp>
@@ -18,16 +26,60 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <unordered_map>
 
 namespace fc {
   template<> struct get_typename<std::vector<uint160>>        { static const char* name()  { return "std::vector<uint160>";  } };
   template<> struct get_typename<fc::ecc::compact_signature>  { static const char* name()  { return "fc::ecc::compact_signature";  } };
 } // namespace fc
 
+namespace bts { namespace blockchain { namespace detail {
+    /**
+     *  An entry in the unspent output set, it holds everything fetch_inputs needs
+     *  so that validation does not have to load the transaction that created the output.
+     */
+    struct unspent_output
+    {
+       trx_num         source;
+       fc::signed_int  delegate_id;
+       trx_output      output;
+    };
+
+    struct undo_spent_output
+    {
+       output_reference  ref;
+       unspent_output    output;
+    };
+
+    /** a record as it was before a block modified it, record is null if the block created it */
+    template<typename Key>
+    struct undo_record
+    {
+       Key                        key;
+       fc::optional<name_record>  record;
+    };
+
+    /**
+     *  Everything store() changed while applying a block, kept so that pop_block can
+     *  unwind the block without searching the indexes.
+     */
+    struct block_undo
+    {
+       std::vector<undo_spent_output>            spent_outputs;
+       std::vector<trx_num>                      added_trxs;
+       std::vector<undo_record<std::string> >    prior_names;
+       std::vector<undo_record<uint32_t> >       prior_delegates;
+    };
+} } } // bts::blockchain::detail
+
+FC_REFLECT( bts::blockchain::detail::unspent_output, (source)(delegate_id)(output) )
+FC_REFLECT( bts::blockchain::detail::undo_spent_output, (ref)(output) )
+FC_REFLECT_TEMPLATE( (typename Key), bts::blockchain::detail::undo_record<Key>, (key)(record) )
+FC_REFLECT( bts::blockchain::detail::block_undo, (spent_outputs)(added_trxs)(prior_names)(prior_delegates) )
 
 
 namespace bts { namespace blockchain {
-    namespace ldb = leveldb;
 
     uint64_t to_bips( uint64_t shares, uint64_t total_shares )
     { try {
@@ -39,14 +91,18 @@ namespace bts { namespace blockchain {
         return big_shares.low_bits(); //(BTS_BLOCKCHAIN_BIP * shares) / total_shares;
     } FC_RETHROW_EXCEPTIONS( warn, "", ("shares",shares)("total_shares",total_shares) ) }
 
+    /** of the delegates.snapshot layout, a snapshot of another version is rebuilt */
+    static const uint32_t delegates_snapshot_version = 1;
+
     namespace detail
     {
        struct vote_del
        {
-          vote_del( int64_t v = 0, uint32_t del = 0 )
-          :votes(v),delegate_id(del){}
-          int64_t votes;
+          vote_del( int64_t v = 0, uint32_t del = 0, uint32_t s = 0 )
+          :votes(v),delegate_id(del),slot(s){}
+          int64_t  votes;
           uint32_t delegate_id;
+          uint32_t slot; ///< position of the record in delegate_index::_records
           friend bool operator == ( const vote_del& a, const vote_del& b )
           {
              return a.votes == b.votes && a.delegate_id == b.delegate_id;
@@ -57,12 +113,234 @@ namespace bts { namespace blockchain {
           }
        };
 
+       /**
+        *  Every delegate record held in contiguous memory along with a rank ordered
+        *  by votes.  Updates only replace the record, the rank is rebuilt by the
+        *  first query after a change so a block that touches many delegates sorts
+        *  them once.
+        *
+        *  Between begin_changes() and commit_changes() the prior record of each
+        *  delegate that changes is kept, so revert_changes() can undo a failed
+        *  batch without the index being copied for every block.
+        */
+       class delegate_index
+       {
+          public:
+             delegate_index():_ranked(true),_tracking(false){}
+
+             void begin_changes()
+             {
+                _prior.clear();
+                _tracking = true;
+             }
+
+             void commit_changes()
+             {
+                _prior.clear();
+                _tracking = false;
+             }
+
+             void revert_changes()
+             {
+                _tracking = false;
+                for( auto itr = _prior.begin(); itr != _prior.end(); ++itr )
+                {
+                   if( itr->second ) update( *itr->second );
+                   else              remove( itr->first );
+                }
+                _prior.clear();
+             }
+
+             const name_record* find( uint32_t delegate_id )const
+             {
+                auto itr = _slots.find( delegate_id );
+                if( itr == _slots.end() ) return nullptr;
+                return &_records[itr->second];
+             }
+
+             void update( const name_record& rec )
+             {
+                save_prior( rec.delegate_id );
+                auto itr = _slots.find( rec.delegate_id );
+                if( itr == _slots.end() )
+                {
+                   _slots[rec.delegate_id] = _records.size();
+                   _records.push_back( rec );
+                   _ranked = false;
+                   return;
+                }
+                auto& cur = _records[itr->second];
+                if( cur.total_votes() != rec.total_votes() ) _ranked = false;
+                cur = rec;
+             }
+
+             void remove( uint32_t delegate_id )
+             {
+                auto itr = _slots.find( delegate_id );
+                if( itr == _slots.end() ) return;
+                save_prior( delegate_id );
+                uint32_t slot = itr->second;
+                _slots.erase( itr );
+                if( slot + 1 != _records.size() )
+                {
+                   _records[slot] = std::move( _records.back() );
+                   _slots[_records[slot].delegate_id] = slot;
+                }
+                _records.pop_back();
+                _ranked = false;
+             }
+
+             /** @return up to count records, most votes first */
+             std::vector<name_record> top( uint32_t count )
+             {
+                if( !_ranked ) rank();
+                std::vector<name_record> result;
+                result.reserve( std::min<size_t>( count, _ranks.size() ) );
+                for( auto itr = _ranks.begin(); itr != _ranks.end() && result.size() < count; ++itr )
+                   result.push_back( _records[itr->slot] );
+                return result;
+             }
+
+             void clear()
+             {
+                _records.clear();
+                _slots.clear();
+                _ranks.clear();
+                _ranked = true;
+                _prior.clear();
+             }
+
+             /** in no particular order */
+             const std::vector<name_record>& records()const { return _records; }
+
+          private:
+             void save_prior( uint32_t delegate_id )
+             {
+                if( !_tracking || _prior.find( delegate_id ) != _prior.end() ) return;
+                auto rec = find( delegate_id );
+                _prior[delegate_id] = rec ? fc::optional<name_record>( *rec ) : fc::optional<name_record>();
+             }
+
+             void rank()
+             {
+                _ranks.resize( _records.size() );
+                for( uint32_t i = 0; i < _records.size(); ++i )
+                   _ranks[i] = vote_del( _records[i].total_votes(), _records[i].delegate_id, i );
+                std::sort( _ranks.begin(), _ranks.end() );
+                _ranked = true;
+             }
+
+             std::vector<name_record>               _records;
+             std::unordered_map<uint32_t,uint32_t>  _slots;
+             std::vector<vote_del>                  _ranks;
+             bool                                   _ranked;
+             /** delegate_id -> record before its first change since begin_changes, null if it didn't exist */
+             std::unordered_map<uint32_t,fc::optional<name_record> > _prior;
+             bool                                   _tracking;
+       };
+
+      /**
+       *  block_num -> block_id, the reverse of blk_id2num.  Every id is kept in memory so that
+       *  peers can be sent the ids of thousands of blocks without reading or hashing their
+       *  headers.  The ids are persisted as a flat array that is appended to as blocks are
+       *  stored and memory mapped to load it.
+       */
+      class block_id_list
+      {
+         public:
+            void open( const fc::path& file )
+            {
+               static_assert( sizeof(block_id_type) == 20, "block ids are stored as 20 raw bytes" );
+               _file = file;
+               _ids.clear();
+               if( fc::exists( _file ) )
+               {
+                  size_t file_size = fc::file_size( _file );
+                  _ids.resize( file_size / sizeof(block_id_type) );
+                  if( _ids.size() )
+                  {
+                     fc::file_mapping fm( _file.generic_string().c_str(), fc::read_only );
+                     fc::mapped_region mr( fm, fc::read_only, 0, _ids.size() * sizeof(block_id_type) );
+                     memcpy( _ids.data(), mr.get_address(), _ids.size() * sizeof(block_id_type) );
+                  }
+               }
+               open_for_append();
+            }
+
+            void close()
+            {
+               _out.close();
+               _ids.clear();
+            }
+
+            /** replaces the whole list, used to rebuild it from the blocks */
+            void assign( std::vector<block_id_type> ids )
+            {
+               _out.close();
+               _ids = std::move(ids);
+               {
+                  std::ofstream out( _file.generic_string().c_str(), std::ios::binary | std::ios::trunc );
+                  out.write( (const char*)_ids.data(), _ids.size() * sizeof(block_id_type) );
+                  FC_ASSERT( out.good(), "unable to write ${file}", ("file",_file) );
+               }
+               open_for_append();
+            }
+
+            /** @param id the id of block size() */
+            void push_back( const block_id_type& id )
+            {
+               _ids.push_back( id );
+               _out.write( (const char*)&id, sizeof(id) );
+               _out.flush();
+               FC_ASSERT( _out.good(), "unable to write ${file}", ("file",_file) );
+            }
+
+            void pop_back()
+            {
+               FC_ASSERT( _ids.size() );
+               _ids.pop_back();
+               _out.close();
+               fc::resize_file( _file, _ids.size() * sizeof(block_id_type) );
+               open_for_append();
+            }
+
+            size_t size()const                  { return _ids.size(); }
+            const block_id_type& back()const     { return _ids.back(); }
+
+            const block_id_type& at( uint32_t block_num )const
+            {
+               if( block_num >= _ids.size() )
+                  FC_THROW_EXCEPTION( key_not_found_exception, "unable to find block ${block_num}", ("block_num",block_num) );
+               return _ids[block_num];
+            }
+
+            /** @return up to count ids starting with block_num */
+            std::vector<block_id_type> range( uint32_t block_num, uint32_t count )const
+            {
+               if( block_num >= _ids.size() ) return std::vector<block_id_type>();
+               auto first = _ids.begin() + block_num;
+               return std::vector<block_id_type>( first, first + std::min<size_t>( count, _ids.end() - first ) );
+            }
+
+         private:
+            void open_for_append()
+            {
+               _out.open( _file.generic_string().c_str(), std::ios::binary | std::ios::app );
+               FC_ASSERT( _out.good(), "unable to open ${file}", ("file",_file) );
+            }
+
+            fc::path                    _file;
+            std::ofstream               _out;
+            std::vector<block_id_type>  _ids;
+      };
+
       // TODO: .01 BTC update private members to use _member naming convention
       class chain_database_impl
       {
          public:
             chain_database_impl()
-            { }
+            :_single_database(false),_owner_index(false),_block_store_enabled(false),_prune_depth(0),_undo(nullptr),_importing(false),_trusted_import(false),_defer_indexes(false),
+             _evaluating_deterministic(false),_sync_block_count(0),_unsynced_writes(0){}
             chain_database*                                     _self;
 
             //std::unique_ptr<ldb::DB> blk_id2num;  // maps blocks to unique IDs
@@ -71,18 +349,47 @@ namespace bts { namespace blockchain {
             bts::db::level_map<trx_num,meta_trx>                meta_trxs;
             bts::db::level_map<uint32_t,signed_block_header>    blocks;
             bts::db::level_map<uint32_t,std::vector<uint160> >  block_trxs;
+            /** the ids of the deterministic transactions of a block, only stored for blocks that have them */
+            bts::db::level_map<uint32_t,std::vector<uint160> >  block_deterministic_trxs;
 
             bts::db::level_map< uint32_t, name_record >         _delegate_records;
             bts::db::level_map< std::string, name_record >      _name_records;
 
-            /**
-             *  track the delegate votes by rank
-             */
-            std::set<vote_del>                                  _votes_to_delegate;
-            std::map<uint32_t, int64_t>                         _delegate_to_votes;
+            /** every output that has not been spent, the most recently used are kept in memory */
+            bts::db::cached_level_map<output_reference,unspent_output> _unspent_outputs;
+
+            /** maps block_num to the changes that block made */
+            bts::db::level_map<uint32_t,block_undo>             _block_undo;
+
+            /** the unspent outputs of _unspent_outputs that have an owner, only open if _owner_index */
+            bts::db::level_map<owner_output_key,uint8_t>        _owner_outputs;
+            bool                                                _owner_index;
+
+            /** the unspent outputs of _unspent_outputs by the transaction that created them */
+            bts::db::level_map<age_output_key,uint8_t>          _age_outputs;
+
+            /** set when all of the above share one database as prefixed keyspaces */
+            bool                                                _single_database;
+            bts::db::kv_backend_ptr                             _shared_db;
+
+            /** mirrors _delegate_records and tracks the delegates by rank */
+            delegate_index                                      _delegates;
+            /** the records of _delegates as of the head block, written by close() */
+            fc::path                                            _delegates_snapshot;
+
+            /** the id of every block in the chain, indexed by block_num */
+            block_id_list                                       _block_ids;
+
+            /** whole blocks, only open if _block_store_enabled */
+            block_store                                         _block_store;
+            bool                                                _block_store_enabled;
+            /** blocks below the head that keep their undo records and spent transactions, 0 keeps all */
+            uint32_t                                            _prune_depth;
 
             pow_validator_ptr                                   _pow_validator;
             transaction_validator_ptr                           _trx_validator;
+            /** held by the reads of transactions evaluated in parallel, see lock_reads() */
+            mutable std::recursive_mutex                        _read_mutex;
             address                                             _trustee;
 
 
@@ -90,38 +397,403 @@ namespace bts { namespace blockchain {
             trx_block                                           head_block;
             block_id_type                                       head_block_id;
 
-            void update_delegate( const name_record& rec  )
+            /** the undo record of the block being stored, null while storing genesis */
+            block_undo*                                         _undo;
+            std::set<std::string>                               _undo_names;
+            std::set<uint32_t>                                  _undo_delegates;
+
+            /** import_blocks holds the write batch open across blocks, store() leaves committing to it */
+            bool                                                _importing;
+            /** import_blocks of a trusted file, validate() skips the trustee signature */
+            bool                                                _trusted_import;
+            /** blocks are stored without updating trx_id2num and blk_id2num, see set_defer_indexes */
+            bool                                                _defer_indexes;
+            /** see chain_database::is_evaluating_deterministic_transactions */
+            bool                                                _evaluating_deterministic;
+
+            /** evaluates the transactions the chain generated for the next block, after those of the block */
+            transaction_summary evaluate_deterministic( const signed_transactions& deterministic_trxs,
+                                                        const block_evaluation_state_ptr& state )
+            {
+               transaction_summary summary;
+               _evaluating_deterministic = true;
+               try {
+                  for( const signed_transaction& strx : deterministic_trxs )
+                     summary += _trx_validator->evaluate( strx, state );
+               } catch ( ... ) { _evaluating_deterministic = false; throw; }
+               _evaluating_deterministic = false;
+               return summary;
+            }
+
+            /**
+             *  All mutations made while applying a block are staged and then
+             *  written with one kv_batch per database.
+             */
+            void begin_batch()
+            {
+                blk_id2num.begin_batch();
+                trx_id2num.begin_batch();
+                meta_trxs.begin_batch();
+                blocks.begin_batch();
+                block_trxs.begin_batch();
+                block_deterministic_trxs.begin_batch();
+                _delegate_records.begin_batch();
+                _name_records.begin_batch();
+                _unspent_outputs.begin_batch();
+                _block_undo.begin_batch();
+                if( _owner_index ) _owner_outputs.begin_batch();
+                _age_outputs.begin_batch();
+                _delegates.begin_changes();
+            }
+
+            /** see chain_database_tuning::sync_block_count */
+            uint32_t                                            _sync_block_count;
+            fc::microseconds                                    _sync_interval;
+            uint32_t                                            _unsynced_writes;
+            fc::time_point                                      _last_sync;
+
+            /** @return true if the write about to be committed should be synced, by the group commit policy */
+            bool sync_due()
+            {
+                ++_unsynced_writes;
+                if( _sync_block_count && _unsynced_writes >= _sync_block_count ) return true;
+                return _sync_interval.count() > 0 && fc::time_point::now() - _last_sync >= _sync_interval;
+            }
+
+            /** blocks is committed last so that a partially written block is not seen as the head on open */
+            void commit_batch( bool force_sync = false )
             {
-                auto new_votes = rec.votes_for - rec.votes_against;
-                auto itr = _delegate_to_votes.find( rec.delegate_id );
-                if( itr != _delegate_to_votes.end() )
+                const bool sync = sync_due() || force_sync;
+                if( _shared_db )
+                {
+                   auto batch = _shared_db->create_batch();
+                   blk_id2num.flush_batch( *batch );
+                   trx_id2num.flush_batch( *batch );
+                   meta_trxs.flush_batch( *batch );
+                   block_trxs.flush_batch( *batch );
+                   block_deterministic_trxs.flush_batch( *batch );
+                   _delegate_records.flush_batch( *batch );
+                   _name_records.flush_batch( *batch );
+                   _unspent_outputs.flush_batch( *batch );
+                   _block_undo.flush_batch( *batch );
+                   if( _owner_index ) _owner_outputs.flush_batch( *batch );
+                   _age_outputs.flush_batch( *batch );
+                   blocks.flush_batch( *batch );
+
+                   _shared_db->write( *batch, sync );
+                }
+                else
+                {
+                   // each database has its own log, syncing a group means syncing all of them
+                   blk_id2num.commit_batch( sync );
+                   trx_id2num.commit_batch( sync );
+                   meta_trxs.commit_batch( sync );
+                   block_trxs.commit_batch( sync );
+                   block_deterministic_trxs.commit_batch( sync );
+                   _delegate_records.commit_batch( sync );
+                   _name_records.commit_batch( sync );
+                   _unspent_outputs.commit_batch( sync );
+                   _block_undo.commit_batch( sync );
+                   if( _owner_index ) _owner_outputs.commit_batch( sync );
+                   _age_outputs.commit_batch( sync );
+                   blocks.commit_batch( sync );
+                }
+                _delegates.commit_changes();
+                if( sync )
                 {
-                    ilog( "old votes: ${v}  new votes ${nv}", ("v",itr->second)("nv",new_votes) );
-                    _votes_to_delegate.erase( vote_del( itr->second, itr->first ));
+                   _unsynced_writes = 0;
+                   _last_sync       = fc::time_point::now();
                 }
-                _votes_to_delegate.insert( vote_del(new_votes, rec.delegate_id) );
-                _delegate_to_votes[ rec.delegate_id ] = new_votes;
+            }
 
-                wlog( "store delegate ${d}", ("d",rec) );
+            /** makes the writes since the last sync durable, an empty synced batch flushes each log */
+            void sync()
+            {
+                if( _unsynced_writes == 0 || (!_sync_block_count && !_sync_interval.count()) ) return;
+                begin_batch();
+                commit_batch( true );
+            }
+
+            void abort_batch()
+            {
+                blk_id2num.abort_batch();
+                trx_id2num.abort_batch();
+                meta_trxs.abort_batch();
+                blocks.abort_batch();
+                block_trxs.abort_batch();
+                block_deterministic_trxs.abort_batch();
+                _delegate_records.abort_batch();
+                _name_records.abort_batch();
+                _unspent_outputs.abort_batch();
+                _block_undo.abort_batch();
+                _owner_outputs.abort_batch();
+                _age_outputs.abort_batch();
+                _delegates.revert_changes();
+            }
+
+            void update_delegate( const name_record& rec  )
+            {
+                save_prior_delegate( rec.delegate_id );
+                _delegates.update( rec );
                 _delegate_records.store( rec.delegate_id, rec );
             }
 
+            /** restores the vote ranking and record of a delegate, rec is null if it did not exist */
+            void restore_delegate( uint32_t delegate_id, const fc::optional<name_record>& rec )
+            {
+                if( rec )
+                {
+                   update_delegate( *rec );
+                   return;
+                }
+                _delegates.remove( delegate_id );
+                _delegate_records.remove( delegate_id );
+            }
+
+            /** like find_record for any value, @return false if k was not found */
+            template<typename Map, typename Key, typename Value>
+            static bool find_value( Map& records, const Key& k, Value& v )
+            {
+                return records.with_value( k, [&]( const char* data, size_t size )
+                {
+                   fc::datastream<const char*> ds( data, size );
+                   fc::raw::unpack( ds, v );
+                });
+            }
+
+            template<typename Map, typename Key>
+            static fc::optional<name_record> find_record( Map& records, const Key& k )
+            {
+                name_record rec;
+                bool found = records.with_value( k, [&]( const char* data, size_t size )
+                {
+                   fc::datastream<const char*> ds( data, size );
+                   fc::raw::unpack( ds, rec );
+                });
+                if( found ) return rec;
+                return fc::optional<name_record>();
+            }
+
+            /** records the state of a delegate the first time the current block modifies it */
+            void save_prior_delegate( uint32_t delegate_id )
+            {
+                if( !_undo || !_undo_delegates.insert( delegate_id ).second ) return;
+                undo_record<uint32_t> prior;
+                prior.key    = delegate_id;
+                if( auto rec = _delegates.find( delegate_id ) ) prior.record = *rec;
+                _undo->prior_delegates.push_back( prior );
+            }
+
+            void save_prior_name( const std::string& name )
+            {
+                if( !_undo || !_undo_names.insert( name ).second ) return;
+                undo_record<std::string> prior;
+                prior.key    = name;
+                prior.record = find_record( _name_records, name );
+                _undo->prior_names.push_back( prior );
+            }
+
+            /** pts addresses are indexed by the hash of all 25 bytes so they can't be mistaken for an address */
+            static fc::ripemd160 owner_key( const address& a )     { return a.addr; }
+            static fc::ripemd160 owner_key( const pts_address& a ) { return fc::ripemd160::hash( a.addr.data, sizeof(a.addr) ); }
+
+            /** @return false if out has no owner in the index */
+            static bool owner_of( const trx_output& out, fc::ripemd160& owner )
+            {
+               switch( out.claim_func )
+               {
+                  case claim_by_signature:
+                     owner = owner_key( out.as<claim_by_signature_output>().owner );
+                     return true;
+                  case claim_by_pts:
+                     owner = owner_key( out.as<claim_by_pts_output>().owner );
+                     return true;
+                  default:
+                     return false;
+               }
+            }
+
+            /** keeps the age and owner indexes in step with a change of _unspent_outputs */
+            void index_output( const output_reference& ref, const trx_num& source, const trx_output& out, bool unspent )
+            {
+               age_output_key age;
+               age.source = source;
+               age.ref    = ref;
+               if( unspent ) _age_outputs.store( age, 0 );
+               else          _age_outputs.remove( age );
+
+               owner_output_key key;
+               if( !_owner_index || !owner_of( out, key.owner ) ) return;
+               key.ref = ref;
+               if( unspent ) _owner_outputs.store( key, 0 );
+               else          _owner_outputs.remove( key );
+            }
+
+            /** entries written with each batch of rebuild_hash_indexes, the batch is sorted by key */
+            static const uint32_t hash_index_batch_size = 100000;
+
+            /**
+             *  Rebuilds blk_id2num and trx_id2num from blocks and meta_trxs, which are read in
+             *  order.  Each batch is staged in the key order of the index before it is written,
+             *  so LevelDB receives runs of sorted keys instead of one random key per transaction.
+             */
+            void rebuild_hash_indexes()
+            { try {
+                ilog( "building the block and transaction id indexes" );
+                uint32_t staged = 0;
+                blk_id2num.begin_batch();
+                for( auto itr = blocks.begin(); itr.valid(); ++itr )
+                {
+                   blk_id2num.store( itr.value().id(), itr.key() );
+                   if( ++staged % hash_index_batch_size == 0 ) { blk_id2num.commit_batch(); blk_id2num.begin_batch(); }
+                }
+                blk_id2num.commit_batch();
+
+                staged = 0;
+                trx_id2num.begin_batch();
+                for( auto itr = meta_trxs.begin(); itr.valid(); ++itr )
+                {
+                   trx_id2num.store( itr.value().id(), itr.key() );
+                   if( ++staged % hash_index_batch_size == 0 ) { trx_id2num.commit_batch(); trx_id2num.begin_batch(); }
+                }
+                trx_id2num.commit_batch();
+            } FC_RETHROW_EXCEPTIONS( warn, "error building the block and transaction id indexes" ) }
+
+            /** builds whichever of the age and owner indexes are wanted but empty */
+            void build_output_indexes()
+            { try {
+                bool age   = !_age_outputs.begin().valid();
+                bool owner = _owner_index && !_owner_outputs.begin().valid();
+                if( !age && !owner ) return;
+                ilog( "building output indexes" );
+
+                // the entries of an index that is not empty are rewritten as they are
+                begin_batch();
+                auto itr = _unspent_outputs.begin();
+                while( itr.valid() )
+                {
+                   index_output( itr.key(), itr.value().source, itr.value().output, true );
+                   ++itr;
+                }
+                commit_batch();
+            } FC_RETHROW_EXCEPTIONS( warn, "error building output indexes" ) }
+
             void mark_spent( const output_reference& o, const trx_num& intrx, uint16_t in )
             {
-               auto tid    = trx_id2num.fetch( o.trx_hash );
+               auto unspent = _unspent_outputs.find( o );
+               auto tid     = unspent ? unspent->source : trx_id2num.fetch( o.trx_hash );
+
                meta_trx   mtrx   = meta_trxs.fetch( tid );
                FC_ASSERT( mtrx.meta_outputs.size() > o.output_idx.value );
 
+               if( _undo )
+               {
+                  undo_spent_output spent;
+                  spent.ref = o;
+                  if( unspent )
+                  {
+                     spent.output = *unspent;
+                  }
+                  else
+                  {
+                     FC_ASSERT( mtrx.outputs.size() > o.output_idx.value );
+                     spent.output.source      = tid;
+                     spent.output.delegate_id = mtrx.vote;
+                     spent.output.output      = mtrx.outputs[o.output_idx.value];
+                  }
+                  _undo->spent_outputs.push_back( spent );
+               }
+               if( unspent )                                          index_output( o, unspent->source, unspent->output, false );
+               else if( mtrx.outputs.size() > o.output_idx.value )   index_output( o, tid, mtrx.outputs[o.output_idx.value], false );
+               _unspent_outputs.remove( o );
+
                mtrx.meta_outputs[o.output_idx.value].trx_id    = intrx;
                mtrx.meta_outputs[o.output_idx.value].input_num = in;
 
                meta_trxs.store( tid, mtrx );
             }
 
+            /** unspent outputs read by each thread of prefetch_inputs */
+            static const uint32_t prefetch_inputs_per_thread = 64;
+
+            /** transactions evaluated by each thread of evaluate_in_parallel, and the smallest block it is used for */
+            static const uint32_t parallel_evaluation_per_thread = 32;
+
+            /**
+             *  Evaluates trxs on the worker threads, each range against a block state of its own,
+             *  and merges the states into block_state in block order.  Inputs spent twice have
+             *  already been rejected, so the transactions only share what their states merge.
+             *
+             *  @return false if a transaction fails or the states conflict, block_state is then
+             *          incomplete and the block must be evaluated serially, which reports the
+             *          first error in block order
+             */
+            bool evaluate_in_parallel( const signed_transactions& trxs, uint64_t fee_rate,
+                                       const block_evaluation_state_ptr& block_state, transaction_summary& summary )
+            {
+               BTS_TRACE_SPAN( "chain_database::evaluate_in_parallel" );
+               std::vector<block_evaluation_state_ptr> range_states( trxs.size() ); // at the first transaction of each range
+               std::vector<transaction_summary>        summaries( trxs.size() );
+               std::vector<char>                       failed( trxs.size() );
+               parallel_for( trxs.size(), parallel_evaluation_per_thread, [&]( size_t begin, size_t end )
+               {
+                  auto range_state = _trx_validator->create_block_state();
+                  range_states[begin] = range_state;
+                  for( size_t i = begin; i < end; ++i )
+                  {
+                     try
+                     {
+                        summaries[i] = _trx_validator->evaluate( trxs[i], range_state );
+                        failed[i]    = trxs[i].version != 0 || !(summaries[i].fees >= (trxs[i].size() * fee_rate)/1000);
+                     }
+                     catch ( ... )
+                     {
+                        failed[i] = true;
+                     }
+                     if( failed[i] ) return;
+                  }
+               });
+
+               for( size_t i = 0; i < trxs.size(); ++i )
+               {
+                  if( failed[i] ) return false;
+                  if( range_states[i] && !block_state->merge( *range_states[i] ) ) return false;
+                  summary += summaries[i];
+               }
+               return true;
+            }
+
+            /**
+             *  Reads the unspent outputs that the inputs of trxs spend into the cache of
+             *  _unspent_outputs before the transactions are evaluated.  The references are
+             *  sorted, which is the key order of _unspent_outputs, and deduplicated so that
+             *  the reads of a block are one pass over the index instead of a random read per
+             *  input, split over threads.
+             */
+            void prefetch_inputs( const signed_transactions& trxs )
+            { try {
+               BTS_TRACE_SPAN( "chain_database::prefetch_inputs" );
+               std::vector<output_reference> refs;
+               for( const signed_transaction& trx : trxs )
+                  for( const trx_input& in : trx.inputs )
+                     refs.push_back( in.output_ref );
+               std::sort( refs.begin(), refs.end() );
+               refs.erase( std::unique( refs.begin(), refs.end() ), refs.end() );
+
+               _unspent_outputs.prefetch( refs, []( size_t count, const std::function<void( size_t, size_t )>& read )
+               {
+                  parallel_for( count, prefetch_inputs_per_thread, read );
+               });
+            } FC_RETHROW_EXCEPTIONS( warn, "error prefetching inputs" ) }
+
             trx_output get_output( const output_reference& ref )
             { try {
+               auto unspent = _unspent_outputs.find( ref );
+               if( unspent ) return unspent->output;
+
                auto tid    = trx_id2num.fetch( ref.trx_hash );
-               meta_trx   mtrx   = meta_trxs.fetch( tid );
+               meta_trx   mtrx;
+               fetch_trx( tid, mtrx );
                FC_ASSERT( mtrx.outputs.size() > ref.output_idx.value );
                return mtrx.outputs[ref.output_idx.value];
             } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref) ) }
@@ -134,8 +806,20 @@ namespace bts { namespace blockchain {
             {
                //ilog( "trxid: ${id}   ${tn}\n\n  ${trx}\n\n", ("id",t.id())("tn",tn)("trx",t) );
 
-               trx_id2num.store( t.id(), tn );
+               auto trx_id = t.id();
+               if( !_defer_indexes ) trx_id2num.store( trx_id, tn );
                meta_trxs.store( tn, meta_trx(t) );
+               if( _undo ) _undo->added_trxs.push_back( tn );
+
+               for( uint32_t o = 0; o < t.outputs.size(); ++o )
+               {
+                  unspent_output unspent;
+                  unspent.source      = tn;
+                  unspent.delegate_id = t.vote;
+                  unspent.output      = t.outputs[o];
+                  _unspent_outputs.store( output_reference( trx_id, o ), unspent );
+                  index_output( output_reference( trx_id, o ), tn, t.outputs[o], true );
+               }
 
                for( uint16_t i = 0; i < t.inputs.size(); ++i )
                {
@@ -143,16 +827,25 @@ namespace bts { namespace blockchain {
                }
             }
 
-            /** the genesis block requires some special treatment and initialization */
+            /**
+             *  The genesis block requires some special treatment and initialization.
+             *
+             *  The votes of each output are rounded to bips as they always were and summed per
+             *  delegate, so that each delegate is updated once.  The whole genesis is written in
+             *  the one batch of push_block, a genesis that fails to store leaves nothing behind.
+             */
             void store_genesis( const trx_block& b, 
                                 const signed_transactions& deterministic_trxs, 
                                 const block_evaluation_state_ptr& state  )
             { try {
                 std::vector<uint160> trxs_ids;
+                trxs_ids.reserve( b.trxs.size() );
                 std::map<int32_t,uint64_t> delegate_votes;
+                std::map<int32_t,uint64_t> delegate_bips;
                 for( uint32_t i = 1; i <= 100; ++i )
                 {
                    delegate_votes[i] = 0;
+                   delegate_bips[i]  = 0;
                 }
                 for( uint32_t cur_trx = 0 ; cur_trx < b.trxs.size(); ++cur_trx )
                 {
@@ -173,30 +866,28 @@ namespace bts { namespace blockchain {
                     }
                     else // cur_trx != 0
                     {
-                       ilog( " processing transaction ${o}", ("o",cur_trx) );
-                       name_record rec = _delegate_records.fetch( b.trxs[cur_trx].vote );
                        // first transaction registers names... the rest are initial balance
+                       auto votes = delegate_votes.find( b.trxs[cur_trx].vote );
+                       FC_ASSERT( votes != delegate_votes.end() );
+                       uint64_t& bips = delegate_bips[b.trxs[cur_trx].vote];
                        for( uint32_t o = 0; o < b.trxs[cur_trx].outputs.size(); ++o )
                        {
-                          ilog( "   processing output  ${o}  ${data}", ("o",o)("data",b.trxs[cur_trx].outputs[o]) );
-                          FC_ASSERT( delegate_votes.find( b.trxs[cur_trx].vote ) != delegate_votes.end() );
-                          delegate_votes[b.trxs[cur_trx].vote] += b.trxs[cur_trx].outputs[o].amount.get_rounded_amount();
-                          ilog( "total_shares: ${total}", ("total",b.total_shares) );
-                          rec.votes_for += to_bips( b.trxs[cur_trx].outputs[o].amount.get_rounded_amount(), b.total_shares );
-                          ilog( "votes for: ${v}", ("v",rec.votes_for) );
-                          ilog( "rec: ${rc}", ("rc",rec) );
+                          votes->second += b.trxs[cur_trx].outputs[o].amount.get_rounded_amount();
+                          bips          += to_bips( b.trxs[cur_trx].outputs[o].amount.get_rounded_amount(), b.total_shares );
                        }
-                       ilog( "updating delegate..." );
-                       update_delegate( rec );
                     }
                 }
-                elog( "total votes:\n ${e}", ("e",fc::json::to_pretty_string( delegate_votes) ) );
+
                 uint64_t sum = 0;
-                for( auto i : delegate_votes )
+                for( const auto& votes : delegate_votes )
                 {
-                   sum += i.second;
+                   sum += votes.second;
+                   if( votes.second == 0 ) continue;
+                   name_record rec = _delegate_records.fetch( votes.first );
+                   rec.votes_for += delegate_bips[votes.first];
+                   update_delegate( rec );
                 }
-                elog( "grand total: ${g}", ("g",sum) );
+                ilog( "genesis block of ${n} transactions, grand total: ${g}", ("n",b.trxs.size())("g",sum) );
 
                 head_block    = b;
                 head_block_id = b.id();
@@ -204,7 +895,7 @@ namespace bts { namespace blockchain {
                 blocks.store( b.block_num, b );
                 block_trxs.store( b.block_num, trxs_ids );
 
-                blk_id2num.store( b.id(), b.block_num );
+                if( !_defer_indexes ) blk_id2num.store( b.id(), b.block_num );
             }  FC_RETHROW_EXCEPTIONS( warn, "error storing genesis block " ) } // store_genesis
 
 
@@ -218,7 +909,51 @@ namespace bts { namespace blockchain {
                    store_genesis( b, deterministic_trxs, state );
                    return;
                 }
+                block_undo undo;
+                _undo = &undo;
+                _undo_names.clear();
+                _undo_delegates.clear();
+                try {
+                   store_block( b, deterministic_trxs, state );
+                } catch ( ... ) { _undo = nullptr; throw; }
+                _undo = nullptr;
+                _block_undo.store( b.block_num, undo );
+                if( _prune_depth && b.block_num > _prune_depth ) prune( b.block_num - _prune_depth );
+            } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+            /**
+             *  Drops the undo record of block_num, which can no longer be popped, and every transaction
+             *  whose outputs were all spent by block_num or before.  Those are the transactions the
+             *  undo record has added and spent from, the others are dropped with a later block.
+             *  Reads see the writes of the open batch, so blocks imported in one batch are pruned too.
+             */
+            void prune( uint32_t block_num )
+            {
+                block_undo undo;
+                if( !find_value( _block_undo, block_num, undo ) ) return;
+
+                std::set<trx_num> candidates( undo.added_trxs.begin(), undo.added_trxs.end() );
+                for( const undo_spent_output& spent : undo.spent_outputs )
+                   candidates.insert( spent.output.source );
+
+                meta_trx mtrx;
+                for( const trx_num& tn : candidates )
+                {
+                   if( !find_value( meta_trxs, tn, mtrx ) ) continue;
+                   bool spent = mtrx.meta_outputs.size() == mtrx.outputs.size();
+                   for( uint32_t o = 0; spent && o < mtrx.meta_outputs.size(); ++o )
+                      spent = mtrx.meta_outputs[o].is_spent() && mtrx.meta_outputs[o].trx_id.block_num <= block_num;
+                   if( spent ) meta_trxs.remove( tn );
+                }
+                _block_undo.remove( block_num );
+            }
+
+            void store_block( const trx_block& b, 
+                              const signed_transactions& deterministic_trxs, 
+                              const block_evaluation_state_ptr& state  )
+            {
                 std::vector<uint160> trxs_ids;
+                std::vector<uint160> deterministic_ids;
 
                 // store individual transactions
                 for( uint32_t cur_trx = 0; cur_trx < b.trxs.size(); ++cur_trx )
@@ -230,51 +965,205 @@ namespace bts { namespace blockchain {
                 // store deterministic transactions
                 for( const signed_transaction& trx : deterministic_trxs )
                 {
-                   store( trx, trx_num( b.block_num, trxs_ids.size() ) );
-                   // TODO: why don't we include this here... do determinsitic trxs not
-                   // get included in the merkel root... does this hinder light weight
-                   // clients.
-                  // trxs_ids.push_back( trx.id() );
+                   store( trx, trx_num( b.block_num, trxs_ids.size() + deterministic_ids.size() ) );
+                   deterministic_ids.push_back( trx.id() );
                 }
                 head_block    = b;
                 head_block_id = b.id();
 
                 blocks.store( b.block_num, b );
                 block_trxs.store( b.block_num, trxs_ids );
+                // they follow trxs_ids as leaves of the merkle tree
+                if( deterministic_ids.size() ) block_deterministic_trxs.store( b.block_num, deterministic_ids );
 
-                blk_id2num.store( b.id(), b.block_num );
+                if( !_defer_indexes ) blk_id2num.store( b.id(), b.block_num );
                 
 
                 // update name name records...
-                for( auto item : state->_name_outputs )
+                for( const auto& item : state->_name_outputs )
                 {
                    update_name_record( item.first, item.second );
                 }
 
-                // update votes
-                for( auto item : state->_input_votes )
+                // update votes, each delegate is written once with the net change of the block.
+                // The inputs and outputs of a delegate are rounded to bips separately, as every
+                // node has always done, netting the shares first would round differently.
+                std::map<uint32_t,std::pair<int64_t,int64_t> > vote_changes; // delegate_id -> (for, against)
+                for( const auto& item : state->_input_votes )
                 {
-                   auto rec = _delegate_records.fetch( abs(item.first) );
+                   auto& change = vote_changes[abs(item.first)];
                    if( item.first < 0 )
-                      rec.votes_against -= to_bips(item.second,b.total_shares);
+                      change.second -= to_bips( item.second, b.total_shares );
                    else
-                      rec.votes_for     -= to_bips(item.second,b.total_shares);
-                   update_delegate( rec );
+                      change.first  -= to_bips( item.second, b.total_shares );
                 }
-                for( auto item : state->_output_votes )
+                for( const auto& item : state->_output_votes )
                 {
-                   auto rec = _delegate_records.fetch( abs(item.first) );
+                   auto& change = vote_changes[abs(item.first)];
                    if( item.first < 0 )
-                      rec.votes_against += to_bips( item.second, b.total_shares );
+                      change.second += to_bips( item.second, b.total_shares );
                    else
-                      rec.votes_for     += to_bips( item.second, b.total_shares );
+                      change.first  += to_bips( item.second, b.total_shares );
+                }
+                for( auto itr = vote_changes.begin(); itr != vote_changes.end(); ++itr )
+                {
+                   auto cur = _delegates.find( itr->first );
+                   if( !cur )
+                   {
+                      FC_THROW_EXCEPTION( key_not_found_exception, "unknown delegate ${d}", ("d",itr->first) );
+                   }
+                   name_record rec = *cur;
+                   rec.votes_for     += itr->second.first;
+                   rec.votes_against += itr->second.second;
                    update_delegate( rec );
                 }
+            }
 
-            } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+            /** unwinds the head block using the undo record written when it was stored */
+            void pop_head_block()
+            { try {
+                FC_ASSERT( head_block.block_num != 0 && head_block.block_num != trx_num::invalid_block_num,
+                           "the genesis block cannot be popped" );
+                auto block_num = head_block.block_num;
+                block_undo undo;
+                FC_ASSERT( find_value( _block_undo, block_num, undo ),
+                           "blocks more than the prune depth below the head cannot be popped", ("prune_depth",_prune_depth) );
+
+                // outputs are restored before the transactions are removed so that an output
+                // created and spent within the block is removed as well
+                for( auto itr = undo.spent_outputs.rbegin(); itr != undo.spent_outputs.rend(); ++itr )
+                {
+                   meta_trx mtrx = meta_trxs.fetch( itr->output.source );
+                   FC_ASSERT( mtrx.meta_outputs.size() > itr->ref.output_idx.value );
+                   mtrx.meta_outputs[itr->ref.output_idx.value] = meta_trx_output();
+                   meta_trxs.store( itr->output.source, mtrx );
+                   _unspent_outputs.store( itr->ref, itr->output );
+                   index_output( itr->ref, itr->output.source, itr->output.output, true );
+                }
+
+                for( auto itr = undo.added_trxs.rbegin(); itr != undo.added_trxs.rend(); ++itr )
+                {
+                   meta_trx mtrx = meta_trxs.fetch( *itr );
+                   auto trx_id = mtrx.id();
+                   for( uint32_t o = 0; o < mtrx.outputs.size(); ++o )
+                   {
+                      _unspent_outputs.remove( output_reference( trx_id, o ) );
+                      index_output( output_reference( trx_id, o ), *itr, mtrx.outputs[o], false );
+                   }
+                   trx_id2num.remove( trx_id );
+                   meta_trxs.remove( *itr );
+                }
+
+                for( auto itr = undo.prior_names.rbegin(); itr != undo.prior_names.rend(); ++itr )
+                {
+                   if( itr->record ) _name_records.store( itr->key, *itr->record );
+                   else              _name_records.remove( itr->key );
+                }
+                for( auto itr = undo.prior_delegates.rbegin(); itr != undo.prior_delegates.rend(); ++itr )
+                {
+                   restore_delegate( itr->key, itr->record );
+                }
+
+                blk_id2num.remove( head_block_id );
+                block_trxs.remove( block_num );
+                block_deterministic_trxs.remove( block_num );
+                blocks.remove( block_num );
+                _block_undo.remove( block_num );
+
+                head_block    = blocks.fetch( block_num - 1 );
+                head_block_id = head_block.id();
+            } FC_RETHROW_EXCEPTIONS( warn, "unable to pop block ${b}", ("b",head_block.block_num) ) }
+
+            /**
+             *  Reads a block from LevelDB, one read for the header and one per transaction.  The
+             *  transactions are read by their position in the block rather than through trx_id2num,
+             *  which is not written while the indexes are deferred.
+             */
+            trx_block fetch_indexed_block( uint32_t block_num )
+            {
+                trx_block fb = blocks.fetch( block_num );
+                auto trx_ids = block_trxs.fetch( block_num );
+                fb.trxs.reserve( trx_ids.size() );
+                meta_trx mtrx;
+                for( uint32_t i = 0; i < trx_ids.size(); ++i )
+                {
+                   fetch_trx( trx_num( block_num, i ), mtrx );
+                   fb.trxs.push_back( mtrx );
+                }
+                return fb;
+            }
+
+            /**
+             *  A transaction dropped by prune() is read back from the block store with its outputs
+             *  reported as spent by the transaction itself, which spent them is not kept.
+             */
+            void fetch_trx( const trx_num& t, meta_trx& trx )
+            {
+                // trx may hold the cache of the transaction it was last fetched into
+                trx.invalidate_cache();
+                if( find_value( meta_trxs, t, trx ) ) return;
+                if( !_block_store.is_open() || t.block_num >= _block_store.size() )
+                   FC_THROW_EXCEPTION( key_not_found_exception, "unable to find transaction ${t}", ("t",t) );
+
+                auto blk = _block_store.fetch( t.block_num );
+                if( t.trx_idx >= blk.trxs.size() )
+                   FC_THROW_EXCEPTION( key_not_found_exception, "unable to find transaction ${t}", ("t",t) );
+                trx = meta_trx( blk.trxs[t.trx_idx] );
+                for( meta_trx_output& out : trx.meta_outputs )
+                {
+                   out.trx_id    = t;
+                   out.input_num = trx_num::invalid_output_num;
+                }
+            }
+
+            /**
+             *  The store is appended to after the blocks are committed, so it can be missing the
+             *  last blocks or still have popped ones.  Blocks that are no longer those of the chain
+             *  are truncated and the missing ones are appended from LevelDB.
+             */
+            void sync_block_store()
+            { try {
+                uint32_t block_count = _block_ids.size();
+                uint32_t keep        = std::min<uint32_t>( _block_store.size(), block_count );
+                while( keep > 0 && _block_store.fetch( keep - 1 ).id() != _block_ids.at( keep - 1 ) )
+                   --keep;
+                _block_store.truncate( keep );
+
+                if( keep < block_count )
+                   ilog( "appending blocks ${first} to ${last} to the block store", ("first",keep)("last",block_count - 1) );
+                for( uint32_t block_num = keep; block_num < block_count; ++block_num )
+                   _block_store.append( fetch_indexed_block( block_num ) );
+            } FC_RETHROW_EXCEPTIONS( warn, "error building the block store" ) }
+
+            /** databases created before the unspent output set existed have to build it once */
+            void rebuild_unspent_outputs()
+            { try {
+                ilog( "building unspent output index" );
+                begin_batch();
+                auto itr = meta_trxs.begin();
+                while( itr.valid() )
+                {
+                   const meta_trx& mtrx = itr.value();
+                   auto trx_id = mtrx.id();
+                   for( uint32_t o = 0; o < mtrx.outputs.size(); ++o )
+                   {
+                      if( o < mtrx.meta_outputs.size() && mtrx.meta_outputs[o].is_spent() )
+                         continue;
+                      unspent_output unspent;
+                      unspent.source      = itr.key();
+                      unspent.delegate_id = mtrx.vote;
+                      unspent.output      = mtrx.outputs[o];
+                      _unspent_outputs.store( output_reference( trx_id, o ), unspent );
+                      index_output( output_reference( trx_id, o ), itr.key(), mtrx.outputs[o], true );
+                   }
+                   ++itr;
+                }
+                commit_batch();
+            } FC_RETHROW_EXCEPTIONS( warn, "error building unspent output index" ) }
 
             void update_name_record( const std::string& name, const claim_name_output& out )
             {
+                save_prior_name( name );
                 auto current_record = _self->lookup_name( name );
                 if( current_record )
                 {
@@ -296,8 +1185,206 @@ namespace bts { namespace blockchain {
                 }
             }
       };
+
+      /** a LevelDB snapshot of every index of a chain_database_impl, only read through const methods */
+      class chain_snapshot_impl
+      {
+         public:
+            chain_snapshot_impl( const chain_database_impl& db )
+            :_db(db),
+             _head_block(db.head_block),
+             _head_block_id(db.head_block_id),
+             _blk_id2num( db.blk_id2num.snapshot() ),
+             _trx_id2num( db.trx_id2num.snapshot() ),
+             _meta_trxs( db.meta_trxs.snapshot() ),
+             _blocks( db.blocks.snapshot() ),
+             _block_trxs( db.block_trxs.snapshot() ),
+             _block_deterministic_trxs( db.block_deterministic_trxs.snapshot() ),
+             _delegate_records( db._delegate_records.snapshot() ),
+             _name_records( db._name_records.snapshot() ),
+             _unspent_outputs( db._unspent_outputs.snapshot() )
+            {
+               if( db._owner_index ) _owner_outputs = db._owner_outputs.snapshot();
+            }
+
+            template<typename Value, typename Map, typename Key>
+            static Value fetch( const Map& map, const Key& k, const bts::db::level_snapshot& snapshot )
+            {
+               Value v;
+               if( !map.fetch( k, v, snapshot ) )
+               {
+                  FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+               }
+               return v;
+            }
+
+            const chain_database_impl&  _db;
+            signed_block_header         _head_block;
+            block_id_type               _head_block_id;
+
+            bts::db::level_snapshot     _blk_id2num;
+            bts::db::level_snapshot     _trx_id2num;
+            bts::db::level_snapshot     _meta_trxs;
+            bts::db::level_snapshot     _blocks;
+            bts::db::level_snapshot     _block_trxs;
+            bts::db::level_snapshot     _block_deterministic_trxs;
+            bts::db::level_snapshot     _delegate_records;
+            bts::db::level_snapshot     _name_records;
+            bts::db::level_snapshot     _unspent_outputs;
+            bts::db::level_snapshot     _owner_outputs; ///< null without an owner index
+      };
     }
 
+     chain_snapshot::chain_snapshot( const detail::chain_database_impl& db )
+     :my( new detail::chain_snapshot_impl( db ) )
+     {
+     }
+
+     chain_snapshot::~chain_snapshot()
+     {
+     }
+
+     const signed_block_header& chain_snapshot::get_head_block()const { return my->_head_block; }
+     uint32_t                   chain_snapshot::head_block_num()const { return my->_head_block.block_num; }
+     block_id_type              chain_snapshot::head_block_id()const  { return my->_head_block_id; }
+
+     fc::optional<name_record> chain_snapshot::lookup_name( const std::string& name )const
+     {
+        name_record rec;
+        if( my->_db._name_records.fetch( name, rec, my->_name_records ) ) return rec;
+        return fc::optional<name_record>();
+     }
+
+     fc::optional<name_record> chain_snapshot::lookup_delegate( uint16_t del )const
+     {
+        name_record rec;
+        if( my->_db._delegate_records.fetch( del, rec, my->_delegate_records ) ) return rec;
+        return fc::optional<name_record>();
+     }
+
+     /** ranks the delegate records of the snapshot, there are only a few hundred of them */
+     std::vector<name_record> chain_snapshot::get_delegates( uint32_t count )const
+     { try {
+        std::vector<name_record>      records;
+        std::vector<detail::vote_del> ranks;
+        auto itr = my->_db._delegate_records.begin( my->_delegate_records );
+        while( itr.valid() )
+        {
+           ranks.push_back( detail::vote_del( itr.value().total_votes(), itr.value().delegate_id, records.size() ) );
+           records.push_back( itr.value() );
+           ++itr;
+        }
+        std::sort( ranks.begin(), ranks.end() );
+
+        std::vector<name_record> result;
+        result.reserve( std::min<size_t>( count, ranks.size() ) );
+        for( auto r = ranks.begin(); r != ranks.end() && result.size() < count; ++r )
+           result.push_back( records[r->slot] );
+        return result;
+     } FC_RETHROW_EXCEPTIONS( warn, "", ("count",count) ) }
+
+     trx_num chain_snapshot::fetch_trx_num( const uint160& trx_id )const
+     { try {
+        return my->fetch<trx_num>( my->_db.trx_id2num, trx_id, my->_trx_id2num );
+     } FC_RETHROW_EXCEPTIONS( warn, "trx_id ${trx_id}", ("trx_id",trx_id) ) }
+
+     meta_trx chain_snapshot::fetch_trx( const trx_num& t )const
+     { try {
+        return my->fetch<meta_trx>( my->_db.meta_trxs, t, my->_meta_trxs );
+     } FC_RETHROW_EXCEPTIONS( warn, "trx_id ${trx_id}", ("trx_id",t) ) }
+
+     signed_transaction chain_snapshot::fetch_transaction( const transaction_id_type& trx_id )const
+     { try {
+        return fetch_trx( fetch_trx_num( trx_id ) );
+     } FC_RETHROW_EXCEPTIONS( warn, "", ("id",trx_id) ) }
+
+     trx_output chain_snapshot::fetch_output( const output_reference& ref )const
+     { try {
+        detail::unspent_output unspent;
+        if( my->_db._unspent_outputs.fetch( ref, unspent, my->_unspent_outputs ) )
+           return unspent.output;
+
+        meta_trx mtrx = fetch_trx( fetch_trx_num( ref.trx_hash ) );
+        FC_ASSERT( mtrx.outputs.size() > ref.output_idx.value );
+        return mtrx.outputs[ref.output_idx.value];
+     } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref) ) }
+
+     std::vector<owned_output> chain_snapshot::fetch_owned_outputs( const std::vector<address>& owners,
+                                                                    const std::vector<pts_address>& pts_owners )const
+     { try {
+        FC_ASSERT( my->_owner_outputs != nullptr, "the chain database has no owner index" );
+        std::vector<fc::ripemd160> keys;
+        keys.reserve( owners.size() + pts_owners.size() );
+        for( const address& a : owners )         keys.push_back( detail::chain_database_impl::owner_key( a ) );
+        for( const pts_address& a : pts_owners ) keys.push_back( detail::chain_database_impl::owner_key( a ) );
+
+        std::vector<owned_output> result;
+        detail::unspent_output    unspent;
+        for( const fc::ripemd160& owner : keys )
+        {
+           detail::owner_output_key first;
+           first.owner = owner;
+           auto itr = my->_db._owner_outputs.lower_bound( first, my->_owner_outputs );
+           while( itr.valid() && itr.key().owner == owner )
+           {
+              if( my->_db._unspent_outputs.fetch( itr.key().ref, unspent, my->_unspent_outputs ) )
+              {
+                 owned_output found;
+                 found.ref    = itr.key().ref;
+                 found.source = unspent.source;
+                 found.vote   = unspent.delegate_id.value;
+                 found.output = unspent.output;
+                 result.push_back( found );
+              }
+              ++itr;
+           }
+        }
+        return result;
+     } FC_RETHROW_EXCEPTIONS( warn, "", ("owners",owners.size())("pts_owners",pts_owners.size()) ) }
+
+     uint32_t chain_snapshot::fetch_block_num( const block_id_type& block_id )const
+     { try {
+        return my->fetch<uint32_t>( my->_db.blk_id2num, block_id, my->_blk_id2num );
+     } FC_RETHROW_EXCEPTIONS( warn, "block id: ${block_id}", ("block_id",block_id) ) }
+
+     signed_block_header chain_snapshot::fetch_block( uint32_t block_num )const
+     { try {
+        return my->fetch<signed_block_header>( my->_db.blocks, block_num, my->_blocks );
+     } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
+     digest_block chain_snapshot::fetch_digest_block( uint32_t block_num )const
+     { try {
+        digest_block fb = fetch_block( block_num );
+        fb.trx_ids = my->fetch<std::vector<uint160> >( my->_db.block_trxs, block_num, my->_block_trxs );
+        my->_db.block_deterministic_trxs.fetch( block_num, fb.deterministic_ids, my->_block_deterministic_trxs );
+        return fb;
+     } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
+     trx_block chain_snapshot::fetch_trx_block( uint32_t block_num )const
+     { try {
+        trx_block fb = fetch_block( block_num );
+        auto trx_ids = my->fetch<std::vector<uint160> >( my->_db.block_trxs, block_num, my->_block_trxs );
+        fb.trxs.reserve( trx_ids.size() );
+        for( uint32_t i = 0; i < trx_ids.size(); ++i )
+           fb.trxs.push_back( fetch_trx( trx_num( block_num, i ) ) );
+        return fb;
+     } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
+     transaction_proof chain_snapshot::fetch_transaction_proof( const transaction_id_type& trx_id )const
+     { try {
+        auto tn     = fetch_trx_num( trx_id );
+        auto digest = fetch_digest_block( tn.block_num );
+        // a block of one transaction uses its id as the root, which leaves out the deterministic ones
+        FC_ASSERT( tn.trx_idx < digest.trx_ids.size() || digest.trx_ids.size() > 1,
+                   "the merkle root of a block with one transaction does not include its deterministic transactions" );
+
+        transaction_proof proof;
+        proof.header = digest;
+        proof.branch = digest.calculate_merkle_branch( tn.trx_idx );
+        proof.trx    = fetch_trx( tn );
+        return proof;
+     } FC_RETHROW_EXCEPTIONS( warn, "", ("trx_id",trx_id) ) }
+
      chain_database::chain_database()
      :my( new detail::chain_database_impl() )
      {
@@ -311,37 +1398,31 @@ namespace bts { namespace blockchain {
      }
      fc::optional<name_record> chain_database::lookup_name( const std::string& name )
      {
-        auto itr = my->_name_records.find( name );
-        if( itr.valid() )
-           return itr.value();
-        return fc::optional<name_record>();
+        auto lock = lock_reads();
+        // sees the writes of the open batch, which import_blocks keeps across several blocks
+        return detail::chain_database_impl::find_record( my->_name_records, name );
      }
 
      fc::optional<name_record> chain_database::lookup_delegate( uint16_t del )
-     { try {
-        auto itr = my->_delegate_records.find( del );
-        if( itr.valid() )
-           return itr.value();
+     {
+        auto lock = lock_reads();
+        auto rec = my->_delegates.find( del );
+        if( rec ) return *rec;
         return fc::optional<name_record>();
-     } FC_RETHROW_EXCEPTIONS( warn, "delegate id: ${id}", ("id",del) ) }
+     }
 
-     std::vector<name_record> chain_database::get_delegates( uint32_t count )
+     std::unique_lock<std::recursive_mutex> chain_database::lock_reads()const
      {
-        std::vector<name_record> results;
-        results.reserve( 100 );
+        return std::unique_lock<std::recursive_mutex>( my->_read_mutex );
+     }
 
-        uint32_t i = 0;
-        for( auto del : my->_votes_to_delegate )
-        {
-           results.push_back( *lookup_delegate( del.delegate_id ) );   
-           ++i;
-           if( i == count ) return results;
-        }
-        return results;
+     std::vector<name_record> chain_database::get_delegates( uint32_t count )
+     {
+        return my->_delegates.top( count );
      }
 
 
-     void chain_database::open( const fc::path& dir, bool create )
+     void chain_database::open( const fc::path& dir, bool create, const chain_database_tuning& tuning )
      {
        try {
          if( !fc::exists( dir ) )
@@ -353,31 +1434,124 @@ namespace bts { namespace blockchain {
               }
               fc::create_directories( dir );
          }
-         my->blk_id2num.open( dir / "blk_id2num", create );
-         my->trx_id2num.open( dir / "trx_id2num", create );
-         my->meta_trxs.open(  dir / "meta_trxs",  create );
-         my->blocks.open(     dir / "blocks",     create );
-         my->block_trxs.open( dir / "block_trxs", create );
-         my->_delegate_records.open( dir / "delegate_records", create );
-         my->_name_records.open( dir / "name_records", create );
+         my->_sync_block_count = tuning.sync_block_count;
+         my->_sync_interval    = fc::milliseconds( tuning.sync_interval_ms );
+         my->_unsynced_writes  = 0;
+         my->_last_sync        = fc::time_point::now();
+
+         // an existing database keeps the layout it was created with
+         bool single_database = my->_single_database;
+         if( fc::exists( dir / "chain" ) )       single_database = true;
+         else if( fc::exists( dir / "blocks" ) ) single_database = false;
+
+         if( single_database )
+         {
+            my->_shared_db = bts::db::open_shared_database( dir / "chain", create, tuning.hash_indexes );
+            my->blk_id2num.open( my->_shared_db, "\x01" );
+            my->trx_id2num.open( my->_shared_db, "\x02" );
+            my->meta_trxs.open(  my->_shared_db, "\x03" );
+            my->blocks.open(     my->_shared_db, "\x04" );
+            my->block_trxs.open( my->_shared_db, "\x05" );
+            my->block_deterministic_trxs.open( my->_shared_db, "\x0c" );
+            my->_delegate_records.open( my->_shared_db, "\x06" );
+            my->_name_records.open( my->_shared_db, "\x07" );
+            my->_unspent_outputs.open( my->_shared_db, "\x08" );
+            my->_block_undo.open( my->_shared_db, "\x09" );
+            my->_owner_outputs.open( my->_shared_db, "\x0a" );
+            my->_age_outputs.open( my->_shared_db, "\x0b" );
+            if( !my->_owner_index )
+            {
+               // drop the index, it would be out of date if it was wanted again
+               if( my->_owner_outputs.begin().valid() )
+               {
+                  ilog( "dropping owner index" );
+                  my->_owner_outputs.begin_batch();
+                  for( auto itr = my->_owner_outputs.begin(); itr.valid(); ++itr )
+                     my->_owner_outputs.remove( itr.key() );
+                  my->_owner_outputs.commit_batch();
+               }
+               my->_owner_outputs.close();
+            }
+         }
+         else
+         {
+            my->blk_id2num.open( dir / "blk_id2num", create, tuning.hash_indexes );
+            my->trx_id2num.open( dir / "trx_id2num", create, tuning.hash_indexes );
+            my->meta_trxs.open(  dir / "meta_trxs",  create, tuning.records );
+            my->blocks.open(     dir / "blocks",     create, tuning.records );
+            my->block_trxs.open( dir / "block_trxs", create, tuning.records );
+            my->block_deterministic_trxs.open( dir / "block_deterministic_trxs", create, tuning.records );
+            my->_delegate_records.open( dir / "delegate_records", create, tuning.records );
+            my->_name_records.open( dir / "name_records", create, tuning.records );
+            my->_unspent_outputs.open( dir / "unspent_outputs", create, tuning.records );
+            my->_block_undo.open( dir / "block_undo", create, tuning.records );
+            my->_age_outputs.open( dir / "age_outputs", create, tuning.records );
+            if( my->_owner_index )
+               my->_owner_outputs.open( dir / "owner_outputs", create, tuning.records );
+            else if( fc::exists( dir / "owner_outputs" ) )
+               fc::remove_all( dir / "owner_outputs" ); // it would be out of date if it was wanted again
+         }
 
 
+         my->_unspent_outputs.set_max_cache_size( tuning.unspent_output_cache_size );
+         my->_delegates_snapshot = dir / "delegates.snapshot";
+
          // read the last block from the DB
          my->blocks.last( my->head_block.block_num, my->head_block );
          if( my->head_block.block_num != uint32_t(-1) )
          {
             my->head_block_id = my->head_block.id();
 
+            // missing if the database was closed while the indexes were deferred
+            if( !my->blk_id2num.with_value( my->head_block_id, []( const char*, size_t ){} ) )
+               my->rebuild_hash_indexes();
+
+            if( !my->_unspent_outputs.begin().valid() )
+               my->rebuild_unspent_outputs();
+            else
+               my->build_output_indexes();
 
-            auto itr = my->_delegate_records.begin();
+
+            std::vector<name_record> delegates;
+            if( bts::db::load_state_snapshot( my->_delegates_snapshot, delegates_snapshot_version, my->head_block_id, delegates ) )
+            {
+               for( const name_record& rec : delegates )
+                  my->_delegates.update( rec );
+            }
+            else
+            {
+               auto itr = my->_delegate_records.begin();
+               while( itr.valid() )
+               {
+                  my->_delegates.update( itr.value() );
+                  ++itr;
+               }
+            }
+         }
+
+         // the list is written after the blocks are committed, so it can be missing the last
+         // block or still have a popped one.  It is rebuilt from the blocks if it doesn't match
+         my->_block_ids.open( dir / "blk_num2id" );
+         uint32_t block_count = my->head_block.block_num + 1;
+         if( my->_block_ids.size() != block_count ||
+             (block_count && my->_block_ids.back() != my->head_block_id) )
+         {
+            ilog( "building block id list" );
+            std::vector<block_id_type> ids;
+            ids.reserve( block_count );
+            auto itr = my->blocks.begin();
             while( itr.valid() )
             {
-               auto rec = itr.value();
-               auto votes = rec.votes_for - rec.votes_against;
-               my->_votes_to_delegate.insert( detail::vote_del( votes, rec.delegate_id ) );
-               my->_delegate_to_votes[rec.delegate_id] = votes;
+               ids.push_back( itr.value().id() );
                ++itr;
             }
+            my->_block_ids.assign( std::move(ids) );
+         }
+
+         if( my->_block_store_enabled )
+         {
+            my->_block_store.open( dir / "block_store" );
+            my->sync_block_store();
          }
 
 
@@ -386,20 +1560,166 @@ namespace bts { namespace blockchain {
 
      void chain_database::close()
      {
+        if( my->head_block.block_num != trx_num::invalid_block_num && !my->_delegates_snapshot.string().empty() )
+        {
+           try {
+              bts::db::save_state_snapshot( my->_delegates_snapshot, delegates_snapshot_version,
+                                            my->head_block_id, my->_delegates.records() );
+           }
+           catch ( const fc::exception& e )
+           {
+              wlog( "${e}", ("e",e.to_detail_string()) );
+           }
+        }
+        my->_delegates_snapshot = fc::path();
+        if( my->head_block.block_num != trx_num::invalid_block_num )
+        {
+           try {
+              my->sync();
+           }
+           catch ( const fc::exception& e )
+           {
+              wlog( "${e}", ("e",e.to_detail_string()) );
+           }
+        }
         my->blk_id2num.close();
         my->trx_id2num.close();
         my->blocks.close();
         my->block_trxs.close();
+        my->block_deterministic_trxs.close();
         my->meta_trxs.close();
+        my->_delegate_records.close();
+        my->_name_records.close();
+        my->_unspent_outputs.close();
+        my->_block_undo.close();
+        my->_owner_outputs.close();
+        my->_age_outputs.close();
+        my->_shared_db.reset();
+        my->_delegates.clear();
+        my->_block_ids.close();
+        my->_block_store.close();
+     }
+
+     void chain_database::set_single_database( bool single )
+     {
+        my->_single_database = single;
+     }
+
+     void chain_database::set_defer_indexes( bool defer )
+    {
+       if( my->_defer_indexes && !defer && head_block_num() != trx_num::invalid_block_num )
+       {
+          my->_defer_indexes = false;
+          my->rebuild_hash_indexes();
+       }
+       my->_defer_indexes = defer;
+    }
+
+    void chain_database::set_owner_index( bool index )
+     {
+        my->_owner_index = index;
+     }
+
+     bool chain_database::has_owner_index()const
+     {
+        return my->_owner_index;
+     }
+
+     void chain_database::set_block_store( bool store )
+     {
+        my->_block_store_enabled = store;
      }
 
+     bool chain_database::has_block_store()const
+     {
+        return my->_block_store_enabled;
+     }
+
+     void chain_database::set_prune_depth( uint32_t depth )
+     {
+        my->_prune_depth = depth;
+     }
+
+     uint32_t chain_database::get_prune_depth()const
+     {
+        return my->_prune_depth;
+     }
+
+    namespace detail
+    {
+       /** the LevelDB properties worth watching, leveldb.sstables lists every file and is left out */
+       template<typename Map>
+       std::map<std::string,std::string> database_properties( const Map& m )
+       {
+          std::map<std::string,std::string> properties;
+          std::vector<std::string> names = { "leveldb.stats", "leveldb.approximate-memory-usage" };
+          for( uint32_t level = 0; level < 7; ++level )
+             names.push_back( "leveldb.num-files-at-level" + fc::to_string( int64_t(level) ) );
+          for( const std::string& name : names )
+          {
+             std::string value;
+             if( m.get_property( name, value ) ) properties[name] = value;
+          }
+          return properties;
+       }
+
+       /** the properties of a map with a database of its own are reported by the name of the table */
+       template<typename Map>
+       void add_table_stats( storage_stats& stats, const char* name, const Map& m, bool shared_db )
+       {
+          stats.tables[name] = m.get_stats();
+          if( !shared_db ) stats.databases[name] = database_properties( m );
+       }
+    }
+
+    storage_stats chain_database::get_storage_stats()const
+    {
+       storage_stats stats;
+       bool shared = my->_shared_db != nullptr;
+       detail::add_table_stats( stats, "blk_id2num",       my->blk_id2num,        shared );
+       detail::add_table_stats( stats, "trx_id2num",       my->trx_id2num,        shared );
+       detail::add_table_stats( stats, "meta_trxs",        my->meta_trxs,         shared );
+       detail::add_table_stats( stats, "blocks",           my->blocks,            shared );
+       detail::add_table_stats( stats, "block_trxs",       my->block_trxs,        shared );
+       detail::add_table_stats( stats, "block_deterministic_trxs", my->block_deterministic_trxs, shared );
+       detail::add_table_stats( stats, "delegate_records", my->_delegate_records, shared );
+       detail::add_table_stats( stats, "name_records",     my->_name_records,     shared );
+       detail::add_table_stats( stats, "unspent_outputs",  my->_unspent_outputs,  shared );
+       detail::add_table_stats( stats, "block_undo",       my->_block_undo,       shared );
+       if( my->_owner_index )
+          detail::add_table_stats( stats, "owner_outputs", my->_owner_outputs,    shared );
+       detail::add_table_stats( stats, "age_outputs",      my->_age_outputs,      shared );
+       if( shared )
+          stats.databases["chain"] = detail::database_properties( my->blocks );
+
+       stats.unspent_output_cache_size   = my->_unspent_outputs.cache_size();
+       stats.unspent_output_cache_hits   = my->_unspent_outputs.cache_hits();
+       stats.unspent_output_cache_misses = my->_unspent_outputs.cache_misses();
+       stats.signature_cache             = signature_cache::instance().get_stats();
+       return stats;
+    }
+
+    /** an output with its claim, its key in the map and the lru list and the node overheads */
+    static const uint64_t unspent_output_cache_entry_bytes =
+       sizeof(detail::unspent_output) + 2*sizeof(output_reference) + 48 + 64;
+
+    uint64_t chain_database::get_unspent_output_cache_bytes()const
+    {
+       return my->_unspent_outputs.cache_size() * unspent_output_cache_entry_bytes;
+    }
+
+    void chain_database::set_unspent_output_cache_bytes( uint64_t bytes )
+    {
+       my->_unspent_outputs.set_max_cache_size( size_t( bytes / unspent_output_cache_entry_bytes ) );
+    }
+
     uint32_t chain_database::head_block_num()const
     {
        return my->head_block.block_num;
     }
     block_id_type chain_database::head_block_id()const
     {
-       return my->head_block.id();
+       return my->head_block_id;
     }
 
     trx_num    chain_database::fetch_trx_num( const uint160& trx_id )
@@ -409,7 +1729,14 @@ namespace bts { namespace blockchain {
 
     meta_trx    chain_database::fetch_trx( const trx_num& trx_id )
     { try {
-       return my->meta_trxs.fetch( trx_id );
+       meta_trx trx;
+       my->fetch_trx( trx_id, trx );
+       return trx;
+    } FC_RETHROW_EXCEPTIONS( warn, "trx_id ${trx_id}", ("trx_id",trx_id) ) }
+
+    void chain_database::fetch_trx( const trx_num& trx_id, meta_trx& trx )
+    { try {
+       my->fetch_trx( trx_id, trx );
     } FC_RETHROW_EXCEPTIONS( warn, "trx_id ${trx_id}", ("trx_id",trx_id) ) }
 
     uint32_t    chain_database::fetch_block_num( const block_id_type& block_id )
@@ -417,6 +1744,16 @@ namespace bts { namespace blockchain {
        return my->blk_id2num.fetch( block_id );
     } FC_RETHROW_EXCEPTIONS( warn, "block id: ${block_id}", ("block_id",block_id) ) }
 
+    block_id_type chain_database::fetch_block_id( uint32_t block_num )
+    {
+       return my->_block_ids.at( block_num );
+    }
+
+    std::vector<block_id_type> chain_database::fetch_block_ids( uint32_t block_num, uint32_t count )
+    {
+       return my->_block_ids.range( block_num, count );
+    }
+
     signed_block_header chain_database::fetch_block( uint32_t block_num )
     {
        return my->blocks.fetch(block_num);
@@ -426,21 +1763,51 @@ namespace bts { namespace blockchain {
     { try {
        digest_block fb = my->blocks.fetch(block_num);
        fb.trx_ids = my->block_trxs.fetch( block_num );
+       detail::chain_database_impl::find_value( my->block_deterministic_trxs, block_num, fb.deterministic_ids );
        return fb;
     } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
 
+    signed_transactions chain_database::fetch_deterministic_trxs( uint32_t block_num )
+    { try {
+       signed_transactions trxs;
+       auto digest = fetch_digest_block( block_num );
+       trxs.reserve( digest.deterministic_ids.size() );
+       for( uint32_t i = 0; i < digest.deterministic_ids.size(); ++i )
+          trxs.push_back( fetch_trx( trx_num( block_num, digest.trx_ids.size() + i ) ) );
+       return trxs;
+    } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
     trx_block  chain_database::fetch_trx_block( uint32_t block_num )
     { try {
-       trx_block fb = my->blocks.fetch(block_num);
-       auto trx_ids = my->block_trxs.fetch( block_num );
-       for( uint32_t i = 0; i < trx_ids.size(); ++i )
-       {
-          auto trx_num = fetch_trx_num(trx_ids[i]);
-          fb.trxs.push_back( fetch_trx( trx_num ) );
-       }
-       return fb;
+       if( my->_block_store.is_open() && block_num < my->_block_store.size() )
+          return my->_block_store.fetch( block_num );
+       return my->fetch_indexed_block( block_num );
     } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
 
+    /**
+     *  The leaves of the merkle tree are the ids of the transactions of the block
+     *  followed by those of its deterministic transactions.
+     */
+    transaction_proof chain_database::fetch_transaction_proof( const transaction_id_type& trx_id )
+    { try {
+       auto tn     = fetch_trx_num( trx_id );
+       auto digest = fetch_digest_block( tn.block_num );
+       // a block of one transaction uses its id as the root, which leaves out the deterministic ones
+       FC_ASSERT( tn.trx_idx < digest.trx_ids.size() || digest.trx_ids.size() > 1,
+                  "the merkle root of a block with one transaction does not include its deterministic transactions" );
+
+       transaction_proof proof;
+       proof.header = digest;
+       proof.branch = digest.calculate_merkle_branch( tn.trx_idx );
+       proof.trx    = fetch_trx( tn );
+       return proof;
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("trx_id",trx_id) ) }
+
+    chain_snapshot_ptr chain_database::get_snapshot()const
+    { try {
+       return chain_snapshot_ptr( new chain_snapshot( *my ) );
+    } FC_RETHROW_EXCEPTIONS( warn, "unable to take a snapshot of the chain" ) }
+
     signed_transaction chain_database::fetch_transaction( const transaction_id_type& id )
     { try {
           auto trx_num = fetch_trx_num(id);
@@ -449,12 +1816,25 @@ namespace bts { namespace blockchain {
 
     trx_output chain_database::fetch_output(const output_reference& ref)
     {
-        auto trx = fetch_transaction(ref.trx_hash);
-        return trx.outputs[ref.output_idx];
+        return my->get_output( ref );
     }
 
+    std::vector<output_reference> chain_database::fetch_unspent_outputs_before( uint32_t block_num, uint32_t limit )
+    { try {
+        std::vector<output_reference> result;
+        for( auto itr = my->_age_outputs.begin(); itr.valid() && result.size() < limit; ++itr )
+        {
+           if( itr.key().source.block_num >= block_num ) break;
+           result.push_back( itr.key().ref );
+        }
+        return result;
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num)("limit",limit) ) }
+
     std::vector<meta_trx_input> chain_database::fetch_inputs( const std::vector<trx_input>& inputs, uint32_t head )
     {
+       BTS_TRACE_SPAN( "chain_database::fetch_inputs" );
+       BTS_TRACE_COUNT( "inputs fetched", inputs.size() );
+       auto lock = lock_reads();
        try
        {
           if( head == uint32_t(-1) )
@@ -464,11 +1844,25 @@ namespace bts { namespace blockchain {
 
           std::vector<meta_trx_input> rtn;
           rtn.reserve( inputs.size() );
+          meta_trx trx;
           for( uint32_t i = 0; i < inputs.size(); ++i )
           {
             try {
+             auto unspent = my->_unspent_outputs.find( inputs[i].output_ref );
+             if( unspent )
+             {
+                meta_trx_input metin;
+                metin.source       = unspent->source;
+                metin.delegate_id  = unspent->delegate_id;
+                metin.output_num   = inputs[i].output_ref.output_idx;
+                metin.output       = unspent->output;
+                rtn.push_back( metin );
+                continue;
+             }
+
+             // the output is spent or does not exist, the transaction record reports which
              trx_num tn   = fetch_trx_num( inputs[i].output_ref.trx_hash );
-             meta_trx trx = fetch_trx( tn );
+             fetch_trx( tn, trx );
 
              if( inputs[i].output_ref.output_idx.value >= trx.meta_outputs.size() )
              {
@@ -498,7 +1892,12 @@ namespace bts { namespace blockchain {
 
     void validate_unique_inputs( const signed_transactions& deterministic_trxs, const signed_transactions& trxs )
     {
-       std::unordered_set<output_reference> ref_outs;
+       size_t input_count = 0;
+       for( const signed_transaction& trx : deterministic_trxs ) input_count += trx.inputs.size();
+       for( const signed_transaction& trx : trxs )               input_count += trx.inputs.size();
+
+       flat_hash_set<output_reference> ref_outs;
+       ref_outs.reserve( input_count );
        for( const signed_transaction& trx : deterministic_trxs )
        {
             for( const trx_input& in : trx.inputs )
@@ -518,75 +1917,160 @@ namespace bts { namespace blockchain {
     signed_transactions chain_database::generate_deterministic_transactions()
     {
        signed_transactions trxs;
-       // TODO: move all unspent outputs over 1 year old to new outputs and charge a 5% fee
+       // TODO: move all unspent outputs over 1 year old to new outputs and charge a 5% fee, the
+       // outputs that cross the threshold with the next block are the first results of
+       // fetch_unspent_outputs_before( head_block_num() + 1 - BTS_BLOCKCHAIN_BLOCKS_PER_YEAR, ... )
 
        return trxs;
     }
 
+    void chain_database::validate_for_relay( const trx_block& b )
+    { try {
+        if( !my->_trusted_import )
+           FC_ASSERT( b.signee() == my->_trustee, "block is not signed by the trustee" );
+        FC_ASSERT( b.block_num    == head_block_num() + 1 );
+        FC_ASSERT( b.prev         == my->head_block_id );
+        FC_ASSERT( b.trx_mroot    == b.calculate_merkle_root( generate_deterministic_transactions() ) );
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",b.block_num) ) }
+
     block_evaluation_state_ptr chain_database::validate( const trx_block& b, const signed_transactions& deterministic_trxs )
     { try {
+        BTS_TRACE_SPAN( "chain_database::validate" );
         auto block_state = my->_trx_validator->create_block_state();
         if( b.block_num == 0 ) { return block_state; } // don't check anything for the genesis block;
-        FC_ASSERT( b.signee() == my->_trustee );
-        FC_ASSERT( b.version      == 0                                                         );
-        FC_ASSERT( b.trxs.size()  > 0                                                          );
-        FC_ASSERT( b.block_num    == head_block_num() + 1                                      );
-        FC_ASSERT( b.prev         == my->head_block_id                                         );
-        /// time stamps from the future are not allowed
-        FC_ASSERT( b.next_fee     == b.calculate_next_fee( my->head_block.next_fee,  b.block_size() ), "",
-                   ("b.next_fee",b.next_fee)("b.calculate_next_fee", b.calculate_next_fee( my->head_block.next_fee, b.block_size()))
-                   ("get_fee_rate",get_fee_rate())("b.size",b.block_size())
-                   );
-
-        // TODO: timestamp should be multiple of BTS_BLOCKCHAIN_INTERVAL_SEC from genesis 
-        FC_ASSERT( b.timestamp    <= (my->_pow_validator->get_time() + fc::seconds(10)), "",
-                   ("b.timestamp", b.timestamp)("future",my->_pow_validator->get_time()+ fc::seconds(10)));
-
-        FC_ASSERT( b.timestamp    > fc::time_point(my->head_block.timestamp) + fc::seconds(10) );
-
+        if( !my->_trusted_import )
+           FC_ASSERT( b.signee() == my->_trustee );
+        validate_header( b );
 
         validate_unique_inputs( b.trxs, deterministic_trxs );
 
         FC_ASSERT( b.trx_mroot == b.calculate_merkle_root(deterministic_trxs) );
 
+        // recover all signatures in parallel, evaluate() below finds them in the cache
+        signature_cache::instance().recover( b.trxs );
+        my->prefetch_inputs( b.trxs );
+
         transaction_summary summary;
         transaction_summary trx_summary;
         int32_t last = b.trxs.size()-1;
         uint64_t fee_rate = get_fee_rate();
-        for( int32_t i = 0; i <= last; ++i )
+        bool parallel = b.trxs.size() >= 2 * detail::chain_database_impl::parallel_evaluation_per_thread &&
+                        my->_trx_validator->supports_parallel_evaluation();
+        if( !parallel || !my->evaluate_in_parallel( b.trxs, fee_rate, block_state, summary ) )
         {
-            trx_summary = my->_trx_validator->evaluate( b.trxs[i], block_state );
-            FC_ASSERT( b.trxs[i].version == 0 );
-            FC_ASSERT( trx_summary.fees >= (b.trxs[i].size() * fee_rate)/1000 );
-            summary += trx_summary;
+           if( parallel )
+           {
+              block_state = my->_trx_validator->create_block_state();
+              summary     = transaction_summary();
+           }
+           for( int32_t i = 0; i <= last; ++i )
+           {
+               trx_summary = my->_trx_validator->evaluate( b.trxs[i], block_state );
+               FC_ASSERT( b.trxs[i].version == 0 );
+               FC_ASSERT( trx_summary.fees >= (b.trxs[i].size() * fee_rate)/1000 );
+               summary += trx_summary;
+           }
         }
+        BTS_TRACE_COUNT( "transactions validated", b.trxs.size() );
 
-        for( auto strx : deterministic_trxs )
-        {
-            summary += my->_trx_validator->evaluate( strx, block_state );
-        }
+        summary += my->evaluate_deterministic( deterministic_trxs, block_state );
 
         FC_ASSERT( b.total_shares    == my->head_block.total_shares - summary.fees, "",
                    ("b.total_shares",b.total_shares)("head_block.total_shares",my->head_block.total_shares)("summary.fees",summary.fees) );
 
+        validate_block_state( b, block_state );
         return block_state;
 
     } FC_RETHROW_EXCEPTIONS( warn, "error validating block" ) }
 
+    /** the checks of the header that don't need the transactions to be evaluated */
+    void chain_database::validate_header( const trx_block& b )
+    {
+        FC_ASSERT( b.version      == 0                                                         );
+        FC_ASSERT( b.trxs.size()  > 0                                                          );
+        FC_ASSERT( b.block_num    == head_block_num() + 1                                      );
+        FC_ASSERT( b.prev         == my->head_block_id                                         );
+        /// time stamps from the future are not allowed
+        const size_t block_size = b.block_size();
+        const uint64_t next_fee = b.calculate_next_fee( my->head_block.next_fee, block_size );
+        FC_ASSERT( b.next_fee     == next_fee, "",
+                   ("b.next_fee",b.next_fee)("b.calculate_next_fee", next_fee)
+                   ("get_fee_rate",get_fee_rate())("b.size",block_size)
+                   );
+
+        // TODO: timestamp should be multiple of BTS_BLOCKCHAIN_INTERVAL_SEC from genesis 
+        FC_ASSERT( b.timestamp    <= (my->_pow_validator->get_time() + fc::seconds(10)), "",
+                   ("b.timestamp", b.timestamp)("future",my->_pow_validator->get_time()+ fc::seconds(10)));
+
+        FC_ASSERT( b.timestamp    > fc::time_point(my->head_block.timestamp) + fc::seconds(10) );
+    }
+
     /**
      *  Attempts to append block b to the block chain with the given trxs.
      */
     void chain_database::push_block( const trx_block& b )
     { try {
+        BTS_TRACE_SPAN( "chain_database::push_block" );
         auto deterministic_trxs = generate_deterministic_transactions();
         auto state = validate( b, deterministic_trxs );
         store( b, deterministic_trxs, state );
       } FC_RETHROW_EXCEPTIONS( warn, "unable to push block", ("b", b) );
     } // chain_database::push_block
 
+    /**
+     *  The signatures, fees and inputs of b.trxs were checked when they were evaluated into
+     *  state, which was done against the same head block as long as b follows it.
+     */
+    void chain_database::push_trusted_block( const trx_block& b, const block_evaluation_state_ptr& state,
+                                             const transaction_summary& summary )
+    { try {
+        BTS_TRACE_SPAN( "chain_database::push_trusted_block" );
+        FC_ASSERT( state );
+        FC_ASSERT( b.block_num > 0, "the genesis block is pushed with push_block" );
+        validate_header( b );
+
+        auto deterministic_trxs = generate_deterministic_transactions();
+        validate_unique_inputs( b.trxs, deterministic_trxs );
+        FC_ASSERT( b.trx_mroot == b.calculate_merkle_root(deterministic_trxs) );
+
+        transaction_summary block_summary = summary;
+        block_summary += my->evaluate_deterministic( deterministic_trxs, state );
+        FC_ASSERT( b.total_shares    == my->head_block.total_shares - block_summary.fees, "",
+                   ("b.total_shares",b.total_shares)("head_block.total_shares",my->head_block.total_shares)("summary.fees",block_summary.fees) );
+
+        validate_block_state( b, state );
+        store( b, deterministic_trxs, state );
+      } FC_RETHROW_EXCEPTIONS( warn, "unable to push trusted block", ("b", b) );
+    }
+
     void chain_database::store( const trx_block& blk, const signed_transactions& deterministic_trxs, const block_evaluation_state_ptr& state )
     {
-        my->store( blk, deterministic_trxs, state );
+        BTS_TRACE_SPAN( "chain_database::store" );
+        if( my->_importing ) // import_blocks commits, or aborts and restores the head, for the whole batch
+        {
+           my->store( blk, deterministic_trxs, state );
+           my->_block_ids.push_back( my->head_block_id );
+           if( my->_block_store.is_open() ) my->_block_store.append( blk );
+           return;
+        }
+
+        auto prev_head    = my->head_block;
+        auto prev_head_id = my->head_block_id;
+
+        my->begin_batch();
+        try {
+           my->store( blk, deterministic_trxs, state );
+           my->commit_batch();
+        }
+        catch ( ... )
+        {
+           my->abort_batch();
+           my->head_block         = prev_head;
+           my->head_block_id      = prev_head_id;
+           throw;
+        }
+        my->_block_ids.push_back( my->head_block_id );
+        if( my->_block_store.is_open() ) my->_block_store.append( blk );
     }
 
     /**
@@ -594,10 +2078,123 @@ namespace bts { namespace blockchain {
      *  unspent.
      */
     trx_block chain_database::pop_block()
+    { try {
+        auto blk          = fetch_trx_block( head_block_num() );
+        auto prev_head    = my->head_block;
+        auto prev_head_id = my->head_block_id;
+
+        my->begin_batch();
+        try {
+           my->pop_head_block();
+           undo( blk );
+           my->commit_batch();
+        }
+        catch ( ... )
+        {
+           my->abort_batch();
+           my->head_block         = prev_head;
+           my->head_block_id      = prev_head_id;
+           // derived databases rebuild what they keep in memory from the restored chain
+           abort_undo();
+           throw;
+        }
+        // the chain is consistent before derived databases write, an error of theirs can't
+        // leave the popped block in the id list or the block store
+        my->_block_ids.pop_back();
+        if( my->_block_store.is_open() ) my->_block_store.truncate( my->_block_ids.size() );
+        commit_undo();
+        return blk;
+    } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+    void chain_database::undo( const trx_block& blk )
     {
-       FC_ASSERT( !"TODO: implement pop_block" );
     }
 
+    void chain_database::export_blocks( uint32_t first, uint32_t last, const fc::path& path )
+    { try {
+        FC_ASSERT( head_block_num() != trx_num::invalid_block_num, "the chain is empty" );
+        FC_ASSERT( first <= last && last <= head_block_num() );
+
+        std::ofstream out( path.generic_string().c_str(), std::ios::binary | std::ios::trunc );
+        FC_ASSERT( out.good(), "unable to open ${path} for writing", ("path",path) );
+        // the store holds the same records, they are copied without being unpacked
+        if( my->_block_store.is_open() && last < my->_block_store.size() )
+        {
+           my->_block_store.write_records( first, last, out );
+        }
+        else
+        {
+           for( uint32_t block_num = first; block_num <= last; ++block_num )
+           {
+              auto     packed = fc::raw::pack( fetch_trx_block( block_num ) );
+              uint32_t size   = packed.size();
+              out.write( (const char*)&size, sizeof(size) );
+              out.write( packed.data(), packed.size() );
+           }
+        }
+        out.flush();
+        FC_ASSERT( out.good(), "error writing ${path}", ("path",path) );
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("first",first)("last",last)("path",path) ) }
+
+    uint32_t chain_database::import_blocks( const fc::path& path, bool trusted, uint32_t batch_size )
+    { try {
+        FC_ASSERT( batch_size > 0 );
+        uint64_t file_size = fc::file_size( path );
+        if( file_size == 0 ) return 0;
+
+        fc::file_mapping  fm( path.generic_string().c_str(), fc::read_only );
+        fc::mapped_region mr( fm, fc::read_only, 0, file_size );
+        const char* data = (const char*)mr.get_address();
+
+        uint32_t imported = 0;
+        uint64_t pos      = 0;
+        while( pos < file_size )
+        {
+           auto     prev_head    = my->head_block;
+           auto     prev_head_id = my->head_block_id;
+           uint32_t block_count  = my->_block_ids.size();
+           uint32_t batched      = 0;
+
+           my->begin_batch();
+           my->_importing      = true;
+           my->_trusted_import = trusted;
+           try {
+              for( ; batched < batch_size && pos < file_size; ++batched )
+              {
+                 uint32_t size = 0;
+                 FC_ASSERT( file_size - pos >= sizeof(size), "truncated block size" );
+                 memcpy( (char*)&size, data + pos, sizeof(size) );
+                 pos += sizeof(size);
+                 FC_ASSERT( file_size - pos >= size, "truncated block" );
+
+                 trx_block blk;
+                 fc::datastream<const char*> ds( data + pos, size );
+                 fc::raw::unpack( ds, blk );
+                 pos += size;
+                 push_block( blk );
+              }
+              my->_importing      = false;
+              my->_trusted_import = false;
+              my->commit_batch();
+           }
+           catch ( ... )
+           {
+              my->_importing      = false;
+              my->_trusted_import = false;
+              my->abort_batch();
+              my->head_block      = prev_head;
+              my->head_block_id   = prev_head_id;
+              while( my->_block_ids.size() > block_count )
+                 my->_block_ids.pop_back();
+              if( my->_block_store.is_open() ) my->_block_store.truncate( block_count );
+              wlog( "imported ${n} blocks before the batch that failed", ("n",imported) );
+              throw;
+           }
+           imported += batched;
+        }
+        return imported;
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("path",path)("trusted",trusted) ) }
+
 
     uint64_t chain_database::get_stake()
     {
@@ -639,14 +2236,19 @@ namespace bts { namespace blockchain {
        return my->_trustee;
     }
 
-    void chain_database::evaluate_transaction( const signed_transaction& trx )
+    bool chain_database::is_evaluating_deterministic_transactions()const
+    {
+        return my->_evaluating_deterministic;
+    }
+
+    transaction_summary chain_database::evaluate_transaction( const signed_transaction& trx )
     {
-       get_transaction_validator()->evaluate( trx, get_transaction_validator()->create_block_state() );
+       return get_transaction_validator()->evaluate( trx, get_transaction_validator()->create_block_state() );
     }
     uint32_t  chain_database::get_new_delegate_id()const
     {
        uint32_t new_id = rand();
-       while( my->_delegate_to_votes.find(new_id) != my->_delegate_to_votes.end() )
+       while( my->_delegates.find(new_id) )
             new_id = fc::time_point::now().time_since_epoch().count() ^ rand();
        return new_id;
     }
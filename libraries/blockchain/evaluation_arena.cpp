@@ -0,0 +1,45 @@
+#include <bts/blockchain/evaluation_arena.hpp>
+
+#include <algorithm>
+
+namespace bts { namespace blockchain {
+
+   evaluation_arena::evaluation_arena( size_t chunk_size )
+   :_chunk_size(chunk_size),_pos(nullptr),_end(nullptr)
+   {
+   }
+
+   evaluation_arena::~evaluation_arena()
+   {
+   }
+
+   void* evaluation_arena::allocate_chunk( size_t size, size_t align )
+   {
+      // an allocation larger than a chunk gets a chunk of its own
+      size_t chunk_size = std::max( _chunk_size, size + align );
+      _chunks.emplace_back( new char[chunk_size] );
+      _chunk_sizes.push_back( chunk_size );
+      _pos = _chunks.back().get();
+      _end = _pos + chunk_size;
+      return allocate( size, align );
+   }
+
+   void evaluation_arena::release()
+   {
+      if( _chunks.size() > 1 )
+      {
+         _chunks.resize( 1 );
+         _chunk_sizes.resize( 1 );
+      }
+      _pos = _chunks.size() ? _chunks.front().get()         : nullptr;
+      _end = _chunks.size() ? _pos + _chunk_sizes.front()   : nullptr;
+   }
+
+   size_t evaluation_arena::capacity()const
+   {
+      size_t total = 0;
+      for( size_t size : _chunk_sizes ) total += size;
+      return total;
+   }
+
+} } // bts::blockchain
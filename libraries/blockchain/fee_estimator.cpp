@@ -0,0 +1,146 @@
+#include <bts/blockchain/fee_estimator.hpp>
+#include <bts/blockchain/config.hpp>
+
+#include <algorithm>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      /** the lowest rate of each bucket, 0 has a bucket of its own and the first ones are one apart */
+      struct bucket_bounds
+      {
+         bucket_bounds()
+         {
+            double rate = 1;
+            bounds[0] = 0;
+            for( uint32_t i = 1; i < fee_histogram::bucket_count; ++i, rate *= 1.1 )
+               bounds[i] = std::max<uint64_t>( bounds[i-1] + 1, uint64_t( rate ) );
+         }
+         uint64_t bounds[fee_histogram::bucket_count];
+      };
+      static const bucket_bounds fee_buckets;
+   }
+
+   const uint32_t fee_histogram::bucket_count;
+   const uint32_t fee_estimator::max_target;
+
+   fee_histogram::fee_histogram()
+   {
+      clear();
+   }
+
+   uint32_t fee_histogram::bucket_of( uint64_t fee_rate )
+   {
+      const uint64_t* end = detail::fee_buckets.bounds + bucket_count;
+      return uint32_t( std::upper_bound( detail::fee_buckets.bounds, end, fee_rate ) - detail::fee_buckets.bounds ) - 1;
+   }
+
+   uint64_t fee_histogram::rate_of( uint32_t bucket )
+   {
+      return detail::fee_buckets.bounds[std::min( bucket, bucket_count - 1 )];
+   }
+
+   void fee_histogram::add( uint64_t fee_rate, uint64_t bytes )
+   {
+      _bytes[bucket_of( fee_rate )] += bytes;
+      _total_bytes += bytes;
+   }
+
+   void fee_histogram::remove( uint64_t fee_rate, uint64_t bytes )
+   {
+      uint64_t& bucket = _bytes[bucket_of( fee_rate )];
+      bytes = std::min( bytes, bucket );
+      bucket       -= bytes;
+      _total_bytes -= bytes;
+   }
+
+   void fee_histogram::clear()
+   {
+      _bytes.fill( 0 );
+      _total_bytes = 0;
+   }
+
+   uint64_t fee_histogram::rate_at_depth( uint64_t depth )const
+   {
+      uint64_t ahead = 0;
+      for( uint32_t b = bucket_count; b > 0; --b )
+      {
+         ahead += _bytes[b-1];
+         if( ahead >= depth ) return rate_of( b );
+      }
+      return 0;
+   }
+
+   uint64_t fee_histogram::rate_at_quantile( double q )const
+   {
+      if( _total_bytes == 0 ) return 0;
+      uint64_t below = 0;
+      uint64_t limit = uint64_t( q * _total_bytes );
+      for( uint32_t b = 0; b < bucket_count; ++b )
+      {
+         below += _bytes[b];
+         if( below > limit ) return rate_of( b );
+      }
+      return rate_of( bucket_count - 1 );
+   }
+
+   fee_estimator::fee_estimator( uint32_t window )
+   :_window(std::max<uint32_t>( 1, window )),_sampled_bytes(0),_min_fee_rate(0)
+   {
+      std::unique_lock<std::mutex> lock( _mutex );
+      recompute();
+   }
+
+   void fee_estimator::record_block( const std::vector<std::pair<uint64_t,uint32_t> >& included, uint64_t block_size )
+   {
+      std::unique_lock<std::mutex> lock( _mutex );
+      sampled_block sample;
+      sample.included = included;
+      sample.size     = block_size;
+      for( const auto& trx : sample.included ) _included.add( trx.first, trx.second );
+      _sampled_bytes += block_size;
+      _blocks.push_back( std::move( sample ) );
+
+      while( _blocks.size() > _window )
+      {
+         for( const auto& trx : _blocks.front().included ) _included.remove( trx.first, trx.second );
+         _sampled_bytes -= _blocks.front().size;
+         _blocks.pop_front();
+      }
+      recompute();
+   }
+
+   void fee_estimator::update( const fee_histogram& pending, uint64_t min_fee_rate )
+   {
+      std::unique_lock<std::mutex> lock( _mutex );
+      _pending      = pending;
+      _min_fee_rate = min_fee_rate;
+      recompute();
+   }
+
+   void fee_estimator::recompute()
+   {
+      // until blocks were seen, assume they are filled up to the size they aim for
+      uint64_t block_capacity = _blocks.empty() ? BTS_BLOCKCHAIN_TARGET_BLOCK_SIZE
+                                                : std::max<uint64_t>( 1, _sampled_bytes / _blocks.size() );
+      for( uint32_t target = 1; target <= max_target; ++target )
+      {
+         fee_estimate& e   = _estimates[target];
+         e.target_blocks   = target;
+         e.min_fee_rate    = _min_fee_rate;
+         e.block_fee_rate  = _included.rate_at_quantile( 0.5 / target );
+         e.pool_fee_rate   = _pending.rate_at_depth( target * block_capacity );
+         e.fee_rate        = std::max( e.min_fee_rate, std::max( e.block_fee_rate, e.pool_fee_rate ) );
+         e.blocks_sampled  = _blocks.size();
+      }
+      _estimates[0] = _estimates[1];
+   }
+
+   fee_estimate fee_estimator::estimate( uint32_t target_blocks )const
+   {
+      std::unique_lock<std::mutex> lock( _mutex );
+      return _estimates[std::min( std::max<uint32_t>( 1, target_blocks ), max_target )];
+   }
+
+} } // bts::blockchain
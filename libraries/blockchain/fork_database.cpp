@@ -0,0 +1,187 @@
+#include <bts/blockchain/fork_database.hpp>
+#include <bts/blockchain/chain_database.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      class fork_database_impl
+      {
+         public:
+            fork_database_impl( uint32_t max_depth, uint32_t max_ahead )
+            :_max_depth(max_depth),_max_ahead(max_ahead){}
+
+            uint32_t                                                    _max_depth;
+            uint32_t                                                    _max_ahead;
+            mutable std::mutex                                          _mutex;
+            std::unordered_map<block_id_type, trx_block>                _blocks;
+            std::unordered_multimap<block_id_type, block_id_type>       _by_prev;
+            std::multimap<uint32_t, block_id_type>                      _by_num;
+
+            void insert( const block_id_type& id, const trx_block& blk )
+            {
+               if( !_blocks.insert( std::make_pair( id, blk ) ).second ) return;
+               _by_prev.insert( std::make_pair( blk.prev, id ) );
+               _by_num.insert( std::make_pair( blk.block_num, id ) );
+            }
+
+            /** removes id without its descendants */
+            void erase( const block_id_type& id )
+            {
+               auto itr = _blocks.find( id );
+               if( itr == _blocks.end() ) return;
+               auto prev = _by_prev.equal_range( itr->second.prev );
+               for( auto p = prev.first; p != prev.second; ++p )
+                  if( p->second == id ) { _by_prev.erase( p ); break; }
+               auto num = _by_num.equal_range( itr->second.block_num );
+               for( auto n = num.first; n != num.second; ++n )
+                  if( n->second == id ) { _by_num.erase( n ); break; }
+               _blocks.erase( itr );
+            }
+
+            void erase_branch( const block_id_type& id )
+            {
+               std::vector<block_id_type> pending( 1, id );
+               while( pending.size() )
+               {
+                  auto next = pending.back();
+                  pending.pop_back();
+                  auto children = _by_prev.equal_range( next );
+                  for( auto c = children.first; c != children.second; ++c ) pending.push_back( c->second );
+                  erase( next );
+               }
+            }
+
+            void prune( uint32_t head_block_num )
+            {
+               while( _by_num.size() && _by_num.begin()->first + _max_depth < head_block_num )
+                  erase( _by_num.begin()->second );
+            }
+      };
+
+      bool is_on_chain( chain_database& chain, const block_id_type& id )
+      {
+         if( id == chain.head_block_id() ) return true;
+         try {
+            chain.fetch_block_num( id );
+            return true;
+         }
+         catch ( const fc::key_not_found_exception& )
+         {
+            return false;
+         }
+      }
+
+   } // namespace detail
+
+   fork_database::fork_database( uint32_t max_depth, uint32_t max_ahead )
+   :my( new detail::fork_database_impl( max_depth, max_ahead ) )
+   {
+   }
+
+   fork_database::~fork_database()
+   {
+   }
+
+   bool fork_database::add_block( const trx_block& blk, uint32_t head_block_num )
+   {
+      if( blk.block_num + my->_max_depth < head_block_num || blk.block_num > head_block_num + my->_max_ahead )
+         return false;
+      auto id = blk.id();
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      if( my->_blocks.find( id ) != my->_blocks.end() ) return false;
+      my->insert( id, blk );
+      my->prune( head_block_num );
+      return true;
+   }
+
+   bool fork_database::contains( const block_id_type& id )const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_blocks.find( id ) != my->_blocks.end();
+   }
+
+   size_t fork_database::size()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_blocks.size();
+   }
+
+   void fork_database::remove_branch( const block_id_type& id )
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->erase_branch( id );
+   }
+
+   /**
+    *  The candidates are tried from the highest block down, the first whose ancestors are all
+    *  known and reach a block of the chain is the best branch.
+    */
+   chain_switch fork_database::update_chain( chain_database& chain )
+   { try {
+      chain_switch result;
+      while( true )
+      {
+         std::vector<trx_block> branch; // the tip first
+         uint32_t               fork_num = 0;
+         {
+            std::unique_lock<std::mutex> lock( my->_mutex );
+            for( auto itr = my->_by_num.rbegin(); itr != my->_by_num.rend() && branch.empty(); ++itr )
+            {
+               if( itr->first <= chain.head_block_num() ) break;
+               auto cur = my->_blocks.find( itr->second );
+               while( cur != my->_blocks.end() )
+               {
+                  branch.push_back( cur->second );
+                  if( detail::is_on_chain( chain, cur->second.prev ) )
+                  {
+                     fork_num = cur->second.block_num - 1;
+                     break;
+                  }
+                  cur = my->_blocks.find( cur->second.prev );
+               }
+               if( cur == my->_blocks.end() ) branch.clear();
+            }
+         }
+         if( branch.empty() ) break;
+
+         if( fork_num < chain.head_block_num() )
+            wlog( "switching to a branch of ${n} blocks from block ${fork}", ("n",branch.size())("fork",fork_num) );
+         while( chain.head_block_num() > fork_num )
+         {
+            result.popped.push_back( chain.pop_block() );
+            std::unique_lock<std::mutex> lock( my->_mutex );
+            my->insert( result.popped.back().id(), result.popped.back() );
+         }
+
+         for( auto itr = branch.rbegin(); itr != branch.rend(); ++itr )
+         {
+            auto id = itr->id();
+            try {
+               chain.push_block( *itr );
+            }
+            catch ( const fc::exception& e )
+            {
+               wlog( "dropping block ${id} and its descendants: ${e}", ("id",id)("e",e.to_detail_string()) );
+               std::unique_lock<std::mutex> lock( my->_mutex );
+               my->erase_branch( id );
+               break;
+            }
+            result.pushed.push_back( *itr );
+            std::unique_lock<std::mutex> lock( my->_mutex );
+            my->erase( id );
+         }
+      }
+
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->prune( chain.head_block_num() );
+      return result;
+   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+} } // bts::blockchain
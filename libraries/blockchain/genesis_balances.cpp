@@ -0,0 +1,220 @@
+#include <bts/blockchain/genesis_balances.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/io/datastream.hpp>
+#include <fc/io/raw.hpp>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace bts { namespace blockchain {
+
+namespace detail
+{
+   class genesis_balance_reader_impl
+   {
+      public:
+        genesis_balance_reader_impl( const fc::path& file )
+        :_binary(false),_done(false),_first(true)
+        {
+           _in.open( file.generic_string().c_str(), std::ios::binary );
+           FC_ASSERT( _in.good(), "unable to open ${file}", ("file",file) );
+           char magic[sizeof(genesis_balances_magic)];
+           _in.read( magic, sizeof(magic) );
+           if( _in.gcount() == sizeof(magic) && memcmp( magic, genesis_balances_magic, sizeof(magic) ) == 0 )
+           {
+              _binary = true;
+              return;
+           }
+           _in.clear();
+           _in.seekg( 0 );
+           find_balances();
+        }
+
+        /** @return false after the last balance */
+        bool next( pts_address& owner, uint64_t& amount )
+        {
+           if( _done )
+              return false;
+           if( _binary )
+           {
+              char record[sizeof(owner.addr) + sizeof(amount)];
+              _in.read( record, sizeof(record) );
+              if( _in.gcount() == 0 )
+                 return !(_done = true);
+              FC_ASSERT( _in.gcount() == sizeof(record), "truncated genesis balance file" );
+              fc::datastream<const char*> ds( record, sizeof(record) );
+              fc::raw::unpack( ds, owner );
+              fc::raw::unpack( ds, amount );
+              return true;
+           }
+           if( peek() == ']' )
+              return !(_done = true);
+           if( !_first )
+              expect( ',' );
+           _first = false;
+           expect( '[' );
+           owner = pts_address( read_string() );
+           expect( ',' );
+           amount = uint64_t( read_number() * 100000000 );
+           expect( ']' );
+           return true;
+        }
+
+      private:
+        /** moves to the first balance, skipping the other members of the object */
+        void find_balances()
+        {
+           expect( '{' );
+           while( peek() != '}' )
+           {
+              auto key = read_string();
+              expect( ':' );
+              if( key == "balances" )
+              {
+                 expect( '[' );
+                 return;
+              }
+              skip_value();
+              if( peek() == ',' )
+                 _in.get();
+           }
+           _done = true;
+        }
+
+        /** @return the next character that isn't whitespace, without consuming it */
+        char peek()
+        {
+           while( std::isspace( _in.peek() ) )
+              _in.get();
+           FC_ASSERT( _in.peek() != EOF, "unexpected end of genesis file" );
+           return char( _in.peek() );
+        }
+
+        void expect( char c )
+        {
+           FC_ASSERT( peek() == c, "expected '${c}' in genesis file at offset ${pos}", ("c",std::string(1,c))("pos",int64_t(_in.tellg())) );
+           _in.get();
+        }
+
+        std::string read_string()
+        {
+           expect( '"' );
+           std::string result;
+           for( int c = _in.get(); c != '"'; c = _in.get() )
+           {
+              FC_ASSERT( c != EOF, "unterminated string in genesis file" );
+              if( c == '\\' )
+                 c = _in.get();
+              result.push_back( char(c) );
+           }
+           return result;
+        }
+
+        double read_number()
+        {
+           peek();
+           std::string number;
+           while( std::isdigit( _in.peek() ) || strchr( "+-.eE", _in.peek() ) != nullptr )
+              number.push_back( char(_in.get()) );
+           FC_ASSERT( !number.empty(), "expected a number in genesis file at offset ${pos}", ("pos",int64_t(_in.tellg())) );
+           return strtod( number.c_str(), nullptr );
+        }
+
+        void skip_value()
+        {
+           char c = peek();
+           if( c == '"' )
+           {
+              read_string();
+              return;
+           }
+           if( c != '{' && c != '[' )
+           {
+              // a number, true, false or null
+              while( _in.peek() != EOF && !std::isspace( _in.peek() ) && !strchr( ",]}", _in.peek() ) )
+                 _in.get();
+              return;
+           }
+           uint32_t depth = 0;
+           do
+           {
+              c = peek();
+              if( c == '"' ) { read_string(); continue; }
+              _in.get();
+              if( c == '{' || c == '[' ) ++depth;
+              else if( c == '}' || c == ']' ) --depth;
+           } while( depth > 0 );
+        }
+
+        std::ifstream _in;
+        bool          _binary;
+        bool          _done;
+        bool          _first;
+   };
+
+   class genesis_balance_writer_impl
+   {
+      public:
+        genesis_balance_writer_impl( const fc::path& file )
+        {
+           _out.open( file.generic_string().c_str(), std::ios::binary | std::ios::trunc );
+           FC_ASSERT( _out.good(), "unable to open ${file}", ("file",file) );
+           _out.write( genesis_balances_magic, sizeof(genesis_balances_magic) );
+        }
+
+        void write( const pts_address& owner, uint64_t amount )
+        {
+           char record[sizeof(owner.addr) + sizeof(amount)];
+           fc::datastream<char*> ds( record, sizeof(record) );
+           fc::raw::pack( ds, owner );
+           fc::raw::pack( ds, amount );
+           _out.write( record, sizeof(record) );
+           FC_ASSERT( _out.good(), "error writing genesis balance file" );
+        }
+
+        void close()
+        {
+           _out.close();
+           FC_ASSERT( !_out.fail(), "error closing genesis balance file" );
+        }
+
+        std::ofstream _out;
+   };
+} // namespace detail
+
+genesis_balance_reader::genesis_balance_reader( const fc::path& file )
+:my( new detail::genesis_balance_reader_impl( file ) )
+{
+}
+
+genesis_balance_reader::~genesis_balance_reader()
+{
+}
+
+bool genesis_balance_reader::next( pts_address& owner, uint64_t& amount )
+{
+   return my->next( owner, amount );
+}
+
+genesis_balance_writer::genesis_balance_writer( const fc::path& file )
+:my( new detail::genesis_balance_writer_impl( file ) )
+{
+}
+
+genesis_balance_writer::~genesis_balance_writer()
+{
+}
+
+void genesis_balance_writer::write( const pts_address& owner, uint64_t amount )
+{
+   my->write( owner, amount );
+}
+
+void genesis_balance_writer::close()
+{
+   my->close();
+}
+
+} } // bts::blockchain
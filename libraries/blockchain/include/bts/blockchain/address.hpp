@@ -27,6 +27,13 @@ namespace bts { namespace blockchain {
        static bool is_valid(const std::string& base58str );
        operator    std::string()const; ///< converts to base58 + checksum
 
+       /**
+        *  Keeps the string form of addr for the life of the process, converting it
+        *  to or from a string is then a lookup.  For the addresses of a wallet, which
+        *  every listing converts again.  Thread safe.
+        */
+       static void memoize( const address& addr );
+
        fc::ripemd160      addr;
    };
    inline bool operator == ( const address& a, const address& b ) { return a.addr == b.addr; }
@@ -50,7 +57,7 @@ namespace std
        public:
          size_t operator()(const bts::blockchain::address &a) const 
          {
-            return (uint64_t(a.addr._hash[0])<<32) | uint64_t( a.addr._hash[0] );
+            return (uint64_t(a.addr._hash[1])<<32) | uint64_t( a.addr._hash[0] );
          }
    };
 }
@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+  /** the longest input base58_encode and base58_decode accept, in bytes */
+  static const size_t max_base58_size = 128;
+
+  /**
+   *  The same encoding as fc::to_base58, computed in fixed size arrays of 32 bit limbs
+   *  that are divided by 58^5 at a time instead of with a generic bignum.
+   *
+   *  @throw if len > max_base58_size
+   */
+  std::string       base58_encode( const char* data, size_t len );
+
+  /** @throw if s has a character that is not base58 or decodes to more than max_base58_size bytes */
+  std::vector<char> base58_decode( const std::string& s );
+
+} } // bts::blockchain
@@ -8,6 +8,21 @@ namespace bts { namespace blockchain {
 
    typedef uint160  block_id_type;
 
+   /**
+    *  The hashes needed to recompute a block's trx_mroot from a single
+    *  transaction id, ordered from the leaves to the root.
+    */
+   struct merkle_branch
+   {
+      merkle_branch():index(0){}
+
+      /** @return the merkle root of a tree in which leaf is at position index */
+      uint160 calculate_root( const uint160& leaf )const;
+
+      uint32_t              index;  ///< position of the leaf among the transaction ids
+      std::vector<uint160>  hashes; ///< the sibling at each layer
+   };
+
    /**
     *  Light-weight summary of a block that links it to
     *  all prior blocks.  This summary does not contain
@@ -76,6 +91,7 @@ namespace bts { namespace blockchain {
       digest_block(){}
 
       uint160 calculate_merkle_root()const;
+      merkle_branch calculate_merkle_branch( uint32_t trx_idx )const;
 
 
       std::vector<uint160>  trx_ids; 
@@ -96,12 +112,20 @@ namespace bts { namespace blockchain {
       trx_block( const block_header& b, std::vector<signed_transaction> trs )
       :signed_block_header(b),trxs( std::move(trs) ){}
 
-      size_t block_size()const;
-
       trx_block(){}
 
+      void add_transaction( const signed_transaction& trx );
+
+      /**
+       *  @return the packed size of the block.  It is summed over trxs on every call, which
+       *  only packs the transactions whose size was not asked for before, so trxs may be
+       *  changed in any way in between.
+       */
+      size_t block_size()const;
+
      // operator digest_block()const;
       uint160 calculate_merkle_root( const signed_transactions& deterministic_trxs )const;
+      merkle_branch calculate_merkle_branch( uint32_t trx_idx, const signed_transactions& deterministic_trxs )const;
 
       signed_transactions trxs;
    };
@@ -114,6 +138,7 @@ namespace fc
    void from_variant( const variant& var,  bts::blockchain::trx_output& vo );
 }
 
+FC_REFLECT( bts::blockchain::merkle_branch, (index)(hashes) )
 FC_REFLECT( bts::blockchain::block_header,  (version)(block_num)(prev)(timestamp)(next_fee)(total_shares)(trx_mroot) )
 FC_REFLECT_DERIVED( bts::blockchain::signed_block_header, (bts::blockchain::block_header), (trustee_signature) )
 FC_REFLECT_DERIVED( bts::blockchain::digest_block,  (bts::blockchain::signed_block_header), (trx_ids)(deterministic_ids) )
@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <string>
 #include <bts/blockchain/block.hpp>
 
 namespace bts { namespace blockchain {
@@ -8,7 +9,7 @@ namespace bts { namespace blockchain {
   
   /**
    *  @class block_miner;
-   *  @brief Mines blocks in a background thread.
+   *  @brief Mines blocks on the mining pool of bts::db::executor.
    */
   class block_miner 
   {
@@ -19,6 +20,16 @@ namespace bts { namespace blockchain {
 
         void set_block( const block_header& header, const block_header& prev_header, uint64_t miner_votes, uint64_t min_votes );
         void set_effort( float effort );
+        /** the number of threads used by each momentum search, 0 uses one per thread of the mining pool */
+        void set_threads( uint32_t num_threads );
+        /**
+         *  Searches with the miner_backend registered under name on device from the next
+         *  attempt on, "cpu" by default.  A backend that can't use the device is logged
+         *  by each attempt to create it.
+         *
+         *  @throw if no backend is registered under name
+         */
+        void set_backend( const std::string& name, uint32_t device = 0 );
         void set_callback( const callback& cb );
 
      private:
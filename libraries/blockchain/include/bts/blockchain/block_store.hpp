@@ -0,0 +1,58 @@
+#pragma once
+#include <bts/blockchain/block.hpp>
+
+#include <iosfwd>
+#include <memory>
+
+namespace fc { class path; }
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class block_store_impl; }
+
+   /**
+    *  @class block_store
+    *  @ingroup blockchain
+    *
+    *  An append only archive of whole trx_blocks.  Blocks are kept in segment files of
+    *  blocks_per_segment blocks each as a uint32_t size followed by the block packed with
+    *  fc::raw, the same records chain_database::export_blocks writes.  The offset of every
+    *  block within its segment is kept in memory and in an index file beside the segments.
+    *
+    *  Segments are memory mapped to read from, so fetching a block is an offset lookup and
+    *  one unpack instead of a LevelDB read per transaction.  A read maps its segment the
+    *  first time it is needed, which is why fetch and write_records are not const.
+    *
+    *  Records are written before their offset, a record whose offset is missing after a
+    *  crash is truncated away on open.  Not thread safe.
+    */
+   class block_store
+   {
+      public:
+         static const uint32_t blocks_per_segment = 10000;
+
+         block_store();
+         ~block_store();
+
+         void      open( const fc::path& dir );
+         void      close();
+         bool      is_open()const;
+
+         /** @return the number of blocks stored, they are blocks 0 through size() - 1 */
+         uint32_t  size()const;
+
+         /** @param blk must be block size() */
+         void      append( const trx_block& blk );
+
+         /** removes every block from block_count on */
+         void      truncate( uint32_t block_count );
+
+         trx_block fetch( uint32_t block_num );
+         /** copies the records of blocks [first,last] from the segments to out */
+         void      write_records( uint32_t first, uint32_t last, std::ostream& out );
+
+      private:
+         std::unique_ptr<detail::block_store_impl> my;
+   };
+
+} } // bts::blockchain
@@ -0,0 +1,57 @@
+#pragma once
+#include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/transaction_pool.hpp>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class block_template_impl; }
+
+   /**
+    *  @class block_template
+    *  @brief the next block a trustee would produce, kept up to date as transactions arrive
+    *
+    *  Each transaction admitted to the pool is evaluated once, against the block state of
+    *  the template, and appended if it is valid together with those already included, pays
+    *  the minimum fee and fits in BTS_BLOCKCHAIN_MAX_BLOCK_SIZE.  The size and fees of the
+    *  block are kept as transactions are appended.
+    *
+    *  After each block is pushed, reset() starts over on the new head with what is left in
+    *  the pool, highest fee rate first.  generate_block() only fills in the header, unless
+    *  transactions have left the pool or a better one didn't fit since the last reset(); then
+    *  it resets first.  The block state kept for appending transactions is also what the
+    *  trustee pushes the block with, instead of evaluating it a second time.
+    *
+    *  Not thread safe, use it on the thread that pushes blocks to the chain_database.
+    */
+   class block_template
+   {
+      public:
+         block_template( chain_database& db, const transaction_pool& pool );
+         ~block_template();
+
+         /** rebuilds the template on the head block from a snapshot of the pool */
+         void       reset();
+
+         /** @return true if trx was included in the template */
+         bool       add( const pooled_transaction_ptr& trx );
+
+         /** @return the block to sign, empty of transactions if none could be included */
+         trx_block  generate_block();
+
+         /**
+          *  Hands over the block state that the transactions of the block last returned by
+          *  generate_block() were evaluated into, and their summary, so that the block can be
+          *  pushed with chain_database::push_trusted_block().  Call it before anything is
+          *  added, the template includes nothing more until it is reset.
+          */
+         block_evaluation_state_ptr release_block_state( transaction_summary& summary );
+
+         size_t     size()const;       ///< number of transactions included
+         size_t     block_size()const; ///< packed bytes
+         int64_t    fees()const;
+
+      private:
+         std::unique_ptr<detail::block_template_impl> my;
+   };
+
+} } // bts::blockchain
@@ -3,6 +3,11 @@
 #include <bts/blockchain/transaction.hpp>
 #include <bts/blockchain/transaction_validator.hpp>
 #include <bts/blockchain/pow_validator.hpp>
+#include <bts/blockchain/signature_cache.hpp>
+#include <bts/db/level_options.hpp>
+#include <bts/db/table_stats.hpp>
+
+#include <mutex>
 
 namespace fc
 {
@@ -11,7 +16,7 @@ namespace fc
 
 namespace bts { namespace blockchain {
 
-    namespace detail  { class chain_database_impl; }
+    namespace detail  { class chain_database_impl; class chain_snapshot_impl; }
 
     struct name_record
     {
@@ -33,6 +38,123 @@ namespace bts { namespace blockchain {
        int64_t              votes_against;
     };
 
+    /**
+     *  Everything a light client needs to check that trx is included in a block
+     *  whose header it already trusts.
+     */
+    struct transaction_proof
+    {
+       signed_block_header  header;
+       merkle_branch        branch;
+       signed_transaction   trx;
+
+       /** @return true if branch links trx to header.trx_mroot */
+       bool verify()const { return branch.calculate_root( trx.id() ) == header.trx_mroot; }
+    };
+
+    /** an unspent output found through the owner index, see chain_database::set_owner_index */
+    struct owned_output
+    {
+       output_reference  ref;
+       trx_num           source; ///< the transaction that created the output
+       int32_t           vote;   ///< of the transaction that created the output
+       trx_output        output;
+    };
+
+    /**
+     *  LevelDB tuning for the indexes of a chain_database.  When all indexes share
+     *  a single database (see chain_database::set_single_database) hash_indexes is used for it.
+     */
+    struct chain_database_tuning
+    {
+       chain_database_tuning()
+       :hash_indexes( bts::db::level_options::hash_keyed() ),unspent_output_cache_size(100000),
+        sync_block_count(0),sync_interval_ms(0){}
+
+       bts::db::level_options  hash_indexes; ///< trx_id2num and blk_id2num
+       bts::db::level_options  records;      ///< blocks, transactions, delegates, names and unspent outputs
+       uint32_t                unspent_output_cache_size; ///< number of unspent outputs kept in memory
+
+       /**
+        *  Group commit: the write of a block is synced to disk once sync_block_count blocks
+        *  were written since the last sync, or sync_interval_ms after it, whichever comes
+        *  first.  A sync also makes the writes before it durable, so a crash loses at most the
+        *  blocks written since.  1 syncs every block, 0 for both leaves it to the operating
+        *  system.  The interval is checked when a block is written, close() syncs what is left.
+        *
+        *  Only a single database (set_single_database) writes each block as one batch, with
+        *  separate databases a crash between syncs may leave the indexes of a block without it.
+        */
+       uint32_t                sync_block_count;
+       uint32_t                sync_interval_ms;
+    };
+
+    /** what the storage of a chain_database did since it was opened, see get_storage_stats() */
+    struct storage_stats
+    {
+       storage_stats():unspent_output_cache_size(0),unspent_output_cache_hits(0),unspent_output_cache_misses(0){}
+
+       std::map<std::string,bts::db::table_stats>                tables;
+       /** the properties of each database by its directory, "chain" when they share one */
+       std::map<std::string,std::map<std::string,std::string> >  databases;
+       uint64_t                                                  unspent_output_cache_size;
+       uint64_t                                                  unspent_output_cache_hits;
+       uint64_t                                                  unspent_output_cache_misses;
+       signature_cache_stats                                     signature_cache;
+    };
+
+    /**
+     *  @class chain_snapshot
+     *  @ingroup blockchain
+     *
+     *  A read only view of a chain_database as of the head block when it was taken.  Reads
+     *  go to LevelDB snapshots of every index, so they see neither blocks pushed or popped
+     *  since nor a block that is half applied, and they may be made from any thread while
+     *  the chain_database keeps applying blocks.  Nothing is cached, every read goes to LevelDB.
+     *
+     *  A snapshot keeps the database files it reads from being compacted away, release it
+     *  when done.  It must not be used once the chain_database is closed.
+     */
+    class chain_snapshot
+    {
+       public:
+          ~chain_snapshot();
+
+          const signed_block_header&  get_head_block()const;
+          uint32_t                    head_block_num()const;
+          block_id_type               head_block_id()const;
+
+          fc::optional<name_record>   lookup_name( const std::string& name )const;
+          fc::optional<name_record>   lookup_delegate( uint16_t del )const;
+          /** @return the top *count* delegates by vote */
+          std::vector<name_record>    get_delegates( uint32_t count = 100 )const;
+
+          trx_num                     fetch_trx_num( const uint160& trx_id )const;
+          meta_trx                    fetch_trx( const trx_num& t )const;
+          signed_transaction          fetch_transaction( const transaction_id_type& trx_id )const;
+          trx_output                  fetch_output( const output_reference& ref )const;
+
+          uint32_t                    fetch_block_num( const block_id_type& block_id )const;
+          signed_block_header         fetch_block( uint32_t block_num )const;
+          digest_block                fetch_digest_block( uint32_t block_num )const;
+          trx_block                   fetch_trx_block( uint32_t block_num )const;
+          transaction_proof           fetch_transaction_proof( const transaction_id_type& trx_id )const;
+
+          /**
+           *  @return the unspent outputs claimable by any of owners or pts_owners, a range scan
+           *          of the owner index per owner
+           *  @throw if the chain_database was not opened with an owner index
+           */
+          std::vector<owned_output>   fetch_owned_outputs( const std::vector<address>& owners,
+                                                           const std::vector<pts_address>& pts_owners )const;
+
+       private:
+          friend class chain_database;
+          chain_snapshot( const detail::chain_database_impl& db );
+          std::unique_ptr<detail::chain_snapshot_impl> my;
+    };
+    typedef std::shared_ptr<const chain_snapshot> chain_snapshot_ptr;
+
     /**
      *  @class chain_database
      *  @ingroup blockchain
@@ -64,6 +186,24 @@ namespace bts { namespace blockchain {
            */
           virtual void store( const trx_block& blk, const signed_transactions& deterministic_trxs, const block_evaluation_state_ptr& state );
 
+          /**
+           *  Called by validate() and push_trusted_block() once all transactions of blk have
+           *  been evaluated into state, for the checks derived databases make of the whole
+           *  block.  It should throw an exception if the block is invalid.
+           */
+          virtual void validate_block_state( const trx_block& blk, const block_evaluation_state_ptr& state ){}
+
+          /**
+           *  Called by pop_block once the removal of the head block is staged so that
+           *  derived databases can revert whatever they stored for it.  Reads of the
+           *  chain see the staged removal.  Writes are to be staged in batches as well,
+           *  then written by commit_undo() once the chain has committed the removal and
+           *  dropped the block from its id list and block store, or dropped by abort_undo()
+           *  if undo or the chain's commit failed.
+           */
+          virtual void undo( const trx_block& blk );
+          virtual void commit_undo(){}
+          virtual void abort_undo(){}
 
        public:
           chain_database();
@@ -76,11 +216,34 @@ namespace bts { namespace blockchain {
            */
           virtual signed_transactions generate_deterministic_transactions();
 
-          void evaluate_transaction( const signed_transaction& trx );
+          /**
+           *  True while validate() or push_trusted_block() evaluate the transactions returned by
+           *  generate_deterministic_transactions(), which the chain created itself, so that
+           *  validators can accept inputs without the signatures of their owners in them only.
+           */
+          bool is_evaluating_deterministic_transactions()const;
+
+          /** evaluates trx on its own against the head block, throws if it is invalid */
+          transaction_summary evaluate_transaction( const signed_transaction& trx );
+
+          /**
+           *  The checks of validate() that don't evaluate transactions: the trustee signature,
+           *  that blk follows the head block and its trx_mroot.  A block that passes them can
+           *  be relayed to peers while it is validated.  Throws if blk can't be the next block.
+           */
+          void validate_for_relay( const trx_block& blk );
 
           fc::optional<name_record> lookup_name( const std::string& name );
           fc::optional<name_record> lookup_delegate( uint16_t del );
 
+          /**
+           *  Serializes the reads of transactions evaluated in parallel, see
+           *  transaction_validator::supports_parallel_evaluation().  fetch_inputs(), lookup_name()
+           *  and lookup_delegate() take it themselves, a validator holds it around any other
+           *  read of the database.  The lock may be taken again by the thread that holds it.
+           */
+          std::unique_lock<std::recursive_mutex> lock_reads()const;
+
           /**
            *  @param count - the number of delegates to return
            *
@@ -112,7 +275,69 @@ namespace bts { namespace blockchain {
           void set_transaction_validator( const transaction_validator_ptr& v );
           transaction_validator_ptr get_transaction_validator()const;
 
-          virtual void open( const fc::path& dir, bool create = true );
+          /**
+           *  When set before open() every index is stored as a prefixed keyspace of
+           *  a single LevelDB so that each block is applied with one write.  Existing
+           *  databases are always opened with the layout they were created with.
+           */
+          void set_single_database( bool single );
+
+          /**
+           *  When set before open() the unspent claim_by_signature and claim_by_pts outputs are
+           *  also indexed by owner so that chain_snapshot::fetch_owned_outputs can find those of
+           *  a key without scanning the chain.  The index is built on open if it is missing and
+           *  dropped on open if it is no longer wanted.
+           */
+          void set_owner_index( bool index );
+          bool has_owner_index()const;
+
+          /**
+           *  When set before open() every block is also appended to a block_store in dir/"block_store"
+           *  that fetch_trx_block and export_blocks read whole blocks from.  A store that is behind
+           *  the chain is caught up on open.
+           */
+          void set_block_store( bool store );
+          bool has_block_store()const;
+
+          /**
+           *  When not 0, blocks more than depth below the head lose their undo record, so they can
+           *  no longer be popped, and the transactions whose outputs they spent the last of are
+           *  dropped from LevelDB.  fetch_trx reads dropped transactions from the block store and
+           *  reports their outputs spent by the transaction itself, without a store they are not
+           *  found and neither are the blocks that include them.
+           *
+           *  Only blocks stored while a depth is set are pruned.
+           */
+          void     set_prune_depth( uint32_t depth );
+          uint32_t get_prune_depth()const;
+
+          /**
+           *  While set, blocks are stored without updating the block and transaction id
+           *  indexes, whose random keys dominate LevelDB compaction during an initial import.
+           *  Clearing it rebuilds both in one pass over the blocks and transactions.  Lookups by
+           *  id fail meanwhile, and with them the check of inputs that spend a spent output, so
+           *  only defer the indexes to import trusted blocks.  A database closed with the indexes
+           *  deferred rebuilds them on open.
+           */
+          void set_defer_indexes( bool defer );
+
+          /**
+           *  The counts and latencies of every index, the LevelDB statistics of their databases
+           *  and the hit rates of the caches in front of them.  Reading the LevelDB properties
+           *  takes a lock inside LevelDB, this is meant to be called every few seconds at most.
+           */
+          storage_stats get_storage_stats()const;
+
+          /**
+           *  The memory taken by the cache of unspent outputs, estimated from the number of
+           *  outputs it holds, and a limit in bytes that evicts the least recently used outputs
+           *  above it.  Replaces the unspent_output_cache_size the database was opened with.
+           */
+          uint64_t get_unspent_output_cache_bytes()const;
+          void     set_unspent_output_cache_bytes( uint64_t bytes );
+
+          virtual void open( const fc::path& dir, bool create = true,
+                             const chain_database_tuning& tuning = chain_database_tuning() );
           virtual void close();
 
           const signed_block_header&  get_head_block()const;
@@ -129,16 +354,40 @@ namespace bts { namespace blockchain {
 
          trx_num    fetch_trx_num( const uint160& trx_id );
          meta_trx   fetch_trx( const trx_num& t );
+         /** unpacks into trx reusing its storage, for callers that fetch in a loop */
+         void       fetch_trx( const trx_num& t, meta_trx& trx );
 
          signed_transaction          fetch_transaction( const transaction_id_type& trx_id );
          std::vector<meta_trx_input> fetch_inputs( const std::vector<trx_input>& inputs, uint32_t head = trx_num::invalid_block_num );
 
          trx_output fetch_output(const output_reference& ref);
 
+         /**
+          *  @return up to limit unspent outputs created by blocks before block_num, oldest first,
+          *  read from an index of the unspent outputs by creation so that the outputs crossing an
+          *  age threshold are found without scanning the chain
+          */
+         std::vector<output_reference> fetch_unspent_outputs_before( uint32_t block_num, uint32_t limit );
+
          uint32_t                   fetch_block_num( const block_id_type& block_id );
+         /** served from memory, without reading or hashing the header */
+         block_id_type              fetch_block_id( uint32_t block_num );
+         /** @return the ids of up to count blocks starting with block_num, served from memory */
+         std::vector<block_id_type> fetch_block_ids( uint32_t block_num, uint32_t count );
          signed_block_header        fetch_block( uint32_t block_num );
          digest_block               fetch_digest_block( uint32_t block_num );
          trx_block                  fetch_trx_block( uint32_t block_num );
+         /** @return the transactions generate_deterministic_transactions() created for block_num */
+         signed_transactions        fetch_deterministic_trxs( uint32_t block_num );
+
+         /** @return the header of the block that includes trx_id and a merkle branch to it */
+         transaction_proof          fetch_transaction_proof( const transaction_id_type& trx_id );
+
+         /**
+          *  Takes a consistent view of the chain that other threads can read while blocks
+          *  are pushed and popped.  Call it on the thread that pushes blocks.
+          */
+         chain_snapshot_ptr         get_snapshot()const;
 
          /**
           *  Validates the block and then pushes it into the database.
@@ -147,14 +396,41 @@ namespace bts { namespace blockchain {
           */
          void push_block( const trx_block& b );
 
+         /**
+          *  Pushes a block this node built on the head block, without evaluating its
+          *  transactions again.  state and summary are what evaluating b.trxs in order into
+          *  one block state produced, see block_template::release_block_state().  The header
+          *  and the deterministic transactions are still checked, and state is updated by
+          *  them and stored.
+          */
+         void push_trusted_block( const trx_block& b, const block_evaluation_state_ptr& state,
+                                  const transaction_summary& summary );
+
          /**
           *  Removes the top block from the stack and marks all spent outputs as
           *  unspent.
           */
          virtual trx_block pop_block();
 
+         /**
+          *  Writes blocks [first,last] to path as a stream of trx_blocks, each packed with
+          *  fc::raw and preceded by its packed size as a uint32_t.
+          */
+         void       export_blocks( uint32_t first, uint32_t last, const fc::path& path );
+
+         /**
+          *  Pushes the blocks of a file written by export_blocks, which must continue the chain.
+          *  The file is memory mapped and batch_size blocks are applied with each LevelDB write,
+          *  a batch with an invalid block is not applied at all.
+          *
+          *  @param trusted skip the trustee signature of each block, for files from a known source
+          *  @return the number of blocks pushed
+          */
+         uint32_t   import_blocks( const fc::path& path, bool trusted = false, uint32_t batch_size = 100 );
+
        private:
          void   store_trx( const signed_transaction& trx, const trx_num& t );
+         void   validate_header( const trx_block& b );
          std::unique_ptr<detail::chain_database_impl> my;
     }; // chain_database
 
@@ -164,4 +440,8 @@ namespace bts { namespace blockchain {
 
 FC_REFLECT( bts::blockchain::trx_num,  (block_num)(trx_idx) );
 FC_REFLECT( bts::blockchain::name_record, (delegate_id)(name)(data)(owner)(votes_for)(votes_against) )
+FC_REFLECT( bts::blockchain::transaction_proof, (header)(branch)(trx) )
+FC_REFLECT( bts::blockchain::owned_output, (ref)(source)(vote)(output) )
+FC_REFLECT( bts::blockchain::storage_stats, (tables)(databases)(unspent_output_cache_size)(unspent_output_cache_hits)(unspent_output_cache_misses)(signature_cache) )
+FC_REFLECT( bts::blockchain::chain_database_tuning, (hash_indexes)(records)(unspent_output_cache_size)(sync_block_count)(sync_interval_ms) )
 
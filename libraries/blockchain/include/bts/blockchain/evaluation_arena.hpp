@@ -0,0 +1,124 @@
+#pragma once
+#include <fc/variant.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   /**
+    *  @class evaluation_arena
+    *  @brief a monotonic allocator for the state of evaluating one block
+    *
+    *  Allocations are carved in order out of chunks that are only returned to the heap
+    *  when the arena is released or destroyed, so the containers of every transaction
+    *  evaluated for a block cost a pointer bump per allocation instead of a heap call.
+    *  Deallocating is a no-op.  Not thread safe.
+    */
+   class evaluation_arena
+   {
+      public:
+         evaluation_arena( size_t chunk_size = 16 * 1024 );
+         ~evaluation_arena();
+
+         void* allocate( size_t size, size_t align )
+         {
+            size_t pad = (align - size_t(_pos) % align) % align;
+            if( size + pad > size_t(_end - _pos) )
+               return allocate_chunk( size, align );
+            char* result = _pos + pad;
+            _pos = result + size;
+            return result;
+         }
+
+         /** frees every chunk but the first, all memory allocated before is invalid */
+         void   release();
+
+         /** of all chunks, including the unused part of the last */
+         size_t capacity()const;
+
+      private:
+         evaluation_arena( const evaluation_arena& );
+         evaluation_arena& operator=( const evaluation_arena& );
+
+         void* allocate_chunk( size_t size, size_t align );
+
+         std::vector<std::unique_ptr<char[]>>  _chunks;
+         std::vector<size_t>                   _chunk_sizes;
+         size_t                                _chunk_size;
+         char*                                 _pos;
+         char*                                 _end;
+   };
+
+   /**
+    *  Allocates from an evaluation_arena, or from the heap when constructed without one so
+    *  that an evaluation state can still be used on its own.
+    */
+   template<typename T>
+   class arena_allocator
+   {
+      public:
+         typedef T              value_type;
+         typedef T*             pointer;
+         typedef const T*       const_pointer;
+         typedef T&             reference;
+         typedef const T&       const_reference;
+         typedef size_t         size_type;
+         typedef std::ptrdiff_t difference_type;
+
+         template<typename U> struct rebind { typedef arena_allocator<U> other; };
+
+         arena_allocator( evaluation_arena* arena = nullptr ):_arena(arena){}
+         template<typename U>
+         arena_allocator( const arena_allocator<U>& other ):_arena(other.arena()){}
+
+         pointer allocate( size_type n, const void* = 0 )
+         {
+            if( _arena ) return static_cast<pointer>( _arena->allocate( n * sizeof(T), alignof(T) ) );
+            return static_cast<pointer>( ::operator new( n * sizeof(T) ) );
+         }
+
+         void deallocate( pointer p, size_type )
+         {
+            if( !_arena ) ::operator delete( p );
+         }
+
+         template<typename U, typename... Args>
+         void construct( U* p, Args&&... args ) { ::new((void*)p) U( std::forward<Args>(args)... ); }
+         template<typename U>
+         void destroy( U* p ) { p->~U(); }
+
+         pointer       address( reference r )const       { return &r; }
+         const_pointer address( const_reference r )const { return &r; }
+         size_type     max_size()const                   { return size_type(-1) / sizeof(T); }
+
+         evaluation_arena* arena()const { return _arena; }
+
+      private:
+         evaluation_arena* _arena;
+   };
+
+   template<typename T, typename U>
+   bool operator==( const arena_allocator<T>& a, const arena_allocator<U>& b ) { return a.arena() == b.arena(); }
+   template<typename T, typename U>
+   bool operator!=( const arena_allocator<T>& a, const arena_allocator<U>& b ) { return a.arena() != b.arena(); }
+
+   /** flat storage for the few entries a transaction has of each kind, searched linearly */
+   template<typename T>
+   using arena_vector = std::vector<T, arena_allocator<T>>;
+
+} } // bts::blockchain
+
+namespace fc
+{
+   template<typename T>
+   void to_variant( const bts::blockchain::arena_vector<T>& values, variant& v )
+   {
+      std::vector<variant> vars( values.size() );
+      for( size_t i = 0; i < values.size(); ++i )
+         vars[i] = variant( values[i] );
+      v = std::move( vars );
+   }
+}
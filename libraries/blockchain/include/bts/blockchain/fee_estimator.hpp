@@ -0,0 +1,119 @@
+#pragma once
+#include <fc/reflect/reflect.hpp>
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   /**
+    *  @class fee_histogram
+    *  @brief bytes of transactions by fee rate, in buckets 10% apart
+    *
+    *  Rates are in milli-shares per byte, the unit of chain_database::get_fee_rate().  A
+    *  bucket is identified by the lowest rate it holds, so the rates it reports are never
+    *  above those actually paid.
+    */
+   class fee_histogram
+   {
+      public:
+         static const uint32_t bucket_count = 256;
+
+         fee_histogram();
+
+         void     add( uint64_t fee_rate, uint64_t bytes );
+         void     remove( uint64_t fee_rate, uint64_t bytes );
+         void     clear();
+
+         uint64_t total_bytes()const { return _total_bytes; }
+
+         /** the rate a transaction must pay to have less than depth bytes paying more ahead of it */
+         uint64_t rate_at_depth( uint64_t depth )const;
+         /** the rate below which a fraction q of the bytes pay, 0 if there are none */
+         uint64_t rate_at_quantile( double q )const;
+
+         static uint32_t bucket_of( uint64_t fee_rate );
+         /** the lowest rate of bucket */
+         static uint64_t rate_of( uint32_t bucket );
+
+      private:
+         std::array<uint64_t,bucket_count> _bytes;
+         uint64_t                          _total_bytes;
+   };
+
+   struct fee_estimate
+   {
+      fee_estimate():target_blocks(0),fee_rate(0),min_fee_rate(0),block_fee_rate(0),pool_fee_rate(0),blocks_sampled(0){}
+
+      uint32_t target_blocks;
+      uint64_t fee_rate;        ///< what to pay to be included within target_blocks, the highest of the three below
+      uint64_t min_fee_rate;    ///< the chain's required fee rate
+      uint64_t block_fee_rate;  ///< what recent blocks included transactions at
+      uint64_t pool_fee_rate;   ///< what outbids the pending transactions that fill target_blocks
+      uint32_t blocks_sampled;
+   };
+
+   /**
+    *  @class fee_estimator
+    *  @brief answers what fee rate gets a transaction included within a number of blocks
+    *
+    *  Keeps the fee rates of the transactions included by the last window blocks and the
+    *  distribution of the pending ones, each block and each change of the pool only adds
+    *  and subtracts buckets.  The estimates for every target are recomputed when either
+    *  changes, so estimate() is a lookup.
+    *
+    *  For a target of n blocks the rate recent blocks were filled at is the quantile 0.5/n
+    *  of their included bytes: the median rate for the next block, lower rates as waiting
+    *  longer is acceptable.  The pending transactions that pay more would take n blocks
+    *  of the average included size, a new one has to outbid all of those beyond that.
+    *
+    *  All methods are thread safe.
+    */
+   class fee_estimator
+   {
+      public:
+         static const uint32_t max_target = 25;
+
+         fee_estimator( uint32_t window = 100 );
+
+         /**
+          *  @param included the fee rate and packed size of each transaction of the block
+          *         whose fees are known
+          *  @param block_size the packed size of all of its transactions
+          */
+         void         record_block( const std::vector<std::pair<uint64_t,uint32_t> >& included, uint64_t block_size );
+
+         /** recomputes the estimates for the pending transactions and required rate of now */
+         void         update( const fee_histogram& pending, uint64_t min_fee_rate );
+
+         /** target_blocks is clamped to [1, max_target] */
+         fee_estimate estimate( uint32_t target_blocks )const;
+
+      private:
+         struct sampled_block
+         {
+            std::vector<std::pair<uint64_t,uint32_t> > included;
+            uint64_t                                   size;
+         };
+
+         /** caller must hold _mutex */
+         void         recompute();
+
+         uint32_t                                   _window;
+         mutable std::mutex                         _mutex;
+         std::deque<sampled_block>                  _blocks;
+         fee_histogram                              _included;
+         uint64_t                                   _sampled_bytes;
+         fee_histogram                              _pending;
+         uint64_t                                   _min_fee_rate;
+         std::array<fee_estimate,max_target+1>      _estimates;
+   };
+   typedef std::shared_ptr<fee_estimator> fee_estimator_ptr;
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::fee_estimate, (target_blocks)(fee_rate)(min_fee_rate)(block_fee_rate)(pool_fee_rate)(blocks_sampled) )
@@ -0,0 +1,84 @@
+#pragma once
+#include <fc/uint128.hpp>
+#include <stdint.h>
+
+/**
+ *  64.64 fixed point arithmetic on the native 128 bit integers of GCC and Clang, which
+ *  needs neither the heap nor OpenSSL.  Every result is rounded down like the fc::bigint
+ *  arithmetic it replaces.  Where the compiler has no 128 bit integer BTS_HAS_INT128 is
+ *  not defined and asset.cpp keeps using fc::bigint.
+ */
+#if defined(__SIZEOF_INT128__)
+#define BTS_HAS_INT128 1
+
+namespace bts { namespace blockchain { namespace fixed_point {
+
+   typedef unsigned __int128 uint128_type;
+
+   /** a 256 bit unsigned integer as two 128 bit halves */
+   struct uint256_type
+   {
+      uint128_type high;
+      uint128_type low;
+   };
+
+   inline uint128_type to_native( const fc::uint128& v )
+   {
+      return (uint128_type(v.high_bits()) << 64) | v.low_bits();
+   }
+
+   inline fc::uint128 to_fc( uint128_type v )
+   {
+      return fc::uint128( uint64_t(v >> 64), uint64_t(v) );
+   }
+
+   /** @return the full product of a and b from four 64x64 bit multiplies */
+   inline uint256_type multiply( uint128_type a, uint128_type b )
+   {
+      const uint128_type mask = uint64_t(-1);
+      uint128_type al = a & mask, ah = a >> 64;
+      uint128_type bl = b & mask, bh = b >> 64;
+
+      uint128_type ll = al * bl;
+      uint128_type lh = al * bh;
+      uint128_type hl = ah * bl;
+      uint128_type hh = ah * bh;
+
+      // at most 3 * (2^64 - 1), no carry is lost
+      uint128_type mid = (ll >> 64) + (lh & mask) + (hl & mask);
+
+      uint256_type r;
+      r.low  = (mid << 64) | (ll & mask);
+      r.high = hh + (lh >> 64) + (hl >> 64) + (mid >> 64);
+      return r;
+   }
+
+   /**
+    *  Multiplies two 64.64 numbers.
+    *
+    *  @return false if (a * b) >> 64 does not fit in 128 bits
+    */
+   inline bool multiply_shift64( uint128_type a, uint128_type b, uint128_type& result )
+   {
+      auto product = multiply( a, b );
+      if( product.high >> 64 ) return false;
+      result = (product.high << 64) | (product.low >> 64);
+      return true;
+   }
+
+   /**
+    *  Divides a by the 64.64 number b, the quotient always fits in 128 bits because
+    *  a is at most 64 bits.
+    *
+    *  @return false if b is 0
+    */
+   inline bool divide_shift64( uint64_t a, uint128_type b, uint128_type& result )
+   {
+      if( b == 0 ) return false;
+      result = (uint128_type(a) << 64) / b;
+      return true;
+   }
+
+} } } // bts::blockchain::fixed_point
+
+#endif
@@ -0,0 +1,274 @@
+#pragma once
+#include <bts/blockchain/output_reference.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   /**
+    *  Hashes a key that is already uniformly random, such as a ripemd160 id or an address,
+    *  by using its first bytes as they are.  Keys that start with anything but random bytes
+    *  need a specialization.
+    */
+   template<typename Key>
+   struct id_hash
+   {
+      size_t operator()( const Key& k )const
+      {
+         static_assert( sizeof(Key) >= sizeof(size_t), "id_hash reads the first bytes of the key" );
+         size_t h;
+         memcpy( (char*)&h, (const char*)&k, sizeof(h) );
+         return h;
+      }
+   };
+
+   /** the outputs of a transaction share its id, the index spreads them over odd strides */
+   template<>
+   struct id_hash<output_reference>
+   {
+      size_t operator()( const output_reference& k )const
+      {
+         return id_hash<fc::uint160>()( k.trx_hash ) + k.output_idx.value * size_t(0x9e3779b9);
+      }
+   };
+
+   namespace detail
+   {
+      template<typename Key>
+      struct key_of_key
+      {
+         const Key& operator()( const Key& k )const { return k; }
+      };
+
+      template<typename Key, typename Value>
+      struct key_of_pair
+      {
+         const Key& operator()( const std::pair<Key,Value>& e )const { return e.first; }
+      };
+
+      /**
+       *  An open addressing table with linear probing over one array of entries, so that
+       *  a lookup is a probe of adjacent slots instead of a walk of heap nodes.  Erased
+       *  slots are marked and reused, they don't move the other entries, so erasing leaves
+       *  every other iterator valid.  Inserting may rehash, which invalidates them all.
+       */
+      template<typename Key, typename Entry, typename KeyOf, typename Hash>
+      class flat_hash_table
+      {
+         private:
+            enum slot_state { empty_slot, full_slot, erased_slot };
+            struct slot
+            {
+               slot():state(empty_slot){}
+               Entry    entry;
+               uint8_t  state;
+            };
+
+         public:
+            template<typename Slot, typename Value>
+            class iterator_base
+            {
+               public:
+                  typedef std::forward_iterator_tag  iterator_category;
+                  typedef Value                      value_type;
+                  typedef std::ptrdiff_t             difference_type;
+                  typedef Value*                     pointer;
+                  typedef Value&                     reference;
+
+                  iterator_base():_pos(nullptr),_end(nullptr){}
+                  iterator_base( Slot* pos, Slot* end ):_pos(pos),_end(end) { skip(); }
+                  /** an iterator converts to a const_iterator */
+                  template<typename S, typename V>
+                  iterator_base( const iterator_base<S,V>& other ):_pos(other._pos),_end(other._end){}
+
+                  Value& operator*()const  { return _pos->entry; }
+                  Value* operator->()const { return &_pos->entry; }
+
+                  iterator_base& operator++()   { ++_pos; skip(); return *this; }
+                  iterator_base  operator++(int) { iterator_base tmp( *this ); ++*this; return tmp; }
+
+                  friend bool operator == ( const iterator_base& a, const iterator_base& b ) { return a._pos == b._pos; }
+                  friend bool operator != ( const iterator_base& a, const iterator_base& b ) { return a._pos != b._pos; }
+
+               private:
+                  template<typename S, typename V> friend class iterator_base;
+                  friend class flat_hash_table;
+
+                  void skip() { while( _pos != _end && _pos->state != full_slot ) ++_pos; }
+
+                  Slot* _pos;
+                  Slot* _end;
+            };
+            typedef Entry                                       value_type;
+            typedef iterator_base<slot,Entry>                   iterator;
+            typedef iterator_base<const slot,const Entry>       const_iterator;
+
+            flat_hash_table():_size(0),_erased(0){}
+
+            iterator       begin()       { return iterator( _slots.data(), _slots.data() + _slots.size() ); }
+            iterator       end()         { return iterator( _slots.data() + _slots.size(), _slots.data() + _slots.size() ); }
+            const_iterator begin()const  { return const_iterator( _slots.data(), _slots.data() + _slots.size() ); }
+            const_iterator end()const    { return const_iterator( _slots.data() + _slots.size(), _slots.data() + _slots.size() ); }
+
+            size_t size()const  { return _size; }
+            bool   empty()const { return _size == 0; }
+            /** bytes of the slot array */
+            size_t memory_usage()const { return _slots.size() * sizeof(slot); }
+
+            /** removes every entry but keeps the slots for the entries to come */
+            void clear()
+            {
+               for( slot& s : _slots ) if( s.state != empty_slot ) s = slot();
+               _size = _erased = 0;
+            }
+
+            /** makes room for count entries without a rehash */
+            void reserve( size_t count )
+            {
+               if( over_load( count ) ) rehash( count );
+            }
+
+            iterator find( const Key& k )
+            {
+               size_t i;
+               return locate( k, i ) ? at( i ) : end();
+            }
+            const_iterator find( const Key& k )const
+            {
+               size_t i;
+               return locate( k, i ) ? const_iterator( _slots.data() + i, _slots.data() + _slots.size() ) : end();
+            }
+            size_t count( const Key& k )const
+            {
+               size_t i;
+               return locate( k, i ) ? 1 : 0;
+            }
+
+            /** @return the entry with the key of e and whether it was inserted */
+            std::pair<iterator,bool> insert( Entry e )
+            {
+               size_t i;
+               if( locate( KeyOf()( e ), i ) ) return std::make_pair( at( i ), false );
+               if( over_load( _size + 1 ) ) rehash( _size + 1 );
+
+               // the key is not in the table, so the first free slot of its probe is its slot
+               size_t mask = _slots.size() - 1;
+               i = Hash()( KeyOf()( e ) ) & mask;
+               while( _slots[i].state == full_slot ) i = (i + 1) & mask;
+               if( _slots[i].state == erased_slot ) --_erased;
+               _slots[i].entry = std::move( e );
+               _slots[i].state = full_slot;
+               ++_size;
+               return std::make_pair( at( i ), true );
+            }
+
+            template<typename Iterator>
+            void insert( Iterator first, Iterator last )
+            {
+               for( ; first != last; ++first ) insert( Entry( *first ) );
+            }
+
+            size_t erase( const Key& k )
+            {
+               size_t i;
+               if( !locate( k, i ) ) return 0;
+               erase_slot( _slots[i] );
+               return 1;
+            }
+
+            /** @return the entry after itr */
+            iterator erase( iterator itr )
+            {
+               erase_slot( *itr._pos );
+               return ++itr;
+            }
+
+         protected:
+            bool locate( const Key& k, size_t& i )const
+            {
+               if( _slots.empty() ) return false;
+               size_t mask = _slots.size() - 1;
+               for( i = Hash()( k ) & mask; _slots[i].state != empty_slot; i = (i + 1) & mask )
+               {
+                  if( _slots[i].state == full_slot && KeyOf()( _slots[i].entry ) == k )
+                     return true;
+               }
+               return false;
+            }
+
+            iterator at( size_t i ) { return iterator( _slots.data() + i, _slots.data() + _slots.size() ); }
+
+         private:
+            /** erased slots lengthen probes like full ones, so both count towards the 3/4 load */
+            bool over_load( size_t count )const
+            {
+               return (count + _erased) * 4 > _slots.size() * 3;
+            }
+
+            void erase_slot( slot& s )
+            {
+               s.entry = Entry();
+               s.state = erased_slot;
+               --_size;
+               ++_erased;
+            }
+
+            /** moves the entries to a table sized for count, dropping the erased slots */
+            void rehash( size_t count )
+            {
+               size_t capacity = 8;
+               while( count * 4 > capacity * 3 ) capacity *= 2;
+
+               std::vector<slot> old( capacity );
+               old.swap( _slots );
+               size_t mask = capacity - 1;
+               for( slot& s : old )
+               {
+                  if( s.state != full_slot ) continue;
+                  size_t i = Hash()( KeyOf()( s.entry ) ) & mask;
+                  while( _slots[i].state == full_slot ) i = (i + 1) & mask;
+                  _slots[i].entry = std::move( s.entry );
+                  _slots[i].state = full_slot;
+               }
+               _erased = 0;
+            }
+
+            std::vector<slot>  _slots; ///< a power of 2 of them
+            size_t             _size;
+            size_t             _erased;
+      };
+   } // namespace detail
+
+   /**
+    *  A replacement for std::unordered_map with keys that are ids, like transaction ids,
+    *  output references and addresses, that stores its entries in one array and hashes
+    *  them with the bytes of the id.  The key of an entry must not be modified.
+    */
+   template<typename Key, typename Value, typename Hash = id_hash<Key> >
+   class flat_hash_map : public detail::flat_hash_table<Key, std::pair<Key,Value>, detail::key_of_pair<Key,Value>, Hash>
+   {
+      public:
+         typedef Key    key_type;
+         typedef Value  mapped_type;
+
+         Value& operator[]( const Key& k )
+         {
+            auto itr = this->find( k );
+            if( itr != this->end() ) return itr->second;
+            return this->insert( std::make_pair( k, Value() ) ).first->second;
+         }
+   };
+
+   /** like flat_hash_map, for std::unordered_set */
+   template<typename Key, typename Hash = id_hash<Key> >
+   class flat_hash_set : public detail::flat_hash_table<Key, Key, detail::key_of_key<Key>, Hash>
+   {
+      public:
+         typedef Key key_type;
+   };
+
+} } // bts::blockchain
@@ -0,0 +1,59 @@
+#pragma once
+#include <bts/blockchain/block.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   class chain_database;
+   namespace detail { class fork_database_impl; }
+
+   /** the blocks fork_database::update_chain took off the chain and put on it, in that order */
+   struct chain_switch
+   {
+      std::vector<trx_block>  popped; ///< the old head first
+      std::vector<trx_block>  pushed;
+   };
+
+   /**
+    *  @class fork_database
+    *  @ingroup blockchain
+    *  @brief the recent blocks that are not part of the chain
+    *
+    *  Keeps the blocks that do not connect to the head of the chain, because they arrived
+    *  before their parents or belong to another branch, indexed by id and by prev.  Every block
+    *  signed by the trustee weighs the same, so the best branch is the longest one that links
+    *  to a block of the chain and update_chain switches to it with pop_block and push_block.
+    *
+    *  Blocks more than max_depth below or max_ahead above the head are not kept.  The
+    *  methods may be called from any thread, update_chain only where blocks are pushed.
+    */
+   class fork_database
+   {
+      public:
+         fork_database( uint32_t max_depth = 100, uint32_t max_ahead = 2000 );
+         ~fork_database();
+
+         /** @return false if blk was known already or is too far from head_block_num */
+         bool          add_block( const trx_block& blk, uint32_t head_block_num );
+         bool          contains( const block_id_type& id )const;
+         size_t        size()const;
+
+         /** removes the block id and every block that builds on it */
+         void          remove_branch( const block_id_type& id );
+
+         /**
+          *  Makes chain follow the longest linked branch if it is longer than the chain.
+          *  A block of the branch that cannot be pushed is removed with its descendants and the
+          *  next best branch is tried, the popped blocks are kept and may be pushed again.
+          */
+         chain_switch  update_chain( chain_database& chain );
+
+      private:
+         std::unique_ptr<detail::fork_database_impl> my;
+   };
+
+   typedef std::shared_ptr<fork_database> fork_database_ptr;
+
+} } // bts::blockchain
@@ -0,0 +1,56 @@
+#pragma once
+#include <bts/blockchain/pts_address.hpp>
+#include <fc/filesystem.hpp>
+
+#include <memory>
+
+namespace bts { namespace blockchain {
+
+   /** the first bytes of a binary balance file, see genesis_balance_reader */
+   const char genesis_balances_magic[8] = { 'B','T','S','G','E','N','B','1' };
+
+   namespace detail
+   {
+      class genesis_balance_reader_impl;
+      class genesis_balance_writer_impl;
+   }
+
+   /**
+    *  Reads the balances of a genesis file one at a time, so that a snapshot of millions of
+    *  balances isn't parsed into one fc::variant.  The file is the JSON of a
+    *  genesis_block_config or, if it starts with genesis_balances_magic, a sequence of
+    *  fc::raw packed pts_address and uint64_t amount in shares.  JSON amounts are in whole
+    *  shares and converted.
+    */
+   class genesis_balance_reader
+   {
+      public:
+        genesis_balance_reader( const fc::path& file );
+        ~genesis_balance_reader();
+
+        /** @return false after the last balance */
+        bool next( pts_address& owner, uint64_t& amount );
+
+      private:
+        std::unique_ptr<detail::genesis_balance_reader_impl> my;
+   };
+
+   /**
+    *  Writes the binary balance file that genesis_balance_reader reads, amounts in shares.
+    *  The file is complete once close() returns, the destructor closes it without reporting
+    *  errors.
+    */
+   class genesis_balance_writer
+   {
+      public:
+        genesis_balance_writer( const fc::path& file );
+        ~genesis_balance_writer();
+
+        void write( const pts_address& owner, uint64_t amount );
+        void close();
+
+      private:
+        std::unique_ptr<detail::genesis_balance_writer_impl> my;
+   };
+
+} } // bts::blockchain
@@ -0,0 +1,73 @@
+#pragma once
+#include <bts/blockchain/momentum.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+  /**
+   *  @class miner_backend
+   *  @brief searches the momentum nonce space of a seed for birthday collisions
+   *
+   *  A backend may run anywhere, on the mining pool or on a device, and may
+   *  report false candidates: block_miner verifies each one with momentum_verify
+   *  on the host before checking its difficulty.  A backend is used by one
+   *  mining loop at a time and keeps its buffers between searches.
+   */
+  class miner_backend
+  {
+     public:
+        /** return true to stop the search */
+        typedef momentum_search_context::collision_handler candidate_handler;
+
+        virtual ~miner_backend(){}
+
+        virtual std::string name()const = 0;
+
+        /**
+         *  @param on_candidate - called for each candidate as soon as it is found, possibly
+         *                        on another thread
+         *  @param canceled     - polled while searching, returning true abandons the search
+         *
+         *  @return the candidates found before the search completed or stopped
+         */
+        virtual std::vector< std::pair<uint32_t,uint32_t> > search( pow_seed_type seed,
+                                                                    const candidate_handler& on_candidate,
+                                                                    const std::function<bool()>& canceled ) = 0;
+  };
+  typedef std::shared_ptr<miner_backend> miner_backend_ptr;
+
+  /** the default backend, a momentum_search_context on the mining pool */
+  class cpu_miner_backend : public miner_backend
+  {
+     public:
+        /** @param num_threads - 0 uses one per thread of the mining pool */
+        cpu_miner_backend( uint32_t num_threads = 1 );
+
+        virtual std::string name()const override;
+        virtual std::vector< std::pair<uint32_t,uint32_t> > search( pow_seed_type seed,
+                                                                    const candidate_handler& on_candidate,
+                                                                    const std::function<bool()>& canceled ) override;
+
+        const momentum_search_context& context()const { return _context; }
+
+     private:
+        momentum_search_context _context;
+  };
+
+  /**
+   *  Creates a backend for a device, for the cpu backend the device is ignored and
+   *  num_threads is the number of threads of each search.
+   */
+  typedef std::function<miner_backend_ptr( uint32_t device, uint32_t num_threads )> miner_backend_factory;
+
+  /** makes a backend available to block_miner::set_backend, "cpu" is always registered */
+  void                     register_miner_backend( const std::string& name, const miner_backend_factory& factory );
+  /** @throw fc::key_not_found_exception if no backend is registered under name */
+  miner_backend_ptr        create_miner_backend( const std::string& name, uint32_t device = 0, uint32_t num_threads = 1 );
+  std::vector<std::string> miner_backend_names();
+
+} } // bts::blockchain
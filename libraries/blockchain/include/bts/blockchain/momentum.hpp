@@ -2,20 +2,99 @@
 #include <fc/array.hpp>
 #include <fc/io/varint.hpp>
 #include <fc/crypto/ripemd160.hpp>
+#include <fc/crypto/sha512.hpp>
 #include <fc/reflect/reflect.hpp>
+#include <fc/time.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
 
 #define MOMENTUM_NONCE_BITS 26
 #define MAX_MOMENTUM_NONCE  (1<<MOMENTUM_NONCE_BITS)
+#define BIRTHDAYS_PER_HASH  8
 
 namespace bts { namespace blockchain {
    typedef fc::sha256     pow_seed_type;
    typedef fc::ripemd160  pow_hash_type;
 
+   namespace detail { class momentum_search_context_impl; }
+
+   /** timing of the last momentum_search_context::search */
+   struct momentum_search_stats
+   {
+      momentum_search_stats():collisions(0),partition_bits(0){}
+
+      fc::microseconds  generate_time;  ///< hashing and scattering birthdays into partitions
+      fc::microseconds  find_time;      ///< searching the partitions for duplicates
+      uint64_t          collisions;
+      uint32_t          partition_bits;
+   };
+
+   /**
+    *  @class momentum_search_context
+    *  @brief owns the memory used by momentum_search, which runs on the mining pool of bts::db::executor
+    *
+    *  The hash store is several hundred MB, a miner keeps one context and
+    *  reuses it for every attempt instead of faulting the store in each time.
+    *  On Linux the store is backed by 2 MB huge pages when they are available.
+    */
+   class momentum_search_context
+   {
+      public:
+         /** @param num_threads - 0 uses one per thread of the mining pool */
+         momentum_search_context( uint32_t num_threads = 1 );
+         ~momentum_search_context();
+
+         /** return true to stop the search */
+         typedef std::function<bool( uint32_t noncea, uint32_t nonceb )> collision_handler;
+
+         /**
+          *  @param on_collision - called for each collision as soon as its partition
+          *                        has been searched, possibly on a worker thread
+          *  @param canceled     - polled between batches of hashes and between
+          *                        partitions from every thread, returning true
+          *                        abandons the search
+          *
+          *  @return the collisions found before the search completed or stopped
+          */
+         std::vector< std::pair<uint32_t,uint32_t> > search( pow_seed_type head,
+                                                             const collision_handler& on_collision = collision_handler(),
+                                                             const std::function<bool()>& canceled = std::function<bool()>() );
+
+         uint32_t                      num_threads()const;
+         bool                          uses_huge_pages()const;
+         /** bytes allocated for the hash store and filters */
+         uint64_t                      memory_size()const;
+         const momentum_search_stats&  last_stats()const;
+
+      private:
+         std::unique_ptr<detail::momentum_search_context_impl> my;
+   };
+
    /** 
     *  @return all collisions found in the nonce search space 
     */
    std::vector< std::pair<uint32_t,uint32_t> > momentum_search( pow_seed_type head );
+
+   /**
+    *  Splits hash generation by nonce range and duplicate detection by partition
+    *  across num_threads threads, 0 uses one thread per core.
+    *
+    *  @return all collisions found in the nonce search space, a collision is
+    *  missed in the unlikely case that a per thread bucket overflows
+    */
+   std::vector< std::pair<uint32_t,uint32_t> > momentum_search( pow_seed_type head, uint32_t num_threads );
    bool momentum_verify( pow_seed_type head, uint32_t a, uint32_t b );
 
+   /** @return sha512( nonce, head ), which holds the birthdays nonce to nonce+7 */
+   fc::sha512 momentum_hash( pow_seed_type head, uint32_t nonce );
+
+   /**
+    *  Computes momentum_hash for count nonces starting at first_nonce in steps of
+    *  BIRTHDAYS_PER_HASH, using the widest SIMD kernel the CPU supports.
+    */
+   void momentum_hashes( pow_seed_type head, uint32_t first_nonce, uint32_t count, fc::sha512* out );
+
 } } // bts::blockchain
 
@@ -0,0 +1,51 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class orphan_pool_impl; }
+
+   /**
+    *  @class orphan_pool
+    *  @brief transactions that spend outputs of transactions not known to the chain yet
+    *
+    *  A transaction that arrives before its parent cannot be evaluated, it waits here indexed
+    *  by the outputs it is missing until a block includes its parents.  The pool is bounded by
+    *  count and bytes, the oldest orphans are evicted first.
+    *
+    *  All methods are thread safe.
+    */
+   class orphan_pool
+   {
+      public:
+         orphan_pool( size_t max_count = 1000, size_t max_size = 4*1024*1024 );
+         ~orphan_pool();
+
+         /**
+          *  @param missing the inputs of trx whose transactions are unknown, it waits until
+          *         take_children was called for all of them
+          *  @return false if trx is already waiting
+          */
+         bool                             insert( const signed_transaction& trx, const std::vector<output_reference>& missing );
+
+         /**
+          *  Removes and returns the orphans that waited for nothing but the outputs of parent,
+          *  in the order they arrived.  Those that still miss another parent keep waiting.
+          */
+         std::vector<signed_transaction>  take_children( const signed_transaction& parent );
+
+         bool                             contains( const transaction_id_type& id )const;
+         size_t                           size()const;
+         size_t                           size_in_bytes()const;
+         /** evicts the oldest orphans until the pool is within the new limits */
+         void                             set_limits( size_t max_count, size_t max_size );
+         void                             clear();
+
+      private:
+         std::unique_ptr<detail::orphan_pool_impl> my;
+   };
+
+} } // bts::blockchain
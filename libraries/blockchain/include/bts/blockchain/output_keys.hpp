@@ -0,0 +1,88 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <bts/blockchain/output_reference.hpp>
+#include <bts/db/key_encoding.hpp>
+
+/**
+ *  The keys of the output indexes of chain_database.  They are declared with their
+ *  key_encoding so that every level_map of them is instantiated with the same one.
+ */
+namespace bts { namespace blockchain { namespace detail {
+    /** an entry of the owner index, sorted by owner so the outputs of an owner are one range */
+    struct owner_output_key
+    {
+       fc::ripemd160     owner; ///< see chain_database_impl::owner_key
+       output_reference  ref;
+
+       friend bool operator == ( const owner_output_key& a, const owner_output_key& b )
+       {
+          return a.owner == b.owner && a.ref == b.ref;
+       }
+       friend bool operator < ( const owner_output_key& a, const owner_output_key& b )
+       {
+          return a.owner == b.owner ? a.ref < b.ref : a.owner < b.owner;
+       }
+    };
+
+    /** an entry of the age index, sorted by the transaction that created the output */
+    struct age_output_key
+    {
+       trx_num           source;
+       output_reference  ref;
+
+       friend bool operator == ( const age_output_key& a, const age_output_key& b )
+       {
+          return a.source == b.source && a.ref == b.ref;
+       }
+       friend bool operator < ( const age_output_key& a, const age_output_key& b )
+       {
+          return a.source == b.source ? a.ref < b.ref : a.source < b.source;
+       }
+    };
+} } } // bts::blockchain::detail
+
+FC_REFLECT( bts::blockchain::detail::owner_output_key, (owner)(ref) )
+FC_REFLECT( bts::blockchain::detail::age_output_key, (source)(ref) )
+
+namespace bts { namespace db {
+  /** sorts by owner then output_reference */
+  template<>
+  struct key_encoding<bts::blockchain::detail::owner_output_key>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const bts::blockchain::detail::owner_output_key& k )
+     {
+        key_encoding<fc::ripemd160>::pack( out, k.owner );
+        key_encoding<bts::blockchain::output_reference>::append( out, k.ref );
+     }
+
+     static void unpack( const char* data, size_t size, bts::blockchain::detail::owner_output_key& k )
+     {
+        FC_ASSERT( size > sizeof(k.owner) );
+        key_encoding<fc::ripemd160>::unpack( data, sizeof(k.owner), k.owner );
+        key_encoding<bts::blockchain::output_reference>::unpack( data + sizeof(k.owner), size - sizeof(k.owner), k.ref );
+     }
+  };
+
+  /** sorts by source then output_reference, so the oldest outputs come first */
+  template<>
+  struct key_encoding<bts::blockchain::detail::age_output_key>
+  {
+     static const bool is_ordered = true;
+     static const size_t source_size = sizeof(uint32_t) + sizeof(uint16_t);
+
+     static void pack( std::vector<char>& out, const bts::blockchain::detail::age_output_key& k )
+     {
+        key_encoding<bts::blockchain::trx_num>::pack( out, k.source );
+        key_encoding<bts::blockchain::output_reference>::append( out, k.ref );
+     }
+
+     static void unpack( const char* data, size_t size, bts::blockchain::detail::age_output_key& k )
+     {
+        FC_ASSERT( size > source_size );
+        key_encoding<bts::blockchain::trx_num>::unpack( data, source_size, k.source );
+        key_encoding<bts::blockchain::output_reference>::unpack( data + source_size, size - source_size, k.ref );
+     }
+  };
+} } // bts::db
@@ -36,6 +36,38 @@ namespace bts { namespace blockchain {
 #include <fc/reflect/reflect.hpp>
 FC_REFLECT( bts::blockchain::output_reference, (trx_hash)(output_idx) )
 
+#include <bts/db/key_encoding.hpp>
+#include <fc/exception/exception.hpp>
+namespace bts { namespace db {
+  /** sorts by trx_hash then output_idx, matching output_reference::operator< */
+  template<>
+  struct key_encoding<bts::blockchain::output_reference>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const bts::blockchain::output_reference& k )
+     {
+        out.clear();
+        append( out, k );
+     }
+
+     /** for the keys that end with an output_reference, without a buffer for it */
+     static void append( std::vector<char>& out, const bts::blockchain::output_reference& k )
+     {
+        const char* hash = (const char*)&k.trx_hash._hash[0];
+        out.insert( out.end(), hash, hash + sizeof(k.trx_hash._hash) );
+        pack_big_endian( out, k.output_idx.value, sizeof(k.output_idx.value) );
+     }
+
+     static void unpack( const char* data, size_t size, bts::blockchain::output_reference& k )
+     {
+        FC_ASSERT( size == sizeof(k.trx_hash) + sizeof(k.output_idx.value) );
+        key_encoding<fc::uint160>::unpack( data, sizeof(k.trx_hash), k.trx_hash );
+        k.output_idx.value = uint32_t( unpack_big_endian( data + sizeof(k.trx_hash), sizeof(k.output_idx.value) ) );
+     }
+  };
+} } // bts::db
+
 #include <unordered_map>
 namespace std {
   /**
@@ -47,8 +79,8 @@ namespace std {
   {
      size_t operator()( const bts::blockchain::output_reference& e )const
      {
-        return fc::city_hash64( (char*)&e.trx_hash, sizeof(e.trx_hash) ) ^
-               fc::city_hash64( (char*)&e.output_idx, sizeof(e.output_idx) );
+        // trx_hash is already random, the index only has to separate the outputs of a transaction
+        return ((uint64_t(e.trx_hash._hash[1])<<32) | uint64_t( e.trx_hash._hash[0] )) + e.output_idx.value * uint64_t(0x9e3779b9);
      }
   };
 
@@ -0,0 +1,17 @@
+#pragma once
+#include <functional>
+#include <stddef.h>
+
+namespace bts { namespace blockchain {
+
+   /**
+    *  Calls f( begin, end ) for consecutive ranges covering [0,count) on the validation
+    *  thread pool of bts::db::executor and waits for all of them to finish.
+    *  Ranges are at least min_range long, so small inputs run on the calling thread.
+    *
+    *  The calling thread is blocked while it waits, its other fc tasks don't run meanwhile.
+    *  The first exception thrown by f is rethrown after every range has finished.
+    */
+   void parallel_for( size_t count, size_t min_range, const std::function<void( size_t begin, size_t end )>& f );
+
+} } // bts::blockchain
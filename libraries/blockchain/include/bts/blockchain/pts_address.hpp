@@ -1,8 +1,9 @@
 #pragma once
 #include <fc/array.hpp>
+#include <array>
 #include <string>
 
-namespace fc { namespace ecc { class public_key; } }
+namespace fc { namespace ecc { class public_key; } class ripemd160; }
 
 namespace bts { namespace blockchain {
    /**
@@ -13,6 +14,16 @@ namespace bts { namespace blockchain {
        pts_address(); ///< constructs empty / null address
        pts_address( const std::string& base58str );   ///< converts to binary, validates checksum
        pts_address( const fc::ecc::public_key& pub, bool compressed = false, uint8_t version=56 ); ///< converts to binary
+       pts_address( const fc::ripemd160& key_hash, uint8_t version ); ///< key_hash is ripemd160(sha256(serialized key))
+
+       /**
+        *  A PTS key may have been paid to its compressed or uncompressed form with either the
+        *  protoshares (56) or the bitcoin (0) version.  Each serialization is hashed once and
+        *  only the checksum is recomputed per version.
+        *
+        *  @return { uncompressed 56, compressed 56, uncompressed 0, compressed 0 }
+        */
+       static std::array<pts_address,4> all_forms( const fc::ecc::public_key& pub );
 
        uint8_t version()const { return addr.at(0); }
        bool is_valid()const;
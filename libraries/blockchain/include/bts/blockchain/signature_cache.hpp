@@ -0,0 +1,102 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+
+#include <mutex>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class signature_cache_impl; }
+
+   /**
+    *  The parts of transaction validation that do not depend upon the chain state,
+    *  they are computed once per transaction id.
+    */
+   struct transaction_signers
+   {
+      transaction_signers():unique_inputs(true){}
+
+      /**
+       *  Computed on first use because only inputs that claim_by_pts need them and
+       *  each key has four forms.  Thread safe.
+       */
+      const std::unordered_set<pts_address>& pts_addresses()const;
+
+      std::vector<fc::ecc::public_key> keys;          ///< recovered from each signature
+      std::unordered_set<address>      addresses;
+      bool                             unique_inputs; ///< no output is referenced more than once
+
+    private:
+      mutable std::once_flag                   _pts_once;
+      mutable std::unordered_set<pts_address>  _pts_addresses;
+   };
+   typedef std::shared_ptr<const transaction_signers> transaction_signers_ptr;
+
+   /** the size of a signature_cache and how often its lookups found what they looked for */
+   struct signature_cache_stats
+   {
+      signature_cache_stats():signatures(0),hits(0),misses(0),transactions(0),signer_hits(0),signer_misses(0){}
+
+      uint64_t signatures;    ///< recovered keys in the cache
+      uint64_t hits;
+      uint64_t misses;        ///< each one is a key recovery
+      uint64_t transactions;  ///< transaction_signers in the cache
+      uint64_t signer_hits;
+      uint64_t signer_misses;
+   };
+
+   /**
+    *  @class signature_cache
+    *  @brief memoizes public key recovery by (digest, signature)
+    *
+    *  Recovering the public key from a compact signature is most of the cost
+    *  of validating a transaction.  The cache is shared by every transaction_evaluation_state
+    *  so a block can recover all of its signatures on a pool of threads before
+    *  the transactions are evaluated one at a time.
+    *
+    *  The signers of whole transactions are cached by transaction id as well so
+    *  that a transaction accepted into the pending pool is not recovered again
+    *  when the block that includes it is validated.
+    *
+    *  All methods are thread safe.
+    */
+   class signature_cache
+   {
+      public:
+         signature_cache( size_t max_size = 100000, size_t max_trx_size = 20000 );
+         ~signature_cache();
+
+         /** the cache used by signed_transaction::get_signed_addresses() */
+         static signature_cache& instance();
+
+         fc::ecc::public_key     recover( const fc::ecc::compact_signature& sig, const fc::sha256& digest );
+         transaction_signers_ptr get_signers( const signed_transaction& trx );
+
+         /**
+          *  Recovers every signature of trxs on up to num_threads worker threads
+          *  and waits for them to finish.
+          *
+          *  @param num_threads - tasks run on the signature pool of bts::db::executor, 0 for one per thread of the pool
+          */
+         void                    recover( const signed_transactions& trxs, uint32_t num_threads = 0 );
+
+         void                    set_max_size( size_t signatures, size_t trxs );
+         size_t                  size()const;
+
+         /**
+          *  The memory taken by the cache, estimated from the number of keys and signers it
+          *  holds, and a limit in bytes divided between them in the proportion of the sizes
+          *  the cache was created with.
+          */
+         uint64_t                memory_usage()const;
+         void                    set_memory_limit( uint64_t bytes );
+         /** counted since the cache was created, clear() keeps the counts */
+         signature_cache_stats   get_stats()const;
+         void                    clear();
+
+      private:
+         std::unique_ptr<detail::signature_cache_impl> my;
+   };
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::signature_cache_stats, (signatures)(hits)(misses)(transactions)(signer_hits)(signer_misses) )
@@ -8,6 +8,8 @@
 #include <fc/crypto/elliptic.hpp>
 #include <fc/crypto/sha224.hpp>
 #include <fc/io/varint.hpp>
+#include <fc/io/datastream.hpp>
+#include <fc/io/raw_fwd.hpp>
 #include <fc/exception/exception.hpp>
 
 namespace bts { namespace blockchain {
@@ -71,6 +73,10 @@ struct trx_output
        claim_data = fc::raw::pack(t);
     }
 
+    /**
+     *  Unpacks claim_data on every call.  The claims are a few dozen bytes, see
+     *  claim_bench, and outputs are read by several threads at once without a lock.
+     */
     template<typename ClaimType>
     ClaimType as()const
     {
@@ -183,13 +189,56 @@ struct transaction
  */
 struct signed_transaction : public transaction
 {
+    signed_transaction(){}
+    /** a copy computes its own cache, it may be modified without invalidating the original */
+    signed_transaction( const signed_transaction& trx )
+    :transaction(trx),sigs(trx.sigs){}
+    signed_transaction( signed_transaction&& trx )
+    :transaction(std::move(trx)),sigs(std::move(trx.sigs)),_cache(std::move(trx._cache)){}
+
+    signed_transaction& operator=( const signed_transaction& trx )
+    {
+       transaction::operator=( trx );
+       sigs = trx.sigs;
+       _cache.reset();
+       return *this;
+    }
+    signed_transaction& operator=( signed_transaction&& trx )
+    {
+       transaction::operator=( std::move(trx) );
+       sigs   = std::move(trx.sigs);
+       _cache = std::move(trx._cache);
+       return *this;
+    }
+
     std::unordered_set<address>      get_signed_addresses()const;
     std::unordered_set<pts_address>  get_signed_pts_addresses()const;
     transaction_id_type              id()const;
+    fc::sha256                       digest()const;
     void                             sign( const fc::ecc::private_key& k );
     size_t                           size()const;
 
+    /** the transaction as it is serialized, cached along with id() and digest() */
+    const std::vector<char>&         packed()const;
+
+    /**
+     *  The packed image, id and digest are computed once per object, copies start
+     *  without them.  Code that modifies a transaction after using any of them
+     *  must call this, sign() and fc::raw::unpack do so automatically.
+     */
+    void                             invalidate_cache()const { _cache.reset(); }
+
     std::set<fc::ecc::compact_signature> sigs;
+
+  private:
+    struct packed_transaction
+    {
+       std::vector<char>    data;
+       fc::sha256           digest;
+       transaction_id_type  id;
+    };
+    mutable std::shared_ptr<const packed_transaction> _cache;
+    const packed_transaction& get_cache()const;
 };
 
 typedef std::vector<signed_transaction> signed_transactions;
@@ -227,3 +276,68 @@ FC_REFLECT( bts::blockchain::meta_trx_output, (trx_id)(input_num) )
 FC_REFLECT( bts::blockchain::meta_trx_input, (source)(output_num)(delegate_id)(output)(meta_output) )
 FC_REFLECT_DERIVED( bts::blockchain::meta_trx, (bts::blockchain::signed_transaction), (meta_outputs) );
 
+#include <bts/db/key_encoding.hpp>
+namespace bts { namespace db {
+  /** sorts by block_num then trx_idx, matching trx_num::operator< */
+  template<>
+  struct key_encoding<bts::blockchain::trx_num>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const bts::blockchain::trx_num& k )
+     {
+        out.clear();
+        pack_big_endian( out, k.block_num, sizeof(k.block_num) );
+        pack_big_endian( out, k.trx_idx, sizeof(k.trx_idx) );
+     }
+
+     static void unpack( const char* data, size_t size, bts::blockchain::trx_num& k )
+     {
+        FC_ASSERT( size == sizeof(k.block_num) + sizeof(k.trx_idx) );
+        k.block_num = uint32_t( unpack_big_endian( data, sizeof(k.block_num) ) );
+        k.trx_idx   = uint16_t( unpack_big_endian( data + sizeof(k.block_num), sizeof(k.trx_idx) ) );
+     }
+  };
+} } // bts::db
+
+namespace fc { namespace raw {
+   /** unpacks in the order of the reflection, an object that is reused does not keep the id of its last value */
+   template<typename Stream>
+   inline void unpack( Stream& s, bts::blockchain::signed_transaction& t )
+   {
+      fc::raw::unpack( s, static_cast<bts::blockchain::transaction&>(t) );
+      fc::raw::unpack( s, t.sigs );
+      t.invalidate_cache();
+   }
+
+   template<typename Stream>
+   inline void unpack( Stream& s, bts::blockchain::meta_trx& t )
+   {
+      fc::raw::unpack( s, static_cast<bts::blockchain::signed_transaction&>(t) );
+      fc::raw::unpack( s, t.meta_outputs );
+   }
+
+   /**
+    *  The unpack of a container, such as the trxs of a trx_block, was compiled before the
+    *  overloads above were declared and only finds the generic unpack of fc.  These explicit
+    *  specializations of it are used from there too, for the stream every unpack from a
+    *  buffer uses.
+    */
+   template<>
+   inline void unpack<fc::datastream<const char*>, bts::blockchain::signed_transaction>(
+                      fc::datastream<const char*>& s, bts::blockchain::signed_transaction& t )
+   {
+      fc::raw::unpack( s, static_cast<bts::blockchain::transaction&>(t) );
+      fc::raw::unpack( s, t.sigs );
+      t.invalidate_cache();
+   }
+
+   template<>
+   inline void unpack<fc::datastream<const char*>, bts::blockchain::meta_trx>(
+                      fc::datastream<const char*>& s, bts::blockchain::meta_trx& t )
+   {
+      fc::raw::unpack( s, static_cast<bts::blockchain::signed_transaction&>(t) );
+      fc::raw::unpack( s, t.meta_outputs );
+   }
+} } // fc::raw
+
@@ -0,0 +1,98 @@
+#pragma once
+#include <bts/blockchain/fee_estimator.hpp>
+#include <bts/blockchain/transaction.hpp>
+#include <fc/crypto/ripemd160.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class transaction_pool_impl; }
+
+   /**
+    *  A transaction accepted into a transaction_pool, it is never modified once pooled so
+    *  it can be shared by snapshots and blocks under construction.
+    */
+   struct pooled_transaction
+   {
+      pooled_transaction( const signed_transaction& t, int64_t f, uint64_t seq );
+
+      /** fees per 1000 bytes, the unit of chain_database::get_fee_rate() */
+      uint64_t fee_rate()const;
+
+      signed_transaction   trx;
+      transaction_id_type  id;
+      fc::ripemd160        packed_hash; ///< of trx.packed(), the hash peers know a trx_message by
+      int64_t              fees;        ///< as evaluated against the head block when it was pooled
+      uint32_t             size;        ///< packed bytes
+      uint64_t             sequence;    ///< order of arrival, earlier transactions win fee rate ties
+   };
+   typedef std::shared_ptr<const pooled_transaction>  pooled_transaction_ptr;
+   typedef std::vector<pooled_transaction_ptr>        pooled_transactions;
+   typedef std::shared_ptr<const pooled_transactions> transaction_pool_snapshot;
+
+   /**
+    *  @class transaction_pool
+    *  @brief the valid transactions that are waiting to be included in a block
+    *
+    *  Transactions are indexed by id, by the hash of their packed form, by fee rate and by
+    *  the outputs they spend, so a transaction that double spends a pooled one is detected
+    *  on insert.  The pool is bounded by count and bytes, the lowest fee rates are evicted
+    *  first.
+    *
+    *  Readers take a snapshot, an immutable list ordered by fee rate that is only rebuilt
+    *  after the pool changes and that they can iterate without holding any lock while
+    *  others keep inserting.
+    *
+    *  All methods are thread safe.
+    */
+   class transaction_pool
+   {
+      public:
+         transaction_pool( size_t max_count = 50000, size_t max_size = 32*1024*1024 );
+         ~transaction_pool();
+
+         /**
+          *  Adds trx, which must already have been evaluated.  A transaction that spends an
+          *  output a pooled one spends replaces it only if it pays a higher fee rate than
+          *  every transaction it conflicts with.  When the pool is full, transactions with
+          *  lower fee rates are evicted to make room.
+          *
+          *  @return false if trx is already pooled, is outbid by a conflicting transaction
+          *          or the pool is full of transactions paying at least as much
+          */
+         bool                      insert( const signed_transaction& trx, int64_t fees );
+         bool                      remove( const transaction_id_type& id );
+
+         /**
+          *  Removes the transactions of a block and every other transaction that spends
+          *  one of their inputs, which can no longer be included.
+          */
+         void                      remove_included( const signed_transactions& trxs );
+         void                      clear();
+
+         bool                      contains( const transaction_id_type& id )const;
+         /** @return nullptr if not pooled */
+         pooled_transaction_ptr    find( const transaction_id_type& id )const;
+         pooled_transaction_ptr    find_by_packed_hash( const fc::ripemd160& packed_hash )const;
+         /** @return the pooled transaction that spends ref, or nullptr */
+         pooled_transaction_ptr    find_spender( const output_reference& ref )const;
+
+         /** the pool as of now, highest fee rate first */
+         transaction_pool_snapshot snapshot()const;
+
+         size_t                    size()const;
+         size_t                    size_in_bytes()const;
+         /** the bytes pooled at each fee rate, kept up to date by every insert and removal */
+         fee_histogram             fee_distribution()const;
+         /** the number of transactions that have ever left the pool, for noticing that those of a snapshot may be gone */
+         uint64_t                  removal_count()const;
+         /** evicts the lowest fee rates until the pool is within the new limits */
+         void                      set_limits( size_t max_count, size_t max_size );
+
+      private:
+         std::unique_ptr<detail::transaction_pool_impl> my;
+   };
+
+} } // bts::blockchain
@@ -1,5 +1,7 @@
 #pragma once
 #include <bts/blockchain/transaction.hpp>
+#include <bts/blockchain/signature_cache.hpp>
+#include <bts/blockchain/evaluation_arena.hpp>
 #include <unordered_map>
 
 namespace bts { namespace blockchain {
@@ -34,22 +36,50 @@ namespace bts { namespace blockchain {
     *
     *  This class is designed to be derived from when extending the basic
     *  blockchain to add additional evaluation criterion. 
+    *
+    *  The containers of the block state and of every transaction_evaluation_state
+    *  made for it allocate from _arena, which is released with the block state.
     */
    class block_evaluation_state
    {
       public:
+         template<typename K, typename V>
+         struct arena_map
+         {
+            typedef std::unordered_map<K,V,std::hash<K>,std::equal_to<K>,arena_allocator<std::pair<const K,V>>> type;
+         };
+
+         block_evaluation_state();
          virtual ~block_evaluation_state(){}
          void add_name_output( const claim_name_output& o )
          {
             FC_ASSERT( _name_outputs.find( o.name ) == _name_outputs.end() );
             _name_outputs[o.name] = o;
          }
+         /** votes for delegate -did are votes against delegate did */
          void  add_input_delegate_votes( int32_t did, const asset& votes );
          void  add_output_delegate_votes( int32_t did, const asset& votes );
 
-         std::unordered_map<std::string,claim_name_output> _name_outputs;
-         std::unordered_map<int32_t,uint64_t>              _input_votes;
-         std::unordered_map<int32_t,uint64_t>              _output_votes;
+         /**
+          *  Adds the changes of a state that transactions later in the block were evaluated
+          *  into on their own, see transaction_validator::supports_parallel_evaluation().
+          *  Derived states merge what they add, such as the names they claim.
+          *
+          *  @return false if the states conflict, this state is then incomplete and the
+          *          block is evaluated again serially
+          */
+         virtual bool merge( const block_evaluation_state& later );
+
+         evaluation_arena* arena() { return &_arena; }
+
+      private:
+         evaluation_arena                                  _arena;
+
+      public:
+         arena_map<std::string,claim_name_output>::type    _name_outputs;
+         /** summed per did and direction, each sum is rounded to bips by itself */
+         arena_map<int32_t,uint64_t>::type                 _input_votes;
+         arena_map<int32_t,uint64_t>::type                 _output_votes;
    };
 
    typedef std::shared_ptr<block_evaluation_state> block_evaluation_state_ptr;
@@ -63,13 +93,15 @@ namespace bts { namespace blockchain {
       public:
           struct asset_io
           {
-             asset_io():in(0),out(0),required_fees(0){}
+             asset_io( asset::unit_type u = 0 ):unit(u),in(0),out(0),required_fees(0){}
+             asset::unit_type unit;
              int64_t in;
              int64_t out;
              int64_t required_fees; ///< extra fees that are required
           };
 
-          transaction_evaluation_state( const signed_transaction& trx );
+          /** @param arena of the block state the transaction is evaluated for, null to use the heap */
+          transaction_evaluation_state( const signed_transaction& trx, evaluation_arena* arena = nullptr );
           virtual ~transaction_evaluation_state();
           
           int64_t  get_total_in( asset::unit_type t = 0 )const;
@@ -82,21 +114,24 @@ namespace bts { namespace blockchain {
           void     add_name_input( const claim_name_output& o );
           bool     has_name_input( const claim_name_output& o )
           {
-             return name_inputs.find(o.name) == name_inputs.end();
+             return find_name_input( o.name ) == name_inputs.end();
           }
           
           bool     is_output_used( uint32_t out )const;
           void     mark_output_as_used( uint32_t out );
 
-          std::unordered_map<std::string,claim_name_output> name_inputs;
-          std::vector<meta_trx_input>                       inputs;
-          signed_transaction                                trx;
+          /** a transaction rarely has more than one of these, they are kept in input order */
+          arena_vector<claim_name_output>           name_inputs;
+          std::vector<meta_trx_input>               inputs;
+          /** the state is evaluated while the caller holds the transaction, it is not copied */
+          const signed_transaction&                 trx;
 
           bool has_signature( const address& a )const;
           bool has_signature( const pts_address& a )const;
 
-          std::unordered_set<address>               sigs;
-          std::unordered_set<pts_address>           pts_sigs;
+          /** shared with the signature_cache, addresses and keys are not copied per evaluation */
+          transaction_signers_ptr                   signers;
+          bool                                      unique_inputs; ///< computed once per transaction id
 
           /** valid votes are those where one of the previous two blocks
            * is referenced by the transaction and the input 
@@ -109,8 +144,13 @@ namespace bts { namespace blockchain {
           void balance_assets()const;
 
       //private:
-          std::unordered_map<asset::unit_type,asset_io>  total;
-          std::unordered_set<uint32_t>                   used_outputs;
+          arena_vector<asset_io>                    total; ///< one per unit, in the order first seen
+          arena_vector<uint32_t>                    used_outputs;
+
+      private:
+          arena_vector<claim_name_output>::const_iterator find_name_input( const std::string& name )const;
+          const asset_io*                                 find_total( asset::unit_type t )const;
+          asset_io&                                       get_total( asset::unit_type t );
    };  // transaction_evaluation_state
 
    /**
@@ -138,6 +178,18 @@ namespace bts { namespace blockchain {
           virtual transaction_summary evaluate( const signed_transaction& trx, 
                                                 const block_evaluation_state_ptr& block_state );
 
+          /**
+           *  When true chain_database::validate() evaluates the transactions of large blocks on
+           *  the worker threads, each range of them against a block state of its own that is
+           *  merged in block order with block_evaluation_state::merge().  A block that fails or
+           *  whose states conflict is evaluated again serially.
+           *
+           *  Validators opt in by overriding this once their evaluate() and validate methods
+           *  only read the database through chain_database::lock_reads() and keep everything
+           *  they add for the block in a block state that merges.  The base validator does.
+           */
+          virtual bool supports_parallel_evaluation()const;
+
           virtual void validate_input( const meta_trx_input& in, transaction_evaluation_state& state, 
                                        const block_evaluation_state_ptr& block_state );
           virtual void validate_output( const trx_output& in, transaction_evaluation_state& state, 
@@ -178,6 +230,6 @@ namespace bts { namespace blockchain {
 
 FC_REFLECT( bts::blockchain::transaction_summary, (valid_votes)(invalid_votes)(fees) )
 
-FC_REFLECT( bts::blockchain::transaction_evaluation_state::asset_io, (in)(out)(required_fees) )
-FC_REFLECT( bts::blockchain::transaction_evaluation_state, (name_inputs)(inputs)(trx)(sigs)
-                                                          (pts_sigs)(valid_votes)(invalid_votes)(spent)(used_outputs)(total) )
+FC_REFLECT( bts::blockchain::transaction_evaluation_state::asset_io, (unit)(in)(out)(required_fees) )
+FC_REFLECT( bts::blockchain::transaction_evaluation_state, (name_inputs)(inputs)
+                                                          (valid_votes)(invalid_votes)(spent)(used_outputs)(total) )
@@ -0,0 +1,78 @@
+#include <bts/blockchain/miner_backend.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <map>
+#include <mutex>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     class miner_backend_registry
+     {
+        public:
+           miner_backend_registry()
+           {
+              _factories["cpu"] = []( uint32_t, uint32_t num_threads )
+              {
+                 return std::make_shared<cpu_miner_backend>( num_threads );
+              };
+           }
+
+           static miner_backend_registry& instance()
+           {
+              static miner_backend_registry registry;
+              return registry;
+           }
+
+           std::mutex                                   _mutex;
+           std::map<std::string, miner_backend_factory> _factories;
+     };
+  }
+
+  cpu_miner_backend::cpu_miner_backend( uint32_t num_threads )
+  :_context( num_threads )
+  {
+  }
+
+  std::string cpu_miner_backend::name()const { return "cpu"; }
+
+  std::vector< std::pair<uint32_t,uint32_t> > cpu_miner_backend::search( pow_seed_type seed,
+                                                                         const candidate_handler& on_candidate,
+                                                                         const std::function<bool()>& canceled )
+  {
+     return _context.search( seed, on_candidate, canceled );
+  }
+
+  void register_miner_backend( const std::string& name, const miner_backend_factory& factory )
+  {
+     FC_ASSERT( factory );
+     auto& registry = detail::miner_backend_registry::instance();
+     std::unique_lock<std::mutex> lock( registry._mutex );
+     registry._factories[name] = factory;
+  }
+
+  miner_backend_ptr create_miner_backend( const std::string& name, uint32_t device, uint32_t num_threads )
+  { try {
+     miner_backend_factory factory;
+     {
+        auto& registry = detail::miner_backend_registry::instance();
+        std::unique_lock<std::mutex> lock( registry._mutex );
+        auto itr = registry._factories.find( name );
+        if( itr == registry._factories.end() )
+           FC_THROW_EXCEPTION( key_not_found_exception, "no miner backend named ${name}", ("name",name) );
+        factory = itr->second;
+     }
+     return factory( device, num_threads );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("name",name)("device",device)("num_threads",num_threads) ) }
+
+  std::vector<std::string> miner_backend_names()
+  {
+     auto& registry = detail::miner_backend_registry::instance();
+     std::unique_lock<std::mutex> lock( registry._mutex );
+     std::vector<std::string> names;
+     for( const auto& f : registry._factories ) names.push_back( f.first );
+     return names;
+  }
+
+} } // bts::blockchain
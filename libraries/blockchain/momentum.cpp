@@ -1,4 +1,5 @@
 #include <bts/blockchain/momentum.hpp>
+#include <bts/db/executor.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/crypto/sha1.hpp>
@@ -11,6 +12,16 @@
 #include <fc/time.hpp>
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 #include <fc/log/logger.hpp>
 
@@ -18,12 +29,14 @@
 namespace bts { namespace blockchain {
 
    #define SEARCH_SPACE_BITS 50
-   #define BIRTHDAYS_PER_HASH 8
+   #define HASHES_PER_BATCH  64 /* hashes computed per call to momentum_hashes */
 
    // The Momentum duplicate detector filter
    #define FILTER_SLOTS_POWER 19  /* 2^20 bits - fits in L2 */
    #define FILTER_SIZE_BYTES (1 << (FILTER_SLOTS_POWER+1-3))
-   #define PARTITION_BITS     10 /* Balance TLB pressure vs filter */
+   #ifndef PARTITION_BITS
+   #define PARTITION_BITS     10 /* Balance TLB pressure vs filter, can be overridden to tune */
+   #endif
 
    #define HASH_MASK ((1ULL<<(64-MOMENTUM_NONCE_BITS))-1)  /* How hash is stored in hashStore */
    #define MOMENTUM_COLHASH_SIZE 36 /* bytes */
@@ -75,6 +88,12 @@ namespace bts { namespace blockchain {
       free(filter);
    }
 
+   struct filter_deleter
+   {
+      void operator()(uint32_t *filter)const { free_filter(filter); }
+   };
+   typedef std::unique_ptr<uint32_t, filter_deleter> filter_ptr;
+
    void reset_filter(uint32_t *filter)
    {
       memset(filter, 0x00, FILTER_SIZE_BYTES);
@@ -116,18 +135,49 @@ namespace bts { namespace blockchain {
    }
 
 
-   void generate_hashes(pow_seed_type head, uint64_t *hashStore, uint32_t *hashCounts)
+   /* A search can be stopped by the caller between batches of hashes and
+    * between partitions, or by the collision handler when it has what it needs.
+    * The handler is called with the mutex held so it never runs concurrently. */
+   struct search_control
    {
-      fc::sha512::encoder enc;
-      for ( uint32_t n = 0; n < MAX_MOMENTUM_NONCE; n += (BIRTHDAYS_PER_HASH)) {
-         enc.write( (char*)&n, sizeof(n));
-         enc.write( (char *)&head, sizeof(head));
-	 auto result = enc.result();
+      search_control( const std::function<bool()>& c, const momentum_search_context::collision_handler& h )
+      :canceled(c),on_collision(h),stop(false){}
+
+      bool should_stop()
+      {
+         if (!stop && canceled && canceled()) stop = true;
+         return stop;
+      }
+
+      void report(const std::vector< std::pair<uint32_t,uint32_t> >& found, size_t first)
+      {
+         if (!on_collision || first == found.size()) return;
+         std::unique_lock<std::mutex> lock(mutex);
+         for (size_t i = first; i < found.size() && !stop; i++)
+            if (on_collision(found[i].first, found[i].second)) stop = true;
+      }
+
+      std::function<bool()>                         canceled;
+      momentum_search_context::collision_handler    on_collision;
+      std::atomic<bool>                             stop;
+      std::mutex                                    mutex;
+   };
 
-	 for (uint32_t i = 0; i < BIRTHDAYS_PER_HASH; i++) {
-	    put_hash_in_bucket((result._hash[i] >> (64 - SEARCH_SPACE_BITS)), hashStore, hashCounts, n+i);
-	 }
-	 enc.reset();
+   #define BATCHES_PER_CANCEL_CHECK 16
+
+   void generate_hashes(pow_seed_type head, uint64_t *hashStore, uint32_t *hashCounts, search_control& control)
+   {
+      fc::sha512 results[HASHES_PER_BATCH];
+      uint32_t batch = 0;
+      for ( uint32_t n = 0; n < MAX_MOMENTUM_NONCE; n += (BIRTHDAYS_PER_HASH*HASHES_PER_BATCH)) {
+         if (++batch % BATCHES_PER_CANCEL_CHECK == 0 && control.should_stop()) return;
+         momentum_hashes( head, n, HASHES_PER_BATCH, results );
+
+         for (uint32_t r = 0; r < HASHES_PER_BATCH; r++) {
+	    for (uint32_t i = 0; i < BIRTHDAYS_PER_HASH; i++) {
+	       put_hash_in_bucket((results[r]._hash[i] >> (64 - SEARCH_SPACE_BITS)), hashStore, hashCounts, n+r*BIRTHDAYS_PER_HASH+i);
+	    }
+         }
       }
    }
 
@@ -183,50 +233,282 @@ namespace bts { namespace blockchain {
    }
 
    
-   std::vector< std::pair<uint32_t,uint32_t> > momentum_search( pow_seed_type head )
+   /* The parallel search gives every thread its own sub-bucket in each partition
+    * so that hash generation needs no synchronization.  The sub-buckets hold
+    * fewer hashes than a partition so their relative variance is larger, the
+    * margin is 3.125% plus eight standard deviations and writes are bounded. */
+
+   uint32_t sub_bucket_size(uint32_t num_threads)
    {
-      std::vector< std::pair<uint32_t,uint32_t> > results;
+      uint32_t partition_real_size = 1<<(MOMENTUM_NONCE_BITS-PARTITION_BITS);
+      uint32_t n = (partition_real_size + num_threads - 1) / num_threads;
+      return n + (n>>5) + uint32_t(8*std::sqrt(double(n))) + 16;
+   }
 
-      uint32_t *filter = allocate_filter();
-      if (!filter) {
-            printf("Could not allocate filter for mining\n");
-            return results;
-      }
-      uint32_t hashStoreSize = MAX_MOMENTUM_NONCE * sizeof(uint64_t);
-      /* inter-partition margin of 3% plus a little extra at the end for
-       * paranoia.  Missing things is OK 1 in a billion times, but 
-       * crashing isn't, so the extra 1/64th at the end pushes the
-       * probability of overrun down into the infestisimally small range.
-       */
-
-      hashStoreSize += ((hashStoreSize >> 5) + (hashStoreSize >> 6));
-      uint64_t *hashStore = (uint64_t *)malloc(hashStoreSize);
-      if (!hashStore) {
-            free_filter(filter);
-            printf("Could not allocate hashStore for mining\n");
-            return results;
+   void generate_hashes(pow_seed_type head, uint32_t begin, uint32_t end,
+                        uint64_t *hashStore, uint32_t *hashCounts, const uint32_t *hashLimits,
+                        search_control& control)
+   {
+      fc::sha512 results[HASHES_PER_BATCH];
+      uint32_t batch = 0;
+      for ( uint32_t n = begin; n < end; n += (BIRTHDAYS_PER_HASH*HASHES_PER_BATCH)) {
+         if (++batch % BATCHES_PER_CANCEL_CHECK == 0 && control.should_stop()) return;
+         uint32_t count = std::min<uint32_t>( HASHES_PER_BATCH, (end - n) / BIRTHDAYS_PER_HASH );
+         momentum_hashes( head, n, count, results );
+
+         for (uint32_t r = 0; r < count; r++) {
+	    for (uint32_t i = 0; i < BIRTHDAYS_PER_HASH; i++) {
+	       uint64_t hash = results[r]._hash[i] >> (64 - SEARCH_SPACE_BITS);
+	       uint32_t bin = hash & ((1<<PARTITION_BITS)-1);
+	       /* a full sub-bucket drops the hash, missing a collision is harmless */
+	       if (hashCounts[bin] < hashLimits[bin])
+	          put_hash_in_bucket(hash, hashStore, hashCounts, n+r*BIRTHDAYS_PER_HASH+i);
+	    }
+         }
       }
+   }
 
+   namespace detail
+   {
       static const int NUM_PARTITIONS = (1<<PARTITION_BITS);
-      uint32_t hashCounts[NUM_PARTITIONS];
 
-      for (int i = 0; i < NUM_PARTITIONS; i++) { 
-            hashCounts[i] = partition_offset(i);
-      }
+      /* The store is scattered into randomly so it is backed by 2 MB pages when
+       * possible: reserved huge pages first, then transparent huge pages. */
+      class hash_store
+      {
+         public:
+            hash_store():_data(nullptr),_size(0),_mapped(false),_huge_pages(false){}
+            ~hash_store() { release(); }
+
+            /** rounds size up to a whole number of huge pages on Linux, false if it can't be had */
+            bool allocate( uint64_t size )
+            {
+               release();
+               _size = size;
+#ifdef __linux__
+               static const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+               _size = (_size + HUGE_PAGE_SIZE - 1) & ~uint64_t(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+               void* p = mmap(nullptr, _size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+               if (p != MAP_FAILED) {
+                  _data = (uint64_t *)p;
+                  _mapped = _huge_pages = true;
+                  return true;
+               }
+#endif
+               p = mmap(nullptr, _size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+               if (p != MAP_FAILED) {
+                  _data = (uint64_t *)p;
+                  _mapped = true;
+#ifdef MADV_HUGEPAGE
+                  _huge_pages = madvise(p, _size, MADV_HUGEPAGE) == 0;
+#endif
+                  return true;
+               }
+#endif
+               _data = (uint64_t *)malloc(_size);
+               return _data != nullptr;
+            }
+
+            uint64_t *data()const       { return _data; }
+            uint64_t  size()const       { return _size; }
+            bool      huge_pages()const { return _huge_pages; }
+
+         private:
+            hash_store( const hash_store& );
+            hash_store& operator=( const hash_store& );
+
+            void release()
+            {
+               if (!_data) return;
+#ifdef __linux__
+               if (_mapped) munmap(_data, _size);
+               else
+#endif
+               free(_data);
+               _data = nullptr;
+               _mapped = _huge_pages = false;
+            }
+
+            uint64_t *_data;
+            uint64_t  _size;
+            bool      _mapped;
+            bool      _huge_pages;
+      };
+
+      class momentum_search_context_impl
+      {
+         public:
+            momentum_search_context_impl( uint32_t num_threads )
+            :_num_threads(num_threads),_sub_size(0),
+             _pool(bts::db::executor::instance().pool( "mining" ))
+            {
+               uint64_t store_size = 0;
+               if (_num_threads == 1) {
+                  store_size = MAX_MOMENTUM_NONCE * sizeof(uint64_t);
+                  /* inter-partition margin of 3% plus a little extra at the end for
+                   * paranoia.  Missing things is OK 1 in a billion times, but 
+                   * crashing isn't, so the extra 1/64th at the end pushes the
+                   * probability of overrun down into the infestisimally small range.
+                   */
+                  store_size += ((store_size >> 5) + (store_size >> 6));
+               } else {
+                  _sub_size  = sub_bucket_size(_num_threads);
+                  store_size = uint64_t(NUM_PARTITIONS) * _num_threads * _sub_size * sizeof(uint64_t);
+               }
+               // the members own what they allocated, so a failure here frees what came before it
+               FC_ASSERT( _store.allocate( store_size ), "unable to allocate momentum hash store" );
+
+               _filters.reserve( _num_threads );
+               for (uint32_t t = 0; t < _num_threads; t++) {
+                  _filters.push_back( filter_ptr( allocate_filter() ) );
+                  FC_ASSERT( _filters.back() != nullptr, "unable to allocate momentum filter" );
+               }
+            }
+
+            std::vector< std::pair<uint32_t,uint32_t> > search_serial( pow_seed_type head, search_control& control )
+            {
+               std::vector< std::pair<uint32_t,uint32_t> > results;
+               uint32_t hashCounts[NUM_PARTITIONS];
+
+               for (int i = 0; i < NUM_PARTITIONS; i++) { 
+                     hashCounts[i] = partition_offset(i);
+               }
+
+               auto start = fc::time_point::now();
+               generate_hashes(head, _store.data(), hashCounts, control);
+               auto generated = fc::time_point::now();
+               for (uint32_t i = 0; i < NUM_PARTITIONS && !control.should_stop(); i++) {
+	             int binStart = partition_offset(i);
+	             int binCount = hashCounts[i] - binStart;
+	             size_t first = results.size();
+	             find_duplicates(_store.data()+binStart, binCount, results, _filters[0].get(), head);
+	             control.report(results, first);
+               }
+               record_stats( start, generated, results.size() );
+               return results;
+            }
+
+            std::vector< std::pair<uint32_t,uint32_t> > search_parallel( pow_seed_type head, search_control& control )
+            {
+               std::vector< std::pair<uint32_t,uint32_t> > results;
+               uint32_t num_threads = _num_threads;
+               uint32_t sub_size    = _sub_size;
+               uint64_t *hashStore  = _store.data();
+
+               /* thread t writes partition p at sub-bucket p*num_threads+t */
+               std::vector<uint32_t> hashCounts(NUM_PARTITIONS * num_threads);
+               std::vector<uint32_t> hashLimits(NUM_PARTITIONS * num_threads);
+               for (uint32_t t = 0; t < num_threads; t++) {
+                  for (int p = 0; p < NUM_PARTITIONS; p++) {
+                     hashCounts[t*NUM_PARTITIONS + p] = (p*num_threads + t) * sub_size;
+                     hashLimits[t*NUM_PARTITIONS + p] = hashCounts[t*NUM_PARTITIONS + p] + sub_size;
+                  }
+               }
+
+               auto start = fc::time_point::now();
+
+               /* nonce ranges are multiples of BIRTHDAYS_PER_HASH */
+               uint32_t range = (MAX_MOMENTUM_NONCE / num_threads + BIRTHDAYS_PER_HASH - 1) & ~uint32_t(BIRTHDAYS_PER_HASH-1);
+               std::vector< fc::future<void> > done;
+               for (uint32_t t = 0; t < num_threads; t++) {
+                  uint32_t begin = std::min<uint32_t>( t * range, MAX_MOMENTUM_NONCE );
+                  uint32_t end   = std::min<uint32_t>( begin + range, MAX_MOMENTUM_NONCE );
+                  uint32_t *counts = &hashCounts[t*NUM_PARTITIONS];
+                  const uint32_t *limits = &hashLimits[t*NUM_PARTITIONS];
+                  search_control* ctl = &control;
+                  done.push_back( _pool.async( [=](){ generate_hashes( head, begin, end, hashStore, counts, limits, *ctl ); } ) );
+               }
+               for (auto& d : done) d.wait();
+               done.clear();
+               auto generated = fc::time_point::now();
+               if (control.should_stop()) {
+                  record_stats( start, generated, 0 );
+                  return results;
+               }
+
+               /* each thread compacts the sub-buckets of every num_threads'th partition
+                * and searches it with its own filter */
+               std::vector< std::vector< std::pair<uint32_t,uint32_t> > > partition_results(NUM_PARTITIONS);
+               for (uint32_t t = 0; t < num_threads; t++) {
+                  uint32_t *filter = _filters[t].get();
+                  done.push_back( _pool.async( [&,t,filter]()
+                  {
+                     for (uint32_t p = t; p < uint32_t(NUM_PARTITIONS) && !control.should_stop(); p += num_threads) {
+                        uint64_t *bin = hashStore + uint64_t(p*num_threads) * sub_size;
+                        uint32_t count = 0;
+                        for (uint32_t s = 0; s < num_threads; s++) {
+                           uint32_t start = (p*num_threads + s) * sub_size;
+                           uint32_t sub_count = hashCounts[s*NUM_PARTITIONS + p] - start;
+                           memmove(bin + count, hashStore + start, sub_count * sizeof(uint64_t));
+                           count += sub_count;
+                        }
+                        find_duplicates(bin, count, partition_results[p], filter, head);
+                        control.report(partition_results[p], 0);
+                     }
+                  } ) );
+               }
+               for (auto& d : done) d.wait();
+
+               for (uint32_t p = 0; p < uint32_t(NUM_PARTITIONS); p++)
+                  results.insert( results.end(), partition_results[p].begin(), partition_results[p].end() );
+               record_stats( start, generated, results.size() );
+               return results;
+            }
+
+            void record_stats( fc::time_point start, fc::time_point generated, size_t collisions )
+            {
+               _stats.generate_time  = generated - start;
+               _stats.find_time      = fc::time_point::now() - generated;
+               _stats.collisions     = collisions;
+               _stats.partition_bits = PARTITION_BITS;
+            }
+
+            momentum_search_stats                      _stats;
+            uint32_t                                   _num_threads;
+            uint32_t                                   _sub_size;
+            hash_store                                 _store;
+            std::vector<filter_ptr>                    _filters;
+            /** the searches of every context share the threads of the mining pool */
+            bts::db::thread_pool&                      _pool;
+      };
+   } // detail
+
+   momentum_search_context::momentum_search_context( uint32_t num_threads )
+   {
+      if (num_threads == 0) num_threads = bts::db::executor::instance().pool( "mining" ).size();
+      my.reset( new detail::momentum_search_context_impl( num_threads ) );
+   }
 
-      generate_hashes(head, hashStore, hashCounts);
-      for (uint32_t i = 0; i < NUM_PARTITIONS; i++) {
-	    int binStart = partition_offset(i);
-	    int binCount = hashCounts[i] - binStart;
-	    find_duplicates(hashStore+binStart, binCount, results, filter, head);
-      }
+   momentum_search_context::~momentum_search_context()
+   {
+   }
+
+   std::vector< std::pair<uint32_t,uint32_t> > momentum_search_context::search( pow_seed_type head,
+                                                                               const collision_handler& on_collision,
+                                                                               const std::function<bool()>& canceled )
+   {
+      search_control control( canceled, on_collision );
+      if (my->_num_threads == 1) return my->search_serial( head, control );
+      return my->search_parallel( head, control );
+   }
 
-      free_filter(filter);
-      free(hashStore);
+   uint32_t momentum_search_context::num_threads()const { return my->_num_threads; }
+   bool     momentum_search_context::uses_huge_pages()const { return my->_store.huge_pages(); }
+   uint64_t momentum_search_context::memory_size()const { return my->_store.size() + uint64_t(my->_filters.size()) * FILTER_SIZE_BYTES; }
+   const momentum_search_stats& momentum_search_context::last_stats()const { return my->_stats; }
 
-      return results;
+   std::vector< std::pair<uint32_t,uint32_t> > momentum_search( pow_seed_type head )
+   {
+      return momentum_search( head, 1 );
    }
 
+   std::vector< std::pair<uint32_t,uint32_t> > momentum_search( pow_seed_type head, uint32_t num_threads )
+   { try {
+      momentum_search_context context( num_threads );
+      return context.search( head );
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("num_threads",num_threads) ) }
+
 
    bool momentum_verify( pow_seed_type head, uint32_t a, uint32_t b )
    {
@@ -235,16 +517,10 @@ namespace bts { namespace blockchain {
        if( b > MAX_MOMENTUM_NONCE ) return false;
 
        uint32_t ia = (a / 8) * 8; 
-       fc::sha512::encoder enca;
-       enca.write( (char*)&ia, sizeof(ia) );
-       enca.write( (char*)&head, sizeof(head) );
-       auto ar = enca.result();
+       auto ar = momentum_hash( head, ia );
 
        uint32_t ib = (b / 8) * 8; 
-       fc::sha512::encoder encb;
-       encb.write( (char*)&ib, sizeof(ib) );
-       encb.write( (char*)&head, sizeof(head) );
-       auto br = encb.result();
+       auto br = momentum_hash( head, ib );
 
        return (ar._hash[a%8]>>14) == (br._hash[b%8]>>14);
    }
@@ -0,0 +1,259 @@
+#include <bts/blockchain/momentum.hpp>
+#include <fc/crypto/sha512.hpp>
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MOMENTUM_HASH_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * A SHA-512 specialized for the 36 byte momentum input (nonce, head).  The
+ * input always fits in one block so there is a single compression with a
+ * known padding, and only the first message word depends upon the nonce.
+ * The AVX2 and AVX-512 kernels hash 4 and 8 nonces at once, one per lane.
+ *
+ * fc::sha512 stores the digest as bytes, so every output word is byte
+ * swapped into _hash to produce exactly what fc::sha512::encoder produces.
+ */
+
+namespace bts { namespace blockchain {
+
+   namespace
+   {
+      const uint64_t K[80] = {
+         0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+         0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+         0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+         0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+         0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+         0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+         0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+         0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+         0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+         0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+         0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+         0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+         0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+         0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+         0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+         0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+         0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+         0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+         0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+         0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+      };
+
+      const uint64_t H0[8] = {
+         0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+         0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+      };
+
+      /** the input is 36 bytes, or 288 bits */
+      const uint64_t INPUT_BITS = 36*8;
+
+      inline uint64_t load_be64( const unsigned char* p )
+      {
+         uint64_t v = 0;
+         for( int i = 0; i < 8; ++i ) v = (v << 8) | p[i];
+         return v;
+      }
+
+      inline uint32_t load_be32( const unsigned char* p )
+      {
+         return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+      }
+
+      /** stores v so that its bytes are in big endian order in memory */
+      inline void store_be64( uint64_t& out, uint64_t v )
+      {
+         unsigned char* p = (unsigned char*)&out;
+         for( int i = 7; i >= 0; --i ) { p[i] = (unsigned char)v; v >>= 8; }
+      }
+
+      /**
+       *  Message words 1 through 15 depend only upon head.  Word 0 holds the
+       *  nonce, as stored in memory by the encoder, followed by 4 bytes of head.
+       */
+      struct message
+      {
+         message( const pow_seed_type& head )
+         {
+            const unsigned char* h = (const unsigned char*)&head;
+            head_prefix = load_be32( h );
+            for( int i = 0; i < 3; ++i ) w[i+1] = load_be64( h + 4 + 8*i );
+            w[4] = (uint64_t(load_be32( h + 28 )) << 32) | 0x80000000ULL;
+            for( int i = 5; i < 15; ++i ) w[i] = 0;
+            w[15] = INPUT_BITS;
+         }
+
+         uint64_t word0( uint32_t nonce )const
+         {
+            unsigned char n[4];
+            memcpy( n, &nonce, sizeof(n) );
+            return (uint64_t(load_be32( n )) << 32) | head_prefix;
+         }
+
+         uint64_t w[16]; ///< w[0] is unused
+         uint32_t head_prefix;
+      };
+
+      inline uint64_t rotr( uint64_t x, int n ) { return (x >> n) | (x << (64-n)); }
+
+      void hash_scalar( const message& m, uint32_t nonce, fc::sha512& out )
+      {
+         uint64_t w[80];
+         w[0] = m.word0( nonce );
+         for( int t = 1; t < 16; ++t ) w[t] = m.w[t];
+         for( int t = 16; t < 80; ++t )
+         {
+            uint64_t s0 = rotr(w[t-15],1) ^ rotr(w[t-15],8) ^ (w[t-15] >> 7);
+            uint64_t s1 = rotr(w[t-2],19) ^ rotr(w[t-2],61) ^ (w[t-2] >> 6);
+            w[t] = w[t-16] + s0 + w[t-7] + s1;
+         }
+
+         uint64_t a = H0[0], b = H0[1], c = H0[2], d = H0[3];
+         uint64_t e = H0[4], f = H0[5], g = H0[6], h = H0[7];
+         for( int t = 0; t < 80; ++t )
+         {
+            uint64_t t1 = h + (rotr(e,14) ^ rotr(e,18) ^ rotr(e,41)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+            uint64_t t2 = (rotr(a,28) ^ rotr(a,34) ^ rotr(a,39)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+         }
+
+         store_be64( out._hash[0], a + H0[0] );
+         store_be64( out._hash[1], b + H0[1] );
+         store_be64( out._hash[2], c + H0[2] );
+         store_be64( out._hash[3], d + H0[3] );
+         store_be64( out._hash[4], e + H0[4] );
+         store_be64( out._hash[5], f + H0[5] );
+         store_be64( out._hash[6], g + H0[6] );
+         store_be64( out._hash[7], h + H0[7] );
+      }
+
+#ifdef MOMENTUM_HASH_X86
+      /* one lane per nonce, the nonces are first_nonce, first_nonce + step, ... */
+
+      #define AVX2_ROTR(x,n) _mm256_or_si256( _mm256_srli_epi64((x),(n)), _mm256_slli_epi64((x),64-(n)) )
+      #define AVX2_XOR3(x,y,z) _mm256_xor_si256( _mm256_xor_si256((x),(y)), (z) )
+
+      __attribute__((target("avx2")))
+      void hash_avx2( const message& m, uint32_t first_nonce, uint32_t step, fc::sha512* out )
+      {
+         __m256i w[80];
+         w[0] = _mm256_set_epi64x( m.word0( first_nonce + 3*step ), m.word0( first_nonce + 2*step ),
+                                   m.word0( first_nonce + step ),   m.word0( first_nonce ) );
+         for( int t = 1; t < 16; ++t ) w[t] = _mm256_set1_epi64x( m.w[t] );
+         for( int t = 16; t < 80; ++t )
+         {
+            __m256i s0 = AVX2_XOR3( AVX2_ROTR(w[t-15],1), AVX2_ROTR(w[t-15],8), _mm256_srli_epi64(w[t-15],7) );
+            __m256i s1 = AVX2_XOR3( AVX2_ROTR(w[t-2],19), AVX2_ROTR(w[t-2],61), _mm256_srli_epi64(w[t-2],6) );
+            w[t] = _mm256_add_epi64( _mm256_add_epi64( w[t-16], s0 ), _mm256_add_epi64( w[t-7], s1 ) );
+         }
+
+         __m256i a = _mm256_set1_epi64x( H0[0] ), b = _mm256_set1_epi64x( H0[1] );
+         __m256i c = _mm256_set1_epi64x( H0[2] ), d = _mm256_set1_epi64x( H0[3] );
+         __m256i e = _mm256_set1_epi64x( H0[4] ), f = _mm256_set1_epi64x( H0[5] );
+         __m256i g = _mm256_set1_epi64x( H0[6] ), h = _mm256_set1_epi64x( H0[7] );
+         for( int t = 0; t < 80; ++t )
+         {
+            __m256i ch  = _mm256_xor_si256( _mm256_and_si256( e, f ), _mm256_andnot_si256( e, g ) );
+            __m256i maj = AVX2_XOR3( _mm256_and_si256( a, b ), _mm256_and_si256( a, c ), _mm256_and_si256( b, c ) );
+            __m256i t1  = _mm256_add_epi64( _mm256_add_epi64( h, AVX2_XOR3( AVX2_ROTR(e,14), AVX2_ROTR(e,18), AVX2_ROTR(e,41) ) ),
+                                            _mm256_add_epi64( ch, _mm256_add_epi64( _mm256_set1_epi64x( K[t] ), w[t] ) ) );
+            __m256i t2  = _mm256_add_epi64( AVX2_XOR3( AVX2_ROTR(a,28), AVX2_ROTR(a,34), AVX2_ROTR(a,39) ), maj );
+            h = g; g = f; f = e; e = _mm256_add_epi64( d, t1 );
+            d = c; c = b; b = a; a = _mm256_add_epi64( t1, t2 );
+         }
+
+         __m256i state[8] = { a, b, c, d, e, f, g, h };
+         uint64_t lanes[4];
+         for( int i = 0; i < 8; ++i )
+         {
+            _mm256_storeu_si256( (__m256i*)lanes, _mm256_add_epi64( state[i], _mm256_set1_epi64x( H0[i] ) ) );
+            for( int l = 0; l < 4; ++l ) store_be64( out[l]._hash[i], lanes[l] );
+         }
+      }
+
+      #define AVX512_XOR3(x,y,z) _mm512_ternarylogic_epi64( (x), (y), (z), 0x96 )
+
+      __attribute__((target("avx512f")))
+      void hash_avx512( const message& m, uint32_t first_nonce, uint32_t step, fc::sha512* out )
+      {
+         __m512i w[80];
+         w[0] = _mm512_set_epi64( m.word0( first_nonce + 7*step ), m.word0( first_nonce + 6*step ),
+                                  m.word0( first_nonce + 5*step ), m.word0( first_nonce + 4*step ),
+                                  m.word0( first_nonce + 3*step ), m.word0( first_nonce + 2*step ),
+                                  m.word0( first_nonce + step ),   m.word0( first_nonce ) );
+         for( int t = 1; t < 16; ++t ) w[t] = _mm512_set1_epi64( m.w[t] );
+         for( int t = 16; t < 80; ++t )
+         {
+            __m512i s0 = AVX512_XOR3( _mm512_ror_epi64(w[t-15],1), _mm512_ror_epi64(w[t-15],8), _mm512_srli_epi64(w[t-15],7) );
+            __m512i s1 = AVX512_XOR3( _mm512_ror_epi64(w[t-2],19), _mm512_ror_epi64(w[t-2],61), _mm512_srli_epi64(w[t-2],6) );
+            w[t] = _mm512_add_epi64( _mm512_add_epi64( w[t-16], s0 ), _mm512_add_epi64( w[t-7], s1 ) );
+         }
+
+         __m512i a = _mm512_set1_epi64( H0[0] ), b = _mm512_set1_epi64( H0[1] );
+         __m512i c = _mm512_set1_epi64( H0[2] ), d = _mm512_set1_epi64( H0[3] );
+         __m512i e = _mm512_set1_epi64( H0[4] ), f = _mm512_set1_epi64( H0[5] );
+         __m512i g = _mm512_set1_epi64( H0[6] ), h = _mm512_set1_epi64( H0[7] );
+         for( int t = 0; t < 80; ++t )
+         {
+            __m512i ch  = _mm512_ternarylogic_epi64( e, f, g, 0xca );
+            __m512i maj = _mm512_ternarylogic_epi64( a, b, c, 0xe8 );
+            __m512i t1  = _mm512_add_epi64( _mm512_add_epi64( h, AVX512_XOR3( _mm512_ror_epi64(e,14), _mm512_ror_epi64(e,18), _mm512_ror_epi64(e,41) ) ),
+                                            _mm512_add_epi64( ch, _mm512_add_epi64( _mm512_set1_epi64( K[t] ), w[t] ) ) );
+            __m512i t2  = _mm512_add_epi64( AVX512_XOR3( _mm512_ror_epi64(a,28), _mm512_ror_epi64(a,34), _mm512_ror_epi64(a,39) ), maj );
+            h = g; g = f; f = e; e = _mm512_add_epi64( d, t1 );
+            d = c; c = b; b = a; a = _mm512_add_epi64( t1, t2 );
+         }
+
+         __m512i state[8] = { a, b, c, d, e, f, g, h };
+         uint64_t lanes[8];
+         for( int i = 0; i < 8; ++i )
+         {
+            _mm512_storeu_si512( (void*)lanes, _mm512_add_epi64( state[i], _mm512_set1_epi64( H0[i] ) ) );
+            for( int l = 0; l < 8; ++l ) store_be64( out[l]._hash[i], lanes[l] );
+         }
+      }
+#endif
+
+      enum momentum_hash_kernel { scalar_kernel, avx2_kernel, avx512_kernel };
+
+      momentum_hash_kernel detect_kernel()
+      {
+#ifdef MOMENTUM_HASH_X86
+         __builtin_cpu_init();
+         if( __builtin_cpu_supports( "avx512f" ) ) return avx512_kernel;
+         if( __builtin_cpu_supports( "avx2" ) )    return avx2_kernel;
+#endif
+         return scalar_kernel;
+      }
+
+      const momentum_hash_kernel best_kernel = detect_kernel();
+   } // anonymous namespace
+
+   fc::sha512 momentum_hash( pow_seed_type head, uint32_t nonce )
+   {
+      fc::sha512 result;
+      hash_scalar( message( head ), nonce, result );
+      return result;
+   }
+
+   void momentum_hashes( pow_seed_type head, uint32_t first_nonce, uint32_t count, fc::sha512* out )
+   {
+      message m( head );
+      const uint32_t step = BIRTHDAYS_PER_HASH;
+      uint32_t i = 0;
+#ifdef MOMENTUM_HASH_X86
+      if( best_kernel == avx512_kernel )
+         for( ; i + 8 <= count; i += 8 ) hash_avx512( m, first_nonce + i*step, step, out + i );
+      if( best_kernel >= avx2_kernel )
+         for( ; i + 4 <= count; i += 4 ) hash_avx2( m, first_nonce + i*step, step, out + i );
+#endif
+      for( ; i < count; ++i ) hash_scalar( m, first_nonce + i*step, out[i] );
+   }
+
+} } // bts::blockchain
@@ -0,0 +1,158 @@
+#include <bts/blockchain/orphan_pool.hpp>
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      struct orphan
+      {
+         signed_transaction              trx;
+         transaction_id_type             id;
+         uint32_t                        size;
+         uint64_t                        sequence;
+         /** the outputs it still waits for */
+         std::vector<output_reference>   missing;
+      };
+      typedef std::shared_ptr<orphan> orphan_ptr;
+
+      class orphan_pool_impl
+      {
+         public:
+            orphan_pool_impl( size_t max_count, size_t max_size )
+            :_max_count(max_count),_max_size(max_size),_size_in_bytes(0),_next_sequence(0){}
+
+            size_t                                                       _max_count;
+            size_t                                                       _max_size;
+            size_t                                                       _size_in_bytes;
+            uint64_t                                                     _next_sequence;
+            mutable std::mutex                                           _mutex;
+            std::unordered_map<transaction_id_type, orphan_ptr>          _by_id;
+            std::unordered_multimap<output_reference, orphan_ptr>        _by_missing;
+            std::map<uint64_t, orphan_ptr>                               _by_arrival;
+
+            /** caller must hold _mutex */
+            void erase( const orphan_ptr& entry )
+            {
+               for( const output_reference& ref : entry->missing )
+               {
+                  auto range = _by_missing.equal_range( ref );
+                  for( auto itr = range.first; itr != range.second; ++itr )
+                     if( itr->second == entry ) { _by_missing.erase( itr ); break; }
+               }
+               _by_id.erase( entry->id );
+               _by_arrival.erase( entry->sequence );
+               _size_in_bytes -= entry->size;
+            }
+      };
+
+   } // namespace detail
+
+   orphan_pool::orphan_pool( size_t max_count, size_t max_size )
+   :my( new detail::orphan_pool_impl( max_count, max_size ) )
+   {
+   }
+
+   orphan_pool::~orphan_pool()
+   {
+   }
+
+   bool orphan_pool::insert( const signed_transaction& trx, const std::vector<output_reference>& missing )
+   {
+      auto entry      = std::make_shared<detail::orphan>();
+      entry->trx      = trx;
+      entry->id       = trx.id();
+      entry->size     = trx.size();
+      entry->missing  = missing;
+      if( entry->size > my->_max_size || missing.empty() ) return false;
+
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      if( my->_by_id.find( entry->id ) != my->_by_id.end() ) return false;
+
+      while( my->_by_arrival.size() && ( my->_by_arrival.size() >= my->_max_count ||
+                                         my->_size_in_bytes + entry->size > my->_max_size ) )
+         my->erase( my->_by_arrival.begin()->second );
+
+      entry->sequence = my->_next_sequence++;
+      my->_by_id[entry->id]                 = entry;
+      my->_by_arrival[entry->sequence]      = entry;
+      for( const output_reference& ref : entry->missing )
+         my->_by_missing.insert( std::make_pair( ref, entry ) );
+      my->_size_in_bytes += entry->size;
+      return true;
+   }
+
+   std::vector<signed_transaction> orphan_pool::take_children( const signed_transaction& parent )
+   {
+      auto parent_id = parent.id();
+      std::map<uint64_t, detail::orphan_ptr> ready;
+
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      if( my->_by_missing.empty() ) return std::vector<signed_transaction>();
+      for( uint32_t o = 0; o < parent.outputs.size(); ++o )
+      {
+         output_reference ref( parent_id, o );
+         auto range = my->_by_missing.equal_range( ref );
+         for( auto itr = range.first; itr != range.second; )
+         {
+            auto entry = itr->second;
+            auto found = std::find( entry->missing.begin(), entry->missing.end(), ref );
+            if( found != entry->missing.end() ) entry->missing.erase( found );
+            if( entry->missing.empty() ) ready[entry->sequence] = entry;
+            itr = my->_by_missing.erase( itr );
+         }
+      }
+
+      std::vector<signed_transaction> children;
+      children.reserve( ready.size() );
+      for( auto& item : ready )
+      {
+         my->erase( item.second );
+         children.push_back( std::move( item.second->trx ) );
+      }
+      return children;
+   }
+
+   bool orphan_pool::contains( const transaction_id_type& id )const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_by_id.find( id ) != my->_by_id.end();
+   }
+
+   size_t orphan_pool::size()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_by_id.size();
+   }
+
+   size_t orphan_pool::size_in_bytes()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_size_in_bytes;
+   }
+
+   void orphan_pool::set_limits( size_t max_count, size_t max_size )
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->_max_count = max_count;
+      my->_max_size  = max_size;
+      while( my->_by_arrival.size() && ( my->_by_arrival.size() > my->_max_count ||
+                                         my->_size_in_bytes > my->_max_size ) )
+         my->erase( my->_by_arrival.begin()->second );
+   }
+
+   void orphan_pool::clear()
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->_by_id.clear();
+      my->_by_missing.clear();
+      my->_by_arrival.clear();
+      my->_size_in_bytes = 0;
+   }
+
+} } // bts::blockchain
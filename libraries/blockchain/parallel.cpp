@@ -0,0 +1,97 @@
+#include <bts/blockchain/parallel.hpp>
+#include <bts/db/executor.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      /** counts the ranges still running, waiting on it blocks the thread instead of yielding */
+      class range_latch
+      {
+         public:
+            range_latch( size_t count ):_remaining(count){}
+
+            void done( std::exception_ptr error )
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               if( error && !_error ) _error = error;
+               if( --_remaining == 0 ) _finished.notify_all();
+            }
+
+            /** @return the first exception of a range */
+            std::exception_ptr wait()
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               _finished.wait( lock, [this](){ return _remaining == 0; } );
+               return _error;
+            }
+
+         private:
+            std::mutex              _mutex;
+            std::condition_variable _finished;
+            size_t                  _remaining;
+            std::exception_ptr      _error;
+      };
+
+      static bool is_thread_of( bts::db::thread_pool& pool )
+      {
+         fc::thread* current = &fc::thread::current();
+         for( uint32_t i = 0; i < pool.size(); ++i )
+            if( &pool.thread( i ) == current ) return true;
+         return false;
+      }
+   }
+
+   /**
+    *  The caller is blocked rather than left to yield while the ranges run, so no other task of
+    *  its fc::thread, such as an RPC call on the chain thread, can run while it is in the middle
+    *  of something like a block whose batch is open.  The caller evaluates the first range
+    *  itself, and a caller that is a thread of the pool runs every range, since blocking it
+    *  could leave the pool without a thread for the ranges it waits for.
+    */
+   void parallel_for( size_t count, size_t min_range, const std::function<void( size_t begin, size_t end )>& f )
+   {
+      if( count == 0 ) return;
+      min_range = std::max<size_t>( min_range, 1 );
+
+      auto& pool    = bts::db::executor::instance().pool( "validation" );
+      size_t ranges = std::min<size_t>( pool.size(), (count + min_range - 1) / min_range );
+      if( ranges <= 1 || detail::is_thread_of( pool ) )
+      {
+         f( 0, count );
+         return;
+      }
+
+      size_t range = (count + ranges - 1) / ranges;
+      ranges = (count + range - 1) / range;
+
+      // every range finishes before returning or rethrowing, so f is not referenced afterwards
+      detail::range_latch latch( ranges - 1 );
+      for( size_t r = 1; r < ranges; ++r )
+      {
+         size_t begin = r * range;
+         size_t end   = std::min( begin + range, count );
+         pool.async( [&f,&latch,begin,end]()
+         {
+            std::exception_ptr error;
+            try { f( begin, end ); }
+            catch ( ... ) { error = std::current_exception(); }
+            latch.done( error );
+         } );
+      }
+
+      std::exception_ptr error;
+      try { f( 0, std::min( range, count ) ); }
+      catch ( ... ) { error = std::current_exception(); }
+      std::exception_ptr range_error = latch.wait();
+      if( error ) std::rethrow_exception( error );
+      if( range_error ) std::rethrow_exception( range_error );
+   }
+
+} } // bts::blockchain
@@ -1,10 +1,10 @@
 #include <algorithm>
 
-#include <fc/crypto/base58.hpp>
 #include <fc/crypto/elliptic.hpp>
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/exception/exception.hpp>
 
+#include <bts/blockchain/base58.hpp>
 #include <bts/blockchain/pts_address.hpp>
 #include <bts/blockchain/small_hash.hpp>
 
@@ -16,7 +16,7 @@ namespace bts { namespace blockchain {
 
    pts_address::pts_address( const std::string& base58str )
    {
-      std::vector<char> v = fc::from_base58( fc::string(base58str) );
+      std::vector<char> v = base58_decode( base58str );
       if( v.size() )
          memcpy( addr.data, v.data(), std::min<size_t>( v.size(), sizeof(addr) ) );
 
@@ -26,7 +26,7 @@ namespace bts { namespace blockchain {
       }
    }
 
-   pts_address::pts_address( const fc::ecc::public_key& pub, bool compressed, uint8_t version )
+   static fc::ripemd160 key_hash( const fc::ecc::public_key& pub, bool compressed )
    {
        fc::sha256 sha2;
        if( compressed )
@@ -39,12 +39,39 @@ namespace bts { namespace blockchain {
            auto dat = pub.serialize_ecc_point();
            sha2     = fc::sha256::hash(dat.data, sizeof(dat) );
        }
-       auto rep      = fc::ripemd160::hash((char*)&sha2,sizeof(sha2));
-       addr.data[0]  = version;
-       memcpy( addr.data+1, (char*)&rep, sizeof(rep) );
-       auto check    = fc::sha256::hash( addr.data, sizeof(rep)+1 );
+       return fc::ripemd160::hash((char*)&sha2,sizeof(sha2));
+   }
+
+   /** sets the version byte and recomputes the checksum over the existing key hash */
+   static void set_version( pts_address& a, uint8_t version )
+   {
+       a.addr.data[0] = version;
+       auto check     = fc::sha256::hash( a.addr.data, sizeof(fc::ripemd160)+1 );
        check = fc::sha256::hash(check); // double
-       memcpy( addr.data+1+sizeof(rep), (char*)&check, 4 );
+       memcpy( a.addr.data+1+sizeof(fc::ripemd160), (char*)&check, 4 );
+   }
+
+   pts_address::pts_address( const fc::ecc::public_key& pub, bool compressed, uint8_t version )
+   {
+       auto rep = key_hash( pub, compressed );
+       memcpy( addr.data+1, (char*)&rep, sizeof(rep) );
+       set_version( *this, version );
+   }
+
+   pts_address::pts_address( const fc::ripemd160& rep, uint8_t version )
+   {
+       memcpy( addr.data+1, (char*)&rep, sizeof(rep) );
+       set_version( *this, version );
+   }
+
+   std::array<pts_address,4> pts_address::all_forms( const fc::ecc::public_key& pub )
+   {
+       std::array<pts_address,4> r;
+       r[0] = pts_address( key_hash( pub, false ), 56 );
+       r[1] = pts_address( key_hash( pub, true  ), 56 );
+       r[2] = r[0]; set_version( r[2], 0 );
+       r[3] = r[1]; set_version( r[3], 0 );
+       return r;
    }
 
    /**
@@ -61,7 +88,7 @@ namespace bts { namespace blockchain {
 
    pts_address::operator std::string()const
    {
-        return fc::to_base58( addr.data, sizeof(addr) );
+        return base58_encode( addr.data, sizeof(addr) );
    }
 
 
@@ -0,0 +1,253 @@
+#include <bts/blockchain/signature_cache.hpp>
+#include <bts/db/executor.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/log/logger.hpp>
+
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      class signature_cache_impl
+      {
+         public:
+            /** a key in the map and the order, its public key and the node overhead */
+            static const uint64_t key_entry_bytes    = 2*sizeof(fc::sha256) + sizeof(fc::ecc::public_key) + 48;
+            /** the signers of a transaction with a signature or two, their addresses and inputs */
+            static const uint64_t signer_entry_bytes = 2*sizeof(transaction_id_type) + sizeof(transaction_signers) + 256;
+
+            signature_cache_impl( size_t max_size, size_t max_trx_size )
+            :_max_size(max_size),_max_trx_size(max_trx_size),_initial_size(max_size),_initial_trx_size(max_trx_size),
+             _hits(0),_misses(0),_signer_hits(0),_signer_misses(0){}
+
+            static fc::sha256 cache_key( const fc::ecc::compact_signature& sig, const fc::sha256& digest )
+            {
+               fc::sha256::encoder enc;
+               enc.write( (const char*)&digest, sizeof(digest) );
+               enc.write( (const char*)sig.begin(), sig.size() );
+               return enc.result();
+            }
+
+            bool find( const fc::sha256& key, fc::ecc::public_key& pub )
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               auto itr = _keys.find( key );
+               if( itr == _keys.end() ) { ++_misses; return false; }
+               ++_hits;
+               pub = itr->second;
+               return true;
+            }
+
+            void insert( const fc::sha256& key, const fc::ecc::public_key& pub )
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               if( _max_size == 0 ) return;
+               if( !_keys.insert( std::make_pair( key, pub ) ).second ) return;
+               _order.push_back( key );
+               while( _keys.size() > _max_size ) evict();
+            }
+
+            transaction_signers_ptr find_signers( const transaction_id_type& id )
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               auto itr = _signers.find( id );
+               if( itr == _signers.end() ) { ++_signer_misses; return transaction_signers_ptr(); }
+               ++_signer_hits;
+               return itr->second;
+            }
+
+            void insert_signers( const transaction_id_type& id, const transaction_signers_ptr& signers )
+            {
+               std::unique_lock<std::mutex> lock( _mutex );
+               if( _max_trx_size == 0 ) return;
+               if( !_signers.insert( std::make_pair( id, signers ) ).second ) return;
+               _trx_order.push_back( id );
+               while( _signers.size() > _max_trx_size ) evict_signers();
+            }
+
+            /** removes the oldest entry, caller must hold _mutex */
+            void evict()
+            {
+               _keys.erase( _order.front() );
+               _order.pop_front();
+            }
+
+            void evict_signers()
+            {
+               _signers.erase( _trx_order.front() );
+               _trx_order.pop_front();
+            }
+
+            size_t                                       _max_size;
+            size_t                                       _max_trx_size;
+            const size_t                                 _initial_size;
+            const size_t                                 _initial_trx_size;
+            mutable std::mutex                           _mutex;
+            std::map<fc::sha256,fc::ecc::public_key>     _keys;
+            std::deque<fc::sha256>                       _order;
+            std::map<transaction_id_type,transaction_signers_ptr> _signers;
+            std::deque<transaction_id_type>              _trx_order;
+            uint64_t                                     _hits;
+            uint64_t                                     _misses;
+            uint64_t                                     _signer_hits;
+            uint64_t                                     _signer_misses;
+      };
+   }
+
+   const std::unordered_set<pts_address>& transaction_signers::pts_addresses()const
+   {
+      std::call_once( _pts_once, [this]()
+      {
+         for( auto itr = keys.begin(); itr != keys.end(); ++itr )
+         {
+            auto forms = pts_address::all_forms( *itr );
+            _pts_addresses.insert( forms.begin(), forms.end() );
+         }
+      });
+      return _pts_addresses;
+   }
+
+   signature_cache::signature_cache( size_t max_size, size_t max_trx_size )
+   :my( new detail::signature_cache_impl( max_size, max_trx_size ) )
+   {
+   }
+
+   signature_cache::~signature_cache()
+   {
+   }
+
+   signature_cache& signature_cache::instance()
+   {
+      static signature_cache cache;
+      return cache;
+   }
+
+   fc::ecc::public_key signature_cache::recover( const fc::ecc::compact_signature& sig, const fc::sha256& digest )
+   {
+      auto key = detail::signature_cache_impl::cache_key( sig, digest );
+      fc::ecc::public_key pub;
+      if( my->find( key, pub ) ) return pub;
+
+      pub = fc::ecc::public_key( sig, digest );
+      my->insert( key, pub );
+      return pub;
+   }
+
+   transaction_signers_ptr signature_cache::get_signers( const signed_transaction& trx )
+   {
+      auto id = trx.id();
+      auto signers = my->find_signers( id );
+      if( signers ) return signers;
+
+      auto result = std::make_shared<transaction_signers>();
+      auto dig    = trx.digest();
+      result->keys.reserve( trx.sigs.size() );
+      for( auto itr = trx.sigs.begin(); itr != trx.sigs.end(); ++itr )
+      {
+         result->keys.push_back( recover( *itr, dig ) );
+         result->addresses.insert( address( result->keys.back() ) );
+      }
+
+      std::unordered_set<output_reference> unique_inputs;
+      result->unique_inputs = true;
+      for( auto itr = trx.inputs.begin(); itr != trx.inputs.end(); ++itr )
+      {
+         if( !unique_inputs.insert( itr->output_ref ).second )
+         {
+            result->unique_inputs = false;
+            break;
+         }
+      }
+
+      my->insert_signers( id, result );
+      return result;
+   }
+
+   void signature_cache::recover( const signed_transactions& trxs, uint32_t num_threads )
+   { try {
+      auto& pool = bts::db::executor::instance().pool( "signature" );
+      if( num_threads == 0 ) num_threads = pool.size();
+      num_threads = std::min<uint32_t>( num_threads, trxs.size() );
+      if( num_threads == 0 ) return;
+
+      // task i recovers every num_threads'th transaction
+      std::vector< fc::future<void> > done;
+      done.reserve( num_threads );
+      for( uint32_t i = 0; i < num_threads; ++i )
+      {
+         done.push_back( pool.async( [this,&trxs,i,num_threads]()
+         {
+            for( uint32_t t = i; t < trxs.size(); t += num_threads )
+            {
+               try {
+                  get_signers( trxs[t] );
+               }
+               catch ( const fc::exception& e )
+               {
+                  // invalid signatures are reported when the transaction is evaluated
+                  wlog( "unable to recover signatures: ${e}", ("e",e.to_detail_string()) );
+               }
+            }
+         } ) );
+      }
+      for( auto& d : done ) d.wait();
+   } FC_RETHROW_EXCEPTIONS( warn, "error recovering signatures" ) }
+
+   void signature_cache::set_max_size( size_t signatures, size_t trxs )
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->_max_size     = signatures;
+      my->_max_trx_size = trxs;
+      while( my->_keys.size() > my->_max_size ) my->evict();
+      while( my->_signers.size() > my->_max_trx_size ) my->evict_signers();
+   }
+
+   size_t signature_cache::size()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_keys.size();
+   }
+
+   uint64_t signature_cache::memory_usage()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_keys.size()    * detail::signature_cache_impl::key_entry_bytes +
+             my->_signers.size() * detail::signature_cache_impl::signer_entry_bytes;
+   }
+
+   void signature_cache::set_memory_limit( uint64_t bytes )
+   {
+      uint64_t key_bytes    = my->_initial_size     * detail::signature_cache_impl::key_entry_bytes;
+      uint64_t signer_bytes = my->_initial_trx_size * detail::signature_cache_impl::signer_entry_bytes;
+      double   key_part     = key_bytes + signer_bytes ? double(key_bytes) / (key_bytes + signer_bytes) : 1;
+      set_max_size( size_t( bytes * key_part / detail::signature_cache_impl::key_entry_bytes ),
+                    size_t( bytes * (1 - key_part) / detail::signature_cache_impl::signer_entry_bytes ) );
+   }
+
+   signature_cache_stats signature_cache::get_stats()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      signature_cache_stats stats;
+      stats.signatures     = my->_keys.size();
+      stats.hits           = my->_hits;
+      stats.misses         = my->_misses;
+      stats.transactions   = my->_signers.size();
+      stats.signer_hits    = my->_signer_hits;
+      stats.signer_misses  = my->_signer_misses;
+      return stats;
+   }
+
+   void signature_cache::clear()
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->_keys.clear();
+      my->_order.clear();
+      my->_signers.clear();
+      my->_trx_order.clear();
+   }
+
+} } // bts::blockchain
@@ -1,6 +1,7 @@
 #include <bts/blockchain/address.hpp>
 #include <bts/blockchain/transaction.hpp>
 #include <bts/blockchain/small_hash.hpp>
+#include <bts/blockchain/signature_cache.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/raw.hpp>
 
@@ -21,7 +22,7 @@ namespace bts { namespace blockchain {
        std::unordered_set<address> r;
        for( auto itr = sigs.begin(); itr != sigs.end(); ++itr )
        {
-            r.insert( address(fc::ecc::public_key( *itr, dig )) );
+            r.insert( address( signature_cache::instance().recover( *itr, dig ) ) );
        }
        return r;
    }
@@ -30,41 +31,67 @@ namespace bts { namespace blockchain {
    {
        auto dig = digest(); 
        std::unordered_set<pts_address> r;
-       // add both compressed and uncompressed forms...
+       // add both compressed and uncompressed forms of both versions...
        for( auto itr = sigs.begin(); itr != sigs.end(); ++itr )
        {
-            auto signed_key_data = fc::ecc::public_key( *itr, dig ).serialize();
-            
-            // note: 56 is the version bit of protoshares
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data),false,56) );
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data ),true,56) );
-            // note: 5 comes from en.bitcoin.it/wiki/Vanitygen where version bit is 0
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data ),false,0) );
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data ),true,0) );
+            auto forms = pts_address::all_forms( signature_cache::instance().recover( *itr, dig ) );
+            r.insert( forms.begin(), forms.end() );
        }
-       ilog( "${signed_addr}", ("signed_addr",r) );
        return r;
    }
 
+   /**
+    *  The unsigned transaction is a prefix of the signed transaction, so the
+    *  digest and the id are both computed from one serialization.
+    */
+   const signed_transaction::packed_transaction& signed_transaction::get_cache()const
+   {
+      if( !_cache )
+      {
+         auto c = std::make_shared<packed_transaction>();
+         c->data   = fc::raw::pack( static_cast<const transaction&>(*this) );
+         c->digest = fc::sha256::hash( c->data.data(), c->data.size() );
+
+         fc::datastream<size_t> ss;
+         fc::raw::pack( ss, sigs );
+         size_t unsigned_size = c->data.size();
+         c->data.resize( unsigned_size + ss.tellp() );
+         fc::datastream<char*> ds( c->data.data() + unsigned_size, ss.tellp() );
+         fc::raw::pack( ds, sigs );
+
+         c->id = small_hash( c->data.data(), c->data.size() );
+         _cache = c;
+      }
+      return *_cache;
+   }
+
    transaction_id_type signed_transaction::id()const
    {
-      fc::sha512::encoder enc;
-      fc::raw::pack( enc, *this );
-      return small_hash( enc.result() );
+      return get_cache().id;
+   }
+
+   fc::sha256 signed_transaction::digest()const
+   {
+      return get_cache().digest;
+   }
+
+   const std::vector<char>& signed_transaction::packed()const
+   {
+      return get_cache().data;
    }
 
    void    signed_transaction::sign( const fc::ecc::private_key& k )
    {
     try {
-      sigs.insert( k.sign_compact( digest() ) );  
+      // the inputs and outputs may have changed since the digest was cached
+      sigs.insert( k.sign_compact( transaction::digest() ) );  
+      invalidate_cache();
      } FC_RETHROW_EXCEPTIONS( warn, "error signing transaction", ("trx", *this ) );
    }
 
    size_t signed_transaction::size()const
    {
-      fc::datastream<size_t> ds;
-      fc::raw::pack(ds,*this);
-      return ds.tellp();
+      return packed().size();
    }
 
 } }
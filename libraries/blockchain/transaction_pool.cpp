@@ -0,0 +1,270 @@
+#include <bts/blockchain/transaction_pool.hpp>
+#include <bts/blockchain/flat_hash.hpp>
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+
+namespace bts { namespace blockchain {
+
+   pooled_transaction::pooled_transaction( const signed_transaction& t, int64_t f, uint64_t seq )
+   :trx(t),
+    id(t.id()),
+    packed_hash( fc::ripemd160::hash( t.packed().data(), t.packed().size() ) ),
+    fees(f),
+    size(t.size()),
+    sequence(seq){}
+
+   uint64_t pooled_transaction::fee_rate()const
+   {
+      if( fees <= 0 || size == 0 ) return 0;
+      return (uint64_t(fees) * 1000) / size;
+   }
+
+   namespace detail
+   {
+      /** highest fee rate first, then the earliest arrival */
+      struct higher_fee_rate_first
+      {
+         bool operator()( const pooled_transaction_ptr& a, const pooled_transaction_ptr& b )const
+         {
+            uint64_t a_rate = a->fee_rate();
+            uint64_t b_rate = b->fee_rate();
+            if( a_rate != b_rate ) return a_rate > b_rate;
+            return a->sequence < b->sequence;
+         }
+      };
+
+      class transaction_pool_impl
+      {
+         public:
+            transaction_pool_impl( size_t max_count, size_t max_size )
+            :_max_count(max_count),_max_size(max_size),_size_in_bytes(0),_next_sequence(0),_removal_count(0){}
+
+            /** caller must hold _mutex */
+            void add( const pooled_transaction_ptr& entry )
+            {
+               _by_id[entry->id] = entry;
+               _by_packed_hash[entry->packed_hash] = entry;
+               _by_fee_rate.insert( entry );
+               for( const trx_input& in : entry->trx.inputs )
+                  _spent_outputs[in.output_ref] = entry;
+               _size_in_bytes += entry->size;
+               _fees.add( entry->fee_rate(), entry->size );
+               _snapshot.reset();
+            }
+
+            /** caller must hold _mutex, entry is a copy because it may be the one held by _by_id */
+            void erase( pooled_transaction_ptr entry )
+            {
+               _by_id.erase( entry->id );
+               _by_packed_hash.erase( entry->packed_hash );
+               _by_fee_rate.erase( entry );
+               for( const trx_input& in : entry->trx.inputs )
+               {
+                  auto itr = _spent_outputs.find( in.output_ref );
+                  if( itr != _spent_outputs.end() && itr->second == entry )
+                     _spent_outputs.erase( itr );
+               }
+               _size_in_bytes -= entry->size;
+               _fees.remove( entry->fee_rate(), entry->size );
+               ++_removal_count;
+               _snapshot.reset();
+            }
+
+            /** the pooled transactions that spend an input of trx, caller must hold _mutex */
+            std::vector<pooled_transaction_ptr> find_conflicts( const signed_transaction& trx )const
+            {
+               std::vector<pooled_transaction_ptr> conflicts;
+               for( const trx_input& in : trx.inputs )
+               {
+                  auto itr = _spent_outputs.find( in.output_ref );
+                  if( itr != _spent_outputs.end() &&
+                      std::find( conflicts.begin(), conflicts.end(), itr->second ) == conflicts.end() )
+                     conflicts.push_back( itr->second );
+               }
+               return conflicts;
+            }
+
+            /** caller must hold _mutex */
+            void enforce_limits()
+            {
+               while( !_by_fee_rate.empty() && (_by_id.size() > _max_count || _size_in_bytes > _max_size) )
+                  erase( *_by_fee_rate.rbegin() );
+            }
+
+            size_t                                                            _max_count;
+            size_t                                                            _max_size;
+            size_t                                                            _size_in_bytes;
+            uint64_t                                                          _next_sequence;
+            uint64_t                                                          _removal_count;
+            mutable std::mutex                                                _mutex;
+            flat_hash_map<transaction_id_type,pooled_transaction_ptr>         _by_id;
+            flat_hash_map<fc::ripemd160,pooled_transaction_ptr>               _by_packed_hash;
+            std::set<pooled_transaction_ptr,higher_fee_rate_first>            _by_fee_rate;
+            flat_hash_map<output_reference,pooled_transaction_ptr>            _spent_outputs;
+            fee_histogram                                                     _fees;
+            /** rebuilt by the first snapshot() after a change */
+            mutable transaction_pool_snapshot                                 _snapshot;
+      };
+   }
+
+   transaction_pool::transaction_pool( size_t max_count, size_t max_size )
+   :my( new detail::transaction_pool_impl( max_count, max_size ) )
+   {
+   }
+
+   transaction_pool::~transaction_pool()
+   {
+   }
+
+   bool transaction_pool::insert( const signed_transaction& trx, int64_t fees )
+   {
+      // hashing and packing happen before taking the lock
+      auto entry = std::make_shared<pooled_transaction>( trx, fees, 0 );
+
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      if( my->_by_id.find( entry->id ) != my->_by_id.end() ) return false;
+      if( entry->size > my->_max_size ) return false;
+      entry->sequence = my->_next_sequence++;
+
+      auto conflicts = my->find_conflicts( trx );
+      for( const pooled_transaction_ptr& conflict : conflicts )
+      {
+         if( conflict->fee_rate() >= entry->fee_rate() )
+         {
+            wlog( "transaction ${id} spends an output of pooled transaction ${conflict}, ignoring it",
+                  ("id",entry->id)("conflict",conflict->id) );
+            return false;
+         }
+      }
+
+      // make sure there is room before replacing anything
+      size_t count = my->_by_id.size() - conflicts.size() + 1;
+      size_t bytes = my->_size_in_bytes + entry->size;
+      for( const pooled_transaction_ptr& conflict : conflicts )
+         bytes -= conflict->size;
+      std::vector<pooled_transaction_ptr> evicted;
+      for( auto itr = my->_by_fee_rate.rbegin();
+           itr != my->_by_fee_rate.rend() && (count > my->_max_count || bytes > my->_max_size); ++itr )
+      {
+         if( std::find( conflicts.begin(), conflicts.end(), *itr ) != conflicts.end() ) continue;
+         if( !detail::higher_fee_rate_first()( entry, *itr ) ) return false;
+         evicted.push_back( *itr );
+         --count;
+         bytes -= (*itr)->size;
+      }
+      if( count > my->_max_count || bytes > my->_max_size ) return false;
+
+      for( const pooled_transaction_ptr& conflict : conflicts ) my->erase( conflict );
+      for( const pooled_transaction_ptr& e : evicted )          my->erase( e );
+      my->add( entry );
+      return true;
+   }
+
+   bool transaction_pool::remove( const transaction_id_type& id )
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      auto itr = my->_by_id.find( id );
+      if( itr == my->_by_id.end() ) return false;
+      my->erase( itr->second );
+      return true;
+   }
+
+   void transaction_pool::remove_included( const signed_transactions& trxs )
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      for( const signed_transaction& trx : trxs )
+      {
+         auto itr = my->_by_id.find( trx.id() );
+         if( itr != my->_by_id.end() ) my->erase( itr->second );
+         for( const pooled_transaction_ptr& conflict : my->find_conflicts( trx ) )
+            my->erase( conflict );
+      }
+   }
+
+   void transaction_pool::clear()
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->_removal_count += my->_by_id.size();
+      my->_by_id.clear();
+      my->_by_packed_hash.clear();
+      my->_by_fee_rate.clear();
+      my->_spent_outputs.clear();
+      my->_size_in_bytes = 0;
+      my->_fees.clear();
+      my->_snapshot.reset();
+   }
+
+   bool transaction_pool::contains( const transaction_id_type& id )const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_by_id.find( id ) != my->_by_id.end();
+   }
+
+   pooled_transaction_ptr transaction_pool::find( const transaction_id_type& id )const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      auto itr = my->_by_id.find( id );
+      if( itr == my->_by_id.end() ) return pooled_transaction_ptr();
+      return itr->second;
+   }
+
+   pooled_transaction_ptr transaction_pool::find_by_packed_hash( const fc::ripemd160& packed_hash )const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      auto itr = my->_by_packed_hash.find( packed_hash );
+      if( itr == my->_by_packed_hash.end() ) return pooled_transaction_ptr();
+      return itr->second;
+   }
+
+   pooled_transaction_ptr transaction_pool::find_spender( const output_reference& ref )const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      auto itr = my->_spent_outputs.find( ref );
+      if( itr == my->_spent_outputs.end() ) return pooled_transaction_ptr();
+      return itr->second;
+   }
+
+   transaction_pool_snapshot transaction_pool::snapshot()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      if( !my->_snapshot )
+         my->_snapshot = std::make_shared<pooled_transactions>( my->_by_fee_rate.begin(), my->_by_fee_rate.end() );
+      return my->_snapshot;
+   }
+
+   size_t transaction_pool::size()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_by_id.size();
+   }
+
+   size_t transaction_pool::size_in_bytes()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_size_in_bytes;
+   }
+
+   fee_histogram transaction_pool::fee_distribution()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_fees;
+   }
+
+   uint64_t transaction_pool::removal_count()const
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      return my->_removal_count;
+   }
+
+   void transaction_pool::set_limits( size_t max_count, size_t max_size )
+   {
+      std::unique_lock<std::mutex> lock( my->_mutex );
+      my->_max_count = max_count;
+      my->_max_size  = max_size;
+      my->enforce_limits();
+   }
+
+} } // bts::blockchain
@@ -1,10 +1,14 @@
 #include <bts/blockchain/transaction_validator.hpp>
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/signature_cache.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/raw.hpp>
 
 #include <fc/log/logger.hpp>
 
+#include <algorithm>
+#include <typeinfo>
+
 namespace bts { namespace blockchain {
    transaction_summary::transaction_summary()
    :valid_votes(0),invalid_votes(0),spent(0),fees(0)
@@ -18,94 +22,122 @@ namespace bts { namespace blockchain {
       fees          += a.fees;
       return *this;
    }
-   transaction_evaluation_state::transaction_evaluation_state( const signed_transaction& t )
-   :trx(t),valid_votes(0),invalid_votes(0),spent(0)
+   block_evaluation_state::block_evaluation_state()
+   :_name_outputs( 0, std::hash<std::string>(), std::equal_to<std::string>(), arena_allocator<int>( &_arena ) ),
+    _input_votes( 0, std::hash<int32_t>(), std::equal_to<int32_t>(), arena_allocator<int>( &_arena ) ),
+    _output_votes( 0, std::hash<int32_t>(), std::equal_to<int32_t>(), arena_allocator<int>( &_arena ) )
+   {
+   }
+
+   transaction_evaluation_state::transaction_evaluation_state( const signed_transaction& t, evaluation_arena* arena )
+   :name_inputs( arena_allocator<claim_name_output>( arena ) ),trx(t),valid_votes(0),invalid_votes(0),spent(0),
+    total( arena_allocator<asset_io>( arena ) ),used_outputs( arena_allocator<uint32_t>( arena ) )
    {
-        sigs     = trx.get_signed_addresses();
-        pts_sigs = trx.get_signed_pts_addresses();
+        signers       = signature_cache::instance().get_signers( trx );
+        unique_inputs = signers->unique_inputs;
    }
 
    bool transaction_evaluation_state::has_signature( const address& a )const
    {
-        return sigs.find( a ) != sigs.end();
+        return signers->addresses.find( a ) != signers->addresses.end();
    }
 
    bool transaction_evaluation_state::has_signature( const pts_address& a )const
    {
+        const auto& pts_sigs = signers->pts_addresses();
         return pts_sigs.find( a ) != pts_sigs.end();
    }
 
+   const transaction_evaluation_state::asset_io* transaction_evaluation_state::find_total( asset_type t )const
+   {
+       for( const asset_io& io : total )
+          if( io.unit == t ) return &io;
+       return nullptr;
+   }
+
+   transaction_evaluation_state::asset_io& transaction_evaluation_state::get_total( asset_type t )
+   {
+       for( asset_io& io : total )
+          if( io.unit == t ) return io;
+       total.push_back( asset_io( t ) );
+       return total.back();
+   }
+
    int64_t transaction_evaluation_state::get_total_in( asset_type t )const
    {
-       auto itr = total.find( t );
-       if( itr == total.end() ) return 0;
-       return itr->second.in;
+       auto io = find_total( t );
+       return io ? io->in : 0;
    }
 
    int64_t transaction_evaluation_state::get_total_out( asset_type t )const
    {
-       auto itr = total.find( t );
-       if( itr == total.end() ) return 0;
-       return itr->second.out;
+       auto io = find_total( t );
+       return io ? io->out : 0;
    }
 
    int64_t transaction_evaluation_state::get_required_fees( asset_type t )const
    {
-       auto itr = total.find( t );
-       if( itr == total.end() ) return 0;
-       return itr->second.required_fees;
+       auto io = find_total( t );
+       return io ? io->required_fees : 0;
+   }
+
+   arena_vector<claim_name_output>::const_iterator transaction_evaluation_state::find_name_input( const std::string& name )const
+   {
+       return std::find_if( name_inputs.begin(), name_inputs.end(),
+                            [&]( const claim_name_output& o ) { return o.name == name; } );
    }
+
    void transaction_evaluation_state::add_name_input( const claim_name_output& o )
    {
        FC_ASSERT( claim_name_output::is_valid_name( o.name ) );
-       FC_ASSERT( name_inputs.find( o.name ) == name_inputs.end() );
-       name_inputs[o.name] = o;
+       FC_ASSERT( find_name_input( o.name ) == name_inputs.end() );
+       name_inputs.push_back( o );
    }
    void block_evaluation_state::add_input_delegate_votes( int32_t did, const asset& votes )
    {
-      auto itr = _input_votes.find(did);
-      if( itr == _input_votes.end() )
-         _input_votes[did] = votes.get_rounded_amount();
-      else
-         itr->second += votes.get_rounded_amount();
+      _input_votes[did] += votes.get_rounded_amount();
    }
    void block_evaluation_state::add_output_delegate_votes( int32_t did, const asset& votes )
    {
-      auto itr = _output_votes.find(did);
-      if( itr == _output_votes.end() )
-         _output_votes[did] = votes.get_rounded_amount();
-      else
-         itr->second += votes.get_rounded_amount();
+      _output_votes[did] += votes.get_rounded_amount();
+   }
+
+   bool block_evaluation_state::merge( const block_evaluation_state& later )
+   {
+      for( const auto& name : later._name_outputs )
+      {
+         if( !_name_outputs.insert( name ).second )
+            return false;
+      }
+      for( const auto& votes : later._input_votes )
+         _input_votes[votes.first] += votes.second;
+      for( const auto& votes : later._output_votes )
+         _output_votes[votes.first] += votes.second;
+      return true;
    }
 
    void transaction_evaluation_state::add_input_asset( asset a )
    {
-       auto itr = total.find( a.unit );
-       if( itr == total.end() ) total[a.unit].in = a.get_rounded_amount();
-       else itr->second.in += a.get_rounded_amount();
+       get_total( a.unit ).in += a.get_rounded_amount();
    }
 
    void transaction_evaluation_state::add_output_asset( asset a )
    {
-       auto itr = total.find( a.unit );
-       if( itr == total.end() ) total[a.unit].out = a.get_rounded_amount();
-       else itr->second.out += a.get_rounded_amount();
+       get_total( a.unit ).out += a.get_rounded_amount();
    }
    void transaction_evaluation_state::add_required_fees( asset a )
    {
-       auto itr = total.find( a.unit );
-       if( itr == total.end() ) total[a.unit].required_fees = a.get_rounded_amount();
-       else itr->second.required_fees += a.get_rounded_amount();
+       get_total( a.unit ).required_fees += a.get_rounded_amount();
    }
 
    bool transaction_evaluation_state::is_output_used( uint32_t out )const
    {
-       return used_outputs.find(out) != used_outputs.end();
+       return std::find( used_outputs.begin(), used_outputs.end(), out ) != used_outputs.end();
    }
 
    void transaction_evaluation_state::mark_output_as_used( uint32_t out )
    {
-       used_outputs.insert(out);
+       if( !is_output_used( out ) ) used_outputs.push_back( out );
    }
 
    transaction_evaluation_state::~transaction_evaluation_state(){}
@@ -121,10 +153,16 @@ namespace bts { namespace blockchain {
       return std::make_shared<block_evaluation_state>();
    }
 
+   /** derived validators may keep state of their own, they have to opt in themselves */
+   bool transaction_validator::supports_parallel_evaluation()const
+   {
+      return typeid(*this) == typeid(transaction_validator);
+   }
+
    transaction_summary transaction_validator::evaluate( const signed_transaction& trx, 
                                                         const block_evaluation_state_ptr& block_state )
    {
-       transaction_evaluation_state state(trx);
+       transaction_evaluation_state state( trx, block_state ? block_state->arena() : nullptr );
        return on_evaluate( state, block_state );
    }
 
@@ -138,23 +176,19 @@ namespace bts { namespace blockchain {
        FC_ASSERT( !!trx_delegate, "unable to find delegate id ${id}", ("id",state.trx.vote) );
 
        /** make sure inputs are unique */
-       std::unordered_set<output_reference> unique_inputs;
-       for( auto in : state.trx.inputs )
-       {
-          FC_ASSERT( unique_inputs.insert( in.output_ref ).second, 
-              "transaction references same output more than once.", ("trx",state.trx) )
-       }
+       FC_ASSERT( state.unique_inputs, 
+           "transaction references same output more than once.", ("trx",state.trx) )
 
        /** validate all inputs */
-       for( auto in : state.inputs ) 
+       for( const meta_trx_input& in : state.inputs ) 
        {
           FC_ASSERT( !in.meta_output.is_spent(), "", ("trx",state.trx) );
           validate_input( in, state, block_state );
        }
 
 
-       /** validate all inputs */
-       for( auto out : state.trx.outputs ) 
+       /** validate all outputs */
+       for( const trx_output& out : state.trx.outputs ) 
           validate_output( out, state, block_state );
 
        state.balance_assets();
@@ -173,11 +207,11 @@ namespace bts { namespace blockchain {
 
    void transaction_evaluation_state::balance_assets()const
    {
-      for( auto itr = total.begin(); itr != total.end(); ++itr )
+      for( const asset_io& io : total )
       {
-         if( itr->first != 0 )
+         if( io.unit != 0 )
          {
-            FC_ASSERT( itr->second.out == itr->second.in );
+            FC_ASSERT( io.out == io.in );
          }
       }
    }
@@ -201,7 +235,7 @@ namespace bts { namespace blockchain {
           default:
              FC_ASSERT( !"Unsupported claim type", "type: ${type}", ("type",in.output.claim_func) );
        }
-   } FC_RETHROW_EXCEPTIONS( warn, "", ("in",in)("state",state) ) }
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("in",in)("trx",state.trx)("state",state) ) }
 
    void transaction_validator::validate_output( const trx_output& out, transaction_evaluation_state& state,
                                                const block_evaluation_state_ptr& block_state )
@@ -243,7 +277,7 @@ namespace bts { namespace blockchain {
                                                              transaction_evaluation_state& state,
                                                              const block_evaluation_state_ptr& block_state )
    {
-       auto claim = in.output.as<claim_by_pts_output>(); 
+       auto claim = in.output.as<claim_by_pts_output>();
        FC_ASSERT( state.has_signature( claim.owner ), "", ("owner",claim.owner) );
        state.add_input_asset( in.output.amount );
 
@@ -259,8 +293,8 @@ namespace bts { namespace blockchain {
                                                          transaction_evaluation_state& state,
                                                          const block_evaluation_state_ptr& block_state )
    {
-       auto claim = in.output.as<claim_by_signature_output>(); 
-       FC_ASSERT( state.has_signature( claim.owner ), "", ("owner",claim.owner)("sigs",state.sigs) );
+       auto claim = in.output.as<claim_by_signature_output>();
+       FC_ASSERT( state.has_signature( claim.owner ), "", ("owner",claim.owner)("sigs",state.signers->addresses) );
        state.add_input_asset( in.output.amount );
 
        if( in.output.amount.unit == 0 )
@@ -275,8 +309,8 @@ namespace bts { namespace blockchain {
                                                          transaction_evaluation_state& state,
                                                          const block_evaluation_state_ptr& block_state )
    {
-       auto claim = in.output.as<claim_name_output>(); 
-       FC_ASSERT( state.has_signature( address(claim.owner) ), "", ("owner",claim.owner)("sigs",state.sigs) );
+       auto claim = in.output.as<claim_name_output>();
+       FC_ASSERT( state.has_signature( address(claim.owner) ), "", ("owner",claim.owner)("sigs",state.signers->addresses) );
        state.add_name_input( claim );
        state.add_input_asset( in.output.amount );
 
@@ -307,7 +341,7 @@ namespace bts { namespace blockchain {
                                                      transaction_evaluation_state& state,
                                                      const block_evaluation_state_ptr& block_state )
    {
-       auto claim = out.as<claim_name_output>(); 
+       auto claim = out.as<claim_name_output>();
        block_state->add_name_output( claim );
        if( !state.has_name_input( claim ) )
        {
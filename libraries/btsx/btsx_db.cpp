@@ -1,5 +1,23 @@
 #include <bts/btsx/btsx_db.hpp>
 #include <bts/btsx/btsx_transaction_validator.hpp>
+#include <bts/db/level_map.hpp>
+#include <fc/reflect/variant.hpp>
+
+namespace bts { namespace btsx {
+
+   namespace detail
+   {
+      /** the orders a block added to and removed from the book, kept to undo it */
+      struct market_block_delta
+      {
+         std::vector<output_reference>  added;
+         std::vector<market_order>      removed;
+      };
+   }
+
+} } // bts::btsx
+
+FC_REFLECT( bts::btsx::detail::market_block_delta, (added)(removed) )
 
 namespace bts { namespace btsx {
 
@@ -8,7 +26,147 @@ namespace bts { namespace btsx {
       class btsx_db_impl
       {
          public:
+            order_book                                              _book;
+            /** the book on disk, written with every block */
+            bts::db::level_map<output_reference,market_order>       _orders;
+            /** by block number, the last one is the block the book on disk is at */
+            bts::db::level_map<uint32_t,market_block_delta>         _deltas;
+
+            void load_book()
+            {
+               _book.clear();
+               for( auto itr = _orders.begin(); itr.valid(); ++itr )
+                  _book.insert( itr.value() );
+            }
+
+            void apply( const signed_transaction& trx, market_block_delta& delta )
+            {
+               market_order removed;
+               for( const trx_input& in : trx.inputs )
+               {
+                  if( _book.remove( in.output_ref, &removed ) )
+                  {
+                     _orders.remove( in.output_ref );
+                     delta.removed.push_back( removed );
+                  }
+               }
+
+               auto trx_id = trx.id();
+               for( uint32_t i = 0; i < trx.outputs.size(); ++i )
+               {
+                  auto order = to_market_order( trx.outputs[i], output_reference( trx_id, i ) );
+                  if( !order ) continue;
+                  _book.insert( *order );
+                  _orders.store( order->ref, *order );
+                  delta.added.push_back( order->ref );
+               }
+            }
 
+            void apply_block( const trx_block& blk, const signed_transactions& deterministic_trxs )
+            {
+               market_block_delta delta;
+               _orders.begin_batch();
+               _deltas.begin_batch();
+               try {
+                  for( const signed_transaction& trx : blk.trxs )           apply( trx, delta );
+                  for( const signed_transaction& trx : deterministic_trxs ) apply( trx, delta );
+                  _deltas.store( blk.block_num, delta );
+                  _orders.commit_batch();
+                  _deltas.commit_batch();
+               }
+               catch ( ... )
+               {
+                  _orders.abort_batch();
+                  _deltas.abort_batch();
+                  load_book();
+                  throw;
+               }
+            }
+
+            /** reverts the book and stages the writes in batches for commit_revert() or abort_revert() */
+            void stage_revert( uint32_t block_num )
+            {
+               _orders.begin_batch();
+               _deltas.begin_batch();
+               try {
+                  auto itr = _deltas.find( block_num );
+                  if( !itr.valid() ) return;
+                  auto delta = itr.value();
+
+                  for( auto ref = delta.added.rbegin(); ref != delta.added.rend(); ++ref )
+                  {
+                     _book.remove( *ref );
+                     _orders.remove( *ref );
+                  }
+                  for( const market_order& order : delta.removed )
+                  {
+                     _book.insert( order );
+                     _orders.store( order.ref, order );
+                  }
+                  _deltas.remove( block_num );
+               }
+               catch ( ... )
+               {
+                  abort_revert();
+                  throw;
+               }
+            }
+
+            void commit_revert()
+            {
+               try {
+                  _orders.commit_batch();
+                  _deltas.commit_batch();
+               }
+               catch ( ... )
+               {
+                  abort_revert();
+                  throw;
+               }
+            }
+
+            void abort_revert()
+            {
+               _orders.abort_batch();
+               _deltas.abort_batch();
+               load_book();
+            }
+
+            void revert_block( uint32_t block_num )
+            {
+               stage_revert( block_num );
+               commit_revert();
+            }
+
+            /** an order that cannot buy a single unit at its price is paid back to its owner */
+            static void add_remainder( signed_transaction& trx, const market_order& order, const asset& rest )
+            {
+               if( rest.amount == 0 ) return;
+               if( (rest * order.order_price).amount > 0 )
+                  trx.outputs.push_back( trx_output( claim_by_bid_output( order.owner, order.order_price ), rest ) );
+               else
+                  trx.outputs.push_back( trx_output( claim_by_signature_output( order.owner ), rest ) );
+            }
+
+            static bool match( const market_order& bid, const market_order& ask, signed_transaction& trx )
+            {
+               const price& p = ask.order_price;
+
+               asset base_fill = bid.amount * p;
+               if( base_fill.amount > ask.amount.amount ) base_fill.amount = ask.amount.amount;
+               if( base_fill.amount == 0 ) return false;
+
+               asset quote_paid = base_fill * p;
+               if( quote_paid.amount == 0 ) return false;
+
+               trx.inputs.push_back( trx_input( bid.ref ) );
+               trx.inputs.push_back( trx_input( ask.ref ) );
+               trx.outputs.push_back( trx_output( claim_by_signature_output( bid.owner ), base_fill ) );
+               trx.outputs.push_back( trx_output( claim_by_signature_output( ask.owner ), quote_paid ) );
+               add_remainder( trx, ask, ask.amount - base_fill );
+               add_remainder( trx, bid, bid.amount - quote_paid );
+               return true;
+            }
       };
 
    } // namespace detail
@@ -23,14 +181,113 @@ namespace bts { namespace btsx {
    {
    }
 
-   void  btsx_db::open( const fc::path& dir, bool create )
+   void  btsx_db::open( const fc::path& dir, bool create, const chain_database_tuning& tuning )
    { try {
-       chain_database::open( dir, create );
+       chain_database::open( dir, create, tuning );
+       my->_orders.open( dir / "market_orders", create, tuning.records );
+       my->_deltas.open( dir / "market_deltas", create, tuning.records );
+       my->load_book();
+
+       // store() writes the chain before the book, so the book is at most behind it
+       uint32_t book_head = trx_num::invalid_block_num;
+       my->_deltas.last( book_head );
+       auto head = head_block_num();
+       while( book_head != trx_num::invalid_block_num && (head == trx_num::invalid_block_num || book_head > head) )
+       {
+          my->revert_block( book_head );
+          book_head = book_head == 0 ? trx_num::invalid_block_num : book_head - 1;
+       }
+       if( head == trx_num::invalid_block_num ) return;
+
+       uint32_t next = book_head == trx_num::invalid_block_num ? 0 : book_head + 1;
+       if( next <= head )
+          ilog( "replaying blocks ${first} to ${last} into the order book", ("first",next)("last",head) );
+       for( ; next <= head; ++next )
+       {
+          auto blk = fetch_trx_block( next );
+
+          signed_transactions deterministic_trxs;
+          for( uint32_t idx = blk.trxs.size(); ; ++idx )
+          {
+             meta_trx trx;
+             try { fetch_trx( trx_num( next, idx ), trx ); }
+             catch ( const fc::exception& ) { break; }
+             deterministic_trxs.push_back( trx );
+          }
+          my->apply_block( blk, deterministic_trxs );
+       }
    } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
    void  btsx_db::close()
    {
+       my->_deltas.close();
+       my->_orders.close();
+       my->_book.clear();
        chain_database::close();
    }
 
+   const order_book& btsx_db::get_order_book()const
+   {
+       return my->_book;
+   }
+
+   const market_order* btsx_db::get_best_bid( uint16_t asset_pair )const
+   {
+       return my->_book.best( asset_pair, bid_order );
+   }
+
+   const market_order* btsx_db::get_best_ask( uint16_t asset_pair )const
+   {
+       return my->_book.best( asset_pair, ask_order );
+   }
+
+   signed_transactions btsx_db::generate_deterministic_transactions()
+   {
+       auto trxs = chain_database::generate_deterministic_transactions();
+
+       for( uint16_t pair : my->_book.get_asset_pairs() )
+       {
+          auto bid = my->_book.best( pair, bid_order );
+          auto ask = my->_book.best( pair, ask_order );
+          if( !bid || !ask || bid->order_price.ratio < ask->order_price.ratio ) continue;
+
+          signed_transaction trx;
+          try {
+             if( !detail::btsx_db_impl::match( *bid, *ask, trx ) ) continue;
+          }
+          catch ( const fc::exception& e )
+          {
+             wlog( "unable to match ${bid} with ${ask}: ${e}", ("bid",*bid)("ask",*ask)("e",e.to_detail_string()) );
+             continue;
+          }
+          trxs.push_back( trx );
+       }
+       return trxs;
+   }
+
+   void btsx_db::store( const trx_block& blk, const signed_transactions& deterministic_trxs,
+                        const block_evaluation_state_ptr& state )
+   {
+       chain_database::store( blk, deterministic_trxs, state );
+       my->apply_block( blk, deterministic_trxs );
+   }
+
+   void btsx_db::undo( const trx_block& blk )
+   {
+       my->stage_revert( blk.block_num );
+       chain_database::undo( blk );
+   }
+
+   void btsx_db::commit_undo()
+   {
+       my->commit_revert();
+       chain_database::commit_undo();
+   }
+
+   void btsx_db::abort_undo()
+   {
+       my->abort_revert();
+       chain_database::abort_undo();
+   }
+
 } } // bts::btsx
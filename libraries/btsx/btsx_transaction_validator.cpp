@@ -7,17 +7,19 @@
 namespace bts { namespace btsx {
 
    btsx_transaction_validator::btsx_transaction_validator( btsx_db* db )
-   :transaction_validator(db)
+   :transaction_validator(db),_btsx_db(db)
    {
    }
 
-    transaction_summary btsx_transaction_validator::evaluate( const signed_transaction& trx )
+    transaction_summary btsx_transaction_validator::evaluate( const signed_transaction& trx,
+                                                              const block_evaluation_state_ptr& block_state )
     { try {
-       btsx_evaluation_state state(trx);
-       return on_evaluate( state );
+       btsx_evaluation_state state( trx, block_state ? block_state->arena() : nullptr );
+       return on_evaluate( state, block_state );
     } FC_RETHROW_EXCEPTIONS( warn, "", ("trx",trx) ) }
 
-    void btsx_transaction_validator::validate_input( const meta_trx_input& in, transaction_evaluation_state& state )
+    void btsx_transaction_validator::validate_input( const meta_trx_input& in, transaction_evaluation_state& state,
+                                                     const block_evaluation_state_ptr& block_state )
     { try {
          switch( in.output.claim_func )
          {
@@ -33,11 +35,12 @@ namespace bts { namespace btsx {
             case claim_by_cover_bid:
                // TODO: implement this
             default:
-               transaction_validator::validate_input( in, state );
+               transaction_validator::validate_input( in, state, block_state );
          }
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
-    void btsx_transaction_validator::validate_output( const trx_output& out, transaction_evaluation_state& state )
+    void btsx_transaction_validator::validate_output( const trx_output& out, transaction_evaluation_state& state,
+                                                      const block_evaluation_state_ptr& block_state )
     { try {
          switch( out.claim_func )
          {
@@ -51,38 +54,56 @@ namespace bts { namespace btsx {
                validate_cover_output( out, state );            
                break;
             default:
-               transaction_validator::validate_output( out, state );
+               transaction_validator::validate_output( out, state, block_state );
          }
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
     void btsx_transaction_validator::validate_bid_output( const trx_output& out, transaction_evaluation_state& state )
     { try {
-
+       auto claim = out.as<claim_by_bid_output>();
+       FC_ASSERT( claim.is_bid( out.amount.unit ) || claim.is_ask( out.amount.unit ) );
+       // an order that cannot buy a single unit would never leave the book
+       FC_ASSERT( (out.amount * claim.ask_price).amount > 0, "order is too small to trade" );
+       state.add_output_asset( out.amount );
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
     void btsx_transaction_validator::validate_bid_input( const meta_trx_input& in, transaction_evaluation_state& state )
     { try {
-
+       auto claim = in.output.as<claim_by_bid_output>();
+       // cancelled by the owner or filled by the market
+       FC_ASSERT( state.has_signature( claim.pay_address ) || _db->is_evaluating_deterministic_transactions() );
+       state.add_input_asset( in.output.amount );
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
    
     void btsx_transaction_validator::validate_long_output( const trx_output& out, transaction_evaluation_state& state )
     { try {
-
+       auto claim = out.as<claim_by_long_output>();
+       FC_ASSERT( out.amount.unit == 0 && claim.ask_price.base_unit == 0 );
+       FC_ASSERT( (out.amount * claim.ask_price).amount > 0, "order is too small to trade" );
+       state.add_output_asset( out.amount );
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
     void btsx_transaction_validator::validate_long_input( const meta_trx_input& in, transaction_evaluation_state& state )
     { try {
-
+       auto claim = in.output.as<claim_by_long_output>();
+       FC_ASSERT( state.has_signature( claim.pay_address ) || _db->is_evaluating_deterministic_transactions() );
+       state.add_input_asset( in.output.amount );
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
    
     void btsx_transaction_validator::validate_cover_output( const trx_output& out, transaction_evaluation_state& state )
     { try {
-
+       auto claim = out.as<claim_by_cover_output>();
+       FC_ASSERT( out.amount.unit == 0 && claim.payoff.amount > 0 );
+       state.add_output_asset( out.amount );
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
     void btsx_transaction_validator::validate_cover_input( const meta_trx_input& in, transaction_evaluation_state& state )
     { try {
-
+       auto claim = in.output.as<claim_by_cover_output>();
+       FC_ASSERT( state.has_signature( claim.owner ) );
+       state.add_input_asset( in.output.amount );
+       // the payoff is a negative input, the transaction must destroy it
+       state.add_output_asset( claim.payoff );
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
 } } // bts::btsx
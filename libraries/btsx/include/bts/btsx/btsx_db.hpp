@@ -1,20 +1,52 @@
 #pragma once
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/btsx/order_book.hpp>
 
 namespace bts { namespace btsx {
    using namespace bts::blockchain;
 
    namespace detail { class btsx_db_impl; }
 
+   /**
+    *  Keeps an order_book of the unspent market outputs up to date as blocks are stored
+    *  and popped.  The book is also written to disk with every block so that opening the
+    *  database only replays the blocks stored since it was last written.
+    */
    class btsx_db : public chain_database
    {
        public:
           btsx_db();
           ~btsx_db();
-    
-          void  open( const fc::path& dir, bool create );
+
+          void  open( const fc::path& dir, bool create,
+                      const chain_database_tuning& tuning = chain_database_tuning() );
           void  close();
-    
+
+          const order_book&  get_order_book()const;
+
+          /** @return the highest bid of asset_pair, or nullptr if there is none */
+          const market_order*  get_best_bid( uint16_t asset_pair )const;
+          /** @return the lowest ask of asset_pair, or nullptr if there is none */
+          const market_order*  get_best_ask( uint16_t asset_pair )const;
+
+          /**
+           *  Matches the best bid and ask of every pair whose prices cross, one trade per pair
+           *  and block.  The ask is filled at its own price, a remainder of either order that
+           *  can still buy one unit stays in the book as a new order.
+           *
+           *  A block that also spends a matched order is invalid.  The matches spend the orders
+           *  without the signatures of their owners, which the validator accepts only while the
+           *  chain evaluates its deterministic transactions.
+           */
+          virtual signed_transactions generate_deterministic_transactions();
+
+       protected:
+          virtual void store( const trx_block& blk, const signed_transactions& deterministic_trxs,
+                              const block_evaluation_state_ptr& state );
+          virtual void undo( const trx_block& blk );
+          virtual void commit_undo();
+          virtual void abort_undo();
+
        private:
           std::unique_ptr<detail::btsx_db_impl> my;
    };
@@ -8,8 +8,8 @@ namespace bts { namespace btsx {
    class btsx_evaluation_state : public transaction_evaluation_state
    {
         public:
-           btsx_evaluation_state( const signed_transaction& trx )
-           :transaction_evaluation_state( trx ){}
+           btsx_evaluation_state( const signed_transaction& trx, evaluation_arena* arena = nullptr )
+           :transaction_evaluation_state( trx, arena ){}
    };
 
    class btsx_transaction_validator : public bts::blockchain::transaction_validator
@@ -17,10 +17,13 @@ namespace bts { namespace btsx {
        public:
           btsx_transaction_validator( btsx_db* db );
 
-          virtual transaction_summary evaluate( const signed_transaction& trx );
+          virtual transaction_summary evaluate( const signed_transaction& trx,
+                                                const block_evaluation_state_ptr& block_state );
 
-          virtual void validate_input( const meta_trx_input& in, transaction_evaluation_state& state );
-          virtual void validate_output( const trx_output& out, transaction_evaluation_state& state );
+          virtual void validate_input( const meta_trx_input& in, transaction_evaluation_state& state,
+                                       const block_evaluation_state_ptr& block_state );
+          virtual void validate_output( const trx_output& out, transaction_evaluation_state& state,
+                                        const block_evaluation_state_ptr& block_state );
 
           virtual void validate_bid_output( const trx_output& out, transaction_evaluation_state& state );
           virtual void validate_bid_input( const meta_trx_input& in, transaction_evaluation_state& state );
@@ -30,6 +33,9 @@ namespace bts { namespace btsx {
 
           virtual void validate_cover_output( const trx_output& out, transaction_evaluation_state& state );
           virtual void validate_cover_input( const meta_trx_input& in, transaction_evaluation_state& state );
+
+       private:
+          btsx_db* _btsx_db;
    };
 
 } } // bts::btsx
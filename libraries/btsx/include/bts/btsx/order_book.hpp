@@ -0,0 +1,86 @@
+#pragma once
+#include <bts/btsx/outputs.hpp>
+#include <bts/blockchain/transaction.hpp>
+#include <fc/optional.hpp>
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace bts { namespace btsx {
+   using namespace bts::blockchain;
+
+   enum order_kind_enum
+   {
+      bid_order   = 0, ///< a claim_by_bid output offering the quote unit, the highest price is best
+      ask_order   = 1, ///< a claim_by_bid output offering the base unit, the lowest price is best
+      long_order  = 2, ///< a claim_by_long output that shorts are matched against, the highest price is best
+      cover_order = 3  ///< a claim_by_cover position at its call price, the highest is called first
+   };
+
+   /** an unspent market output as kept by the order_book */
+   struct market_order
+   {
+      market_order():kind(bid_order){}
+
+      uint16_t asset_pair()const { return order_price.asset_pair(); }
+
+      fc::enum_type<uint8_t,order_kind_enum>  kind;
+      price                                   order_price; ///< the ask price, or the call price of a cover
+      output_reference                        ref;
+      asset                                   amount;      ///< of the output
+      address                                 owner;       ///< the pay_address or owner of the output
+   };
+
+   /** @return the order of out if it is a market output */
+   fc::optional<market_order> to_market_order( const trx_output& out, const output_reference& ref );
+
+   /**
+    *  @class order_book
+    *
+    *  The unspent market orders of every asset pair.  Each book of a pair and kind is a
+    *  vector of (price, ref) sorted so that the best order is at the back, which makes
+    *  the best price a read of the last entry and filling it a pop_back.  Orders are
+    *  found by ref through a hash map, so removing one is a binary search of its book.
+    */
+   class order_book
+   {
+      public:
+         void                       insert( const market_order& order );
+         /** @return false if ref is not an order */
+         bool                       remove( const output_reference& ref, market_order* removed = nullptr );
+         const market_order*        find( const output_reference& ref )const;
+
+         /** @return nullptr if the book of asset_pair and kind is empty */
+         const market_order*        best( uint16_t asset_pair, order_kind_enum kind )const;
+         /** @return up to limit orders, best first */
+         std::vector<market_order>  get_orders( uint16_t asset_pair, order_kind_enum kind, uint32_t limit = -1 )const;
+         /** @return up to limit covers of p.asset_pair() with a call price of p or above, highest first */
+         std::vector<market_order>  get_margin_calls( const price& p, uint32_t limit = -1 )const;
+         /** @return the pairs with at least one order, in order */
+         std::vector<uint16_t>      get_asset_pairs()const;
+
+         size_t                     size()const { return _orders.size(); }
+         void                       clear();
+
+      private:
+         struct entry
+         {
+            fc::uint128_t     ratio;
+            output_reference  ref;
+         };
+         typedef std::vector<entry> book_type;
+
+         static uint32_t   book_id( uint16_t asset_pair, order_kind_enum kind ) { return (uint32_t(asset_pair) << 8) | kind; }
+         /** true if a sorts before b in a book of kind, the best order sorts last */
+         static bool       sorts_before( const entry& a, const entry& b, order_kind_enum kind );
+         book_type::iterator  locate( book_type& book, const entry& e, order_kind_enum kind );
+
+         std::unordered_map<output_reference,market_order>  _orders;
+         std::map<uint32_t,book_type>                        _books;
+   };
+
+} } // bts::btsx
+
+FC_REFLECT_ENUM( bts::btsx::order_kind_enum, (bid_order)(ask_order)(long_order)(cover_order) )
+FC_REFLECT( bts::btsx::market_order, (kind)(order_price)(ref)(amount)(owner) )
@@ -40,8 +40,8 @@ namespace bts { namespace btsx {
       claim_by_bid_output( const address& pay_addr, const price& ask )
       :pay_address(pay_addr),ask_price(ask){}
 
-      bool is_bid(asset::type out_unit)const;
-      bool is_ask(asset::type out_unit)const;
+      bool is_bid(asset::unit_type out_unit)const;
+      bool is_ask(asset::unit_type out_unit)const;
 
       address  pay_address; // where to send ask_unit (or cancel sig)
       price    ask_price;   // price base per unit
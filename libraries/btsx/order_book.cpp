@@ -0,0 +1,150 @@
+#include <bts/btsx/order_book.hpp>
+
+#include <algorithm>
+
+namespace bts { namespace btsx {
+
+   fc::optional<market_order> to_market_order( const trx_output& out, const output_reference& ref )
+   {
+      market_order order;
+      order.ref    = ref;
+      order.amount = out.amount;
+      switch( out.claim_func )
+      {
+         case claim_by_bid:
+         {
+            auto claim = out.as<claim_by_bid_output>();
+            order.kind        = claim.is_ask( out.amount.unit ) ? ask_order : bid_order;
+            order.order_price = claim.ask_price;
+            order.owner       = claim.pay_address;
+            return order;
+         }
+         case claim_by_long:
+         {
+            auto claim = out.as<claim_by_long_output>();
+            order.kind        = long_order;
+            order.order_price = claim.ask_price;
+            order.owner       = claim.pay_address;
+            return order;
+         }
+         case claim_by_cover:
+         {
+            auto claim = out.as<claim_by_cover_output>();
+            order.kind        = cover_order;
+            order.order_price = claim.get_call_price( out.amount );
+            order.owner       = claim.owner;
+            return order;
+         }
+         default:
+            return fc::optional<market_order>();
+      }
+   }
+
+   bool order_book::sorts_before( const entry& a, const entry& b, order_kind_enum kind )
+   {
+      // the lowest ask is best so asks sort descending
+      if( kind == ask_order )
+         return a.ratio != b.ratio ? b.ratio < a.ratio : b.ref < a.ref;
+      return a.ratio != b.ratio ? a.ratio < b.ratio : a.ref < b.ref;
+   }
+
+   order_book::book_type::iterator order_book::locate( book_type& book, const entry& e, order_kind_enum kind )
+   {
+      return std::lower_bound( book.begin(), book.end(), e,
+                               [kind]( const entry& a, const entry& b ) { return sorts_before( a, b, kind ); } );
+   }
+
+   void order_book::insert( const market_order& order )
+   {
+      if( !_orders.insert( std::make_pair( order.ref, order ) ).second ) return;
+
+      order_kind_enum kind = order.kind;
+      entry e;
+      e.ratio = order.order_price.ratio;
+      e.ref   = order.ref;
+
+      auto& book = _books[book_id( order.asset_pair(), kind )];
+      book.insert( locate( book, e, kind ), e );
+   }
+
+   bool order_book::remove( const output_reference& ref, market_order* removed )
+   {
+      auto itr = _orders.find( ref );
+      if( itr == _orders.end() ) return false;
+
+      const market_order& order = itr->second;
+      order_kind_enum kind = order.kind;
+      entry e;
+      e.ratio = order.order_price.ratio;
+      e.ref   = ref;
+
+      auto book_itr = _books.find( book_id( order.asset_pair(), kind ) );
+      if( book_itr != _books.end() )
+      {
+         auto& book = book_itr->second;
+         auto pos = locate( book, e, kind );
+         if( pos != book.end() && pos->ref == ref ) book.erase( pos );
+         if( book.empty() ) _books.erase( book_itr );
+      }
+
+      if( removed ) *removed = order;
+      _orders.erase( itr );
+      return true;
+   }
+
+   const market_order* order_book::find( const output_reference& ref )const
+   {
+      auto itr = _orders.find( ref );
+      if( itr == _orders.end() ) return nullptr;
+      return &itr->second;
+   }
+
+   const market_order* order_book::best( uint16_t asset_pair, order_kind_enum kind )const
+   {
+      auto itr = _books.find( book_id( asset_pair, kind ) );
+      if( itr == _books.end() || itr->second.empty() ) return nullptr;
+      return find( itr->second.back().ref );
+   }
+
+   std::vector<market_order> order_book::get_orders( uint16_t asset_pair, order_kind_enum kind, uint32_t limit )const
+   {
+      std::vector<market_order> orders;
+      auto itr = _books.find( book_id( asset_pair, kind ) );
+      if( itr == _books.end() ) return orders;
+
+      const auto& book = itr->second;
+      for( auto e = book.rbegin(); e != book.rend() && orders.size() < limit; ++e )
+         orders.push_back( _orders.find( e->ref )->second );
+      return orders;
+   }
+
+   std::vector<market_order> order_book::get_margin_calls( const price& p, uint32_t limit )const
+   {
+      std::vector<market_order> calls;
+      auto itr = _books.find( book_id( p.asset_pair(), cover_order ) );
+      if( itr == _books.end() ) return calls;
+
+      const auto& book = itr->second;
+      for( auto e = book.rbegin(); e != book.rend() && calls.size() < limit && !(e->ratio < p.ratio); ++e )
+         calls.push_back( _orders.find( e->ref )->second );
+      return calls;
+   }
+
+   std::vector<uint16_t> order_book::get_asset_pairs()const
+   {
+      std::vector<uint16_t> pairs;
+      for( const auto& item : _books )
+      {
+         uint16_t pair = uint16_t(item.first >> 8);
+         if( pairs.empty() || pairs.back() != pair ) pairs.push_back( pair );
+      }
+      return pairs;
+   }
+
+   void order_book::clear()
+   {
+      _orders.clear();
+      _books.clear();
+   }
+
+} } // bts::btsx
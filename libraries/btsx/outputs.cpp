@@ -7,4 +7,20 @@ namespace bts { namespace btsx {
    const claim_type_enum claim_by_cover_output::type       = claim_type_enum::claim_by_cover;
    const claim_type_enum claim_by_opt_execute_output::type = claim_type_enum::claim_by_opt_execute;
 
+   bool claim_by_bid_output::is_bid( asset::unit_type out_unit )const
+   {
+      return out_unit == ask_price.quote_unit;
+   }
+
+   bool claim_by_bid_output::is_ask( asset::unit_type out_unit )const
+   {
+      return out_unit == ask_price.base_unit;
+   }
+
+   /** the price at which collat is only worth the payoff */
+   price claim_by_cover_output::get_call_price( asset collat )const
+   {
+      return payoff / collat;
+   }
+
 } } // bts::btsx
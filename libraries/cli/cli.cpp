@@ -4,6 +4,8 @@
 #include <fc/io/sstream.hpp>
 #include <fc/io/buffered_iostream.hpp>
 
+#include <deque>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -74,7 +76,9 @@ namespace bts { namespace cli {
 
             void interactive_open_wallet()
             {
-              if( !_client->get_wallet()->is_open() )
+              bool is_open = false;
+              _client->run_on_chain_thread( [&](){ is_open = _client->get_wallet()->is_open(); } );
+              if( !is_open )
               {
                 try
                 {
@@ -107,7 +111,9 @@ namespace bts { namespace cli {
 
             void interactive_unlock_wallet()
             {
-              if( _client->get_wallet()->is_locked() )
+              bool is_locked = false;
+              _client->run_on_chain_thread( [&](){ is_locked = _client->get_wallet()->is_locked(); } );
+              if( is_locked )
               {
                 while (1)
                 {
@@ -177,7 +183,9 @@ namespace bts { namespace cli {
               
               std::string response;
               std::cout << "About to broadcast transaction:\n\n";
-              std::cout << _client->get_wallet()->get_transaction_info_string(*_client->get_chain(), transaction) << "\n";
+              std::string info;
+              _client->run_on_chain_thread( [&](){ info = _client->get_wallet()->get_transaction_info_string(*_client->get_chain(), transaction); } );
+              std::cout << info << "\n";
               std::cout << "Send this transaction? (Y/n)\n";
               std::cin >> response;
 
@@ -204,10 +212,13 @@ namespace bts { namespace cli {
               if (arguments.size() == 1)
                 block_num = (uint32_t)arguments[0].as_uint64();
                 
-              _client->get_wallet()->scan_chain( *_client->get_chain(), block_num, [](uint32_t cur, uint32_t last, uint32_t trx, uint32_t last_trx)
-                {
-                    std::cout << "scanning transaction " <<  cur << "." << trx <<"  of " << last << "." << last_trx << "         \r";
-                });              
+              _client->run_on_chain_thread( [&]()
+              {
+                _client->get_wallet()->scan_chain( *_client->get_chain(), block_num, [](uint32_t cur, uint32_t last, uint32_t trx, uint32_t last_trx)
+                  {
+                      std::cout << "scanning transaction " <<  cur << "." << trx <<"  of " << last << "." << last_trx << "         \r";
+                  });
+              } );
               return fc::variant();
             }
 
@@ -363,7 +374,8 @@ namespace bts { namespace cli {
               {
                 std::cout << std::setw( 33 ) << std::left << "address" << " : " << "account" << "\n";
                 std::cout << "--------------------------------------------------------------------------------\n";
-                auto addrs = _client->get_wallet()->get_receive_addresses();
+                std::unordered_map<bts::blockchain::address,std::string> addrs;
+                _client->run_on_chain_thread( [&](){ addrs = _client->get_wallet()->get_receive_addresses(); } );
                 for( auto addr : addrs )
                   std::cout << std::setw( 33 ) << std::left << std::string(addr.first) << " : " << addr.second << "\n";
               }
@@ -400,6 +412,120 @@ namespace bts { namespace cli {
               }
             }
 
+            /** a command of a batch, result is only valid if it was dispatched */
+            struct batch_command
+            {
+              uint64_t                 line_number;
+              fc::future<fc::variant>  result;
+              std::string              error;
+            };
+
+            void write_batch_result( batch_command& cmd )
+            {
+              fc::mutable_variant_object reply( "line", cmd.line_number );
+              if( cmd.error.empty() )
+              {
+                try
+                {
+                  reply["result"] = cmd.result.wait();
+                }
+                catch ( const fc::exception& e )
+                {
+                  cmd.error = e.to_string();
+                }
+              }
+              if( !cmd.error.empty() )
+                reply["error"] = cmd.error;
+              std::cout << fc::json::to_string( reply ) << "\n";
+            }
+
+            /** splits a line as process_commands does, parsing the arguments by the types of the method */
+            void parse_batch_line( const std::string& line, std::string& command, fc::variants& arguments )
+            {
+              std::string::const_iterator iter = std::find_if(line.begin(), line.end(), ::isspace);
+              command = line.substr(0, iter - line.begin());
+              fc::istream_ptr argument_stream = std::make_shared<fc::stringstream>(
+                  iter != line.end() ? line.substr(iter - line.begin() + 1) : std::string());
+              fc::buffered_istream buffered_argument_stream(argument_stream);
+              arguments = _self->parse_interactive_command(buffered_argument_stream, command);
+            }
+
+            void process_batch( const fc::path& command_file, uint32_t read_concurrency )
+            {
+              std::ifstream file;
+              std::istream* input = &std::cin;
+              if( command_file != fc::path("-") )
+              {
+                file.open( command_file.generic_string().c_str() );
+                FC_ASSERT( file.good(), "unable to open ${file}", ("file",command_file) );
+                input = &file;
+              }
+
+              std::deque<batch_command> pending;
+              auto write_until = [&]( size_t remaining )
+              {
+                while( pending.size() > remaining )
+                {
+                  write_batch_result( pending.front() );
+                  pending.pop_front();
+                }
+              };
+
+              const uint32_t lines_per_read = 256;
+              uint64_t line_number = 0;
+              bool more = true;
+              while( more )
+              {
+                // reading may block, so it is done on the thread interactive input is read on
+                std::vector<std::string> lines = _cin_thread.async( [&]()
+                {
+                  std::vector<std::string> read;
+                  std::string line;
+                  while( read.size() < lines_per_read && std::getline( *input, line ) )
+                    read.push_back( line );
+                  more = read.size() == lines_per_read;
+                  return read;
+                } ).wait();
+
+                for( const std::string& line : lines )
+                {
+                  ++line_number;
+                  std::string trimmed = boost::algorithm::trim_copy( line );
+                  if( trimmed.empty() || trimmed[0] == '#' )
+                    continue;
+
+                  batch_command cmd;
+                  cmd.line_number = line_number;
+                  std::string command;
+                  fc::variants arguments;
+                  bool read_only = false;
+                  try
+                  {
+                    parse_batch_line( trimmed, command, arguments );
+                    read_only = _rpc_server->get_method_data( command ).read_only;
+                  }
+                  catch ( const fc::exception& e )
+                  {
+                    cmd.error = e.to_string();
+                  }
+
+                  if( cmd.error.empty() )
+                  {
+                    // anything but a read_only method may depend on the commands before it
+                    if( !read_only )
+                      write_until( 0 );
+                    // read_only methods wait for a read thread, so these run side by side
+                    auto rpc_server = _rpc_server;
+                    cmd.result = fc::async( [=](){ return rpc_server->direct_invoke_method( command, arguments ); } );
+                  }
+                  pending.push_back( cmd );
+                  write_until( read_only ? std::max<uint32_t>( read_concurrency, 1 ) - 1 : 0 );
+                }
+              }
+              write_until( 0 );
+              std::cout.flush();
+            }
+
             void process_commands()
             {
               std::string line = _self->get_line();
@@ -506,7 +632,8 @@ namespace bts { namespace cli {
 
     void cli_impl::create_wallet_if_missing()
     {
-      auto wallet_dat = _client->get_wallet()->get_wallet_filename_for_user("default");
+      fc::path wallet_dat;
+      _client->run_on_chain_thread( [&](){ wallet_dat = _client->get_wallet()->get_wallet_filename_for_user("default"); } );
       if( !fc::exists( wallet_dat ) )
       {
         std::cout << "Creating wallet "<< wallet_dat.generic_string() << "\n";
@@ -563,7 +690,7 @@ namespace bts { namespace cli {
           std::cout << "No passphrase provided, your wallet will be stored unencrypted.\n";
         }
 
-        _client->get_wallet()->create( wallet_dat, pass1, keypass1 );
+        _client->run_on_chain_thread( [&](){ _client->get_wallet()->create( wallet_dat, pass1, keypass1 ); } );
         std::cout << "Wallet created.\n";
       }
     }
@@ -580,6 +707,15 @@ namespace bts { namespace cli {
     my->_cin_complete = fc::async( [=](){ my->process_commands(); } );
   }
 
+  cli::cli( const client_ptr& client, const bts::rpc::rpc_server_ptr& rpc_server,
+            const fc::path& command_file, uint32_t read_concurrency ) :
+    my( new detail::cli_impl(client, rpc_server) )
+  {
+    my->_self        = this;
+    my->_main_thread = &fc::thread::current();
+    my->_cin_complete = fc::async( [=](){ my->process_batch( command_file, read_concurrency ); } );
+  }
+
    cli::~cli()
    {
       try 
@@ -608,12 +744,13 @@ namespace bts { namespace cli {
    void cli::list_transactions( uint32_t count )
    {
        /* dump the transactions from the wallet, which needs the chain db */
-       client()->get_wallet()->dump_txs(*(client()->get_chain()), count);
+       client()->run_on_chain_thread( [&](){ client()->get_wallet()->dump_txs(*(client()->get_chain()), count); } );
    }
 #endif
    void cli::list_delegates( uint32_t count )
    {
-        auto delegates = client()->get_chain()->get_delegates( count );
+        std::vector<bts::blockchain::name_record> delegates;
+        client()->run_on_chain_thread( [&](){ delegates = client()->get_chain()->get_delegates( count ); } );
 
         std::cerr<<"Delegate Ranking\n";
         std::cerr<<std::setw(6)<<"Rank "<<"  "
@@ -19,6 +19,15 @@ namespace bts { namespace cli {
    {
       public:
          cli( const client_ptr& client, const bts::rpc::rpc_server_ptr& rpc_server );
+         /**
+          *  Runs the commands of command_file, or of stdin if it is "-", without prompting
+          *  and writes one line of compact JSON per command to stdout: {"line":n,"result":r}
+          *  or {"line":n,"error":e}, in the order of the commands.  Up to read_concurrency
+          *  read_only commands run at once, any other command runs once all commands before
+          *  it are done.
+          */
+         cli( const client_ptr& client, const bts::rpc::rpc_server_ptr& rpc_server,
+              const fc::path& command_file, uint32_t read_concurrency = 8 );
          virtual ~cli();
 
          virtual void list_delegates( uint32_t count = 0 );
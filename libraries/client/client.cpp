@@ -1,10 +1,20 @@
 #include <algorithm>
+#include <deque>
+#include <list>
+#include <unordered_map>
 
 #include <bts/client/client.hpp>
 #include <bts/client/messages.hpp>
 #include <bts/net/chain_client.hpp>
 #include <bts/net/node.hpp>
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/config.hpp>
+#include <bts/blockchain/fee_estimator.hpp>
+#include <bts/blockchain/transaction_pool.hpp>
+#include <bts/blockchain/block_template.hpp>
+#include <bts/blockchain/fork_database.hpp>
+#include <bts/blockchain/orphan_pool.hpp>
+#include <bts/blockchain/signature_cache.hpp>
 #include <fc/reflect/variant.hpp>
 
 #include <fc/thread/thread.hpp>
@@ -14,16 +24,130 @@ namespace bts { namespace client {
 
     namespace detail 
     { 
+       /**
+        *  Packed block_messages of recently stored or requested blocks, least recently used
+        *  are dropped first.  Every syncing peer asks for the same blocks, so this lets us
+        *  read and pack each one once rather than once per peer.
+        */
+       class block_message_cache
+       {
+          public:
+            block_message_cache(size_t max_size_in_bytes = 32 * 1024 * 1024) :
+              _size_in_bytes(0),
+              _max_size_in_bytes(max_size_in_bytes),
+              _hits(0),
+              _misses(0)
+            {}
+
+            /** @return nullptr if block_id isn't cached, otherwise valid until the next insert() or set_max_size_in_bytes() */
+            const bts::net::message* find(const block_id_type& block_id, uint32_t& block_num)
+            {
+              auto iter = _cache.find(block_id);
+              if (iter == _cache.end())
+              {
+                ++_misses;
+                return nullptr;
+              }
+              ++_hits;
+              _lru.splice(_lru.begin(), _lru, iter->second.lru_position);
+              block_num = iter->second.block_num;
+              return &iter->second.packed_block;
+            }
+
+            void insert(const block_id_type& block_id, uint32_t block_num, bts::net::message packed_block)
+            {
+              if (_cache.find(block_id) != _cache.end())
+                return;
+              _size_in_bytes += packed_block.data.size();
+              _lru.push_front(block_id);
+              _cache.insert(std::make_pair(block_id, entry{std::move(packed_block), block_num, _lru.begin()}));
+              while (_size_in_bytes > _max_size_in_bytes && _cache.size() > 1)
+                evict();
+            }
+
+            uint64_t hits()const   { return _hits;   }
+            uint64_t misses()const { return _misses; }
+
+            size_t size_in_bytes()const { return _size_in_bytes; }
+            void   set_max_size_in_bytes(size_t max_size_in_bytes)
+            {
+              _max_size_in_bytes = max_size_in_bytes;
+              while (_size_in_bytes > _max_size_in_bytes && !_cache.empty())
+                evict();
+            }
+
+          private:
+            struct entry
+            {
+              bts::net::message                  packed_block;
+              uint32_t                           block_num;
+              std::list<block_id_type>::iterator lru_position;
+            };
+
+            void evict()
+            {
+              auto iter = _cache.find(_lru.back());
+              _size_in_bytes -= iter->second.packed_block.data.size();
+              _cache.erase(iter);
+              _lru.pop_back();
+            }
+
+            std::unordered_map<block_id_type, entry> _cache;
+            std::list<block_id_type>                 _lru;
+            size_t                                   _size_in_bytes;
+            size_t                                   _max_size_in_bytes;
+            uint64_t                                 _hits;
+            uint64_t                                 _misses;
+       };
+
+       /**
+        *  The block ids of the latest block messages by message id.  Peers advertise a new
+        *  block by the id of the message that carries it, while syncing peers name blocks by
+        *  their block id, so the id a peer gave is translated before the chain is asked.
+        */
+       class block_message_ids
+       {
+          public:
+            block_message_ids(size_t max_size = 1024) : _max_size(max_size) {}
+
+            void insert(const bts::net::message_hash_type& message_id, const block_id_type& block_id)
+            {
+              if (!_block_ids.insert(std::make_pair(message_id, block_id)).second)
+                return;
+              _order.push_back(message_id);
+              if (_order.size() > _max_size)
+              {
+                _block_ids.erase(_order.front());
+                _order.pop_front();
+              }
+            }
+
+            /** @return the block the message carries, or the id itself if it is no message we know */
+            block_id_type translate(const bts::net::item_hash_t& id)const
+            {
+              auto iter = _block_ids.find(id);
+              return iter == _block_ids.end() ? block_id_type(id) : iter->second;
+            }
+
+          private:
+            std::unordered_map<bts::net::message_hash_type, block_id_type> _block_ids;
+            std::deque<bts::net::message_hash_type>                        _order;
+            size_t                                                         _max_size;
+       };
+
        class client_impl : public bts::net::chain_client_delegate,
                            public bts::net::node_delegate
        {
           public:
             client_impl(bool use_p2p = false)
+            :_main_thread(&fc::thread::current()),_chain_thread("chain"),
+             _fee_estimator(std::make_shared<bts::blockchain::fee_estimator>())
             {
               if (use_p2p)
               {
                 _p2p_node = std::make_shared<bts::net::node>();
-                _p2p_node->set_delegate(this);
+                // blocks are validated on _chain_thread while the node keeps downloading
+                _p2p_node->set_delegate(this, &_chain_thread);
               }
               else
               {
@@ -34,7 +158,22 @@ namespace bts { namespace client {
             }
 
             void trustee_loop();
-            signed_transactions get_pending_transactions() const;
+            void storage_stats_loop();
+            void memory_budget_loop();
+            void register_memory_budget();
+            void on_block_pushed(const trx_block& block);
+            void update_fee_estimates();
+            void on_new_trusted_block(const trx_block& block,
+                                      const bts::blockchain::block_evaluation_state_ptr& block_state,
+                                      const bts::blockchain::transaction_summary& summary);
+            void on_block_popped(const trx_block& block);
+            std::vector<output_reference> missing_parents(const signed_transaction& trx);
+            template<typename Functor>
+            void update_block_template(Functor&& update);
+            template<typename Functor>
+            auto on_chain_thread(Functor&& task) -> decltype(task());
+            template<typename Functor>
+            auto on_main_thread(Functor&& task) -> decltype(task());
 
             /* Implement chain_client_impl */
             // @{
@@ -46,14 +185,29 @@ namespace bts { namespace client {
             // @{
             virtual bool has_item(const bts::net::item_id& id) override;
             virtual void handle_message(const bts::net::message&) override;
+            virtual void handle_block(const block_message& block_message_to_handle) override;
             virtual std::vector<bts::net::item_hash_t> get_item_ids(const bts::net::item_id& from_id,
                                                                     uint32_t& remaining_item_count,
                                                                     uint32_t limit = 2000) override;
             virtual bts::net::message get_item(const bts::net::item_id& id) override;
-            virtual void sync_status(uint32_t item_type, uint32_t item_count) override;
+            virtual std::vector<signed_block_header> get_block_headers(const std::vector<bts::net::item_hash_t>& block_ids) override;
+            virtual void validate_block_header(const signed_block_header& header) override;
+            virtual bool validate_block_for_relay(const block_message& block_message_to_check) override;
+            virtual uint64_t get_transaction_priority(const bts::net::message& transaction_message) override;
+            virtual std::vector<fc::optional<signed_transaction> > get_transactions_by_short_id(const block_id_type& block_id,
+                                                                                               const std::vector<uint64_t>& short_trx_ids) override;
+            virtual void sync_status(uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation) override;
             virtual void connection_count_changed(uint32_t c) override;
             /// @}
 
+            /** the network runs here */
+            fc::thread*                                                 _main_thread;
+            /**
+             *  The chain, the pools, the wallets and the caches below are only used on this
+             *  thread.  The p2p node calls us on it, the chain client and the callers of client
+             *  are sent to it by on_chain_thread().
+             */
+            fc::thread                                                  _chain_thread;
             fc::ecc::private_key                                        _trustee_key;
             fc::time_point                                              _last_block;
             fc::path                                                    _data_dir;
@@ -62,9 +216,28 @@ namespace bts { namespace client {
             bts::net::chain_client_ptr                                  _chain_client;
             bts::net::node_ptr                                          _p2p_node;
             bts::blockchain::chain_database_ptr                         _chain_db;
-            std::unordered_map<transaction_id_type, signed_transaction> _pending_trxs;
+            /** peers know a trx_message by the packed_hash of its transaction */
+            bts::blockchain::transaction_pool                           _pending_trxs;
+            /** transactions that arrived before the transactions they spend were included */
+            bts::blockchain::orphan_pool                                _orphan_trxs;
+            /** fed with the fee rates of the pooled transactions that blocks include */
+            bts::blockchain::fee_estimator_ptr                          _fee_estimator;
+            /** the block the trustee would produce next, only used on _chain_thread */
+            std::unique_ptr<bts::blockchain::block_template>            _block_template;
             bts::wallet::wallet_ptr                                     _wallet;
+            bts::wallet::wallet_manager_ptr                             _wallet_manager;
+            new_block_handler                                           _new_block_handler;
             fc::future<void>                                            _trustee_loop_complete;
+            fc::microseconds                                            _storage_stats_interval;
+            fc::future<void>                                            _storage_stats_loop_complete;
+            /** shared by the caches of the chain, the pools and the block cache, rebalanced on _chain_thread */
+            bts::db::memory_budget                                      _memory_budget;
+            fc::future<void>                                            _memory_budget_loop_complete;
+            /** only used on _chain_thread */
+            block_message_cache                                         _block_message_cache;
+            block_message_ids                                           _block_message_ids;
+            /** blocks that arrived before their parents or belong to another branch */
+            bts::blockchain::fork_database                              _forks;
        };
 
        void client_impl::trustee_loop()
@@ -72,22 +245,24 @@ namespace bts { namespace client {
          _last_block = _chain_db->get_head_block().timestamp;
          while (!_trustee_loop_complete.canceled())
          {
-           signed_transactions pending_trxs;
-           pending_trxs = get_pending_transactions();
-           if (pending_trxs.size() && (fc::time_point::now() - _last_block) > fc::seconds(30))
+           if (_pending_trxs.size() && (fc::time_point::now() - _last_block) > fc::seconds(30))
            {
              try {
-               bts::blockchain::trx_block blk = _wallet->generate_next_block(*_chain_db, pending_trxs);
+               bts::blockchain::trx_block blk = _block_template->generate_block();
                blk.sign(_trustee_key);
                // _chain_db->push_block( blk );
                if (_chain_client)
-                 _chain_client->broadcast_block(blk);
+                 _main_thread->async( [&](){ _chain_client->broadcast_block(blk); } ).wait();
                else
                {
-                 _p2p_node->broadcast(block_message(blk.id(), blk, blk.trustee_signature));
+                 // the template evaluated the transactions as they arrived, take its state before
+                 // anything else runs on this thread and push the block without evaluating them again
+                 bts::blockchain::transaction_summary summary;
+                 bts::blockchain::block_evaluation_state_ptr block_state = _block_template->release_block_state(summary);
                  // with the p2p code, if you broadcast something to the network, it will not
                  // immediately send it back to you 
-                 on_new_block(blk);
+                 on_new_trusted_block(blk, block_state, summary);
+                 _main_thread->async( [&](){ _p2p_node->broadcast(block_message(blk.id(), blk, blk.trustee_signature)); } ).wait();
                }
 
                _last_block = fc::time_point::now();
@@ -101,45 +276,310 @@ namespace bts { namespace client {
          }
        }
 
-       signed_transactions client_impl::get_pending_transactions() const
+       void client_impl::storage_stats_loop()
        {
-         signed_transactions trxs;
-         trxs.reserve(_pending_trxs.size());
-         for (auto trx : _pending_trxs)
+         while (!_storage_stats_loop_complete.canceled())
          {
-           trxs.push_back(trx.second);
+           fc::usleep(_storage_stats_interval);
+           if (_storage_stats_loop_complete.canceled())
+             break;
+           try
+           {
+             ilog("storage: ${stats} block cache hits ${hits} misses ${misses}",
+                  ("stats", _chain_db->get_storage_stats())
+                  ("hits", _block_message_cache.hits())("misses", _block_message_cache.misses()));
+           }
+           catch (const fc::exception& e)
+           {
+             wlog("unable to read storage statistics: ${e}", ("e", e.to_detail_string()));
+           }
          }
-         return trxs;
+       }
+
+       void client_impl::memory_budget_loop()
+       {
+         while (!_memory_budget_loop_complete.canceled())
+         {
+           try
+           {
+             _memory_budget.rebalance();
+           }
+           catch (const fc::exception& e)
+           {
+             wlog("unable to rebalance the memory budget: ${e}", ("e", e.to_detail_string()));
+           }
+           fc::usleep(fc::seconds(5));
+         }
+       }
+
+       /**
+        *  The pools count the packed size of their transactions, which take about twice as
+        *  much once unpacked and indexed.  Pending transactions are the last to give up memory
+        *  and cached blocks, which are read back from the database, the first.
+        */
+       void client_impl::register_memory_budget()
+       {
+         const uint64_t unpacked = 2;
+         _memory_budget.add_cache("block_cache", 20, 0,
+                                  [this]() { return uint64_t(_block_message_cache.size_in_bytes()); },
+                                  [this](uint64_t bytes) { _block_message_cache.set_max_size_in_bytes(size_t(bytes)); });
+         _memory_budget.add_cache("signature_cache", 15, 1,
+                                  []() { return signature_cache::instance().memory_usage(); },
+                                  [](uint64_t bytes) { signature_cache::instance().set_memory_limit(bytes); });
+         _memory_budget.add_cache("orphan_pool", 5, 2,
+                                  [this]() { return _orphan_trxs.size_in_bytes() * unpacked; },
+                                  [this](uint64_t bytes) { _orphan_trxs.set_limits(1000, size_t(bytes / unpacked)); });
+         if (_chain_db)
+           _memory_budget.add_cache("unspent_outputs", 40, 3,
+                                    [this]() { return _chain_db->get_unspent_output_cache_bytes(); },
+                                    [this](uint64_t bytes) { _chain_db->set_unspent_output_cache_bytes(bytes); });
+         _memory_budget.add_cache("transaction_pool", 20, 4,
+                                  [this]() { return _pending_trxs.size_in_bytes() * unpacked; },
+                                  [this](uint64_t bytes) { _pending_trxs.set_limits(50000, size_t(bytes / unpacked)); });
+       }
+
+       /** runs task on _chain_thread and waits for it, or right away if this is that thread */
+       template<typename Functor>
+       auto client_impl::on_chain_thread(Functor&& task) -> decltype(task())
+       {
+         if (&fc::thread::current() == &_chain_thread)
+           return task();
+         return _chain_thread.async([&](){ return task(); }).wait();
+       }
+
+       /** the chain client and the p2p node are used on the thread that created them */
+       template<typename Functor>
+       auto client_impl::on_main_thread(Functor&& task) -> decltype(task())
+       {
+         if (&fc::thread::current() == _main_thread)
+           return task();
+         return _main_thread->async([&](){ return task(); }).wait();
+       }
+
+       template<typename Functor>
+       void client_impl::update_block_template(Functor&& update)
+       {
+         on_chain_thread([&]()
+         {
+           if (_block_template)
+             update(*_block_template);
+         });
        }
 
        ///////////////////////////////////////////////////////
        // Implement chain_client_delegate                   //
        ///////////////////////////////////////////////////////
+       /**
+        *  A block that builds on the head is pushed right away, any other is kept in _forks
+        *  until its parents arrive or its branch becomes the longest.
+        */
        void client_impl::on_new_block(const trx_block& block)
+       {
+         // the chain client calls us on the thread it runs on
+         if (&fc::thread::current() != &_chain_thread)
+           return on_chain_thread([&]() { on_new_block(block); });
+
+         if (block.block_num == 0 || block.prev == _chain_db->head_block_id())
+         {
+           try
+           {
+             _chain_db->push_block(block);
+           }
+           catch (fc::exception& e)
+           {
+             wlog("Error pushing block ${block}: ${error}", ("block", block)("error", e.to_string()));
+             throw;
+           }
+           on_block_pushed(block);
+         }
+         else if (!_forks.add_block(block, _chain_db->head_block_num()))
+           return;
+
+         bts::blockchain::chain_switch changes = _forks.update_chain(*_chain_db);
+         for (const trx_block& popped : changes.popped)
+           on_block_popped(popped);
+         for (const trx_block& pushed : changes.pushed)
+           on_block_pushed(pushed);
+       }
+
+       /** a block the trustee built on the head, as evaluated by _block_template */
+       void client_impl::on_new_trusted_block(const trx_block& block,
+                                              const bts::blockchain::block_evaluation_state_ptr& block_state,
+                                              const bts::blockchain::transaction_summary& summary)
        {
          try
          {
-           _chain_db->push_block(block);
+           _chain_db->push_trusted_block(block, block_state, summary);
          }
          catch (fc::exception& e)
          {
            wlog("Error pushing block ${block}: ${error}", ("block", block)("error", e.to_string()));
            throw;
          }
+         on_block_pushed(block);
+       }
 
-         for (auto trx : block.trxs)
-           _pending_trxs.erase(trx.id());
+       void client_impl::on_block_popped(const trx_block& block)
+       {
+         update_block_template([](bts::blockchain::block_template& next_block) { next_block.reset(); });
+         if (_wallet && !_wallet->revert_block(block.block_num))
+           wlog("the wallet was not scanned block by block and may still list outputs of block ${n}", ("n", block.block_num));
+         if (_wallet_manager)
+           _wallet_manager->revert_block(block.block_num);
+       }
+
+       void client_impl::on_block_pushed(const trx_block& block)
+       {
+         // the fees of a transaction are only known if it was pooled, the others are left out
+         std::vector<std::pair<uint64_t, uint32_t> > included;
+         uint64_t block_size = 0;
+         included.reserve(block.trxs.size());
+         for (const signed_transaction& trx : block.trxs)
+         {
+           bts::blockchain::pooled_transaction_ptr pooled = _pending_trxs.find(trx.id());
+           if (pooled)
+           {
+             included.push_back(std::make_pair(pooled->fee_rate(), pooled->size));
+             block_size += pooled->size;
+           }
+           else
+             block_size += trx.size();
+         }
+         _fee_estimator->record_block(included, block_size);
+         _pending_trxs.remove_included(block.trxs);
+         update_fee_estimates();
+         update_block_template([](bts::blockchain::block_template& next_block) { next_block.reset(); });
+         for (const signed_transaction& parent : block.trxs)
+         {
+           for (const signed_transaction& child : _orphan_trxs.take_children(parent))
+           {
+             try
+             {
+               on_new_transaction(child);
+             }
+             catch (const fc::exception& e)
+             {
+               wlog("dropping orphan transaction ${id}: ${e}", ("id", child.id())("e", e.to_string()));
+             }
+           }
+         }
+         // the deterministic transactions the block didn't carry are read back as the chain stored them
+         bts::blockchain::signed_transactions deterministic_trxs;
+         if (_p2p_node || _wallet)
+           deterministic_trxs = _chain_db->fetch_deterministic_trxs(block.block_num);
+         // our peers are about to ask for it
+         if (_p2p_node)
+         {
+           block_id_type block_id = block.id();
+           bts::net::message packed_block(block_message(block_id, block, block.trustee_signature));
+           _block_message_ids.insert(packed_block.id(), block_id);
+           _block_message_cache.insert(block_id, block.block_num, std::move(packed_block));
+           // light clients learn of the block from its merkle block, the copies outlive this call
+           _main_thread->async([this, block, deterministic_trxs]() { _p2p_node->send_filtered_block(block, deterministic_trxs); });
+         }
          ilog("");
-         _wallet->scan_chain(*_chain_db, block.block_num);
+         // the block is in memory, the wallet only reads the chain when it missed blocks
+         if (_wallet && _wallet->last_scanned() + 1 == block.block_num)
+           _wallet->apply_block(block, deterministic_trxs);
+         else if (_wallet)
+           _wallet->scan_chain(*_chain_db, block.block_num);
+         if (_wallet_manager)
+           _wallet_manager->scan_block(block.block_num);
+         if (_new_block_handler)
+           _new_block_handler(block);
+       }
+
+       void client_impl::update_fee_estimates()
+       {
+         if (_chain_db)
+           _fee_estimator->update(_pending_trxs.fee_distribution(), _chain_db->get_fee_rate());
+       }
+
+       /** the inputs of trx that spend transactions the chain does not know */
+       std::vector<output_reference> client_impl::missing_parents(const signed_transaction& trx)
+       {
+         std::vector<output_reference> missing;
+         for (const trx_input& in : trx.inputs)
+         {
+           try
+           {
+             _chain_db->fetch_trx_num(in.output_ref.trx_hash);
+           }
+           catch (const fc::key_not_found_exception&)
+           {
+             missing.push_back(in.output_ref);
+           }
+         }
+         return missing;
+       }
+
+       /**
+        *  One more than the fee rate, from one read of each input's output and without checking
+        *  signatures.  A transaction whose inputs are not all known can't be priced, it gets 0,
+        *  below every transaction that could be, and may still become an orphan.  In a full
+        *  queue it never displaces another.
+        */
+       uint64_t client_impl::get_transaction_priority(const bts::net::message& transaction_message)
+       {
+         FC_ASSERT(transaction_message.size <= BTS_BLOCKCHAIN_MAX_BLOCK_SIZE, "transaction larger than a block");
+         signed_transaction trx = transaction_message.as<trx_message>().trx;
+         transaction_id_type trx_id = trx.id();
+         FC_ASSERT(!_pending_trxs.contains(trx_id) && !_orphan_trxs.contains(trx_id), "duplicate transaction");
+
+         int64_t fees = 0;
+         for (const trx_input& in : trx.inputs)
+         {
+           try
+           {
+             trx_output spent = _chain_db->fetch_output(in.output_ref);
+             if (spent.amount.unit == 0)
+               fees += spent.amount.get_rounded_amount();
+           }
+           catch (const fc::exception&)
+           {
+             return 0;
+           }
+         }
+         for (const trx_output& out : trx.outputs)
+           if (out.amount.unit == 0)
+             fees -= out.amount.get_rounded_amount();
+
+         uint64_t fee_rate = fees > 0 ? (uint64_t(fees) * 1000) / trx.size() : 0;
+         FC_ASSERT(fee_rate >= _chain_db->get_fee_rate(), "fee rate below the chain's",
+                   ("fee_rate", fee_rate)("required", _chain_db->get_fee_rate()));
+         return fee_rate + 1;
        }
 
        void client_impl::on_new_transaction(const signed_transaction& trx)
        {
-         _chain_db->evaluate_transaction(trx); // throws exception if invalid trx.
-         if (_pending_trxs.insert(std::make_pair(trx.id(), trx)).second)
+         if (&fc::thread::current() != &_chain_thread)
+           return on_chain_thread([&]() { on_new_transaction(trx); });
+
+         transaction_summary summary;
+         try
+         {
+           summary = _chain_db->evaluate_transaction(trx); // throws exception if invalid trx.
+         }
+         catch (const fc::exception&)
+         {
+           // a child of a transaction that is not included yet is kept until its parents are
+           std::vector<output_reference> missing = missing_parents(trx);
+           if (missing.empty())
+             throw;
+           if (_orphan_trxs.insert(trx, missing))
+             ilog("transaction ${id} waits for ${n} parents", ("id", trx.id())("n", missing.size()));
+           return;
+         }
+         if (_pending_trxs.insert(trx, summary.fees))
+         {
            ilog("new transaction");
+           update_fee_estimates();
+           bts::blockchain::pooled_transaction_ptr pooled = _pending_trxs.find(trx.id());
+           if (pooled)
+             update_block_template([&](bts::blockchain::block_template& next_block) { next_block.add(pooled); });
+         }
          else
-           wlog("duplicate transaction, ignoring");
+           wlog("duplicate, conflicting or low fee transaction, ignoring");
        }
 
 
@@ -148,6 +588,21 @@ namespace bts { namespace client {
        ///////////////////////////////////////////////////////
        bool client_impl::has_item(const bts::net::item_id& id)
        {
+         if (id.item_type == block_message_type)
+         {
+           block_id_type block_id = _block_message_ids.translate(id.item_hash);
+           try
+           {
+             _chain_db->fetch_block_num(block_id);
+             return true;
+           }
+           catch (const fc::key_not_found_exception&)
+           {
+             return _forks.contains(block_id);
+           }
+         }
+         if (id.item_type == trx_message_type)
+           return _pending_trxs.find_by_packed_hash(id.item_hash) != nullptr;
          return false;
        }
        void client_impl::handle_message(const bts::net::message& message_to_handle)
@@ -156,9 +611,9 @@ namespace bts { namespace client {
          {
          case block_message_type:
            {
-             block_message block_message_to_handle(message_to_handle.as<block_message>());
-             ilog("CLIENT: just received block ${id}", ("id", block_message_to_handle.block_id));
-             on_new_block(block_message_to_handle.block);
+             block_message block_message_to_handle;
+             message_to_handle.as(block_message_to_handle);
+             handle_block(block_message_to_handle);
              break;
            }
          case trx_message_type:
@@ -170,6 +625,13 @@ namespace bts { namespace client {
          }
        }
 
+       void client_impl::handle_block(const block_message& block_message_to_handle)
+       {
+         ilog("CLIENT: just received block ${id}", ("id", block_message_to_handle.block_id));
+         _block_message_ids.insert(bts::net::message(block_message_to_handle).id(), block_message_to_handle.block_id);
+         on_new_block(block_message_to_handle.block);
+       }
+
        std::vector<bts::net::item_hash_t> client_impl::get_item_ids(const bts::net::item_id& from_id,
                                                                     uint32_t& remaining_item_count,
                                                                     uint32_t limit /* = 2000 */)
@@ -192,65 +654,94 @@ namespace bts { namespace client {
          }
          remaining_item_count = _chain_db->head_block_num() - last_seen_block_num;
          uint32_t items_to_get_this_iteration = std::min(limit, remaining_item_count);
-         std::vector<bts::net::item_hash_t> hashes_to_return;
-         hashes_to_return.reserve(items_to_get_this_iteration);
-         for (uint32_t i = 0; i < items_to_get_this_iteration; ++i)
-         {
-           ++last_seen_block_num;
-           signed_block_header header;
-           try
-           {
-             header = _chain_db->fetch_block(last_seen_block_num);
-           }
-           catch (fc::key_not_found_exception&)
-           {
-             assert(false && "I assume this can never happen");
-           }
-           hashes_to_return.push_back(header.id());
-         }
+         std::vector<bts::net::item_hash_t> hashes_to_return = _chain_db->fetch_block_ids(last_seen_block_num + 1, items_to_get_this_iteration);
+         assert(hashes_to_return.size() == items_to_get_this_iteration);
          remaining_item_count -= items_to_get_this_iteration;
          return hashes_to_return;
        }
 
        bts::net::message client_impl::get_item(const bts::net::item_id& id)
        {
-#if 0
-         try
-         {
-           bts::net::message result = _message_cache.get_message(id.item_hash);
-           ilog("get_item() returning message from _message_cache (id: ${item_hash})", ("item_hash", result.id()));
-           ilog("item's real hash is ${hash}", ("hash", fc::ripemd160::hash(&result.data[0], result.data.size())));
-           return result;
-         }
-         catch (const fc::key_not_found_exception&)
-         {
-           // not in our cache.  Either it has already expired from our cache, or
-           // it's a request for an actual block during synchronization.  
-         }
-#endif
-
          if (id.item_type == block_message_type)
          {
-           uint32_t block_number = _chain_db->fetch_block_num(id.item_hash);
+           // a cached block may have been popped since, the in-memory id list tells us cheaply
+           block_id_type block_id = _block_message_ids.translate(id.item_hash);
+           uint32_t block_number;
+           const bts::net::message* cached_block = _block_message_cache.find(block_id, block_number);
+           if (cached_block && block_number <= _chain_db->head_block_num() &&
+               _chain_db->fetch_block_id(block_number) == block_id)
+             return *cached_block;
+
+           block_number = _chain_db->fetch_block_num(block_id);
            bts::client::block_message block_message_to_send;
            block_message_to_send.block = _chain_db->fetch_trx_block(block_number);
            block_message_to_send.block_id = block_message_to_send.block.id();
-           FC_ASSERT(id.item_hash == block_message_to_send.block_id);
+           FC_ASSERT(block_id == block_message_to_send.block_id);
            block_message_to_send.signature = block_message_to_send.block.trustee_signature;
-           return block_message_to_send;
+           bts::net::message packed_block(block_message_to_send);
+           _block_message_cache.insert(block_message_to_send.block_id, block_number, packed_block);
+           return packed_block;
          }
 
          if (id.item_type == trx_message_type)
          {
-           trx_message trx_message_to_send;
-           auto iter = _pending_trxs.find(id.item_hash);
-           if (iter != _pending_trxs.end())
-             trx_message_to_send.trx = iter->second;
+           bts::blockchain::pooled_transaction_ptr pooled = _pending_trxs.find_by_packed_hash(id.item_hash);
+           if (pooled)
+             return trx_message(pooled->trx);
          }
 
          FC_THROW_EXCEPTION(key_not_found_exception, "I don't have the item you're looking for");
        }
-       void client_impl::sync_status(uint32_t item_type, uint32_t item_count)
+       std::vector<signed_block_header> client_impl::get_block_headers(const std::vector<bts::net::item_hash_t>& block_ids)
+       {
+         std::vector<signed_block_header> headers;
+         headers.reserve(block_ids.size());
+         try
+         {
+           for (const bts::net::item_hash_t& block_id : block_ids)
+             headers.push_back(_chain_db->fetch_block(_chain_db->fetch_block_num(block_id)));
+         }
+         catch (const fc::key_not_found_exception&)
+         {
+         }
+         return headers;
+       }
+
+       void client_impl::validate_block_header(const signed_block_header& header)
+       {
+         FC_ASSERT(header.signee() == _chain_db->get_trustee(), "block ${num} is not signed by the trustee", ("num", header.block_num));
+       }
+
+       bool client_impl::validate_block_for_relay(const block_message& block_message_to_check)
+       {
+         // a block that doesn't follow our head may be from a fork we know nothing about
+         if (block_message_to_check.block.prev != _chain_db->head_block_id())
+           return false;
+         _chain_db->validate_for_relay(block_message_to_check.block);
+         return true;
+       }
+
+       std::vector<fc::optional<signed_transaction> > client_impl::get_transactions_by_short_id(const block_id_type& block_id,
+                                                                                                 const std::vector<uint64_t>& short_trx_ids)
+       {
+         // the ids are salted with the block id, so they can't be precomputed
+         bts::blockchain::transaction_pool_snapshot pending = _pending_trxs.snapshot();
+         std::unordered_map<uint64_t, const signed_transaction*> pending_trxs_by_short_id;
+         pending_trxs_by_short_id.reserve(pending->size());
+         for (const bts::blockchain::pooled_transaction_ptr& pooled : *pending)
+           pending_trxs_by_short_id[short_transaction_id(block_id, pooled->id)] = &pooled->trx;
+
+         std::vector<fc::optional<signed_transaction> > trxs(short_trx_ids.size());
+         for (size_t i = 0; i < short_trx_ids.size(); ++i)
+         {
+           auto iter = pending_trxs_by_short_id.find(short_trx_ids[i]);
+           if (iter != pending_trxs_by_short_id.end())
+             trxs[i] = *iter->second;
+         }
+         return trxs;
+       }
+
+       void client_impl::sync_status(uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation)
        {
        }
        void client_impl::connection_count_changed(uint32_t c)
@@ -267,6 +758,12 @@ namespace bts { namespace client {
     client::~client()
     {
        try {
+          log_storage_stats( fc::microseconds() );
+          if( my->_memory_budget_loop_complete.valid() )
+          {
+             my->_memory_budget_loop_complete.cancel();
+             my->_memory_budget_loop_complete.wait();
+          }
           if( my->_trustee_loop_complete.valid() )
           {
              my->_trustee_loop_complete.cancel();
@@ -283,29 +780,82 @@ namespace bts { namespace client {
 
     void client::set_chain( const bts::blockchain::chain_database_ptr& ptr )
     {
-       my->_chain_db = ptr;
+       my->on_chain_thread( [&]()
+       {
+          my->_chain_db = ptr;
+          my->update_fee_estimates();
+       } );
        if (my->_chain_client)
          my->_chain_client->set_chain( ptr );
     }
 
     void client::set_wallet( const bts::wallet::wallet_ptr& wall )
     {
-       FC_ASSERT( my->_chain_db );
-       my->_wallet = wall;
-       my->_wallet->scan_chain( *my->_chain_db, my->_chain_db->head_block_num() );
+       my->on_chain_thread( [&]()
+       {
+          FC_ASSERT( my->_chain_db );
+          my->_wallet = wall;
+          my->_wallet->set_fee_estimator( my->_fee_estimator );
+          my->_wallet->scan_chain( *my->_chain_db, my->_chain_db->head_block_num() );
+       } );
+    }
+
+    bts::blockchain::fee_estimate client::estimate_fee( uint32_t target_blocks )const
+    {
+       return my->_fee_estimator->estimate( target_blocks );
+    }
+
+    void client::set_wallet_manager( const bts::wallet::wallet_manager_ptr& manager )
+    {
+       my->on_chain_thread( [&]()
+       {
+          FC_ASSERT( my->_chain_db );
+          my->_wallet_manager = manager;
+          my->_wallet_manager->set_chain( my->_chain_db.get() );
+       } );
+    }
+
+    void client::set_new_block_handler( const new_block_handler& handler )
+    {
+       my->on_chain_thread( [&]() { my->_new_block_handler = handler; } );
+    }
+
+    void client::run_on_chain_thread( const std::function<void()>& task )const
+    {
+       my->on_chain_thread( task );
     }
 
     bts::wallet::wallet_ptr client::get_wallet()const { return my->_wallet; }
+    bts::wallet::wallet_manager_ptr client::get_wallet_manager()const { return my->_wallet_manager; }
     bts::blockchain::chain_database_ptr client::get_chain()const { return my->_chain_db; }
     bts::net::node_ptr client::get_node()const { return my->_p2p_node; }
 
+    uint64_t client::block_cache_hits()const
+    {
+       return my->on_chain_thread( [&](){ return my->_block_message_cache.hits(); } );
+    }
+
+    uint64_t client::block_cache_misses()const
+    {
+       return my->on_chain_thread( [&](){ return my->_block_message_cache.misses(); } );
+    }
+
+    bts::blockchain::storage_stats client::get_storage_stats()const
+    {
+       return my->on_chain_thread( [&]() -> bts::blockchain::storage_stats
+       {
+          FC_ASSERT( my->_chain_db );
+          return my->_chain_db->get_storage_stats();
+       } );
+    }
+
     void client::broadcast_transaction( const signed_transaction& trx )
     {
       if (my->_chain_client)
-        my->_chain_client->broadcast_transaction( trx );
+        my->on_main_thread( [&](){ my->_chain_client->broadcast_transaction( trx ); } );
       else
       {
-        my->_p2p_node->broadcast(trx_message(trx));
+        my->on_main_thread( [&](){ my->_p2p_node->broadcast(trx_message(trx)); } );
         // p2p doesn't send messages back to the originator
         my->on_new_transaction(trx);
       }
@@ -320,7 +870,29 @@ namespace bts { namespace client {
     void client::run_trustee( const fc::ecc::private_key& k )
     {
        my->_trustee_key = k;
-       my->_trustee_loop_complete = fc::async( [=](){ my->trustee_loop(); } );
+       my->on_chain_thread( [&]()
+       {
+          my->_block_template.reset(new bts::blockchain::block_template(*my->_chain_db, my->_pending_trxs));
+          my->_block_template->reset();
+       } );
+       // produce blocks on the thread that applies the blocks we receive
+       my->_trustee_loop_complete = my->_chain_thread.async( [=](){ my->trustee_loop(); } );
+    }
+
+    void client::log_storage_stats( const fc::microseconds& interval )
+    {
+       try {
+          if( my->_storage_stats_loop_complete.valid() && !my->_storage_stats_loop_complete.ready() )
+          {
+             my->_storage_stats_loop_complete.cancel();
+             my->_storage_stats_loop_complete.wait();
+          }
+       }
+       catch ( const fc::canceled_exception& ) {}
+       my->_storage_stats_loop_complete = fc::future<void>();
+       my->_storage_stats_interval = interval;
+       if( interval.count() > 0 && my->_chain_db )
+          my->_storage_stats_loop_complete = my->_chain_thread.async( [=](){ my->storage_stats_loop(); } );
     }
 
     bool client::is_connected() const
@@ -337,11 +909,24 @@ namespace bts { namespace client {
         my->_p2p_node->listen_on_port(port_to_listen);
     }
 
-    void client::configure(const fc::path& configuration_directory)
+    void client::configure(const fc::path& configuration_directory, uint64_t memory_budget_bytes /* = 0 */)
     {
       my->_data_dir = configuration_directory;
       if (my->_p2p_node)
         my->_p2p_node->load_configuration( my->_data_dir );
+
+      my->_memory_budget.set_total(memory_budget_bytes);
+      if (memory_budget_bytes && !my->_memory_budget_loop_complete.valid())
+      {
+        // the caches are resized by rebalance(), on the thread they are used on
+        my->on_chain_thread( [&](){ my->register_memory_budget(); } );
+        my->_memory_budget_loop_complete = my->_chain_thread.async( [=](){ my->memory_budget_loop(); } );
+      }
+    }
+
+    std::vector<bts::db::memory_budget_usage> client::get_memory_usage()const
+    {
+       return my->_memory_budget.get_usage();
     }
 
     fc::path client::get_data_dir()const
@@ -360,11 +945,14 @@ namespace bts { namespace client {
         return;
       bts::net::item_id head_item_id;
       head_item_id.item_type = bts::client::block_message_type;
-      uint32_t last_block_num = my->_chain_db->head_block_num();
-      if (last_block_num == (uint32_t)-1)
-        head_item_id.item_hash = bts::net::item_hash_t();
-      else
-        head_item_id.item_hash = my->_chain_db->head_block_id();
+      my->on_chain_thread( [&]()
+      {
+        uint32_t last_block_num = my->_chain_db->head_block_num();
+        if (last_block_num == (uint32_t)-1)
+          head_item_id.item_hash = bts::net::item_hash_t();
+        else
+          head_item_id.item_hash = my->_chain_db->head_block_id();
+      } );
       my->_p2p_node->sync_from(head_item_id);
       my->_p2p_node->connect_to_p2p_network();
     }
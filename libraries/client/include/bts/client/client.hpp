@@ -1,13 +1,21 @@
 #pragma once
 #include <bts/blockchain/chain_database.hpp>
-#include <bts/wallet/wallet.hpp>
+#include <bts/blockchain/fee_estimator.hpp>
+#include <bts/wallet/wallet_manager.hpp>
 #include <bts/net/node.hpp>
+#include <bts/db/memory_budget.hpp>
 
 namespace bts { namespace client {
 
     using namespace bts::blockchain;
 
     namespace detail { class client_impl; }
+
+    /**
+     *  Called after each block is pushed and the wallet has scanned it, on the thread that
+     *  pushed it.
+     */
+    typedef std::function<void(const signed_block_header&)> new_block_handler;
     
     /** 
      * @class client
@@ -22,6 +30,8 @@ namespace bts { namespace client {
 
          void set_chain( const bts::blockchain::chain_database_ptr& chain );
          void set_wallet( const bts::wallet::wallet_ptr& wall );
+         /** the wallets of the manager are scanned for each new block along with the wallet */
+         void set_wallet_manager( const bts::wallet::wallet_manager_ptr& manager );
 
          /** verifies and then broadcasts the transaction */
          void broadcast_transaction( const signed_transaction& trx );
@@ -34,16 +44,50 @@ namespace bts { namespace client {
 
          void add_node( const std::string& ep );
 
+         /** replaces the handler called for each new block, pass an empty one to stop the calls */
+         void set_new_block_handler( const new_block_handler& handler );
+
+         /**
+          *  Blocks are applied, and the wallets scanned, on a thread of the client.  The chain and
+          *  the wallets may only be used on it, from other threads inside run_on_chain_thread().
+          */
          bts::blockchain::chain_database_ptr get_chain()const;
          bts::wallet::wallet_ptr             get_wallet()const;
+         bts::wallet::wallet_manager_ptr     get_wallet_manager()const;
+
+         /** runs task on the thread that applies blocks and waits for it, exceptions are rethrown */
+         void                                run_on_chain_thread( const std::function<void()>& task )const;
          bts::net::node_ptr                  get_node()const;
 
+         /** how often blocks requested by peers were served from the cache of packed blocks */
+         uint64_t                            block_cache_hits()const;
+         uint64_t                            block_cache_misses()const;
+
+         /** chain_database::get_storage_stats(), read on the thread that applies blocks */
+         bts::blockchain::storage_stats      get_storage_stats()const;
+
+         /**
+          *  Logs chain_database::get_storage_stats() and the block cache counts every interval,
+          *  on the thread that applies blocks.  A zero interval stops logging.
+          */
+         void log_storage_stats( const fc::microseconds& interval );
+
          fc::path                            get_data_dir()const;
 
          // returns true if the client is connected to the network (either server or p2p)
          bool is_connected() const;
 
-         void configure( const fc::path& configuration_directory );
+         /**
+          *  @param memory_budget_bytes - divided among the block cache, the signature cache, the
+          *         cache of unspent outputs and the transaction pools, which are shrunk every few
+          *         seconds to fit, 0 leaves each at its own limit.  Set the chain first.
+          */
+         void configure( const fc::path& configuration_directory, uint64_t memory_budget_bytes = 0 );
+         /** of each cache sharing the memory budget, as of the last time it was rebalanced */
+         std::vector<bts::db::memory_budget_usage> get_memory_usage()const;
+
+         /** the fee rate that gets a transaction included within target_blocks, from precomputed estimates */
+         bts::blockchain::fee_estimate       estimate_fee( uint32_t target_blocks )const;
 
          // functions for taking command-line parameters and passing them on to the p2p node
          void listen_on_port( uint16_t port_to_listen );
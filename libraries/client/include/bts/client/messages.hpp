@@ -7,7 +7,12 @@ namespace bts { namespace client {
    {
       trx_message_type       = 1000,
       block_message_type     = 1001,
-      signature_message_type = 1002
+      signature_message_type = 1002,
+      fetch_block_headers_message_type = 1003,
+      block_headers_message_type       = 1004,
+      compact_block_message_type             = 1005,
+      fetch_block_transactions_message_type  = 1006,
+      block_transactions_message_type        = 1007
    };
 
    struct trx_message
@@ -42,9 +47,78 @@ namespace bts { namespace client {
       fc::ecc::compact_signature   signature;
    };
 
+   /** a peer that asks for more headers than this in one fetch_block_headers_message is disconnected */
+   const uint32_t maximum_block_headers_per_request = 2000;
+
+   /**
+    *  Headers-first synchronization: asks for the headers of blocks the peer listed in a
+    *  blockchain_item_ids_inventory_message so they can be checked before the bodies are fetched.
+    */
+   struct fetch_block_headers_message
+   {
+      static const message_type_enum type;
+
+      std::vector<blockchain::block_id_type> block_ids;
+   };
+
+   /** the headers of the requested blocks, in order, ending at the first block the peer doesn't have */
+   struct block_headers_message
+   {
+      static const message_type_enum type;
+
+      std::vector<bts::blockchain::signed_block_header> headers;
+   };
+
+   /**
+    *  Compact block relay: the id of each transaction is shortened to 8 bytes, salted with
+    *  the block id so that ids that collide in one block are unlikely to collide in the next.
+    */
+   uint64_t short_transaction_id( const blockchain::block_id_type& block_id, const blockchain::transaction_id_type& trx_id );
+
+   /**
+    *  Sent instead of a block_message to peers that already have most of its transactions.
+    *  The receiver rebuilds the block_message and checks it against block_message_hash.
+    */
+   struct compact_block_message
+   {
+      static const message_type_enum type;
+
+      compact_block_message(){}
+      compact_block_message( const block_message& blk, const fc::uint160_t& block_message_hash );
+
+      fc::uint160_t                       block_message_hash; ///< id of the packed block_message
+      blockchain::block_id_type           block_id;
+      bts::blockchain::signed_block_header header;
+      std::vector<uint64_t>               short_trx_ids;
+      fc::ecc::compact_signature          signature;
+   };
+
+   /** asks for the transactions of a compact block that the receiver doesn't have */
+   struct fetch_block_transactions_message
+   {
+      static const message_type_enum type;
+
+      fc::uint160_t          block_message_hash;
+      std::vector<uint32_t>  trx_indexes;
+   };
+
+   /** the transactions requested by a fetch_block_transactions_message, in the same order */
+   struct block_transactions_message
+   {
+      static const message_type_enum type;
+
+      fc::uint160_t                                      block_message_hash;
+      std::vector<bts::blockchain::signed_transaction>   trxs;
+   };
+
 } } // bts::client
 
-FC_REFLECT_ENUM( bts::client::message_type_enum, (trx_message_type)(block_message_type)(signature_message_type) )
+FC_REFLECT_ENUM( bts::client::message_type_enum, (trx_message_type)(block_message_type)(signature_message_type)(fetch_block_headers_message_type)(block_headers_message_type)(compact_block_message_type)(fetch_block_transactions_message_type)(block_transactions_message_type) )
 FC_REFLECT( bts::client::trx_message, (trx) )
 FC_REFLECT( bts::client::block_message, (block_id)(block)(signature) )
 FC_REFLECT( bts::client::signature_message, (block_id)(signature) )
+FC_REFLECT( bts::client::fetch_block_headers_message, (block_ids) )
+FC_REFLECT( bts::client::block_headers_message, (headers) )
+FC_REFLECT( bts::client::compact_block_message, (block_message_hash)(block_id)(header)(short_trx_ids)(signature) )
+FC_REFLECT( bts::client::fetch_block_transactions_message, (block_message_hash)(trx_indexes) )
+FC_REFLECT( bts::client::block_transactions_message, (block_message_hash)(trxs) )
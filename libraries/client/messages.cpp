@@ -1,8 +1,32 @@
 #include <bts/client/messages.hpp>
+#include <fc/crypto/city.hpp>
+#include <string.h>
+
 namespace bts { namespace client {
 
    const message_type_enum trx_message::type       = message_type_enum::trx_message_type;
    const message_type_enum block_message::type     = message_type_enum::block_message_type;
    const message_type_enum signature_message::type = message_type_enum::signature_message_type;
+   const message_type_enum fetch_block_headers_message::type = message_type_enum::fetch_block_headers_message_type;
+   const message_type_enum block_headers_message::type       = message_type_enum::block_headers_message_type;
+   const message_type_enum compact_block_message::type            = message_type_enum::compact_block_message_type;
+   const message_type_enum fetch_block_transactions_message::type = message_type_enum::fetch_block_transactions_message_type;
+   const message_type_enum block_transactions_message::type       = message_type_enum::block_transactions_message_type;
+
+   uint64_t short_transaction_id( const blockchain::block_id_type& block_id, const blockchain::transaction_id_type& trx_id )
+   {
+      char salted_id[sizeof(block_id) + sizeof(trx_id)];
+      memcpy( salted_id, (const char*)&block_id, sizeof(block_id) );
+      memcpy( salted_id + sizeof(block_id), (const char*)&trx_id, sizeof(trx_id) );
+      return fc::city_hash64( salted_id, sizeof(salted_id) );
+   }
+
+   compact_block_message::compact_block_message( const block_message& blk, const fc::uint160_t& block_message_hash )
+   :block_message_hash(block_message_hash),block_id(blk.block_id),header(blk.block),signature(blk.signature)
+   {
+      short_trx_ids.reserve( blk.block.trxs.size() );
+      for( const auto& trx : blk.block.trxs )
+         short_trx_ids.push_back( short_transaction_id( block_id, trx.id() ) );
+   }
 
 } } // bts::client
@@ -0,0 +1,247 @@
+#include <bts/db/executor.hpp>
+#include <bts/db/table_stats.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     /** the cores listed in /sys for a NUMA node, e.g. "0-7,16-23", empty if there is no such node */
+     std::vector<uint32_t> numa_node_cores( int32_t node )
+     {
+        std::vector<uint32_t> cores;
+        std::ifstream in( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+        std::string range;
+        while( std::getline( in, range, ',' ) )
+        {
+           std::istringstream parse( range );
+           uint32_t first = 0, last = 0;
+           char dash = 0;
+           if( !(parse >> first) ) continue;
+           if( !(parse >> dash >> last) ) last = first;
+           for( uint32_t c = first; c <= last; ++c ) cores.push_back( c );
+        }
+        return cores;
+     }
+
+     /** pins the calling thread, an empty set leaves it free to run anywhere */
+     void pin_current_thread( const std::vector<uint32_t>& cores )
+     {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        if( cores.empty() )
+        {
+           for( uint32_t c = 0; c < std::max( 1u, std::thread::hardware_concurrency() ) && c < CPU_SETSIZE; ++c )
+              CPU_SET( c, &set );
+        }
+        for( auto c : cores )
+           if( c < CPU_SETSIZE ) CPU_SET( c, &set );
+        int err = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+        if( err != 0 )
+           wlog( "unable to pin thread to cores ${c}: error ${e}", ("c",cores)("e",err) );
+#else
+        if( !cores.empty() )
+           wlog( "pinning threads to cores is only supported on linux" );
+#endif
+     }
+
+     class thread_pool_impl
+     {
+        public:
+           thread_pool_impl( const std::string& name, uint32_t default_threads )
+           :_name(name),_size(std::max<uint32_t>( 1, default_threads )),_configured(false),_numa_node(-1),
+            _next(0),_queued(0),_max_queued(0),_completed(0),_wait_us(0),_run_us(0){}
+
+           /** the cores thread i may run on, caller must hold _mutex */
+           std::vector<uint32_t> cores_of( uint32_t i )const
+           {
+              if( !_cores.empty() ) return std::vector<uint32_t>( 1, _cores[i % _cores.size()] );
+              if( _numa_node >= 0 ) return numa_node_cores( _numa_node );
+              return std::vector<uint32_t>();
+           }
+
+           std::string                               _name;
+           mutable std::mutex                        _mutex;
+           uint32_t                                  _size;
+           bool                                      _configured;
+           std::vector<uint32_t>                     _cores;
+           int32_t                                   _numa_node;
+           std::vector<std::unique_ptr<fc::thread> > _threads;
+
+           std::atomic<uint32_t>                     _next;
+           std::atomic<uint64_t>                     _queued;
+           std::atomic<uint64_t>                     _max_queued;
+           std::atomic<uint64_t>                     _completed;
+           std::atomic<uint64_t>                     _wait_us;
+           std::atomic<uint64_t>                     _run_us;
+     };
+
+     class executor_impl
+     {
+        public:
+           executor_impl()
+           {
+              uint32_t cores = std::max( 1u, std::thread::hardware_concurrency() );
+              // the defaults match the threads each of these created for itself before
+              add( "network",    std::min( 4u, std::max( 2u, cores ) - 1 ) );
+              add( "validation", cores );
+              add( "signature",  cores );
+              add( "storage",    1 );
+              add( "rpc",        2 );
+              add( "mining",     cores );
+           }
+
+           void add( const std::string& name, uint32_t threads )
+           {
+              _pools[name].reset( new thread_pool( name, threads ) );
+           }
+
+           std::map<std::string, std::unique_ptr<thread_pool> > _pools;
+     };
+  }
+
+  thread_pool::thread_pool( const std::string& name, uint32_t default_threads )
+  :my( new detail::thread_pool_impl( name, default_threads ) )
+  {
+  }
+
+  thread_pool::~thread_pool()
+  {
+  }
+
+  const std::string& thread_pool::name()const { return my->_name; }
+
+  uint32_t thread_pool::size()const
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     return my->_size;
+  }
+
+  void thread_pool::configure( const thread_pool_config& config )
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     if( config.threads )
+     {
+        my->_size       = config.threads;
+        my->_configured = true;
+     }
+     my->_cores     = config.cores;
+     my->_numa_node = config.numa_node;
+     for( uint32_t i = 0; i < my->_threads.size(); ++i )
+     {
+        auto cores = my->cores_of( i );
+        my->_threads[i]->async( [cores](){ detail::pin_current_thread( cores ); } ).wait();
+     }
+  }
+
+  void thread_pool::set_default_size( uint32_t threads )
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     if( !my->_configured ) my->_size = std::max<uint32_t>( 1, threads );
+  }
+
+  fc::thread& thread_pool::thread( uint32_t i )
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     i %= my->_size;
+     while( my->_threads.size() <= i )
+     {
+        my->_threads.emplace_back( new fc::thread( my->_name ) );
+        auto cores = my->cores_of( my->_threads.size() - 1 );
+        if( !cores.empty() )
+           my->_threads.back()->async( [cores](){ detail::pin_current_thread( cores ); } ).wait();
+     }
+     return *my->_threads[i];
+  }
+
+  uint32_t thread_pool::next_thread()
+  {
+     return my->_next.fetch_add( 1, std::memory_order_relaxed );
+  }
+
+  int64_t thread_pool::task_queued()
+  {
+     uint64_t queued = my->_queued.fetch_add( 1, std::memory_order_relaxed ) + 1;
+     uint64_t max    = my->_max_queued.load( std::memory_order_relaxed );
+     while( queued > max && !my->_max_queued.compare_exchange_weak( max, queued, std::memory_order_relaxed ) ) {}
+     return table_counters::now_us();
+  }
+
+  int64_t thread_pool::task_started( int64_t queued )
+  {
+     int64_t now = table_counters::now_us();
+     my->_queued.fetch_sub( 1, std::memory_order_relaxed );
+     my->_wait_us.fetch_add( std::max<int64_t>( 0, now - queued ), std::memory_order_relaxed );
+     return now;
+  }
+
+  void thread_pool::task_finished( int64_t started )
+  {
+     my->_completed.fetch_add( 1, std::memory_order_relaxed );
+     my->_run_us.fetch_add( std::max<int64_t>( 0, table_counters::now_us() - started ), std::memory_order_relaxed );
+  }
+
+  thread_pool_stats thread_pool::get_stats()const
+  {
+     thread_pool_stats stats;
+     stats.name       = my->_name;
+     stats.threads    = size();
+     stats.queued     = my->_queued.load( std::memory_order_relaxed );
+     stats.max_queued = my->_max_queued.load( std::memory_order_relaxed );
+     stats.completed  = my->_completed.load( std::memory_order_relaxed );
+     stats.wait_us    = my->_wait_us.load( std::memory_order_relaxed );
+     stats.run_us     = my->_run_us.load( std::memory_order_relaxed );
+     return stats;
+  }
+
+  executor::executor()
+  :my( new detail::executor_impl() )
+  {
+  }
+
+  executor::~executor()
+  {
+  }
+
+  executor& executor::instance()
+  {
+     static executor pools;
+     return pools;
+  }
+
+  void executor::configure( const std::vector<thread_pool_config>& pools )
+  { try {
+     for( const auto& config : pools )
+        pool( config.name ).configure( config );
+  } FC_RETHROW_EXCEPTIONS( warn, "unable to configure the thread pools" ) }
+
+  thread_pool& executor::pool( const std::string& name )
+  {
+     auto itr = my->_pools.find( name );
+     FC_ASSERT( itr != my->_pools.end(), "unknown thread pool ${name}", ("name",name) );
+     return *itr->second;
+  }
+
+  std::vector<thread_pool_stats> executor::get_stats()const
+  {
+     std::vector<thread_pool_stats> stats;
+     for( const auto& p : my->_pools ) stats.push_back( p.second->get_stats() );
+     return stats;
+  }
+
+} } // bts::db
@@ -0,0 +1,214 @@
+#pragma once
+#include <bts/db/level_map.hpp>
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace bts { namespace db {
+
+  /**
+   *  @brief a level_map with a bounded, least recently used cache of values in front of it
+   *
+   *  Writes go through to the underlying level_map (and are staged if a batch is
+   *  open) and update the cache.  Aborting a batch clears the cache because it may
+   *  hold values that were never committed.
+   *
+   *  @note Key must be usable with std::hash
+   */
+  template<typename Key, typename Value>
+  class cached_level_map
+  {
+     public:
+        cached_level_map( size_t max_cache_size = 100000 )
+        :_max_cache_size(max_cache_size),_hits(0),_misses(0){}
+
+        void open( const fc::path& dir, bool create = true, const level_options& options = level_options() )
+        {
+           clear_cache();
+           _db.open( dir, create, options );
+        }
+
+        void open( const kv_backend_ptr& db, const std::string& prefix )
+        {
+           clear_cache();
+           _db.open( db, prefix );
+        }
+
+        void close()
+        {
+           clear_cache();
+           _db.close();
+        }
+
+        void set_max_cache_size( size_t s )
+        {
+           _max_cache_size = s;
+           while( _cache.size() > _max_cache_size ) evict();
+        }
+
+        void begin_batch()                          { _db.begin_batch();        }
+        void commit_batch( bool sync = false )      { _db.commit_batch( sync ); }
+        void flush_batch( kv_batch& batch )         { _db.flush_batch( batch ); }
+        void abort_batch()                          { _db.abort_batch(); clear_cache(); }
+
+        table_stats get_stats()const                { return _db.get_stats(); }
+        bool get_property( const std::string& name, std::string& value )const { return _db.get_property( name, value ); }
+
+        /**
+         *  @return a pointer to the cached value or nullptr if k does not exist, the
+         *  pointer is only valid until the next call that modifies this map
+         */
+        const Value* find( const Key& k )
+        {
+           auto itr = _cache.find( k );
+           if( itr != _cache.end() )
+           {
+              ++_hits;
+              _lru.splice( _lru.begin(), _lru, itr->second.second );
+              return &itr->second.first;
+           }
+           ++_misses;
+
+           Value v;
+           bool found = _db.with_value( k, [&]( const char* data, size_t size )
+           {
+              fc::datastream<const char*> ds( data, size );
+              fc::raw::unpack( ds, v );
+           });
+           if( !found ) return nullptr;
+           return &insert( k, std::move(v) );
+        }
+
+        /**
+         *  Reads the values of the keys that are neither cached nor staged in the open batch
+         *  into the cache, so that the find() calls that follow are hits.  The keys should be
+         *  sorted by their encoding so that LevelDB reads neighbouring blocks in turn and
+         *  without duplicates.  At most max_cache_size values are read.
+         *
+         *  for_ranges( count, read ) must call read( begin, end ) for ranges covering
+         *  [0,count), possibly on several threads at once: each range reads from the same
+         *  snapshot into values of its own.
+         *
+         *  @return the number of values read into the cache
+         */
+        template<typename ForRanges>
+        size_t prefetch( const std::vector<Key>& keys, ForRanges&& for_ranges )
+        {
+           std::vector<const Key*> missing;
+           for( const Key& k : keys )
+           {
+              if( missing.size() >= _max_cache_size ) break;
+              if( _cache.find( k ) == _cache.end() && !_db.is_staged( k ) )
+                 missing.push_back( &k );
+           }
+           if( missing.empty() ) return 0;
+
+           auto                snapshot = _db.snapshot();
+           std::vector<Value>  values( missing.size() );
+           std::vector<char>   found( missing.size() );
+           for_ranges( missing.size(), [&]( size_t begin, size_t end )
+           {
+              for( size_t i = begin; i < end; ++i )
+                 found[i] = _db.fetch( *missing[i], values[i], snapshot );
+           });
+
+           size_t loaded = 0;
+           for( size_t i = 0; i < missing.size(); ++i )
+           {
+              if( !found[i] || _cache.find( *missing[i] ) != _cache.end() ) continue;
+              insert( *missing[i], std::move( values[i] ) );
+              ++loaded;
+           }
+           _misses += missing.size();
+           return loaded;
+        }
+
+        Value fetch( const Key& k )
+        {
+           auto v = find( k );
+           if( !v )
+           {
+              FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+           }
+           return *v;
+        }
+
+        void store( const Key& k, const Value& v )
+        {
+           _db.store( k, v );
+           auto itr = _cache.find( k );
+           if( itr != _cache.end() ) erase( itr );
+           insert( k, v );
+        }
+
+        void remove( const Key& k )
+        {
+           _db.remove( k );
+           auto itr = _cache.find( k );
+           if( itr != _cache.end() ) erase( itr );
+        }
+
+        typename level_map<Key,Value>::iterator begin( const level_snapshot& snapshot = level_snapshot() )const
+        {
+           return _db.begin( snapshot );
+        }
+
+        level_snapshot snapshot()const { return _db.snapshot(); }
+
+        /** reads k as of snapshot without going through the cache, may be called from any thread */
+        bool fetch( const Key& k, Value& v, const level_snapshot& snapshot )const
+        {
+           return _db.fetch( k, v, snapshot );
+        }
+
+        uint64_t cache_hits()const   { return _hits;   }
+        uint64_t cache_misses()const { return _misses; }
+        size_t   cache_size()const   { return _cache.size(); }
+
+     private:
+        typedef std::list<Key>                                                          lru_list;
+        typedef std::unordered_map<Key, std::pair<Value,typename lru_list::iterator> >  cache_type;
+
+        const Value& insert( const Key& k, Value v )
+        {
+           if( _max_cache_size == 0 )
+           {
+              _uncached = std::move(v);
+              return _uncached;
+           }
+           while( _cache.size() >= _max_cache_size ) evict();
+           _lru.push_front( k );
+           auto result = _cache.insert( std::make_pair( k, std::make_pair( std::move(v), _lru.begin() ) ) );
+           return result.first->second.first;
+        }
+
+        void erase( typename cache_type::iterator itr )
+        {
+           _lru.erase( itr->second.second );
+           _cache.erase( itr );
+        }
+
+        void evict()
+        {
+           auto itr = _cache.find( _lru.back() );
+           if( itr != _cache.end() ) _cache.erase( itr );
+           _lru.pop_back();
+        }
+
+        void clear_cache()
+        {
+           _cache.clear();
+           _lru.clear();
+        }
+
+        level_map<Key,Value>   _db;
+        size_t                 _max_cache_size;
+        cache_type             _cache;
+        lru_list               _lru;
+        Value                  _uncached;
+        uint64_t               _hits;
+        uint64_t               _misses;
+  };
+
+} } // bts::db
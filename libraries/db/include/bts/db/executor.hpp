@@ -0,0 +1,122 @@
+#pragma once
+#include <fc/thread/thread.hpp>
+#include <fc/reflect/reflect.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bts { namespace db {
+
+  namespace detail { class thread_pool_impl; class executor_impl; }
+
+  /** how many threads a pool has and where they run */
+  struct thread_pool_config
+  {
+     thread_pool_config():threads(0),numa_node(-1){}
+
+     std::string            name;
+     uint32_t               threads;    ///< 0 keeps the pool's default
+     std::vector<uint32_t>  cores;      ///< thread i is pinned to cores[i % cores.size()]
+     int32_t                numa_node;  ///< without cores the threads may run on any core of this node, -1 for any node
+  };
+
+  /** counted since the pool was created, the times are summed over every task */
+  struct thread_pool_stats
+  {
+     thread_pool_stats():threads(0),queued(0),max_queued(0),completed(0),wait_us(0),run_us(0){}
+
+     std::string name;
+     uint32_t    threads;
+     uint64_t    queued;      ///< tasks waiting to start now
+     uint64_t    max_queued;
+     uint64_t    completed;
+     uint64_t    wait_us;     ///< from async() until the task started
+     uint64_t    run_us;
+  };
+
+  /**
+   *  A fixed set of fc::threads, created on first use.  Tasks given to async() go to the
+   *  threads in turn and are counted in get_stats(), work that must stay on one thread
+   *  can use thread(i) directly.  A thread is pinned to its cores when it is created and
+   *  again when the pool is configured.
+   */
+  class thread_pool
+  {
+     public:
+        thread_pool( const std::string& name, uint32_t default_threads );
+        ~thread_pool();
+
+        const std::string& name()const;
+        uint32_t           size()const;
+
+        /** threads beyond a smaller size are kept, thread(i) and async() stop using them */
+        void configure( const thread_pool_config& config );
+        /** the size used until configure() sets one, for pools sized by their users' own options */
+        void set_default_size( uint32_t threads );
+
+        /** thread i % size() */
+        fc::thread& thread( uint32_t i );
+
+        template<typename Functor>
+        auto async( Functor&& f ) -> fc::future<decltype(f())>
+        {
+           int64_t queued = task_queued();
+           return thread( next_thread() ).async( [this,queued,f]() mutable
+           {
+              task_timer timer( *this, queued );
+              return f();
+           } );
+        }
+
+        thread_pool_stats get_stats()const;
+
+     private:
+        struct task_timer
+        {
+           task_timer( thread_pool& p, int64_t queued ):pool(p),started(p.task_started( queued )){}
+           ~task_timer() { pool.task_finished( started ); }
+           thread_pool& pool;
+           int64_t      started;
+        };
+
+        uint32_t next_thread();
+        int64_t  task_queued();
+        int64_t  task_started( int64_t queued );
+        void     task_finished( int64_t started );
+
+        std::unique_ptr<detail::thread_pool_impl> my;
+  };
+
+  /**
+   *  The thread pools of the process by name: network, validation, signature, storage, rpc
+   *  and mining.  Configure them before the work starts, on a machine with several NUMA
+   *  nodes pinning mining and validation to different nodes keeps the mining threads from
+   *  evicting the chain state from the caches of the validation threads.  Memory allocated
+   *  by a pinned thread is placed on its node by the kernel's default first-touch policy.
+   */
+  class executor
+  {
+     public:
+        static executor& instance();
+
+        /** @throw if a name is not one of the pools */
+        void configure( const std::vector<thread_pool_config>& pools );
+
+        /** @throw if name is not one of the pools */
+        thread_pool& pool( const std::string& name );
+
+        std::vector<thread_pool_stats> get_stats()const;
+
+     private:
+        executor();
+        ~executor();
+
+        std::unique_ptr<detail::executor_impl> my;
+  };
+
+} } // bts::db
+
+FC_REFLECT( bts::db::thread_pool_config, (name)(threads)(cores)(numa_node) )
+FC_REFLECT( bts::db::thread_pool_stats, (name)(threads)(queued)(max_queued)(completed)(wait_us)(run_us) )
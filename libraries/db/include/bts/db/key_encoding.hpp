@@ -0,0 +1,131 @@
+#pragma once
+#include <fc/io/raw.hpp>
+#include <fc/crypto/ripemd160.hpp>
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace bts { namespace db {
+
+  /**
+   *  @brief defines how the keys of a level_map are laid out on disk
+   *
+   *  When is_ordered is true the encoded bytes sort in the same order as
+   *  Key::operator< so the database can use leveldb's bytewise comparator
+   *  instead of unpacking both keys on every comparison.
+   *
+   *  The default encoding is fc::raw, which is not order preserving.  Key types
+   *  that are stored in a level_map should specialize this template, the helpers
+   *  below make it easy to build big-endian composite keys.
+   */
+  template<typename Key, typename Enable = void>
+  struct key_encoding
+  {
+     static const bool is_ordered = false;
+
+     static void pack( std::vector<char>& out, const Key& k )
+     {
+        // sized by a counting pass so that a reused out does not allocate
+        out.resize( fc::raw::pack_size( k ) );
+        fc::datastream<char*> ds( out.data(), out.size() );
+        fc::raw::pack( ds, k );
+     }
+
+     static void unpack( const char* data, size_t size, Key& k )
+     {
+        fc::datastream<const char*> ds( data, size );
+        fc::raw::unpack( ds, k );
+     }
+  };
+
+  /** appends the low *bytes* bytes of v to out, most significant byte first */
+  inline void pack_big_endian( std::vector<char>& out, uint64_t v, size_t bytes )
+  {
+     for( size_t i = bytes; i > 0; --i )
+        out.push_back( char( (v >> (8*(i-1))) & 0xff ) );
+  }
+
+  inline uint64_t unpack_big_endian( const char* data, size_t bytes )
+  {
+     uint64_t v = 0;
+     for( size_t i = 0; i < bytes; ++i )
+        v = (v << 8) | uint8_t(data[i]);
+     return v;
+  }
+
+  template<typename Key>
+  struct key_encoding<Key, typename std::enable_if<std::is_integral<Key>::value && std::is_unsigned<Key>::value>::type>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const Key& k )
+     {
+        out.clear();
+        pack_big_endian( out, k, sizeof(Key) );
+     }
+
+     static void unpack( const char* data, size_t size, Key& k )
+     {
+        FC_ASSERT( size == sizeof(Key) );
+        k = Key( unpack_big_endian( data, sizeof(Key) ) );
+     }
+  };
+
+  /** signed integers have their sign bit flipped so negative values sort first */
+  template<typename Key>
+  struct key_encoding<Key, typename std::enable_if<std::is_integral<Key>::value && std::is_signed<Key>::value>::type>
+  {
+     typedef typename std::make_unsigned<Key>::type unsigned_key;
+     static const bool is_ordered = true;
+     static const unsigned_key sign_bit = unsigned_key(1) << (8*sizeof(Key)-1);
+
+     static void pack( std::vector<char>& out, const Key& k )
+     {
+        out.clear();
+        pack_big_endian( out, unsigned_key(k) ^ sign_bit, sizeof(Key) );
+     }
+
+     static void unpack( const char* data, size_t size, Key& k )
+     {
+        FC_ASSERT( size == sizeof(Key) );
+        k = Key( unsigned_key( unpack_big_endian( data, sizeof(Key) ) ) ^ sign_bit );
+     }
+  };
+
+  /** ripemd160 compares with memcmp so its raw bytes are already ordered */
+  template<>
+  struct key_encoding<fc::ripemd160>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const fc::ripemd160& k )
+     {
+        out.assign( (const char*)&k._hash[0], (const char*)&k._hash[0] + sizeof(k._hash) );
+     }
+
+     static void unpack( const char* data, size_t size, fc::ripemd160& k )
+     {
+        FC_ASSERT( size == sizeof(k._hash) );
+        memcpy( (char*)&k._hash[0], data, size );
+     }
+  };
+
+  /** the length prefix is dropped so strings sort lexicographically */
+  template<>
+  struct key_encoding<std::string>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const std::string& k )
+     {
+        out.assign( k.begin(), k.end() );
+     }
+
+     static void unpack( const char* data, size_t size, std::string& k )
+     {
+        k.assign( data, size );
+     }
+  };
+
+} } // bts::db
@@ -0,0 +1,157 @@
+#pragma once
+#include <bts/db/level_options.hpp>
+#include <fc/filesystem.hpp>
+
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace bts { namespace db {
+
+  /** a range of bytes owned by someone else */
+  struct kv_slice
+  {
+     kv_slice():data(nullptr),size(0){}
+     kv_slice( const char* d, size_t s ):data(d),size(s){}
+     kv_slice( const std::string& s ):data(s.data()),size(s.size()){}
+
+     bool starts_with( const std::string& prefix )const
+     {
+        return size >= prefix.size() && memcmp( data, prefix.data(), prefix.size() ) == 0;
+     }
+
+     const char* data;
+     size_t      size;
+  };
+
+  /** orders the keys of a table whose key_encoding is not ordered */
+  class kv_comparator
+  {
+     public:
+        virtual ~kv_comparator(){}
+        virtual int         compare( const kv_slice& a, const kv_slice& b )const = 0;
+        /** stored with the table, a table must be reopened with a comparator of the same name */
+        virtual const char* name()const = 0;
+  };
+
+  /** pins the contents of a backend as of when it was taken, released with its last copy */
+  class kv_snapshot
+  {
+     public:
+        virtual ~kv_snapshot(){}
+  };
+  typedef std::shared_ptr<const kv_snapshot> kv_snapshot_ptr;
+
+  /** positioned on a key of a backend, slices are valid until the iterator moves */
+  class kv_iterator
+  {
+     public:
+        virtual ~kv_iterator(){}
+
+        virtual bool     valid()const = 0;
+        virtual void     seek_to_first() = 0;
+        virtual void     seek_to_last() = 0;
+        /** positions the iterator on the first key that is not less than key */
+        virtual void     seek( const kv_slice& key ) = 0;
+        virtual void     next() = 0;
+        virtual void     prev() = 0;
+        virtual kv_slice key()const = 0;
+        virtual kv_slice value()const = 0;
+        /** throws if the last move failed for any other reason than reaching an end */
+        virtual void     check_status()const = 0;
+  };
+
+  /** mutations that a backend applies atomically with write() */
+  class kv_batch
+  {
+     public:
+        virtual ~kv_batch(){}
+        virtual void put( const kv_slice& key, const kv_slice& value ) = 0;
+        virtual void remove( const kv_slice& key ) = 0;
+  };
+
+  /**
+   *  @class kv_backend
+   *  @brief the ordered key value store under a level_map
+   *
+   *  get() and iterators given a snapshot may be called from any thread while another
+   *  one writes, everything else is called by one thread at a time.
+   */
+  class kv_backend
+  {
+     public:
+        virtual ~kv_backend(){}
+
+        /** @return false if key was not found, snapshot may be null to read the latest state */
+        virtual bool                         get( const kv_slice& key, std::string& value, const kv_snapshot* snapshot = nullptr )const = 0;
+        virtual void                         put( const kv_slice& key, const kv_slice& value ) = 0;
+        virtual void                         remove( const kv_slice& key ) = 0;
+
+        virtual std::unique_ptr<kv_batch>    create_batch()const = 0;
+        /** @param sync - flush the write ahead log, or whatever the backend has, before returning */
+        virtual void                         write( kv_batch& batch, bool sync = false ) = 0;
+
+        virtual kv_snapshot_ptr              snapshot()const = 0;
+        virtual std::unique_ptr<kv_iterator> iterate( const kv_snapshot* snapshot = nullptr )const = 0;
+
+        /**
+         *  Reports on the internals of the backend, LevelDB answers "leveldb.stats",
+         *  "leveldb.num-files-at-level<N>" and "leveldb.approximate-memory-usage".
+         *
+         *  @return false if the backend does not know the property
+         */
+        virtual bool                         get_property( const std::string& name, std::string& value )const { return false; }
+  };
+  typedef std::shared_ptr<kv_backend> kv_backend_ptr;
+
+  /**
+   *  What a level_map tells the backend about the table it opens in a directory, so that
+   *  a backend that can upgrade tables written by older versions knows how.
+   */
+  struct kv_table_info
+  {
+     kv_table_info():record_type(""),record_type_size(0){}
+
+     /** null if the key encoding is ordered and keys compare bytewise, backends keep it as long as the table */
+     std::shared_ptr<const kv_comparator>       comparator;
+     /** orders keys written with fc::raw, the order of tables written before the key encoding */
+     std::shared_ptr<const kv_comparator>       legacy_comparator;
+     /** fc::get_typename of the value and its size, for upgrades of the value type */
+     const char*                                record_type;
+     size_t                                     record_type_size;
+     /** converts a key written with fc::raw to the current encoding, null if keys were never unordered */
+     std::function<std::string(const kv_slice&)> reencode_legacy_key;
+  };
+
+  /**
+   *  Opens a table in dir, a null table is a database shared by several prefixed level_maps,
+   *  which compares keys bytewise.
+   */
+  typedef std::function<kv_backend_ptr( const fc::path& dir, bool create, const level_options& options,
+                                        const kv_table_info* table )> kv_backend_factory;
+
+  /**
+   *  Backends by the name that level_options::backend selects them with.  "leveldb" and
+   *  "memory" are always registered.
+   */
+  class kv_backend_registry
+  {
+     public:
+        static kv_backend_registry& instance();
+
+        /** called before any table is opened with name */
+        void           add_backend( const std::string& name, const kv_backend_factory& factory );
+        bool           has_backend( const std::string& name )const;
+
+        /** opens dir with the backend named by options.backend */
+        kv_backend_ptr open( const fc::path& dir, bool create, const level_options& options,
+                             const kv_table_info* table )const;
+
+     private:
+        kv_backend_registry();
+        std::map<std::string,kv_backend_factory> _factories;
+  };
+
+} } // bts::db
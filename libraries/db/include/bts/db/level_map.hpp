@@ -1,8 +1,6 @@
 #pragma once
-#include <leveldb/db.h>
-#include <leveldb/comparator.h>
-
 #include <fc/filesystem.hpp>
+#include <fc/optional.hpp>
 
 #include <fc/reflect/reflect.hpp>
 #include <fc/io/raw.hpp>
@@ -10,123 +8,394 @@
 
 #include <fc/log/logger.hpp>
 
-#include <bts/db/upgrade_leveldb.hpp>
+#include <bts/db/kv_backend.hpp>
+#include <bts/db/key_encoding.hpp>
+#include <bts/db/table_stats.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
 
 namespace bts { namespace db {
 
-  namespace ldb = leveldb;
+  /** a snapshot of the backend of a level_map, released with its last copy */
+  typedef kv_snapshot_ptr level_snapshot;
+
+  namespace detail
+  {
+     /** keep their capacity between calls, so that steady state reads and writes don't allocate */
+     struct scratch_buffers
+     {
+        scratch_buffers():in_use(false){}
+
+        std::vector<char>  key;
+        std::string        value;
+        std::vector<char>  pack;
+        bool               in_use;
+     };
+
+     /**
+      *  The scratch buffers of the calling thread, shared by every level_map on it.  A call
+      *  made while they are leased, from a visitor or by another task of the thread, gets
+      *  buffers of its own instead.
+      */
+     class scratch_lease
+     {
+        public:
+           scratch_lease():_shared( thread_buffers() ),_buffers( &_shared )
+           {
+              if( _shared.in_use ) _buffers = &_own;
+              else                 _shared.in_use = true;
+           }
+           ~scratch_lease() { if( _buffers == &_shared ) _shared.in_use = false; }
+
+           scratch_buffers* operator->()const { return _buffers; }
+
+        private:
+           scratch_lease( const scratch_lease& );
+           scratch_lease& operator=( const scratch_lease& );
+
+           static scratch_buffers& thread_buffers()
+           {
+              static thread_local scratch_buffers buffers;
+              return buffers;
+           }
+
+           scratch_buffers&  _shared;
+           scratch_buffers   _own;
+           scratch_buffers*  _buffers;
+     };
+  }
 
   /**
-   *  @brief implements a high-level API on top of Level DB that stores items using fc::raw / reflection
+   *  @brief implements a high-level API on top of a kv_backend that stores items using fc::raw / reflection
+   *
+   *  The backend of a map is chosen by level_options::backend when it is opened, LevelDB
+   *  unless another one was registered with kv_backend_registry.
+   *
+   *  Mutations may be grouped by calling begin_batch().  While a batch is open
+   *  store() and remove() are staged in memory and fetch() will see the staged
+   *  values, but nothing is written to the database until commit_batch() applies
+   *  all of them as a single kv_batch.  Iterators only see committed data.
+   *
+   *  Several level_maps can share one backend by opening them with distinct
+   *  key prefixes, in which case their batches can be combined with flush_batch().
    *
+   *  Reads given a snapshot() see the committed contents of the database as of when
+   *  it was taken.  They use no state of the map besides the database, so they may be
+   *  made from any thread while another one writes.
+   *
+   *  Every read and write that reaches the database is counted and timed, see get_stats().
    */
   template<typename Key, typename Value>
   class level_map
   {
      public:
-        void open( const fc::path& dir, bool create = true )
-        {
-           ldb::Options opts;
-           opts.create_if_missing = create;
-           opts.comparator = & _comparer;
+        level_map():_batching(false),_stats( std::make_shared<table_counters>() ){}
 
-           /// \waring Given path must exist to succeed toNativeAnsiPath
-           fc::create_directories(dir);
-
-           std::string ldbPath = dir.to_native_ansi_path();
+        void open( const fc::path& dir, bool create = true, const level_options& options = level_options() )
+        {
+           _db.reset();
+           _prefix.clear();
+
+           kv_table_info table;
+           auto comparer = std::make_shared<key_compare>();
+           if( !key_encoding<Key>::is_ordered )
+              table.comparator = comparer;
+           else
+              table.reencode_legacy_key = &reencode_legacy_key;
+           table.legacy_comparator = comparer;
+           table.record_type       = fc::get_typename<Value>::name();
+           table.record_type_size  = sizeof(Value);
+
+           _db = kv_backend_registry::instance().open( dir, create, options, &table );
+        }
 
-           ldb::DB* ndb = nullptr;
-           auto ntrxstat = ldb::DB::Open( opts, ldbPath.c_str(), &ndb );
-           if( !ntrxstat.ok() )
-           {
-               FC_THROW_EXCEPTION( db_in_use_exception, "Unable to open database ${db}\n\t${msg}",
-                    ("db",dir)
-                    ("msg",ntrxstat.ToString())
-                    );
-           }
-           _db.reset(ndb);
-           try_upgrade_db( dir,ndb, fc::get_typename<Value>::name(),sizeof(Value) );
+        /**
+         *  Stores this map in a keyspace of db that is shared with other maps, every
+         *  key is prefixed with *prefix* which must not be a prefix of any other
+         *  map's prefix.  The database must compare keys bytewise.
+         *
+         *  @note database value upgrades via RECORD_TYPE are not performed for shared databases
+         */
+        void open( const kv_backend_ptr& db, const std::string& prefix )
+        {
+           static_assert( key_encoding<Key>::is_ordered, "shared databases require an ordered key_encoding" );
+           FC_ASSERT( db != nullptr );
+           FC_ASSERT( prefix.size() > 0 && uint8_t(prefix.back()) != 0xff );
+           _db     = db;
+           _prefix = prefix;
         }
 
         void close()
         {
+          abort_batch();
           _db.reset();
         }
 
-        Value fetch( const Key& k )
+        /**
+         *  Starts staging all calls to store() and remove() until commit_batch()
+         *  or abort_batch() is called.
+         */
+        void begin_batch()
+        {
+          FC_ASSERT( !_batching, "a write batch is already in progress" );
+          _batching = true;
+        }
+
+        bool in_batch()const { return _batching; }
+
+        /** @return true if the open batch stores or removes k, which a snapshot would not see */
+        bool is_staged( const Key& k )const { return _batching && _pending.find( k ) != _pending.end(); }
+
+        /**
+         *  Writes every staged mutation to the database atomically.
+         *
+         *  @param sync - flush the write ahead log before returning
+         */
+        void commit_batch( bool sync = false )
         {
           try {
-             std::vector<char> kslice = fc::raw::pack( k );
-             ldb::Slice ks( kslice.data(), kslice.size() );
+             FC_ASSERT( _batching, "no write batch is in progress" );
+             FC_ASSERT( _db != nullptr );
+
+             auto batch = _db->create_batch();
+             flush_batch( *batch );
+             int64_t start = table_counters::now_us();
+             _db->write( *batch, sync );
+             _stats->write_latency.record( table_counters::now_us() - start );
+          } FC_RETHROW_EXCEPTIONS( warn, "error committing write batch" );
+        }
+
+        /**
+         *  Moves every staged mutation into batch and ends the current batch, the
+         *  caller is responsible for writing batch to the shared database.
+         */
+        void flush_batch( kv_batch& batch )
+        {
+          FC_ASSERT( _batching, "no write batch is in progress" );
+          detail::scratch_lease scratch;
+          for( auto itr = _pending.begin(); itr != _pending.end(); ++itr )
+          {
+             make_key( scratch->key, itr->first );
+             kv_slice ks( scratch->key.data(), scratch->key.size() );
+             if( itr->second )
+             {
+                const auto& vec = pack_value( scratch->pack, *itr->second );
+                batch.put( ks, kv_slice( vec.data(), vec.size() ) );
+                _stats->record_write( ks.size, vec.size() );
+             }
+             else
+             {
+                batch.remove( ks );
+                _stats->record_remove( ks.size );
+             }
+          }
+          _stats->batches.fetch_add( 1, std::memory_order_relaxed );
+          _pending.clear();
+          _batching = false;
+        }
+
+        /** discards all staged mutations */
+        void abort_batch()
+        {
+          _pending.clear();
+          _batching = false;
+        }
+
+        /** counted since the map was created, reopening it keeps the counts */
+        table_stats get_stats()const { return _stats->get(); }
+
+        /**
+         *  A property of the database, see kv_backend::get_property().  Maps that share a
+         *  database report the same properties.
+         */
+        bool get_property( const std::string& name, std::string& value )const
+        {
+           return _db && _db->get_property( name, value );
+        }
+
+        /** pins the committed contents of the database, maps that share a database can share it */
+        level_snapshot snapshot()const
+        {
+           FC_ASSERT( _db != nullptr );
+           return _db->snapshot();
+        }
+
+        /**
+         *  Reads the value k had when snapshot was taken, staged mutations are ignored.
+         *
+         *  @return false if k was not found
+         */
+        bool fetch( const Key& k, Value& v, const level_snapshot& snapshot )const
+        {
+          try {
+             FC_ASSERT( snapshot != nullptr );
+             std::vector<char> kslice;
+             make_key( kslice, k );
              std::string value;
-             auto status = _db->Get( ldb::ReadOptions(), ks, &value );
-             if( status.IsNotFound() )
+             int64_t start = table_counters::now_us();
+             bool found = _db->get( kv_slice( kslice.data(), kslice.size() ), value, snapshot.get() );
+             _stats->record_read( start, found, value.size() );
+             if( !found )
+             {
+               return false;
+             }
+             fc::datastream<const char*> ds( value.data(), value.size() );
+             fc::raw::unpack( ds, v );
+             return true;
+          } FC_RETHROW_EXCEPTIONS( warn, "error fetching key ${key}", ("key",k) );
+        }
+
+        Value fetch( const Key& k )
+        {
+          Value tmp;
+          fetch_into( k, tmp );
+          return tmp;
+        }
+
+        /**
+         *  Unpacks the value stored at k directly into v so that callers fetching
+         *  in a loop can reuse the storage already allocated by v.
+         */
+        void fetch_into( const Key& k, Value& v )
+        {
+          try {
+             if( _batching )
+             {
+                auto itr = _pending.find( k );
+                if( itr != _pending.end() )
+                {
+                   if( !itr->second )
+                   {
+                     FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+                   }
+                   v = *itr->second;
+                   return;
+                }
+             }
+             bool found = with_value( k, [&]( const char* data, size_t size )
+             {
+                fc::datastream<const char*> ds( data, size );
+                fc::raw::unpack( ds, v );
+             });
+             if( !found )
              {
                FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
              }
-             if( !status.ok() )
+          } FC_RETHROW_EXCEPTIONS( warn, "error fetching key ${key}", ("key",k) );
+        }
+
+        /**
+         *  Calls visit( const char* data, size_t size ) with the packed value stored at k,
+         *  which allows reading part of a value without unpacking all of it.
+         *
+         *  The value is copied into a scratch buffer of the calling thread that keeps its
+         *  capacity between calls, the data is only valid while visit runs.
+         *
+         *  @return false if k was not found
+         */
+        template<typename Visitor>
+        bool with_value( const Key& k, Visitor&& visit )
+        {
+          try {
+             detail::scratch_lease scratch;
+             if( _batching )
+             {
+                auto itr = _pending.find( k );
+                if( itr != _pending.end() )
+                {
+                   if( !itr->second ) return false;
+                   const auto& vec = pack_value( scratch->pack, *itr->second );
+                   visit( (const char*)vec.data(), vec.size() );
+                   return true;
+                }
+             }
+             make_key( scratch->key, k );
+             int64_t start = table_counters::now_us();
+             bool found = _db->get( kv_slice( scratch->key.data(), scratch->key.size() ), scratch->value );
+             _stats->record_read( start, found, scratch->value.size() );
+             if( !found )
              {
-                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+               return false;
              }
-             fc::datastream<const char*> ds(value.c_str(), value.size());
-             Value tmp;
-             fc::raw::unpack(ds, tmp);
-             return tmp;
+             visit( (const char*)scratch->value.data(), scratch->value.size() );
+             return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error fetching key ${key}", ("key",k) );
         }
 
+        /**
+         *  The key and value at the current position are decoded at most once, the
+         *  decoded copies are shared by all copies of the iterator.
+         */
         class iterator
         {
            public:
              iterator(){}
              bool valid()const
              {
-                return _it && _it->Valid();
+                return _it && _it->valid() && _it->key().starts_with( _prefix );
              }
 
-             Key key()const
+             const Key& key()const
              {
-                 Key tmp_key;
-                 fc::datastream<const char*> ds2( _it->key().data(), _it->key().size() );
-                 fc::raw::unpack( ds2, tmp_key );
-                 return tmp_key;
+                 if( !_decoded->key )
+                 {
+                    _decoded->key = Key();
+                    auto k = _it->key();
+                    key_encoding<Key>::unpack( k.data + _prefix.size(), k.size - _prefix.size(), *_decoded->key );
+                 }
+                 return *_decoded->key;
              }
 
-             Value value()const
+             const Value& value()const
              {
-               Value tmp_val;
-               fc::datastream<const char*> ds( _it->value().data(), _it->value().size() );
-               fc::raw::unpack( ds, tmp_val );
-               return tmp_val;
+               if( !_decoded->value )
+               {
+                  _decoded->value = Value();
+                  auto v = _it->value();
+                  fc::datastream<const char*> ds( v.data, v.size );
+                  fc::raw::unpack( ds, *_decoded->value );
+               }
+               return *_decoded->value;
              }
 
-             iterator& operator++()    { _it->Next(); return *this; }
-             iterator  operator++(int) { _it->Next(); return *this; }
+             iterator& operator++()    { _it->next(); reset(); return *this; }
+             iterator  operator++(int) { _it->next(); reset(); return *this; }
 
-             iterator& operator--()    { _it->Prev(); return *this; }
-             iterator  operator--(int) { _it->Prev(); return *this; }
+             iterator& operator--()    { _it->prev(); reset(); return *this; }
+             iterator  operator--(int) { _it->prev(); reset(); return *this; }
 
            protected:
              friend class level_map;
-             iterator( ldb::Iterator* it )
-             :_it(it){}
+             iterator( std::unique_ptr<kv_iterator> it, const std::string& prefix, const level_snapshot& snapshot )
+             :_snapshot(snapshot),_it(std::move(it)),_prefix(prefix),_decoded( std::make_shared<decoded>() ){}
+
+             struct decoded
+             {
+                fc::optional<Key>   key;
+                fc::optional<Value> value;
+             };
 
-             std::shared_ptr<ldb::Iterator> _it;
+             void reset()
+             {
+                _decoded->key   = fc::optional<Key>();
+                _decoded->value = fc::optional<Value>();
+             }
+
+             level_snapshot                 _snapshot; ///< kept alive as long as _it reads it
+             std::shared_ptr<kv_iterator>   _it;
+             std::string                    _prefix;
+             std::shared_ptr<decoded>       _decoded;
         };
 
-        iterator begin()
+        /** @param snapshot - iterate the database as of snapshot, or the latest state if null */
+        iterator begin( const level_snapshot& snapshot = level_snapshot() )const
         { try {
-           iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
-           itr._it->SeekToFirst();
-
-           if( itr._it->status().IsNotFound() )
-           {
-             FC_THROW_EXCEPTION( key_not_found_exception, "" );
-           }
-           if( !itr._it->status().ok() )
-           {
-               FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", itr._it->status().ToString() ) );
-           }
+           iterator itr( _db->iterate( snapshot.get() ), _prefix, snapshot );
+           if( _prefix.size() ) itr._it->seek( kv_slice( _prefix ) );
+           else                 itr._it->seek_to_first();
+           itr._it->check_status();
 
            if( itr.valid() )
            {
@@ -135,12 +404,12 @@ namespace bts { namespace db {
            return iterator();
         } FC_RETHROW_EXCEPTIONS( warn, "error seeking to first" ) }
 
-        iterator find( const Key& key )
+        iterator find( const Key& key, const level_snapshot& snapshot = level_snapshot() )const
         { try {
-           std::vector<char> kslice = fc::raw::pack( key );
-           ldb::Slice key_slice( kslice.data(), kslice.size() );
-           iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
-           itr._it->Seek( key_slice );
+           std::vector<char> kslice;
+           make_key( kslice, key );
+           iterator itr( _db->iterate( snapshot.get() ), _prefix, snapshot );
+           itr._it->seek( kv_slice( kslice.data(), kslice.size() ) );
            if( itr.valid() && itr.key() == key )
            {
               return itr;
@@ -148,11 +417,12 @@ namespace bts { namespace db {
            return iterator();
         } FC_RETHROW_EXCEPTIONS( warn, "error finding ${key}", ("key",key) ) }
 
-        iterator lower_bound( const Key& key )
+        iterator lower_bound( const Key& key, const level_snapshot& snapshot = level_snapshot() )const
         { try {
-           ldb::Slice key_slice( (char*)&key, sizeof(key) );
-           iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
-           itr._it->Seek( key_slice );
+           std::vector<char> kslice;
+           make_key( kslice, key );
+           iterator itr( _db->iterate( snapshot.get() ), _prefix, snapshot );
+           itr._it->seek( kv_slice( kslice.data(), kslice.size() ) );
            if( itr.valid()  )
            {
               return itr;
@@ -163,15 +433,13 @@ namespace bts { namespace db {
         bool last( Key& k )
         {
           try {
-             std::unique_ptr<ldb::Iterator> it( _db->NewIterator( ldb::ReadOptions() ) );
-             FC_ASSERT( it != nullptr );
-             it->SeekToLast();
-             if( !it->Valid() )
+             auto it = _db->iterate();
+             if( !seek_to_last( *it ) )
              {
                return false;
              }
-             fc::datastream<const char*> ds2( it->key().data(), it->key().size() );
-             fc::raw::unpack( ds2, k );
+             auto ks = it->key();
+             key_encoding<Key>::unpack( ks.data + _prefix.size(), ks.size - _prefix.size(), k );
              return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error reading last item from database" );
         }
@@ -179,18 +447,17 @@ namespace bts { namespace db {
         bool last( Key& k, Value& v )
         {
           try {
-           std::unique_ptr<ldb::Iterator> it( _db->NewIterator( ldb::ReadOptions() ) );
-           FC_ASSERT( it != nullptr );
-           it->SeekToLast();
-           if( !it->Valid() )
+           auto it = _db->iterate();
+           if( !seek_to_last( *it ) )
            {
              return false;
            }
-           fc::datastream<const char*> ds( it->value().data(), it->value().size() );
+           auto vs = it->value();
+           fc::datastream<const char*> ds( vs.data, vs.size );
            fc::raw::unpack( ds, v );
 
-           fc::datastream<const char*> ds2( it->key().data(), it->key().size() );
-           fc::raw::unpack( ds2, k );
+           auto ks = it->key();
+           key_encoding<Key>::unpack( ks.data + _prefix.size(), ks.size - _prefix.size(), k );
            return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error reading last item from database" );
         }
@@ -200,18 +467,19 @@ namespace bts { namespace db {
           try
           {
              FC_ASSERT( _db != nullptr );
-
-             std::vector<char> kslice = fc::raw::pack( k );
-             ldb::Slice ks( kslice.data(), kslice.size() );
-
-             auto vec = fc::raw::pack(v);
-             ldb::Slice vs( vec.data(), vec.size() );
-
-             auto status = _db->Put( ldb::WriteOptions(), ks, vs );
-             if( !status.ok() )
+             if( _batching )
              {
-                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+                _pending[k] = v;
+                return;
              }
+
+             detail::scratch_lease scratch;
+             make_key( scratch->key, k );
+             const auto& vec = pack_value( scratch->pack, v );
+             int64_t start = table_counters::now_us();
+             _db->put( kv_slice( scratch->key.data(), scratch->key.size() ), kv_slice( vec.data(), vec.size() ) );
+             _stats->write_latency.record( table_counters::now_us() - start );
+             _stats->record_write( scratch->key.size(), vec.size() );
           } FC_RETHROW_EXCEPTIONS( warn, "error storing ${key} = ${value}", ("key",k)("value",v) );
         }
 
@@ -220,31 +488,79 @@ namespace bts { namespace db {
           try
           {
              FC_ASSERT( _db != nullptr );
-
-             std::vector<char> kslice = fc::raw::pack( k );
-             ldb::Slice ks( kslice.data(), kslice.size() );
-             auto status = _db->Delete( ldb::WriteOptions(), ks );
-             if( status.IsNotFound() )
+             if( _batching )
              {
-               FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
-             }
-             if( !status.ok() )
-             {
-                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+                _pending[k] = fc::optional<Value>();
+                return;
              }
+
+             detail::scratch_lease scratch;
+             make_key( scratch->key, k );
+             int64_t start = table_counters::now_us();
+             _db->remove( kv_slice( scratch->key.data(), scratch->key.size() ) );
+             _stats->write_latency.record( table_counters::now_us() - start );
+             _stats->record_remove( scratch->key.size() );
           } FC_RETHROW_EXCEPTIONS( warn, "error removing ${key}", ("key",k) );
         }
 
      private:
-        class key_compare : public leveldb::Comparator
+        /** packs v into out, one of the scratch buffers */
+        static const std::vector<char>& pack_value( std::vector<char>& out, const Value& v )
+        {
+           out.resize( fc::raw::pack_size( v ) );
+           fc::datastream<char*> ds( out.data(), out.size() );
+           fc::raw::pack( ds, v );
+           return out;
+        }
+
+        void make_key( std::vector<char>& out, const Key& k )const
+        {
+           key_encoding<Key>::pack( out, k );
+           if( _prefix.size() )
+              out.insert( out.begin(), _prefix.begin(), _prefix.end() );
+        }
+
+        /** positions it on the last key of this map's keyspace */
+        bool seek_to_last( kv_iterator& it )const
+        {
+           if( _prefix.empty() )
+           {
+              it.seek_to_last();
+              it.check_status();
+              return it.valid();
+           }
+           std::string successor = _prefix;
+           successor.back() = char( uint8_t(successor.back()) + 1 );
+           it.seek( kv_slice( successor ) );
+           if( it.valid() ) it.prev();
+           else             it.seek_to_last();
+           it.check_status();
+           return it.valid() && it.key().starts_with( _prefix );
+        }
+
+        static std::string reencode_legacy_key( const kv_slice& legacy_key )
+        {
+           Key k;
+           fc::datastream<const char*> ds( legacy_key.data, legacy_key.size );
+           fc::raw::unpack( ds, k );
+           std::vector<char> kslice;
+           key_encoding<Key>::pack( kslice, k );
+           return std::string( kslice.data(), kslice.size() );
+        }
+
+        /**
+         *  Only used for keys that do not have an order preserving key_encoding and
+         *  to read databases written before key_encoding existed.
+         */
+        class key_compare : public kv_comparator
         {
           public:
-            int Compare( const leveldb::Slice& a, const leveldb::Slice& b )const
+            int compare( const kv_slice& a, const kv_slice& b )const
             {
                Key ak,bk;
-               fc::datastream<const char*> dsa( a.data(), a.size() );
+               fc::datastream<const char*> dsa( a.data, a.size );
                fc::raw::unpack( dsa, ak );
-               fc::datastream<const char*> dsb( b.data(), b.size() );
+               fc::datastream<const char*> dsb( b.data, b.size );
                fc::raw::unpack( dsb, bk );
 
                if( ak  < bk ) return -1;
@@ -252,15 +568,24 @@ namespace bts { namespace db {
                return 1;
             }
 
-            const char* Name()const { return "key_compare"; }
-            void FindShortestSeparator( std::string*, const leveldb::Slice& )const{}
-            void FindShortSuccessor( std::string* )const{};
+            const char* name()const { return "key_compare"; }
         };
 
-        key_compare                  _comparer;
-
-public: //DLNFIX temporary, remove this
-        std::unique_ptr<leveldb::DB> _db;
+        bool                                 _batching;
+        std::map<Key,fc::optional<Value> >   _pending;
+        std::string                          _prefix;
+        kv_backend_ptr                       _db;
+        std::shared_ptr<table_counters>      _stats;
   };
 
+  /**
+   *  Opens a database that holds several prefixed level_maps, with the backend
+   *  named by options.backend.
+   */
+  inline kv_backend_ptr open_shared_database( const fc::path& dir, bool create = true,
+                                              const level_options& options = level_options() )
+  {
+     return kv_backend_registry::instance().open( dir, create, options, nullptr );
+  }
+
 } } // bts::db
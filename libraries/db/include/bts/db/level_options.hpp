@@ -0,0 +1,50 @@
+#pragma once
+#include <fc/reflect/reflect.hpp>
+#include <stdint.h>
+#include <string>
+
+namespace bts { namespace db {
+
+  /**
+   *  @brief the backend and its tuning parameters for a single level_map
+   *
+   *  The defaults match LevelDB's own defaults except for the block cache, which is
+   *  allocated explicitly so that its size can be configured.
+   */
+  struct level_options
+  {
+     level_options()
+     :cache_size(8*1024*1024),
+      bloom_bits_per_key(0),
+      write_buffer_size(4*1024*1024),
+      max_open_files(1000),
+      compression(true),
+      backend("leveldb"){}
+
+     /**
+      *  Tables keyed by random hashes (trx_id2num, blk_id2num) are dominated by point
+      *  lookups of keys that may not exist, so they get a bloom filter and a larger cache.
+      *  Hash keys do not compress so compression is disabled.
+      */
+     static level_options hash_keyed()
+     {
+        level_options o;
+        o.cache_size         = 32*1024*1024;
+        o.bloom_bits_per_key = 10;
+        o.write_buffer_size  = 8*1024*1024;
+        o.compression        = false;
+        return o;
+     }
+
+     uint64_t  cache_size;         ///< bytes of LRU block cache, 0 uses LevelDB's internal cache
+     uint32_t  bloom_bits_per_key; ///< 0 disables the bloom filter
+     uint64_t  write_buffer_size;  ///< bytes
+     uint32_t  max_open_files;
+     bool      compression;        ///< snappy compression of table blocks
+     /** the kv_backend_registry name of the store, the other options are LevelDB's and may not apply to others */
+     std::string backend;
+  };
+
+} } // bts::db
+
+FC_REFLECT( bts::db::level_options, (cache_size)(bloom_bits_per_key)(write_buffer_size)(max_open_files)(compression)(backend) )
@@ -1,12 +1,17 @@
 #pragma once
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
+#include <leveldb/write_batch.h>
 #include <fc/filesystem.hpp>
+#include <fc/optional.hpp>
 #include <fc/reflect/reflect.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/exception/exception.hpp>
 
 #include <bts/db/upgrade_leveldb.hpp>
+#include <bts/db/leveldb_options.hpp>
+
+#include <map>
 
 namespace bts { namespace db {
 
@@ -17,18 +22,27 @@ namespace bts { namespace db {
    *
    *
    *  @note Key must be a POD type
+   *
+   *  @see level_map::begin_batch() for the semantics of write batches
    */
   template<typename Key, typename Value>
   class level_pod_map
   {
      public:
-        void open( const fc::path& dir, bool create = true )
+        level_pod_map():_batching(false){}
+
+        void open( const fc::path& dir, bool create = true, const level_options& options = level_options() )
         {
+           _db.reset();
            ldb::Options opts;
+           apply_options( options, opts, _resources );
            opts.create_if_missing = create;
            opts.comparator = & _comparer;
            
 
+           // an upgrade interrupted while it replaced dir has to finish before dir is opened
+           recover_upgrade_db( dir );
+
            /// \waring Given path must exist to succeed toNativeAnsiPath
            fc::create_directories(dir);
 
@@ -44,17 +58,92 @@ namespace bts { namespace db {
                     );
            }
            _db.reset(ndb);
-           try_upgrade_db(dir,ndb, fc::get_typename<Value>::name(),sizeof(Value));
+           if( try_upgrade_db(dir,ndb, fc::get_typename<Value>::name(),sizeof(Value), opts.comparator) )
+           {
+              // the upgraded copy replaces dir once ndb is closed
+              _db.reset();
+              finish_upgrade_db( dir );
+              ndb = nullptr;
+              ntrxstat = ldb::DB::Open( opts, ldb_path.c_str(), &ndb );
+              if( !ntrxstat.ok() )
+              {
+                  FC_THROW_EXCEPTION( db_in_use_exception, "Unable to open upgraded database ${db}\n\t${msg}", 
+                       ("db",dir)
+                       ("msg",ntrxstat.ToString()) 
+                       );
+              }
+              _db.reset(ndb);
+           }
         }
 
         void close()
         {
+          abort_batch();
           _db.reset();
         }
 
+        void begin_batch()
+        {
+          FC_ASSERT( !_batching, "a write batch is already in progress" );
+          _batching = true;
+        }
+
+        bool in_batch()const { return _batching; }
+
+        void commit_batch( bool sync = false )
+        {
+          try {
+             FC_ASSERT( _batching, "no write batch is in progress" );
+             FC_ASSERT( _db != nullptr );
+
+             ldb::WriteBatch batch;
+             for( auto itr = _pending.begin(); itr != _pending.end(); ++itr )
+             {
+                ldb::Slice ks( (char*)&itr->first, sizeof(itr->first) );
+                if( itr->second )
+                {
+                   auto vec = fc::raw::pack( *itr->second );
+                   batch.Put( ks, ldb::Slice( vec.data(), vec.size() ) );
+                }
+                else
+                {
+                   batch.Delete( ks );
+                }
+             }
+
+             ldb::WriteOptions opts;
+             opts.sync = sync;
+             auto status = _db->Write( opts, &batch );
+             if( !status.ok() )
+             {
+                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+             }
+             _pending.clear();
+             _batching = false;
+          } FC_RETHROW_EXCEPTIONS( warn, "error committing write batch", ("staged",_pending.size()) );
+        }
+
+        void abort_batch()
+        {
+          _pending.clear();
+          _batching = false;
+        }
+
         Value fetch( const Key& key )
         {
           try {
+             if( _batching )
+             {
+                auto itr = _pending.find( key );
+                if( itr != _pending.end() )
+                {
+                   if( !itr->second )
+                   {
+                     FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",key) );
+                   }
+                   return *itr->second;
+                }
+             }
              ldb::Slice key_slice( (char*)&key, sizeof(key) );
              std::string value;
              auto status = _db->Get( ldb::ReadOptions(), key_slice, &value );
@@ -191,6 +280,11 @@ namespace bts { namespace db {
         {
           try
           {
+             if( _batching )
+             {
+                _pending[k] = v;
+                return;
+             }
              ldb::Slice ks( (char*)&k, sizeof(k) );
              auto vec = fc::raw::pack(v);
              ldb::Slice vs( vec.data(), vec.size() );
@@ -207,6 +301,11 @@ namespace bts { namespace db {
         {
           try
           {
+            if( _batching )
+            {
+               _pending[k] = fc::optional<Value>();
+               return;
+            }
             ldb::Slice ks( (char*)&k, sizeof(k) );
             auto status = _db->Delete( ldb::WriteOptions(), ks );
 
@@ -241,8 +340,11 @@ namespace bts { namespace db {
             void FindShortSuccessor( std::string* )const{};
         };
 
-        key_compare                  _comparer;
-        std::unique_ptr<leveldb::DB> _db;
+        key_compare                          _comparer;
+        leveldb_resources                    _resources;
+        bool                                 _batching;
+        std::map<Key,fc::optional<Value> >   _pending;
+        std::unique_ptr<leveldb::DB>         _db;
         
   };
 
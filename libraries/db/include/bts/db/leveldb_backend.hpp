@@ -0,0 +1,14 @@
+#pragma once
+#include <bts/db/kv_backend.hpp>
+
+namespace bts { namespace db {
+
+  /**
+   *  The kv_backend_factory of "leveldb".  A table is checked for the upgrades of
+   *  upgrade_leveldb.hpp as it is opened: keys written with fc::raw are re-encoded and
+   *  values of a legacy RECORD_TYPE are converted.
+   */
+  kv_backend_ptr open_leveldb_backend( const fc::path& dir, bool create, const level_options& options,
+                                       const kv_table_info* table );
+
+} } // bts::db
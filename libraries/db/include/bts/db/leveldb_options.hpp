@@ -0,0 +1,39 @@
+#pragma once
+#include <leveldb/options.h>
+#include <leveldb/cache.h>
+#include <leveldb/filter_policy.h>
+#include <bts/db/level_options.hpp>
+
+#include <memory>
+
+namespace bts { namespace db {
+
+  /**
+   *  Owns the block cache and filter policy referenced by a leveldb::Options,
+   *  it must outlive every database opened with those options.
+   */
+  struct leveldb_resources
+  {
+     std::shared_ptr<leveldb::Cache>              block_cache;
+     std::shared_ptr<const leveldb::FilterPolicy> filter_policy;
+  };
+
+  inline void apply_options( const level_options& o, leveldb::Options& opts, leveldb_resources& res )
+  {
+     res = leveldb_resources();
+     if( o.cache_size > 0 )
+     {
+        res.block_cache.reset( leveldb::NewLRUCache( o.cache_size ) );
+        opts.block_cache = res.block_cache.get();
+     }
+     if( o.bloom_bits_per_key > 0 )
+     {
+        res.filter_policy.reset( leveldb::NewBloomFilterPolicy( o.bloom_bits_per_key ) );
+        opts.filter_policy = res.filter_policy.get();
+     }
+     opts.write_buffer_size = o.write_buffer_size;
+     opts.max_open_files    = o.max_open_files;
+     opts.compression       = o.compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+  }
+
+} } // bts::db
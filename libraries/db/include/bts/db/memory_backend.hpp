@@ -0,0 +1,14 @@
+#pragma once
+#include <bts/db/kv_backend.hpp>
+
+namespace bts { namespace db {
+
+  /**
+   *  The kv_backend_factory of "memory".  The table is an ordered map in memory that is
+   *  dropped with the last reference to the backend, dir and the LevelDB options are
+   *  ignored.  Meant for tables that are rebuilt on every start and for tests.
+   */
+  kv_backend_ptr open_memory_backend( const fc::path& dir, bool create, const level_options& options,
+                                      const kv_table_info* table );
+
+} } // bts::db
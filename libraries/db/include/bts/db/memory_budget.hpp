@@ -0,0 +1,77 @@
+#pragma once
+#include <fc/reflect/reflect.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bts { namespace db {
+
+  namespace detail { class memory_budget_impl; }
+
+  /** what a cache registered with a memory_budget was allowed and used at the last rebalance() */
+  struct memory_budget_usage
+  {
+     memory_budget_usage():priority(0),quota(0),limit(0),usage(0){}
+
+     std::string name;
+     uint32_t    priority;
+     uint64_t    quota;  ///< its share of the budget
+     uint64_t    limit;  ///< what it was told to stay within, below the quota while shrunk
+     uint64_t    usage;
+  };
+
+  /**
+   *  Divides one budget of bytes among the caches and pools of a process.
+   *
+   *  Each cache is registered with a share of the budget, a priority and two callbacks.  One
+   *  reports its usage in bytes and the other sets its limit in bytes.  rebalance() gives every
+   *  cache its share of the budget as its quota, and lends what the caches below their quota
+   *  leave unused to the full cache of the highest priority.  The other caches above their
+   *  quota keep what they use while the caches together stay within the budget, and the
+   *  loan is what is left of the spare memory.  While the caches together use more than the
+   *  budget, because a lender grew back into its quota, those above their quota are shrunk
+   *  toward it from the lowest priority up.  A cache within its quota is never shrunk, the
+   *  quotas add up to the budget.
+   *
+   *  The callbacks are called by rebalance() on the thread that calls it, register caches
+   *  that are used by one thread from that thread.  A total of 0 disables the budget and
+   *  rebalance() leaves the limits alone.  The budget is thread safe.
+   */
+  class memory_budget
+  {
+     public:
+        typedef std::function<uint64_t()>        usage_function;
+        typedef std::function<void( uint64_t )>  limit_function;
+
+        memory_budget( uint64_t total_bytes = 0 );
+        ~memory_budget();
+
+        void     set_total( uint64_t total_bytes );
+        uint64_t get_total()const;
+
+        /**
+         *  @param share    - relative to the shares of the other caches
+         *  @param priority - lower priorities are shrunk first under pressure
+         *
+         *  A cache registered again under the same name replaces the earlier registration.
+         */
+        void add_cache( const std::string& name, uint32_t share, uint32_t priority,
+                        const usage_function& usage, const limit_function& limit );
+        void remove_cache( const std::string& name );
+
+        /** reads the usage of every cache and sets their limits */
+        void rebalance();
+
+        /** as of the last rebalance() */
+        std::vector<memory_budget_usage> get_usage()const;
+
+     private:
+        std::unique_ptr<detail::memory_budget_impl> my;
+  };
+
+} } // bts::db
+
+FC_REFLECT( bts::db::memory_budget_usage, (name)(priority)(quota)(limit)(usage) )
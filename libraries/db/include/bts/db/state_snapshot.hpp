@@ -0,0 +1,79 @@
+#pragma once
+#include <fc/crypto/ripemd160.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace db {
+
+  namespace detail { class mapped_snapshot_impl; }
+
+  /**
+   *  A file of in-memory state derived from a database, so that opening the database
+   *  can load that state instead of rebuilding it.  The state is packed with fc::raw
+   *  after a header that holds a version, the id of the database state it was derived
+   *  from and a ripemd160 checksum of the packed state.
+   *
+   *  Snapshots are written when a database is closed cleanly.  A snapshot is stale if
+   *  its version or state id differ from the ones asked for, which callers take as the
+   *  signal to rebuild, e.g. with the id of the head block as the state id.
+   */
+  class mapped_snapshot
+  {
+     public:
+        mapped_snapshot();
+        ~mapped_snapshot();
+
+        /**
+         *  Memory maps file and checks its header and checksum.
+         *
+         *  @return false if file is missing, stale or damaged
+         */
+        bool        open( const fc::path& file, uint32_t version, const fc::ripemd160& state_id );
+
+        const char* data()const;
+        size_t      size()const;
+
+     private:
+        std::unique_ptr<detail::mapped_snapshot_impl> my;
+  };
+
+  /** writes packed_state to a temporary file that then replaces file */
+  void write_state_snapshot( const fc::path& file, uint32_t version, const fc::ripemd160& state_id,
+                             const std::vector<char>& packed_state );
+
+  template<typename T>
+  void save_state_snapshot( const fc::path& file, uint32_t version, const fc::ripemd160& state_id, const T& state )
+  {
+     write_state_snapshot( file, version, state_id, fc::raw::pack( state ) );
+  }
+
+  /**
+   *  Unpacks state straight from the mapped file.
+   *
+   *  @return false if the snapshot is missing, stale or damaged, state is then unchanged
+   */
+  template<typename T>
+  bool load_state_snapshot( const fc::path& file, uint32_t version, const fc::ripemd160& state_id, T& state )
+  {
+     mapped_snapshot snapshot;
+     if( !snapshot.open( file, version, state_id ) ) return false;
+     try {
+        T loaded;
+        fc::datastream<const char*> ds( snapshot.data(), snapshot.size() );
+        fc::raw::unpack( ds, loaded );
+        state = std::move( loaded );
+        return true;
+     }
+     catch ( const fc::exception& e )
+     {
+        wlog( "unable to unpack state snapshot ${file}: ${e}", ("file",file)("e",e.to_detail_string()) );
+        return false;
+     }
+  }
+
+} } // bts::db
@@ -0,0 +1,120 @@
+#pragma once
+#include <fc/reflect/reflect.hpp>
+#include <fc/time.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace bts { namespace db {
+
+  /**
+   *  What a level_map did to its database since it was created.  The latencies are
+   *  histograms of microseconds, bucket i counts the calls that took less than 2^i and,
+   *  from i == 1, at least 2^(i-1).  The last bucket also counts everything slower.
+   */
+  struct table_stats
+  {
+     table_stats():reads(0),read_misses(0),bytes_read(0),writes(0),removes(0),bytes_written(0),batches(0){}
+
+     uint64_t               reads;          ///< lookups that went to the database, staged values are not counted
+     uint64_t               read_misses;
+     uint64_t               bytes_read;
+     uint64_t               writes;         ///< puts, directly or in a batch
+     uint64_t               removes;
+     uint64_t               bytes_written;  ///< keys and values
+     uint64_t               batches;        ///< committed by this map or flushed into a shared one
+     std::vector<uint64_t>  read_latency_us;
+     std::vector<uint64_t>  write_latency_us; ///< of direct puts and removes and of committed batches
+  };
+
+  /** a histogram of latencies that may be recorded from several threads */
+  class latency_histogram
+  {
+     public:
+        static const uint32_t bucket_count = 24; ///< the last one starts at about 4 seconds
+
+        latency_histogram()
+        {
+           for( uint32_t i = 0; i < bucket_count; ++i ) _buckets[i].store( 0, std::memory_order_relaxed );
+        }
+
+        void record( int64_t us )
+        {
+           uint32_t b = 0;
+           while( us > 0 && b < bucket_count - 1 ) { us >>= 1; ++b; }
+           _buckets[b].fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        std::vector<uint64_t> counts()const
+        {
+           std::vector<uint64_t> c( bucket_count );
+           for( uint32_t i = 0; i < bucket_count; ++i ) c[i] = _buckets[i].load( std::memory_order_relaxed );
+           return c;
+        }
+
+     private:
+        std::atomic<uint64_t> _buckets[bucket_count];
+  };
+
+  /**
+   *  The counters behind table_stats.  Reads given a snapshot may be made from other
+   *  threads, so every counter is atomic, and a counter costs a relaxed add.
+   */
+  class table_counters
+  {
+     public:
+        table_counters()
+        :reads(0),read_misses(0),bytes_read(0),writes(0),removes(0),bytes_written(0),batches(0){}
+
+        static int64_t now_us() { return fc::time_point::now().time_since_epoch().count(); }
+
+        void record_read( int64_t start_us, bool found, size_t size )
+        {
+           read_latency.record( now_us() - start_us );
+           reads.fetch_add( 1, std::memory_order_relaxed );
+           if( found ) bytes_read.fetch_add( size, std::memory_order_relaxed );
+           else        read_misses.fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        void record_write( size_t key_size, size_t value_size )
+        {
+           writes.fetch_add( 1, std::memory_order_relaxed );
+           bytes_written.fetch_add( key_size + value_size, std::memory_order_relaxed );
+        }
+
+        void record_remove( size_t key_size )
+        {
+           removes.fetch_add( 1, std::memory_order_relaxed );
+           bytes_written.fetch_add( key_size, std::memory_order_relaxed );
+        }
+
+        table_stats get()const
+        {
+           table_stats s;
+           s.reads            = reads.load( std::memory_order_relaxed );
+           s.read_misses      = read_misses.load( std::memory_order_relaxed );
+           s.bytes_read       = bytes_read.load( std::memory_order_relaxed );
+           s.writes           = writes.load( std::memory_order_relaxed );
+           s.removes          = removes.load( std::memory_order_relaxed );
+           s.bytes_written    = bytes_written.load( std::memory_order_relaxed );
+           s.batches          = batches.load( std::memory_order_relaxed );
+           s.read_latency_us  = read_latency.counts();
+           s.write_latency_us = write_latency.counts();
+           return s;
+        }
+
+        std::atomic<uint64_t> reads;
+        std::atomic<uint64_t> read_misses;
+        std::atomic<uint64_t> bytes_read;
+        std::atomic<uint64_t> writes;
+        std::atomic<uint64_t> removes;
+        std::atomic<uint64_t> bytes_written;
+        std::atomic<uint64_t> batches;
+        latency_histogram     read_latency;
+        latency_histogram     write_latency;
+  };
+
+} } // bts::db
+
+FC_REFLECT( bts::db::table_stats, (reads)(read_misses)(bytes_read)(writes)(removes)(bytes_written)(batches)(read_latency_us)(write_latency_us) )
@@ -0,0 +1,74 @@
+#pragma once
+#include <fc/filesystem.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace bts { namespace db {
+
+  namespace detail { class tracer_impl; }
+
+  /**
+   *  Records timed spans and counters of the hot paths of a node into a fixed size ring
+   *  buffer, so that tracing can stay on in production: a span costs two clock reads and
+   *  an uncontended lock, and when tracing is disabled at run time a single atomic load.
+   *  The oldest spans are overwritten once the buffer is full.
+   *
+   *  Tracing is compiled in with BTS_TRACING, without it BTS_TRACE_SPAN and
+   *  BTS_TRACE_COUNT expand to nothing.
+   */
+  class tracer
+  {
+     public:
+        static tracer& instance();
+
+        void enable( bool e )   { _enabled.store( e, std::memory_order_relaxed ); }
+        bool enabled()const     { return _enabled.load( std::memory_order_relaxed ); }
+
+        /** name must be a string literal, only the pointer is kept */
+        void record_span( const char* name, int64_t start_us, int64_t duration_us );
+        void add_counter( const char* name, int64_t delta );
+
+        /**
+         *  Writes the recorded spans and the current value of every counter in the trace
+         *  event format read by chrome://tracing, then clears the spans.
+         */
+        void dump( const fc::path& file );
+
+     private:
+        tracer();
+        ~tracer();
+
+        std::atomic<bool>                    _enabled;
+        std::unique_ptr<detail::tracer_impl> my;
+  };
+
+  /** records the time from its construction to its destruction as a span */
+  class trace_span
+  {
+     public:
+        trace_span( const char* name );
+        ~trace_span();
+
+     private:
+        trace_span( const trace_span& );
+        trace_span& operator=( const trace_span& );
+
+        const char* _name;
+        int64_t     _start;
+  };
+
+} } // bts::db
+
+#ifdef BTS_TRACING
+#define BTS_TRACE_CAT2( A, B ) A ## B
+#define BTS_TRACE_CAT( A, B )  BTS_TRACE_CAT2( A, B )
+#define BTS_TRACE_SPAN( NAME ) \
+   bts::db::trace_span BTS_TRACE_CAT( _bts_trace_span_, __LINE__ )( NAME )
+#define BTS_TRACE_COUNT( NAME, DELTA ) \
+   do { if( bts::db::tracer::instance().enabled() ) bts::db::tracer::instance().add_counter( NAME, DELTA ); } while( false )
+#else
+#define BTS_TRACE_SPAN( NAME )
+#define BTS_TRACE_COUNT( NAME, DELTA ) do {} while( false )
+#endif
@@ -4,6 +4,7 @@
 #include <fc/reflect/reflect.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/exception/exception.hpp>
+#include <algorithm>
 #include <functional>
 #include <map>
 #include <boost/regex.hpp>
@@ -18,7 +19,8 @@ namespace fc { class path; }
  * be upgraded to the current database formats. Whenever a database is first opened,
  * this code checks if the database is stored in an old format and looks for an
  * upgrade function to upgrade it to the current format. If found, the objects
- * in the database will be immediately upgraded to the current format.
+ * in the database are copied in their current format into a new database that
+ * then replaces the old one.
  *
  * Upgrades are performed by executing a series of chained copy constructors
  * from the legacy object format to the current object format. This means
@@ -71,46 +73,91 @@ namespace fc { class path; }
 
 namespace bts { namespace db {
 
-    typedef std::function<void(leveldb::DB*)> upgrade_db_function; 
+    /** converts one packed value of a legacy type to the packed current type */
+    typedef std::function<std::vector<char>(const leveldb::Slice&)> upgrade_db_function; 
+
+    /** reported after every batch of an upgrade that is committed */
+    struct upgrade_progress
+    {
+        upgrade_progress():records(0),done(false){}
+
+        std::string  db;      ///< the directory being upgraded
+        uint64_t     records; ///< copied so far, including those copied before a restart
+        bool         done;
+    };
+    typedef std::function<void(const upgrade_progress&)> upgrade_progress_function;
 
     class upgrade_db_mapper
     {
         public:
+          upgrade_db_mapper():_batch_size(10000){}
+
           static  upgrade_db_mapper& instance();
           int32_t add_type( const std::string& type_name, const upgrade_db_function& function);
 
+          /** called on the thread that opens the database */
+          void    set_progress_callback( const upgrade_progress_function& callback ) { _progress = callback; }
+          /** records copied per WriteBatch, and between two saved positions */
+          void    set_batch_size( uint32_t records ) { _batch_size = std::max<uint32_t>( records, 1 ); }
+
           std::map<std::string,upgrade_db_function> _upgrade_db_function_registry;
+          upgrade_progress_function                 _progress;
+          uint32_t                                  _batch_size;
     };
 
     #define REGISTER_DB_OBJECT(TYPE,VERSIONNUM) \
-        void UpgradeDb ## TYPE ## VERSIONNUM(leveldb::DB* dbase) \
+        std::vector<char> UpgradeDb ## TYPE ## VERSIONNUM(const leveldb::Slice& value) \
         { \
-          std::unique_ptr<leveldb::Iterator> dbase_itr( dbase->NewIterator(leveldb::ReadOptions()) ); \
-          dbase_itr->SeekToFirst(); \
-          if( dbase_itr->status().IsNotFound() ) /*if empty database, do nothing*/ \
-            return; \
-          if( !dbase_itr->status().ok() ) \
-            FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", dbase_itr->status().ToString() ) ); \
-          while( dbase_itr->Valid() ) /* convert dbase objects from legacy TypeVersionNum to current Type */ \
-          { \
-            TYPE ## VERSIONNUM old_value; /*load old record type*/ \
-            fc::datastream<const char*> dstream( dbase_itr->value().data(), dbase_itr->value().size() ); \
-            fc::raw::unpack( dstream, old_value ); \
-            TYPE new_value(old_value);       /*convert to new record type*/ \
-            leveldb::Slice key_slice = dbase_itr->key(); \
-            auto vec = fc::raw::pack(new_value); \
-            leveldb::Slice value_slice( vec.data(), vec.size() ); \
-            auto status = dbase->Put( leveldb::WriteOptions(), key_slice, value_slice ); \
-            if( !status.ok() ) \
-            { \
-              FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) ); \
-            } \
-            dbase_itr->Next(); \
-          } /*while*/ \
+          TYPE ## VERSIONNUM old_value; /*load old record type*/ \
+          fc::datastream<const char*> dstream( value.data(), value.size() ); \
+          fc::raw::unpack( dstream, old_value ); \
+          TYPE new_value(old_value);       /*convert to new record type*/ \
+          return fc::raw::pack(new_value); \
         } \
         static int dummyResult ## TYPE ## VERSIONNUM  = \
-          upgrade_db_mapper::instance()->add_type(fc::get_typename<TYPE ## VERSIONNUM>::name(), UpgradeDb ## TYPE ## VERSIONNUM);
+          upgrade_db_mapper::instance().add_type(fc::get_typename<TYPE ## VERSIONNUM>::name(), UpgradeDb ## TYPE ## VERSIONNUM);
+
+    /**
+     *  Upgrades the values of dbase if its RECORD_TYPE is a legacy type with a registered
+     *  upgrade function.  The converted records are copied in batches into a new database
+     *  next to dir, which is opened with comparator.  The position of the copy is saved
+     *  with every batch so that an interrupted upgrade resumes where it stopped, and dbase
+     *  itself is not modified.
+     *
+     *  @return true if dir must be replaced by the copy with finish_upgrade_db() once
+     *          dbase is closed
+     */
+    bool try_upgrade_db( const fc::path& dir, leveldb::DB* dbase, const char* record_type, size_t record_type_size,
+                         const leveldb::Comparator* comparator = leveldb::BytewiseComparator() );
+
+    /**
+     *  Replaces dir by the copy made by try_upgrade_db.  dir is renamed to a backup before
+     *  the copy takes its place and the backup is deleted last, a crash in between is
+     *  recovered by recover_upgrade_db().
+     */
+    void finish_upgrade_db( const fc::path& dir );
+
+    /**
+     *  Completes or rolls back a finish_upgrade_db() that was interrupted, to be called
+     *  before dir is opened.  If the copy was whole it replaces dir, otherwise dir is
+     *  restored from its backup.
+     *
+     *  @return false if there was nothing to recover
+     */
+    bool recover_upgrade_db( const fc::path& dir );
+
+    typedef std::function<std::string(const leveldb::Slice&)> reencode_key_function;
 
-    void try_upgrade_db( const fc::path& dir, leveldb::DB* dbase, const char* record_type, size_t record_type_size );
+    /**
+     *  Databases written before bts::db::key_encoding used fc::raw keys sorted by a
+     *  deserializing comparator.  This opens such a database with the legacy comparator,
+     *  copies every record into a new database with keys converted by reencode and
+     *  then replaces the old database with the new one.  Like try_upgrade_db the copy is
+     *  made in batches and resumes after an interruption.
+     *
+     *  @return false if dir could not be opened with legacy_comparator
+     */
+    bool try_upgrade_key_encoding( const fc::path& dir, const leveldb::Comparator* legacy_comparator,
+                                   const reencode_key_function& reencode );
 
 } } // namespace db
@@ -0,0 +1,42 @@
+#include <bts/db/kv_backend.hpp>
+#include <bts/db/leveldb_backend.hpp>
+#include <bts/db/memory_backend.hpp>
+#include <fc/exception/exception.hpp>
+
+namespace bts { namespace db {
+
+  kv_backend_registry::kv_backend_registry()
+  {
+     _factories["leveldb"] = &open_leveldb_backend;
+     _factories["memory"]  = &open_memory_backend;
+  }
+
+  kv_backend_registry& kv_backend_registry::instance()
+  {
+     static kv_backend_registry registry;
+     return registry;
+  }
+
+  void kv_backend_registry::add_backend( const std::string& name, const kv_backend_factory& factory )
+  {
+     FC_ASSERT( factory, "no factory given for backend ${name}", ("name",name) );
+     _factories[name] = factory;
+  }
+
+  bool kv_backend_registry::has_backend( const std::string& name )const
+  {
+     return _factories.find( name ) != _factories.end();
+  }
+
+  kv_backend_ptr kv_backend_registry::open( const fc::path& dir, bool create, const level_options& options,
+                                            const kv_table_info* table )const
+  { try {
+     auto itr = _factories.find( options.backend );
+     if( itr == _factories.end() )
+        FC_THROW_EXCEPTION( exception, "unknown database backend ${backend}", ("backend",options.backend) );
+     auto db = itr->second( dir, create, options, table );
+     FC_ASSERT( db != nullptr );
+     return db;
+  } FC_RETHROW_EXCEPTIONS( warn, "error opening ${db}", ("db",dir) ) }
+
+} } // bts::db
@@ -0,0 +1,226 @@
+#include <bts/db/leveldb_backend.hpp>
+#include <bts/db/leveldb_options.hpp>
+#include <bts/db/upgrade_leveldb.hpp>
+#include <leveldb/db.h>
+#include <leveldb/comparator.h>
+#include <leveldb/write_batch.h>
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+
+namespace bts { namespace db {
+
+  namespace ldb = leveldb;
+
+  namespace detail
+  {
+     inline ldb::Slice to_slice( const kv_slice& s ) { return ldb::Slice( s.data, s.size ); }
+     inline kv_slice   to_kv( const ldb::Slice& s )  { return kv_slice( s.data(), s.size() ); }
+
+     void check( const ldb::Status& status )
+     {
+        if( !status.ok() )
+           FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+     }
+
+     /** presents a kv_comparator to LevelDB, which stores its name with the table */
+     class leveldb_comparator : public ldb::Comparator
+     {
+        public:
+          leveldb_comparator( const std::shared_ptr<const kv_comparator>& c ):_comparator(c){}
+
+          int Compare( const ldb::Slice& a, const ldb::Slice& b )const
+          {
+             return _comparator->compare( to_kv( a ), to_kv( b ) );
+          }
+
+          const char* Name()const { return _comparator->name(); }
+          void FindShortestSeparator( std::string*, const ldb::Slice& )const{}
+          void FindShortSuccessor( std::string* )const{}
+
+        private:
+          std::shared_ptr<const kv_comparator> _comparator; ///< owned, the table may outlive the map that opened it
+     };
+
+     class leveldb_snapshot : public kv_snapshot
+     {
+        public:
+          leveldb_snapshot( const std::shared_ptr<ldb::DB>& db )
+          :_db(db),_snapshot( db->GetSnapshot() ){}
+          ~leveldb_snapshot() { _db->ReleaseSnapshot( _snapshot ); }
+
+          std::shared_ptr<ldb::DB> _db;
+          const ldb::Snapshot*     _snapshot;
+     };
+
+     ldb::ReadOptions read_options( const kv_snapshot* snapshot )
+     {
+        ldb::ReadOptions opts;
+        if( snapshot ) opts.snapshot = static_cast<const leveldb_snapshot*>( snapshot )->_snapshot;
+        return opts;
+     }
+
+     /** keeps the database open as long as the iterator reads it */
+     class leveldb_iterator : public kv_iterator
+     {
+        public:
+          leveldb_iterator( const std::shared_ptr<ldb::DB>& db, const kv_snapshot* snapshot )
+          :_db(db),_it( db->NewIterator( read_options( snapshot ) ) )
+          {
+             FC_ASSERT( _it != nullptr );
+          }
+
+          bool     valid()const                  { return _it->Valid(); }
+          void     seek_to_first()               { _it->SeekToFirst(); }
+          void     seek_to_last()                { _it->SeekToLast(); }
+          void     seek( const kv_slice& key )   { _it->Seek( to_slice( key ) ); }
+          void     next()                        { _it->Next(); }
+          void     prev()                        { _it->Prev(); }
+          kv_slice key()const                    { return to_kv( _it->key() ); }
+          kv_slice value()const                  { return to_kv( _it->value() ); }
+
+          void     check_status()const
+          {
+             auto status = _it->status();
+             if( status.IsNotFound() )
+               FC_THROW_EXCEPTION( key_not_found_exception, "" );
+             check( status );
+          }
+
+        private:
+          std::shared_ptr<ldb::DB>       _db;
+          std::unique_ptr<ldb::Iterator> _it;
+     };
+
+     class leveldb_batch : public kv_batch
+     {
+        public:
+          void put( const kv_slice& key, const kv_slice& value ) { _batch.Put( to_slice( key ), to_slice( value ) ); }
+          void remove( const kv_slice& key )                     { _batch.Delete( to_slice( key ) ); }
+
+          ldb::WriteBatch _batch;
+     };
+
+     class leveldb_backend_impl : public kv_backend
+     {
+        public:
+          leveldb_backend_impl( const std::shared_ptr<ldb::DB>& db ):_db(db){}
+
+          bool get( const kv_slice& key, std::string& value, const kv_snapshot* snapshot )const
+          {
+             auto status = _db->Get( read_options( snapshot ), to_slice( key ), &value );
+             if( status.IsNotFound() ) return false;
+             check( status );
+             return true;
+          }
+
+          void put( const kv_slice& key, const kv_slice& value )
+          {
+             check( _db->Put( ldb::WriteOptions(), to_slice( key ), to_slice( value ) ) );
+          }
+
+          void remove( const kv_slice& key )
+          {
+             check( _db->Delete( ldb::WriteOptions(), to_slice( key ) ) );
+          }
+
+          std::unique_ptr<kv_batch> create_batch()const
+          {
+             return std::unique_ptr<kv_batch>( new leveldb_batch() );
+          }
+
+          void write( kv_batch& batch, bool sync )
+          {
+             ldb::WriteOptions opts;
+             opts.sync = sync;
+             check( _db->Write( opts, &static_cast<leveldb_batch&>( batch )._batch ) );
+          }
+
+          kv_snapshot_ptr snapshot()const
+          {
+             return std::make_shared<leveldb_snapshot>( _db );
+          }
+
+          std::unique_ptr<kv_iterator> iterate( const kv_snapshot* snapshot )const
+          {
+             return std::unique_ptr<kv_iterator>( new leveldb_iterator( _db, snapshot ) );
+          }
+
+          bool get_property( const std::string& name, std::string& value )const
+          {
+             return _db->GetProperty( name, &value );
+          }
+
+        private:
+          std::shared_ptr<ldb::DB> _db;
+     };
+
+     /** the cache, filter policy and comparator are released after the database */
+     std::shared_ptr<ldb::DB> wrap_db( ldb::DB* ndb, const leveldb_resources& resources,
+                                       const std::shared_ptr<leveldb_comparator>& comparator )
+     {
+        return std::shared_ptr<ldb::DB>( ndb, [resources,comparator]( ldb::DB* db ){ delete db; } );
+     }
+  } // namespace detail
+
+  kv_backend_ptr open_leveldb_backend( const fc::path& dir, bool create, const level_options& options,
+                                       const kv_table_info* table )
+  {
+     ldb::Options opts;
+     leveldb_resources resources;
+     apply_options( options, opts, resources );
+     opts.create_if_missing = create;
+
+     std::shared_ptr<detail::leveldb_comparator> comparator;
+     if( table && table->comparator )
+     {
+        comparator = std::make_shared<detail::leveldb_comparator>( table->comparator );
+        opts.comparator = comparator.get();
+     }
+
+     // an upgrade interrupted while it replaced dir has to finish before dir is opened
+     recover_upgrade_db( dir );
+
+     /// \waring Given path must exist to succeed toNativeAnsiPath
+     fc::create_directories(dir);
+
+     std::string ldb_path = dir.to_native_ansi_path();
+
+     ldb::DB* ndb = nullptr;
+     auto status = ldb::DB::Open( opts, ldb_path.c_str(), &ndb );
+     if( status.IsInvalidArgument() && table && table->reencode_legacy_key && table->legacy_comparator )
+     {
+        // the database was created with the deserializing comparator, rewrite its keys
+        detail::leveldb_comparator legacy( table->legacy_comparator );
+        auto reencode = table->reencode_legacy_key;
+        if( try_upgrade_key_encoding( dir, &legacy, [&]( const ldb::Slice& k ){ return reencode( detail::to_kv( k ) ); } ) )
+           status = ldb::DB::Open( opts, ldb_path.c_str(), &ndb );
+     }
+     if( !status.ok() )
+     {
+         FC_THROW_EXCEPTION( db_in_use_exception, "Unable to open database ${db}\n\t${msg}",
+              ("db",dir)
+              ("msg",status.ToString())
+              );
+     }
+     auto db = detail::wrap_db( ndb, resources, comparator );
+
+     if( table && try_upgrade_db( dir, ndb, table->record_type, table->record_type_size, opts.comparator ) )
+     {
+        // the upgraded copy replaces dir once ndb is closed
+        db.reset();
+        finish_upgrade_db( dir );
+        ndb = nullptr;
+        status = ldb::DB::Open( opts, ldb_path.c_str(), &ndb );
+        if( !status.ok() )
+        {
+            FC_THROW_EXCEPTION( db_in_use_exception, "Unable to open upgraded database ${db}\n\t${msg}",
+                 ("db",dir)
+                 ("msg",status.ToString())
+                 );
+        }
+        db = detail::wrap_db( ndb, resources, comparator );
+     }
+     return std::make_shared<detail::leveldb_backend_impl>( db );
+  }
+
+} } // bts::db
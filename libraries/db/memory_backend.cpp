@@ -0,0 +1,164 @@
+#include <bts/db/memory_backend.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     /** the order of the table comparator, or bytewise without one */
+     class memory_key_less
+     {
+        public:
+          memory_key_less( const std::shared_ptr<const kv_comparator>& c = nullptr ):_comparator(c){}
+
+          bool operator()( const std::string& a, const std::string& b )const
+          {
+             if( !_comparator ) return a < b;
+             return _comparator->compare( kv_slice( a ), kv_slice( b ) ) < 0;
+          }
+
+        private:
+          std::shared_ptr<const kv_comparator> _comparator;
+     };
+
+     typedef std::map<std::string,std::string,memory_key_less> memory_table;
+     typedef std::shared_ptr<const memory_table>               memory_table_ptr;
+
+     /** a version of the table, writes after it was taken copy the table first */
+     class memory_snapshot : public kv_snapshot
+     {
+        public:
+          memory_snapshot( const memory_table_ptr& t ):_table(t){}
+
+          memory_table_ptr _table;
+     };
+
+     class memory_iterator : public kv_iterator
+     {
+        public:
+          memory_iterator( const memory_table_ptr& t ):_table(t),_it(t->end()){}
+
+          bool     valid()const                  { return _it != _table->end(); }
+          void     seek_to_first()               { _it = _table->begin(); }
+          void     seek_to_last()                { _it = _table->empty() ? _table->end() : std::prev( _table->end() ); }
+          void     seek( const kv_slice& key )   { _it = _table->lower_bound( std::string( key.data, key.size ) ); }
+          void     next()                        { ++_it; }
+          void     prev()                        { _it = _it == _table->begin() ? _table->end() : std::prev( _it ); }
+          kv_slice key()const                    { return kv_slice( _it->first ); }
+          kv_slice value()const                  { return kv_slice( _it->second ); }
+          void     check_status()const           {}
+
+        private:
+          memory_table_ptr             _table;
+          memory_table::const_iterator _it;
+     };
+
+     class memory_batch : public kv_batch
+     {
+        public:
+          void put( const kv_slice& key, const kv_slice& value )
+          {
+             _ops.push_back( op{ std::string( key.data, key.size ), std::string( value.data, value.size ), false } );
+          }
+          void remove( const kv_slice& key )
+          {
+             _ops.push_back( op{ std::string( key.data, key.size ), std::string(), true } );
+          }
+
+          struct op
+          {
+             std::string key;
+             std::string value;
+             bool        removed;
+          };
+          std::vector<op> _ops;
+     };
+
+     /**
+      *  Readers share the current table with a snapshot, a write while anyone else holds
+      *  it replaces the table with a copy, so snapshots and iterators never see it change.
+      */
+     class memory_backend_impl : public kv_backend
+     {
+        public:
+          memory_backend_impl( const std::shared_ptr<const kv_comparator>& c )
+          :_table( std::make_shared<memory_table>( memory_key_less( c ) ) ){}
+
+          bool get( const kv_slice& key, std::string& value, const kv_snapshot* snapshot )const
+          {
+             memory_table_ptr table = snapshot ? static_cast<const memory_snapshot*>( snapshot )->_table : current();
+             auto itr = table->find( std::string( key.data, key.size ) );
+             if( itr == table->end() ) return false;
+             value = itr->second;
+             return true;
+          }
+
+          void put( const kv_slice& key, const kv_slice& value )
+          {
+             std::unique_lock<std::mutex> lock( _mutex );
+             writable()[std::string( key.data, key.size )] = std::string( value.data, value.size );
+          }
+
+          void remove( const kv_slice& key )
+          {
+             std::unique_lock<std::mutex> lock( _mutex );
+             writable().erase( std::string( key.data, key.size ) );
+          }
+
+          std::unique_ptr<kv_batch> create_batch()const
+          {
+             return std::unique_ptr<kv_batch>( new memory_batch() );
+          }
+
+          void write( kv_batch& batch, bool )
+          {
+             std::unique_lock<std::mutex> lock( _mutex );
+             memory_table& table = writable();
+             for( const auto& o : static_cast<memory_batch&>( batch )._ops )
+             {
+                if( o.removed ) table.erase( o.key );
+                else            table[o.key] = o.value;
+             }
+          }
+
+          kv_snapshot_ptr snapshot()const
+          {
+             return std::make_shared<memory_snapshot>( current() );
+          }
+
+          std::unique_ptr<kv_iterator> iterate( const kv_snapshot* snapshot )const
+          {
+             memory_table_ptr table = snapshot ? static_cast<const memory_snapshot*>( snapshot )->_table : current();
+             return std::unique_ptr<kv_iterator>( new memory_iterator( table ) );
+          }
+
+        private:
+          memory_table_ptr current()const
+          {
+             std::unique_lock<std::mutex> lock( _mutex );
+             return _table;
+          }
+
+          /** called with _mutex held */
+          memory_table& writable()
+          {
+             if( !_table.unique() ) _table = std::make_shared<memory_table>( *_table );
+             return *_table;
+          }
+
+          mutable std::mutex            _mutex;
+          std::shared_ptr<memory_table> _table;
+     };
+  } // namespace detail
+
+  kv_backend_ptr open_memory_backend( const fc::path& dir, bool create, const level_options& options,
+                                      const kv_table_info* table )
+  {
+     return std::make_shared<detail::memory_backend_impl>( table ? table->comparator : nullptr );
+  }
+
+} } // bts::db
@@ -0,0 +1,161 @@
+#include <bts/db/memory_budget.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <algorithm>
+#include <mutex>
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     struct budget_entry
+     {
+        memory_budget_usage           usage;
+        uint32_t                      share;
+        memory_budget::usage_function get_usage;
+        memory_budget::limit_function set_limit;
+     };
+
+     class memory_budget_impl
+     {
+        public:
+           memory_budget_impl( uint64_t total ):_total(total){}
+
+           mutable std::mutex          _mutex;
+           uint64_t                    _total;
+           std::vector<budget_entry>   _entries;
+     };
+  }
+
+  memory_budget::memory_budget( uint64_t total_bytes )
+  :my( new detail::memory_budget_impl( total_bytes ) )
+  {
+  }
+
+  memory_budget::~memory_budget()
+  {
+  }
+
+  void memory_budget::set_total( uint64_t total_bytes )
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     my->_total = total_bytes;
+  }
+
+  uint64_t memory_budget::get_total()const
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     return my->_total;
+  }
+
+  void memory_budget::add_cache( const std::string& name, uint32_t share, uint32_t priority,
+                                 const usage_function& usage, const limit_function& limit )
+  {
+     FC_ASSERT( usage && limit );
+     detail::budget_entry entry;
+     entry.usage.name     = name;
+     entry.usage.priority = priority;
+     entry.share          = share;
+     entry.get_usage      = usage;
+     entry.set_limit      = limit;
+
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     for( auto& e : my->_entries )
+     {
+        if( e.usage.name == name ) { e = entry; return; }
+     }
+     my->_entries.push_back( entry );
+  }
+
+  void memory_budget::remove_cache( const std::string& name )
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     my->_entries.erase( std::remove_if( my->_entries.begin(), my->_entries.end(),
+                                         [&]( const detail::budget_entry& e ){ return e.usage.name == name; } ),
+                         my->_entries.end() );
+  }
+
+  /** the callbacks are called without holding the lock, they may take locks of their own */
+  void memory_budget::rebalance()
+  {
+     std::vector<detail::budget_entry> entries;
+     uint64_t total = 0;
+     {
+        std::unique_lock<std::mutex> lock( my->_mutex );
+        entries = my->_entries;
+        total   = my->_total;
+     }
+     if( total == 0 || entries.empty() ) return;
+
+     uint64_t shares = 0;
+     for( const auto& e : entries ) shares += e.share;
+     if( shares == 0 ) return;
+
+     std::vector<detail::budget_entry*> by_priority;
+     uint64_t used  = 0;
+     uint64_t spare = 0;
+     for( auto& e : entries )
+     {
+        e.usage.quota = uint64_t( double(total) * e.share / shares );
+        e.usage.limit = e.usage.quota;
+        e.usage.usage = e.get_usage();
+        used += e.usage.usage;
+        if( e.usage.usage < e.usage.quota ) spare += e.usage.quota - e.usage.usage;
+        by_priority.push_back( &e );
+     }
+     std::stable_sort( by_priority.begin(), by_priority.end(),
+                       []( const detail::budget_entry* a, const detail::budget_entry* b ){ return a->usage.priority > b->usage.priority; } );
+
+     // what the caches below their quota don't use is lent to the full ones, highest priority first
+     auto borrower = std::find_if( by_priority.begin(), by_priority.end(),
+                                   []( const detail::budget_entry* e ){ return e->usage.usage >= e->usage.quota; } );
+
+     // without pressure the other caches above their quota keep what they use, out of the spare
+     if( used <= total )
+     {
+        for( auto itr = by_priority.begin(); itr != by_priority.end(); ++itr )
+        {
+           auto& u = (*itr)->usage;
+           if( itr == borrower || u.usage <= u.quota ) continue;
+           u.limit = u.usage;
+           spare  -= std::min( spare, u.usage - u.quota );
+        }
+     }
+     if( borrower != by_priority.end() ) (*borrower)->usage.limit += spare;
+
+     // a lender that grew back takes back what it lent, the caches above their quota give up
+     // what they use beyond it from the lowest priority up, and no cache is left above its quota
+     // unless the others leave it spare memory
+     if( used > total )
+     {
+        uint64_t excess = used - total;
+        for( auto itr = by_priority.rbegin(); itr != by_priority.rend() && excess; ++itr )
+        {
+           auto& u = (*itr)->usage;
+           if( u.usage <= u.quota ) continue;
+           uint64_t cut = std::min( excess, u.usage - u.quota );
+           u.limit = std::min( u.limit, u.usage - cut );
+           excess -= cut;
+        }
+     }
+
+     for( const auto& e : entries ) e.set_limit( e.usage.limit );
+
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     for( auto& current : my->_entries )
+     {
+        for( const auto& e : entries )
+           if( e.usage.name == current.usage.name ) current.usage = e.usage;
+     }
+  }
+
+  std::vector<memory_budget_usage> memory_budget::get_usage()const
+  {
+     std::unique_lock<std::mutex> lock( my->_mutex );
+     std::vector<memory_budget_usage> result;
+     result.reserve( my->_entries.size() );
+     for( const auto& e : my->_entries ) result.push_back( e.usage );
+     return result;
+  }
+
+} } // bts::db
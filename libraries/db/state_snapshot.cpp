@@ -0,0 +1,124 @@
+#include <bts/db/state_snapshot.hpp>
+#include <fc/interprocess/file_mapping.hpp>
+
+#include <fstream>
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     static const uint32_t snapshot_magic = 0x53545342; // "BSTS"
+
+     struct snapshot_header
+     {
+        snapshot_header():magic(snapshot_magic),version(0),size(0){}
+
+        uint32_t       magic;
+        uint32_t       version;
+        fc::ripemd160  state_id;
+        uint64_t       size;      ///< of the packed state that follows the header
+        fc::ripemd160  checksum;  ///< of the packed state
+     };
+  }
+
+} } // bts::db
+
+FC_REFLECT( bts::db::detail::snapshot_header, (magic)(version)(state_id)(size)(checksum) )
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     class mapped_snapshot_impl
+     {
+        public:
+           mapped_snapshot_impl():_data(nullptr),_size(0){}
+
+           std::unique_ptr<fc::file_mapping>   _mapping;
+           std::unique_ptr<fc::mapped_region>  _region;
+           const char*                         _data;
+           size_t                              _size;
+     };
+  }
+
+  mapped_snapshot::mapped_snapshot()
+  :my( new detail::mapped_snapshot_impl() )
+  {
+  }
+
+  mapped_snapshot::~mapped_snapshot()
+  {
+  }
+
+  bool mapped_snapshot::open( const fc::path& file, uint32_t version, const fc::ripemd160& state_id )
+  {
+     try {
+        if( !fc::exists( file ) ) return false;
+        size_t file_size = fc::file_size( file );
+        size_t header_size = fc::raw::pack_size( detail::snapshot_header() );
+        if( file_size < header_size ) return false;
+
+        my->_mapping.reset( new fc::file_mapping( file.generic_string().c_str(), fc::read_only ) );
+        my->_region.reset( new fc::mapped_region( *my->_mapping, fc::read_only, 0, file_size ) );
+        const char* base = (const char*)my->_region->get_address();
+
+        detail::snapshot_header header;
+        fc::datastream<const char*> ds( base, header_size );
+        fc::raw::unpack( ds, header );
+
+        if( header.magic != detail::snapshot_magic || header.version != version || header.state_id != state_id )
+        {
+           ilog( "state snapshot ${file} is stale", ("file",file) );
+           return false;
+        }
+        if( header.size != file_size - header_size ||
+            fc::ripemd160::hash( base + header_size, header.size ) != header.checksum )
+        {
+           wlog( "state snapshot ${file} is damaged", ("file",file) );
+           return false;
+        }
+
+        my->_data = base + header_size;
+        my->_size = header.size;
+        return true;
+     }
+     catch ( const fc::exception& e )
+     {
+        wlog( "unable to map state snapshot ${file}: ${e}", ("file",file)("e",e.to_detail_string()) );
+        return false;
+     }
+  }
+
+  const char* mapped_snapshot::data()const
+  {
+     return my->_data;
+  }
+
+  size_t mapped_snapshot::size()const
+  {
+     return my->_size;
+  }
+
+  void write_state_snapshot( const fc::path& file, uint32_t version, const fc::ripemd160& state_id,
+                             const std::vector<char>& packed_state )
+  { try {
+     detail::snapshot_header header;
+     header.version  = version;
+     header.state_id = state_id;
+     header.size     = packed_state.size();
+     header.checksum = fc::ripemd160::hash( packed_state.data(), packed_state.size() );
+     auto packed_header = fc::raw::pack( header );
+
+     fc::path tmp = file.parent_path() / (file.filename().string() + ".tmp");
+     {
+        std::ofstream out( tmp.generic_string().c_str(), std::ios::binary | std::ios::trunc );
+        out.write( packed_header.data(), packed_header.size() );
+        out.write( packed_state.data(), packed_state.size() );
+        out.flush();
+        FC_ASSERT( out.good(), "unable to write ${file}", ("file",tmp) );
+     }
+     if( fc::exists( file ) ) fc::remove( file );
+     fc::rename( tmp, file );
+  } FC_RETHROW_EXCEPTIONS( warn, "error writing state snapshot ${file}", ("file",file) ) }
+
+} } // bts::db
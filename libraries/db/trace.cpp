@@ -0,0 +1,141 @@
+#include <bts/db/trace.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/time.hpp>
+
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     struct trace_event
+     {
+        const char* name;
+        uint64_t    thread;
+        int64_t     start;
+        int64_t     duration;
+     };
+
+     class tracer_impl
+     {
+        public:
+           static const size_t capacity = 1 << 16;
+
+           tracer_impl():_next(0),_size(0){ _events.resize( capacity ); }
+
+           std::mutex                      _mutex;
+           std::vector<trace_event>        _events;
+           size_t                          _next;
+           size_t                          _size;
+           /** keyed by the address of the name literal */
+           std::map<const char*,int64_t>   _counters;
+     };
+
+     inline int64_t now_us()
+     {
+        return fc::time_point::now().time_since_epoch().count();
+     }
+
+     /** the names are literals of this code base, only quotes and backslashes need escaping */
+     void write_name( std::ostream& out, const char* name )
+     {
+        out << '"';
+        for( const char* c = name; *c; ++c )
+        {
+           if( *c == '"' || *c == '\\' ) out << '\\';
+           out << *c;
+        }
+        out << '"';
+     }
+  }
+
+  tracer& tracer::instance()
+  {
+     static tracer t;
+     return t;
+  }
+
+  tracer::tracer()
+  :_enabled(true),my( new detail::tracer_impl() )
+  {
+  }
+
+  tracer::~tracer()
+  {
+  }
+
+  void tracer::record_span( const char* name, int64_t start_us, int64_t duration_us )
+  {
+     detail::trace_event e = { name, std::hash<std::thread::id>()( std::this_thread::get_id() ), start_us, duration_us };
+     std::lock_guard<std::mutex> lock( my->_mutex );
+     my->_events[my->_next] = e;
+     my->_next = (my->_next + 1) % detail::tracer_impl::capacity;
+     if( my->_size < detail::tracer_impl::capacity ) ++my->_size;
+  }
+
+  void tracer::add_counter( const char* name, int64_t delta )
+  {
+     std::lock_guard<std::mutex> lock( my->_mutex );
+     my->_counters[name] += delta;
+  }
+
+  void tracer::dump( const fc::path& file )
+  { try {
+     std::vector<detail::trace_event> events;
+     std::map<const char*,int64_t>    counters;
+     {
+        std::lock_guard<std::mutex> lock( my->_mutex );
+        size_t first = (my->_next + detail::tracer_impl::capacity - my->_size) % detail::tracer_impl::capacity;
+        events.reserve( my->_size );
+        for( size_t i = 0; i < my->_size; ++i )
+           events.push_back( my->_events[(first + i) % detail::tracer_impl::capacity] );
+        my->_size = 0;
+        my->_next = 0;
+        counters = my->_counters;
+     }
+
+     std::ofstream out( file.generic_string().c_str() );
+     FC_ASSERT( out.good(), "unable to open ${file}", ("file",file) );
+
+     out << "{\"traceEvents\":[\n";
+     bool first = true;
+     for( const auto& e : events )
+     {
+        if( !first ) out << ",\n";
+        first = false;
+        out << "{\"name\":";
+        detail::write_name( out, e.name );
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << (e.thread & 0xffffffff)
+            << ",\"ts\":" << e.start << ",\"dur\":" << e.duration << "}";
+     }
+     auto ts = detail::now_us();
+     for( const auto& c : counters )
+     {
+        if( !first ) out << ",\n";
+        first = false;
+        out << "{\"name\":";
+        detail::write_name( out, c.first );
+        out << ",\"ph\":\"C\",\"pid\":1,\"ts\":" << ts << ",\"args\":{\"value\":" << c.second << "}}";
+     }
+     out << "\n]}\n";
+     FC_ASSERT( out.good(), "unable to write ${file}", ("file",file) );
+  } FC_RETHROW_EXCEPTIONS( warn, "unable to dump trace to ${file}", ("file",file) ) }
+
+  trace_span::trace_span( const char* name )
+  :_name(name),_start( tracer::instance().enabled() ? detail::now_us() : 0 )
+  {
+  }
+
+  trace_span::~trace_span()
+  {
+     if( _start )
+        tracer::instance().record_span( _name, _start, detail::now_us() - _start );
+  }
+
+} } // bts::db
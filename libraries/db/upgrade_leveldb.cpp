@@ -1,4 +1,7 @@
 #include <bts/db/upgrade_leveldb.hpp>
+#include <leveldb/write_batch.h>
+#include <fc/crypto/hex.hpp>
+#include <fc/filesystem.hpp>
 #include <fc/log/logger.hpp>
 #include <boost/filesystem.hpp>
 #include <fstream>
@@ -19,9 +22,210 @@ namespace bts { namespace db {
     }
 
 
+    namespace
+    {
+      typedef std::function<void(const leveldb::Slice& key, const leveldb::Slice& value, leveldb::WriteBatch& batch)> copy_record_function;
+
+      fc::path upgrade_dir_for( const fc::path& dir )
+      {
+        return dir.parent_path() / (dir.filename().string() + ".upgrade");
+      }
+
+      /** where dir is moved while the upgrade takes its place */
+      fc::path backup_dir_for( const fc::path& dir )
+      {
+        return dir.parent_path() / (dir.filename().string() + ".old");
+      }
+
+      /**
+       *  Written into the upgrade directory before the databases are swapped, the copy is
+       *  whole once it exists.  It moves into dir with the copy and is removed last but one,
+       *  before the backup.
+       */
+      fc::path complete_marker( const fc::path& upgrade_dir )
+      {
+        return upgrade_dir / "UPGRADE_COMPLETE";
+      }
+
+      void check( const leveldb::Status& status )
+      {
+        if( !status.ok() )
+          FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+      }
+
+      /**
+       *  The UPGRADE_POSITION file of a copy holds the number of records copied and the hex
+       *  of the last source key copied.  It is written after the batch it describes so an
+       *  interruption at worst copies that batch again, which rewrites the same records.
+       */
+      bool read_position( const fc::path& upgrade_dir, uint64_t& records, std::string& last_key )
+      {
+        fc::path position_filename = upgrade_dir / "UPGRADE_POSITION";
+        if( !fc::exists( position_filename ) ) return false;
+        std::ifstream is( position_filename.to_native_ansi_path() );
+        std::string hex;
+        is >> records >> hex;
+        if( !is ) return false;
+        last_key.resize( hex.size() / 2 );
+        if( !last_key.empty() )
+          fc::from_hex( hex, &last_key[0], last_key.size() );
+        return true;
+      }
+
+      void write_position( const fc::path& upgrade_dir, uint64_t records, const std::string& last_key )
+      {
+        fc::path position_filename = upgrade_dir / "UPGRADE_POSITION";
+        fc::path tmp_filename      = upgrade_dir / "UPGRADE_POSITION.tmp";
+        {
+          std::ofstream os( tmp_filename.to_native_ansi_path(), std::ios::trunc );
+          os << records << " " << fc::to_hex( last_key.data(), last_key.size() ) << std::endl;
+          os.flush();
+          FC_ASSERT( os.good(), "unable to write ${file}", ("file",tmp_filename) );
+        }
+        if( fc::exists( position_filename ) )
+          fc::remove( position_filename );
+        fc::rename( tmp_filename, position_filename );
+      }
+
+      void report( const fc::path& dir, uint64_t records, bool done )
+      {
+        auto& mapper = upgrade_db_mapper::instance();
+        if( !mapper._progress ) return;
+        upgrade_progress progress;
+        progress.db      = dir.to_native_ansi_path();
+        progress.records = records;
+        progress.done    = done;
+        mapper._progress( progress );
+      }
+
+      /**
+       *  Copies the records of source into the database next to dir in batches, resuming
+       *  from the saved position of an earlier copy.
+       *
+       *  @return the number of records copied
+       */
+      uint64_t copy_records( const fc::path& dir, leveldb::DB* source, const leveldb::Comparator* comparator,
+                             const copy_record_function& copy )
+      {
+        fc::path upgrade_dir = upgrade_dir_for( dir );
+
+        uint64_t records = 0;
+        std::string last_key;
+        bool resume = fc::exists( upgrade_dir ) && read_position( upgrade_dir, records, last_key );
+        if( !resume && fc::exists( upgrade_dir ) )
+          fc::remove_all( upgrade_dir );
+
+        leveldb::Options upgraded_opts;
+        upgraded_opts.create_if_missing = true;
+        upgraded_opts.error_if_exists   = !resume;
+        upgraded_opts.comparator        = comparator;
+
+        leveldb::DB* upgraded_db = nullptr;
+        check( leveldb::DB::Open( upgraded_opts, upgrade_dir.to_native_ansi_path().c_str(), &upgraded_db ) );
+        std::unique_ptr<leveldb::DB> upgraded( upgraded_db );
+
+        if( resume )
+          ilog( "Resuming upgrade of ${db} after ${count} records", ("db",dir.to_native_ansi_path())("count",records) );
+
+        leveldb::WriteOptions sync_opts;
+        sync_opts.sync = true;
+
+        const uint32_t batch_size = upgrade_db_mapper::instance()._batch_size;
+        uint32_t       in_batch   = 0;
+        leveldb::WriteBatch batch;
+        std::unique_ptr<leveldb::Iterator> itr( source->NewIterator( leveldb::ReadOptions() ) );
+        if( resume )
+        {
+          itr->Seek( last_key );
+          if( itr->Valid() && itr->key() == leveldb::Slice( last_key ) ) itr->Next();
+        }
+        else
+        {
+          itr->SeekToFirst();
+        }
+
+        for( ; itr->Valid(); itr->Next() )
+        {
+          copy( itr->key(), itr->value(), batch );
+          ++records;
+          if( ++in_batch == batch_size )
+          {
+            check( upgraded->Write( sync_opts, &batch ) );
+            batch.Clear();
+            in_batch = 0;
+            write_position( upgrade_dir, records, itr->key().ToString() );
+            report( dir, records, false );
+          }
+        }
+        check( itr->status() );
+
+        check( upgraded->Write( sync_opts, &batch ) );
+        if( fc::exists( upgrade_dir / "UPGRADE_POSITION" ) )
+          fc::remove( upgrade_dir / "UPGRADE_POSITION" );
+        report( dir, records, true );
+        return records;
+      }
+    }
+
+    /**
+     *  Every step leaves either dir or its backup next to a complete copy, so that
+     *  recover_upgrade_db() can finish the swap after a crash between any two of them.
+     */
+    void finish_upgrade_db( const fc::path& dir )
+    { try {
+      fc::path upgrade_dir = upgrade_dir_for( dir );
+      fc::path backup_dir  = backup_dir_for( dir );
+      FC_ASSERT( fc::exists( upgrade_dir ), "no upgrade of ${db} to finish", ("db",dir) );
+      if( !fc::exists( complete_marker( upgrade_dir ) ) )
+      {
+        std::ofstream os( complete_marker( upgrade_dir ).to_native_ansi_path() );
+        os << "1" << std::endl;
+        os.flush();
+        FC_ASSERT( os.good(), "unable to mark the upgrade of ${db} complete", ("db",dir) );
+      }
+      if( fc::exists( dir ) )
+      {
+        // left by a swap that was done but for deleting it
+        if( fc::exists( backup_dir ) )
+          fc::remove_all( backup_dir );
+        fc::rename( dir, backup_dir );
+      }
+      fc::rename( upgrade_dir, dir );
+      fc::remove( complete_marker( dir ) );
+      fc::remove_all( backup_dir );
+    } FC_RETHROW_EXCEPTIONS( warn, "error replacing ${db} with its upgrade", ("db",dir) ) }
+
+    bool recover_upgrade_db( const fc::path& dir )
+    { try {
+      fc::path upgrade_dir = upgrade_dir_for( dir );
+      fc::path backup_dir  = backup_dir_for( dir );
+      if( fc::exists( complete_marker( upgrade_dir ) ) )
+      {
+        ilog( "Finishing the interrupted upgrade of ${db}", ("db",dir.to_native_ansi_path()) );
+        finish_upgrade_db( dir );
+        return true;
+      }
+      if( !fc::exists( backup_dir ) && !fc::exists( complete_marker( dir ) ) )
+        return false;
+
+      if( !fc::exists( dir ) )
+      {
+        // the swap never started with a copy that is whole, so the backup is the database
+        fc::rename( backup_dir, dir );
+        return true;
+      }
+      // the upgraded copy is in place, only the cleanup was interrupted
+      if( fc::exists( complete_marker( dir ) ) )
+        fc::remove( complete_marker( dir ) );
+      if( fc::exists( backup_dir ) )
+        fc::remove_all( backup_dir );
+      return true;
+    } FC_RETHROW_EXCEPTIONS( warn, "error recovering the upgrade of ${db}", ("db",dir) ) }
+
     // this code has no bitshares dependencies, and it
     // could be moved to fc, if fc ever adds a leveldb dependency
-    void try_upgrade_db( const fc::path& dir, leveldb::DB* dbase, const char* record_type, size_t record_type_size )
+    bool try_upgrade_db( const fc::path& dir, leveldb::DB* dbase, const char* record_type, size_t record_type_size,
+                         const leveldb::Comparator* comparator )
     {
       size_t old_record_type_size = 0;
       std::string old_record_type;
@@ -36,7 +240,7 @@ namespace bts { namespace db {
         if (!isdigit(old_record_type[last_char]))
         {
           ilog("Database ${db} is not upgradeable",("db",dir.to_native_ansi_path()));
-          return;
+          return false;
         }
         //strip version number from current_record_name and append 0 to set old_record_type (e.g. mytype0)
         while (isdigit(old_record_type[last_char]))
@@ -65,12 +269,21 @@ namespace bts { namespace db {
           ilog("Upgrading database ${db} from ${old} to ${new}",("db",dir.to_native_ansi_path())
                                                                 ("old",old_record_type)
                                                                 ("new",record_type));
-          //update database's RECORD_TYPE to new record type name
-          std::ofstream os(record_type_filename.to_native_ansi_path());
+          //copy the database converted by the upgrade function
+          const upgrade_db_function& upgrade = upgrade_function_itr->second;
+          auto records = copy_records( dir, dbase, comparator,
+            [&]( const leveldb::Slice& key, const leveldb::Slice& value, leveldb::WriteBatch& batch )
+            {
+              auto vec = upgrade( value );
+              batch.Put( key, leveldb::Slice( vec.data(), vec.size() ) );
+            });
+
+          //the copy is of the new record type
+          std::ofstream os((upgrade_dir_for( dir ) / "RECORD_TYPE").to_native_ansi_path());
           os << record_type << std::endl;
           os << record_type_size;
-          //upgrade the database using upgrade function
-          upgrade_function_itr->second(dbase);
+          ilog( "Upgraded ${count} records in ${db}", ("count",records)("db",dir.to_native_ansi_path()) );
+          return true;
         }
         else
         {
@@ -90,5 +303,43 @@ namespace bts { namespace db {
                  ("db",dir.to_native_ansi_path())("new",record_type));
 
       }
+      return false;
     }
+
+    bool try_upgrade_key_encoding( const fc::path& dir, const leveldb::Comparator* legacy_comparator,
+                                   const reencode_key_function& reencode )
+    { try {
+      leveldb::Options legacy_opts;
+      legacy_opts.create_if_missing = false;
+      legacy_opts.comparator = legacy_comparator;
+
+      leveldb::DB* legacy_db = nullptr;
+      auto status = leveldb::DB::Open( legacy_opts, dir.to_native_ansi_path().c_str(), &legacy_db );
+      if( !status.ok() )
+      {
+        elog( "Unable to open ${db} with legacy key comparator: ${msg}",
+              ("db",dir.to_native_ansi_path())("msg",status.ToString()) );
+        return false;
+      }
+      std::unique_ptr<leveldb::DB> legacy( legacy_db );
+
+      ilog( "Upgrading key encoding of database ${db}", ("db",dir.to_native_ansi_path()) );
+
+      auto records = copy_records( dir, legacy.get(), leveldb::BytewiseComparator(),
+        [&]( const leveldb::Slice& key, const leveldb::Slice& value, leveldb::WriteBatch& batch )
+        {
+          batch.Put( reencode( key ), value );
+        });
+      legacy.reset();
+
+      fc::path record_type_filename = dir / "RECORD_TYPE";
+      if( fc::exists( record_type_filename ) )
+        fc::copy( record_type_filename, upgrade_dir_for( dir ) / "RECORD_TYPE" );
+
+      finish_upgrade_db( dir );
+
+      ilog( "Upgraded ${count} records in ${db}", ("count",records)("db",dir.to_native_ansi_path()) );
+      return true;
+    } FC_RETHROW_EXCEPTIONS( warn, "error upgrading key encoding of ${db}", ("db",dir) ) }
+
 } } // namespace bts;:db
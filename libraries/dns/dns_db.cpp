@@ -1,8 +1,12 @@
 #include <bts/dns/dns_db.hpp>
 #include <bts/dns/util.hpp>
+#include <bts/db/state_snapshot.hpp>
 
 namespace bts { namespace dns {
 
+/* Of the dns_resolver.snapshot layout, a snapshot of another version is rebuilt */
+static const uint32_t resolver_snapshot_version = 1;
+
 dns_db::dns_db()
 {
     set_transaction_validator(std::make_shared<dns_transaction_validator>(this));
@@ -13,50 +17,202 @@ dns_db::~dns_db()
     close();
 }
 
-void dns_db::open(const fc::path& dir, bool create)
+void dns_db::open(const fc::path& dir, bool create, const bts::blockchain::chain_database_tuning& tuning)
 { try {
-    chain_database::open(dir, create);
-    _dns2ref.open(dir / "dns2ref", create);
+    chain_database::open(dir, create, tuning);
+    _records.open(dir / "dns_records", create, tuning.records);
+    _auction_closes.open(dir / "dns_auction_index", create, tuning.records);
+    _expires.open(dir / "dns_expiry_index", create, tuning.records);
+
+    if (fc::exists(dir / "dns2ref"))
+        upgrade_dns2ref(dir);
+
+    /* databases from before the indexes existed */
+    if (_records.begin().valid() && !_auction_closes.begin().valid() && !_expires.begin().valid())
+        build_deadline_indexes();
+
+    _resolver_snapshot = dir / "dns_resolver.snapshot";
+    if (!load_resolver_table())
+        build_resolver_table();
 } FC_RETHROW_EXCEPTIONS(warn, "Error opening DNS database in dir=${dir} with create=${create}", ("dir", dir) ("create", create)) }
 
 void dns_db::close()
 {
-    _dns2ref.close();
+    save_resolver_table();
+    _expires.close();
+    _auction_closes.close();
+    _records.close();
     chain_database::close();
+
+    std::unique_lock<std::mutex> lock(_values_mutex);
+    _values.clear();
+    _resolver_stats = dns_resolver_stats();
 }
 
+/* The domain outputs come decoded from the block state that validated blk, they are
+ * only decoded again if the state is not from a dns_transaction_validator */
 void dns_db::store(const trx_block& blk, const signed_transactions& deterministic_trxs,
                    const block_evaluation_state_ptr& state)
 {
     chain_database::store(blk, deterministic_trxs, state);
 
-    for (auto i = 0u; i < blk.trxs.size(); i++)
+    auto dns_state = std::dynamic_pointer_cast<dns_block_evaluation_state>(state);
+    std::vector<dns_block_output> decoded;
+    if (!dns_state)
+    {
+        for (const auto& tx : blk.trxs)
+        {
+            for (auto j = 0u; j < tx.outputs.size(); j++)
+            {
+                if (!is_domain_output(tx.outputs[j]))
+                    continue;
+
+                dns_block_output block_output;
+                block_output.ref = output_reference(tx.id(), j);
+                block_output.output = to_domain_output(tx.outputs[j]);
+                block_output.amount = tx.outputs[j].amount;
+                decoded.push_back(block_output);
+            }
+        }
+    }
+    const auto& domain_outputs = dns_state ? dns_state->domain_outputs : decoded;
+    if (domain_outputs.empty())
+        return;
+
+    _records.begin_batch();
+    _auction_closes.begin_batch();
+    _expires.begin_batch();
+
+    try
+    {
+        for (const auto& block_output : domain_outputs)
+        {
+            const auto& name = block_output.output.name;
+            auto prev = find_dns_record(name);
+            if (prev != nullptr)
+                index_deadlines(name, *prev, false);
+
+            auto record = dns_record(block_output.ref, blk.block_num, block_output.output, block_output.amount);
+            set_dns_record(name, record);
+            index_deadlines(name, record, true);
+            set_resolved_value(name, block_output.output.value);
+        }
+    }
+    catch (...)
     {
-        auto tx = blk.trxs[i];
+        _expires.abort_batch();
+        _auction_closes.abort_batch();
+        _records.abort_batch();
+        build_resolver_table();
+        throw;
+    }
+
+    _records.commit_batch();
+    _auction_closes.commit_batch();
+    _expires.commit_batch();
+}
+
+/* Each domain output replaces the reference of its name, the previous reference is
+ * the domain output for the same name spent by the transaction if there is one.
+ * The writes are staged until commit_undo, the resolver table is rebuilt if they
+ * are aborted */
+void dns_db::undo(const trx_block& blk)
+{
+    _records.begin_batch();
+    _auction_closes.begin_batch();
+    _expires.begin_batch();
 
-        for (auto output : tx.outputs)
+    for (auto i = blk.trxs.size(); i > 0; i--)
+    {
+        const auto& tx = blk.trxs[i - 1];
+
+        for (const auto& output : tx.outputs)
         {
             if (!is_domain_output(output))
                 continue;
 
-            set_dns_ref(to_domain_output(output).name, output_reference(tx.id(), i));
+            auto name = to_domain_output(output).name;
+            bool restored = false;
+
+            auto current = find_dns_record(name);
+            if (current != nullptr)
+                index_deadlines(name, *current, false);
+
+            for (const auto& input : tx.inputs)
+            {
+                auto prev = fetch_output(input.output_ref);
+                if (is_domain_output(prev) && to_domain_output(prev).name == name)
+                {
+                    auto record = make_dns_record(input.output_ref);
+                    set_dns_record(name, record);
+                    index_deadlines(name, record, true);
+                    set_resolved_value(name, to_domain_output(prev).value);
+                    restored = true;
+                    break;
+                }
+            }
+
+            if (!restored && has_dns_ref(name))
+            {
+                remove_dns_ref(name);
+                set_resolved_value(name, std::vector<char>());
+            }
         }
     }
+
+    chain_database::undo(blk);
 }
 
-void dns_db::set_dns_ref(const std::string& key, const bts::blockchain::output_reference& ref)
+void dns_db::commit_undo()
 {
-    _dns2ref.store(key, ref);
+    _records.commit_batch();
+    _auction_closes.commit_batch();
+    _expires.commit_batch();
+    chain_database::commit_undo();
 }
 
-bts::blockchain::output_reference dns_db::get_dns_ref(const std::string& key)
+void dns_db::abort_undo()
+{
+    _expires.abort_batch();
+    _auction_closes.abort_batch();
+    _records.abort_batch();
+    build_resolver_table();
+    chain_database::abort_undo();
+}
+
+void dns_db::set_dns_record(const std::string& key, const dns_record& record)
+{
+    _records.store(key, record);
+}
+
+dns_record dns_db::get_dns_record(const std::string& key)
 { try {
-    return _dns2ref.fetch(key);
+    return _records.fetch(key);
 } FC_RETHROW_EXCEPTIONS(warn, "Could not fetch DNS key=${key}", ("key", key)) }
 
+const dns_record* dns_db::find_dns_record(const std::string& key)
+{
+    return _records.find(key);
+}
+
+bts::blockchain::output_reference dns_db::get_dns_ref(const std::string& key)
+{
+    return get_dns_record(key).ref;
+}
+
 bool dns_db::has_dns_ref(const std::string& key)
 {
-    return _dns2ref.find(key).valid();
+    return find_dns_record(key) != nullptr;
+}
+
+void dns_db::remove_dns_ref(const std::string& key)
+{
+    _records.remove(key);
+}
+
+void dns_db::set_record_cache_size(size_t size)
+{
+    _records.set_max_cache_size(size);
 }
 
 std::map<std::string, bts::blockchain::output_reference>
@@ -65,22 +221,185 @@ std::map<std::string, bts::blockchain::output_reference>
     FC_ASSERT(f != nullptr, "Null filter function");
     std::map<std::string, bts::blockchain::output_reference> map;
 
-    bts::db::level_map<std::string, bts::blockchain::output_reference>::iterator iter = _dns2ref.begin();
-    if (!iter.valid()) return map;
+    for (auto iter = _records.begin(); iter.valid(); ++iter)
+    {
+        auto ref = iter.value().ref;
+        if (f(iter.key(), ref, *this))
+            map[iter.key()] = ref;
+    }
+
+    return map;
+}
+
+std::vector<std::string> dns_db::get_active_auction_names()
+{
+    return names_between(_auction_closes, head_block_num() + 1, trx_num::invalid_block_num);
+}
+
+std::vector<std::string> dns_db::get_expiring_names(uint32_t blocks)
+{
+    auto head = head_block_num();
+    auto last = blocks < trx_num::invalid_block_num - head ? head + blocks : trx_num::invalid_block_num;
+    if (last <= head) return std::vector<std::string>();
+
+    return names_between(_expires, head + 1, last);
+}
+
+dns_record dns_db::make_dns_record(const bts::blockchain::output_reference& ref)
+{
+    auto output = fetch_output(ref);
+    return dns_record(ref, fetch_trx_num(ref.trx_hash).block_num, to_domain_output(output), output.amount);
+}
 
-    std::string last;
-    _dns2ref.last(last);
+/* A bid closes its auction DNS_AUCTION_DURATION_BLOCKS later and the name expires
+ * DNS_EXPIRE_DURATION_BLOCKS after that, an update only moves the expiry */
+void dns_db::index_deadlines(const std::string& name, const dns_record& record, bool add)
+{
+    auto expires = record.block_num + DNS_EXPIRE_DURATION_BLOCKS;
 
-    while (true)
+    if (record.last_tx_type == claim_domain_output::bid_or_auction)
     {
-        if (f(iter.key(), iter.value(), *this))
-            map[iter.key()] = iter.value();
+        auto closes = dns_deadline_key(record.block_num + DNS_AUCTION_DURATION_BLOCKS, name);
+        if (add) _auction_closes.store(closes, 0);
+        else     _auction_closes.remove(closes);
 
-        if (iter.key() == last) break;
-        iter++;
+        expires += DNS_AUCTION_DURATION_BLOCKS;
     }
 
-    return map;
+    if (add) _expires.store(dns_deadline_key(expires, name), 0);
+    else     _expires.remove(dns_deadline_key(expires, name));
+}
+
+void dns_db::build_deadline_indexes()
+{ try {
+    ilog("indexing the auctions and expiries of DNS names");
+
+    for (auto iter = _records.begin(); iter.valid(); ++iter)
+        index_deadlines(iter.key(), iter.value(), true);
+} FC_RETHROW_EXCEPTIONS(warn, "Error indexing DNS auctions and expiries") }
+
+void dns_db::upgrade_dns2ref(const fc::path& dir)
+{ try {
+    ilog("converting the DNS name references to records");
+
+    {
+        bts::db::level_map<std::string, bts::blockchain::output_reference> dns2ref;
+        dns2ref.open(dir / "dns2ref", false);
+
+        for (auto iter = dns2ref.begin(); iter.valid(); ++iter)
+            set_dns_record(iter.key(), make_dns_record(iter.value()));
+
+        dns2ref.close();
+    }
+
+    fc::remove_all(dir / "dns2ref");
+} FC_RETHROW_EXCEPTIONS(warn, "Error converting DNS name references in dir=${dir}", ("dir", dir)) }
+
+/* [first_block, last_block] in deadline order */
+std::vector<std::string> dns_db::names_between(bts::db::level_map<dns_deadline_key, uint8_t>& index,
+                                               uint32_t first_block, uint32_t last_block)
+{
+    std::vector<std::string> names;
+
+    for (auto iter = index.lower_bound(dns_deadline_key(first_block)); iter.valid(); ++iter)
+    {
+        auto key = iter.key();
+        if (key.block_num > last_block) break;
+        names.push_back(key.name);
+    }
+
+    return names;
+}
+
+std::vector<fc::optional<std::vector<char>>> dns_db::resolve(const std::vector<std::string>& names)
+{
+    std::vector<fc::optional<std::vector<char>>> values(names.size());
+
+    std::unique_lock<std::mutex> lock(_values_mutex);
+    ++_resolver_stats.batches;
+    _resolver_stats.lookups += names.size();
+
+    for (auto i = 0u; i < names.size(); i++)
+    {
+        auto iter = _values.find(names[i]);
+        if (iter == _values.end())
+            continue;
+
+        values[i] = iter->second;
+        ++_resolver_stats.hits;
+    }
+
+    return values;
+}
+
+dns_resolver_stats dns_db::get_resolver_stats()
+{
+    std::unique_lock<std::mutex> lock(_values_mutex);
+    auto stats = _resolver_stats;
+    stats.names = _values.size();
+    return stats;
+}
+
+void dns_db::set_resolved_value(const std::string& name, const std::vector<char>& value)
+{
+    std::unique_lock<std::mutex> lock(_values_mutex);
+    if (value.empty())
+        _values.erase(name);
+    else
+        _values[name] = value;
+}
+
+void dns_db::build_resolver_table()
+{ try {
+    {
+        std::unique_lock<std::mutex> lock(_values_mutex);
+        _values.clear();
+    }
+
+    for (auto iter = _records.begin(); iter.valid(); ++iter)
+        set_resolved_value(iter.key(), to_domain_output(fetch_output(iter.value().ref)).value);
+} FC_RETHROW_EXCEPTIONS(warn, "Error loading the DNS resolver table") }
+
+bool dns_db::load_resolver_table()
+{
+    if (head_block_num() == trx_num::invalid_block_num)
+        return false;
+
+    std::vector<std::pair<std::string, std::vector<char>>> values;
+    if (!bts::db::load_state_snapshot(_resolver_snapshot, resolver_snapshot_version, head_block_id(), values))
+        return false;
+
+    std::unique_lock<std::mutex> lock(_values_mutex);
+    _values.clear();
+    _values.reserve(values.size());
+    for (auto& item : values)
+        _values[item.first] = std::move(item.second);
+    return true;
+}
+
+/* Written once at a clean close, nothing is written while blocks are pushed */
+void dns_db::save_resolver_table()
+{
+    if (_resolver_snapshot.string().empty())
+        return;
+
+    try
+    {
+        if (head_block_num() != trx_num::invalid_block_num)
+        {
+            std::vector<std::pair<std::string, std::vector<char>>> values;
+            {
+                std::unique_lock<std::mutex> lock(_values_mutex);
+                values.assign(_values.begin(), _values.end());
+            }
+            bts::db::save_state_snapshot(_resolver_snapshot, resolver_snapshot_version, head_block_id(), values);
+        }
+    }
+    catch (const fc::exception& e)
+    {
+        wlog("${e}", ("e", e.to_detail_string()));
+    }
+    _resolver_snapshot = fc::path();
 }
 
 } } // bts::dns
@@ -1,5 +1,7 @@
 #include <bts/dns/dns_rpc_server.hpp>
 #include <bts/dns/dns_wallet.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/crypto/base64.hpp>
 #include <boost/bind.hpp>
 
 namespace bts { namespace dns {
@@ -26,6 +28,9 @@ namespace bts { namespace dns {
       fc::variant update_domain_record(const fc::variants& params);
       fc::variant list_active_auctions(const fc::variants& params);
       fc::variant lookup_domain_record(const fc::variants& params);
+      fc::variant resolve_domains(const fc::variants& params);
+      fc::variant resolve_domains_packed(const fc::variants& params);
+      fc::variant get_resolver_stats(const fc::variants& params);
     };
 
     fc::variant dns_rpc_server_impl::bid_on_domain(const fc::variants& params)
@@ -89,6 +94,27 @@ namespace bts { namespace dns {
       std::string name = params[0].as_string();
       return lookup_value(name, *get_dns_db());
     }
+    fc::variant dns_rpc_server_impl::resolve_domains(const fc::variants& params)
+    {
+      auto names = params[0].as<std::vector<std::string> >();
+      auto values = get_dns_db()->resolve(names);
+
+      fc::variants result;
+      result.reserve(values.size());
+      for (const auto& value : values)
+        result.push_back(value ? unserialize_value(*value) : fc::variant());
+      return fc::variant(result);
+    }
+    fc::variant dns_rpc_server_impl::resolve_domains_packed(const fc::variants& params)
+    {
+      auto names = params[0].as<std::vector<std::string> >();
+      auto packed = fc::raw::pack(get_dns_db()->resolve(names));
+      return fc::variant(fc::base64_encode(packed.data(), packed.size()));
+    }
+    fc::variant dns_rpc_server_impl::get_resolver_stats(const fc::variants& params)
+    {
+      return fc::variant(get_dns_db()->get_resolver_stats());
+    }
 
   } // end namespace detail
 
@@ -150,6 +176,29 @@ namespace bts { namespace dns {
                                               {{"domain_name",  "string",  true}},
                           /* prerequisites */ json_authenticated};
     register_method(lookup_domain_record_metadata);
+
+    method_data resolve_domains_metadata{"resolve_domains", JSON_METHOD_IMPL(resolve_domains),
+                            /* description */ "Returns the value of each name, or null, from the in memory table of current values",
+                            /* returns: */    "vector<variant>",
+                            /* params:          name            type              required */ 
+                                              {{"domain_names", "vector<string>", true}},
+                          /* prerequisites */ json_authenticated};
+    register_method(resolve_domains_metadata);
+
+    method_data resolve_domains_packed_metadata{"resolve_domains_packed", JSON_METHOD_IMPL(resolve_domains_packed),
+                            /* description */ "Returns the serialized value of each name as an fc::raw packed vector<optional<vector<char>>>, base64 encoded",
+                            /* returns: */    "string",
+                            /* params:          name            type              required */ 
+                                              {{"domain_names", "vector<string>", true}},
+                          /* prerequisites */ json_authenticated};
+    register_method(resolve_domains_packed_metadata);
+
+    method_data get_resolver_stats_metadata{"get_resolver_stats", JSON_METHOD_IMPL(get_resolver_stats),
+                            /* description */ "Returns the size of the resolver table and the lookups it has served",
+                            /* returns: */    "dns_resolver_stats",
+                            /* params:     */ {},
+                          /* prerequisites */ json_authenticated};
+    register_method(get_resolver_stats_metadata);
 #undef JSON_METHOD_IMPL
   }
 
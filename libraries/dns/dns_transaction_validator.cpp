@@ -3,6 +3,22 @@
 
 namespace bts { namespace dns {
 
+/* A name claimed in both states is a conflict, as name_is_available() would have found it in the pool */
+bool dns_block_evaluation_state::merge(const block_evaluation_state &later)
+{
+    if (!block_evaluation_state::merge(later))
+        return false;
+
+    const dns_block_evaluation_state &dns_later = dynamic_cast<const dns_block_evaluation_state &>(later);
+    for (const auto &name : dns_later.name_pool)
+    {
+        if (!name_pool.insert(name).second)
+            return false;
+    }
+    domain_outputs.insert(domain_outputs.end(), dns_later.domain_outputs.begin(), dns_later.domain_outputs.end());
+    return true;
+}
+
 dns_transaction_validator::dns_transaction_validator(dns_db *db) : transaction_validator(db)
 {
     _dns_db = dynamic_cast<dns_db *>(db);
@@ -21,7 +37,7 @@ block_evaluation_state_ptr dns_transaction_validator::create_block_state() const
 transaction_summary dns_transaction_validator::evaluate(const signed_transaction &tx,
                                                         const block_evaluation_state_ptr &block_state)
 {
-    dns_tx_evaluation_state state(tx);
+    dns_tx_evaluation_state state(tx, block_state ? block_state->arena() : nullptr);
 
     return on_evaluate(state, block_state);
 }
@@ -47,17 +63,26 @@ void dns_transaction_validator::validate_input(const meta_trx_input &in, transac
 void dns_transaction_validator::validate_output(const trx_output &out, transaction_evaluation_state &state,
                                                 const block_evaluation_state_ptr &block_state)
 {
+    dns_tx_evaluation_state &dns_state = dynamic_cast<dns_tx_evaluation_state &>(state);
+    auto output_index = dns_state.output_index++;
+
     if (is_domain_output(out))
     {
         claim_domain_output dns_output = to_domain_output(out);
-        dns_tx_evaluation_state &dns_state = dynamic_cast<dns_tx_evaluation_state &>(state);
         const dns_block_evaluation_state_ptr dns_block_state = std::dynamic_pointer_cast<dns_block_evaluation_state>(block_state);
         FC_ASSERT(dns_block_state);
 
         validate_domain_output(dns_output, out.amount, dns_state, dns_block_state);
 
         /* Add name to name pool */
-        dns_block_state->name_pool.push_back(dns_output.name);
+        dns_block_state->name_pool.insert(dns_output.name);
+
+        /* Only one domain output per tx, so its id is computed once */
+        dns_block_output block_output;
+        block_output.ref = output_reference(state.trx.id(), output_index);
+        block_output.output = dns_output;
+        block_output.amount = out.amount;
+        dns_block_state->domain_outputs.push_back(block_output);
     }
     else
     {
@@ -70,6 +95,7 @@ void dns_transaction_validator::validate_domain_input(const claim_domain_output
                                                       const dns_block_evaluation_state_ptr &block_state)
 {
     ilog("Validating domain claim input");
+    auto lock = _dns_db->lock_reads();
     FC_ASSERT(!state.seen_domain_input, "More than one domain claim input in tx: ${tx}", ("tx", state.trx));
 
     FC_ASSERT(_dns_db->has_dns_ref(input.name), "Input references invalid name");
@@ -86,6 +112,7 @@ void dns_transaction_validator::validate_domain_output(const claim_domain_output
                                                        const dns_block_evaluation_state_ptr &block_state)
 {
     ilog("Validating domain claim output");
+    auto lock = _dns_db->lock_reads();
     FC_ASSERT(!state.seen_domain_output, "More than one domain claim output in tx: ${tx}", ("tx", state.trx));
     state.seen_domain_output = true;
 
@@ -98,8 +125,8 @@ void dns_transaction_validator::validate_domain_output(const claim_domain_output
 
     /* Check name status */
     bool new_or_expired;
-    output_reference prev_tx_ref;
-    auto available = name_is_available(output.name, block_state->name_pool, *_dns_db, new_or_expired, prev_tx_ref);
+    dns_record prev_record;
+    auto available = name_is_available(output.name, block_state->name_pool, *_dns_db, new_or_expired, prev_record);
 
     /* If we haven't seen a domain input then the only valid output is a new domain auction */
     if (!state.seen_domain_input)
@@ -116,7 +143,7 @@ void dns_transaction_validator::validate_domain_output(const claim_domain_output
     FC_ASSERT(output.name == state.domain_input.name, "Bid tx refers to different input and output names");
 
     /* Bid in existing auction */
-    if (!auction_is_closed(prev_tx_ref, *_dns_db))
+    if (!auction_is_closed(prev_record, *_dns_db))
     {
         ilog("Currently in an auction");
         FC_ASSERT(available, "Name not available");
@@ -149,7 +176,7 @@ void dns_transaction_validator::validate_domain_output(const claim_domain_output
 
     /* Update or sale */
     ilog("Auction is over.");
-    FC_ASSERT(!domain_is_expired(prev_tx_ref, *_dns_db), "Domain is expired");
+    FC_ASSERT(!domain_is_expired(prev_record, *_dns_db), "Domain is expired");
 
     /* Keep output amount constant when updating domain record */
     if (output.last_tx_type == claim_domain_output::update)
@@ -162,8 +189,7 @@ void dns_transaction_validator::validate_domain_output(const claim_domain_output
     }
 
     /* If you're the owner, do whatever you like! */
-    auto prev_domain_output = to_domain_output(get_tx_ref_output(prev_tx_ref, *_dns_db));
-    FC_ASSERT(state.has_signature(prev_domain_output.owner), "Domain tx missing required signature: ${tx}", ("tx", state.trx));
+    FC_ASSERT(state.has_signature(prev_record.owner), "Domain tx missing required signature: ${tx}", ("tx", state.trx));
     ilog("Tx signed by owner");
 }
 
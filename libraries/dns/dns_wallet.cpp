@@ -32,13 +32,19 @@ std::string dns_wallet::get_output_info_string(const trx_output& out)
 
 signed_transaction dns_wallet::bid_on_domain(const std::string &name, const asset &bid_price,
                                              const signed_transactions &tx_pool, dns_db &db)
+{
+    return bid_on_domain(name, bid_price, get_names_from_txs(tx_pool), db);
+}
+
+signed_transaction dns_wallet::bid_on_domain(const std::string &name, const asset &bid_price,
+                                             const dns_name_pool &name_pool, dns_db &db)
 { try {
     FC_ASSERT(is_valid_name(name), "Invalid name");
 
     /* Name should be new, for auction, or expired */
     bool new_or_expired;
-    output_reference prev_tx_ref;
-    FC_ASSERT(name_is_available(name, tx_pool, db, new_or_expired, prev_tx_ref), "Name not available");
+    dns_record prev_record;
+    FC_ASSERT(name_is_available(name, name_pool, db, new_or_expired, prev_record), "Name not available");
 
     /* Build domain output */
     claim_domain_output domain_output;
@@ -55,15 +61,13 @@ signed_transaction dns_wallet::bid_on_domain(const std::string &name, const asse
     }
     else
     {
-        tx.inputs.push_back(trx_input(prev_tx_ref));
+        tx.inputs.push_back(trx_input(prev_record.ref));
 
-        auto prev_output = get_tx_ref_output(prev_tx_ref, db);
-        FC_ASSERT(is_valid_bid_price(bid_price, prev_output.amount), "Invalid bid price");
-        auto transfer_amount = get_bid_transfer_amount(bid_price, prev_output.amount);
+        FC_ASSERT(is_valid_bid_price(bid_price, prev_record.amount), "Invalid bid price");
+        auto transfer_amount = get_bid_transfer_amount(bid_price, prev_record.amount);
 
         /* Fee is implicit from difference */
-        auto prev_dns_output = to_domain_output(prev_output);
-        tx.outputs.push_back(trx_output(claim_by_signature_output(prev_dns_output.owner), transfer_amount));
+        tx.outputs.push_back(trx_output(claim_by_signature_output(prev_record.owner), transfer_amount));
         tx.outputs.push_back(trx_output(domain_output, bid_price));
     }
 
@@ -73,40 +77,49 @@ signed_transaction dns_wallet::bid_on_domain(const std::string &name, const asse
 
 signed_transaction dns_wallet::update_domain(const std::string &name, const fc::variant &value,
                                              const signed_transactions &tx_pool, dns_db &db)
+{
+    return update_domain(name, value, get_names_from_txs(tx_pool), db);
+}
+
+signed_transaction dns_wallet::update_domain(const std::string &name, const fc::variant &value,
+                                             const dns_name_pool &name_pool, dns_db &db)
 { try {
     FC_ASSERT(is_valid_name(name), "Invalid name");
     FC_ASSERT(is_valid_value(value), "Invalid value");
 
     /* Name should exist and be owned */
-    output_reference prev_tx_ref;
-    FC_ASSERT(name_is_useable(name, tx_pool, db, get_unspent_outputs(), prev_tx_ref), "Name unavailable");
-
-    auto prev_output = get_tx_ref_output(prev_tx_ref, db);
-    auto prev_domain_output = to_domain_output(prev_output);
+    dns_record prev_record;
+    FC_ASSERT(name_is_useable(name, name_pool, db, get_unspent_outputs(), prev_record), "Name unavailable");
 
     /* Build domain output */
     claim_domain_output domain_output;
     domain_output.name = name;
     domain_output.value = serialize_value(value);
-    domain_output.owner = prev_domain_output.owner;
+    domain_output.owner = prev_record.owner;
     domain_output.last_tx_type = claim_domain_output::update;
 
-    return update_or_auction_domain(domain_output, prev_output.amount, prev_tx_ref, prev_domain_output.owner, db);
+    return update_or_auction_domain(domain_output, prev_record.amount, prev_record.ref, prev_record.owner, db);
 
 } FC_RETHROW_EXCEPTIONS(warn, "update_domain ${name} with value ${val}", ("name", name)("val", value)) }
 
 signed_transaction dns_wallet::transfer_domain(const std::string &name, const address &recipient,
                                                const signed_transactions &tx_pool, dns_db &db)
+{
+    return transfer_domain(name, recipient, get_names_from_txs(tx_pool), db);
+}
+
+signed_transaction dns_wallet::transfer_domain(const std::string &name, const address &recipient,
+                                               const dns_name_pool &name_pool, dns_db &db)
 { try {
     FC_ASSERT(is_valid_name(name), "Invalid name");
     FC_ASSERT(is_valid_owner(recipient), "Invalid recipient");
 
     /* Name should exist and be owned */
-    output_reference prev_tx_ref;
-    FC_ASSERT(name_is_useable(name, tx_pool, db, get_unspent_outputs(), prev_tx_ref), "Name unavailable");
+    dns_record prev_record;
+    FC_ASSERT(name_is_useable(name, name_pool, db, get_unspent_outputs(), prev_record), "Name unavailable");
 
-    auto prev_output = get_tx_ref_output(prev_tx_ref, db);
-    auto prev_domain_output = to_domain_output(prev_output);
+    /* The value is not part of the record */
+    auto prev_domain_output = to_domain_output(get_tx_ref_output(prev_record.ref, db));
 
     /* Build domain output */
     claim_domain_output domain_output;
@@ -115,31 +128,34 @@ signed_transaction dns_wallet::transfer_domain(const std::string &name, const ad
     domain_output.owner = recipient;
     domain_output.last_tx_type = claim_domain_output::update;
 
-    return update_or_auction_domain(domain_output, prev_output.amount, prev_tx_ref, prev_domain_output.owner, db);
+    return update_or_auction_domain(domain_output, prev_record.amount, prev_record.ref, prev_record.owner, db);
 
 } FC_RETHROW_EXCEPTIONS(warn, "transfer_domain ${name} with recipient ${val}", ("name", name)("val", recipient)) }
 
 signed_transaction dns_wallet::auction_domain(const std::string &name, const asset &ask_price,
                                               const signed_transactions &tx_pool, dns_db &db)
+{
+    return auction_domain(name, ask_price, get_names_from_txs(tx_pool), db);
+}
+
+signed_transaction dns_wallet::auction_domain(const std::string &name, const asset &ask_price,
+                                              const dns_name_pool &name_pool, dns_db &db)
 { try {
     FC_ASSERT(is_valid_name(name), "Invalid name");
     FC_ASSERT(is_valid_ask_price(ask_price), "Invalid ask_price");
 
     /* Name should exist and be owned */
-    output_reference prev_tx_ref;
-    FC_ASSERT(name_is_useable(name, tx_pool, db, get_unspent_outputs(), prev_tx_ref), "Name unavailable");
-
-    auto prev_output = get_tx_ref_output(prev_tx_ref, db);
-    auto prev_domain_output = to_domain_output(prev_output);
+    dns_record prev_record;
+    FC_ASSERT(name_is_useable(name, name_pool, db, get_unspent_outputs(), prev_record), "Name unavailable");
 
     /* Build domain output */
     claim_domain_output domain_output;
     domain_output.name = name;
     domain_output.value = std::vector<char>();
-    domain_output.owner = prev_domain_output.owner;
+    domain_output.owner = prev_record.owner;
     domain_output.last_tx_type = claim_domain_output::bid_or_auction;
 
-    return update_or_auction_domain(domain_output, ask_price, prev_tx_ref, prev_domain_output.owner, db);
+    return update_or_auction_domain(domain_output, ask_price, prev_record.ref, prev_record.owner, db);
 
 } FC_RETHROW_EXCEPTIONS(warn, "auction_domain ${name} with ${amt}", ("name", name)("amt", ask_price)) }
 
@@ -2,10 +2,85 @@
 
 #include <fc/reflect/variant.hpp>
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/db/cached_level_map.hpp>
 #include <bts/db/level_map.hpp>
 
 #include <bts/dns/dns_transaction_validator.hpp>
 
+#include <mutex>
+#include <unordered_map>
+
+namespace bts { namespace dns {
+
+/** the current domain output of a name, what validating a domain output needs to know of it */
+struct dns_record
+{
+    dns_record():block_num(0){}
+    dns_record(const bts::blockchain::output_reference& r, uint32_t b, const claim_domain_output& o,
+               const bts::blockchain::asset& a)
+    :ref(r),block_num(b),last_tx_type(o.last_tx_type),owner(o.owner),amount(a){}
+
+    bts::blockchain::output_reference                               ref;
+    uint32_t                                                        block_num; ///< that included ref
+    fc::enum_type<uint8_t, claim_domain_output::last_tx_type_enum>  last_tx_type;
+    bts::blockchain::address                                        owner;
+    bts::blockchain::asset                                          amount;
+};
+
+/** counts of the lookups served by dns_db::resolve since the database was opened */
+struct dns_resolver_stats
+{
+    dns_resolver_stats():names(0),batches(0),lookups(0),hits(0){}
+
+    uint64_t names;   ///< with a value in the table
+    uint64_t batches; ///< calls to resolve
+    uint64_t lookups;
+    uint64_t hits;
+};
+
+/** an entry of the auction and expiry indexes of dns_db, sorted by block then name */
+struct dns_deadline_key
+{
+    dns_deadline_key(uint32_t b = 0, const std::string& n = std::string()):block_num(b),name(n){}
+
+    uint32_t    block_num;
+    std::string name;
+
+    friend bool operator == (const dns_deadline_key& a, const dns_deadline_key& b)
+    {
+        return a.block_num == b.block_num && a.name == b.name;
+    }
+    friend bool operator < (const dns_deadline_key& a, const dns_deadline_key& b)
+    {
+        return a.block_num == b.block_num ? a.name < b.name : a.block_num < b.block_num;
+    }
+};
+
+} } // bts::dns
+
+namespace bts { namespace db {
+    /** the block big-endian, then the name without a length prefix */
+    template<>
+    struct key_encoding<bts::dns::dns_deadline_key>
+    {
+        static const bool is_ordered = true;
+
+        static void pack(std::vector<char>& out, const bts::dns::dns_deadline_key& k)
+        {
+            out.clear();
+            pack_big_endian(out, k.block_num, sizeof(k.block_num));
+            out.insert(out.end(), k.name.begin(), k.name.end());
+        }
+
+        static void unpack(const char* data, size_t size, bts::dns::dns_deadline_key& k)
+        {
+            FC_ASSERT(size >= sizeof(k.block_num));
+            k.block_num = uint32_t(unpack_big_endian(data, sizeof(k.block_num)));
+            k.name.assign(data + sizeof(k.block_num), size - sizeof(k.block_num));
+        }
+    };
+} } // bts::db
+
 namespace bts { namespace dns {
 
 class dns_db : public bts::blockchain::chain_database
@@ -14,23 +89,82 @@ class dns_db : public bts::blockchain::chain_database
         dns_db();
         ~dns_db();
 
-        virtual void open(const fc::path& dir, bool create = true);
+        virtual void open(const fc::path& dir, bool create = true,
+                          const bts::blockchain::chain_database_tuning& tuning = bts::blockchain::chain_database_tuning());
         virtual void close();
         virtual void store(const trx_block& blk, const signed_transactions& deterministic_trxs,
                            const block_evaluation_state_ptr& state);
+        virtual void undo(const trx_block& blk);
+        virtual void commit_undo();
+        virtual void abort_undo();
 
-        // TODO: Add delete operation
-        void                              set_dns_ref(const std::string& key, const bts::blockchain::output_reference& ref);
+        void                              set_dns_record(const std::string& key, const dns_record& record);
+        dns_record                        get_dns_record(const std::string& key);
+        /**
+         *  @return the record of key or nullptr, served from an LRU cache in front of LevelDB.  The
+         *  pointer is only valid until the next block is pushed or popped.
+         */
+        const dns_record*                 find_dns_record(const std::string& key);
         bts::blockchain::output_reference get_dns_ref(const std::string& key);
         bool                              has_dns_ref(const std::string& key);
+        void                              remove_dns_ref(const std::string& key);
+
+        /** the number of records kept decoded in memory */
+        void                              set_record_cache_size(size_t size);
 
         std::map<std::string, bts::blockchain::output_reference>
             filter(bool (*f)(const std::string&, const bts::blockchain::output_reference&, dns_db& db));
 
+        /** @return the names in auction as of the head block, the auction that closes first first */
+        std::vector<std::string>          get_active_auction_names();
+        /** @return the names that expire within the next *blocks* blocks, the first to expire first */
+        std::vector<std::string>          get_expiring_names(uint32_t blocks);
+
+        /**
+         *  Looks names up in a table of the current value of every name that has one, kept in
+         *  memory and updated as blocks are pushed and popped.  A name in its first auction has
+         *  no value.  Thread safe, the whole batch is served under one lock.
+         *
+         *  @return the serialized value of each name, see unserialize_value()
+         */
+        std::vector<fc::optional<std::vector<char>>> resolve(const std::vector<std::string>& names);
+        dns_resolver_stats                           get_resolver_stats();
+
     private:
-        bts::db::level_map<std::string, bts::blockchain::output_reference> _dns2ref;
+        /** the record of the domain output ref, from the chain */
+        dns_record make_dns_record(const bts::blockchain::output_reference& ref);
+        /** adds or removes the deadlines of the record of name */
+        void index_deadlines(const std::string& name, const dns_record& record, bool add);
+        void build_deadline_indexes();
+        /** converts the name to output_reference map of older databases */
+        void upgrade_dns2ref(const fc::path& dir);
+        std::vector<std::string> names_between(bts::db::level_map<dns_deadline_key, uint8_t>& index,
+                                               uint32_t first_block, uint32_t last_block);
+        /** an empty value removes name from the resolver table */
+        void set_resolved_value(const std::string& name, const std::vector<char>& value);
+        void build_resolver_table();
+        /** @return false if the snapshot written by close() is stale, see bts::db::mapped_snapshot */
+        bool load_resolver_table();
+        void save_resolver_table();
+
+        bts::db::cached_level_map<std::string, dns_record>  _records;
+        /** the block each auction closes, when a bid is that old */
+        bts::db::level_map<dns_deadline_key, uint8_t>       _auction_closes;
+        /** the block each name expires */
+        bts::db::level_map<dns_deadline_key, uint8_t>       _expires;
+
+        /** guards _values and _resolver_stats, which resolve() reads from other threads */
+        std::mutex                                          _values_mutex;
+        std::unordered_map<std::string, std::vector<char>>  _values;
+        dns_resolver_stats                                  _resolver_stats;
+        /** the resolver table as of the head block, empty while closed */
+        fc::path                                            _resolver_snapshot;
 };
 
 typedef std::shared_ptr<dns_db> dns_db_ptr;
 
 } } // bts::dns
+
+FC_REFLECT(bts::dns::dns_record, (ref)(block_num)(last_tx_type)(owner)(amount))
+FC_REFLECT(bts::dns::dns_deadline_key, (block_num)(name))
+FC_REFLECT(bts::dns::dns_resolver_stats, (names)(batches)(lookups)(hits))
@@ -3,19 +3,26 @@
 #include <bts/blockchain/transaction_validator.hpp>
 #include <bts/dns/outputs.hpp>
 
+#include <unordered_set>
+
 namespace bts { namespace dns {
 
 using namespace bts::blockchain;
 
 class dns_db;
 
+/* Names with a domain output in a block or transaction pool, each may have only one */
+typedef std::unordered_set<std::string> dns_name_pool;
+
 class dns_tx_evaluation_state : public bts::blockchain::transaction_evaluation_state
 {
     public:
-        dns_tx_evaluation_state(const signed_transaction &tx) : transaction_evaluation_state(tx)
+        dns_tx_evaluation_state(const signed_transaction &tx, evaluation_arena* arena = nullptr)
+            : transaction_evaluation_state(tx, arena)
         {
             seen_domain_input = false;
             seen_domain_output = false;
+            output_index = 0;
         }
 
         claim_domain_output domain_input;
@@ -24,12 +31,27 @@ class dns_tx_evaluation_state : public bts::blockchain::transaction_evaluation_s
         /* Only one domain input/output per tx */
         bool seen_domain_input;
         bool seen_domain_output;
+
+        /* Of the output being validated */
+        uint32_t output_index;
+};
+
+/* A domain output accepted into a block, decoded once for dns_db::store */
+struct dns_block_output
+{
+    output_reference    ref;
+    claim_domain_output output;
+    asset               amount;
 };
 
 class dns_block_evaluation_state : public bts::blockchain::block_evaluation_state
 {
     public:
-        std::vector<std::string> name_pool;
+        virtual bool merge(const block_evaluation_state &later);
+
+        dns_name_pool                   name_pool;
+        /* In the order of the block */
+        std::vector<dns_block_output>   domain_outputs;
 };
 
 typedef std::shared_ptr<dns_block_evaluation_state> dns_block_evaluation_state_ptr;
@@ -45,6 +67,9 @@ class dns_transaction_validator : public bts::blockchain::transaction_validator
         virtual transaction_summary evaluate(const signed_transaction &tx,
                                              const block_evaluation_state_ptr &block_state);
 
+        /* Domain claims read the database under dns_db::lock_reads() */
+        virtual bool supports_parallel_evaluation() const { return true; }
+
         virtual void validate_input(const meta_trx_input &in, transaction_evaluation_state &state,
                                     const block_evaluation_state_ptr &block_state);
 
@@ -66,3 +91,4 @@ class dns_transaction_validator : public bts::blockchain::transaction_validator
 } } // bts::dns
 
 FC_REFLECT(bts::dns::dns_tx_evaluation_state, (seen_domain_input)(seen_domain_output)(domain_input)(domain_input_amount));
+FC_REFLECT(bts::dns::dns_block_output, (ref)(output)(amount));
@@ -25,6 +25,19 @@ class dns_wallet : public bts::wallet::wallet
 
         signed_transaction auction_domain(const std::string &name, const asset &ask_price,
                                           const signed_transactions &tx_pool, dns_db &db);
+
+        /* The same with the names of the pool, see add_names_from_tx() to keep one up to date */
+        signed_transaction bid_on_domain(const std::string &name, const asset &bid_price,
+                                         const dns_name_pool &name_pool, dns_db &db);
+
+        signed_transaction update_domain(const std::string &name, const fc::variant &value,
+                                         const dns_name_pool &name_pool, dns_db &db);
+
+        signed_transaction transfer_domain(const std::string &name, const address &recipient,
+                                           const dns_name_pool &name_pool, dns_db &db);
+
+        signed_transaction auction_domain(const std::string &name, const asset &ask_price,
+                                          const dns_name_pool &name_pool, dns_db &db);
         
         virtual std::string get_output_info_string(const trx_output& out);
         virtual std::string get_input_info_string(bts::blockchain::chain_database& db, const trx_input& in);
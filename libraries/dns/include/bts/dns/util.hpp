@@ -38,22 +38,28 @@ claim_domain_output to_domain_output(const trx_output &output);
 output_reference get_name_tx_ref(const std::string &name, dns_db &db);
 trx_output get_tx_ref_output(const output_reference &tx_ref, dns_db &db);
 uint32_t get_tx_age(const output_reference &tx_ref, dns_db &db);
+uint32_t get_record_age(const dns_record &record, dns_db &db);
 
-bool auction_is_closed(const output_reference &tx_ref, dns_db &db);
-bool domain_is_expired(const output_reference &tx_ref, dns_db &db);
+bool auction_is_closed(const dns_record &record, dns_db &db);
+bool domain_is_expired(const dns_record &record, dns_db &db);
 
-std::vector<std::string> get_names_from_txs(const signed_transactions &txs);
-std::vector<std::string> get_names_from_unspent(const std::map<bts::wallet::output_index, trx_output>
-                                                &unspent_outputs);
+/* Adds the names of the domain outputs of tx, to keep a pool as transactions arrive */
+void add_names_from_tx(const signed_transaction &tx, dns_name_pool &name_pool);
+dns_name_pool get_names_from_txs(const signed_transactions &txs);
+dns_name_pool get_names_from_unspent(const std::map<bts::wallet::output_index, trx_output> &unspent_outputs);
 
-bool name_is_available(const std::string &name, const std::vector<std::string> &name_pool, dns_db &db,
-                       bool &new_or_expired, output_reference &prev_tx_ref);
+/* prev_record is the current record of the name unless it is new */
+bool name_is_available(const std::string &name, const dns_name_pool &name_pool, dns_db &db,
+                       bool &new_or_expired, dns_record &prev_record);
 bool name_is_available(const std::string &name, const signed_transactions &tx_pool, dns_db &db,
-                       bool &new_or_expired, output_reference &prev_tx_ref);
+                       bool &new_or_expired, dns_record &prev_record);
 
+bool name_is_useable(const std::string &name, const dns_name_pool &name_pool, dns_db &db,
+                     const std::map<bts::wallet::output_index, trx_output> &unspent_outputs,
+                     dns_record &prev_record);
 bool name_is_useable(const std::string &name, const signed_transactions &tx_pool, dns_db &db,
                      const std::map<bts::wallet::output_index, trx_output> &unspent_outputs,
-                     output_reference &prev_tx_ref);
+                     dns_record &prev_record);
 
 std::vector<char> serialize_value(const fc::variant &value);
 fc::variant unserialize_value(const std::vector<char> &value);
@@ -70,9 +76,11 @@ bool is_valid_ask_price(const asset &ask_price);
 asset get_bid_transfer_amount(const asset &bid_price, const asset &prev_bid_price);
 
 // TODO: Also include current tx_pool?
+/* Null for a name that has no value, such as one not yet owned or still in its first auction */
 fc::variant lookup_value(const std::string& key, dns_db& db);
 
 // TODO: Also include current tx_pool?
+/* Sorted by the block the auction closes */
 std::vector<trx_output> get_active_auctions(dns_db& db);
 
 } } // bts::dns
@@ -38,137 +38,145 @@ uint32_t get_tx_age(const output_reference &tx_ref, dns_db &db)
     return db.head_block_num() - block_num;
 }
 
-bool auction_is_closed(const output_reference &tx_ref, dns_db &db)
+uint32_t get_record_age(const dns_record &record, dns_db &db)
 {
-    auto output = get_tx_ref_output(tx_ref, db);
-    FC_ASSERT(is_domain_output(output));
+    return db.head_block_num() - record.block_num;
+}
 
-    auto dns_output = to_domain_output(output);
-    auto age = get_tx_age(tx_ref, db);
+bool auction_is_closed(const dns_record &record, dns_db &db)
+{
+    auto age = get_record_age(record, db);
 
-    if (dns_output.last_tx_type == claim_domain_output::bid_or_auction
+    if (record.last_tx_type == claim_domain_output::bid_or_auction
         && age < DNS_AUCTION_DURATION_BLOCKS)
         return false;
 
     return true;
 }
 
-bool domain_is_expired(const output_reference &tx_ref, dns_db &db)
+bool domain_is_expired(const dns_record &record, dns_db &db)
 {
-    auto output = get_tx_ref_output(tx_ref, db);
-    FC_ASSERT(is_domain_output(output));
-
-    if (!auction_is_closed(tx_ref, db))
+    if (!auction_is_closed(record, db))
         return false;
 
-    auto dns_output = to_domain_output(output);
-    auto age = get_tx_age(tx_ref, db);
+    auto age = get_record_age(record, db);
 
-    if (dns_output.last_tx_type == claim_domain_output::bid_or_auction)
+    if (record.last_tx_type == claim_domain_output::bid_or_auction)
         return age >= (DNS_AUCTION_DURATION_BLOCKS + DNS_EXPIRE_DURATION_BLOCKS);
 
-    FC_ASSERT(dns_output.last_tx_type == claim_domain_output::update);
+    FC_ASSERT(record.last_tx_type == claim_domain_output::update);
 
     return age >= DNS_EXPIRE_DURATION_BLOCKS;
 }
 
-std::vector<std::string> get_names_from_txs(const signed_transactions &txs)
+void add_names_from_tx(const signed_transaction &tx, dns_name_pool &name_pool)
 {
-    std::vector<std::string> names = std::vector<std::string>();
-
-    for (auto &tx : txs)
+    for (auto &output : tx.outputs)
     {
-        for (auto &output : tx.outputs)
-        {
-            if (!is_domain_output(output))
-                continue;
+        if (!is_domain_output(output))
+            continue;
 
-            names.push_back(to_domain_output(output).name);
-        }
+        name_pool.insert(to_domain_output(output).name);
     }
+}
+
+dns_name_pool get_names_from_txs(const signed_transactions &txs)
+{
+    dns_name_pool names;
+
+    for (auto &tx : txs)
+        add_names_from_tx(tx, names);
 
     return names;
 }
 
-std::vector<std::string> get_names_from_unspent(const std::map<bts::wallet::output_index, trx_output>
-                                                &unspent_outputs)
+dns_name_pool get_names_from_unspent(const std::map<bts::wallet::output_index, trx_output> &unspent_outputs)
 {
-    std::vector<std::string> names = std::vector<std::string>();
+    dns_name_pool names;
 
-    for (auto pair : unspent_outputs)
+    for (auto &pair : unspent_outputs)
     {
         if (!is_domain_output(pair.second))
             continue;
 
-        names.push_back(to_domain_output(pair.second).name);
+        names.insert(to_domain_output(pair.second).name);
     }
 
     return names;
 }
 
 /* Check if name is available for bid: new, in auction, or expired */
-bool name_is_available(const std::string &name, const std::vector<std::string> &name_pool, dns_db &db,
-                       bool &new_or_expired, output_reference &prev_tx_ref)
+bool name_is_available(const std::string &name, const dns_name_pool &name_pool, dns_db &db,
+                       bool &new_or_expired, dns_record &prev_record)
 {
     FC_ASSERT(is_valid_name(name), "Invalid name");
 
     new_or_expired = false;
 
-    if (std::find(name_pool.begin(), name_pool.end(), name) != name_pool.end())
+    if (name_pool.count(name) > 0)
         return false;
 
-    if (!db.has_dns_ref(name))
+    auto record = db.find_dns_record(name);
+    if (record == nullptr)
     {
         new_or_expired = true;
         return true;
     }
 
-    prev_tx_ref = get_name_tx_ref(name, db);
+    prev_record = *record;
 
-    if (domain_is_expired(prev_tx_ref, db))
+    if (domain_is_expired(prev_record, db))
         new_or_expired = true;
 
-    return !auction_is_closed(prev_tx_ref, db) || new_or_expired;
+    return !auction_is_closed(prev_record, db) || new_or_expired;
 }
 
 bool name_is_available(const std::string &name, const signed_transactions &tx_pool, dns_db &db,
-                       bool &new_or_expired, output_reference &prev_tx_ref)
+                       bool &new_or_expired, dns_record &prev_record)
 {
     FC_ASSERT(is_valid_name(name), "Invalid name");
 
-    return name_is_available(name, get_names_from_txs(tx_pool), db, new_or_expired, prev_tx_ref);
+    return name_is_available(name, get_names_from_txs(tx_pool), db, new_or_expired, prev_record);
 }
 
 /* Check if name is available for value update or auction */
-bool name_is_useable(const std::string &name, const signed_transactions &tx_pool, dns_db &db,
+bool name_is_useable(const std::string &name, const dns_name_pool &name_pool, dns_db &db,
                      const std::map<bts::wallet::output_index, trx_output> &unspent_outputs,
-                     output_reference &prev_tx_ref)
+                     dns_record &prev_record)
 {
     FC_ASSERT(is_valid_name(name), "Invalid name");
 
-    std::vector<std::string> name_pool = get_names_from_txs(tx_pool);
-    if (std::find(name_pool.begin(), name_pool.end(), name) != name_pool.end())
+    if (name_pool.count(name) > 0)
         return false;
 
-    if (!db.has_dns_ref(name))
+    auto record = db.find_dns_record(name);
+    if (record == nullptr)
         return false;
 
-    prev_tx_ref = get_name_tx_ref(name, db);
+    prev_record = *record;
 
-    if (!auction_is_closed(prev_tx_ref, db))
+    if (!auction_is_closed(prev_record, db))
         return false;
 
-    if (domain_is_expired(prev_tx_ref, db))
+    if (domain_is_expired(prev_record, db))
         return false;
 
     /* Check if spendable */
-    std::vector<std::string> unspent_names = get_names_from_unspent(unspent_outputs);
-    if (std::find(unspent_names.begin(), unspent_names.end(), name) == unspent_names.end())
+    if (get_names_from_unspent(unspent_outputs).count(name) == 0)
         return false;
 
     return true;
 }
 
+bool name_is_useable(const std::string &name, const signed_transactions &tx_pool, dns_db &db,
+                     const std::map<bts::wallet::output_index, trx_output> &unspent_outputs,
+                     dns_record &prev_record)
+{
+    FC_ASSERT(is_valid_name(name), "Invalid name");
+
+    return name_is_useable(name, get_names_from_txs(tx_pool), db, unspent_outputs, prev_record);
+}
+
 std::vector<char> serialize_value(const fc::variant &value)
 {
     return fc::raw::pack(value);
@@ -227,22 +235,20 @@ asset get_bid_transfer_amount(const asset &bid_price, const asset &prev_bid_pric
 fc::variant lookup_value(const std::string& key, dns_db& db)
 {
     FC_ASSERT(is_valid_name(key));
-    FC_ASSERT(db.has_dns_ref(key), "Key does not exist");
 
-    auto output = get_tx_ref_output(db.get_dns_ref(key), db);
+    auto value = db.resolve(std::vector<std::string>{key}).front();
+    if (!value.valid())
+        return fc::variant();
 
-    return unserialize_value(to_domain_output(output).value);
+    return unserialize_value(*value);
 }
 
 std::vector<trx_output> get_active_auctions(dns_db& db)
 {
     std::vector<trx_output> list;
 
-    auto f = [](const std::string& k, const output_reference& v, dns_db& db)->bool { return !auction_is_closed(v, db); };
-    auto map = db.filter(f);
-
-    for (auto iter = map.begin(); iter != map.end(); iter++)
-        list.push_back(get_tx_ref_output(iter->second, db));
+    for (auto& name : db.get_active_auction_names())
+        list.push_back(get_tx_ref_output(db.get_dns_ref(name), db));
 
     return list;
 }
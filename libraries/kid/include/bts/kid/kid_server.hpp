@@ -19,6 +19,15 @@ namespace bts { namespace kid
 
       uint32_t block_num;
       uint16_t record_num;
+
+      friend bool operator == ( const name_index& a, const name_index& b )
+      {
+         return a.block_num == b.block_num && a.record_num == b.record_num;
+      }
+      friend bool operator < ( const name_index& a, const name_index& b )
+      {
+         return a.block_num == b.block_num ? a.record_num < b.record_num : a.block_num < b.block_num;
+      }
    };
    struct history
    {
@@ -35,9 +44,19 @@ namespace bts { namespace kid
          void set_data_directory( const fc::path& dir );
          void listen( const fc::ip::endpoint& ep );
 
+         /** the proof of work and signature of r are checked on a worker thread */
          bool                    update_record( const signed_name_record& r );
+         /**
+          *  Verifies the batch on all worker threads at once, records that fail the checks
+          *  against the pending records and the latest ones are rejected before any hashing.
+          *
+          *  @return whether each record was accepted
+          */
+         std::vector<bool>       update_records( const std::vector<signed_name_record>& records );
          signed_name_record      fetch_record_by_key( const std::string& name_b58 );
+         /** the pending update of name or else its latest record, one read of a cached map */
          signed_name_record      fetch_record( const std::string& name );
+         /** reads the record alone, not the block that includes it */
          signed_name_record      fetch_record( const name_index& n );
          history                 fetch_history( const std::string& name );
 
@@ -1,5 +1,6 @@
 #include <bts/kid/kid_server.hpp>
 #include <bts/blockchain/difficulty.hpp>
+#include <bts/db/cached_level_map.hpp>
 #include <bts/db/level_map.hpp>
 #include <fc/filesystem.hpp>
 #include <fc/network/http/server.hpp>
@@ -9,10 +10,37 @@
 #include <fc/io/raw.hpp>
 #include <fc/io/json.hpp>
 #include <fc/interprocess/file_mapping.hpp>
+#include <fc/crypto/ripemd160.hpp>
+#include <boost/filesystem.hpp>
 
-#include <fstream>
+#include <ctime>
+#include <deque>
 
 
+
+namespace bts { namespace db {
+  /** sorts by block_num then record_num, matching name_index::operator< */
+  template<>
+  struct key_encoding<bts::kid::name_index>
+  {
+     static const bool is_ordered = true;
+
+     static void pack( std::vector<char>& out, const bts::kid::name_index& k )
+     {
+        out.clear();
+        pack_big_endian( out, k.block_num, sizeof(k.block_num) );
+        pack_big_endian( out, k.record_num, sizeof(k.record_num) );
+     }
+
+     static void unpack( const char* data, size_t size, bts::kid::name_index& k )
+     {
+        FC_ASSERT( size == sizeof(k.block_num) + sizeof(k.record_num) );
+        k.block_num  = uint32_t( unpack_big_endian( data, sizeof(k.block_num) ) );
+        k.record_num = uint16_t( unpack_big_endian( data + sizeof(k.block_num), sizeof(k.record_num) ) );
+     }
+  };
+} } // bts::db
+
 namespace bts { namespace kid {
    uint64_t   name_record::difficulty()const
    {
@@ -76,17 +104,62 @@ namespace bts { namespace kid {
 
    namespace detail
    {
+       /**
+        *  The checks of a record that need no server state, the proof of work first because it
+        *  is cheaper than recovering the signature.  Called on the read threads.
+        */
+       void verify_record( const signed_name_record& r, uint64_t difficulty )
+       {
+          FC_ASSERT( r.difficulty() >= difficulty, "",
+                     ("r.difficulty",r.difficulty())("current_difficulty",difficulty));
+          FC_ASSERT( r.get_signee() == r.master_key );
+       }
+
+       /** a response that only changes with etag */
+       struct cached_response
+       {
+          cached_response():file_size(0),last_write(0),read_at(0){}
+
+          std::string etag;
+          std::string body;
+          /** of a static file when it was read, it is read again once either changes */
+          uint64_t    file_size;
+          std::time_t last_write;
+          /**
+           *  last_write has a resolution of a second, a file read in the second it was written
+           *  may be written again without last_write changing, so it is read again.
+           */
+          std::time_t read_at;
+       };
+
        class server_impl
        {
           public:
+             server_impl():_pending_json_valid(false),_next_read_thread(0),_max_cached_responses(1000){}
+
              server*                                                   _self;
              fc::http::server                                          _httpd;
              bts::db::level_map<std::string, history >                 _name_index;
              bts::db::level_map<uint32_t, signed_block>                _block_database;
              bts::db::level_map<std::string,stored_key >               _key_data;
              bts::db::level_map<std::string,std::string>               _key_to_name;
+             /** every record of every block, so that one can be read without its block */
+             bts::db::level_map<name_index, signed_name_record>        _records;
+             /** the latest record of each name */
+             bts::db::cached_level_map<std::string, signed_name_record> _latest_records;
 
              std::unordered_map<std::string, signed_name_record>       _pending;
+             /** the pending endpoint, rebuilt by the first request after _pending changes */
+             std::string                                               _pending_json;
+             bool                                                      _pending_json_valid;
+
+             /** read blocks and static files so that requests for them don't wait on each other */
+             std::vector<std::unique_ptr<fc::thread> >                 _read_threads;
+             uint64_t                                                  _next_read_thread;
+             /** by request path, blocks and static files */
+             std::unordered_map<std::string, cached_response>          _response_cache;
+             std::deque<std::string>                                   _response_cache_order;
+             size_t                                                    _max_cached_responses;
        
              fc::future<void>                                          _block_gen_loop_complete;
        
@@ -123,18 +196,159 @@ namespace bts { namespace kid {
                          hist.updates.push_back( name_index( next_block.number, rec ) );
                          _name_index.store( new_rec.name, hist );
                          _key_to_name.store( new_rec.active_key.to_base58(), new_rec.name );
+                         store_record( name_index( next_block.number, rec ), new_rec );
                       }
        
                       _current_block = next_block;
                       _current_block_id = _current_block.id();
+                      _pending.clear();
+                      _pending_json_valid = false;
+                   }
+                   fc::usleep( fc::seconds( 1 ) );
+                }
+             }
+
+             void start_read_threads()
+             {
+                if( _read_threads.empty() )
+                {
+                   for( uint32_t i = 0; i < 2; ++i )
+                      _read_threads.emplace_back( new fc::thread( "kid_read" ) );
+                }
+             }
 
-                      fc::path block_file = _data_dir / "block" / fc::to_string( uint64_t(_current_block.number) );
+             fc::thread& read_thread()
+             {
+                start_read_threads();
+                return *_read_threads[ _next_read_thread++ % _read_threads.size() ];
+             }
 
-                      std::ofstream out( block_file.generic_string().c_str() );
-                      auto block_str = fc::json::to_pretty_string( _current_block );
-                      out.write( block_str.c_str(), block_str.size() );
+             void cache_response( const std::string& path, const cached_response& response )
+             {
+                if( _response_cache.find( path ) == _response_cache.end() )
+                {
+                   if( _response_cache.size() >= _max_cached_responses )
+                   {
+                      _response_cache.erase( _response_cache_order.front() );
+                      _response_cache_order.pop_front();
                    }
-                   fc::usleep( fc::seconds( 1 ) );
+                   _response_cache_order.push_back( path );
+                }
+                _response_cache[path] = response;
+             }
+
+             /** a block never changes once generated, its id is its etag */
+             cached_response block_response( const std::string& path, uint32_t block_num, bool pretty )
+             {
+                auto itr = _response_cache.find( path );
+                if( itr != _response_cache.end() ) return itr->second;
+
+                // waiting yields to the other requests of this thread
+                auto response = read_thread().async( [=]() -> cached_response
+                {
+                   auto blk = _self->fetch_block( block_num );
+                   cached_response result;
+                   result.etag = "\"" + blk.id().str() + "\"";
+                   result.body = pretty ? fc::json::to_pretty_string( blk ) : fc::json::to_string( blk );
+                   return result;
+                } ).wait();
+                cache_response( path, response );
+                return response;
+             }
+
+             fc::optional<cached_response> static_file_response( const std::string& path, const fc::path& filename )
+             {
+                if( !fc::exists( filename ) ) return fc::optional<cached_response>();
+                FC_ASSERT( !fc::is_directory( filename ) );
+                auto file_size = fc::file_size( filename );
+                FC_ASSERT( file_size != 0 );
+                boost::system::error_code ec;
+                std::time_t last_write = boost::filesystem::last_write_time( boost::filesystem::path( filename.generic_string() ), ec );
+                FC_ASSERT( !ec, "unable to read the modification time of ${f}", ("f",filename) );
+
+                auto itr = _response_cache.find( path );
+                if( itr != _response_cache.end() && itr->second.file_size == file_size &&
+                    itr->second.last_write == last_write && itr->second.read_at > last_write )
+                   return itr->second;
+
+                std::time_t read_at = std::time( nullptr );
+
+                auto response = read_thread().async( [=]() -> cached_response
+                {
+                   fc::file_mapping fm( filename.generic_string().c_str(), fc::read_only );
+                   fc::mapped_region mr( fm, fc::read_only, 0, file_size );
+
+                   cached_response result;
+                   result.body.assign( (const char*)mr.get_address(), mr.get_size() );
+                   result.etag = "\"" + fc::ripemd160::hash( result.body ).str() + "\"";
+                   result.file_size  = file_size;
+                   result.last_write = last_write;
+                   result.read_at    = read_at;
+                   return result;
+                } ).wait();
+                cache_response( path, response );
+                return response;
+             }
+
+             /** answers 304 to a client that already has this version */
+             void send_response( const fc::http::request& r, const fc::http::server::response& s,
+                                 fc::http::reply::status_code status, const cached_response& response )
+             {
+                s.add_header( "ETag", response.etag );
+                if( r.get_header( "If-None-Match" ) == response.etag )
+                {
+                   s.set_status( fc::http::reply::status_code( 304 ) );
+                   s.set_length( 0 );
+                   return;
+                }
+                s.set_status( status );
+                s.set_length( response.body.size() );
+                s.write( response.body.c_str(), response.body.size() );
+             }
+
+             /** the checks of r against the server state, which hash nothing */
+             void check_record( const signed_name_record& r )
+             {
+                FC_ASSERT( _pending.size() < 20000 );
+                FC_ASSERT( fc::trim_and_normalize_spaces( r.name ) == r.name );
+                FC_ASSERT( fc::to_lower( r.name ) == r.name );
+                FC_ASSERT( _current_block_id == r.prev_block_id     );
+
+                auto pending_itr = _pending.find( r.name );
+                FC_ASSERT( pending_itr == _pending.end()         );
+                auto latest = _latest_records.find( r.name );
+                if( !latest ) return;
+
+                FC_ASSERT( latest->master_key == r.master_key )
+                FC_ASSERT( r.first_update == latest->first_update );
+                FC_ASSERT( r.last_update  > latest->last_update );
+                FC_ASSERT( fc::time_point::now() > fc::time_point(r.last_update) );
+                FC_ASSERT( (fc::time_point::now() - fc::time_point(r.last_update)) < fc::seconds( 120 ) );
+             }
+
+             /** r must have been verified, it is checked again because a block may have been generated meanwhile */
+             void add_pending( const signed_name_record& r )
+             {
+                check_record( r );
+                _pending[r.name] = r;
+                _pending_json_valid = false;
+             }
+
+             void store_record( const name_index& index, const signed_name_record& rec )
+             {
+                _records.store( index, rec );
+                _latest_records.store( rec.name, rec );
+             }
+
+             /** for data directories from before records were stored on their own */
+             void index_records( uint32_t last_block )
+             {
+                ilog( "indexing the records of ${n} blocks", ("n",last_block) );
+                for( auto itr = _block_database.begin(); itr.valid(); ++itr )
+                {
+                   auto blk = itr.value();
+                   for( uint32_t rec = 0; rec < blk.records.size(); ++rec )
+                      store_record( name_index( blk.number, rec ), blk.records[rec] );
                 }
              }
 
@@ -149,10 +363,14 @@ namespace bts { namespace kid {
                     //ilog( "command: ${command}", ("command",first_dir) );
                     if( first_dir == "pending" )
                     {
+                       if( !_pending_json_valid )
+                       {
+                          _pending_json = fc::json::to_string( _pending );
+                          _pending_json_valid = true;
+                       }
                        s.set_status( fc::http::reply::OK );
-                       auto pending_json = fc::json::to_string( _pending );
-                       s.set_length( pending_json.size() );
-                       s.write( pending_json.c_str(), pending_json.size() );
+                       s.set_length( _pending_json.size() );
+                       s.write( _pending_json.c_str(), _pending_json.size() );
                     }
                     else if( first_dir == "update_record" )
                     {
@@ -166,6 +384,17 @@ namespace bts { namespace kid {
                        s.set_length( 12 );
                        s.write( "Record Created", 12 );
                     }
+                    else if( first_dir == "update_records" )
+                    {
+                       FC_ASSERT( r.body.size() );
+                       std::string str(r.body.data(),r.body.size());
+                       auto recs = fc::json::from_string( str ).as<std::vector<signed_name_record> >();
+
+                       auto accepted = fc::json::to_string( _self->update_records( recs ) );
+                       s.set_status( fc::http::reply::OK );
+                       s.set_length( accepted.size() );
+                       s.write( accepted.c_str(), accepted.size() );
+                    }
                     else if( first_dir == "fetch_by_name/" )
                     {
                        auto name = r.path.substr( pos+1, std::string::npos );
@@ -206,32 +435,28 @@ namespace bts { namespace kid {
                        s.set_length( blkjson.size() );
                        s.write( blkjson.c_str(), blkjson.size() );
                     }
+                    else if( first_dir == "block/" )
+                    {
+                       // what used to be written to htdocs/block/N as each block was generated
+                       auto block_num = r.path.substr( pos+1, std::string::npos );
+                       send_response( r, s, fc::http::reply::OK,
+                                      block_response( r.path, fc::to_uint64( block_num ), true ) );
+                    }
                     else if( first_dir == "fetch_block/" )
                     {
                        auto block_num = r.path.substr( pos+1, std::string::npos );
-                       auto blk = _self->fetch_block(  fc::to_uint64( block_num ) );
-                       s.set_status( fc::http::reply::Found );
-                       auto blkjson = fc::json::to_string( blk );
-                       s.set_length( blkjson.size() );
-                       s.write( blkjson.c_str(), blkjson.size() );
+                       send_response( r, s, fc::http::reply::Found,
+                                      block_response( r.path, fc::to_uint64( block_num ), false ) );
                     }
                     else
                     {
                        auto dotpos = r.path.find( ".." );
                        FC_ASSERT( dotpos == std::string::npos );
                        auto filename = _data_dir / r.path.substr(1,std::string::npos);
-                       if( fc::exists( filename ) )
+                       auto response = static_file_response( r.path, filename );
+                       if( response )
                        {
-                          FC_ASSERT( !fc::is_directory( filename ) );
-                          auto file_size = fc::file_size( filename );
-                          FC_ASSERT( file_size != 0 );
-
-                          fc::file_mapping fm( filename.generic_string().c_str(), fc::read_only );
-                          fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size( filename ) );
-
-                          s.set_status( fc::http::reply::OK );
-                          s.set_length( file_size );
-                          s.write( (const char*)mr.get_address(), mr.get_size() );
+                          send_response( r, s, fc::http::reply::OK, *response );
                           return;
                        }
                        s.set_status( fc::http::reply::NotFound );
@@ -277,17 +502,21 @@ namespace bts { namespace kid {
    void server::set_data_directory( const fc::path& dir )
    {
       my->_data_dir = dir / "htdocs";
-      fc::create_directories( my->_data_dir / "block" );
+      fc::create_directories( my->_data_dir );
       my->_name_index.open( dir / "name_index" );
       my->_block_database.open( dir / "block_database" );
       my->_key_data.open( dir / "key_data" );
       my->_key_to_name.open( dir / "key_to_name" );
+      my->_records.open( dir / "records" );
+      my->_latest_records.open( dir / "latest_records" );
 
       uint32_t last_block = 0;
       if( my->_block_database.last( last_block ) )
       {
          my->_current_block = fetch_block( last_block );
          my->_current_block_id = my->_current_block.id();
+         if( last_block > 0 && !my->_records.begin().valid() )
+            my->index_records( last_block );
       }
       else
       {
@@ -311,53 +540,85 @@ namespace bts { namespace kid {
 
    bool server::update_record( const signed_name_record& r )
    { try {
-      FC_ASSERT( my->_pending.size() < 20000 );
-      FC_ASSERT( fc::trim_and_normalize_spaces( r.name ) == r.name );
-      FC_ASSERT( fc::to_lower( r.name ) == r.name );
-      FC_ASSERT( r.difficulty() >= my->_current_block.difficulty, "",
-                 ("r.difficulty",r.difficulty())("current_difficulty",my->_current_block.difficulty));
-      FC_ASSERT( my->_current_block_id == r.prev_block_id     );
-      FC_ASSERT( r.get_signee() == r.master_key );
-
-      auto pending_itr = my->_pending.find( r.name );
-      FC_ASSERT( pending_itr == my->_pending.end()         );
-      auto hist = fetch_history( r.name ); 
-      if( hist.updates.size() == 0 )
+      my->check_record( r );
+      auto difficulty = my->_current_block.difficulty;
+      // waiting yields to the other requests of this thread
+      my->read_thread().async( [=](){ detail::verify_record( r, difficulty ); } ).wait();
+      my->add_pending( r );
+      return true;
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to update record ${rec}", ("rec",r) ) }
+
+   std::vector<bool> server::update_records( const std::vector<signed_name_record>& records )
+   {
+      std::vector<bool> accepted( records.size(), false );
+      std::vector<size_t> unverified;
+      for( size_t i = 0; i < records.size(); ++i )
       {
-         my->_pending[r.name] = r;
-         return true;
+         try {
+            my->check_record( records[i] );
+            unverified.push_back( i );
+         }
+         catch ( const fc::exception& e )
+         {
+            wlog( "rejecting record ${name}: ${e}", ("name",records[i].name)("e",e.to_string()) );
+         }
       }
 
-      auto old_record  = fetch_record( hist.updates.back() );
-      FC_ASSERT( old_record.master_key == r.master_key )
-      FC_ASSERT( r.first_update == old_record.first_update );
-      FC_ASSERT( r.last_update  > old_record.last_update );
-      FC_ASSERT( fc::time_point::now() > fc::time_point(r.last_update) );
-      FC_ASSERT( (fc::time_point::now() - fc::time_point(r.last_update)) < fc::seconds( 120 ) );
-      my->_pending[r.name] = r;
-      return true;
-   } FC_RETHROW_EXCEPTIONS( warn, "unable to update record ${rec}", ("rec",r) ) }
+      // each read thread verifies an interleaved share of the batch
+      auto difficulty = my->_current_block.difficulty;
+      my->start_read_threads();
+      auto workers = my->_read_threads.size();
+      std::vector<char> verified( records.size(), 0 );
+      std::vector<fc::future<void> > done;
+      for( size_t w = 0; w < workers; ++w )
+      {
+         done.push_back( my->_read_threads[w]->async( [&,w]()
+         {
+            for( size_t i = w; i < unverified.size(); i += workers )
+            {
+               try {
+                  detail::verify_record( records[unverified[i]], difficulty );
+                  verified[unverified[i]] = 1;
+               }
+               catch ( const fc::exception& e )
+               {
+                  wlog( "rejecting record ${name}: ${e}", ("name",records[unverified[i]].name)("e",e.to_string()) );
+               }
+            }
+         } ) );
+      }
+      for( auto& d : done ) d.wait();
+
+      for( auto i : unverified )
+      {
+         if( !verified[i] ) continue;
+         try {
+            my->add_pending( records[i] );
+            accepted[i] = true;
+         }
+         catch ( const fc::exception& e )
+         {
+            wlog( "rejecting record ${name}: ${e}", ("name",records[i].name)("e",e.to_string()) );
+         }
+      }
+      return accepted;
+   }
 
    signed_name_record      server::fetch_record( const std::string& name )
    {
       auto pending_itr = my->_pending.find( name );
       if( pending_itr != my->_pending.end() )
          return pending_itr->second;
-      auto hist= fetch_history( name ); 
-      FC_ASSERT( hist.updates.size() > 0 );
 
-      auto old_block   = fetch_block( hist.updates.back().block_num );
-      return fetch_record( hist.updates.back() );
-      FC_ASSERT( old_block.records.size() > hist.updates.back().record_num );
-      return old_block.records[hist.updates.back().record_num];
+      auto latest = my->_latest_records.find( name );
+      FC_ASSERT( latest, "unknown name ${name}", ("name",name) );
+      return *latest;
    }
 
    signed_name_record      server::fetch_record( const name_index& index )
-   {
-      auto old_block   = fetch_block( index.block_num );
-      FC_ASSERT( old_block.records.size() > index.record_num );
-      return old_block.records[index.record_num];
-   }
+   { try {
+      return my->_records.fetch( index );
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to fetch record ${n}", ("n",index) ) }
    signed_name_record      server::fetch_record_by_key( const std::string& key_b58 )
    {
       auto name = my->_key_to_name.fetch( key_b58 );
@@ -1,8 +1,8 @@
-
 #pragma once
 #include <bts/blockchain/asset.hpp>
 #include <bts/blockchain/transaction.hpp>
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/config.hpp>
 
 #include <bts/lotto/lotto_transaction_validator.hpp>
 
@@ -10,21 +10,31 @@ namespace bts { namespace lotto {
 
 namespace detail  { class lotto_db_impl; }
 
+/** the running totals of a drawing, which covers BTS_BLOCKCHAIN_BLOCKS_PER_DAY blocks */
 struct drawing_record
 {
    drawing_record()
-   :total_jackpot(0),total_paid(0){}
+   :total_jackpot(0),total_paid(0),ticket_count(0){}
+
+   uint64_t   remaining_jackpot()const { return total_jackpot - total_paid; }
 
-   uint64_t total_jackpot;
-   uint64_t total_paid;
+   uint64_t   total_jackpot;  ///< the ticket sales of the drawing
+   uint64_t   total_paid;
+   uint32_t   ticket_count;
+   fc::sha256 winning_number; ///< set once the first block of the next drawing is stored
 };
+
+/** what the tickets of a block added to its drawing, kept so the block can be undone */
 struct block_summary
 {
    block_summary()
-   :ticket_sales(0),amount_won(0){}
+   :drawing(0),ticket_sales(0),amount_won(0){}
 
-   uint64_t ticket_sales;
-   uint64_t amount_won;
+   uint32_t                     drawing;
+   uint64_t                     ticket_sales;
+   uint64_t                     amount_won;
+   std::vector<uint64_t>        lucky_numbers; ///< of the tickets of the block, sorted
+   std::map<uint32_t,uint64_t>  claims;        ///< jackpot paid by drawing
 };
 
 class lotto_db : public bts::blockchain::chain_database
@@ -32,32 +42,48 @@ class lotto_db : public bts::blockchain::chain_database
     public:
         lotto_db();
         ~lotto_db();
-    
-        void             open( const fc::path& dir, bool create );
-        void             close();
 
-        uint64_t get_jackpot_for_ticket( uint64_t ticket_block_num, 
-                                         fc::sha256& winning_number, 
+        virtual void     open( const fc::path& dir, bool create = true,
+                               const chain_database_tuning& tuning = chain_database_tuning() );
+        virtual void     close();
+
+        static uint32_t  drawing_for_block( uint32_t block_num ) { return block_num / BTS_BLOCKCHAIN_BLOCKS_PER_DAY; }
+
+        /**
+         *  @param winning_number of the drawing the ticket was for
+         *  @param global_odds the number of tickets of that drawing
+         *  @return what is left of the jackpot of the drawing
+         *  @throw if the drawing has not been drawn yet or its jackpot was claimed
+         */
+        uint64_t get_jackpot_for_ticket( uint64_t ticket_block_num,
+                                         fc::sha256& winning_number,
                                          uint64_t& global_odds );
 
+        drawing_record   get_drawing( uint32_t drawing );
+        block_summary    get_block_summary( uint32_t block_num );
+        /** @return the tickets of block_num that picked lucky_number, a binary search of its summary */
+        uint32_t         count_tickets( uint32_t block_num, uint64_t lucky_number );
+
+    protected:
         /**
          * Performs global validation of a block to make sure that no two transactions conflict. In
          * the case of the lotto only one transaction can claim the jackpot.
          */
-        virtual void validate( const trx_block& blk, const signed_transactions& determinsitc_trxs );
+        virtual void validate_block_state( const trx_block& blk, const block_evaluation_state_ptr& state );
 
-        /** 
+        /**
          *  Called after a block has been validated and appends
          *  it to the block chain storing all relevant transactions and updating the
          *  winning database.
          */
-        virtual void store( const trx_block& blk, const signed_transactions& determinsitc_trxs );
+        virtual void store( const trx_block& blk, const signed_transactions& deterministic_trxs,
+                            const block_evaluation_state_ptr& state );
+
+        /** subtracts the summary of blk from its drawing, staged until commit_undo() */
+        virtual void undo( const trx_block& blk );
+        virtual void commit_undo();
+        virtual void abort_undo();
 
-        /**
-         * When a block is popped from the chain, this method implements the necessary code
-         * to revert the blockchain database to the proper state.
-         */
-        virtual trx_block pop_block();
     private:
          std::unique_ptr<detail::lotto_db_impl> my;
 
@@ -67,5 +93,5 @@ class lotto_db : public bts::blockchain::chain_database
 }} // bts::lotto
 
 
-FC_REFLECT( bts::lotto::drawwing_record, (total_jackpot)(total_paid) )
-FC_REFLECT( bts::lotto::block_summary, (ticket_sales)(amount_won) )
+FC_REFLECT( bts::lotto::drawing_record, (total_jackpot)(total_paid)(ticket_count)(winning_number) )
+FC_REFLECT( bts::lotto::block_summary, (drawing)(ticket_sales)(amount_won)(lucky_numbers)(claims) )
@@ -44,4 +44,4 @@ struct claim_ticket_output
 
 FC_REFLECT_ENUM(bts::lotto::claim_type_enum, (claim_ticket));
 FC_REFLECT(bts::lotto::claim_ticket_input, BOOST_PP_SEQ_NIL);
-FC_REFLECT(bts::lotto::claim_ticket_output, (owner)(odds));
+FC_REFLECT(bts::lotto::claim_ticket_output, (lucky_number)(owner)(odds));
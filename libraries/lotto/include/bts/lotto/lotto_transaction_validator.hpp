@@ -4,6 +4,8 @@
 #include <bts/lotto/lotto_outputs.hpp>
 #include <fc/reflect/variant.hpp>
 
+#include <map>
+
 namespace bts { namespace lotto {
 using namespace bts::blockchain;
 
@@ -11,26 +13,54 @@ class lotto_db;
 class lotto_trx_evaluation_state : public bts::blockchain::transaction_evaluation_state
 {
     public:
-        lotto_trx_evaluation_state( const signed_transaction& tx )
-        :transaction_evaluation_state( tx ),total_ticket_sales(0){}
+        lotto_trx_evaluation_state( const signed_transaction& tx, evaluation_arena* arena = nullptr )
+        :transaction_evaluation_state( tx, arena ),total_ticket_sales(0),ticket_winnings(0){}
 
         uint64_t total_ticket_sales;
         uint64_t ticket_winnings;
 };
 
+/** the tickets sold and jackpots claimed by the transactions of a block */
+class lotto_block_evaluation_state : public bts::blockchain::block_evaluation_state
+{
+    public:
+        /** lucky number and amount of each ticket, in the order of the block */
+        std::vector< std::pair<uint64_t,uint64_t> > tickets;
+        /** jackpot claimed by drawing, only one ticket of a block may claim a drawing */
+        std::map<uint32_t,uint64_t>                 claims;
+};
+
+typedef std::shared_ptr<lotto_block_evaluation_state> lotto_block_evaluation_state_ptr;
+
 class lotto_transaction_validator : public bts::blockchain::transaction_validator
 {
     public:
         lotto_transaction_validator(lotto_db* db);
         virtual ~lotto_transaction_validator();
 
-        virtual transaction_summary evaluate( const signed_transaction& trx );
-        virtual void validate_input( const meta_trx_input& in, transaction_evaluation_state& state );
-        virtual void validate_output( const trx_output& out, transaction_evaluation_state& state );
+        virtual block_evaluation_state_ptr create_block_state()const;
+
+        virtual transaction_summary evaluate( const signed_transaction& trx,
+                                              const block_evaluation_state_ptr& block_state );
+        virtual void validate_input( const meta_trx_input& in, transaction_evaluation_state& state,
+                                     const block_evaluation_state_ptr& block_state );
+        virtual void validate_output( const trx_output& out, transaction_evaluation_state& state,
+                                      const block_evaluation_state_ptr& block_state );
+
+        void validate_ticket_input( const meta_trx_input& in, lotto_trx_evaluation_state& state,
+                                    const lotto_block_evaluation_state_ptr& block_state );
+        void validate_ticket_output( const trx_output& out, lotto_trx_evaluation_state& state,
+                                     const lotto_block_evaluation_state_ptr& block_state );
 
-        void validate_ticket_input(const meta_trx_input& in, transaction_evaluation_state& state);
-        void validate_ticket_output(const trx_output& out, transaction_evaluation_state& state);
+        /**
+         *  @return true if a ticket for lucky_number at odds that paid amount wins the drawing
+         *          that drew winning_number out of global_odds tickets
+         */
+        static bool is_winner( uint64_t lucky_number, uint16_t odds, uint64_t amount,
+                               const fc::sha256& winning_number, uint64_t global_odds );
+
+    private:
+        lotto_db* _lotto_db;
 };
 
 }} // bts::lotto
-
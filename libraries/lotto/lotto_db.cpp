@@ -1,8 +1,9 @@
-
 #include <bts/db/level_map.hpp>
 #include <bts/lotto/lotto_db.hpp>
 #include <fc/reflect/variant.hpp>
 
+#include <algorithm>
+
 namespace bts { namespace lotto {
 
     namespace detail
@@ -14,7 +15,27 @@ namespace bts { namespace lotto {
                 // map drawning number to drawing record
                 bts::db::level_map<uint32_t, drawing_record>  _drawing2record;
                 bts::db::level_map<uint32_t, block_summary>   _block2summary;
-            
+
+                /** both read through the batches undo() stages */
+                drawing_record fetch_drawing( uint32_t drawing )
+                {
+                    drawing_record rec;
+                    _drawing2record.with_value( drawing, [&]( const char* data, size_t size )
+                    {
+                        fc::datastream<const char*> ds( data, size );
+                        fc::raw::unpack( ds, rec );
+                    });
+                    return rec;
+                }
+
+                bool fetch_summary( uint32_t block_num, block_summary& summary )
+                {
+                    return _block2summary.with_value( block_num, [&]( const char* data, size_t size )
+                    {
+                        fc::datastream<const char*> ds( data, size );
+                        fc::raw::unpack( ds, summary );
+                    });
+                }
         };
     }
 
@@ -28,53 +49,171 @@ namespace bts { namespace lotto {
     {
     }
 
-    void lotto_db::open( const fc::path& dir, bool create )
+    void lotto_db::open( const fc::path& dir, bool create, const chain_database_tuning& tuning )
     {
         try {
-            chain_database::open( dir, create );
-            my->drawing2record.open( dir / "drawing2record", create );
-            my->block2summary.open( dir / "block2summary", create );
-        } FC_RETHROW_EXCEPTIONS( warn, "Error loading domain database ${dir}", ("dir", dir)("create", create) );
+            chain_database::open( dir, create, tuning );
+            my->_drawing2record.open( dir / "drawing2record", create, tuning.records );
+            my->_block2summary.open( dir / "block2summary", create, tuning.records );
+        } FC_RETHROW_EXCEPTIONS( warn, "Error loading lotto database ${dir}", ("dir", dir)("create", create) );
     }
 
-    void lotto_db::close() 
+    void lotto_db::close()
+    {
+        my->_block2summary.close();
+        my->_drawing2record.close();
+        chain_database::close();
+    }
+
+    uint64_t lotto_db::get_jackpot_for_ticket( uint64_t ticket_block_num,
+                                               fc::sha256& winning_number,
+                                               uint64_t& global_odds )
+    { try {
+        auto drawing = drawing_for_block( ticket_block_num );
+        FC_ASSERT( drawing < drawing_for_block( head_block_num() ), "drawing ${d} has not been drawn", ("d",drawing) );
+
+        auto rec = get_drawing( drawing );
+        FC_ASSERT( rec.remaining_jackpot() > 0, "the jackpot of drawing ${d} was claimed", ("d",drawing) );
+
+        winning_number = rec.winning_number;
+        global_odds    = std::max<uint64_t>( rec.ticket_count, 1 );
+        return rec.remaining_jackpot();
+    } FC_RETHROW_EXCEPTIONS( warn, "ticket from block ${b}", ("b",ticket_block_num) ) }
+
+    drawing_record lotto_db::get_drawing( uint32_t drawing )
     {
-        my->name2record.close();
+        return my->fetch_drawing( drawing );
     }
 
-    uint64_t lotto_db::get_jackpot_for_ticket( uint64_t ticket_block_num, 
-                                     fc::sha256& winning_number, 
-                                     uint64_t& global_odds )
+    block_summary lotto_db::get_block_summary( uint32_t block_num )
+    { try {
+        return my->_block2summary.fetch( block_num );
+    } FC_RETHROW_EXCEPTIONS( warn, "block ${b}", ("b",block_num) ) }
+
+    uint32_t lotto_db::count_tickets( uint32_t block_num, uint64_t lucky_number )
     {
+        block_summary summary;
+        if( !my->fetch_summary( block_num, summary ) ) return 0;
+        auto range = std::equal_range( summary.lucky_numbers.begin(), summary.lucky_numbers.end(), lucky_number );
+        return uint32_t( range.second - range.first );
     }
 
     /**
      * Performs global validation of a block to make sure that no two transactions conflict. In
      * the case of the lotto only one transaction can claim the jackpot.
      */
-    void lotto_db::validate( const trx_block& blk, const signed_transactions& determinsitc_trxs )
+    void lotto_db::validate_block_state( const trx_block& blk, const block_evaluation_state_ptr& state )
     {
+        chain_database::validate_block_state( blk, state );
+        auto lotto_state = std::dynamic_pointer_cast<lotto_block_evaluation_state>( state );
+        FC_ASSERT( lotto_state );
+
+        // the validator allows one claim per drawing and block, check it against the jackpot
+        for( const auto& claim : lotto_state->claims )
+            FC_ASSERT( claim.second <= get_drawing( claim.first ).remaining_jackpot() );
     }
 
-    /** 
+    /**
      *  Called after a block has been validated and appends
      *  it to the block chain storing all relevant transactions and updating the
      *  winning database.
      */
-    void lotto_db::store( const trx_block& blk, const signed_transactions& determinsitc_trxs )
+    void lotto_db::store( const trx_block& blk, const signed_transactions& deterministic_trxs,
+                          const block_evaluation_state_ptr& state )
+    {
+        chain_database::store( blk, deterministic_trxs, state );
+
+        block_summary summary;
+        summary.drawing = drawing_for_block( blk.block_num );
+
+        auto lotto_state = std::dynamic_pointer_cast<lotto_block_evaluation_state>( state );
+        if( lotto_state )
+        {
+            summary.lucky_numbers.reserve( lotto_state->tickets.size() );
+            for( const auto& ticket : lotto_state->tickets )
+            {
+                summary.ticket_sales += ticket.second;
+                summary.lucky_numbers.push_back( ticket.first );
+            }
+            std::sort( summary.lucky_numbers.begin(), summary.lucky_numbers.end() );
+
+            for( const auto& claim : lotto_state->claims )
+            {
+                summary.amount_won += claim.second;
+                summary.claims[claim.first] += claim.second;
+
+                auto rec = my->fetch_drawing( claim.first );
+                rec.total_paid += claim.second;
+                my->_drawing2record.store( claim.first, rec );
+            }
+        }
+
+        if( summary.ticket_sales > 0 || !summary.lucky_numbers.empty() )
+        {
+            auto rec = my->fetch_drawing( summary.drawing );
+            rec.total_jackpot += summary.ticket_sales;
+            rec.ticket_count  += summary.lucky_numbers.size();
+            my->_drawing2record.store( summary.drawing, rec );
+        }
+
+        // the first block of a drawing draws the previous one
+        if( blk.block_num > 0 && blk.block_num % BTS_BLOCKCHAIN_BLOCKS_PER_DAY == 0 )
+        {
+            auto rec = my->fetch_drawing( summary.drawing - 1 );
+            rec.winning_number = fc::sha256::hash( blk.id() );
+            my->_drawing2record.store( summary.drawing - 1, rec );
+        }
+
+        my->_block2summary.store( blk.block_num, summary );
+    }
+
+    void lotto_db::undo( const trx_block& blk )
+    {
+        my->_drawing2record.begin_batch();
+        my->_block2summary.begin_batch();
+        block_summary summary;
+        if( my->fetch_summary( blk.block_num, summary ) )
+        {
+            if( blk.block_num > 0 && blk.block_num % BTS_BLOCKCHAIN_BLOCKS_PER_DAY == 0 )
+            {
+                auto rec = my->fetch_drawing( summary.drawing - 1 );
+                rec.winning_number = fc::sha256();
+                my->_drawing2record.store( summary.drawing - 1, rec );
+            }
+
+            if( summary.ticket_sales > 0 || !summary.lucky_numbers.empty() )
+            {
+                auto rec = my->fetch_drawing( summary.drawing );
+                rec.total_jackpot -= summary.ticket_sales;
+                rec.ticket_count  -= summary.lucky_numbers.size();
+                my->_drawing2record.store( summary.drawing, rec );
+            }
+
+            for( const auto& claim : summary.claims )
+            {
+                auto rec = my->fetch_drawing( claim.first );
+                rec.total_paid -= claim.second;
+                my->_drawing2record.store( claim.first, rec );
+            }
+
+            my->_block2summary.remove( blk.block_num );
+        }
+
+        chain_database::undo( blk );
+    }
+
+    void lotto_db::commit_undo()
     {
+        my->_drawing2record.commit_batch();
+        my->_block2summary.commit_batch();
+        chain_database::commit_undo();
     }
 
-    /**
-     * When a block is popped from the chain, this method implements the necessary code
-     * to revert the blockchain database to the proper state.
-     */
-    trx_block lotto_db::pop_block()
+    void lotto_db::abort_undo()
     {
-       auto blk = chain_database::pop_block();
-       // TODO: remove block summary from DB
-       FC_ASSERT( !"Not Implemented" );
-       return blk;
+        my->_drawing2record.abort_batch();
+        my->_block2summary.abort_batch();
+        chain_database::abort_undo();
     }
 
 }} // bts::lotto
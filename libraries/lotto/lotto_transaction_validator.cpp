@@ -1,13 +1,15 @@
 #include <bts/lotto/lotto_transaction_validator.hpp>
-#include <bts/lotto/outputs.hpp>
+#include <bts/lotto/lotto_outputs.hpp>
 #include <bts/lotto/lotto_db.hpp>
 #include <bts/blockchain/config.hpp>
 #include <fc/io/raw.hpp>
 
+#include <cstring>
+
 namespace bts { namespace lotto {
 
 lotto_transaction_validator::lotto_transaction_validator(lotto_db* db)
-:transaction_validator(db)
+:transaction_validator(db),_lotto_db(db)
 {
 }
 
@@ -15,90 +17,117 @@ lotto_transaction_validator::~lotto_transaction_validator()
 {
 }
 
-transaction_summary lotto_transaction_validator::evaluate( const signed_transaction& tx)
+block_evaluation_state_ptr lotto_transaction_validator::create_block_state()const
 {
-    lotto_trx_evaluation_state state(tx);
-    return on_evaluate( state );
+    return std::make_shared<lotto_block_evaluation_state>();
 }
 
+transaction_summary lotto_transaction_validator::evaluate( const signed_transaction& tx,
+                                                           const block_evaluation_state_ptr& block_state )
+{
+    lotto_trx_evaluation_state state( tx, block_state ? block_state->arena() : nullptr );
+    return on_evaluate( state, block_state );
+}
 
-void lotto_transaction_validator::validate_input( const meta_trx_input& in, transaction_evaluation_state& state )
+
+void lotto_transaction_validator::validate_input( const meta_trx_input& in, transaction_evaluation_state& state,
+                                                  const block_evaluation_state_ptr& block_state )
 {
      switch( in.output.claim_func )
      {
         case claim_ticket:
-            validate_ticket_input(in, state);
-           break;
+        {
+            auto lotto_block_state = std::dynamic_pointer_cast<lotto_block_evaluation_state>( block_state );
+            FC_ASSERT( lotto_block_state );
+            validate_ticket_input( in, dynamic_cast<lotto_trx_evaluation_state&>(state), lotto_block_state );
+            break;
+        }
         default:
-           transaction_validator::validate_input( in, state );
+           transaction_validator::validate_input( in, state, block_state );
      }
 }
 
-void lotto_transaction_validator::validate_output( const trx_output& out, transaction_evaluation_state& state )
+void lotto_transaction_validator::validate_output( const trx_output& out, transaction_evaluation_state& state,
+                                                   const block_evaluation_state_ptr& block_state )
 {
      switch( out.claim_func )
      {
         case claim_ticket:
-            validate_ticket_output(out, state);
-           break;
+        {
+            auto lotto_block_state = std::dynamic_pointer_cast<lotto_block_evaluation_state>( block_state );
+            FC_ASSERT( lotto_block_state );
+            validate_ticket_output( out, dynamic_cast<lotto_trx_evaluation_state&>(state), lotto_block_state );
+            break;
+        }
         default:
-           transaction_validator::validate_output( out, state );
+           transaction_validator::validate_output( out, state, block_state );
      }
 }
 
-void lotto_transaction_validator::validate_ticket_input(const meta_trx_input& in, transaction_evaluation_state& state)
+bool lotto_transaction_validator::is_winner( uint64_t lucky_number, uint16_t odds, uint64_t amount,
+                                             const fc::sha256& winning_number, uint64_t global_odds )
+{
+    fc::sha256::encoder enc;
+    enc.write( (char*)&lucky_number, sizeof(lucky_number) );
+    enc.write( (char*)&winning_number, sizeof(winning_number) );
+    auto result = enc.result();
+
+    // the leading 64 bits of the hash are as uniform as all of it, without a bigint per ticket
+    uint64_t draw = 0;
+    memcpy( (char*)&draw, result.data(), sizeof(draw) );
+
+    /** the ticket number must be below the winning threshold to claim the jackpot */
+    auto winning_threshold = draw % (global_odds * odds);
+    auto ticket_threshold  = amount / odds;
+    return winning_threshold < ticket_threshold;
+}
+
+void lotto_transaction_validator::validate_ticket_input( const meta_trx_input& in, lotto_trx_evaluation_state& state,
+                                                         const lotto_block_evaluation_state_ptr& block_state )
 { try {
-    auto lotto_state = dynamic_cast<lotto_trx_evaluation_state&>(state);
-    auto claim_ticket = in.output.as<claim_ticket_output>();
+    auto ticket = in.output.as<claim_ticket_output>();
 
-    auto trx_loc = _db->fetch_trx_num( in.output_ref.trx_id );
-    auto headnum = _db->head_block_num();
+    // the transaction that bought the ticket, without a lookup by id
+    auto ticket_block = in.source.block_num;
+    auto headnum      = _db->head_block_num();
 
     // ticket must have been purchased in the past 2 days
-    FC_ASSERT( headnum - trx_loc.block_num < (BTS_BLOCKCHAIN_BLOCKS_PER_DAY*2) );
-    // ticket must be before the last drawing... 
-    FC_ASSERT( trx_loc.block_num < (headnum/BTS_BLOCKCHAIN_BLOCKS_PER_DAY)*BTS_BLOCKCHAIN_BLOCKS_PER_DAY );
+    FC_ASSERT( headnum - ticket_block < (BTS_BLOCKCHAIN_BLOCKS_PER_DAY*2) );
+    // ticket must be before the last drawing...
+    FC_ASSERT( ticket_block < (headnum/BTS_BLOCKCHAIN_BLOCKS_PER_DAY)*BTS_BLOCKCHAIN_BLOCKS_PER_DAY );
     // ticket must be signed by owner
-    FC_ASSERT( lotto_state.has_signature( claim_ticket.owner ) );
-    
-    lotto_db* db = dynamic_cast<lotto_db*>(_db);
-    FC_ASSERT( db != nullptr );
-    
+    FC_ASSERT( state.has_signature( ticket.owner ) );
+    FC_ASSERT( ticket.odds >= 1 );
+
+    auto drawing = lotto_db::drawing_for_block( ticket_block );
+    FC_ASSERT( block_state->claims.find( drawing ) == block_state->claims.end(),
+               "the jackpot of drawing ${d} is already claimed in this block", ("d",drawing) );
+
     fc::sha256 winning_number;
     uint64_t global_odds = 0;
 
     // returns the jackpot based upon which lottery the ticket was for.
     // throws an exception if the jackpot was already claimed.
-    uint64_t jackpot  = db->get_jackpot_for_ticket( trx_loc.block_num, winning_number, global_odds );
+    uint64_t jackpot  = _lotto_db->get_jackpot_for_ticket( ticket_block, winning_number, global_odds );
 
-    fc::sha256::encoder enc;
-    enc.write( (char*)&claim_ticket.lucky_number, sizeof(claim_ticket.lucky_number) );
-    enc.write( (char*)&winning_number, sizeof(winning_number) );
-    fc::bigint  result_bigint( enc.result() );
+    FC_ASSERT( is_winner( ticket.lucky_number, ticket.odds, in.output.amount.get_rounded_amount(),
+                          winning_number, global_odds ), "ticket did not win" );
 
-    /** the ticket number must be below the winning threshold to claim the jackpot */
-    auto winning_threshold = result_bigint % fc::bigint( global_odds * claim_ticket.odds ).to_int64();
-    auto ticket_threshold = in.output.amount.get_rounded_amount() / claim_ticket.odds;
-    if( winning_threshold < ticket_threshold ) // we have a winner!
-    {
-        lotto_state.add_input_asset( asset( jackpot ) ); 
-        lotto_state.ticket_winnings += jackpot;
-    }
-
-    uint64_t winnings = db->get_winnings( in ); // throws if they did not win.
-    lotto_state.ticket_winnings += winnings;
-    add_input_asset( asset(winnings) );
-} FC_RETHROW_EXCEPTIONS( warn, "" ) }
-
-void lotto_transaction_validator::validate_ticket_output(const trx_output& out, transaction_evaluation_state& state)
+    state.add_input_asset( asset( jackpot ) );
+    state.ticket_winnings += jackpot;
+    block_state->claims[drawing] = jackpot;
+} FC_RETHROW_EXCEPTIONS( warn, "", ("in",in) ) }
+
+void lotto_transaction_validator::validate_ticket_output( const trx_output& out, lotto_trx_evaluation_state& state,
+                                                          const lotto_block_evaluation_state_ptr& block_state )
 { try {
-    auto lotto_state = dynamic_cast<lotto_trx_evaluation_state&>(state);
-    lotto_state.total_ticket_sales += out.amount.get_rounded_amount();
-    lotto_state.add_output_asset( out.amount );
+    auto ticket = out.as<claim_ticket_output>();
+    FC_ASSERT( ticket.odds >= 1 );
 
-    auto claim_ticket = in.output.as<claim_ticket_output>();
-    FC_ASSERT( claim_ticket.odds 
-} FC_RETHROW_EXCEPTIONS( warn, "" ) }
+    state.total_ticket_sales += out.amount.get_rounded_amount();
+    state.add_output_asset( out.amount );
+    block_state->tickets.push_back( std::make_pair( ticket.lucky_number, out.amount.get_rounded_amount() ) );
+} FC_RETHROW_EXCEPTIONS( warn, "", ("out",out) ) }
 
 
-}} // bts::blockchain
+}} // bts::lotto
@@ -0,0 +1,89 @@
+#include <bts/net/aead_cipher.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <openssl/evp.h>
+
+#include <string.h>
+
+namespace bts { namespace net { namespace detail {
+
+  namespace
+  {
+    const EVP_CIPHER* evp_cipher_of( stcp_socket::cipher_suite suite )
+    {
+      switch( suite )
+      {
+        case stcp_socket::aes_256_gcm:
+          return EVP_aes_256_gcm();
+#ifndef OPENSSL_NO_CHACHA
+        case stcp_socket::chacha20_poly1305:
+          return EVP_chacha20_poly1305();
+#endif
+        default:
+          return nullptr;
+      }
+    }
+  }
+
+  aead_cipher::aead_cipher( stcp_socket::cipher_suite suite, const fc::sha256& key, bool encrypt )
+  :_ctx( EVP_CIPHER_CTX_new() ),_encrypt(encrypt),_sequence_number(0)
+  {
+    FC_ASSERT( _ctx != nullptr );
+    const EVP_CIPHER* cipher = evp_cipher_of( suite );
+    if( !cipher )
+    {
+      EVP_CIPHER_CTX_free( _ctx );
+      FC_THROW_EXCEPTION( exception, "unsupported cipher suite ${suite}", ("suite", int(suite)) );
+    }
+    if( EVP_CipherInit_ex( _ctx, cipher, nullptr, nullptr, nullptr, _encrypt ) != 1 ||
+        EVP_CIPHER_CTX_ctrl( _ctx, EVP_CTRL_AEAD_SET_IVLEN, sizeof(_nonce), nullptr ) != 1 ||
+        EVP_CipherInit_ex( _ctx, nullptr, nullptr, (const unsigned char*)key.data(), nullptr, _encrypt ) != 1 )
+    {
+      EVP_CIPHER_CTX_free( _ctx );
+      FC_THROW_EXCEPTION( exception, "unable to initialize cipher suite ${suite}", ("suite", int(suite)) );
+    }
+  }
+
+  aead_cipher::~aead_cipher()
+  {
+    EVP_CIPHER_CTX_free( _ctx );
+  }
+
+  bool aead_cipher::is_supported( stcp_socket::cipher_suite suite )
+  {
+    return evp_cipher_of( suite ) != nullptr;
+  }
+
+  void aead_cipher::seal( const char* length, char* data, uint32_t len, char* tag )
+  {
+    int out_len = 0;
+    start_record();
+    if( EVP_EncryptUpdate( _ctx, nullptr, &out_len, (const unsigned char*)length, stcp_socket::record_header_size ) != 1 ||
+        EVP_EncryptUpdate( _ctx, (unsigned char*)data, &out_len, (const unsigned char*)data, len ) != 1 ||
+        EVP_EncryptFinal_ex( _ctx, (unsigned char*)data + out_len, &out_len ) != 1 ||
+        EVP_CIPHER_CTX_ctrl( _ctx, EVP_CTRL_AEAD_GET_TAG, stcp_socket::record_tag_size, tag ) != 1 )
+      FC_THROW_EXCEPTION( exception, "unable to seal record of ${len} bytes", ("len", len) );
+  }
+
+  void aead_cipher::open( const char* length, char* data, uint32_t len, const char* tag )
+  {
+    int out_len = 0;
+    start_record();
+    if( EVP_DecryptUpdate( _ctx, nullptr, &out_len, (const unsigned char*)length, stcp_socket::record_header_size ) != 1 ||
+        EVP_DecryptUpdate( _ctx, (unsigned char*)data, &out_len, (const unsigned char*)data, len ) != 1 ||
+        EVP_CIPHER_CTX_ctrl( _ctx, EVP_CTRL_AEAD_SET_TAG, stcp_socket::record_tag_size, (void*)tag ) != 1 ||
+        EVP_DecryptFinal_ex( _ctx, (unsigned char*)data + out_len, &out_len ) != 1 )
+      FC_THROW_EXCEPTION( exception, "record of ${len} bytes failed authentication", ("len", len) );
+  }
+
+  void aead_cipher::start_record()
+  {
+    uint64_t n = _sequence_number++;
+    memset( _nonce, 0, sizeof(_nonce) );
+    for( int i = 0; i < 8; ++i )
+      _nonce[i] = (unsigned char)(n >> (8*i));
+    if( EVP_CipherInit_ex( _ctx, nullptr, nullptr, nullptr, _nonce, _encrypt ) != 1 )
+      FC_THROW_EXCEPTION( exception, "unable to set the record nonce" );
+  }
+
+} } } // bts::net::detail
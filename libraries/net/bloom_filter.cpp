@@ -0,0 +1,86 @@
+#include <bts/net/bloom_filter.hpp>
+#include <fc/crypto/city.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace bts { namespace net {
+
+  bloom_filter::bloom_filter(uint32_t number_of_elements, double false_positive_rate, uint32_t tweak) :
+    number_of_hash_functions(0),
+    tweak(tweak)
+  {
+    // the optimal size is -n ln(p) / ln(2)^2 bits, with ln(2) * bits / n hash functions
+    const double ln2 = 0.6931471805599453;
+    double bit_count = -double(std::max<uint32_t>(number_of_elements, 1)) * std::log(std::min(std::max(false_positive_rate, 1e-9), 1.0)) / (ln2 * ln2);
+    size_t byte_count = std::min<size_t>(std::max<size_t>(size_t(bit_count / 8), 1), maximum_bloom_filter_size);
+    bits.resize(byte_count);
+    double hash_functions = double(byte_count) * 8 / double(std::max<uint32_t>(number_of_elements, 1)) * ln2;
+    number_of_hash_functions = std::min<uint32_t>(std::max<uint32_t>(uint32_t(hash_functions), 1), maximum_bloom_filter_hash_functions);
+  }
+
+  /** the hash functions are combinations of the two halves of one city hash, see Kirsch and Mitzenmacher */
+  uint32_t bloom_filter::bit_index(uint64_t hash, uint32_t hash_number) const
+  {
+    uint32_t low = uint32_t(hash) ^ (tweak * 0xfba4c795);
+    uint32_t high = uint32_t(hash >> 32) | 1;
+    return (low + hash_number * high) % uint32_t(bits.size() * 8);
+  }
+
+  void bloom_filter::insert(const char* data, size_t size)
+  {
+    if (bits.empty())
+      return;
+    uint64_t hash = fc::city_hash64(data, size);
+    for (uint32_t i = 0; i < number_of_hash_functions; ++i)
+    {
+      uint32_t index = bit_index(hash, i);
+      bits[index / 8] |= char(1 << (index % 8));
+    }
+  }
+
+  bool bloom_filter::may_contain(const char* data, size_t size) const
+  {
+    if (bits.empty())
+      return false;
+    uint64_t hash = fc::city_hash64(data, size);
+    for (uint32_t i = 0; i < number_of_hash_functions; ++i)
+    {
+      uint32_t index = bit_index(hash, i);
+      if (!(bits[index / 8] & char(1 << (index % 8))))
+        return false;
+    }
+    return true;
+  }
+
+  bool bloom_filter::is_within_limits() const
+  {
+    return bits.size() <= maximum_bloom_filter_size && number_of_hash_functions <= maximum_bloom_filter_hash_functions;
+  }
+
+  bool match_transaction(bloom_filter& filter, const bts::blockchain::signed_transaction& trx)
+  {
+    bts::blockchain::transaction_id_type trx_id = trx.id();
+    bool matched = filter.may_contain(trx_id);
+    for (const bts::blockchain::trx_input& input : trx.inputs)
+      if (!matched && filter.may_contain(input.output_ref))
+        matched = true;
+    for (uint32_t i = 0; i < trx.outputs.size(); ++i)
+    {
+      const bts::blockchain::trx_output& output = trx.outputs[i];
+      bool owner_matched = false;
+      if (output.claim_func == bts::blockchain::claim_by_signature)
+        owner_matched = filter.may_contain(output.as<bts::blockchain::claim_by_signature_output>().owner);
+      else if (output.claim_func == bts::blockchain::claim_by_pts)
+        owner_matched = filter.may_contain(output.as<bts::blockchain::claim_by_pts_output>().owner);
+      if (owner_matched)
+      {
+        // so that the transaction that spends it matches too
+        filter.insert(bts::blockchain::output_reference(trx_id, i));
+        matched = true;
+      }
+    }
+    return matched;
+  }
+
+} } // bts::net
@@ -26,6 +26,20 @@ namespace bts { namespace net {
                ilog( "received block num ${n}", ("n",blkmsg.block_data.block_num) );
                _delegate->on_new_block( blkmsg.block_data );
             }
+            else if( m.msg_type == block_batch_message::type )
+            {
+               auto batch = m.as<block_batch_message>();
+               uint32_t block_num = 0;
+               for( const std::vector<char>& packed : batch.blocks )
+               {
+                  auto blk = fc::raw::unpack<trx_block>( packed );
+                  block_num = blk.block_num;
+                  _delegate->on_new_block( blk );
+               }
+               ilog( "received ${n} blocks up to ${b}", ("n",batch.blocks.size())("b",block_num) );
+               if( batch.blocks.size() )
+                  c.send( message( sync_ack_message( block_num ) ) );
+            }
             else if( m.msg_type == trx_message::type )
             {
                auto trx_msg = m.as<trx_message>();
@@ -65,7 +79,7 @@ namespace bts { namespace net {
                        _chain_con.connect( fc::ip::endpoint::from_string(ep) );
 
                        subscribe_message msg;
-                       msg.version        = 0;
+                       msg.version        = flow_controlled_sync_version;
                        if( _chain->head_block_num() != uint32_t(-1) )
                        {
                           msg.last_block     = _chain->head_block_id();
@@ -13,7 +13,9 @@
 #include <fc/thread/mutex.hpp>
 #include <fc/thread/scoped_lock.hpp>
 
+#include <deque>
 #include <unordered_map>
+#include <bts/db/executor.hpp>
 #include <bts/db/level_map.hpp>
 namespace bts { namespace net {
 
@@ -21,14 +23,33 @@ const chain_message_type subscribe_message::type = chain_message_type::subscribe
 const chain_message_type block_message::type     = chain_message_type::block_msg;
 const chain_message_type trx_message::type       = chain_message_type::trx_msg;
 const chain_message_type trx_err_message::type   = chain_message_type::trx_err_msg;
+const chain_message_type block_batch_message::type = chain_message_type::block_batch_msg;
+const chain_message_type sync_ack_message::type  = chain_message_type::sync_ack_msg;
 
   namespace detail
   {
+     /** a syncing client that acknowledges nothing for this long is disconnected */
+     static const uint32_t sync_ack_timeout_sec = 30;
+
+     /** a client with more than this queued by queue_send is disconnected */
+     static const uint64_t max_send_queue_bytes = 32*1024*1024;
+
+     /** the blocks of one sync message, fetched and packed by the prefetch thread */
+     struct prefetched_blocks
+     {
+        prefetched_blocks():last_block_num(0){}
+
+        message                          msg;
+        uint32_t                         last_block_num;
+        bts::blockchain::block_id_type   last_block_id;
+     };
+
      class chain_connection_impl
      {
         public:
           chain_connection_impl(chain_connection& s)
-          :self(s),con_del(nullptr){}
+          :self(s),con_del(nullptr),chain(nullptr),chain_thread(nullptr),
+           sync_window_bytes(4*1024*1024),sync_batch_bytes(256*1024),in_flight_bytes(0),send_queue_bytes(0){}
           chain_connection&          self;
           stcp_socket_ptr      sock;
           fc::ip::endpoint     remote_ep;
@@ -36,6 +57,7 @@ const chain_message_type trx_err_message::type   = chain_message_type::trx_err_m
 
           bts::blockchain::block_id_type   _last_block_id;
           bts::blockchain::chain_database* chain;
+          fc::thread*                      chain_thread; ///< that pushes the blocks of chain, set with it
 
           /** used to ensure that messages are written completely */
           fc::mutex              write_lock;
@@ -44,6 +66,149 @@ const chain_message_type trx_err_message::type   = chain_message_type::trx_err_m
           fc::future<void>       read_loop_complete;
           fc::future<void>       exec_sync_loop_complete;
 
+          std::deque<chain_connection::shared_frame> send_queue;
+          uint64_t               send_queue_bytes;
+          fc::future<void>       send_loop_complete;
+
+          void write_frame( const std::vector<char>& frame )
+          {
+             fc::scoped_lock<fc::mutex> lock(write_lock);
+             sock->write( frame.data(), frame.size() );
+             sock->flush();
+          }
+
+          void send_loop()
+          {
+             try
+             {
+                while( send_queue.size() && !send_loop_complete.canceled() )
+                {
+                   auto frame = send_queue.front();
+                   send_queue.pop_front();
+                   send_queue_bytes -= frame->size();
+                   write_frame( *frame );
+                }
+             }
+             catch ( const fc::canceled_exception& )
+             {
+                throw;
+             }
+             catch ( const fc::exception& e )
+             {
+                wlog( "unable to send queued message to ${ep}: ${e}", ("ep",remote_ep)("e",e.to_detail_string()) );
+                send_queue.clear();
+                send_queue_bytes = 0;
+             }
+          }
+
+          uint64_t               sync_window_bytes;
+          uint32_t               sync_batch_bytes;
+          /** the last block num and size of every batch sent but not acknowledged yet */
+          std::deque< std::pair<uint32_t,uint64_t> > in_flight;
+          uint64_t               in_flight_bytes;
+          fc::promise<void>::ptr sync_ack_promise;
+
+          /**
+           *  Packs the blocks from first up to at most last, as many as fit in max_bytes but at
+           *  least one, in a block_batch_message or, if not batched, a block_message of first.
+           *  Only reads the snapshot, so it runs on the storage pool.
+           */
+          static prefetched_blocks prefetch( const bts::blockchain::chain_snapshot_ptr& snapshot,
+                                             uint32_t first, uint32_t last, uint32_t max_bytes, bool batched )
+          {
+             prefetched_blocks result;
+             if( !batched )
+             {
+                block_message blk_msg( snapshot->fetch_trx_block( first ) );
+                result.last_block_num = first;
+                result.last_block_id  = blk_msg.block_data.id();
+                result.msg            = message( blk_msg );
+                return result;
+             }
+
+             block_batch_message batch;
+             uint64_t bytes = 0;
+             for( uint32_t n = first; n <= last && (n == first || bytes < max_bytes); ++n )
+             {
+                auto blk = snapshot->fetch_trx_block( n );
+                batch.blocks.push_back( fc::raw::pack( blk ) );
+                bytes += batch.blocks.back().size();
+                result.last_block_num = n;
+                result.last_block_id  = blk.id();
+             }
+             result.msg = message( batch );
+             return result;
+          }
+
+          /** blocks until bytes more can be sent without exceeding the sync window */
+          void wait_for_sync_window( uint64_t bytes )
+          {
+             while( in_flight_bytes && in_flight_bytes + bytes > sync_window_bytes )
+             {
+                sync_ack_promise = fc::promise<void>::ptr( new fc::promise<void>() );
+                try
+                {
+                   sync_ack_promise->wait_until( fc::time_point::now() + fc::seconds(sync_ack_timeout_sec) );
+                }
+                catch ( const fc::timeout_exception& )
+                {
+                   sync_ack_promise.reset();
+                   FC_THROW_EXCEPTION( timeout_exception, "no blocks acknowledged for ${s} seconds",
+                                       ("s",sync_ack_timeout_sec)("in_flight_bytes",in_flight_bytes) );
+                }
+                sync_ack_promise.reset();
+             }
+          }
+
+          /**
+           *  Sends the blocks after _last_block_id up to the head block, the next message is
+           *  prefetched while the last one is sent.  Blocks pushed meanwhile are picked up by
+           *  the next snapshot.
+           */
+          void sync( bool flow_controlled )
+          {
+             auto& prefetch_pool = bts::db::executor::instance().pool( "storage" );
+             in_flight.clear();
+             in_flight_bytes = 0;
+
+             while( !exec_sync_loop_complete.canceled() )
+             {
+                // the snapshot is taken where blocks are pushed, everything else reads the snapshot
+                bts::blockchain::chain_database* db = chain;
+                auto snapshot   = chain_thread->async( [db](){ return db->get_snapshot(); } ).wait();
+                uint32_t head   = snapshot->head_block_num();
+                uint32_t next   = 0;
+                if( _last_block_id != bts::blockchain::block_id_type() )
+                   next = snapshot->fetch_block_num( _last_block_id ) + 1;
+                if( head == uint32_t(-1) || next > head )
+                   break;
+                ilog( "syncing blocks ${n} to ${h}", ("n",next)("h",head) );
+
+                uint32_t max_bytes = sync_batch_bytes;
+                auto fetch = [snapshot,head,max_bytes,flow_controlled]( uint32_t first )
+                             { return prefetch( snapshot, first, head, max_bytes, flow_controlled ); };
+                fc::future<prefetched_blocks> pending = prefetch_pool.async( [=](){ return fetch( next ); } );
+                while( next <= head && !exec_sync_loop_complete.canceled() )
+                {
+                   prefetched_blocks blocks = pending.wait();
+                   next = blocks.last_block_num + 1;
+                   if( next <= head )
+                      pending = prefetch_pool.async( [=](){ return fetch( next ); } );
+
+                   uint64_t bytes = blocks.msg.size;
+                   if( flow_controlled ) wait_for_sync_window( bytes );
+                   self.send( blocks.msg );
+                   _last_block_id = blocks.last_block_id;
+                   if( flow_controlled )
+                   {
+                      in_flight.push_back( std::make_pair( blocks.last_block_num, bytes ) );
+                      in_flight_bytes += bytes;
+                   }
+                }
+             }
+             ilog( "all synced up, no blocks left to send" );
+          }
+
           void read_loop()
           {
             const int BUFFER_SIZE = 16;
@@ -168,6 +333,11 @@ const chain_message_type trx_err_message::type   = chain_message_type::trx_err_m
           my->exec_sync_loop_complete.cancel();
           my->exec_sync_loop_complete.wait();
         }
+        if( my->send_loop_complete.valid() )
+        {
+          my->send_loop_complete.cancel();
+          my->send_loop_complete.wait();
+        }
     } 
     catch ( const fc::canceled_exception& e )
     {
@@ -240,21 +410,40 @@ const chain_message_type trx_err_message::type   = chain_message_type::trx_err_m
       FC_THROW_EXCEPTION( exception, "unable to connect to ${host_port}", ("host_port",host_port) );
   }
 
-  void chain_connection::send( const message& m )
+  chain_connection::shared_frame chain_connection::pack_frame( const message& m )
   {
-    try {
-      fc::scoped_lock<fc::mutex> lock(my->write_lock);
 #define MAIL_PACKED_MESSAGE_HEADER sizeof(message_header)
       size_t len = MAIL_PACKED_MESSAGE_HEADER + m.size;
       len = 16*((len+15)/16); //pad the message we send to a multiple of 16 bytes
-      std::vector<char> tmp(len);
-      memcpy( tmp.data(), (char*)&m, MAIL_PACKED_MESSAGE_HEADER );
-      memcpy( tmp.data() + MAIL_PACKED_MESSAGE_HEADER, m.data.data(), m.size );
-      my->sock->write( tmp.data(), tmp.size() );
-      my->sock->flush();
+      auto frame = std::make_shared<std::vector<char> >(len);
+      memcpy( frame->data(), (char*)&m, MAIL_PACKED_MESSAGE_HEADER );
+      memcpy( frame->data() + MAIL_PACKED_MESSAGE_HEADER, m.data.data(), m.size );
+      return frame;
+  }
+
+  void chain_connection::send( const message& m )
+  {
+    try {
+      my->write_frame( *pack_frame( m ) );
     } FC_RETHROW_EXCEPTIONS( warn, "unable to send message" );
   }
 
+  void chain_connection::queue_send( const shared_frame& frame )
+  {
+     if( my->send_queue_bytes + frame->size() > detail::max_send_queue_bytes )
+     {
+        wlog( "disconnecting ${ep}, it has ${b} bytes queued", ("ep",my->remote_ep)("b",my->send_queue_bytes) );
+        my->send_queue.clear();
+        my->send_queue_bytes = 0;
+        get_socket()->get_socket().close();
+        return;
+     }
+     my->send_queue.push_back( frame );
+     my->send_queue_bytes += frame->size();
+     if( !my->send_loop_complete.valid() || my->send_loop_complete.ready() )
+        my->send_loop_complete = fc::async( [=](){ my->send_loop(); } );
+  }
+
 
   fc::ip::endpoint chain_connection::remote_endpoint()const 
   {
@@ -266,47 +455,49 @@ const chain_message_type trx_err_message::type   = chain_message_type::trx_err_m
      return my->remote_ep;
   }
 
-  void chain_connection::exec_sync_loop()
+  void chain_connection::exec_sync_loop( bool flow_controlled )
   {
       my->exec_sync_loop_complete = fc::async( [=]() 
       {
-          while( !my->exec_sync_loop_complete.canceled() )
+          try {
+             // TODO: sign the blocks..
+             my->sync( flow_controlled );
+          } 
+          catch ( const fc::canceled_exception& )
           {
-             try {
-                int32_t  cur_block_num  = int32_t(-1);
-                if( my->_last_block_id != bts::blockchain::block_id_type() )
-                    cur_block_num = my->chain->fetch_block_num( my->_last_block_id );
-                ilog( "head block ${h}  cur block ${c}", ("c",cur_block_num)("h",my->chain->head_block_num() ) );
-                while( cur_block_num < int32_t(my->chain->head_block_num())  )
-                {
-                    cur_block_num++;
-                    block_message blk_msg;
-                    blk_msg.block_data = my->chain->fetch_trx_block( cur_block_num );
-                    // TODO: sign it..
-                    ilog( "sending block ${n} ${c}", ("n",cur_block_num)("c",blk_msg.block_data.id()) );
-                    send( bts::net::message(blk_msg) );
-                    my->_last_block_id = blk_msg.block_data.id();
-                    fc::usleep( fc::microseconds( 1000*100 ) );
-                }
-                ilog( "all synced up, no blocks left to send" );
-                return;
-             } 
-             catch ( const fc::exception& e ) 
-             {
-                wlog( "${e}", ("e", e.to_detail_string() ) );
-                trx_err_message reply;
-                reply.err = e.to_detail_string();
-                send( message( reply ) );
-                get_socket()->get_socket().close();
-                return;
-             }
+             throw;
+          }
+          catch ( const fc::exception& e ) 
+          {
+             wlog( "${e}", ("e", e.to_detail_string() ) );
+             trx_err_message reply;
+             reply.err = e.to_detail_string();
+             send( message( reply ) );
+             get_socket()->get_socket().close();
           }
       });
   }
 
+  void chain_connection::acknowledge_sync( uint32_t block_num )
+  {
+     while( my->in_flight.size() && my->in_flight.front().first <= block_num )
+     {
+        my->in_flight_bytes -= my->in_flight.front().second;
+        my->in_flight.pop_front();
+     }
+     if( my->sync_ack_promise ) my->sync_ack_promise->set_value();
+  }
+
+  void chain_connection::set_sync_window( uint64_t window_bytes, uint32_t batch_bytes )
+  {
+     my->sync_window_bytes = window_bytes;
+     my->sync_batch_bytes  = batch_bytes;
+  }
+
   void chain_connection::set_database( bts::blockchain::chain_database* db )
   {
-     my->chain = db;
+     my->chain        = db;
+     my->chain_thread = &fc::thread::current();
   }
 
 } } // namesace bts::net
@@ -6,6 +6,7 @@
 #include <bts/net/message.hpp>
 #include <bts/net/stcp_socket.hpp>
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/genesis_balances.hpp>
 #include <bts/db/level_map.hpp>
 #include <fc/time.hpp>
 #include <fc/network/tcp_socket.hpp>
@@ -29,12 +30,14 @@ namespace bts { namespace net {
 /**
  *  When creating the genesis block it must initialize the genesis block to vote
  *  evenly for the top 100 delegates and register the top 100 delegates.
+ *
+ *  The balances are streamed from the file twice, the first pass finds the total that
+ *  the votes are divided by.
  */
 bts::blockchain::trx_block create_test_genesis_block(fc::path genesis_json_file)
 {
    try {
       FC_ASSERT( fc::exists(genesis_json_file) );
-      auto config = fc::json::from_file(genesis_json_file).as<genesis_block_config>();
       bts::blockchain::trx_block b;
 
       signed_transaction dtrx;
@@ -53,50 +56,48 @@ bts::blockchain::trx_block create_test_genesis_block(fc::path genesis_json_file)
       bts::blockchain::signed_transaction coinbase;
       coinbase.version = 0;
 
-      // TODO: simplify to one output per tx and evenly allocate votes among delegates
-      uint8_t output_idx = 0;
-      int32_t  current_delegate = 0;
-      uint64_t total_votes = 0;
-      uint64_t total = 0;
-      for( auto itr = config.balances.begin(); itr != config.balances.end(); ++itr )
+      pts_address owner;
+      uint64_t    balance = 0;
+      uint64_t    total   = 0;
       {
-          itr->second *=  100000000;;
-          total += itr->second;
+         genesis_balance_reader balances( genesis_json_file );
+         while( balances.next( owner, balance ) )
+            total += balance;
       }
       FC_ASSERT(total >= 100, "genesis block must contain enough balances to distribute amongst the delegates");
       int64_t one_percent = total / 100;
-      elog( "one percent: ${one}", ("one",one_percent) );
+      ilog( "one percent: ${one}", ("one",one_percent) );
 
 
       int64_t cur_trx_total = 0;
       int64_t total_supply = 0;
-      for( auto itr = config.balances.begin(); itr != config.balances.end(); ++itr )
+      genesis_balance_reader balances( genesis_json_file );
+      while( balances.next( owner, balance ) )
       {
+         int64_t amount = int64_t(balance);
          auto delta = one_percent - cur_trx_total;
-         if( delta > itr->second )
+         if( delta > amount )
          {
-            coinbase.outputs.push_back( trx_output( claim_by_pts_output( itr->first ), asset( itr->second ) ) );
-            cur_trx_total += itr->second;
+            coinbase.outputs.push_back( trx_output( claim_by_pts_output( owner ), asset( balance ) ) );
+            cur_trx_total += amount;
          }
          else
          {
-            coinbase.outputs.push_back( trx_output( claim_by_pts_output( itr->first ), asset( delta ) ) );
+            coinbase.outputs.push_back( trx_output( claim_by_pts_output( owner ), asset( uint64_t(delta) ) ) );
             cur_trx_total += delta;
             total_supply += cur_trx_total;
             coinbase.vote = ((total_supply / one_percent)%100)+1;
-            ilog( "vote: ${v}", ("v",coinbase.vote) );
 
             b.trxs.emplace_back( std::move(coinbase) );
             coinbase.outputs.clear();
             cur_trx_total = 0;
 
-            int64_t change = itr->second - delta;
+            int64_t change = amount - delta;
             while( change >= one_percent )
             {
-               coinbase.outputs.push_back( trx_output( claim_by_pts_output( itr->first ), asset( one_percent ) ) );
+               coinbase.outputs.push_back( trx_output( claim_by_pts_output( owner ), asset( uint64_t(one_percent) ) ) );
                total_supply += one_percent;
                coinbase.vote = ((total_supply / one_percent)%100)+1;
-               ilog( "vote: ${v}", ("v",coinbase.vote) );
                b.trxs.emplace_back( coinbase );
                coinbase.outputs.clear();
                change -= one_percent;
@@ -104,7 +105,7 @@ bts::blockchain::trx_block create_test_genesis_block(fc::path genesis_json_file)
             }
             if( change != 0 )
             {
-               coinbase.outputs.push_back( trx_output( claim_by_pts_output( itr->first ), asset( change ) ) );
+               coinbase.outputs.push_back( trx_output( claim_by_pts_output( owner ), asset( uint64_t(change) ) ) );
                cur_trx_total = change;
             }
          }
@@ -118,7 +119,6 @@ bts::blockchain::trx_block create_test_genesis_block(fc::path genesis_json_file)
       if( coinbase.outputs.size() )
       {
          coinbase.vote = ((total_supply / one_percent)%100)+1;
-         ilog( "vote: ${v}", ("v",coinbase.vote) );
          b.trxs.emplace_back( coinbase );
          coinbase.outputs.clear();
       }
@@ -199,44 +199,29 @@ namespace detail
         std::unordered_map<bts::blockchain::transaction_id_type,bts::blockchain::signed_transaction> _pending;
 
 
+        /** the block is packed once and queued on every connection, queue_send does not yield */
         void broadcast_block( const bts::blockchain::trx_block& blk )
         {
-            // copy list to prevent yielding in middle...
-            auto cons = _connections;
-
-            block_message blk_msg(blk);
-            for( auto c : cons )
+            auto frame = chain_connection::pack_frame( message( block_message(blk) ) );
+            auto id    = blk.id();
+            for( const auto& c : _connections )
             {
-               try {
-                  if( c.second->get_last_block_id() == blk.prev )
-                  {
-                    c.second->send( message( blk_msg ) );
-                    c.second->set_last_block_id( blk.id() );
-                  }
-               }
-               catch ( const fc::exception& w )
+               if( c.second->get_last_block_id() == blk.prev )
                {
-                  wlog( "${w}", ( "w",w.to_detail_string() ) );
+                 c.second->queue_send( frame );
+                 c.second->set_last_block_id( id );
                }
             }
         }
 
         void broadcast( const message& m )
         {
-            // copy list to prevent yielding in middle...
-            auto cons = _connections;
             ilog( "broadcast" );
-
-            for( auto con : cons )
+            auto frame = chain_connection::pack_frame( m );
+            for( const auto& con : _connections )
             {
-               try {
-                 // TODO... make sure connection is synced...
-                 con.second->send( m );
-               }
-               catch ( const fc::exception& w )
-               {
-                  wlog( "${w}", ( "w",w.to_detail_string() ) );
-               }
+               // TODO... make sure connection is synced...
+               con.second->queue_send( frame );
             }
         }
 
@@ -256,7 +241,11 @@ namespace detail
                 auto sm = m.as<subscribe_message>();
                 ilog( "recv: ${m}", ("m",sm) );
                 c.set_last_block_id( sm.last_block );
-                c.exec_sync_loop();
+                c.exec_sync_loop( sm.version >= flow_controlled_sync_version );
+             }
+             else if( m.msg_type == sync_ack_message::type )
+             {
+                c.acknowledge_sync( m.as<sync_ack_message>().block_num );
              }
              else if( m.msg_type == block_message::type )
              {
@@ -288,7 +277,7 @@ namespace detail
                    if( _pending.insert( std::make_pair(trx.signed_trx.id(),trx.signed_trx) ).second )
                    {
                       ilog( "new transaction, broadcasting" );
-                      fc::async( [=]() { broadcast( m ); } );
+                      broadcast( m );
                    }
                    else
                    {
@@ -350,6 +339,7 @@ namespace detail
               auto con = std::make_shared<chain_connection>(s,this);
               _connections[con->remote_endpoint()] = con;
               con->set_database( _chain.get() );
+              con->set_sync_window( _cfg.sync_window_bytes, _cfg.sync_batch_bytes );
               if( _ser_del ) _ser_del->on_connected( con );
            }
            catch ( const fc::canceled_exception& )
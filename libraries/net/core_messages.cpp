@@ -1,4 +1,11 @@
 #include <bts/net/core_messages.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <algorithm>
+
+#ifdef BTS_NET_HAVE_ZLIB
+# include <zlib.h>
+#endif
 
 namespace bts { namespace net {
 
@@ -12,5 +19,64 @@ namespace bts { namespace net {
   const core_message_type_enum connection_rejected_message::type           = core_message_type_enum::connection_rejected_message_type;
   const core_message_type_enum address_request_message::type               = core_message_type_enum::address_request_message_type;
   const core_message_type_enum address_message::type                       = core_message_type_enum::address_message_type;
+  const core_message_type_enum cipher_switch_message::type                 = core_message_type_enum::cipher_switch_message_type;
+  const core_message_type_enum compressed_message::type                    = core_message_type_enum::compressed_message_type;
+  const core_message_type_enum filter_load_message::type                   = core_message_type_enum::filter_load_message_type;
+  const core_message_type_enum filter_add_message::type                    = core_message_type_enum::filter_add_message_type;
+  const core_message_type_enum merkle_block_message::type                  = core_message_type_enum::merkle_block_message_type;
+
+  uint32_t local_connection_capabilities()
+  {
+#ifdef BTS_NET_HAVE_ZLIB
+    return zlib_compressed_messages | bloom_filtered_blocks;
+#else
+    return bloom_filtered_blocks;
+#endif
+  }
+
+  message compress_message(const message& message_to_compress)
+  {
+#ifdef BTS_NET_HAVE_ZLIB
+    compressed_message result;
+    result.uncompressed_type = message_to_compress.msg_type;
+    result.uncompressed_size = message_to_compress.size;
+    uLongf compressed_size = compressBound(message_to_compress.size);
+    result.compressed_data.resize(compressed_size);
+    // messages are compressed as they are sent, speed matters more than the last few percent
+    int status = compress2((Bytef*)result.compressed_data.data(), &compressed_size,
+                           (const Bytef*)message_to_compress.data.data(), message_to_compress.size, Z_BEST_SPEED);
+    if (status != Z_OK)
+      FC_THROW_EXCEPTION(exception, "unable to compress message of ${size} bytes: ${status}", ("size", message_to_compress.size)("status", status));
+    result.compressed_data.resize(compressed_size);
+    return message(result);
+#else
+    FC_THROW_EXCEPTION(exception, "message compression is not supported by this build");
+#endif
+  }
+
+  message decompress_message(const compressed_message& message_to_decompress, uint32_t maximum_size)
+  {
+#ifdef BTS_NET_HAVE_ZLIB
+    const uint32_t MAXIMUM_MESSAGE_SIZE = 16 * 1024 * 1024; // see message_header
+    if (message_to_decompress.uncompressed_size > std::min(maximum_size, MAXIMUM_MESSAGE_SIZE))
+      FC_THROW_EXCEPTION(exception, "compressed message of ${size} bytes exceeds the maximum of ${max}",
+                         ("size", message_to_decompress.uncompressed_size)("max", std::min(maximum_size, MAXIMUM_MESSAGE_SIZE)));
+    // unpacking would recurse with every level of nesting
+    if (message_to_decompress.uncompressed_type == compressed_message_type)
+      FC_THROW_EXCEPTION(exception, "compressed message holds another compressed message");
+    message result;
+    result.msg_type = message_to_decompress.uncompressed_type;
+    result.size = message_to_decompress.uncompressed_size;
+    result.data.resize(result.size);
+    uLongf uncompressed_size = result.size;
+    int status = uncompress((Bytef*)result.data.data(), &uncompressed_size,
+                            (const Bytef*)message_to_decompress.compressed_data.data(), message_to_decompress.compressed_data.size());
+    if (status != Z_OK || uncompressed_size != result.size)
+      FC_THROW_EXCEPTION(exception, "unable to decompress message of type ${type}: ${status}", ("type", message_to_decompress.uncompressed_type)("status", status));
+    return result;
+#else
+    FC_THROW_EXCEPTION(exception, "message compression is not supported by this build");
+#endif
+  }
 
 } } // bts::client
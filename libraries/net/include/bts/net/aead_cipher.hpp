@@ -0,0 +1,43 @@
+#pragma once
+#include <bts/net/stcp_socket.hpp>
+#include <fc/crypto/sha256.hpp>
+
+#include <stdint.h>
+
+struct evp_cipher_ctx_st;
+
+namespace bts { namespace net { namespace detail {
+
+  /**
+   *  One direction of an authenticated record stream.  The key is set once and
+   *  every record uses the next value of a 96 bit counter as its nonce, the
+   *  record's length is authenticated as associated data.
+   */
+  class aead_cipher
+  {
+    public:
+      /** @throws fc::exception if this build of OpenSSL lacks suite */
+      aead_cipher( stcp_socket::cipher_suite suite, const fc::sha256& key, bool encrypt );
+      ~aead_cipher();
+
+      /** whether OpenSSL was built with suite */
+      static bool is_supported( stcp_socket::cipher_suite suite );
+
+      /** encrypts len bytes of data in place and writes the tag, length is the record_header_size bytes before it */
+      void seal( const char* length, char* data, uint32_t len, char* tag );
+      /** decrypts len bytes of data in place, @throws fc::exception if the tag doesn't match */
+      void open( const char* length, char* data, uint32_t len, const char* tag );
+
+    private:
+      aead_cipher( const aead_cipher& );
+      aead_cipher& operator=( const aead_cipher& );
+
+      void start_record();
+
+      evp_cipher_ctx_st* _ctx;
+      int                _encrypt;
+      uint64_t           _sequence_number;
+      unsigned char      _nonce[12];
+  };
+
+} } } // bts::net::detail
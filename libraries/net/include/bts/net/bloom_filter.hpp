@@ -0,0 +1,65 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/reflect/reflect.hpp>
+
+#include <vector>
+
+namespace bts { namespace net {
+
+  const uint32_t maximum_bloom_filter_size = 36000;          /// bytes, enough for 20000 keys at 0.1% false positives
+  const uint32_t maximum_bloom_filter_hash_functions = 50;
+  const uint32_t maximum_bloom_filter_element_size = 520;    /// what a filter_add_message may add
+
+  /**
+   *  The filter a light client loads into a full node: a bloom filter over the packed bytes
+   *  of its addresses and of the outputs it owns.  The client chooses the size, and with it
+   *  how many transactions that aren't its own it is sent to hide the ones that are.  The
+   *  tweak lets it pick different bits for the same keys when it reloads the filter.
+   */
+  struct bloom_filter
+  {
+    std::vector<char> bits;
+    uint32_t          number_of_hash_functions;
+    uint32_t          tweak;
+
+    bloom_filter() :
+      number_of_hash_functions(0),
+      tweak(0)
+    {}
+    /** sized for number_of_elements keys at about false_positive_rate, within the maximums */
+    bloom_filter(uint32_t number_of_elements, double false_positive_rate, uint32_t tweak);
+
+    void insert(const char* data, size_t size);
+    bool may_contain(const char* data, size_t size) const;
+
+    /** keys are packed with fc::raw, an address matches the bytes of address in an output */
+    template<typename T>
+    void insert(const T& key)
+    {
+      std::vector<char> packed = fc::raw::pack(key);
+      insert(packed.data(), packed.size());
+    }
+    template<typename T>
+    bool may_contain(const T& key) const
+    {
+      std::vector<char> packed = fc::raw::pack(key);
+      return may_contain(packed.data(), packed.size());
+    }
+
+    /** @return false if a peer sent a filter larger than the maximums */
+    bool is_within_limits() const;
+
+  private:
+    uint32_t bit_index(uint64_t hash, uint32_t hash_number) const;
+  };
+
+  /**
+   *  @return true if trx is of interest to the light client that loaded filter, see
+   *  merkle_block_message.  The outputs of trx that pay to the filter are inserted into it.
+   */
+  bool match_transaction(bloom_filter& filter, const bts::blockchain::signed_transaction& trx);
+
+} } // bts::net
+
+FC_REFLECT( bts::net::bloom_filter, (bits)(number_of_hash_functions)(tweak) )
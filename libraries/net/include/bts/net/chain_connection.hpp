@@ -46,8 +46,19 @@ namespace bts { namespace net {
         stcp_socket_ptr  get_socket()const;
         fc::ip::endpoint remote_endpoint()const;
         
+        /** an encoded message as send() writes it, shared by the connections it is queued on */
+        typedef std::shared_ptr<const std::vector<char> > shared_frame;
+        static shared_frame pack_frame( const message& m );
+
         void send( const message& m );
 
+        /**
+         *  Queues frame to be written by a task of this connection and returns without
+         *  yielding, so that one slow client can not hold up sending to the rest.  A client
+         *  that falls too far behind is disconnected.
+         */
+        void queue_send( const shared_frame& frame );
+
         void connect( const std::string& host_port );  
         void connect( const fc::ip::endpoint& ep );
         void close();
@@ -55,7 +66,18 @@ namespace bts { namespace net {
         bts::blockchain::block_id_type get_last_block_id()const;
         void                           set_last_block_id( const bts::blockchain::block_id_type& t );
 
-        void exec_sync_loop();
+        /**
+         *  Sends every block after get_last_block_id().  Blocks are read from a snapshot taken
+         *  on the database's thread and packed ahead on the shared storage pool, so syncing
+         *  connections add no threads of their own.  If flow_controlled, the blocks go out in
+         *  block_batch_messages of up to the batch size, and no more than the window of bytes
+         *  is sent past the last block acknowledged with acknowledge_sync().  Otherwise each
+         *  block is a block_message and only the socket holds the loop back.
+         */
+        void exec_sync_loop( bool flow_controlled = false );
+        void acknowledge_sync( uint32_t block_num );
+        void set_sync_window( uint64_t window_bytes, uint32_t batch_bytes );
+        /** call it on the thread that pushes the blocks of the database */
         void set_database( bts::blockchain::chain_database*  );
 
       private:
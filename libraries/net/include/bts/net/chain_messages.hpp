@@ -11,10 +11,17 @@ namespace bts { namespace net {
        subscribe_msg = 1,
        block_msg     = 2,
        trx_msg       = 3,
-       trx_err_msg   = 4
-
+       trx_err_msg   = 4,
+       block_batch_msg = 5,
+       sync_ack_msg  = 6
    };
 
+   /**
+    *  Subscribers of this version or later are synced with block_batch_messages that
+    *  they acknowledge with sync_ack_messages, older ones get one block_message per block.
+    */
+   static const uint16_t flow_controlled_sync_version = 1;
+
    struct subscribe_message
    {
       static const chain_message_type type;
@@ -32,6 +39,21 @@ namespace bts { namespace net {
       bts::blockchain::trx_block             block_data;
    };
 
+   /** consecutive blocks sent while syncing, each packed with fc::raw */
+   struct block_batch_message
+   {
+      static const chain_message_type type;
+      std::vector< std::vector<char> >       blocks;
+   };
+
+   /** a subscriber has applied every block up to and including block_num */
+   struct sync_ack_message
+   {
+      static const chain_message_type type;
+      sync_ack_message( uint32_t n = 0 ):block_num(n){}
+      uint32_t                               block_num;
+   };
+
    struct trx_message
    {
       static const chain_message_type type;
@@ -49,8 +71,10 @@ namespace bts { namespace net {
 
 } } // bts::net
 
-FC_REFLECT_ENUM( bts::net::chain_message_type, (subscribe_msg)(block_msg)(trx_msg)(trx_err_msg) )
+FC_REFLECT_ENUM( bts::net::chain_message_type, (subscribe_msg)(block_msg)(trx_msg)(trx_err_msg)(block_batch_msg)(sync_ack_msg) )
 FC_REFLECT( bts::net::subscribe_message, (version)(last_block) )
 FC_REFLECT( bts::net::block_message, (block_data) )
+FC_REFLECT( bts::net::block_batch_message, (blocks) )
+FC_REFLECT( bts::net::sync_ack_message, (block_num) )
 FC_REFLECT( bts::net::trx_message, (signed_trx) )
 FC_REFLECT( bts::net::trx_err_message, (signed_trx)(err) )
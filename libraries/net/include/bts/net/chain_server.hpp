@@ -63,8 +63,10 @@ namespace bts { namespace net {
         struct config
         {
             config()
-            :port(0){}
+            :port(0),sync_window_bytes(4*1024*1024),sync_batch_bytes(256*1024){}
             uint16_t                 port;  ///< the port to listen for incoming connections on.
+            uint64_t                 sync_window_bytes; ///< sent to a syncing client past the block it acknowledged last
+            uint32_t                 sync_batch_bytes;  ///< the size blocks are packed together up to
             std::vector<std::string> blacklist;  // host's that are blocked from connecting
             std::vector<fc::ip::endpoint> mirrors;  // host's that are blocked from connecting
         };
@@ -101,4 +103,4 @@ namespace bts { namespace net {
 
 } } // bts::net
 
-FC_REFLECT( chain_server::config, (port)(mirrors) )
+FC_REFLECT( chain_server::config, (port)(mirrors)(sync_window_bytes)(sync_batch_bytes) )
@@ -1,4 +1,7 @@
 #pragma once
+#include <bts/net/message.hpp>
+#include <bts/net/bloom_filter.hpp>
+#include <bts/blockchain/block.hpp>
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/reflect/reflect.hpp>
 #include <fc/network/ip.hpp>
@@ -37,9 +40,50 @@ namespace bts { namespace net {
     connection_rejected_message_type           = 5008,
     address_request_message_type               = 5009,
     address_message_type                       = 5010,
+    cipher_switch_message_type                 = 5011,
+    compressed_message_type                    = 5012,
+    filter_load_message_type                   = 5013,
+    filter_add_message_type                    = 5014,
+    merkle_block_message_type                  = 5015,
   };
 
-  const uint32_t core_protocol_version = 1;
+  const uint32_t core_protocol_version = 5; /// 2 added headers-first synchronization, 3 compact blocks, 4 authenticated records, 5 connection capabilities
+
+  /**
+   *  Bits of the capabilities that protocol 5 peers append after the fields of their
+   *  hello_message or hello_reply_message.  Older peers stop unpacking before the
+   *  trailer and a hello without one has no capabilities.
+   */
+  enum connection_capability_flags
+  {
+    zlib_compressed_messages = 0x1, ///< the peer can unpack a compressed_message
+    bloom_filtered_blocks    = 0x2  ///< the peer answers a filter_load_message with merkle_block_messages
+  };
+
+  /** @return the capabilities this build supports */
+  uint32_t local_connection_capabilities();
+
+  template<typename HelloMessageType>
+  message pack_with_capabilities(const HelloMessageType& hello, uint32_t capabilities)
+  {
+    message result(hello);
+    std::vector<char> packed_capabilities = fc::raw::pack(capabilities);
+    result.data.insert(result.data.end(), packed_capabilities.begin(), packed_capabilities.end());
+    result.size = result.data.size();
+    return result;
+  }
+
+  template<typename HelloMessageType>
+  uint32_t unpack_capabilities(const message& hello_message_received)
+  {
+    size_t hello_size = fc::raw::pack_size(hello_message_received.as<HelloMessageType>());
+    if (hello_message_received.data.size() <= hello_size)
+      return 0;
+    fc::datastream<const char*> ds(hello_message_received.data.data() + hello_size, hello_message_received.data.size() - hello_size);
+    uint32_t capabilities = 0;
+    fc::raw::unpack(ds, capabilities);
+    return capabilities;
+  }
 
   struct item_ids_inventory_message
   {
@@ -188,9 +232,91 @@ namespace bts { namespace net {
     std::vector<address_info> addresses;
   };
 
+  /**
+   *  The last message its sender encrypts with the AES stream, everything it sends
+   *  afterwards is in records sealed with cipher_suite.  It is handled by the
+   *  message_oriented_connection and never reaches the node.
+   */
+  struct cipher_switch_message
+  {
+    static const core_message_type_enum type;
+
+    uint8_t cipher_suite;
+
+    cipher_switch_message() : cipher_suite(0) {}
+    cipher_switch_message(uint8_t cipher_suite) :
+      cipher_suite(cipher_suite)
+    {}
+  };
+
+  /**
+   *  A deflated message, sent in place of large messages to peers that have the
+   *  zlib_compressed_messages capability.  Messages are hashed after they are unpacked
+   *  so compression doesn't change their id.
+   */
+  struct compressed_message
+  {
+    static const core_message_type_enum type;
+
+    uint32_t          uncompressed_type;
+    uint32_t          uncompressed_size;
+    std::vector<char> compressed_data;
+  };
+
+  /**
+   *  Sent by a light client to a peer with the bloom_filtered_blocks capability.  From then on
+   *  the peer sends it a merkle_block_message for every block it accepts instead of advertising
+   *  inventory to it.  A filter without bits stops the merkle blocks.
+   */
+  struct filter_load_message
+  {
+    static const core_message_type_enum type;
+
+    bloom_filter filter;
+
+    filter_load_message() {}
+    filter_load_message(const bloom_filter& filter) :
+      filter(filter)
+    {}
+  };
+
+  /** adds a key, such as the packed address of a new receiving key, to the loaded filter */
+  struct filter_add_message
+  {
+    static const core_message_type_enum type;
+
+    std::vector<char> data;
+  };
+
+  /**
+   *  The header of a new block and those of its transactions that match the filter of the
+   *  light client, each with the branch that links it to header.trx_mroot.  A transaction
+   *  matches if its id, the owner of one of its outputs or an output one of its inputs spends
+   *  is in the filter.  The outputs of a matching transaction are added to the filter so that
+   *  the transaction spending them matches as well.
+   */
+  struct merkle_block_message
+  {
+    static const core_message_type_enum type;
+
+    bts::blockchain::block_id_type                     block_id;
+    bts::blockchain::signed_block_header               header;
+    std::vector<bts::blockchain::signed_transaction>   matched_trxs;
+    std::vector<bts::blockchain::merkle_branch>        branches; /// branches[i] is the branch of matched_trxs[i]
+  };
+
+  /** @return message_to_compress deflated into a compressed_message */
+  message compress_message(const message& message_to_compress);
+  /**
+   *  @param maximum_size of the inflated message, at most the maximum message size
+   *  @throws fc::exception if the message is corrupt, inflates past maximum_size or holds
+   *          another compressed_message
+   */
+  message decompress_message(const compressed_message& message_to_decompress, uint32_t maximum_size);
+
 } } // bts::client
 
-FC_REFLECT_ENUM( bts::net::core_message_type_enum, (item_ids_inventory_message_type)(blockchain_item_ids_inventory_message_type)(fetch_blockchain_item_ids_message_type)(fetch_item_message_type)(hello_message_type)(address_request_message_type))
+FC_REFLECT_ENUM( bts::net::core_message_type_enum, (item_ids_inventory_message_type)(blockchain_item_ids_inventory_message_type)(fetch_blockchain_item_ids_message_type)(fetch_item_message_type)(hello_message_type)(address_request_message_type)(cipher_switch_message_type)(compressed_message_type)(filter_load_message_type)(filter_add_message_type)(merkle_block_message_type))
 FC_REFLECT( bts::net::item_id, (item_type)(item_hash) )
 FC_REFLECT( bts::net::item_ids_inventory_message, (item_type)(item_hashes_available) )
 FC_REFLECT( bts::net::blockchain_item_ids_inventory_message, (total_remaining_item_count)(item_type)(item_hashes_available) )
@@ -203,9 +329,30 @@ FC_REFLECT( bts::net::connection_rejected_message, (user_agent)(core_protocol_ve
 FC_REFLECT_EMPTY( bts::net::address_request_message )
 FC_REFLECT( bts::net::address_info, (remote_endpoint)(last_seen_time) )
 FC_REFLECT( bts::net::address_message, (addresses) )
+FC_REFLECT( bts::net::cipher_switch_message, (cipher_suite) )
+FC_REFLECT( bts::net::compressed_message, (uncompressed_type)(uncompressed_size)(compressed_data) )
+FC_REFLECT( bts::net::filter_load_message, (filter) )
+FC_REFLECT( bts::net::filter_add_message, (data) )
+FC_REFLECT( bts::net::merkle_block_message, (block_id)(header)(matched_trxs)(branches) )
+
+#include <bts/net/keyed_hash.hpp>
+#include <cstring>
+namespace bts { namespace net {
+    /** item ids come from peers, the type only separates items with the same hash */
+    template<>
+    struct keyed_hash<item_id>
+    {
+       size_t operator()(const item_id& item_to_hash) const
+       {
+          char bytes[sizeof(item_hash_t) + sizeof(uint32_t)];
+          memcpy(bytes, item_to_hash.item_hash.data(), sizeof(item_hash_t));
+          memcpy(bytes + sizeof(item_hash_t), (const char*)&item_to_hash.item_type, sizeof(uint32_t));
+          return size_t(detail::keyed_hash_bytes(bytes, sizeof(bytes)));
+       }
+    };
+} } // bts::net
 
 #include <unordered_map>
-#include <fc/crypto/city.hpp>
 namespace std
 {
     template<>
@@ -213,11 +360,7 @@ namespace std
     {
        size_t operator()(const bts::net::item_id& item_to_hash) const
        {
-//#if defined(_M_X64) || defined(__x86_64__)
-          return fc::city_hash64((char*)&item_to_hash, sizeof(item_to_hash));
-//#else
-//          return fc::city_hash32((char*)&item_to_hash, sizeof(item_to_hash));
-//#endif
+          return bts::net::keyed_hash<bts::net::item_id>()(item_to_hash);
        }
     };
 }
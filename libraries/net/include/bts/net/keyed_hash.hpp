@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace bts { namespace net {
+
+  namespace detail
+  {
+    /** siphash-2-4 of the bytes, keyed with a random key chosen once per process */
+    uint64_t keyed_hash_bytes(const char* data, size_t size);
+  }
+
+  /**
+   *  Hashes keys that peers choose, such as the ids they advertise or request.  The keys
+   *  are hashes themselves, but a peer can grind ids whose first bytes collide and turn
+   *  a table that uses them as they are into a list, so containers filled from the
+   *  network use this instead of bts::blockchain::id_hash.  Keys the chain produced
+   *  itself keep the cheaper id_hash.
+   */
+  template<typename Key>
+  struct keyed_hash
+  {
+    size_t operator()(const Key& k) const
+    {
+      return size_t(detail::keyed_hash_bytes(k.data(), k.data_size()));
+    }
+  };
+
+} } // bts::net
@@ -38,6 +38,20 @@ namespace bts { namespace net {
      message( const message& m )
      :message_header(m),data( m.data ){}
 
+     message& operator=( message&& m )
+     {
+        (message_header&)*this = m;
+        data = std::move( m.data );
+        return *this;
+     }
+
+     message& operator=( const message& m )
+     {
+        (message_header&)*this = m;
+        data = m.data;
+        return *this;
+     }
+
      /**
       *  Assumes that T::type specifies the message type
       */
@@ -62,22 +76,32 @@ namespace bts { namespace net {
       */
      template<typename T>
      T as()const 
+     {
+        T tmp;
+        as( tmp );
+        return tmp;
+     }
+
+     /**
+      *  Deserializes into result in place, so that a large message such as a block
+      *  is unpacked straight into the object that keeps it instead of a temporary.
+      */
+     template<typename T>
+     void as( T& result )const 
      {
          try {
           FC_ASSERT( msg_type == T::type );
-          T tmp;
           if( data.size() )
           {
              fc::datastream<const char*> ds( data.data(), data.size() );
-             fc::raw::unpack( ds, tmp );
+             fc::raw::unpack( ds, result );
           }
           else
           {
-             // just to make sure that tmp shouldn't have any data
+             // just to make sure that result shouldn't have any data
              fc::datastream<const char*> ds( nullptr, 0 );
-             fc::raw::unpack( ds, tmp );
+             fc::raw::unpack( ds, result );
           }
-          return tmp;
          } FC_RETHROW_EXCEPTIONS( warn, 
               "error unpacking network message as a '${type}'  ${x} != ${msg_type}", 
               ("type", fc::get_typename<T>::name() )
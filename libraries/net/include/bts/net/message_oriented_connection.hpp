@@ -1,6 +1,7 @@
 #pragma once
 #include <fc/network/tcp_socket.hpp>
 #include <bts/net/message.hpp>
+#include <bts/net/token_bucket.hpp>
 
 namespace bts { namespace net {
 
@@ -8,6 +9,20 @@ namespace bts { namespace net {
 
   class message_oriented_connection;
 
+  /**
+   *  Queued messages are written highest priority first, in the order they were sent
+   *  within a priority, except that a lower priority gets a turn after a few buffers went
+   *  ahead of it so that it is never starved.  A message that is being written is finished
+   *  before the next one.
+   */
+  enum message_priority
+  {
+    high_priority,  /// handshakes, requests and relayed blocks
+    relay_priority, /// transactions and their inventory
+    bulk_priority,  /// serving the blockchain to peers that are synchronizing with us
+    number_of_message_priorities
+  };
+
   /** receives incoming messages from a message_oriented_connection object */
   class message_oriented_connection_delegate 
   {
@@ -27,8 +42,27 @@ namespace bts { namespace net {
     void connect_to(const fc::ip::endpoint& remote_endpoint);
     void connect_to(const fc::ip::endpoint& remote_endpoint, const fc::ip::endpoint& local_endpoint);
 
-    void send_message(const message& message_to_send);
+    void send_message(const message& message_to_send, message_priority priority = high_priority);
+    /**
+     *  Sends a cipher_switch_message and seals everything sent after it in authenticated
+     *  records.  Only call this once the peer is known to understand the message; the
+     *  peer's own switch is handled whenever its cipher_switch_message arrives.
+     */
+    void enable_authenticated_records();
     void close_connection();
+
+    /**
+     *  Shapes the traffic of this connection with buckets shared by other connections, for
+     *  the limits of the whole node, and its own buckets of the given rates.  Null buckets
+     *  and rates of 0 don't limit.  Reads are paused while over the download limits, which
+     *  leaves the data in the socket so that TCP slows the sender down.
+     */
+    void set_rate_limits(const std::shared_ptr<token_bucket>& shared_upload, const std::shared_ptr<token_bucket>& shared_download,
+                         uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second);
+
+    uint64_t get_total_bytes_sent() const;     /// written to the socket, after encryption
+    uint64_t get_total_bytes_received() const; /// read from the socket
+    size_t   get_send_queue_size() const;      /// bytes queued but not yet written
   private:
     std::unique_ptr<detail::message_oriented_connection_impl> my;
   };
@@ -1,6 +1,10 @@
 #pragma once
 #include <bts/net/core_messages.hpp>
 #include <bts/net/message.hpp>
+#include <bts/blockchain/block.hpp>
+
+namespace fc { class thread; }
+namespace bts { namespace client { struct block_message; } }
 
 namespace bts { namespace net {
 
@@ -29,6 +33,26 @@ namespace bts { namespace net {
           */
          virtual void handle_message( const message& ) = 0;
 
+         /**
+          *  Called instead of handle_message() for the blocks the node has already unpacked,
+          *  so they aren't packed into a message only to be unpacked again.  The default does
+          *  just that.
+          *
+          *  @throws exception if error validating the block
+          */
+         virtual void handle_block( const bts::client::block_message& block );
+
+         /**
+          *  The cheap checks of a new block received during normal operation, such as its
+          *  signature, that it follows our head block and its merkle root.  When they pass the
+          *  block is advertised to peers while handle_block() validates it.
+          *
+          *  @return false if the block can't be checked before it is validated, it is then
+          *          advertised once handle_block() accepts it.  The default always does so.
+          *  @throws exception if the block is invalid, its peer is banned
+          */
+         virtual bool validate_block_for_relay( const bts::client::block_message& block );
+
          /**
           *  Assuming all data elements are ordered in some way, this method should
           *  return up to limit ids that occur *after* from_id.
@@ -45,14 +69,52 @@ namespace bts { namespace net {
           */
          virtual message get_item( const item_id& id ) = 0;
 
+         /**
+          *  Headers-first synchronization: return the headers of the given blocks in order,
+          *  stopping at the first block we don't have.  The default extracts them from get_item().
+          */
+         virtual std::vector<bts::blockchain::signed_block_header> get_block_headers( const std::vector<item_hash_t>& block_ids );
+
+         /**
+          *  Called for each header received during headers-first synchronization
+          *  before its block is downloaded.  The node has already checked that the
+          *  headers link to one another, this should check what only the chain
+          *  knows, such as the trustee signature.
+          *
+          *  @throws exception if the header is invalid, its peer is disconnected
+          */
+         virtual void validate_block_header( const bts::blockchain::signed_block_header& header );
+
+         /**
+          *  Cheap checks of a transaction message received from a peer, made before it waits
+          *  in the node's queue for handle_message.  Queued transactions are validated highest
+          *  priority first.
+          *
+          *  @return the priority of the transaction, the default gives all the same
+          *  @throws exception if the transaction should be dropped without being validated
+          */
+         virtual uint64_t get_transaction_priority( const message& transaction_message );
+
+         /**
+          *  Compact block relay: look up the transactions of a new block among those we already
+          *  have.  The ids are computed by bts::client::short_transaction_id( block_id, trx_id ).
+          *
+          *  @return one entry per short id, empty where we don't have the transaction.  The
+          *          default has none, so every transaction is fetched from the peer.
+          */
+         virtual std::vector<fc::optional<bts::blockchain::signed_transaction> > get_transactions_by_short_id( const bts::blockchain::block_id_type& block_id,
+                                                                                                              const std::vector<uint64_t>& short_trx_ids );
+
          /**
           *  Call this after the call to handle_message succeeds.
           * 
           *  @param item_type the type of the item we're synchronizing, will be the same as item passed to the sync_from() call
           *  @param item_count the number of items known to the node that haven't been sent to handle_item() yet.
           *                    After `item_count` more calls to handle_item(), the node will be in sync
+          *  @param items_awaiting_validation the number of sync items that have been downloaded and are
+          *                    queued for handle_message()
           */
-         virtual void     sync_status( uint32_t item_type, uint32_t item_count ) = 0;
+         virtual void     sync_status( uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation ) = 0;
 
          /**
           *  Call any time the number of connected peers changes.
@@ -71,6 +133,103 @@ namespace bts { namespace net {
       fc::variant      info;
    };
 
+   /**
+    *  Counts samples, such as request round trips, by powers of two: bucket 0 holds those
+    *  under 1ms, bucket i those from 2^(i-1) up to 2^i ms and the last bucket everything longer.
+    */
+   struct latency_histogram
+   {
+      enum { number_of_buckets = 18 }; // the last starts at 2^16ms, about a minute
+
+      latency_histogram() : sample_count(0), total_microseconds(0), buckets(number_of_buckets) {}
+      void add_sample(const fc::microseconds& latency);
+
+      uint64_t              sample_count;
+      uint64_t              total_microseconds;
+      std::vector<uint64_t> buckets;
+   };
+
+   /**
+    *  Traffic of one message type, sizes include the message header.  Compressed messages
+    *  are counted as compressed_message_type, authenticated record overhead isn't counted.
+    *  Peers choose the types they send, every type the node doesn't know is counted as
+    *  unknown_message_type.
+    */
+   const uint32_t unknown_message_type = 0;
+
+   struct message_type_statistics
+   {
+      message_type_statistics() : msg_type(0), messages_sent(0), bytes_sent(0), messages_received(0), bytes_received(0) {}
+
+      uint32_t msg_type;
+      uint64_t messages_sent;
+      uint64_t bytes_sent;
+      uint64_t messages_received;
+      uint64_t bytes_received;
+   };
+
+   struct peer_statistics
+   {
+      peer_statistics() : syncing(false), bytes_sent(0), bytes_received(0), messages_sent(0), messages_received(0),
+                          send_queue_size(0), items_requested(0), sync_items_requested(0), inventory_to_advertise(0) {}
+
+      fc::ip::endpoint  host;
+      bool              syncing;                /// we are still fetching the blockchain from this peer
+      uint64_t          bytes_sent;             /// as written to the socket, after encryption
+      uint64_t          bytes_received;
+      uint64_t          messages_sent;
+      uint64_t          messages_received;
+      uint64_t          send_queue_size;        /// bytes waiting to be written to the socket
+      uint32_t          items_requested;        /// items requested during normal operation that haven't arrived
+      uint32_t          sync_items_requested;   /// sync blocks requested that haven't arrived
+      uint32_t          inventory_to_advertise; /// items waiting for the next trickle to this peer
+      latency_histogram sync_request_latency;   /// how long the peer took to return the sync blocks we requested
+   };
+
+   /**
+    *  Token bucket limits of the traffic of a node, in bytes per second as read from and
+    *  written to the sockets.  0 means unlimited, which is the default.  A limit may be
+    *  exceeded by one message, the traffic after it then waits that much longer.
+    */
+   struct bandwidth_limits
+   {
+      bandwidth_limits() : upload_bytes_per_second(0), download_bytes_per_second(0),
+                           peer_upload_bytes_per_second(0), peer_download_bytes_per_second(0),
+                           burst_milliseconds(1000) {}
+
+      uint64_t upload_bytes_per_second;        /// all peers together
+      uint64_t download_bytes_per_second;
+      uint64_t peer_upload_bytes_per_second;   /// each peer
+      uint64_t peer_download_bytes_per_second;
+      uint32_t burst_milliseconds;             /// how much of the node's rate an idle node may send at once
+   };
+
+   /**
+    *  Counters of a node since it was created and the current depths of its queues, for
+    *  telling whether slow synchronization is bandwidth, latency or validation.
+    */
+   struct node_statistics
+   {
+      node_statistics() : handshake_failures(0), handshaking_connections(0), closing_connections(0), items_to_fetch(0),
+                          new_inventory(0), sync_blocks_received(0), sync_blocks_to_validate(0), active_sync_requests(0),
+                          transactions_to_validate(0), transactions_dropped(0) {}
+
+      std::vector<message_type_statistics> messages;   /// ordered by msg_type
+      std::vector<peer_statistics>         peers;      /// the active connections
+      uint64_t                             handshake_failures; /// failed or timed out dials and key exchanges, rejections of our hello
+      latency_histogram                    handle_message_time; /// time taken by node_delegate::handle_message()
+
+      uint32_t handshaking_connections;
+      uint32_t closing_connections;
+      uint32_t items_to_fetch;          /// items advertised to us that we still want
+      uint32_t new_inventory;           /// items not yet advertised to our peers
+      uint32_t sync_blocks_received;    /// sync blocks waiting for the blocks before them
+      uint32_t sync_blocks_to_validate; /// sync blocks queued for or being handed to the delegate
+      uint32_t active_sync_requests;
+      uint32_t transactions_to_validate; /// transactions from peers waiting for handle_message
+      uint64_t transactions_dropped;     /// failed the priority checks, over their peer's budget or outbid in a full queue
+   };
+
    /**
     *  @class node
     *  @brief provides application independent P2P broadcast and data synchronization
@@ -86,7 +245,12 @@ namespace bts { namespace net {
         node();
         ~node();
 
-        void      set_delegate( node_delegate* del );
+        /**
+         *  @param delegate_thread if set, every call to del is made on this thread so that validating
+         *         blocks does not stall networking.  The node waits for each call, so the delegate is
+         *         never called concurrently with itself.
+         */
+        void      set_delegate( node_delegate* del, fc::thread* delegate_thread = nullptr );
 
         void      load_configuration( const fc::path& configuration_directory );
 
@@ -115,17 +279,82 @@ namespace bts { namespace net {
          */
         void      listen_on_port(uint16_t port);
 
+        /**
+         *  The node dials peers from its database while it has fewer than desired
+         *  connections and refuses inbound connections beyond maximum.  A desired count
+         *  of 0 leaves every connection to connect_to() and inbound peers.  The defaults
+         *  are 3 and 5.
+         */
+        void      set_connection_limits( uint32_t desired, uint32_t maximum );
+
         /**
          *  @return a list of peers that are currently connected.
          */
         std::vector<peer_status> get_connected_peers()const;
 
+        node_statistics          get_statistics()const;
+
+        /**
+         *  Bounds the memory used by sync blocks that arrive before the blocks they follow.
+         *  When the limit is exceeded the highest blocks are dropped and fetched again later.
+         *  The default is 128 MiB.
+         */
+        void      set_maximum_sync_backlog_size( uint64_t bytes );
+
+        /**
+         *  When enabled (the default) blocks are only fetched from a peer after their
+         *  headers have been fetched and validated, which lets us drop a peer on a bad
+         *  fork before downloading its blocks.  Peers that predate headers-first sync
+         *  are always synchronized block by block.
+         */
+        void      set_headers_first_sync( bool enabled );
+
+        /**
+         *  New inventory is collected for each peer and advertised every half to one and a
+         *  half of interval (randomly per peer) instead of as soon as it arrives, so bursts
+         *  of transactions go out in a few large messages.  Blocks are advertised at once.
+         *  The default is 2 seconds.
+         */
+        void      set_inventory_trickle_interval( const fc::microseconds& interval );
+
+        /**
+         *  Blocks and blockchain inventories of 1KB or more are deflated for peers whose
+         *  hello says they can unpack them.  Enabled by default; disabling it only stops
+         *  us from compressing, we still unpack what peers send.
+         */
+        void      set_message_compression( bool enabled );
+
+        /**
+         *  When enabled (the default) a new block that passes the delegate's
+         *  validate_block_for_relay() is advertised before handle_block() has validated it.
+         *  Peers that send us blocks failing those checks are banned for a day.
+         */
+        void      set_early_block_relay( bool enabled );
+
+        /**
+         *  Shapes the traffic of the node and of each peer, which is also read from the
+         *  "bandwidth" of the configuration file by load_configuration().  Whatever is queued
+         *  for a peer goes out highest priority first: handshakes, requests and new blocks,
+         *  then transactions and their inventory, then the blocks served to peers that are
+         *  synchronizing with us.
+         */
+        void      set_bandwidth_limits( const bandwidth_limits& limits );
+
         /**
          *  Add message to outgoing inventory list, notify peers that
          *  I have a message ready.
          */
         void      broadcast( const message& item_to_broadcast );
 
+        /**
+         *  Sends the light clients that loaded a bloom filter into us a merkle_block_message of
+         *  block with the transactions that match their filter, deterministic_trxs being those
+         *  the chain generated for the block.  Call it for every block that is added to the
+         *  chain, on the node's thread.
+         */
+        void      send_filtered_block( const bts::blockchain::trx_block& block,
+                                       const bts::blockchain::signed_transactions& deterministic_trxs );
+
         /**
          *  Node starts the process of fetching all items after item_id of the
          *  given item_type.   During this process messages are not broadcast.
@@ -141,3 +370,14 @@ namespace bts { namespace net {
    typedef std::shared_ptr<node> node_ptr;
 
 } } // bts::net
+
+FC_REFLECT( bts::net::latency_histogram, (sample_count)(total_microseconds)(buckets) )
+FC_REFLECT( bts::net::message_type_statistics, (msg_type)(messages_sent)(bytes_sent)(messages_received)(bytes_received) )
+FC_REFLECT( bts::net::peer_statistics, (host)(syncing)(bytes_sent)(bytes_received)(messages_sent)(messages_received)
+                                       (send_queue_size)(items_requested)(sync_items_requested)(inventory_to_advertise)(sync_request_latency) )
+FC_REFLECT( bts::net::bandwidth_limits, (upload_bytes_per_second)(download_bytes_per_second)
+                                        (peer_upload_bytes_per_second)(peer_download_bytes_per_second)(burst_milliseconds) )
+FC_REFLECT( bts::net::node_statistics, (messages)(peers)(handshake_failures)(handle_message_time)
+                                       (handshaking_connections)(closing_connections)(items_to_fetch)(new_inventory)
+                                       (sync_blocks_received)(sync_blocks_to_validate)(active_sync_requests)
+                                       (transactions_to_validate)(transactions_dropped) )
@@ -7,6 +7,8 @@
 #include <fc/reflect/reflect.hpp>
 #include <fc/reflect/variant.hpp>
 
+#include <vector>
+
 namespace bts { namespace net {
 
   enum potential_peer_last_connection_disposition
@@ -17,7 +19,65 @@ namespace bts { namespace net {
     last_connection_succeeded
   };
 
-  struct potential_peer_record
+  /**
+   *  What we measured of a peer while we were connected to it.  It is kept in the peer
+   *  database so that the averages carry over to the next connection.
+   */
+  struct peer_quality
+  {
+    uint32_t round_trip_time_ms;            /// moving average over requests with short replies, 0 until measured
+    uint64_t sync_bytes_per_second;         /// moving average of how fast it delivered the sync blocks we requested, 0 until measured
+    uint32_t number_of_items_received;      /// blocks and transactions we requested from it, valid or not
+    uint32_t number_of_invalid_items;       /// its blocks, headers and transactions that we rejected
+
+    peer_quality() :
+      round_trip_time_ms(0),
+      sync_bytes_per_second(0),
+      number_of_items_received(0),
+      number_of_invalid_items(0)
+    {}
+
+    void add_round_trip_time(const fc::microseconds& round_trip_time);
+    void add_sync_delivery(uint64_t bytes, const fc::microseconds& elapsed);
+
+    /**
+     *  @return the sync blocks per hour the peer delivers, from its round trip time and throughput,
+     *  cut in half for every sixteenth of its items that was invalid.  Peers that haven't been
+     *  measured are assumed to answer in half a second and deliver 32 kB/s, so that they get a
+     *  chance to prove themselves.  Higher is better
+     */
+    uint64_t score() const;
+    /** true once a round trip or a sync delivery was timed */
+    bool is_measured() const { return round_trip_time_ms != 0 || sync_bytes_per_second != 0; }
+  };
+
+  /**
+   *  When we are full, an active peer that scores less than half of a candidate is disconnected
+   *  to make room for it.  Peers that haven't been measured, the candidate as well as active ones,
+   *  score no better than the worst measured active peer, so a newcomer never replaces a peer
+   *  that proved itself.
+   *
+   *  @return the index of the peer in active_peers to disconnect, active_peers.size() for none
+   */
+  size_t choose_peer_to_evict(const std::vector<peer_quality>& active_peers, const peer_quality& candidate);
+
+  struct potential_peer_record0
+  {
+    fc::ip::endpoint                  endpoint;
+    fc::time_point_sec                last_seen_time;
+    fc::enum_type<uint8_t,potential_peer_last_connection_disposition> last_connection_disposition;
+    fc::time_point_sec                last_connection_attempt_time;
+    uint32_t                          number_of_successful_connection_attempts;
+    uint32_t                          number_of_failed_connection_attempts;
+
+    potential_peer_record0() :
+      last_connection_disposition(never_attempted_to_connect),
+      number_of_successful_connection_attempts(0),
+      number_of_failed_connection_attempts(0)
+    {}
+  };
+
+  struct potential_peer_record1
   {
     fc::ip::endpoint                  endpoint;
     fc::time_point_sec                last_seen_time;
@@ -25,16 +85,33 @@ namespace bts { namespace net {
     fc::time_point_sec                last_connection_attempt_time;
     uint32_t                          number_of_successful_connection_attempts;
     uint32_t                          number_of_failed_connection_attempts;
+    peer_quality                      quality;
 
-    potential_peer_record() {}
-    potential_peer_record(fc::ip::endpoint endpoint,
-                          fc::time_point_sec last_seen_time = fc::time_point_sec(),
-                          potential_peer_last_connection_disposition last_connection_disposition = never_attempted_to_connect) :
+    potential_peer_record1() :
+      last_connection_disposition(never_attempted_to_connect),
+      number_of_successful_connection_attempts(0),
+      number_of_failed_connection_attempts(0)
+    {}
+    potential_peer_record1(fc::ip::endpoint endpoint,
+                           fc::time_point_sec last_seen_time = fc::time_point_sec(),
+                           potential_peer_last_connection_disposition last_connection_disposition = never_attempted_to_connect) :
       endpoint(endpoint),
       last_seen_time(last_seen_time),
-      last_connection_disposition(last_connection_disposition)
+      last_connection_disposition(last_connection_disposition),
+      number_of_successful_connection_attempts(0),
+      number_of_failed_connection_attempts(0)
     {}  
+    /** for peer databases written before peers were measured */
+    potential_peer_record1(const potential_peer_record0& r0) :
+      endpoint(r0.endpoint),
+      last_seen_time(r0.last_seen_time),
+      last_connection_disposition(r0.last_connection_disposition),
+      last_connection_attempt_time(r0.last_connection_attempt_time),
+      number_of_successful_connection_attempts(r0.number_of_successful_connection_attempts),
+      number_of_failed_connection_attempts(r0.number_of_failed_connection_attempts)
+    {}
   };
+  typedef potential_peer_record1 potential_peer_record;
 
   namespace detail
   {
@@ -60,6 +137,11 @@ namespace bts { namespace net {
   }
 
 
+  /**
+   *  Keeps every potential peer in memory, indexed by endpoint, last seen time and
+   *  how good a candidate for a new connection it is.  Updates are written to the
+   *  database in one batch at most every flush interval, and when it is closed.
+   */
   class peer_database
   {
   public:
@@ -72,6 +154,22 @@ namespace bts { namespace net {
     void update_entry(const potential_peer_record& updatedRecord);
     potential_peer_record lookup_or_create_entry_for_endpoint(const fc::ip::endpoint& endpointToLookup);
 
+    /**
+     *  Peers whose last connection failed or was rejected are retried 10 seconds after it,
+     *  doubling with each failed connection attempt up to an hour.
+     *
+     *  @return up to max_count peers to try connecting to at time now, best first: peers
+     *  whose last connection didn't fail ordered by their quality score, then by successful
+     *  minus failed connections and then by how recently they were seen, followed by failed
+     *  peers that are due for a retry, the longest overdue first
+     */
+    std::vector<potential_peer_record> get_connection_candidates(size_t max_count, const fc::time_point_sec& now) const;
+
+    /** writes all updates made since the last flush */
+    void flush();
+    /** the default is 30 seconds */
+    void set_flush_interval(const fc::microseconds& interval);
+
     typedef detail::peer_database_iterator iterator;
     iterator begin();
     iterator end();
@@ -83,4 +181,6 @@ namespace bts { namespace net {
 } } // end namespace bts::net
 
 FC_REFLECT_ENUM(bts::net::potential_peer_last_connection_disposition, (never_attempted_to_connect)(last_connection_failed)(last_connection_rejected)(last_connection_succeeded))
-FC_REFLECT(bts::net::potential_peer_record, (endpoint)(last_seen_time)(last_connection_disposition)(last_connection_attempt_time)(number_of_successful_connection_attempts)(number_of_failed_connection_attempts))
+FC_REFLECT(bts::net::peer_quality, (round_trip_time_ms)(sync_bytes_per_second)(number_of_items_received)(number_of_invalid_items))
+FC_REFLECT(bts::net::potential_peer_record0, (endpoint)(last_seen_time)(last_connection_disposition)(last_connection_attempt_time)(number_of_successful_connection_attempts)(number_of_failed_connection_attempts))
+FC_REFLECT(bts::net::potential_peer_record1, (endpoint)(last_seen_time)(last_connection_disposition)(last_connection_attempt_time)(number_of_successful_connection_attempts)(number_of_failed_connection_attempts)(quality))
@@ -3,15 +3,40 @@
 #include <fc/crypto/aes.hpp>
 #include <fc/crypto/elliptic.hpp>
 
+#include <memory>
+#include <vector>
+
 namespace bts { namespace net {
 
+namespace detail { class aead_cipher; }
+
 /**
  *  Uses ECDH to negotiate a aes key for communicating
- *  with other nodes on the network.
+ *  with other nodes on the network.  The ephemeral keys are generated ahead of
+ *  time and the shared secret is computed on the network thread pool, each key
+ *  is used for one handshake only.
+ *
+ *  The stream starts out encrypted with the original AES stream cipher, which
+ *  requires every write to be a multiple of 16 bytes.  Once both ends agree
+ *  (see message_oriented_connection) each direction can switch to authenticated
+ *  records: a 4 byte length, the ciphertext and a 16 byte tag, sealed in place
+ *  with AES-256-GCM on hosts with AES-NI and ChaCha20-Poly1305 elsewhere.
+ *  Each direction uses its own key so that nonces never repeat under one key.
  */
 class stcp_socket : public virtual fc::iostream
 {
   public:
+    enum cipher_suite
+    {
+      aes_256_gcm       = 1,
+      chacha20_poly1305 = 2
+    };
+    static const size_t record_header_size = 4;
+    static const size_t record_tag_size    = 16;
+
+    /** @return the suite that encrypts fastest on this host */
+    static cipher_suite preferred_cipher_suite();
+
     stcp_socket();
     ~stcp_socket();
     fc::tcp_socket&  get_socket() { return _sock; }
@@ -29,15 +54,51 @@ class stcp_socket : public virtual fc::iostream
 
     void             get( char& c ) { read( &c, 1 ); }
 
+    /**
+     *  Raw access to the stream for callers that frame it themselves, so that
+     *  bytes read ahead of a cipher switch can still be decrypted with the
+     *  right cipher.
+     */
+    //@{
+    size_t           readsome_raw( char* buffer, size_t max );
+    /** decrypts len bytes, a multiple of 16, of the AES stream in place */
+    void             decrypt( char* buffer, size_t len );
+    //@}
+
+    //@{
+    /** everything written after this is sent as records sealed with suite */
+    void             start_sending_records( cipher_suite suite );
+    /** everything read after this is opened as records sealed with suite */
+    void             start_receiving_records( cipher_suite suite );
+    bool             is_sending_records()const    { return _send_aead != nullptr; }
+    bool             is_receiving_records()const  { return _recv_aead != nullptr; }
+
+    /**
+     *  Seals record in place and writes it with a single write.  The first
+     *  record_header_size bytes are reserved for the length, the rest is the
+     *  plaintext; record_tag_size bytes are appended for the tag.
+     */
+    void             write_record( std::vector<char>& record );
+    /**
+     *  Authenticates and decrypts the payload of a record in place.
+     *  @param record points at the length, followed by len bytes of ciphertext and the tag
+     *  @throws fc::exception if the record was not sealed by the peer
+     */
+    void             open_record( char* record, uint32_t len );
+    //@}
+
   private:
     void do_key_exchange();
 
-    fc::ecc::private_key _priv_key;
     fc::array<char,8>    _buf;
     uint32_t             _buf_len;
     fc::tcp_socket       _sock;
     fc::aes_encoder      _send_aes;
     fc::aes_decoder      _recv_aes;
+    fc::sha256           _send_key;
+    fc::sha256           _recv_key;
+    std::unique_ptr<detail::aead_cipher> _send_aead;
+    std::unique_ptr<detail::aead_cipher> _recv_aead;
 };
 
 typedef std::shared_ptr<stcp_socket> stcp_socket_ptr;
@@ -0,0 +1,75 @@
+#pragma once
+#include <fc/time.hpp>
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace bts { namespace net {
+
+  /**
+   *  Limits a stream of bytes to a rate with bursts of up to burst_bytes after it was idle.
+   *
+   *  A caller takes what it is about to transfer and waits for the returned delay, the
+   *  bucket may go into debt so that a message larger than the burst still gets through
+   *  and the traffic after it waits that much longer.  One bucket shared by all
+   *  connections limits their total.  Buckets are used by the fibers of one thread and
+   *  aren't synchronized.
+   */
+  class token_bucket
+  {
+     public:
+        token_bucket() :
+          _bytes_per_second(0),
+          _burst_bytes(0),
+          _tokens(0)
+        {}
+
+        /** a rate of 0 removes the limit */
+        void set_rate( uint64_t bytes_per_second, uint64_t burst_bytes )
+        {
+           // an unlimited bucket starts out full
+           bool was_limited  = is_limited();
+           if( was_limited )
+              refill( fc::time_point::now() );
+           _bytes_per_second = bytes_per_second;
+           _burst_bytes      = std::max<uint64_t>( burst_bytes, 1 );
+           _tokens           = was_limited ? std::min<int64_t>( _tokens, _burst_bytes ) : int64_t(_burst_bytes);
+           _last_refill      = fc::time_point::now();
+        }
+
+        bool     is_limited()const       { return _bytes_per_second != 0; }
+        uint64_t bytes_per_second()const { return _bytes_per_second; }
+
+        /** @return how long to wait before transferring the bytes, zero if they are within the limit */
+        fc::microseconds consume( uint64_t bytes, const fc::time_point& now = fc::time_point::now() )
+        {
+           if( !is_limited() )
+              return fc::microseconds();
+           refill( now );
+           _tokens -= bytes;
+           if( _tokens >= 0 )
+              return fc::microseconds();
+           return fc::microseconds( int64_t( uint64_t(-_tokens) * 1000000 / _bytes_per_second ) );
+        }
+
+     private:
+        void refill( const fc::time_point& now )
+        {
+           int64_t elapsed = (now - _last_refill).count();
+           if( elapsed <= 0 )
+              return;
+           // an hour refills any sensible burst, and the product can't overflow
+           uint64_t earned = std::min<uint64_t>( elapsed, uint64_t(3600) * 1000000 ) * _bytes_per_second / 1000000;
+           if( earned == 0 )
+              return; // keep the fraction for the next call
+           _tokens = std::min<int64_t>( _tokens + int64_t(earned), _burst_bytes );
+           _last_refill = now;
+        }
+
+        uint64_t       _bytes_per_second;
+        uint64_t       _burst_bytes;
+        int64_t        _tokens; ///< negative while in debt
+        fc::time_point _last_refill;
+  };
+
+} } // bts::net
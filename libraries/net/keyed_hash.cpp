@@ -0,0 +1,73 @@
+#include <bts/net/keyed_hash.hpp>
+#include <fc/crypto/rand.hpp>
+
+namespace bts { namespace net { namespace detail {
+
+  namespace
+  {
+    struct siphash_key
+    {
+      uint64_t k0;
+      uint64_t k1;
+      siphash_key()
+      {
+        fc::rand_bytes((char*)&k0, sizeof(k0));
+        fc::rand_bytes((char*)&k1, sizeof(k1));
+      }
+    };
+
+    /** the key is chosen on first use, function statics are initialized once even across threads */
+    const siphash_key& process_key()
+    {
+      static const siphash_key key;
+      return key;
+    }
+
+    inline uint64_t rotate_left(uint64_t x, int b) { return (x << b) | (x >> (64 - b)); }
+
+    inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+    {
+      v0 += v1; v1 = rotate_left(v1, 13); v1 ^= v0; v0 = rotate_left(v0, 32);
+      v2 += v3; v3 = rotate_left(v3, 16); v3 ^= v2;
+      v0 += v3; v3 = rotate_left(v3, 21); v3 ^= v0;
+      v2 += v1; v1 = rotate_left(v1, 17); v1 ^= v2; v2 = rotate_left(v2, 32);
+    }
+  }
+
+  uint64_t keyed_hash_bytes(const char* data, size_t size)
+  {
+    const siphash_key& key = process_key();
+    uint64_t v0 = key.k0 ^ 0x736f6d6570736575ull;
+    uint64_t v1 = key.k1 ^ 0x646f72616e646f6dull;
+    uint64_t v2 = key.k0 ^ 0x6c7967656e657261ull;
+    uint64_t v3 = key.k1 ^ 0x7465646279746573ull;
+
+    const unsigned char* bytes = (const unsigned char*)data;
+    size_t whole_words = size / 8;
+    for (size_t i = 0; i < whole_words; ++i)
+    {
+      uint64_t m = 0;
+      for (int b = 0; b < 8; ++b)
+        m |= uint64_t(bytes[i * 8 + b]) << (8 * b);
+      v3 ^= m;
+      sip_round(v0, v1, v2, v3);
+      sip_round(v0, v1, v2, v3);
+      v0 ^= m;
+    }
+
+    // the last word holds the remaining bytes and the length in its top byte
+    uint64_t last = uint64_t(size & 0xff) << 56;
+    for (size_t b = 0; b < size % 8; ++b)
+      last |= uint64_t(bytes[whole_words * 8 + b]) << (8 * b);
+    v3 ^= last;
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i)
+      sip_round(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+  }
+
+} } } // bts::net::detail
@@ -3,8 +3,14 @@
 #include <fc/log/logger.hpp>
 #include <fc/io/enum_type.hpp>
 
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <string.h>
+
 #include <bts/net/message_oriented_connection.hpp>
 #include <bts/net/stcp_socket.hpp>
+#include <bts/net/core_messages.hpp>
 
 namespace bts { namespace net {
   namespace detail
@@ -16,8 +22,56 @@ namespace bts { namespace net {
       message_oriented_connection_delegate *_delegate;
       stcp_socket _sock;
       fc::future<void> _read_loop_done;
+      std::vector<char> _receive_buffer; /// bytes read ahead of the message being framed
+      size_t _receive_buffer_begin;  /// the first byte that hasn't been framed
+      size_t _plaintext_end;         /// [_receive_buffer_begin, _plaintext_end) has been decrypted
+      size_t _record_end;            /// the end of the record being framed, including its tag
+      size_t _receive_buffer_end;    /// the end of what has been read from the socket
+      uint64_t _bytes_received;
+      uint64_t _bytes_sent;
+
+      struct queued_send_buffer
+      {
+        std::vector<char> data;
+        bool              is_record; /// sealed as one record rather than encrypted with the AES stream
+        bool              switch_to_records_after;
+        queued_send_buffer() : is_record(false), switch_to_records_after(false) {}
+      };
+
+      /// outgoing messages are appended to the queue of their priority, which the send loop
+      /// writes out so that a slow peer only stalls its own connection.  Messages sent with
+      /// the AES stream are padded to 16 bytes, messages in records are not
+      // @{
+      std::deque<queued_send_buffer>  _send_queues[number_of_message_priorities]; /// small messages are coalesced into the last buffer
+      std::vector<std::vector<char> > _free_send_buffers; /// written buffers kept for reuse
+      size_t                          _send_queue_size_in_bytes; /// of all priorities
+      size_t                          _send_buffers_queued;
+      size_t                          _stream_buffers_queued; /// buffers not sent in records, they all go before the cipher switch
+      size_t                          _maximum_send_queue_size_in_bytes;
+      size_t                          _buffers_passing_over_lower; /// written in a row while a lower priority buffer could have been
+      bool                            _queueing_records; /// messages queued from now on go in records
+      stcp_socket::cipher_suite       _send_cipher_suite;
+      fc::promise<void>::ptr          _retrigger_send_loop_promise;
+      fc::future<void>                _send_loop_done;
+      // @}
+
+      /// traffic shaping, the shared buckets limit the whole node
+      // @{
+      std::shared_ptr<token_bucket>   _shared_upload_limit;
+      std::shared_ptr<token_bucket>   _shared_download_limit;
+      token_bucket                    _upload_limit;
+      token_bucket                    _download_limit;
+      // @}
+
+      static fc::microseconds take_bandwidth(token_bucket& own_limit, token_bucket* shared_limit, size_t bytes);
+      bool can_send_front(const std::deque<queued_send_buffer>& send_queue) const;
+      std::deque<queued_send_buffer>* next_send_queue();
+
+      void deliver_message(message& m, const message_header& header, const char* message_data);
       void read_loop();
       void start_read_loop();
+      void send_loop();
+      void start_send_loop();
     public:
       fc::tcp_socket& get_socket();
       void accept();
@@ -25,16 +79,52 @@ namespace bts { namespace net {
       void connect_to(const fc::ip::endpoint& remote_endpoint, const fc::ip::endpoint& local_endpoint);
 
       message_oriented_connection_impl(message_oriented_connection* self, message_oriented_connection_delegate* delegate = nullptr);
-      void send_message(const message& message_to_send);
+      ~message_oriented_connection_impl();
+      void send_message(const message& message_to_send, message_priority priority);
+      void enable_authenticated_records();
       void close_connection();
+      void set_rate_limits(const std::shared_ptr<token_bucket>& shared_upload, const std::shared_ptr<token_bucket>& shared_download,
+                           uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second);
+
+      uint64_t get_total_bytes_sent() const { return _bytes_sent; }
+      uint64_t get_total_bytes_received() const { return _bytes_received; }
+      size_t   get_send_queue_size() const { return _send_queue_size_in_bytes; }
     };
 
     message_oriented_connection_impl::message_oriented_connection_impl(message_oriented_connection* self, message_oriented_connection_delegate* delegate) : 
       _self(self),
-      _delegate(delegate)
+      _delegate(delegate),
+      _receive_buffer_begin(0),
+      _plaintext_end(0),
+      _record_end(0),
+      _receive_buffer_end(0),
+      _bytes_received(0),
+      _bytes_sent(0),
+      _send_queue_size_in_bytes(0),
+      _send_buffers_queued(0),
+      _stream_buffers_queued(0),
+      _maximum_send_queue_size_in_bytes(8 * 1024 * 1024),
+      _buffers_passing_over_lower(0),
+      _queueing_records(false),
+      _send_cipher_suite(stcp_socket::preferred_cipher_suite())
     {
     }
 
+    message_oriented_connection_impl::~message_oriented_connection_impl()
+    {
+      try
+      {
+        if (_send_loop_done.valid() && !_send_loop_done.ready())
+        {
+          _send_loop_done.cancel();
+          _send_loop_done.wait();
+        }
+      }
+      catch (...)
+      {
+      }
+    }
+
     fc::tcp_socket& message_oriented_connection_impl::get_socket()
     {
       return _sock.get_socket();
@@ -44,56 +134,166 @@ namespace bts { namespace net {
     {
       _sock.accept();
       _read_loop_done = fc::async([=](){ read_loop(); });
+      start_send_loop();
     }
 
     void message_oriented_connection_impl::connect_to(const fc::ip::endpoint& remote_endpoint)
     {
       _sock.connect_to(remote_endpoint);
       _read_loop_done = fc::async([=](){ read_loop(); });
+      start_send_loop();
     }
 
     void message_oriented_connection_impl::connect_to(const fc::ip::endpoint& remote_endpoint, const fc::ip::endpoint& local_endpoint)
     {
       _sock.connect_to(remote_endpoint, local_endpoint);
       _read_loop_done = fc::async([=](){ read_loop(); });
+      start_send_loop();
     }
 
 
+    void message_oriented_connection_impl::deliver_message(message& m, const message_header& header, const char* message_data)
+    {
+      const size_t POOLED_BUFFER_SIZE = 1024 * 1024; // larger message buffers are released after use
+
+      if( header.size <= POOLED_BUFFER_SIZE && m.data.capacity() > POOLED_BUFFER_SIZE )
+        std::vector<char>().swap(m.data);
+      (message_header&)m = header;
+      m.data.assign(message_data, message_data + header.size);
+
+      try 
+      { 
+        // message handling errors are warnings...
+        _delegate->on_message(_self, m);
+      } 
+      /// Dedicated catches needed to distinguish from general fc::exception
+      catch ( fc::canceled_exception& e ) { throw e; }
+      catch ( fc::eof_exception& e ) { throw e; }
+      catch ( fc::exception& e ) 
+      { 
+        /// Here loop should be continued so exception should be just caught locally.
+        wlog( "message transmission failed ${er}", ("er", e.to_detail_string() ) );
+      }
+    }
+
     void message_oriented_connection_impl::read_loop()
     {
-      const int BUFFER_SIZE = 16;
-      const int LEFTOVER = BUFFER_SIZE - sizeof(message_header);
-      assert(BUFFER_SIZE >= sizeof(message_header));
+      const size_t MINIMUM_READ_SIZE = 64 * 1024;
+      const size_t MAXIMUM_MESSAGE_SIZE = 16 * 1024 * 1024; // see message_header
+      const size_t MAXIMUM_RECORD_SIZE = MAXIMUM_MESSAGE_SIZE + 64 * 1024;
 
       try 
       {
+        // we read as much as the socket has into _receive_buffer and frame as many messages out of
+        // it as it holds.  Only the bytes of messages being framed are decrypted so that whatever
+        // follows a cipher_switch_message is still encrypted when the switch is made.
+        // m is reused so that its data buffer is only reallocated when a larger message arrives
         message m;
         while( true )
         {
-          char buffer[BUFFER_SIZE];
-          _sock.read(buffer, BUFFER_SIZE);
-          memcpy((char*)&m, buffer, sizeof(message_header));
-
-          size_t remaining_bytes_with_padding = 16 * ((m.size - LEFTOVER + 15) / 16);
-          m.data.resize(LEFTOVER + remaining_bytes_with_padding); //give extra 16 bytes to allow for padding added in send call
-          std::copy(buffer + sizeof(message_header), buffer + sizeof(buffer), m.data.begin());
-          if (remaining_bytes_with_padding)
-            _sock.read(&m.data[LEFTOVER], remaining_bytes_with_padding);
-          m.data.resize(m.size); // truncate off the padding bytes
-
-          try 
-          { 
-            // message handling errors are warnings...
-            _delegate->on_message(_self, m);
-          } 
-          /// Dedicated catches needed to distinguish from general fc::exception
-          catch ( fc::canceled_exception& e ) { throw e; }
-          catch ( fc::eof_exception& e ) { throw e; }
-          catch ( fc::exception& e ) 
-          { 
-            /// Here loop should be continued so exception should be just caught locally.
-            wlog( "message transmission failed ${er}", ("er", e.to_detail_string() ) );
+          size_t bytes_needed; // from _receive_buffer_begin, before more can be framed
+          if( _sock.is_receiving_records() )
+          {
+            // records hold whole, unpadded messages
+            size_t plaintext = _plaintext_end - _receive_buffer_begin;
+            if( plaintext )
+            {
+              message_header header;
+              if( plaintext < sizeof(message_header) )
+                FC_THROW_EXCEPTION( exception, "record ends in the middle of a message header" );
+              memcpy((char*)&header, &_receive_buffer[_receive_buffer_begin], sizeof(message_header));
+              if( header.size > plaintext - sizeof(message_header) )
+                FC_THROW_EXCEPTION( exception, "record ends in the middle of a message of ${size} bytes", ("size", header.size) );
+              if( header.msg_type == core_message_type_enum::cipher_switch_message_type )
+                FC_THROW_EXCEPTION( exception, "peer switched ciphers twice" );
+              _receive_buffer_begin += sizeof(message_header) + header.size;
+              deliver_message(m, header, &_receive_buffer[_receive_buffer_begin - header.size]);
+              continue;
+            }
+
+            // skip the tag of the last record and open the next one once all of it has been read
+            _receive_buffer_begin = _plaintext_end = _record_end;
+            size_t bytes_buffered = _receive_buffer_end - _receive_buffer_begin;
+            bytes_needed = stcp_socket::record_header_size;
+            if( bytes_buffered >= stcp_socket::record_header_size )
+            {
+              uint32_t record_size;
+              memcpy((char*)&record_size, &_receive_buffer[_receive_buffer_begin], sizeof(record_size));
+              if( record_size > MAXIMUM_RECORD_SIZE )
+                FC_THROW_EXCEPTION( exception, "record of ${size} bytes exceeds the maximum record size", ("size", record_size) );
+              bytes_needed = stcp_socket::record_header_size + record_size + stcp_socket::record_tag_size;
+              if( bytes_buffered >= bytes_needed )
+              {
+                _sock.open_record(&_receive_buffer[_receive_buffer_begin], record_size);
+                _receive_buffer_begin += stcp_socket::record_header_size;
+                _plaintext_end = _receive_buffer_begin + record_size;
+                _record_end = _plaintext_end + stcp_socket::record_tag_size;
+                continue;
+              }
+            }
+          }
+          else
+          {
+            // every message is padded to a multiple of 16 bytes, the cipher's block size
+            size_t plaintext = _plaintext_end - _receive_buffer_begin;
+            bytes_needed = 16;
+            if( plaintext >= sizeof(message_header) )
+            {
+              message_header header;
+              memcpy((char*)&header, &_receive_buffer[_receive_buffer_begin], sizeof(message_header));
+              if( header.size > MAXIMUM_MESSAGE_SIZE )
+                FC_THROW_EXCEPTION( exception, "message of ${size} bytes exceeds the maximum message size", ("size", header.size) );
+              bytes_needed = 16 * ((sizeof(message_header) + header.size + 15) / 16);
+              if( plaintext >= bytes_needed )
+              {
+                const char* message_data = &_receive_buffer[_receive_buffer_begin + sizeof(message_header)];
+                _receive_buffer_begin += bytes_needed;
+                if( header.msg_type == core_message_type_enum::cipher_switch_message_type )
+                {
+                  (message_header&)m = header;
+                  m.data.assign(message_data, message_data + header.size);
+                  _sock.start_receiving_records((stcp_socket::cipher_suite)m.as<cipher_switch_message>().cipher_suite);
+                  _record_end = _plaintext_end;
+                }
+                else
+                  deliver_message(m, header, message_data);
+                continue;
+              }
+            }
+
+            // decrypt whatever has been read of the message, in whole cipher blocks
+            size_t bytes_to_decrypt = (std::min(bytes_needed, _receive_buffer_end - _receive_buffer_begin) - plaintext) & ~size_t(15);
+            if( bytes_to_decrypt )
+            {
+              _sock.decrypt(&_receive_buffer[_plaintext_end], bytes_to_decrypt);
+              _plaintext_end += bytes_to_decrypt;
+              continue;
+            }
           }
+
+          // move the partial message to the front and make room for the rest of it
+          if( _receive_buffer_begin )
+          {
+            size_t bytes_buffered = _receive_buffer_end - _receive_buffer_begin;
+            memmove(_receive_buffer.data(), &_receive_buffer[_receive_buffer_begin], bytes_buffered);
+            _plaintext_end -= _receive_buffer_begin;
+            if( _sock.is_receiving_records() )
+              _record_end -= _receive_buffer_begin;
+            _receive_buffer_end = bytes_buffered;
+            _receive_buffer_begin = 0;
+          }
+          size_t buffer_size = std::max(bytes_needed, MINIMUM_READ_SIZE);
+          if( _receive_buffer.size() < buffer_size || 
+              (_receive_buffer.size() > MINIMUM_READ_SIZE && buffer_size == MINIMUM_READ_SIZE) )
+            _receive_buffer.resize(buffer_size);
+
+          size_t bytes_read = _sock.readsome_raw(&_receive_buffer[_receive_buffer_end], _receive_buffer.size() - _receive_buffer_end);
+          _receive_buffer_end += bytes_read;
+          _bytes_received += bytes_read;
+
+          fc::microseconds download_delay = take_bandwidth(_download_limit, _shared_download_limit.get(), bytes_read);
+          if (download_delay.count() > 0)
+            fc::usleep(download_delay);
         }
       } 
       catch ( const fc::canceled_exception& e )
@@ -120,19 +320,205 @@ namespace bts { namespace net {
       }
     }
 
-    void message_oriented_connection_impl::send_message(const message& message_to_send)
+    void message_oriented_connection_impl::send_message(const message& message_to_send, message_priority priority)
     {
-      try 
+      const size_t COALESCED_BUFFER_SIZE = 64 * 1024;
+
+      size_t size_of_message_and_header = sizeof(message_header) + message_to_send.size;
+      //pad the message we send to a multiple of 16 bytes, records need no padding
+      size_t size_with_padding = _queueing_records ? size_of_message_and_header : 16 * ((size_of_message_and_header + 15) / 16);
+
+      // a peer that can't keep up would otherwise hold an unbounded amount of our memory
+      if (_send_queue_size_in_bytes + size_with_padding > _maximum_send_queue_size_in_bytes)
+      {
+        wlog("send queue of ${size} bytes is full, closing the connection", ("size", _send_queue_size_in_bytes));
+        close_connection();
+        return;
+      }
+
+      // the front buffer may be in the middle of being written, and a buffer is sent with one cipher
+      std::deque<queued_send_buffer>& send_queue = _send_queues[priority];
+      if (send_queue.size() < 2 || 
+          send_queue.back().switch_to_records_after ||
+          send_queue.back().is_record != _queueing_records ||
+          send_queue.back().data.size() + size_with_padding > COALESCED_BUFFER_SIZE)
+      {
+        send_queue.emplace_back();
+        ++_send_buffers_queued;
+        if (!_queueing_records)
+          ++_stream_buffers_queued;
+        queued_send_buffer& new_buffer = send_queue.back();
+        if (!_free_send_buffers.empty())
+        {
+          new_buffer.data.swap(_free_send_buffers.back());
+          _free_send_buffers.pop_back();
+        }
+        new_buffer.is_record = _queueing_records;
+        if (_queueing_records)
+        {
+          new_buffer.data.resize(stcp_socket::record_header_size);
+          _send_queue_size_in_bytes += stcp_socket::record_header_size;
+        }
+      }
+      std::vector<char>& buffer = send_queue.back().data;
+      size_t offset = buffer.size();
+      buffer.resize(offset + size_with_padding);
+      memcpy(&buffer[offset], (char*)&message_to_send, sizeof(message_header));
+      memcpy(&buffer[offset + sizeof(message_header)], message_to_send.data.data(), message_to_send.size);
+      memset(&buffer[offset + size_of_message_and_header], 0, size_with_padding - size_of_message_and_header);
+      _send_queue_size_in_bytes += size_with_padding;
+
+      if (_retrigger_send_loop_promise)
+        _retrigger_send_loop_promise->set_value();
+    }
+
+    void message_oriented_connection_impl::enable_authenticated_records()
+    {
+      if (_queueing_records)
+        return;
+      send_message(message(cipher_switch_message(_send_cipher_suite)), high_priority);
+      if (_send_queues[high_priority].empty())
+        return; // the connection was closed
+      _send_queues[high_priority].back().switch_to_records_after = true;
+      _queueing_records = true;
+    }
+
+    fc::microseconds message_oriented_connection_impl::take_bandwidth(token_bucket& own_limit, token_bucket* shared_limit, size_t bytes)
+    {
+      fc::time_point now = fc::time_point::now();
+      fc::microseconds delay = own_limit.consume(bytes, now);
+      if (shared_limit)
+        delay = std::max(delay, shared_limit->consume(bytes, now));
+      return delay;
+    }
+
+    /**
+     * Buffers sealed in records wait for the cipher switch, and the buffer that ends with the
+     * switch waits for all the others sent with the AES stream, which are at the fronts of
+     * their queues.
+     */
+    bool message_oriented_connection_impl::can_send_front(const std::deque<queued_send_buffer>& send_queue) const
+    {
+      if (send_queue.empty())
+        return false;
+      const queued_send_buffer& front = send_queue.front();
+      if (front.is_record != _sock.is_sending_records())
+        return false;
+      return !front.switch_to_records_after || _stream_buffers_queued <= 1;
+    }
+
+    /**
+     * The highest priority queue whose front buffer can be written now.  Steady relay traffic
+     * would starve bulk sync that way, so after MAXIMUM_BUFFERS_PASSING_OVER_LOWER buffers in
+     * a row went ahead of a waiting one, the lowest priority queue that can write goes first.
+     */
+    std::deque<message_oriented_connection_impl::queued_send_buffer>* message_oriented_connection_impl::next_send_queue()
+    {
+      const size_t MAXIMUM_BUFFERS_PASSING_OVER_LOWER = 8;
+      std::deque<queued_send_buffer>* highest = nullptr;
+      std::deque<queued_send_buffer>* lowest = nullptr;
+      for (std::deque<queued_send_buffer>& send_queue : _send_queues)
+      {
+        if (!can_send_front(send_queue))
+          continue;
+        if (!highest)
+          highest = &send_queue;
+        lowest = &send_queue;
+      }
+      if (lowest != highest && _buffers_passing_over_lower >= MAXIMUM_BUFFERS_PASSING_OVER_LOWER)
+        return lowest;
+      return highest;
+    }
+
+    void message_oriented_connection_impl::set_rate_limits(const std::shared_ptr<token_bucket>& shared_upload, const std::shared_ptr<token_bucket>& shared_download,
+                                                           uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second)
+    {
+      _shared_upload_limit = shared_upload;
+      _shared_download_limit = shared_download;
+      // a connection may burst a second of its rate
+      _upload_limit.set_rate(upload_bytes_per_second, upload_bytes_per_second);
+      _download_limit.set_rate(download_bytes_per_second, download_bytes_per_second);
+    }
+
+    void message_oriented_connection_impl::start_send_loop()
+    {
+      _send_loop_done = fc::async([=](){ send_loop(); });
+    }
+
+    void message_oriented_connection_impl::send_loop()
+    {
+      const size_t POOLED_BUFFER_SIZE = 1024 * 1024; // larger buffers are released after use
+      const size_t MAXIMUM_FREE_SEND_BUFFERS = 4;
+
+      try
+      {
+        for (;;)
+        {
+          // the front buffer stays queued while it is written, send_message() appends behind it
+          while (std::deque<queued_send_buffer>* send_queue = next_send_queue())
+          {
+            // pay off what was written before choosing, a message queued meanwhile may go first
+            fc::microseconds upload_delay = take_bandwidth(_upload_limit, _shared_upload_limit.get(), 0);
+            if (upload_delay.count() > 0)
+            {
+              fc::usleep(upload_delay);
+              continue;
+            }
+
+            bool lower_waiting = false;
+            for (std::deque<queued_send_buffer>* lower = send_queue + 1; lower != _send_queues + number_of_message_priorities; ++lower)
+              lower_waiting = lower_waiting || can_send_front(*lower);
+            _buffers_passing_over_lower = lower_waiting ? _buffers_passing_over_lower + 1 : 0;
+
+            queued_send_buffer& queued_buffer = send_queue->front();
+            std::vector<char>& buffer = queued_buffer.data;
+            size_t queued_size = buffer.size();
+            take_bandwidth(_upload_limit, _shared_upload_limit.get(), queued_size);
+            if (queued_buffer.is_record)
+              _sock.write_record(buffer);
+            else
+              _sock.write(buffer.data(), buffer.size());
+            _bytes_sent += buffer.size(); // a record's tag has been appended
+            if (queued_buffer.switch_to_records_after)
+              _sock.start_sending_records(_send_cipher_suite);
+            // a limited connection waits before the next buffer, which mustn't hold this one back
+            if (_send_buffers_queued == 1 || _upload_limit.is_limited() || (_shared_upload_limit && _shared_upload_limit->is_limited()))
+              _sock.flush();
+
+            _send_queue_size_in_bytes -= queued_size;
+            --_send_buffers_queued;
+            if (!queued_buffer.is_record)
+              --_stream_buffers_queued;
+            if (buffer.capacity() <= POOLED_BUFFER_SIZE && _free_send_buffers.size() < MAXIMUM_FREE_SEND_BUFFERS)
+            {
+              buffer.clear();
+              _free_send_buffers.emplace_back();
+              _free_send_buffers.back().swap(buffer);
+            }
+            send_queue->pop_front();
+          }
+
+          _retrigger_send_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
+          _retrigger_send_loop_promise->wait();
+          _retrigger_send_loop_promise.reset();
+        }
+      }
+      catch (const fc::canceled_exception&)
       {
-        size_t size_of_message_and_header = sizeof(message_header) + message_to_send.size;
-        //pad the message we send to a multiple of 16 bytes
-        size_t size_with_padding = 16 * ((size_of_message_and_header + 15) / 16);
-        std::unique_ptr<char[]> padded_message(new char[size_with_padding]);
-        memcpy(padded_message.get(), (char*)&message_to_send, sizeof(message_header));
-        memcpy(padded_message.get() + sizeof(message_header), message_to_send.data.data(), message_to_send.size );
-        _sock.write(padded_message.get(), size_with_padding);
-        _sock.flush();
-      } FC_RETHROW_EXCEPTIONS( warn, "unable to send message" );    
+      }
+      catch (const fc::exception& e)
+      {
+        // the read loop notices the closed socket and reports the connection closed
+        wlog("unable to send message, closing the connection: ${e}", ("e", e.to_detail_string()));
+        _retrigger_send_loop_promise.reset();
+        try
+        {
+          _sock.close();
+        }
+        catch (const fc::exception&)
+        {
+        }
+      }
     }
 
     void message_oriented_connection_impl::close_connection()
@@ -171,9 +557,14 @@ namespace bts { namespace net {
     my->connect_to(remote_endpoint, local_endpoint);
   }
   
-  void message_oriented_connection::send_message(const message& message_to_send)
+  void message_oriented_connection::send_message(const message& message_to_send, message_priority priority)
+  {
+    my->send_message(message_to_send, priority);
+  }
+
+  void message_oriented_connection::enable_authenticated_records()
   {
-    my->send_message(message_to_send);
+    my->enable_authenticated_records();
   }
 
   void message_oriented_connection::close_connection()
@@ -181,4 +572,25 @@ namespace bts { namespace net {
     my->close_connection();
   }
 
+  void message_oriented_connection::set_rate_limits(const std::shared_ptr<token_bucket>& shared_upload, const std::shared_ptr<token_bucket>& shared_download,
+                                                    uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second)
+  {
+    my->set_rate_limits(shared_upload, shared_download, upload_bytes_per_second, download_bytes_per_second);
+  }
+
+  uint64_t message_oriented_connection::get_total_bytes_sent() const
+  {
+    return my->get_total_bytes_sent();
+  }
+
+  uint64_t message_oriented_connection::get_total_bytes_received() const
+  {
+    return my->get_total_bytes_received();
+  }
+
+  size_t message_oriented_connection::get_send_queue_size() const
+  {
+    return my->get_send_queue_size();
+  }
+
 } } // end namespace bts::net
@@ -1,14 +1,20 @@
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 #include <deque>
+#include <map>
+#include <set>
 #include <unordered_set>
+#include <limits>
 #include <list>
+#include <thread>
 //#include <deque>
 #include <boost/tuple/tuple.hpp>
 #include <boost/circular_buffer.hpp>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/random_access_index.hpp>
@@ -20,19 +26,110 @@
 #include <fc/io/json.hpp>
 #include <fc/io/enum_type.hpp>
 #include <fc/crypto/rand.hpp>
+#include <fc/variant_object.hpp>
+
+#include <bts/db/executor.hpp>
+#include <bts/db/trace.hpp>
 
 #include <bts/net/node.hpp>
 #include <bts/net/peer_database.hpp>
 #include <bts/net/message_oriented_connection.hpp>
 #include <bts/net/stcp_socket.hpp>
+#include <bts/net/keyed_hash.hpp>
 #include <bts/client/messages.hpp>
 
 
 namespace bts { namespace net {
   namespace detail
   {
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+    /**
+     * The items a peer has advertised to us, or we to it.  Entries expire after a while and the
+     * oldest are dropped when the filter is full, so each peer costs a fixed amount of memory
+     * however long it stays connected.  Forgetting an item only means we may advertise it again.
+     */
+    class peer_inventory_filter
+    {
+       private:
+         struct item_id_index{};
+         struct time_index{};
+         struct inventory_entry
+         {
+           item_id        item;
+           fc::time_point time_added;
+           inventory_entry(const item_id& item, const fc::time_point& time_added) :
+             item(item),
+             time_added(time_added)
+           {}
+         };
+         typedef boost::multi_index_container<inventory_entry,
+                                              boost::multi_index::indexed_by<boost::multi_index::hashed_unique<boost::multi_index::tag<item_id_index>,
+                                                                                                               boost::multi_index::member<inventory_entry, item_id, &inventory_entry::item>,
+                                                                                                               std::hash<item_id> >,
+                                                                             boost::multi_index::ordered_non_unique<boost::multi_index::tag<time_index>,
+                                                                                                                    boost::multi_index::member<inventory_entry, fc::time_point, &inventory_entry::time_added> > > > inventory_container;
+         inventory_container _inventory;
+
+         size_t           _maximum_size;
+         fc::microseconds _expiration_time;
+       public:
+         peer_inventory_filter() :
+           _maximum_size(10000),
+           _expiration_time(fc::minutes(10))
+         {}
+         bool contains(const item_id& item) const;
+         void insert(const item_id& item);
+         bool erase(const item_id& item);
+         size_t size() const { return _inventory.size(); }
+         /// an estimate, including the overhead of both indices
+         size_t memory_usage() const { return _inventory.size() * (sizeof(inventory_entry) + 5 * sizeof(void*)); }
+       private:
+         void expire(const fc::time_point& now);
+    };
+
+    bool peer_inventory_filter::contains(const item_id& item) const
+    {
+      return _inventory.get<item_id_index>().find(item) != _inventory.get<item_id_index>().end();
+    }
+
+    void peer_inventory_filter::insert(const item_id& item)
+    {
+      fc::time_point now = fc::time_point::now();
+      expire(now);
+      auto& inventory_by_id = _inventory.get<item_id_index>();
+      auto iter = inventory_by_id.find(item);
+      if (iter != inventory_by_id.end())
+        inventory_by_id.replace(iter, inventory_entry(item, now));
+      else
+      {
+        if (_inventory.size() >= _maximum_size)
+          _inventory.get<time_index>().erase(_inventory.get<time_index>().begin());
+        _inventory.insert(inventory_entry(item, now));
+      }
+    }
+
+    bool peer_inventory_filter::erase(const item_id& item)
+    {
+      return _inventory.get<item_id_index>().erase(item) != 0;
+    }
+
+    void peer_inventory_filter::expire(const fc::time_point& now)
+    {
+      auto& inventory_by_time = _inventory.get<time_index>();
+      inventory_by_time.erase(inventory_by_time.begin(), inventory_by_time.lower_bound(now - _expiration_time));
+    }
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
     enum peer_connection_direction { unknown, inbound, outbound };
 
+    /// a compact block being rebuilt, waiting for the transactions we didn't have
+    struct pending_compact_block
+    {
+      bts::client::compact_block_message                               compact_block;
+      std::vector<fc::optional<bts::blockchain::signed_transaction> > trxs; /// empty where we're waiting for the peer
+      bool                                                             requested_all_transactions; /// set after a mismatch, another one is the peer's fault
+    };
+
     class peer_connection : public message_oriented_connection_delegate,
                             public std::enable_shared_from_this<peer_connection>
     {
@@ -63,8 +160,22 @@ namespace bts { namespace net {
       uint32_t         core_protocol_version;
       std::string      user_agent;
       fc::ip::endpoint inbound_endpoint;
+      uint32_t         connection_capabilities; /// connection_capability_flags sent after the peer's hello
+      /// @}
+
+      fc::time_point hello_sent_time; /// outbound peers that don't reply in time are disconnected
+
+      /// reported by node::get_statistics()
+      /// @{
+      uint64_t          messages_sent;
+      uint64_t          messages_received;
+      latency_histogram sync_request_latency;
       /// @}
 
+      /// loaded from the peer database when the peer becomes active and saved to it when it disconnects,
+      /// it decides who we sync from, who is evicted when we are full, and who we connect to first
+      peer_quality quality;
+
       /// blockchain synchronization state data
       /// @{
       std::deque<item_hash_t> ids_of_items_to_get; /// id of items in the blockchain that this peer has told us about
@@ -76,12 +187,28 @@ namespace bts { namespace net {
 
       /// non-syncronization state data
       /// @{
-      std::unordered_set<item_id> inventory_peer_advertised_to_us;
-      std::unordered_set<item_id> inventory_advertised_to_peer; /// TODO: make this a map to the time/block# we advertised it so we can expire items off of the list
+      peer_inventory_filter inventory_peer_advertised_to_us;
+      peer_inventory_filter inventory_advertised_to_peer;
+      std::vector<item_id> inventory_to_advertise; /// new items that go out with the next trickle to this peer
+      fc::time_point next_inventory_trickle_time;
 
-      typedef std::unordered_map<item_id, fc::time_point> item_to_time_map_type;
+      typedef bts::blockchain::flat_hash_map<item_id, fc::time_point, keyed_hash<item_id> > item_to_time_map_type;
       item_to_time_map_type items_requested_from_peer;  /// items we've requested from this peer during normal operation.  fetch from another peer if this peer disconnects
+      uint32_t transactions_to_validate; /// transactions from this peer waiting in the node's validation queue
+      fc::optional<pending_compact_block> compact_block_awaiting_transactions; /// its block stays in items_requested_from_peer until it is rebuilt
+      fc::optional<bloom_filter> light_client_filter; /// set by a light client's filter_load_message, it gets merkle blocks instead of inventory
       item_to_time_map_type sync_items_requested_from_peer; /// ids of blocks we've requested from this peer during sync.  fetch from another peer if this peer disconnects
+      bts::blockchain::flat_hash_set<item_id, keyed_hash<item_id> > sync_items_reassigned_from_peer; /// sync requests this peer failed to answer in time, not requested from it again but accepted if they arrive late
+      fc::microseconds sync_round_trip_time; /// moving average of how long this peer takes to return a sync block we requested, 0 until it has returned one
+      fc::time_point last_sync_block_received_time; /// a pipelined block's throughput is timed from the block before it
+      /// @}
+
+      /// headers-first synchronization state data
+      /// @{
+      uint32_t number_of_verified_item_ids; /// the first this many ids_of_items_to_get have validated headers, only they are fetched
+      fc::optional<item_hash_t> last_verified_item_id; /// the next header we validate must have this as its prev
+      fc::optional<fc::time_point> block_headers_requested_from_peer;
+      bool block_headers_request_is_stale; /// an unverified item was popped off the list while we waited, the reply no longer lines up with it
       /// @}
     public:
       peer_connection(node_impl& n) : 
@@ -89,9 +216,15 @@ namespace bts { namespace net {
         _message_connection(this),
         direction(unknown),
         state(disconnected),
+        connection_capabilities(0),
+        messages_sent(0),
+        messages_received(0),
         number_of_unfetched_item_ids(0),
+        transactions_to_validate(0),
         peer_needs_sync_items_from_us(true),
-        we_need_sync_items_from_peer(true)
+        we_need_sync_items_from_peer(true),
+        number_of_verified_item_ids(0),
+        block_headers_request_is_stale(false)
       {}
       ~peer_connection() {}
 
@@ -103,14 +236,21 @@ namespace bts { namespace net {
       void on_connection_closed(message_oriented_connection* originating_connection) override;
 
       void send_message(const message& message_to_send);
+      /** once the peer has said it speaks protocol 4, see message_oriented_connection */
+      void enable_authenticated_records();
       void close_connection();
+      void set_rate_limits(const std::shared_ptr<token_bucket>& shared_upload, const std::shared_ptr<token_bucket>& shared_download,
+                           uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second);
 
       fc::optional<fc::ip::endpoint> get_remote_endpoint();
       void set_remote_endpoint(fc::optional<fc::ip::endpoint> new_remote_endpoint);
+      const message_oriented_connection& get_message_connection() const { return _message_connection; }
 
       bool busy();
       bool idle();
     private:
+      message_priority priority_of(const message& message_to_send) const;
+      void send_message_on_wire(const message& message_to_send, message_priority priority); /// as it is, counted under its msg_type
       void accept_connection_task();
       void connect_to_task(const fc::ip::endpoint& remote_endpoint);
     };
@@ -122,11 +262,12 @@ namespace bts { namespace net {
     struct node_configuration
     {
       fc::ip::endpoint listen_endpoint;
+      bandwidth_limits bandwidth;
     };
 
  } } } // end namespace bts::net::detail
 
-FC_REFLECT(bts::net::detail::node_configuration, (listen_endpoint));
+FC_REFLECT(bts::net::detail::node_configuration, (listen_endpoint)(bandwidth));
 
 // not sent over the wire, just reflected for logging
 FC_REFLECT_ENUM(bts::net::detail::peer_connection_direction, (unknown)(inbound)(outbound))
@@ -136,6 +277,164 @@ namespace bts { namespace net {
   namespace detail 
   {
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+    /**
+     * Items advertised to us during normal operation that we want to fetch.  Each item is queued
+     * once along with every peer that advertised it, so that when a request fails the item can be
+     * requested from another of them.  Blocks are requested before anything else and items of the
+     * same priority in the order they were queued.  Items nobody delivers within the expiration
+     * time are dropped, and the oldest item is dropped when the queue is full.
+     */
+    class item_fetch_queue
+    {
+       private:
+         struct item_id_index{};
+         struct fetch_order_index{};
+         struct time_index{};
+         struct queued_item
+         {
+           item_id                                  item;
+           uint8_t                                  priority; /// lower is fetched first
+           uint64_t                                 sequence_number;
+           fc::time_point                           time_queued;
+           bool                                     requested; /// waiting for a peer to deliver it
+           std::vector<std::weak_ptr<peer_connection> > sources; /// peers that advertised it and haven't failed to deliver it
+
+           typedef boost::tuple<bool, uint8_t, uint64_t> fetch_order_key;
+           fetch_order_key get_fetch_order_key() const { return fetch_order_key(requested, priority, sequence_number); }
+         };
+         typedef boost::multi_index_container<queued_item,
+                                              boost::multi_index::indexed_by<boost::multi_index::hashed_unique<boost::multi_index::tag<item_id_index>,
+                                                                                                               boost::multi_index::member<queued_item, item_id, &queued_item::item>,
+                                                                                                               std::hash<item_id> >,
+                                                                             boost::multi_index::ordered_unique<boost::multi_index::tag<fetch_order_index>,
+                                                                                                                boost::multi_index::const_mem_fun<queued_item, queued_item::fetch_order_key, &queued_item::get_fetch_order_key> >,
+                                                                             boost::multi_index::ordered_non_unique<boost::multi_index::tag<time_index>,
+                                                                                                                    boost::multi_index::member<queued_item, fc::time_point, &queued_item::time_queued> > > > item_container;
+         item_container   _items;
+         uint64_t         _next_sequence_number;
+         size_t           _maximum_size;
+         fc::microseconds _expiration_time;
+       public:
+         item_fetch_queue() :
+           _next_sequence_number(0),
+           _maximum_size(100000),
+           _expiration_time(fc::minutes(2))
+         {}
+         /** queues item, or adds advertiser to the peers it can be fetched from */
+         void add(const item_id& item, const peer_connection_ptr& advertiser);
+         bool contains(const item_id& item) const;
+         /** the item arrived */
+         void remove(const item_id& item);
+         /** peer didn't deliver item, ask one of its other sources */
+         void request_failed(const item_id& item, const peer_connection* peer);
+         void expire(const fc::time_point& now);
+         size_t size() const { return _items.size(); }
+
+         /**
+          * Calls request(peer, item) for each queued item that hasn't been requested and has a
+          * source for which is_available(peer) is true, in fetch order.  The items are all marked
+          * requested before the first request is made, so request may yield.
+          */
+         template<typename IsAvailable, typename Request>
+         void request_items(IsAvailable&& is_available, Request&& request);
+    };
+
+    void item_fetch_queue::add(const item_id& item, const peer_connection_ptr& advertiser)
+    {
+      auto& items_by_id = _items.get<item_id_index>();
+      auto iter = items_by_id.find(item);
+      if (iter != items_by_id.end())
+      {
+        for (const std::weak_ptr<peer_connection>& source : iter->sources)
+          if (source.lock() == advertiser)
+            return;
+        items_by_id.modify(iter, [&](queued_item& queued) { queued.sources.push_back(advertiser); });
+        return;
+      }
+
+      if (_items.size() >= _maximum_size)
+        _items.get<time_index>().erase(_items.get<time_index>().begin());
+      queued_item new_item;
+      new_item.item = item;
+      new_item.priority = item.item_type == bts::client::block_message_type ? 0 : 1;
+      new_item.sequence_number = _next_sequence_number++;
+      new_item.time_queued = fc::time_point::now();
+      new_item.requested = false;
+      new_item.sources.push_back(advertiser);
+      _items.insert(new_item);
+    }
+
+    bool item_fetch_queue::contains(const item_id& item) const
+    {
+      return _items.get<item_id_index>().find(item) != _items.get<item_id_index>().end();
+    }
+
+    void item_fetch_queue::remove(const item_id& item)
+    {
+      _items.get<item_id_index>().erase(item);
+    }
+
+    void item_fetch_queue::request_failed(const item_id& item, const peer_connection* peer)
+    {
+      auto& items_by_id = _items.get<item_id_index>();
+      auto iter = items_by_id.find(item);
+      if (iter == items_by_id.end())
+        return;
+      items_by_id.modify(iter, [&](queued_item& queued) {
+        queued.requested = false;
+        queued.sources.erase(std::remove_if(queued.sources.begin(), queued.sources.end(), 
+                                            [&](const std::weak_ptr<peer_connection>& source) { 
+                                              peer_connection_ptr source_peer = source.lock();
+                                              return !source_peer || source_peer.get() == peer; 
+                                            }), 
+                             queued.sources.end());
+      });
+      if (iter->sources.empty())
+        items_by_id.erase(iter);
+    }
+
+    void item_fetch_queue::expire(const fc::time_point& now)
+    {
+      auto& items_by_time = _items.get<time_index>();
+      items_by_time.erase(items_by_time.begin(), items_by_time.lower_bound(now - _expiration_time));
+    }
+
+    template<typename IsAvailable, typename Request>
+    void item_fetch_queue::request_items(IsAvailable&& is_available, Request&& request)
+    {
+      // requested items sort after the ones still waiting, so we can stop at the first of them
+      auto& items_in_fetch_order = _items.get<fetch_order_index>();
+      std::vector<std::pair<peer_connection_ptr, item_id> > items_to_request;
+      for (auto iter = items_in_fetch_order.begin(); iter != items_in_fetch_order.end() && !iter->requested; )
+      {
+        peer_connection_ptr available_source;
+        for (const std::weak_ptr<peer_connection>& source : iter->sources)
+        {
+          peer_connection_ptr source_peer = source.lock();
+          if (source_peer && is_available(source_peer))
+          {
+            available_source = source_peer;
+            break;
+          }
+        }
+        if (!available_source)
+        {
+          ++iter;
+          continue;
+        }
+
+        // marking it requested moves it behind the waiting items
+        auto requested_iter = iter++;
+        items_to_request.push_back(std::make_pair(available_source, requested_iter->item));
+        items_in_fetch_order.modify(requested_iter, [](queued_item& queued) { queued.requested = true; });
+      }
+
+      // sending can yield and let other tasks change _items, so only send once we're done walking it
+      for (const auto& peer_and_item : items_to_request)
+        request(peer_and_item.first, peer_and_item.second);
+    }
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
     class blockchain_tied_message_cache 
@@ -151,10 +450,10 @@ namespace bts { namespace net {
            message           message_body;
            uint32_t          block_clock_when_received;
            message_info(const message_hash_type& message_hash,
-                        const message&           message_body,
+                        message                  message_body,
                         uint32_t                 block_clock_when_received) :
              message_hash(message_hash),
-             message_body(message_body),
+             message_body(std::move(message_body)),
              block_clock_when_received (block_clock_when_received)
            {}
          };
@@ -171,8 +470,11 @@ namespace bts { namespace net {
            block_clock(0)
          {}
          void block_accepted();
-         void cache_message(const message& message_to_cache, const message_hash_type& hash_of_message_to_cache);
-         message get_message(const message_hash_type& hash_of_message_to_lookup);
+         void cache_message(message message_to_cache, const message_hash_type& hash_of_message_to_cache);
+         /// the reference is valid until the next call to cache_message() or block_accepted()
+         const message& get_message(const message_hash_type& hash_of_message_to_lookup) const;
+         bool contains(const message_hash_type& hash_of_message_to_lookup) const;
+         void remove(const message_hash_type& hash_of_message_to_remove);
     };
 
     void blockchain_tied_message_cache::block_accepted()
@@ -183,28 +485,163 @@ namespace bts { namespace net {
                                                      _message_cache.get<block_clock_index>().lower_bound(block_clock - cache_duration_in_blocks));
     }
 
-    void blockchain_tied_message_cache::cache_message(const message& message_to_cache, const message_hash_type& hash_of_message_to_cache)
+    void blockchain_tied_message_cache::cache_message(message message_to_cache, const message_hash_type& hash_of_message_to_cache)
     {
-      _message_cache.insert(message_info(hash_of_message_to_cache, message_to_cache, block_clock));
+      _message_cache.insert(message_info(hash_of_message_to_cache, std::move(message_to_cache), block_clock));
     }
 
-    message blockchain_tied_message_cache::get_message(const message_hash_type& hash_of_message_to_lookup)
+    const message& blockchain_tied_message_cache::get_message(const message_hash_type& hash_of_message_to_lookup) const
     {
       message_cache_container::index<message_hash_index>::type::const_iterator iter = _message_cache.get<message_hash_index>().find(hash_of_message_to_lookup);
       if (iter != _message_cache.get<message_hash_index>().end())
         return iter->message_body;
       FC_THROW_EXCEPTION(key_not_found_exception, "Requested message not in cache");
     }
+
+    bool blockchain_tied_message_cache::contains(const message_hash_type& hash_of_message_to_lookup) const
+    {
+      return _message_cache.get<message_hash_index>().find(hash_of_message_to_lookup) != _message_cache.get<message_hash_index>().end();
+    }
+
+    void blockchain_tied_message_cache::remove(const message_hash_type& hash_of_message_to_remove)
+    {
+      _message_cache.get<message_hash_index>().erase(hash_of_message_to_remove);
+    }
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+    /**
+     * Holds sync blocks that arrived before the blocks they follow, indexed by block id for
+     * lookups and by height so that the blocks furthest from being processed are dropped first
+     * when the buffer exceeds its memory cap.
+     */
+    class sync_block_buffer
+    {
+       private:
+         struct block_id_index{};
+         struct block_num_index{};
+         struct buffered_block
+         {
+           bts::blockchain::block_id_type     block_id;
+           uint32_t                           block_num;
+           /// not part of the keys, so take() can move it out before the entry is erased
+           mutable bts::client::block_message block_message;
+           size_t                             size_in_bytes;
+           buffered_block(bts::client::block_message&& block_message, size_t size_in_bytes) :
+             block_id(block_message.block_id),
+             block_num(block_message.block.block_num),
+             block_message(std::move(block_message)),
+             size_in_bytes(size_in_bytes)
+           {}
+           const bts::blockchain::block_id_type& get_block_id() const { return block_id; }
+           uint32_t get_block_num() const { return block_num; }
+         };
+         typedef boost::multi_index_container<buffered_block,
+                                              boost::multi_index::indexed_by<boost::multi_index::hashed_unique<boost::multi_index::tag<block_id_index>,
+                                                                                                               boost::multi_index::const_mem_fun<buffered_block, const bts::blockchain::block_id_type&, &buffered_block::get_block_id>,
+                                                                                                               keyed_hash<bts::blockchain::block_id_type> >,
+                                                                             boost::multi_index::ordered_non_unique<boost::multi_index::tag<block_num_index>,
+                                                                                                                    boost::multi_index::const_mem_fun<buffered_block, uint32_t, &buffered_block::get_block_num> > > > buffered_block_container;
+         buffered_block_container _blocks;
+
+         size_t _size_in_bytes;
+         size_t _maximum_size_in_bytes;
+       public:
+         sync_block_buffer() :
+           _size_in_bytes(0),
+           _maximum_size_in_bytes(128 * 1024 * 1024)
+         {}
+         bool contains(const bts::blockchain::block_id_type& block_id) const;
+         /// @return the ids of the blocks evicted to stay under the cap, possibly including the one just inserted
+         std::vector<bts::blockchain::block_id_type> insert(bts::client::block_message&& block_message, size_t size_in_bytes);
+         fc::optional<bts::client::block_message> take(const bts::blockchain::block_id_type& block_id);
+         std::vector<bts::blockchain::block_id_type> set_maximum_size(size_t maximum_size_in_bytes);
+         size_t size() const { return _blocks.size(); }
+         size_t size_in_bytes() const { return _size_in_bytes; }
+         bool is_full() const { return _size_in_bytes >= _maximum_size_in_bytes; }
+       private:
+         std::vector<bts::blockchain::block_id_type> evict_to_fit();
+    };
+
+    bool sync_block_buffer::contains(const bts::blockchain::block_id_type& block_id) const
+    {
+      return _blocks.get<block_id_index>().find(block_id) != _blocks.get<block_id_index>().end();
+    }
+
+    std::vector<bts::blockchain::block_id_type> sync_block_buffer::insert(bts::client::block_message&& block_message, size_t size_in_bytes)
+    {
+      if (_blocks.insert(buffered_block(std::move(block_message), size_in_bytes)).second)
+        _size_in_bytes += size_in_bytes;
+      return evict_to_fit();
+    }
+
+    fc::optional<bts::client::block_message> sync_block_buffer::take(const bts::blockchain::block_id_type& block_id)
+    {
+      auto iter = _blocks.get<block_id_index>().find(block_id);
+      if (iter == _blocks.get<block_id_index>().end())
+        return fc::optional<bts::client::block_message>();
+      fc::optional<bts::client::block_message> result(std::move(iter->block_message));
+      _size_in_bytes -= iter->size_in_bytes;
+      _blocks.get<block_id_index>().erase(iter);
+      return result;
+    }
+
+    std::vector<bts::blockchain::block_id_type> sync_block_buffer::set_maximum_size(size_t maximum_size_in_bytes)
+    {
+      _maximum_size_in_bytes = maximum_size_in_bytes;
+      return evict_to_fit();
+    }
+
+    std::vector<bts::blockchain::block_id_type> sync_block_buffer::evict_to_fit()
+    {
+      std::vector<bts::blockchain::block_id_type> evicted_block_ids;
+      auto& blocks_by_num = _blocks.get<block_num_index>();
+      // always keep the lowest block, it is the one most likely to be processed next
+      while (_size_in_bytes > _maximum_size_in_bytes && _blocks.size() > 1)
+      {
+        auto highest_block = std::prev(blocks_by_num.end());
+        evicted_block_ids.push_back(highest_block->get_block_id());
+        _size_in_bytes -= highest_block->size_in_bytes;
+        blocks_by_num.erase(highest_block);
+      }
+      return evicted_block_ids;
+    }
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+    /// a sync block that has been taken off the peers' lists and is waiting for the delegate to validate it
+    struct queued_sync_block
+    {
+      bts::client::block_message       block_message;
+      std::vector<peer_connection_ptr> offered_by; /// the peers that had this block at the front of their list
+    };
+
+
+    /// a transaction received from a peer that waits for the delegate to validate it
+    struct queued_transaction
+    {
+      message             transaction_message;
+      uint64_t            priority;
+      uint64_t            sequence;
+      peer_connection_ptr received_from;
+
+      /// highest priority first, then the earliest arrival
+      friend bool operator<(const queued_transaction& a, const queued_transaction& b)
+      {
+        if (a.priority != b.priority)
+          return a.priority > b.priority;
+        return a.sequence < b.sequence;
+      }
+    };
+
 
     class node_impl
     {
     public:
       node_delegate*       _delegate;
+      fc::thread*          _delegate_thread; /// every call to _delegate is made on this thread, null for the node's own thread
 
 #define NODE_CONFIGURATION_FILENAME      "node_config.json"
 #define POTENTIAL_PEER_DATABASE_FILENAME "peers.leveldb"
+/** blocks and inventories deflate by far less, a higher ratio only makes us allocate for a peer's claim */
+#define MAXIMUM_COMPRESSION_RATIO        32
       fc::path             _node_configuration_directory;
       node_configuration   _node_configuration;
 
@@ -221,9 +658,33 @@ namespace bts { namespace net {
       fc::promise<void>::ptr _retrigger_fetch_sync_items_loop_promise;
       bool                   _sync_items_to_fetch_updated;
       fc::future<void>       _fetch_sync_items_loop_done;
-      typedef std::unordered_map<bts::blockchain::block_id_type, fc::time_point> active_sync_requests_map;
+      typedef std::unordered_map<bts::blockchain::block_id_type, fc::time_point, keyed_hash<bts::blockchain::block_id_type> > active_sync_requests_map;
       active_sync_requests_map              _active_sync_requests; /// list of sync blocks we've asked for from peers but have not yet received
-      std::list<bts::client::block_message> _received_sync_items; /// list of sync blocks we've received, but can't yet process because we are still missing blocks that come earlier in the chain
+      sync_block_buffer                     _received_sync_items; /// sync blocks we've received, but can't yet process because we are still missing blocks that come earlier in the chain
+      uint32_t                              _maximum_sync_requests_per_peer; /// the download window, how many sync blocks may be in flight from one peer
+      fc::microseconds                      _minimum_sync_request_timeout; /// sync requests are reassigned after the larger of this and four of the peer's round trips
+      bool                                  _headers_first_sync; /// only fetch blocks whose headers we have validated, from peers that support it
+      // @}
+
+      /// used by the task that hands sync blocks to the delegate
+      // @{
+      fc::promise<void>::ptr        _retrigger_validate_sync_blocks_loop_promise;
+      fc::future<void>              _validate_sync_blocks_loop_done;
+      std::deque<queued_sync_block> _sync_blocks_to_validate; /// blocks in chain order that are being or will be validated while we keep downloading
+      uint32_t                      _maximum_sync_blocks_to_validate; /// when the queue is full, blocks wait in _received_sync_items
+      // @}
+
+      /// used by the task that hands transactions from peers to the delegate.  Blocks don't wait
+      /// in this queue, and while sync blocks are waiting for validation no transaction is handed over
+      // @{
+      fc::promise<void>::ptr         _retrigger_validate_transactions_loop_promise;
+      fc::future<void>               _validate_transactions_loop_done;
+      std::set<queued_transaction>   _transactions_to_validate;
+      uint64_t                       _next_transaction_sequence;
+      uint32_t                       _maximum_transactions_to_validate; /// when full, the lowest priority is dropped
+      uint32_t                       _maximum_transactions_to_validate_per_peer;
+      fc::microseconds               _transaction_validation_budget; /// of delegate time per second
+      uint64_t                       _transactions_dropped;
       // @}
 
       /// used by the task that fetches items during normal operation
@@ -231,14 +692,51 @@ namespace bts { namespace net {
       fc::promise<void>::ptr _retrigger_fetch_item_loop_promise;
       bool                   _items_to_fetch_updated;
       fc::future<void>       _fetch_item_loop_done;
-      std::list<item_id>     _items_to_fetch; /// list of items we know another peer has and we want
+      item_fetch_queue       _items_to_fetch; /// items we know another peer has and we want
       // @}
 
       /// used by the task that advertises inventory during normal operation
       // @{
       fc::promise<void>::ptr _retrigger_advertise_inventory_loop_promise;
       fc::future<void>       _advertise_inventory_loop_done;
-      std::unordered_set<item_id> _new_inventory; /// list of items we have received but not yet advertised to our peers
+      bts::blockchain::flat_hash_set<item_id, keyed_hash<item_id> > _new_inventory; /// list of items we have received but not yet advertised to our peers
+      fc::microseconds       _inventory_trickle_interval; /// new items are batched for each peer for a random half to one and a half of this
+      uint32_t               _maximum_items_per_inventory_message;
+      // @}
+
+      /// large blocks and inventories are deflated for peers that can unpack them
+      // @{
+      bool                   _message_compression;
+      uint32_t               _minimum_size_to_compress; /// smaller messages don't gain enough to be worth the time
+      // @}
+
+      /// blocks that pass the delegate's validate_block_for_relay() are advertised before they are validated
+      // @{
+      bool                   _early_block_relay;
+      void withdraw_relayed_block(const message_hash_type& message_hash, const bts::blockchain::block_id_type& block_id);
+      // @}
+
+      /// peers that sent us blocks failing the relay checks, by ip address, until the ban expires
+      // @{
+      std::unordered_map<uint32_t, fc::time_point> _banned_addresses;
+      fc::microseconds       _ban_duration;
+      void ban_peer(peer_connection* peer);
+      bool is_banned(const fc::ip::address& address);
+      // @}
+
+      /// traffic shaping by _node_configuration.bandwidth, the buckets are shared by every connection
+      // @{
+      std::shared_ptr<token_bucket> _upload_limit;
+      std::shared_ptr<token_bucket> _download_limit;
+      void apply_bandwidth_limits(peer_connection* peer);
+      // @}
+
+      /// large incoming messages are inflated, hashed and unpacked on these threads so that the
+      /// node's thread keeps serving other peers meanwhile.  Handling stays on the node's thread
+      // @{
+      /** the network pool of bts::db::executor, null to decode on the node's own thread */
+      bts::db::thread_pool*                     _decode_threads;
+      uint32_t                                  _minimum_size_to_decode_in_parallel; /// smaller messages cost less than the trip to another thread
       // @}
 
 
@@ -250,6 +748,13 @@ namespace bts { namespace net {
       /** if we have _maximum_number_of_connections or more, we will refuse any inbound connections */
       uint32_t             _maximum_number_of_connections;
 
+      /// outbound connection attempts run in parallel, see p2p_network_connect_loop()
+      // @{
+      uint32_t             _maximum_number_of_concurrent_dials;
+      uint32_t             _number_of_dials_in_progress;
+      fc::microseconds     _dial_timeout; /// for the tcp connection and key exchange, and again for the reply to our hello
+      // @}
+
       fc::tcp_server       _tcp_server;
       fc::future<void>     _accept_loop_complete;
 
@@ -266,6 +771,14 @@ namespace bts { namespace net {
 
       blockchain_tied_message_cache _message_cache; /// cache message we have received and might be required to provide to other peers via inventory requests
 
+      /// counters reported by get_statistics(), peers count their own traffic
+      // @{
+      std::map<uint32_t, message_type_statistics> _message_statistics; /// by msg_type, see statistics_of()
+      message_type_statistics& statistics_of(uint32_t msg_type);
+      uint64_t                                    _handshake_failures;
+      latency_histogram                           _handle_message_time;
+      // @}
+
       node_impl();
       ~node_impl();
 
@@ -275,7 +788,35 @@ namespace bts { namespace net {
       void trigger_p2p_network_connect_loop();
 
       bool have_already_received_sync_item(const item_hash_t& item_hash);
+      void forget_evicted_sync_items(const std::vector<bts::blockchain::block_id_type>& evicted_block_ids);
       void request_sync_item_from_peer(const peer_connection_ptr& peer, const item_hash_t& item_to_request);
+      bool is_syncing_headers_first(const peer_connection* peer) const;
+      void request_block_headers_from_peer(peer_connection* peer);
+      template<typename Functor>
+      auto call_delegate(Functor&& call) -> decltype(call());
+      template<typename Functor>
+      auto run_on_decode_thread(Functor&& call) -> decltype(call());
+      template<typename Functor>
+      auto call_decoder(size_t message_size, Functor&& call) -> decltype(call());
+      template<typename MessageType>
+      MessageType decode_message(const message& received_message);
+      template<typename MessageType>
+      void decode_message(const message& received_message, MessageType& result);
+      template<typename MessageType>
+      void call_delegate_handle_message(const MessageType& message_to_handle);
+      void delegate_handle_message(const message& message_to_handle) { _delegate->handle_message(message_to_handle); }
+      void delegate_handle_message(const bts::client::block_message& block_to_handle) { _delegate->handle_block(block_to_handle); }
+
+      void validate_sync_blocks_loop();
+      void queue_transaction(peer_connection* originating_peer, const message& transaction_message);
+      void validate_transactions_loop();
+      void trigger_validate_transactions_loop();
+      void trigger_validate_sync_blocks_loop();
+      void reject_queued_sync_blocks();
+      void report_sync_status(uint32_t item_type);
+
+      void expire_timed_out_sync_requests();
+      uint32_t get_sync_request_window(peer_connection* peer, uint64_t best_score);
       void fetch_sync_items_loop();
       void trigger_fetch_sync_items_loop();
 
@@ -287,9 +828,19 @@ namespace bts { namespace net {
 
       bool is_accepting_new_connections();
       bool is_wanting_new_connections();
+      bool can_start_another_dial();
+      void disconnect_from_stalled_handshakes();
       uint32_t get_number_of_connections();
 
       bool is_already_connected_to_id(const fc::uint160_t node_id);
+
+      /// peer quality, see peer_quality
+      // @{
+      fc::ip::endpoint get_peer_database_endpoint(peer_connection* peer);
+      void load_peer_quality(peer_connection* peer);
+      void save_peer_quality(peer_connection* peer);
+      bool evict_peer_worse_than(const peer_quality& candidate);
+      // @}
       bool merge_address_info_with_potential_peer_database(const std::vector<address_info> addresses);
       void display_current_connections();
       uint32_t calculate_unsynced_block_count_from_all_peers();
@@ -306,12 +857,24 @@ namespace bts { namespace net {
       void on_fetch_item_message(peer_connection* originating_peer, const fetch_item_message& fetch_item_message_received);
       void on_item_not_available_message(peer_connection* originating_peer, const item_not_available_message& item_not_available_message_received);
       void on_item_ids_inventory_message(peer_connection* originating_peer, const item_ids_inventory_message& item_ids_inventory_message_received);
+      void on_fetch_block_headers_message(peer_connection* originating_peer, const bts::client::fetch_block_headers_message& fetch_block_headers_message_received);
+      void on_block_headers_message(peer_connection* originating_peer, const bts::client::block_headers_message& block_headers_message_received);
+      void on_compact_block_message(peer_connection* originating_peer, const bts::client::compact_block_message& compact_block_message_received);
+      void on_fetch_block_transactions_message(peer_connection* originating_peer, const bts::client::fetch_block_transactions_message& fetch_block_transactions_message_received);
+      void on_block_transactions_message(peer_connection* originating_peer, const bts::client::block_transactions_message& block_transactions_message_received);
+      void finish_compact_block(peer_connection* originating_peer);
+      void on_filter_load_message(peer_connection* originating_peer, const filter_load_message& filter_load_message_received);
+      void on_filter_add_message(peer_connection* originating_peer, const filter_add_message& filter_add_message_received);
+      void on_merkle_block_message(peer_connection* originating_peer, const merkle_block_message& merkle_block_message_received);
       void on_connection_closed(peer_connection* originating_peer);
 
       void process_backlog_of_sync_blocks();
-      void process_block_during_sync(peer_connection* originating_peer, const message& block_message, const message_hash_type& message_hash);
-      void process_block_during_normal_operation(peer_connection* originating_peer, const message& block_message, const message_hash_type& message_hash);
+      void process_block_during_sync(peer_connection* originating_peer, const message& block_message, const message_hash_type& message_hash,
+                                     bts::client::block_message&& block_message_to_process);
+      void process_block_during_normal_operation(peer_connection* originating_peer, const message& block_message, const message_hash_type& message_hash,
+                                                 const bts::client::block_message& block_message_to_process);
   
+      bool drop_duplicate_item(peer_connection* originating_peer, const item_id& received_item_id);
       void process_unrecognized_message(peer_connection* originating_peer, const message& message_to_process, const message_hash_type& message_hash);
 
       void start_synchronizing();
@@ -331,7 +894,7 @@ namespace bts { namespace net {
       void disconnect_from_peer(peer_connection* originating_peer);
 
       // methods implementing node's public interface
-      void set_delegate(node_delegate* del);
+      void set_delegate(node_delegate* del, fc::thread* delegate_thread);
       void load_configuration(const fc::path& configuration_directory);
       void connect_to_p2p_network();
       void add_node(const fc::ip::endpoint& ep);
@@ -339,7 +902,16 @@ namespace bts { namespace net {
       void listen_on_endpoint(const fc::ip::endpoint& ep);
       void listen_on_port(uint16_t port);
       std::vector<peer_status> get_connected_peers() const;
+      node_statistics get_statistics() const;
+      void set_maximum_sync_backlog_size(uint64_t maximum_size_in_bytes);
+      void set_headers_first_sync(bool enabled);
+      void set_inventory_trickle_interval(const fc::microseconds& interval);
+      void set_message_compression(bool enabled);
+      void set_connection_limits(uint32_t desired, uint32_t maximum);
+      void set_early_block_relay(bool enabled);
+      void set_bandwidth_limits(const bandwidth_limits& limits);
       void broadcast(const message& item_to_broadcast);
+      void send_filtered_block(const bts::blockchain::trx_block& block, const bts::blockchain::signed_transactions& deterministic_trxs);
       void sync_from(const item_id&);
       bool is_connected() const;
     }; // end class node_impl
@@ -392,6 +964,10 @@ namespace bts { namespace net {
 
     void peer_connection::on_message(message_oriented_connection* originating_connection, const message& received_message)
     {
+      ++messages_received;
+      message_type_statistics& statistics = _node.statistics_of(received_message.msg_type);
+      ++statistics.messages_received;
+      statistics.bytes_received += sizeof(message_header) + received_message.size;
       _node.on_message(this, received_message);
     }
 
@@ -402,7 +978,47 @@ namespace bts { namespace net {
 
     void peer_connection::send_message(const message& message_to_send)
     {
-      _message_connection.send_message(message_to_send);
+      message_priority priority = priority_of(message_to_send);
+      if (_node._message_compression &&
+          (connection_capabilities & zlib_compressed_messages) &&
+          message_to_send.size >= _node._minimum_size_to_compress &&
+          (message_to_send.msg_type == bts::client::block_message_type ||
+           message_to_send.msg_type == core_message_type_enum::blockchain_item_ids_inventory_message_type))
+        send_message_on_wire(compress_message(message_to_send), priority);
+      else
+        send_message_on_wire(message_to_send, priority);
+    }
+
+    /** blocks go out ahead of transactions, except those served to a peer that is still synchronizing */
+    message_priority peer_connection::priority_of(const message& message_to_send) const
+    {
+      switch (message_to_send.msg_type)
+      {
+      case bts::client::block_message_type:
+        return peer_needs_sync_items_from_us ? bulk_priority : high_priority;
+      case core_message_type_enum::blockchain_item_ids_inventory_message_type:
+      case bts::client::block_headers_message_type:
+        return bulk_priority;
+      case bts::client::trx_message_type:
+      case core_message_type_enum::item_ids_inventory_message_type:
+        return relay_priority;
+      default:
+        return high_priority;
+      }
+    }
+
+    void peer_connection::send_message_on_wire(const message& message_to_send, message_priority priority)
+    {
+      ++messages_sent;
+      message_type_statistics& statistics = _node.statistics_of(message_to_send.msg_type);
+      ++statistics.messages_sent;
+      statistics.bytes_sent += sizeof(message_header) + message_to_send.size;
+      _message_connection.send_message(message_to_send, priority);
+    }
+
+    void peer_connection::enable_authenticated_records()
+    {
+      _message_connection.enable_authenticated_records();
     }
 
     void peer_connection::close_connection()
@@ -410,6 +1026,12 @@ namespace bts { namespace net {
       _message_connection.close_connection();
     }
 
+    void peer_connection::set_rate_limits(const std::shared_ptr<token_bucket>& shared_upload, const std::shared_ptr<token_bucket>& shared_download,
+                                          uint64_t upload_bytes_per_second, uint64_t download_bytes_per_second)
+    {
+      _message_connection.set_rate_limits(shared_upload, shared_download, upload_bytes_per_second, download_bytes_per_second);
+    }
+
     fc::optional<fc::ip::endpoint> peer_connection::get_remote_endpoint()
     {
       return _remote_endpoint;
@@ -421,7 +1043,8 @@ namespace bts { namespace net {
 
     bool peer_connection::busy() 
     { 
-      return !items_requested_from_peer.empty() || !sync_items_requested_from_peer.empty() || item_ids_requested_from_peer;
+      return !items_requested_from_peer.empty() || !sync_items_requested_from_peer.empty() || item_ids_requested_from_peer ||
+             block_headers_requested_from_peer;
     }
 
     bool peer_connection::idle()
@@ -435,11 +1058,35 @@ namespace bts { namespace net {
 
     node_impl::node_impl() : 
       _delegate(nullptr),
+      _delegate_thread(nullptr),
+      _maximum_sync_requests_per_peer(16),
+      _minimum_sync_request_timeout(fc::seconds(30)),
+      _headers_first_sync(true),
+      _maximum_sync_blocks_to_validate(64),
+      _next_transaction_sequence(0),
+      _maximum_transactions_to_validate(4096),
+      _maximum_transactions_to_validate_per_peer(256),
+      _transaction_validation_budget(fc::milliseconds(500)),
+      _transactions_dropped(0),
+      _inventory_trickle_interval(fc::seconds(2)),
+      _maximum_items_per_inventory_message(1000),
+      _message_compression(true),
+      _minimum_size_to_compress(1024),
+      _early_block_relay(true),
+      _ban_duration(fc::hours(24)),
+      _upload_limit(std::make_shared<token_bucket>()),
+      _download_limit(std::make_shared<token_bucket>()),
+      _decode_threads(&bts::db::executor::instance().pool("network")),
+      _minimum_size_to_decode_in_parallel(16 * 1024),
       _user_agent_string("bts::net::node"),
       _desired_number_of_connections(3),
       _maximum_number_of_connections(5),
+      _maximum_number_of_concurrent_dials(8),
+      _number_of_dials_in_progress(0),
+      _dial_timeout(fc::seconds(10)),
       _most_recent_blocks_accepted(_maximum_number_of_connections),
-      _total_number_of_unfetched_items(0)
+      _total_number_of_unfetched_items(0),
+      _handshake_failures(0)
     {
       fc::rand_pseudo_bytes(_node_id.data(), 20);
     }
@@ -479,21 +1126,23 @@ namespace bts { namespace net {
         ilog("Starting an iteration of p2p_network_connect_loop().");
         display_current_connections();
 
-        while (is_wanting_new_connections())
+        disconnect_from_stalled_handshakes();
+
+        while (can_start_another_dial())
         {
           bool initiated_connection_this_pass = false;
           _potential_peer_database_updated = false;
 
-          for ( peer_database::iterator iter = _potential_peer_db.begin();
-               iter != _potential_peer_db.end() && is_wanting_new_connections();
-               ++iter)
+          // peers we're connected or connecting to may be among the best candidates, ask for enough to skip them
+          size_t number_of_candidates = _maximum_number_of_concurrent_dials + _active_connections.size() + _handshaking_connections.size();
+          for (const potential_peer_record& candidate : _potential_peer_db.get_connection_candidates(number_of_candidates, fc::time_point::now()))
           {
-            ilog("Last attempt was ${time_distance} seconds ago (disposition: ${disposition})", ("time_distance", (fc::time_point::now() - iter->last_connection_attempt_time).count() / fc::seconds(1).count())("disposition", iter->last_connection_disposition));
-            if (!is_connection_to_endpoint_in_progress(iter->endpoint) &&
-                ((iter->last_connection_disposition != last_connection_failed && iter->last_connection_disposition != last_connection_rejected) ||
-                 iter->last_connection_attempt_time < fc::time_point::now() - fc::seconds(60 * 5)))
+            if (!can_start_another_dial())
+              break;
+            ilog("Last attempt was ${time_distance} seconds ago (disposition: ${disposition})", ("time_distance", (fc::time_point::now() - candidate.last_connection_attempt_time).count() / fc::seconds(1).count())("disposition", candidate.last_connection_disposition));
+            if (!is_connection_to_endpoint_in_progress(candidate.endpoint) && !is_banned(candidate.endpoint.get_address()))
             {
-              connect_to(iter->endpoint);
+              connect_to(candidate.endpoint);
               initiated_connection_this_pass = true;
             }
           }
@@ -516,6 +1165,11 @@ namespace bts { namespace net {
             ilog("Still want to connect to more nodes, but I don't have any good candidates.  Trying again in 15 seconds");
             _retrigger_connect_loop_promise->wait_until(fc::time_point::now() + fc::seconds(15));
           }
+          else if (!_handshaking_connections.empty())
+          {
+            // come back to disconnect from peers that never reply to our hello
+            _retrigger_connect_loop_promise->wait_until(fc::time_point::now() + _dial_timeout);
+          }
           else
           {
             ilog("I don't need any more connections, waiting forever until something changes");
@@ -540,8 +1194,17 @@ namespace bts { namespace net {
 
     bool node_impl::have_already_received_sync_item(const item_hash_t& item_hash)
     {
-      return std::find_if(_received_sync_items.begin(), _received_sync_items.end(), 
-                          [&item_hash](const bts::client::block_message& message) { return message.block_id == item_hash; }) != _received_sync_items.end();
+      return _received_sync_items.contains(item_hash);
+    }
+
+    void node_impl::forget_evicted_sync_items(const std::vector<bts::blockchain::block_id_type>& evicted_block_ids)
+    {
+      // evicted blocks are fetched again once the blocks before them have been processed
+      for (const bts::blockchain::block_id_type& block_id : evicted_block_ids)
+        _active_sync_requests.erase(block_id);
+      if (!evicted_block_ids.empty())
+        ilog("sync: dropped ${count} blocks from the backlog to stay under ${size} bytes", 
+             ("count", evicted_block_ids.size())("size", _received_sync_items.size_in_bytes()));
     }
 
     void node_impl::request_sync_item_from_peer(const peer_connection_ptr& peer, const item_hash_t& item_to_request)
@@ -553,6 +1216,75 @@ namespace bts { namespace net {
       peer->send_message(fetch_item_message(item_id_to_request));
     }
 
+    bool node_impl::is_syncing_headers_first(const peer_connection* peer) const
+    {
+      return _headers_first_sync && peer->core_protocol_version >= 2;
+    }
+
+    void node_impl::request_block_headers_from_peer(peer_connection* peer)
+    {
+      // one request at a time keeps the reply lined up with the unverified part of the list
+      if (!is_syncing_headers_first(peer) || peer->block_headers_requested_from_peer ||
+          peer->number_of_verified_item_ids >= peer->ids_of_items_to_get.size())
+        return;
+
+      auto first_unverified = peer->ids_of_items_to_get.begin() + peer->number_of_verified_item_ids;
+      size_t count = std::min<size_t>(peer->ids_of_items_to_get.end() - first_unverified, bts::client::maximum_block_headers_per_request);
+      bts::client::fetch_block_headers_message request;
+      request.block_ids.assign(first_unverified, first_unverified + count);
+
+      ilog("sync: requesting ${count} block headers from peer ${endpoint}", ("count", count)("endpoint", peer->get_remote_endpoint()));
+      peer->block_headers_requested_from_peer = fc::time_point::now();
+      peer->block_headers_request_is_stale = false;
+      peer->send_message(request);
+    }
+
+    void node_impl::expire_timed_out_sync_requests()
+    {
+      fc::time_point now = fc::time_point::now();
+      std::vector<peer_connection_ptr> peers_to_disconnect;
+      for (const peer_connection_ptr& peer : _active_connections)
+      {
+        // none of the peer's blocks can be fetched until it sends their headers
+        if (peer->block_headers_requested_from_peer &&
+            *peer->block_headers_requested_from_peer + _minimum_sync_request_timeout < now)
+        {
+          wlog("sync: request for block headers from peer ${endpoint} timed out, disconnecting from peer", ("endpoint", peer->get_remote_endpoint()));
+          peers_to_disconnect.push_back(peer);
+          continue;
+        }
+
+        // give slow peers a few of their own round trips before reassigning their requests
+        fc::microseconds timeout = std::max(_minimum_sync_request_timeout, 
+                                            fc::microseconds(peer->sync_round_trip_time.count() * 4));
+        for (auto iter = peer->sync_items_requested_from_peer.begin(); iter != peer->sync_items_requested_from_peer.end(); )
+        {
+          if (iter->second + timeout < now)
+          {
+            wlog("sync: request for ${item_hash} from peer ${endpoint} timed out, fetching it from another peer", 
+                 ("item_hash", iter->first.item_hash)("endpoint", peer->get_remote_endpoint()));
+            _active_sync_requests.erase(iter->first.item_hash);
+            peer->sync_items_reassigned_from_peer.insert(iter->first);
+            iter = peer->sync_items_requested_from_peer.erase(iter);
+            _sync_items_to_fetch_updated = true;
+          }
+          else
+            ++iter;
+        }
+      }
+      for (const peer_connection_ptr& peer : peers_to_disconnect)
+        disconnect_from_peer(peer.get());
+    }
+
+    /** the best scoring peer gets the full window, the others a share of it in proportion to their score */
+    uint32_t node_impl::get_sync_request_window(peer_connection* peer, uint64_t best_score)
+    {
+      if (best_score == 0)
+        return _maximum_sync_requests_per_peer;
+      uint64_t window = (_maximum_sync_requests_per_peer * peer->quality.score() + best_score - 1) / best_score;
+      return (uint32_t)std::max<uint64_t>(std::min<uint64_t>(window, _maximum_sync_requests_per_peer), 1);
+    }
+
     void node_impl::fetch_sync_items_loop()
     {
       for (;;)
@@ -560,31 +1292,72 @@ namespace bts { namespace net {
         _sync_items_to_fetch_updated = false;
         ilog("beginning another iteration of the sync items loop");
 
-        // for each idle peer that we're syncing with
+        expire_timed_out_sync_requests();
+
+        // once the backlog is full, only fetch the blocks we can process immediately,
+        // anything later would just be evicted again
+        bool backlog_full = _received_sync_items.is_full();
+
+        // the peers that have room in their download window, the best scoring are offered the earliest blocks
+        // and have the widest windows.  Peers we haven't measured yet score as an average peer so they get
+        // a chance to prove themselves
+        uint64_t best_score = 0;
+        for (const peer_connection_ptr& peer : _active_connections)
+          if (peer->we_need_sync_items_from_peer)
+            best_score = std::max(best_score, peer->quality.score());
+        std::vector<peer_connection_ptr> peers_with_room;
         for (const peer_connection_ptr& peer : _active_connections)
+          if (peer->we_need_sync_items_from_peer && peer->items_requested_from_peer.empty() &&
+              peer->sync_items_requested_from_peer.size() < get_sync_request_window(peer.get(), best_score))
+            peers_with_room.push_back(peer);
+        std::sort(peers_with_room.begin(), peers_with_room.end(), 
+                  [](const peer_connection_ptr& a, const peer_connection_ptr& b) { return a->quality.score() > b->quality.score(); });
+
+        for (const peer_connection_ptr& peer : peers_with_room)
         {
-          if (peer->we_need_sync_items_from_peer && peer->idle())
+          // loop through the items it has that we don't yet have on our blockchain, in order.
+          // When syncing headers-first, only those whose headers we've validated
+          size_t number_of_fetchable_items = is_syncing_headers_first(peer.get()) ? peer->number_of_verified_item_ids : peer->ids_of_items_to_get.size();
+          uint32_t window = get_sync_request_window(peer.get(), best_score);
+          for (unsigned i = 0; i < number_of_fetchable_items && (!backlog_full || i == 0) &&
+                               peer->sync_items_requested_from_peer.size() < window; ++i)
           {
-            // loop through the items it has that we don't yet have on our blockchain
-            for (unsigned i = 0; i < peer->ids_of_items_to_get.size(); ++i)
+            const item_hash_t& item_hash = peer->ids_of_items_to_get[i];
+            // if we don't already have this item in our temporary storage, we haven't requested it from another 
+            // syncing peer and this peer hasn't already failed to deliver it
+            if (!have_already_received_sync_item(item_hash) &&
+                _active_sync_requests.find(item_hash) == _active_sync_requests.end() &&
+                peer->sync_items_reassigned_from_peer.find(item_id(bts::client::block_message_type, item_hash)) == peer->sync_items_reassigned_from_peer.end())
             {
-              // if we don't already have this item in our temporary storage and we haven't requested from another syncing peer
-              if (!have_already_received_sync_item(peer->ids_of_items_to_get[i]) &&
-                  _active_sync_requests.find(peer->ids_of_items_to_get[i]) == _active_sync_requests.end())
-              {
-                // then request it from this peer
-                request_sync_item_from_peer(peer, peer->ids_of_items_to_get[i]);
-                break;
-              }
+              // then request it from this peer
+              request_sync_item_from_peer(peer, item_hash);
             }
           }
         }
+        bool requests_outstanding = false;
+        for (const peer_connection_ptr& peer : _active_connections)
+          if (!peer->sync_items_requested_from_peer.empty() || peer->block_headers_requested_from_peer)
+            requests_outstanding = true;
 
         if (!_sync_items_to_fetch_updated)
         {
-          ilog("no sync items to fetch right now, going to sleep");
           _retrigger_fetch_sync_items_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
-          _retrigger_fetch_sync_items_loop_promise->wait();
+          try
+          {
+            if (requests_outstanding)
+            {
+              // wake up periodically to reassign requests that have timed out
+              _retrigger_fetch_sync_items_loop_promise->wait_until(fc::time_point::now() + fc::seconds(1));
+            }
+            else
+            {
+              ilog("no sync items to fetch right now, going to sleep");
+              _retrigger_fetch_sync_items_loop_promise->wait();
+            }
+          }
+          catch (fc::timeout_exception&)
+          {
+          }
           _retrigger_fetch_sync_items_loop_promise.reset();
         }
       }
@@ -598,89 +1371,367 @@ namespace bts { namespace net {
         _retrigger_fetch_sync_items_loop_promise->set_value();
     }
 
-    void node_impl::fetch_items_loop()
+    /**
+     * Runs call on the delegate thread and waits for it.  Waiting yields this fiber, so the node
+     * keeps talking to its peers while the delegate works.
+     */
+    template<typename Functor>
+    auto node_impl::call_delegate(Functor&& call) -> decltype(call())
     {
-      for (;;)
-      {
-        _items_to_fetch_updated = false;
-        ilog("beginning an iteration of fetch items (${count} items to fetch)", ("count", _items_to_fetch.size()));
-
-        for (auto iter = _items_to_fetch.begin(); iter != _items_to_fetch.end(); )
-        {
-          bool item_fetched = false;
-          for (const peer_connection_ptr& peer : _active_connections)
-          {
-            if (peer->idle() &&
-                peer->inventory_peer_advertised_to_us.find(*iter) != peer->inventory_peer_advertised_to_us.end())
-            {
-              ilog("requesting item ${hash} from peer ${endpoint}", ("hash", iter->item_hash)("endpoint", peer->get_remote_endpoint()));
-              peer->items_requested_from_peer.insert(peer_connection::item_to_time_map_type::value_type(*iter, fc::time_point::now()));
-              item_id item_id_to_fetch = *iter;
-              iter = _items_to_fetch.erase(iter);
-              item_fetched = true;
-              peer->send_message(fetch_item_message(item_id_to_fetch));
-              break;
-            }
-          }
-          if (!item_fetched)
-            ++iter;
-        }
+      if (!_delegate_thread || _delegate_thread == &fc::thread::current())
+        return call();
+      return _delegate_thread->async(std::forward<Functor>(call)).wait();
+    }
 
-        if (!_items_to_fetch_updated)
-        {
-          _retrigger_fetch_item_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
-          _retrigger_fetch_item_loop_promise->wait();
-          _retrigger_fetch_item_loop_promise.reset();
-        }
-      }
+    /**
+     * Runs call on the next decode thread and waits for it, like call_delegate().  Calls from
+     * one peer's read loop are made one at a time so its messages are still handled in order.
+     */
+    template<typename Functor>
+    auto node_impl::run_on_decode_thread(Functor&& call) -> decltype(call())
+    {
+      if (!_decode_threads)
+        return call();
+      return _decode_threads->async(std::forward<Functor>(call)).wait();
     }
 
-    void node_impl::trigger_fetch_items_loop()
+    template<typename Functor>
+    auto node_impl::call_decoder(size_t message_size, Functor&& call) -> decltype(call())
     {
-      _items_to_fetch_updated = true;
-      if (_retrigger_fetch_item_loop_promise)
-        _retrigger_fetch_item_loop_promise->set_value();
+      if (message_size < _minimum_size_to_decode_in_parallel)
+        return call();
+      return run_on_decode_thread(std::forward<Functor>(call));
     }
 
-    void node_impl::advertise_inventory_loop()
+    template<typename MessageType>
+    MessageType node_impl::decode_message(const message& received_message)
     {
-      for (;;)
-      {
-        ilog("beginning an iteration of advertise inventory");
-        // swap inventory into local variable, clearing the node's copy
-        std::unordered_set<item_id> inventory_to_advertise;
-        inventory_to_advertise.swap(_new_inventory);
+      return call_decoder(received_message.size, [&]() { return received_message.as<MessageType>(); });
+    }
 
+    /** unpacks into result on the decoding thread, a large message isn't copied back from it */
+    template<typename MessageType>
+    void node_impl::decode_message(const message& received_message, MessageType& result)
+    {
+      call_decoder(received_message.size, [&]() { received_message.as(result); });
+    }
+
+    /** the time includes the trip to the delegate's thread, which is waiting for validation too */
+    template<typename MessageType>
+    void node_impl::call_delegate_handle_message(const MessageType& message_to_handle)
+    {
+      BTS_TRACE_SPAN("node::handle_message");
+      fc::time_point start_time = fc::time_point::now();
+      try
+      {
+        call_delegate([&]() { delegate_handle_message(message_to_handle); });
+      }
+      catch (...)
+      {
+        _handle_message_time.add_sample(fc::time_point::now() - start_time);
+        throw;
+      }
+      _handle_message_time.add_sample(fc::time_point::now() - start_time);
+    }
+
+    void node_impl::validate_sync_blocks_loop()
+    {
+      for (;;)
+      {
+        while (!_sync_blocks_to_validate.empty())
+        {
+          // the block stays in the queue while it is validated so that it is counted in the sync status.
+          // only this loop removes blocks, so the reference stays valid while others are appended
+          const queued_sync_block& block_to_validate = _sync_blocks_to_validate.front();
+          bool client_accepted_block = false;
+          try
+          {
+            call_delegate_handle_message(block_to_validate.block_message);
+            client_accepted_block = true;
+          }
+          catch (fc::exception& e)
+          {
+            wlog("sync: client rejected sync block sent by peer: ${e}", ("e", e.to_detail_string()));
+          }
+
+          if (client_accepted_block)
+          {
+            _sync_blocks_to_validate.pop_front();
+            report_sync_status(bts::client::block_message_type);
+            // there is room in the queue again, move the next blocks over from the backlog
+            process_backlog_of_sync_blocks();
+            trigger_fetch_sync_items_loop();
+          }
+          else
+            reject_queued_sync_blocks();
+        }
+
+        _retrigger_validate_sync_blocks_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
+        _retrigger_validate_sync_blocks_loop_promise->wait();
+        _retrigger_validate_sync_blocks_loop_promise.reset();
+      }
+    }
+
+    void node_impl::trigger_validate_sync_blocks_loop()
+    {
+      if (_retrigger_validate_sync_blocks_loop_promise)
+        _retrigger_validate_sync_blocks_loop_promise->set_value();
+    }
+
+    void node_impl::reject_queued_sync_blocks()
+    {
+      // every block after the rejected one builds upon it, so they are all invalid and so are
+      // the peers that offered them
+      std::set<peer_connection_ptr> peers_to_disconnect;
+      for (const queued_sync_block& queued_block : _sync_blocks_to_validate)
+      {
+        peers_to_disconnect.insert(queued_block.offered_by.begin(), queued_block.offered_by.end());
+        auto accepted_iter = std::find(_most_recent_blocks_accepted.begin(), _most_recent_blocks_accepted.end(), queued_block.block_message.block_id);
+        if (accepted_iter != _most_recent_blocks_accepted.end())
+          _most_recent_blocks_accepted.erase(accepted_iter);
+        ++_total_number_of_unfetched_items;
+      }
+      _sync_blocks_to_validate.clear();
+
+      for (const peer_connection_ptr& peer : peers_to_disconnect)
+        if (_active_connections.find(peer) != _active_connections.end())
+        {
+          wlog("disconnecting client ${endpoint} because it offered us the rejected block", ("endpoint", peer->get_remote_endpoint()));
+          ++peer->quality.number_of_invalid_items;
+          disconnect_from_peer(peer.get());
+        }
+    }
+
+    /**
+     * The checks of get_transaction_priority() are made right away, the full validation waits
+     * for validate_transactions_loop().  A peer can only have so many transactions in the queue.
+     */
+    void node_impl::queue_transaction(peer_connection* originating_peer, const message& transaction_message)
+    {
+      if (originating_peer->transactions_to_validate >= _maximum_transactions_to_validate_per_peer)
+      {
+        dlog("peer ${endpoint} is over its transaction budget, dropping a transaction", ("endpoint", originating_peer->get_remote_endpoint()));
+        ++_transactions_dropped;
+        return;
+      }
+
+      queued_transaction queued;
+      try
+      {
+        queued.priority = call_delegate([&]() { return _delegate->get_transaction_priority(transaction_message); });
+      }
+      catch (const fc::exception& e)
+      {
+        dlog("dropping transaction from peer ${endpoint}: ${e}", ("endpoint", originating_peer->get_remote_endpoint())("e", e.to_string()));
+        ++_transactions_dropped;
+        return;
+      }
+
+      if (_transactions_to_validate.size() >= _maximum_transactions_to_validate)
+      {
+        auto lowest = std::prev(_transactions_to_validate.end());
+        if (lowest->priority >= queued.priority)
+        {
+          ++_transactions_dropped;
+          return;
+        }
+        --lowest->received_from->transactions_to_validate;
+        _transactions_to_validate.erase(lowest);
+        ++_transactions_dropped;
+      }
+
+      queued.transaction_message = transaction_message;
+      queued.sequence = _next_transaction_sequence++;
+      queued.received_from = originating_peer->shared_from_this();
+      _transactions_to_validate.insert(std::move(queued));
+      ++originating_peer->transactions_to_validate;
+      trigger_validate_transactions_loop();
+    }
+
+    /**
+     * The delegate handles one call at a time, so a block arriving meanwhile waits for at most
+     * one transaction.  Transactions get no more than _transaction_validation_budget of the
+     * delegate's time per second, the rest waits in the queue.
+     */
+    void node_impl::validate_transactions_loop()
+    {
+      fc::time_point   budget_window_start = fc::time_point::now();
+      fc::microseconds budget_used;
+      for (;;)
+      {
+        while (!_transactions_to_validate.empty())
+        {
+          if (!_sync_blocks_to_validate.empty())
+          {
+            fc::usleep(fc::milliseconds(10));
+            continue;
+          }
+          fc::time_point now = fc::time_point::now();
+          if (now - budget_window_start >= fc::seconds(1))
+          {
+            budget_window_start = now;
+            budget_used = fc::microseconds();
+          }
+          else if (budget_used >= _transaction_validation_budget)
+          {
+            fc::usleep(budget_window_start + fc::seconds(1) - now);
+            continue;
+          }
+
+          queued_transaction next = *_transactions_to_validate.begin();
+          _transactions_to_validate.erase(_transactions_to_validate.begin());
+          --next.received_from->transactions_to_validate;
+
+          fc::time_point start_time = fc::time_point::now();
+          try
+          {
+            call_delegate_handle_message(next.transaction_message);
+            broadcast(next.transaction_message);
+          }
+          catch (const fc::exception& e)
+          {
+            // an honest peer relays transactions that were valid when it got them and have since been
+            // spent or expired, so a rejection alone doesn't count against it
+            wlog("client rejected transaction sent by peer ${peer}, ${e}", ("peer", next.received_from->get_remote_endpoint())("e", e.to_string()));
+          }
+          budget_used += fc::time_point::now() - start_time;
+        }
+
+        _retrigger_validate_transactions_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
+        _retrigger_validate_transactions_loop_promise->wait();
+        _retrigger_validate_transactions_loop_promise.reset();
+      }
+    }
+
+    void node_impl::trigger_validate_transactions_loop()
+    {
+      if (_retrigger_validate_transactions_loop_promise)
+        _retrigger_validate_transactions_loop_promise->set_value();
+    }
+
+    void node_impl::report_sync_status(uint32_t item_type)
+    {
+      call_delegate([&]() { _delegate->sync_status(item_type, _total_number_of_unfetched_items, _sync_blocks_to_validate.size()); });
+    }
+
+    void node_impl::fetch_items_loop()
+    {
+      for (;;)
+      {
+        _items_to_fetch_updated = false;
+        _items_to_fetch.expire(fc::time_point::now());
+        ilog("beginning an iteration of fetch items (${count} items to fetch)", ("count", _items_to_fetch.size()));
+
+        _items_to_fetch.request_items(
+          [&](const peer_connection_ptr& peer) {
+            return peer->idle() && _active_connections.find(peer) != _active_connections.end();
+          },
+          [&](const peer_connection_ptr& peer, const item_id& item_id_to_fetch) {
+            ilog("requesting item ${hash} from peer ${endpoint}", ("hash", item_id_to_fetch.item_hash)("endpoint", peer->get_remote_endpoint()));
+            peer->items_requested_from_peer.insert(peer_connection::item_to_time_map_type::value_type(item_id_to_fetch, fc::time_point::now()));
+            peer->send_message(fetch_item_message(item_id_to_fetch));
+          });
+
+        if (!_items_to_fetch_updated)
+        {
+          _retrigger_fetch_item_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
+          _retrigger_fetch_item_loop_promise->wait();
+          _retrigger_fetch_item_loop_promise.reset();
+        }
+      }
+    }
+
+    void node_impl::trigger_fetch_items_loop()
+    {
+      _items_to_fetch_updated = true;
+      if (_retrigger_fetch_item_loop_promise)
+        _retrigger_fetch_item_loop_promise->set_value();
+    }
+
+    void node_impl::advertise_inventory_loop()
+    {
+      std::vector<item_hash_t> item_hashes_to_send; // reused for every message
+      for (;;)
+      {
+        ilog("beginning an iteration of advertise inventory");
+        fc::time_point now = fc::time_point::now();
+
+        // queue the new items for the peers who are in sync with us, they go out with each peer's
+        // next trickle.  Blocks are time-critical, so they make every peer's trickle due now
+        bool new_inventory_includes_block = false;
+        for (const item_id& new_item : _new_inventory)
+          if (new_item.item_type == bts::client::block_message_type)
+            new_inventory_includes_block = true;
+        for (const peer_connection_ptr& peer : _active_connections)
+          if (!peer->peer_needs_sync_items_from_us && !peer->light_client_filter)
+          {
+            for (const item_id& new_item : _new_inventory)
+              peer->inventory_to_advertise.push_back(new_item);
+            if (new_inventory_includes_block)
+              peer->next_inventory_trickle_time = now;
+          }
+        _new_inventory.clear();
+
+        fc::time_point next_trickle_time = fc::time_point::maximum();
         for (const peer_connection_ptr& peer : _active_connections)
         {
-          // only advertise to peers who are in sync with us
-          if (!peer->peer_needs_sync_items_from_us)
+          if (peer->inventory_to_advertise.empty())
+            continue;
+          if (peer->next_inventory_trickle_time > now)
+          {
+            next_trickle_time = std::min(next_trickle_time, peer->next_inventory_trickle_time);
+            continue;
+          }
+
+          // one inventory message per type, so group the items by type
+          std::sort(peer->inventory_to_advertise.begin(), peer->inventory_to_advertise.end(),
+                    [](const item_id& a, const item_id& b) { return a.item_type < b.item_type; });
+          unsigned total_items_sent_to_this_peer = 0;
+          for (auto iter = peer->inventory_to_advertise.begin(); iter != peer->inventory_to_advertise.end(); ++iter)
           {
-            std::map<uint32_t, std::vector<item_hash_t> > items_to_advertise_by_type;
             // don't send the peer anything we've already advertised to it
-            // or anything it has advertised to us
-            // group the items we need to send by type, because we'll need to send one inventory message per type
-            unsigned total_items_to_send_to_this_peer = 0;
-            for (const item_id& item_to_advertise : inventory_to_advertise)
-              if (peer->inventory_advertised_to_peer.find(item_to_advertise) == peer->inventory_advertised_to_peer.end() &&
-                  peer->inventory_peer_advertised_to_us.find(item_to_advertise) == peer->inventory_peer_advertised_to_us.end())
-              {
-                items_to_advertise_by_type[item_to_advertise.item_type].push_back(item_to_advertise.item_hash);
-                peer->inventory_advertised_to_peer.insert(item_to_advertise);
-                ++total_items_to_send_to_this_peer;
-                ilog("advertising item ${id} to peer ${endpoint}", ("id", item_to_advertise.item_hash)("endpoint", peer->get_remote_endpoint()));
-              }
-              ilog("advertising ${count} new item(s) of ${types} type(s) to peer ${endpoint}", 
-                   ("count", total_items_to_send_to_this_peer)("types", items_to_advertise_by_type.size())("endpoint", peer->get_remote_endpoint()));
-            for (auto items_group : items_to_advertise_by_type)
-              peer->send_message(item_ids_inventory_message(items_group.first, items_group.second));
+            // or anything it has advertised to us, even while it was queued
+            if (!peer->inventory_advertised_to_peer.contains(*iter) &&
+                !peer->inventory_peer_advertised_to_us.contains(*iter))
+            {
+              peer->inventory_advertised_to_peer.insert(*iter);
+              item_hashes_to_send.push_back(iter->item_hash);
+              ++total_items_sent_to_this_peer;
+            }
+            auto next_iter = std::next(iter);
+            if (!item_hashes_to_send.empty() &&
+                (next_iter == peer->inventory_to_advertise.end() || next_iter->item_type != iter->item_type ||
+                 item_hashes_to_send.size() >= _maximum_items_per_inventory_message))
+            {
+              peer->send_message(item_ids_inventory_message(iter->item_type, item_hashes_to_send));
+              item_hashes_to_send.clear();
+            }
           }
+          ilog("advertising ${count} new item(s) to peer ${endpoint}", 
+               ("count", total_items_sent_to_this_peer)("endpoint", peer->get_remote_endpoint()));
+          peer->inventory_to_advertise.clear();
+
+          // jitter each peer's interval so we don't reveal which peer gave us an item by telling
+          // everyone at once, and so the sends are spread out
+          uint64_t jitter;
+          fc::rand_pseudo_bytes((char*)&jitter, sizeof(jitter));
+          int64_t interval = _inventory_trickle_interval.count();
+          peer->next_inventory_trickle_time = now + fc::microseconds(interval / 2 + (interval > 0 ? int64_t(jitter % uint64_t(interval)) : 0));
         }
 
         if (_new_inventory.empty())
         {
           _retrigger_advertise_inventory_loop_promise = fc::promise<void>::ptr(new fc::promise<void>());
-          _retrigger_advertise_inventory_loop_promise->wait();
+          try
+          {
+            if (next_trickle_time != fc::time_point::maximum())
+              _retrigger_advertise_inventory_loop_promise->wait_until(next_trickle_time);
+            else
+              _retrigger_advertise_inventory_loop_promise->wait();
+          }
+          catch (fc::timeout_exception&)
+          {
+          }
           _retrigger_advertise_inventory_loop_promise.reset();
         }
       }
@@ -702,6 +1753,35 @@ namespace bts { namespace net {
       return get_number_of_connections() < _desired_number_of_connections;
     }
 
+    /**
+     * Dials aren't limited to the connections we are missing, some of them will fail or stall.
+     * Any extra successes stay connected, up to the maximum number of connections
+     */
+    bool node_impl::can_start_another_dial()
+    {
+      return _active_connections.size() < _desired_number_of_connections &&
+             get_number_of_connections() < _maximum_number_of_connections &&
+             _number_of_dials_in_progress < _maximum_number_of_concurrent_dials;
+    }
+
+    void node_impl::disconnect_from_stalled_handshakes()
+    {
+      std::vector<peer_connection_ptr> stalled_peers;
+      for (const peer_connection_ptr& peer : _handshaking_connections)
+        if (peer->direction == peer_connection_direction::outbound &&
+            peer->state == peer_connection::hello_sent &&
+            peer->hello_sent_time < fc::time_point::now() - _dial_timeout)
+          stalled_peers.push_back(peer);
+      for (const peer_connection_ptr& peer : stalled_peers)
+      {
+        wlog("peer ${endpoint} didn't reply to our hello in time, disconnecting", ("endpoint", peer->get_remote_endpoint()));
+        ++_handshake_failures;
+        disconnect_from_peer(peer.get());
+      }
+      if (!stalled_peers.empty())
+        trigger_p2p_network_connect_loop();
+    }
+
     uint32_t node_impl::get_number_of_connections()
     {
       return _handshaking_connections.size() + _active_connections.size();
@@ -729,6 +1809,54 @@ namespace bts { namespace net {
       return false;
     }
 
+    /**
+     * an outbound peer is known by the endpoint we dialed, an inbound one by the address it connected
+     * from and the port it said it listens on.  The address is the one we saw, so a peer can't take
+     * over the history of another by claiming its endpoint in its hello
+     */
+    fc::ip::endpoint node_impl::get_peer_database_endpoint(peer_connection* peer)
+    {
+      fc::optional<fc::ip::endpoint> remote_endpoint = peer->get_remote_endpoint();
+      if (!remote_endpoint)
+        return peer->inbound_endpoint;
+      if (peer->direction == peer_connection_direction::inbound)
+        return fc::ip::endpoint(remote_endpoint->get_address(), peer->inbound_endpoint.port());
+      return *remote_endpoint;
+    }
+
+    void node_impl::load_peer_quality(peer_connection* peer)
+    {
+      peer->quality = _potential_peer_db.lookup_or_create_entry_for_endpoint(get_peer_database_endpoint(peer)).quality;
+    }
+
+    void node_impl::save_peer_quality(peer_connection* peer)
+    {
+      potential_peer_record updated_peer_record = _potential_peer_db.lookup_or_create_entry_for_endpoint(get_peer_database_endpoint(peer));
+      updated_peer_record.quality = peer->quality;
+      _potential_peer_db.update_entry(updated_peer_record);
+    }
+
+    /**
+     * When we are full, the peer choose_peer_to_evict picks is disconnected to make room for the candidate
+     * @return true if a peer was disconnected
+     */
+    bool node_impl::evict_peer_worse_than(const peer_quality& candidate)
+    {
+      std::vector<peer_connection_ptr> active_peers(_active_connections.begin(), _active_connections.end());
+      std::vector<peer_quality> active_qualities;
+      active_qualities.reserve(active_peers.size());
+      for (const peer_connection_ptr& peer : active_peers)
+        active_qualities.push_back(peer->quality);
+      size_t worst_peer_index = choose_peer_to_evict(active_qualities, candidate);
+      if (worst_peer_index == active_peers.size())
+        return false;
+      const peer_connection_ptr& worst_peer = active_peers[worst_peer_index];
+      ilog("disconnecting from peer ${endpoint} with a score of ${score} to make room for a peer with a score of ${candidate}",
+           ("endpoint", worst_peer->get_remote_endpoint())("score", worst_peer->quality.score())("candidate", candidate.score()));
+      disconnect_from_peer(worst_peer.get());
+      return true;
+    }
+
     // merge addresses received from a peer into our database
     bool node_impl::merge_address_info_with_potential_peer_database(const std::vector<address_info> addresses)
     {
@@ -763,45 +1891,100 @@ namespace bts { namespace net {
 
     void node_impl::on_message(peer_connection* originating_peer, const message& received_message)
     {
-      message_hash_type message_hash = received_message.id();
+      // hashed and handled as the message that was compressed, which can't be compressed again
+      if (received_message.msg_type == core_message_type_enum::compressed_message_type)
+      {
+        // peers only compress for us after both hellos said they can unpack them
+        if (!(local_connection_capabilities() & zlib_compressed_messages) ||
+            !(originating_peer->connection_capabilities & zlib_compressed_messages))
+          FC_THROW_EXCEPTION(exception, "compressed message from a peer that did not negotiate compression");
+        message decompressed = call_decoder(received_message.size, [&]() {
+          compressed_message compressed = received_message.as<compressed_message>();
+          uint64_t maximum_size = uint64_t(compressed.compressed_data.size()) * MAXIMUM_COMPRESSION_RATIO;
+          return decompress_message(compressed, uint32_t(std::min<uint64_t>(maximum_size, std::numeric_limits<uint32_t>::max())));
+        });
+        FC_ASSERT(decompressed.msg_type == bts::client::block_message_type ||
+                  decompressed.msg_type == core_message_type_enum::blockchain_item_ids_inventory_message_type,
+                  "only blocks and blockchain inventories are compressed");
+        on_message(originating_peer, decompressed);
+        return;
+      }
+
+      message_hash_type message_hash = call_decoder(received_message.size, [&]() { return received_message.id(); });
+
+      if (received_message.msg_type == bts::client::message_type_enum::block_message_type)
+      {
+        // sync blocks are processed even if we have them, they move the peer's sync state along
+        if (!originating_peer->we_need_sync_items_from_peer && 
+            drop_duplicate_item(originating_peer, item_id(received_message.msg_type, message_hash)))
+          return;
+        bts::client::block_message block_message_received;
+        decode_message(received_message, block_message_received);
+        if (originating_peer->we_need_sync_items_from_peer)
+          process_block_during_sync(originating_peer, received_message, message_hash, std::move(block_message_received));
+        else
+          process_block_during_normal_operation(originating_peer, received_message, message_hash, block_message_received);
+        return;
+      }
+
       //ilog("handling message ${hash} size ${size} from peer ${endpoint}", ("hash", message_hash)("size", received_message.size)("endpoint", originating_peer->get_remote_endpoint()));
       switch (received_message.msg_type)
       {
       case core_message_type_enum::hello_message_type:
-        on_hello_message(originating_peer, received_message.as<hello_message>());
+        originating_peer->connection_capabilities = unpack_capabilities<hello_message>(received_message);
+        on_hello_message(originating_peer, decode_message<hello_message>(received_message));
         break;
       case core_message_type_enum::hello_reply_message_type:
-        on_hello_reply_message(originating_peer, received_message.as<hello_reply_message>());
+        originating_peer->connection_capabilities = unpack_capabilities<hello_reply_message>(received_message);
+        on_hello_reply_message(originating_peer, decode_message<hello_reply_message>(received_message));
         break;
       case core_message_type_enum::connection_rejected_message_type:
-        on_connection_rejected_message(originating_peer, received_message.as<connection_rejected_message>());
+        on_connection_rejected_message(originating_peer, decode_message<connection_rejected_message>(received_message));
         break;
       case core_message_type_enum::address_request_message_type:
-        on_address_request_message(originating_peer, received_message.as<address_request_message>());
+        on_address_request_message(originating_peer, decode_message<address_request_message>(received_message));
         break;
       case core_message_type_enum::address_message_type:
-        on_address_message(originating_peer, received_message.as<address_message>());
+        on_address_message(originating_peer, decode_message<address_message>(received_message));
         break;
       case core_message_type_enum::fetch_blockchain_item_ids_message_type:
-        on_fetch_blockchain_item_ids_message(originating_peer, received_message.as<fetch_blockchain_item_ids_message>());
+        on_fetch_blockchain_item_ids_message(originating_peer, decode_message<fetch_blockchain_item_ids_message>(received_message));
         break;
       case core_message_type_enum::blockchain_item_ids_inventory_message_type:
-        on_blockchain_item_ids_inventory_message(originating_peer, received_message.as<blockchain_item_ids_inventory_message>());
+        on_blockchain_item_ids_inventory_message(originating_peer, decode_message<blockchain_item_ids_inventory_message>(received_message));
         break;
       case core_message_type_enum::fetch_item_message_type:
-        on_fetch_item_message(originating_peer, received_message.as<fetch_item_message>());
+        on_fetch_item_message(originating_peer, decode_message<fetch_item_message>(received_message));
         break;
       case core_message_type_enum::item_not_available_message_type:
-        on_item_not_available_message(originating_peer, received_message.as<item_not_available_message>());
+        on_item_not_available_message(originating_peer, decode_message<item_not_available_message>(received_message));
         break;
       case core_message_type_enum::item_ids_inventory_message_type:
-        on_item_ids_inventory_message(originating_peer, received_message.as<item_ids_inventory_message>());
+        on_item_ids_inventory_message(originating_peer, decode_message<item_ids_inventory_message>(received_message));
         break;
-      case bts::client::message_type_enum::block_message_type:
-        if (originating_peer->we_need_sync_items_from_peer)
-          process_block_during_sync(originating_peer, received_message, message_hash);
-        else
-          process_block_during_normal_operation(originating_peer, received_message, message_hash);
+      case bts::client::message_type_enum::fetch_block_headers_message_type:
+        on_fetch_block_headers_message(originating_peer, decode_message<bts::client::fetch_block_headers_message>(received_message));
+        break;
+      case bts::client::message_type_enum::block_headers_message_type:
+        on_block_headers_message(originating_peer, decode_message<bts::client::block_headers_message>(received_message));
+        break;
+      case bts::client::message_type_enum::compact_block_message_type:
+        on_compact_block_message(originating_peer, decode_message<bts::client::compact_block_message>(received_message));
+        break;
+      case bts::client::message_type_enum::fetch_block_transactions_message_type:
+        on_fetch_block_transactions_message(originating_peer, decode_message<bts::client::fetch_block_transactions_message>(received_message));
+        break;
+      case bts::client::message_type_enum::block_transactions_message_type:
+        on_block_transactions_message(originating_peer, decode_message<bts::client::block_transactions_message>(received_message));
+        break;
+      case core_message_type_enum::filter_load_message_type:
+        on_filter_load_message(originating_peer, decode_message<filter_load_message>(received_message));
+        break;
+      case core_message_type_enum::filter_add_message_type:
+        on_filter_add_message(originating_peer, decode_message<filter_add_message>(received_message));
+        break;
+      case core_message_type_enum::merkle_block_message_type:
+        on_merkle_block_message(originating_peer, decode_message<merkle_block_message>(received_message));
         break;
       default:
         process_unrecognized_message(originating_peer, received_message, message_hash);
@@ -826,6 +2009,15 @@ namespace bts { namespace net {
       if (originating_peer->state == peer_connection::secure_connection_established && 
           originating_peer->direction == peer_connection_direction::inbound)
       {
+        if (is_banned(originating_peer->get_socket().remote_endpoint().get_address()))
+        {
+          ilog("Received a hello_message from banned peer ${peer}, disconnecting", ("peer", originating_peer->get_remote_endpoint()));
+          disconnect_from_peer(originating_peer);
+          return;
+        }
+        // when we are full, a peer that did much better than our worst one the last time takes its place
+        if (!is_accepting_new_connections() && !already_connected_to_this_peer)
+          evict_peer_worse_than(_potential_peer_db.lookup_or_create_entry_for_endpoint(get_peer_database_endpoint(originating_peer)).quality);
         if (!is_accepting_new_connections())
         {
           connection_rejected_message connection_rejected(_user_agent_string, core_protocol_version, originating_peer->get_socket().remote_endpoint());
@@ -848,7 +2040,9 @@ namespace bts { namespace net {
 
           hello_reply_message hello_reply(_user_agent_string, core_protocol_version, originating_peer->get_socket().remote_endpoint(), _node_id);
           originating_peer->state = peer_connection::hello_reply_sent;
-          originating_peer->send_message(message(hello_reply));
+          originating_peer->send_message(pack_with_capabilities(hello_reply, local_connection_capabilities()));
+          if (originating_peer->core_protocol_version >= 4)
+            originating_peer->enable_authenticated_records();
           ilog("Received a hello_message from peer ${peer}, sending reply to accept connection", ("peer", originating_peer->get_remote_endpoint()));
         }
       }
@@ -878,6 +2072,8 @@ namespace bts { namespace net {
           ilog("Received a reply to my \"hello\" from ${peer}, connection is accepted", ("peer", originating_peer->get_remote_endpoint()));
           ilog("Remote server sees my connection as ${endpoint}", ("endpoint", hello_reply_message_received.remote_endpoint));
           originating_peer->state = peer_connection::connected;
+          if (originating_peer->core_protocol_version >= 4)
+            originating_peer->enable_authenticated_records();
           originating_peer->send_message(address_request_message());
         }
       }
@@ -891,6 +2087,7 @@ namespace bts { namespace net {
           originating_peer->direction == peer_connection_direction::outbound)
       {
         ilog("Received a rejection in response to my \"hello\"");
+        ++_handshake_failures;
 
         // update our database to record that we were rejected so we won't try to connect again for a while
         potential_peer_record updated_peer_record = _potential_peer_db.lookup_or_create_entry_for_endpoint(originating_peer->get_socket().remote_endpoint());
@@ -940,8 +2137,8 @@ namespace bts { namespace net {
                                                          const fetch_blockchain_item_ids_message& fetch_blockchain_item_ids_message_received)
     {
       blockchain_item_ids_inventory_message reply_message;
-      reply_message.item_hashes_available = _delegate->get_item_ids(fetch_blockchain_item_ids_message_received.last_item_seen,
-                                                                    reply_message.total_remaining_item_count);
+      reply_message.item_hashes_available = call_delegate([&]() { return _delegate->get_item_ids(fetch_blockchain_item_ids_message_received.last_item_seen,
+                                                                                                 reply_message.total_remaining_item_count); });
       reply_message.item_type = fetch_blockchain_item_ids_message_received.last_item_seen.item_type;
 
       ilog("sync: received a request for item ids after ${last_item_seen} from peer ${peer_endpoint}", 
@@ -956,7 +2153,7 @@ namespace bts { namespace net {
         // if we thought we had all the items this peer had, but it now appears 
         // that we don't, we need to kick off another round of synchronization
         if (!originating_peer->we_need_sync_items_from_peer &&
-            !_delegate->has_item(fetch_blockchain_item_ids_message_received.last_item_seen))
+            !call_delegate([&]() { return _delegate->has_item(fetch_blockchain_item_ids_message_received.last_item_seen); }))
           start_synchronizing_with_peer(originating_peer->shared_from_this());
       }
       else
@@ -1002,6 +2199,9 @@ namespace bts { namespace net {
       // ignore unless we asked for the data
       if (originating_peer->item_ids_requested_from_peer)
       {
+        // the first item in the reply follows this one, unless we flush it below
+        item_hash_t item_preceding_received_items = originating_peer->item_ids_requested_from_peer->get<0>().item_hash;
+        originating_peer->quality.add_round_trip_time(fc::time_point::now() - originating_peer->item_ids_requested_from_peer->get<1>());
         originating_peer->item_ids_requested_from_peer.reset();
 
         ilog("sync: received a list of ${count} available items from ${peer_endpoint}", 
@@ -1046,27 +2246,37 @@ namespace bts { namespace net {
           if (!is_first_item_for_other_peer)
           {
             while (!item_hashes_received.empty() && 
-                   _delegate->has_item(item_id(blockchain_item_ids_inventory_message_received.item_type,
-                                               item_hashes_received.front())))
+                   call_delegate([&]() { return _delegate->has_item(item_id(blockchain_item_ids_inventory_message_received.item_type,
+                                                                            item_hashes_received.front())); }))
+            {
+              item_preceding_received_items = item_hashes_received.front();
               item_hashes_received.pop_front();
+            }
             ilog("after removing all items we have already seen, item_hashes_received.size() = ${size}", ("size", item_hashes_received.size()));
           }
         }
 
+        // a new list starts a new header chain, it has to link to the item before it
+        if (originating_peer->ids_of_items_to_get.empty() && !item_hashes_received.empty())
+        {
+          originating_peer->number_of_verified_item_ids = 0;
+          originating_peer->last_verified_item_id = item_preceding_received_items;
+        }
+
         // append the remaining items to the peer's list
         std::copy(item_hashes_received.begin(), item_hashes_received.end(),
                   std::back_inserter(originating_peer->ids_of_items_to_get));
         originating_peer->number_of_unfetched_item_ids = blockchain_item_ids_inventory_message_received.total_remaining_item_count;
+        request_block_headers_from_peer(originating_peer);
 
         uint32_t new_number_of_unfetched_items = calculate_unsynced_block_count_from_all_peers();
         if (new_number_of_unfetched_items != _total_number_of_unfetched_items)
         {
-          _delegate->sync_status(blockchain_item_ids_inventory_message_received.item_type,
-                                 _total_number_of_unfetched_items);
           _total_number_of_unfetched_items = new_number_of_unfetched_items;
+          report_sync_status(blockchain_item_ids_inventory_message_received.item_type);
         }
         else if (new_number_of_unfetched_items == 0)
-          _delegate->sync_status(blockchain_item_ids_inventory_message_received.item_type, 0);
+          report_sync_status(blockchain_item_ids_inventory_message_received.item_type);
         
         if (blockchain_item_ids_inventory_message_received.total_remaining_item_count != 0)
         {
@@ -1115,11 +2325,16 @@ namespace bts { namespace net {
       ilog("received item request for id ${id} from peer ${endpoint}", ("id", fetch_item_message_received.item_to_fetch.item_hash)("endpoint", originating_peer->get_remote_endpoint()));
       try
       {
-        message requested_message = _message_cache.get_message(fetch_item_message_received.item_to_fetch.item_hash);
+        const message& requested_message = _message_cache.get_message(fetch_item_message_received.item_to_fetch.item_hash);
         ilog("received item request for item ${id} from peer ${endpoint}, returning the item from my message cache",
              ("endpoint", originating_peer->get_remote_endpoint())
              ("id", requested_message.id()));
-        originating_peer->send_message(requested_message);
+        // a block we're relaying, the peer has probably received most of its transactions already
+        if (requested_message.msg_type == bts::client::block_message_type && originating_peer->core_protocol_version >= 3)
+          originating_peer->send_message(bts::client::compact_block_message(requested_message.as<bts::client::block_message>(),
+                                                                            fetch_item_message_received.item_to_fetch.item_hash));
+        else
+          originating_peer->send_message(requested_message);
         return;
       }
       catch (fc::key_not_found_exception&)
@@ -1128,7 +2343,7 @@ namespace bts { namespace net {
 
       try
       {
-        message requested_message = _delegate->get_item(fetch_item_message_received.item_to_fetch);
+        message requested_message = call_delegate([&]() { return _delegate->get_item(fetch_item_message_received.item_to_fetch); });
         ilog("received item request from peer ${endpoint}, returning the item from delegate with id ${id} size ${size}",
              ("id", requested_message.id())
              ("size", requested_message.size)
@@ -1155,14 +2370,16 @@ namespace bts { namespace net {
       {
         originating_peer->items_requested_from_peer.erase(regular_item_iter);
         ilog("Peer doesn't have the requested item.");
+        _items_to_fetch.request_failed(item_not_available_message_received.requested_item, originating_peer);
         trigger_fetch_items_loop();
         return;
-        // TODO: reschedule fetching this item from a different peer
       }
 
       auto sync_item_iter = originating_peer->sync_items_requested_from_peer.find(item_not_available_message_received.requested_item);
       if (sync_item_iter != originating_peer->sync_items_requested_from_peer.end())
       {
+        _active_sync_requests.erase(sync_item_iter->first.item_hash);
+        originating_peer->sync_items_reassigned_from_peer.insert(sync_item_iter->first);
         originating_peer->sync_items_requested_from_peer.erase(sync_item_iter);
         ilog("Peer doesn't have the requested sync item.  This reqlly shouldn't happen");
         trigger_fetch_sync_items_loop();
@@ -1176,14 +2393,36 @@ namespace bts { namespace net {
     {
       ilog("received inventory of ${count} items from peer ${endpoint}", 
            ("count", item_ids_inventory_message_received.item_hashes_available.size())("endpoint", originating_peer->get_remote_endpoint()));
+
+      // items we've cached or the delegate already has are never fetched, the delegate is asked
+      // about all the new ones in one call
+      std::vector<item_hash_t> new_item_hashes;
+      new_item_hashes.reserve(item_ids_inventory_message_received.item_hashes_available.size());
+      for (const item_hash_t& item_hash : item_ids_inventory_message_received.item_hashes_available)
+        if (!_message_cache.contains(item_hash) && 
+            !_items_to_fetch.contains(item_id(item_ids_inventory_message_received.item_type, item_hash)))
+          new_item_hashes.push_back(item_hash);
+      bts::blockchain::flat_hash_set<item_hash_t, keyed_hash<item_hash_t> > item_hashes_we_have;
+      if (!new_item_hashes.empty())
+        call_delegate([&]() {
+          for (const item_hash_t& item_hash : new_item_hashes)
+            if (_delegate->has_item(item_id(item_ids_inventory_message_received.item_type, item_hash)))
+              item_hashes_we_have.insert(item_hash);
+        });
+
       for (const item_hash_t& item_hash : item_ids_inventory_message_received.item_hashes_available)
       {
         item_id advertised_item_id(item_ids_inventory_message_received.item_type, item_hash);
+        if (_message_cache.contains(item_hash) || item_hashes_we_have.find(item_hash) != item_hashes_we_have.end())
+        {
+          originating_peer->inventory_peer_advertised_to_us.insert(advertised_item_id); // so we don't advertise it back
+          continue;
+        }
         bool we_advertised_this_item_to_a_peer = false;
         bool we_requested_this_item_from_a_peer = false;
         for (const peer_connection_ptr peer : _active_connections)
         {
-          if (peer->inventory_advertised_to_peer.find(advertised_item_id) != peer->inventory_advertised_to_peer.end())
+          if (peer->inventory_advertised_to_peer.contains(advertised_item_id))
           {
             we_advertised_this_item_to_a_peer = true;
             break;
@@ -1196,11 +2435,12 @@ namespace bts { namespace net {
         if (!we_advertised_this_item_to_a_peer)
         {
           originating_peer->inventory_peer_advertised_to_us.insert(advertised_item_id);
-          if (!we_requested_this_item_from_a_peer)
+          // an item that is already queued gets another source in case its request fails
+          if (!we_requested_this_item_from_a_peer || _items_to_fetch.contains(advertised_item_id))
           {
             ilog("adding item ${item_hash} from inventory message to our list of items to fetch",
                  ("item_hash", item_hash));
-            _items_to_fetch.push_back(advertised_item_id);
+            _items_to_fetch.add(advertised_item_id, originating_peer->shared_from_this());
             trigger_fetch_items_loop();
           }
         }
@@ -1208,190 +2448,509 @@ namespace bts { namespace net {
       
     }
 
+    void node_impl::on_fetch_block_headers_message(peer_connection* originating_peer,
+                                                   const bts::client::fetch_block_headers_message& fetch_block_headers_message_received)
+    {
+      ilog("sync: received a request for ${count} block headers from peer ${endpoint}", 
+           ("count", fetch_block_headers_message_received.block_ids.size())("endpoint", originating_peer->get_remote_endpoint()));
+      // each id costs us a block lookup, so a peer can't make one request do unbounded work
+      if (fetch_block_headers_message_received.block_ids.size() > bts::client::maximum_block_headers_per_request)
+      {
+        wlog("peer ${endpoint} requested ${count} block headers, more than the ${max} allowed, disconnecting from peer",
+             ("endpoint", originating_peer->get_remote_endpoint())("count", fetch_block_headers_message_received.block_ids.size())
+             ("max", bts::client::maximum_block_headers_per_request));
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+      bts::client::block_headers_message reply_message;
+      reply_message.headers = call_delegate([&]() { return _delegate->get_block_headers(fetch_block_headers_message_received.block_ids); });
+      originating_peer->send_message(reply_message);
+    }
+
+    void node_impl::on_block_headers_message(peer_connection* originating_peer,
+                                             const bts::client::block_headers_message& block_headers_message_received)
+    {
+      if (!originating_peer->block_headers_requested_from_peer)
+      {
+        wlog("received block headers I didn't ask for from peer ${endpoint}, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+      originating_peer->quality.add_round_trip_time(fc::time_point::now() - *originating_peer->block_headers_requested_from_peer);
+      originating_peer->block_headers_requested_from_peer.reset();
+
+      const std::vector<bts::blockchain::signed_block_header>& headers = block_headers_message_received.headers;
+      try
+      {
+        FC_ASSERT(headers.size() <= bts::client::maximum_block_headers_per_request, "peer sent more headers than one request can ask for");
+        // check that the headers are the ones we asked for and form a chain, this is cheap so do it
+        // before asking the delegate to check the signatures
+        if (!originating_peer->block_headers_request_is_stale)
+        {
+          FC_ASSERT(!headers.empty(), "peer has no headers for the blocks it offered us");
+          FC_ASSERT(originating_peer->number_of_verified_item_ids + headers.size() <= originating_peer->ids_of_items_to_get.size(),
+                    "peer sent more headers than we asked for");
+          fc::optional<item_hash_t> previous_id = originating_peer->last_verified_item_id;
+          for (size_t i = 0; i < headers.size(); ++i)
+          {
+            FC_ASSERT(!previous_id || headers[i].prev == *previous_id, "header ${num} does not link to the block before it", ("num", headers[i].block_num));
+            FC_ASSERT(i == 0 || headers[i].block_num == headers[i - 1].block_num + 1, "header ${num} is out of sequence", ("num", headers[i].block_num));
+            previous_id = headers[i].id();
+            FC_ASSERT(*previous_id == originating_peer->ids_of_items_to_get[originating_peer->number_of_verified_item_ids + i],
+                      "header ${num} is not for the block the peer offered us", ("num", headers[i].block_num));
+          }
+          call_delegate([&]() { for (const bts::blockchain::signed_block_header& header : headers) _delegate->validate_block_header(header); });
+        }
+      }
+      catch (const fc::exception& e)
+      {
+        wlog("peer ${endpoint} sent us invalid block headers, disconnecting from peer: ${e}", 
+             ("endpoint", originating_peer->get_remote_endpoint())("e", e.to_detail_string()));
+        ++originating_peer->quality.number_of_invalid_items;
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+
+      // the list may have moved while the headers were being fetched or validated, if it did we
+      // just ask again for whatever is still unverified
+      if (!originating_peer->block_headers_request_is_stale)
+      {
+        originating_peer->number_of_verified_item_ids += headers.size();
+        originating_peer->last_verified_item_id = originating_peer->ids_of_items_to_get[originating_peer->number_of_verified_item_ids - 1];
+        ilog("sync: validated ${count} block headers from peer ${endpoint}, ${verified} of its blocks can be fetched", 
+             ("count", headers.size())("endpoint", originating_peer->get_remote_endpoint())("verified", originating_peer->number_of_verified_item_ids));
+        trigger_fetch_sync_items_loop();
+      }
+      request_block_headers_from_peer(originating_peer);
+    }
+
+    void node_impl::on_compact_block_message(peer_connection* originating_peer,
+                                             const bts::client::compact_block_message& compact_block_message_received)
+    {
+      item_id block_item_id(bts::client::block_message_type, compact_block_message_received.block_message_hash);
+      if (originating_peer->items_requested_from_peer.find(block_item_id) == originating_peer->items_requested_from_peer.end() ||
+          originating_peer->compact_block_awaiting_transactions)
+      {
+        wlog("received a compact block I didn't ask for from peer ${endpoint}, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+
+      pending_compact_block pending;
+      pending.compact_block = compact_block_message_received;
+      pending.requested_all_transactions = false;
+      pending.trxs = call_delegate([&]() { return _delegate->get_transactions_by_short_id(compact_block_message_received.block_id, 
+                                                                                          compact_block_message_received.short_trx_ids); });
+      pending.trxs.resize(compact_block_message_received.short_trx_ids.size());
+      originating_peer->compact_block_awaiting_transactions = pending;
+      finish_compact_block(originating_peer);
+    }
+
+    void node_impl::on_fetch_block_transactions_message(peer_connection* originating_peer,
+                                                        const bts::client::fetch_block_transactions_message& fetch_block_transactions_message_received)
+    {
+      // we only send compact blocks from the message cache, so that's where the full block is
+      bts::client::block_transactions_message reply_message;
+      reply_message.block_message_hash = fetch_block_transactions_message_received.block_message_hash;
+      try
+      {
+        bts::client::block_message cached_block;
+        _message_cache.get_message(fetch_block_transactions_message_received.block_message_hash).as(cached_block);
+        for (uint32_t trx_index : fetch_block_transactions_message_received.trx_indexes)
+        {
+          FC_ASSERT(trx_index < cached_block.block.trxs.size());
+          reply_message.trxs.push_back(cached_block.block.trxs[trx_index]);
+        }
+      }
+      catch (const fc::exception&)
+      {
+        // the block expired from our cache, an empty reply makes the peer fetch it normally
+        reply_message.trxs.clear();
+      }
+      originating_peer->send_message(reply_message);
+    }
+
+    void node_impl::on_block_transactions_message(peer_connection* originating_peer,
+                                                  const bts::client::block_transactions_message& block_transactions_message_received)
+    {
+      if (!originating_peer->compact_block_awaiting_transactions ||
+          originating_peer->compact_block_awaiting_transactions->compact_block.block_message_hash != block_transactions_message_received.block_message_hash)
+      {
+        wlog("received block transactions I didn't ask for from peer ${endpoint}, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+
+      pending_compact_block& pending = *originating_peer->compact_block_awaiting_transactions;
+      item_id block_item_id(bts::client::block_message_type, pending.compact_block.block_message_hash);
+      size_t number_of_missing_transactions = std::count_if(pending.trxs.begin(), pending.trxs.end(), 
+                                                            [](const fc::optional<bts::blockchain::signed_transaction>& trx) { return !trx; });
+      if (block_transactions_message_received.trxs.size() != number_of_missing_transactions)
+      {
+        // the peer no longer has the block, fetch the whole block from whoever advertises it next
+        wlog("peer ${endpoint} couldn't complete its compact block", ("endpoint", originating_peer->get_remote_endpoint()));
+        originating_peer->compact_block_awaiting_transactions.reset();
+        originating_peer->items_requested_from_peer.erase(block_item_id);
+        originating_peer->inventory_peer_advertised_to_us.erase(block_item_id);
+        _items_to_fetch.request_failed(block_item_id, originating_peer);
+        trigger_fetch_items_loop();
+        return;
+      }
+
+      auto next_trx = block_transactions_message_received.trxs.begin();
+      for (fc::optional<bts::blockchain::signed_transaction>& trx : pending.trxs)
+        if (!trx)
+          trx = *next_trx++;
+      finish_compact_block(originating_peer);
+    }
+
+    void node_impl::finish_compact_block(peer_connection* originating_peer)
+    {
+      pending_compact_block& pending = *originating_peer->compact_block_awaiting_transactions;
+
+      bts::client::fetch_block_transactions_message request;
+      request.block_message_hash = pending.compact_block.block_message_hash;
+      for (uint32_t i = 0; i < pending.trxs.size(); ++i)
+        if (!pending.trxs[i])
+          request.trx_indexes.push_back(i);
+      if (!request.trx_indexes.empty())
+      {
+        ilog("requesting ${count} of ${total} transactions of a compact block from peer ${endpoint}", 
+             ("count", request.trx_indexes.size())("total", pending.trxs.size())("endpoint", originating_peer->get_remote_endpoint()));
+        originating_peer->send_message(request);
+        return;
+      }
+
+      bts::client::block_message rebuilt_block;
+      rebuilt_block.block_id = pending.compact_block.block_id;
+      rebuilt_block.block = bts::blockchain::trx_block(pending.compact_block.header);
+      rebuilt_block.block.trxs.reserve(pending.trxs.size());
+      for (const fc::optional<bts::blockchain::signed_transaction>& trx : pending.trxs)
+        rebuilt_block.block.trxs.push_back(*trx);
+      rebuilt_block.signature = pending.compact_block.signature;
+
+      // the hash covers every transaction, so this also catches short ids that collided with
+      // the wrong transaction of ours
+      message rebuilt_message;
+      message_hash_type rebuilt_message_hash;
+      run_on_decode_thread([&]() {
+        rebuilt_message = message(rebuilt_block);
+        rebuilt_message_hash = rebuilt_message.id();
+      });
+      if (rebuilt_message_hash != pending.compact_block.block_message_hash)
+      {
+        if (pending.requested_all_transactions)
+        {
+          wlog("peer ${endpoint} sent a compact block that doesn't match its hash, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
+          disconnect_from_peer(originating_peer);
+          return;
+        }
+        ilog("compact block from peer ${endpoint} doesn't match, requesting all of its transactions", ("endpoint", originating_peer->get_remote_endpoint()));
+        pending.requested_all_transactions = true;
+        for (fc::optional<bts::blockchain::signed_transaction>& trx : pending.trxs)
+          trx.reset();
+        finish_compact_block(originating_peer);
+        return;
+      }
+
+      originating_peer->compact_block_awaiting_transactions.reset();
+      process_block_during_normal_operation(originating_peer, rebuilt_message, rebuilt_message_hash, rebuilt_block);
+    }
+
+    void node_impl::on_filter_load_message(peer_connection* originating_peer, const filter_load_message& filter_load_message_received)
+    {
+      if (!filter_load_message_received.filter.is_within_limits())
+      {
+        wlog("peer ${endpoint} sent us a filter of ${size} bytes and ${functions} hash functions, disconnecting from peer", 
+             ("endpoint", originating_peer->get_remote_endpoint())("size", filter_load_message_received.filter.bits.size())
+             ("functions", filter_load_message_received.filter.number_of_hash_functions));
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+      if (filter_load_message_received.filter.bits.empty())
+      {
+        ilog("peer ${endpoint} cleared its filter", ("endpoint", originating_peer->get_remote_endpoint()));
+        originating_peer->light_client_filter.reset();
+        return;
+      }
+      ilog("peer ${endpoint} loaded a filter of ${size} bytes, sending it merkle blocks from now on", 
+           ("endpoint", originating_peer->get_remote_endpoint())("size", filter_load_message_received.filter.bits.size()));
+      originating_peer->light_client_filter = filter_load_message_received.filter;
+      // it wants the transactions of new blocks, not our inventory
+      originating_peer->inventory_to_advertise.clear();
+    }
+
+    void node_impl::on_filter_add_message(peer_connection* originating_peer, const filter_add_message& filter_add_message_received)
+    {
+      if (!originating_peer->light_client_filter || filter_add_message_received.data.size() > maximum_bloom_filter_element_size)
+      {
+        wlog("peer ${endpoint} sent us a filter_add_message without a filter or of ${size} bytes, disconnecting from peer", 
+             ("endpoint", originating_peer->get_remote_endpoint())("size", filter_add_message_received.data.size()));
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+      originating_peer->light_client_filter->insert(filter_add_message_received.data.data(), filter_add_message_received.data.size());
+    }
+
+    void node_impl::on_merkle_block_message(peer_connection* originating_peer, const merkle_block_message& merkle_block_message_received)
+    {
+      // we only serve light clients, we never load a filter into a peer
+      wlog("peer ${endpoint} sent us a merkle block we didn't ask for, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
+      disconnect_from_peer(originating_peer);
+    }
+
+    /**
+     * Light clients follow the chain through the headers of the merkle blocks, so they get one for
+     * every block even if none of its transactions match.  The deterministic transactions are matched
+     * too, they follow the transactions of the block in the merkle tree.
+     */
+    void node_impl::send_filtered_block(const bts::blockchain::trx_block& block,
+                                        const bts::blockchain::signed_transactions& deterministic_trxs)
+    {
+      for (const peer_connection_ptr& peer : _active_connections)
+      {
+        if (!peer->light_client_filter)
+          continue;
+        merkle_block_message merkle_block;
+        merkle_block.block_id = block.id();
+        merkle_block.header = block;
+        uint32_t trx_count = block.trxs.size() + deterministic_trxs.size();
+        for (uint32_t i = 0; i < trx_count; ++i)
+        {
+          const bts::blockchain::signed_transaction& trx = i < block.trxs.size() ? block.trxs[i] : deterministic_trxs[i - block.trxs.size()];
+          if (match_transaction(*peer->light_client_filter, trx))
+          {
+            merkle_block.matched_trxs.push_back(trx);
+            merkle_block.branches.push_back(block.calculate_merkle_branch(i, deterministic_trxs));
+          }
+        }
+        dlog("sending peer ${endpoint} merkle block ${num} with ${count} matching transactions", 
+             ("endpoint", peer->get_remote_endpoint())("num", block.block_num)("count", merkle_block.matched_trxs.size()));
+        peer->send_message(merkle_block);
+      }
+    }
+
     void node_impl::on_connection_closed(peer_connection* originating_peer)
     {
       peer_connection_ptr originating_peer_ptr = originating_peer->shared_from_this();
       if (_closing_connections.find(originating_peer_ptr) != _closing_connections.end())
         _closing_connections.erase(originating_peer_ptr);
       else if (_active_connections.find(originating_peer_ptr) != _active_connections.end())
+      {
         _active_connections.erase(originating_peer_ptr);
+        save_peer_quality(originating_peer);
+      }
       else if (_handshaking_connections.find(originating_peer_ptr) != _handshaking_connections.end())
         _handshaking_connections.erase(originating_peer_ptr);
       ilog("Remote peer ${endpoint} closed their connection to us", ("endpoint", originating_peer->get_remote_endpoint()));
+
+      // anything we requested from this peer has to come from another one
+      for (const peer_connection::item_to_time_map_type::value_type& requested_item : originating_peer->items_requested_from_peer)
+        _items_to_fetch.request_failed(requested_item.first, originating_peer);
+      if (!originating_peer->items_requested_from_peer.empty())
+      {
+        originating_peer->items_requested_from_peer.clear();
+        trigger_fetch_items_loop();
+      }
+      for (const peer_connection::item_to_time_map_type::value_type& requested_item : originating_peer->sync_items_requested_from_peer)
+        _active_sync_requests.erase(requested_item.first.item_hash);
+      if (!originating_peer->sync_items_requested_from_peer.empty())
+      {
+        originating_peer->sync_items_requested_from_peer.clear();
+        trigger_fetch_sync_items_loop();
+      }
+
       display_current_connections();
       trigger_p2p_network_connect_loop();
     }
 
     void node_impl::process_backlog_of_sync_blocks()
     {
-      bool block_processed_this_iteration;
-      do
+      // blocks are handed to the delegate through _sync_blocks_to_validate so that we keep downloading
+      // while they are validated.  They are treated as accepted here, validate_sync_blocks_loop()
+      // undoes that if the delegate rejects one.  When that queue is full the remaining blocks wait
+      // in _received_sync_items, whose cap then slows down fetching.
+      while (_sync_blocks_to_validate.size() < _maximum_sync_blocks_to_validate)
       {
-        block_processed_this_iteration = false;
-        for (auto received_block_iter = _received_sync_items.begin(); 
-             received_block_iter != _received_sync_items.end(); 
-             ++received_block_iter)
+        // find the block we can hand directly to the client, it is the first item on some peer's list
+        fc::optional<bts::client::block_message> next_block;
+        for (const peer_connection_ptr& peer : _active_connections)
+          if (!peer->ids_of_items_to_get.empty())
+          {
+            next_block = _received_sync_items.take(peer->ids_of_items_to_get.front());
+            if (next_block)
+              break;
+          }
+        if (!next_block)
+          break;
+
+        // process it, remove it from all sync peers lists
+        // the block is moved into the validation queue, only its id is needed after that
+        const bts::blockchain::block_id_type block_id = next_block->block_id;
+
+        // we can get into an intersting situation near the end of synchronization.  We can be in
+        // sync with one peer who is sending us the last block on the chain via a regular inventory
+        // message, while at the same time still be synchronizing with a peer who is sending us the
+        // block through the sync mechanism.  Further, we must request both blocks because 
+        // we don't know they're the same (for the peer in normal operation, it has only told us the
+        // message id, for the peer in the sync case we only known the block_id).
+        if (std::find(_most_recent_blocks_accepted.begin(), _most_recent_blocks_accepted.end(),
+                      block_id) == _most_recent_blocks_accepted.end())
         {
-          // find out if this block is the next block that we can hand directly to the client
-          bool potential_first_block = false;
+          ilog("sync: this block is a potential first block, queueing it for the client");
+          queued_sync_block block_to_validate;
+          block_to_validate.block_message = std::move(*next_block);
           for (const peer_connection_ptr& peer : _active_connections)
             if (!peer->ids_of_items_to_get.empty() &&
-                peer->ids_of_items_to_get.front() == received_block_iter->block_id)
-            {
-              potential_first_block = true;
-              break;
-            }
+                peer->ids_of_items_to_get.front() == block_id)
+              block_to_validate.offered_by.push_back(peer);
+          _sync_blocks_to_validate.push_back(std::move(block_to_validate));
+          // TODO: only record as accepted if it has a valid signature.
+          _most_recent_blocks_accepted.push_back(block_id);
+          trigger_validate_sync_blocks_loop();
+        }
+        else
+          ilog("Already received and accepted this block (presumably through normal inventory mechanism), treating it as accepted");
 
-          // if it is, process it, remove it from all sync peers lists
-          if (potential_first_block)
+        --_total_number_of_unfetched_items;
+        ilog("sync: queued the block for the client, we now have only ${count} items left to fetch before we're in sync", ("count", _total_number_of_unfetched_items));
+        std::set<peer_connection_ptr> peers_with_newly_empty_item_lists;
+        std::set<peer_connection_ptr> peers_we_need_to_sync_to;
+        for (const peer_connection_ptr& peer : _active_connections)
+        {
+          if (peer->ids_of_items_to_get.empty())
           {
-            bts::client::block_message block_message_to_process = *received_block_iter;
-            _received_sync_items.erase(received_block_iter);
-
-            bool client_accepted_block = false;
-            try
-            {
-              ilog("sync: this block is a potential first block, passing it to the client");
-
-              // we can get into an intersting situation near the end of synchronization.  We can be in
-              // sync with one peer who is sending us the last block on the chain via a regular inventory
-              // message, while at the same time still be synchronizing with a peer who is sending us the
-              // block through the sync mechanism.  Further, we must request both blocks because 
-              // we don't know they're the same (for the peer in normal operation, it has only told us the
-              // message id, for the peer in the sync case we only known the block_id).
-              if (std::find(_most_recent_blocks_accepted.begin(), _most_recent_blocks_accepted.end(),
-                            block_message_to_process.block_id) == _most_recent_blocks_accepted.end())
-              {
-                _delegate->handle_message(block_message_to_process);
-                // TODO: only record as accepted if it has a valid signature.
-                _most_recent_blocks_accepted.push_back(block_message_to_process.block_id);
-              }
-              else
-                ilog("Already received and accepted this block (presumably through normal inventory mechanism), treating it as accepted");
-
-              client_accepted_block = true;
-            }
-            catch (fc::exception&)
+            ilog("Cannot pop first element off peer ${peer}'s list, its list is empty", ("peer", peer->get_remote_endpoint()));
+            // we don't know for sure that this peer has the item we just received.
+            // If peer is still syncing to us, we know they will ask us for
+            // sync item ids at least one more time and we'll notify them about
+            // the item then, so there's no need to do anything.  If we still need items
+            // from them, we'll be asking them for more items at some point, and
+            // that will clue them in that they are out of sync.  If we're fully in sync 
+            // we need to kick off another round of synchronization with them so they can 
+            // find out about the new item.
+            if (!peer->peer_needs_sync_items_from_us && !peer->we_need_sync_items_from_peer)
             {
-              wlog("sync: client rejected sync block sent by peer");
+              ilog("We will be restarting synchronization with peer ${peer}", ("peer", peer->get_remote_endpoint()));
+              peers_we_need_to_sync_to.insert(peer);
             }
-
-            if (client_accepted_block)
+          }
+          else
+          {
+            if (peer->ids_of_items_to_get.front() == block_id)
             {
-              --_total_number_of_unfetched_items;
-              block_processed_this_iteration = true;
-              ilog("sync: client accpted the block, we now have only ${count} items left to fetch before we're in sync", ("count", _total_number_of_unfetched_items));
-              std::set<peer_connection_ptr> peers_with_newly_empty_item_lists;
-              std::set<peer_connection_ptr> peers_we_need_to_sync_to;
-              for (const peer_connection_ptr& peer : _active_connections)
+              peer->ids_of_items_to_get.pop_front();
+              if (peer->number_of_verified_item_ids > 0)
+                --peer->number_of_verified_item_ids;
+              else
               {
-                if (peer->ids_of_items_to_get.empty())
-                {
-                  ilog("Cannot pop first element off peer ${peer}'s list, its list is empty", ("peer", peer->get_remote_endpoint()));
-                  // we don't know for sure that this peer has the item we just received.
-                  // If peer is still syncing to us, we know they will ask us for
-                  // sync item ids at least one more time and we'll notify them about
-                  // the item then, so there's no need to do anything.  If we still need items
-                  // from them, we'll be asking them for more items at some point, and
-                  // that will clue them in that they are out of sync.  If we're fully in sync 
-                  // we need to kick off another round of synchronization with them so they can 
-                  // find out about the new item.
-                  if (!peer->peer_needs_sync_items_from_us && !peer->we_need_sync_items_from_peer)
-                  {
-                    ilog("We will be restarting synchronization with peer ${peer}", ("peer", peer->get_remote_endpoint()));
-                    peers_we_need_to_sync_to.insert(peer);
-                  }
-                }
-                else
-                {
-                  if (peer->ids_of_items_to_get.front() == block_message_to_process.block_id)
-                  {
-                    peer->ids_of_items_to_get.pop_front();
-                    ilog("Popped item from front of ${endpoint}'s sync list, new list length is ${len}", ("endpoint", peer->get_remote_endpoint())("len", peer->ids_of_items_to_get.size()));
-
-                    // if we just received the last item in our list from this peer, we will want to 
-                    // send another request to find out if we are in sync, but we can't do this yet
-                    // (we don't want to allow a fiber swap in the middle of popping items off the list)
-                    if (peer->ids_of_items_to_get.empty() && peer->number_of_unfetched_item_ids == 0)
-                      peers_with_newly_empty_item_lists.insert(peer);
-
-                    // in this case, we know the peer was offering us this exact item, no need to 
-                    // try to inform them of its existence
-                  }
-                  else
-                  {
-                    // the peer's of sync items is nonempty, and its first item doesn't match
-                    // the one we just accepted.
-                    // 
-                    // This probably means that this peer is offering us garbage (its blockchain
-                    // should match everyone else's blockchain).  We could see this during a fork,
-                    // though.  I'm not certain if we've settled on what a fork looks like at this
-                    // level, so I'm just leaving the peer connected here.  If it turns out
-                    // that forks are impossible or won't effect sync behavior, we should disconnect 
-                    // the offending peer here.
-                    ilog("Cannot pop first element off peer ${peer}'s list, its first is ${hash}", ("peer", peer->get_remote_endpoint())("hash", peer->ids_of_items_to_get.front()));
-                  }
-                }
+                // another peer delivered it before we validated its header, the chain
+                // continues from it
+                peer->last_verified_item_id = block_id;
+                if (peer->block_headers_requested_from_peer)
+                  peer->block_headers_request_is_stale = true;
               }
-              for (const peer_connection_ptr& peer : peers_with_newly_empty_item_lists)
-                fetch_next_batch_of_item_ids_from_peer(peer.get(), item_id(bts::client::block_message_type, block_message_to_process.block_id));
+              ilog("Popped item from front of ${endpoint}'s sync list, new list length is ${len}", ("endpoint", peer->get_remote_endpoint())("len", peer->ids_of_items_to_get.size()));
+
+              // if we just received the last item in our list from this peer, we will want to 
+              // send another request to find out if we are in sync, but we can't do this yet
+              // (we don't want to allow a fiber swap in the middle of popping items off the list)
+              if (peer->ids_of_items_to_get.empty() && peer->number_of_unfetched_item_ids == 0)
+                peers_with_newly_empty_item_lists.insert(peer);
 
-              for (const peer_connection_ptr& peer : peers_we_need_to_sync_to)
-                start_synchronizing_with_peer(peer);
+              // in this case, we know the peer was offering us this exact item, no need to 
+              // try to inform them of its existence
             }
             else
             {
-              // invalid message received
-              std::list<peer_connection_ptr> peers_to_disconnect;
-              for (const peer_connection_ptr& peer : _active_connections)
-                if (!peer->ids_of_items_to_get.empty() &&
-                    peer->ids_of_items_to_get.front() == block_message_to_process.block_id)
-                  peers_to_disconnect.push_back(peer);
-              for (const peer_connection_ptr& peer : peers_to_disconnect)
-              {
-                wlog("disconnecting client ${endpoint} because it offered us the rejected block", ("endpoint", peer->get_remote_endpoint()));
-                disconnect_from_peer(peer.get());
-              }
-              break;
-            }              
+              // the peer's of sync items is nonempty, and its first item doesn't match
+              // the one we just accepted.
+              // 
+              // This probably means that this peer is offering us garbage (its blockchain
+              // should match everyone else's blockchain).  We could see this during a fork,
+              // though.  I'm not certain if we've settled on what a fork looks like at this
+              // level, so I'm just leaving the peer connected here.  If it turns out
+              // that forks are impossible or won't effect sync behavior, we should disconnect 
+              // the offending peer here.
+              ilog("Cannot pop first element off peer ${peer}'s list, its first is ${hash}", ("peer", peer->get_remote_endpoint())("hash", peer->ids_of_items_to_get.front()));
+            }
+          }
+        }
+        for (const peer_connection_ptr& peer : peers_with_newly_empty_item_lists)
+          fetch_next_batch_of_item_ids_from_peer(peer.get(), item_id(bts::client::block_message_type, block_id));
 
-            break; // start iterating _received_sync_items from the beginning
-          } // end if potential_first_block
-        } // end for each block in _received_sync_items
-      } while (block_processed_this_iteration);
-      ilog("Currently backlog is ${count} blocks", ("count", _received_sync_items.size()));
+        for (const peer_connection_ptr& peer : peers_we_need_to_sync_to)
+          start_synchronizing_with_peer(peer);
+      }
+      ilog("Currently backlog is ${count} blocks, ${queued} waiting for validation", 
+           ("count", _received_sync_items.size())("queued", _sync_blocks_to_validate.size()));
     }
 
-    void node_impl::process_block_during_sync(peer_connection* originating_peer, const message& message_to_process, const message_hash_type& message_hash)
+    void node_impl::process_block_during_sync(peer_connection* originating_peer, const message& message_to_process, const message_hash_type& message_hash,
+                                              bts::client::block_message&& block_message_to_process)
     {
       assert(originating_peer->we_need_sync_items_from_peer);
       assert(message_to_process.msg_type == bts::client::message_type_enum::block_message_type);
-      bts::client::block_message block_message_to_process(message_to_process.as<bts::client::block_message>());
       
       // only process it if we asked for it
-      auto iter = originating_peer->sync_items_requested_from_peer.find(item_id(bts::client::block_message_type, block_message_to_process.block_id));
-      if (iter == originating_peer->sync_items_requested_from_peer.end())
+      item_id received_item_id(bts::client::block_message_type, block_message_to_process.block_id);
+      auto iter = originating_peer->sync_items_requested_from_peer.find(received_item_id);
+      if (iter != originating_peer->sync_items_requested_from_peer.end())
+      {
+        ilog("received a sync block from peer ${endpoint}", ("endpoint", originating_peer->get_remote_endpoint()));
+        fc::time_point now = fc::time_point::now();
+        fc::microseconds round_trip_time = now - iter->second;
+        originating_peer->sync_request_latency.add_sample(round_trip_time);
+        if (originating_peer->sync_round_trip_time.count() == 0)
+          originating_peer->sync_round_trip_time = round_trip_time;
+        else
+          originating_peer->sync_round_trip_time = fc::microseconds((originating_peer->sync_round_trip_time.count() * 7 + round_trip_time.count()) / 8);
+        // behind other blocks in the window, the time since the last one is what it took to send this one
+        originating_peer->quality.add_sync_delivery(message_to_process.size, now - std::max(iter->second, originating_peer->last_sync_block_received_time));
+        originating_peer->last_sync_block_received_time = now;
+        originating_peer->sync_items_requested_from_peer.erase(iter);
+      }
+      else if (originating_peer->sync_items_reassigned_from_peer.erase(received_item_id))
+        ilog("received a sync block from peer ${endpoint} after its request had timed out", ("endpoint", originating_peer->get_remote_endpoint()));
+      else
       {
         wlog("received a sync block I didn't ask for from peer ${endpoint}, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
         disconnect_from_peer(originating_peer);
         return;
       }
-      else
+
+      ++originating_peer->quality.number_of_items_received;
+
+      // the id is what we validated the header against, make sure the block really has it
+      if (block_message_to_process.block.id() != block_message_to_process.block_id)
       {
-        ilog("received a sync block from peer ${endpoint}", ("endpoint", originating_peer->get_remote_endpoint()));
-        originating_peer->sync_items_requested_from_peer.erase(iter);
+        wlog("received a sync block from peer ${endpoint} that doesn't match its id, disconnecting from peer", ("endpoint", originating_peer->get_remote_endpoint()));
+        ++originating_peer->quality.number_of_invalid_items;
+        disconnect_from_peer(originating_peer);
+        return;
+      }
+
+      // a block requested from more than one peer may already have been processed, it is no
+      // longer on the peer's list then
+      if (std::find(originating_peer->ids_of_items_to_get.begin(), originating_peer->ids_of_items_to_get.end(),
+                    block_message_to_process.block_id) == originating_peer->ids_of_items_to_get.end())
+      {
+        ilog("sync: already processed this block, ignoring it");
+        trigger_fetch_sync_items_loop();
+        return;
       }
 
-      // add it to the front of _received_sync_items, then process _received_sync_items to try to 
+      // add it to _received_sync_items, then process _received_sync_items to try to 
       // pass as many messages as possible to the client.
-      _received_sync_items.push_front(block_message_to_process);
+      forget_evicted_sync_items(_received_sync_items.insert(std::move(block_message_to_process), message_to_process.size));
       process_backlog_of_sync_blocks();
 
       // we should be ready to request another block now
       trigger_fetch_sync_items_loop();
     }
 
-    void node_impl::process_block_during_normal_operation(peer_connection* originating_peer, const message& message_to_process, const message_hash_type& message_hash)
+    void node_impl::process_block_during_normal_operation(peer_connection* originating_peer, const message& message_to_process, const message_hash_type& message_hash,
+                                                          const bts::client::block_message& block_message_to_process)
     {
       //std::ostringstream bytes;
       //for (const unsigned char& byte : message_to_process.data)
@@ -1403,7 +2962,6 @@ namespace bts { namespace net {
 
       assert(!originating_peer->we_need_sync_items_from_peer);
       assert(message_to_process.msg_type == bts::client::message_type_enum::block_message_type);
-      bts::client::block_message block_message_to_process(message_to_process.as<bts::client::block_message>());
       
       // only process it if we asked for it
       auto iter = originating_peer->items_requested_from_peer.find(item_id(bts::client::block_message_type, message_hash));
@@ -1416,9 +2974,12 @@ namespace bts { namespace net {
       else
       {
         ilog("received a block from peer ${endpoint}, passing it to client", ("endpoint", originating_peer->get_remote_endpoint()));
+        ++originating_peer->quality.number_of_items_received;
+        _items_to_fetch.remove(iter->first);
         originating_peer->items_requested_from_peer.erase(iter);
         trigger_fetch_items_loop();
 
+        bool relayed_early = false;
         try
         {
           // we can get into an intersting situation near the end of synchronization.  We can be in
@@ -1430,7 +2991,29 @@ namespace bts { namespace net {
           if (std::find(_most_recent_blocks_accepted.begin(), _most_recent_blocks_accepted.end(), 
                         block_message_to_process.block_id) == _most_recent_blocks_accepted.end())
           {
-            _delegate->handle_message(block_message_to_process);
+            // the cheap checks let us advertise the block while it is validated, so that the time it
+            // takes to validate a block isn't added to its propagation delay at every hop.  Nobody honest
+            // relays a block that fails them
+            if (_early_block_relay)
+            {
+              try
+              {
+                relayed_early = call_delegate([&]() { return _delegate->validate_block_for_relay(block_message_to_process); });
+              }
+              catch (const fc::exception& e)
+              {
+                wlog("peer ${endpoint} sent us a block that fails the relay checks: ${e}", 
+                     ("endpoint", originating_peer->get_remote_endpoint())("e", e.to_string()));
+                ban_peer(originating_peer);
+                return;
+              }
+              if (relayed_early)
+              {
+                ilog("block passed the relay checks, advertising it to other peers before validating it");
+                broadcast(message_to_process);
+              }
+            }
+            call_delegate_handle_message(block_message_to_process);
 
             // TODO: only record it as accepted if it has a valid signature.
             _most_recent_blocks_accepted.push_back(block_message_to_process.block_id);
@@ -1443,22 +3026,24 @@ namespace bts { namespace net {
           for (const peer_connection_ptr& peer : _active_connections)
           {
             item_id block_message_item_id(bts::client::message_type_enum::block_message_type, message_hash);
-            auto iter = peer->inventory_peer_advertised_to_us.find(block_message_item_id);
-            if (iter != peer->inventory_peer_advertised_to_us.end())
+            if (peer->inventory_peer_advertised_to_us.erase(block_message_item_id))
             {
               // this peer offered us the item; remove it from the list of items they offered us, and 
               // add it to the list of items we've offered them.  That will prevent us from offering them
               // the same item back (no reason to do that; we already know they have it)
-              peer->inventory_peer_advertised_to_us.erase(iter);
               peer->inventory_advertised_to_peer.insert(block_message_item_id);
             }
           }
-          broadcast(message_to_process);
+          if (!relayed_early)
+            broadcast(message_to_process);
         }
         catch (fc::exception&)
         {
           // client rejected the block.  Disconnect the client and any other clients that offered us this block
           wlog("client rejected block sent by peer");
+          if (relayed_early)
+            withdraw_relayed_block(message_hash, block_message_to_process.block_id);
+          ++originating_peer->quality.number_of_invalid_items;
           std::list<peer_connection_ptr> peers_to_disconnect;
           for (const peer_connection_ptr& peer : _active_connections)
             if (!peer->ids_of_items_to_get.empty() &&
@@ -1473,8 +3058,48 @@ namespace bts { namespace net {
       }
     }
 
+    /**
+     * A block we relayed early failed validation.  We stop advertising and serving it, the peers that
+     * fetched it already reject it themselves.  Its relay checks passed, so whoever sent it to us may
+     * have relayed it early too and isn't banned for it
+     */
+    void node_impl::withdraw_relayed_block(const message_hash_type& message_hash, const bts::blockchain::block_id_type& block_id)
+    {
+      item_id block_item_id(bts::client::block_message_type, message_hash);
+      _message_cache.remove(message_hash);
+      _new_inventory.erase(block_item_id);
+      for (const peer_connection_ptr& peer : _active_connections)
+        peer->inventory_to_advertise.erase(std::remove(peer->inventory_to_advertise.begin(), peer->inventory_to_advertise.end(), block_item_id),
+                                           peer->inventory_to_advertise.end());
+      _most_recent_blocks_accepted.erase(std::remove(_most_recent_blocks_accepted.begin(), _most_recent_blocks_accepted.end(), block_id),
+                                         _most_recent_blocks_accepted.end());
+    }
+
+    /**
+     * We cache every item we broadcast, so a requested item that is in the cache arrived from
+     * another peer first.  It is dropped before it is unpacked or handed to the delegate.
+     * @return true if the item was dropped
+     */
+    bool node_impl::drop_duplicate_item(peer_connection* originating_peer, const item_id& received_item_id)
+    {
+      if (!_message_cache.contains(received_item_id.item_hash))
+        return false;
+      auto iter = originating_peer->items_requested_from_peer.find(received_item_id);
+      if (iter == originating_peer->items_requested_from_peer.end())
+        return false; // unrequested, handled like any other
+      ilog("received item ${hash} from peer ${endpoint}, we already have it", 
+           ("hash", received_item_id.item_hash)("endpoint", originating_peer->get_remote_endpoint()));
+      _items_to_fetch.remove(iter->first);
+      originating_peer->items_requested_from_peer.erase(iter);
+      trigger_fetch_items_loop();
+      return true;
+    }
+
     void node_impl::process_unrecognized_message(peer_connection* originating_peer, const message& message_to_process, const message_hash_type& message_hash)
     {
+      if (drop_duplicate_item(originating_peer, item_id(message_to_process.msg_type, message_hash)))
+        return;
+
       // only process it if we asked for it
       auto iter = originating_peer->items_requested_from_peer.find(item_id(message_to_process.msg_type, message_hash));
       if (iter == originating_peer->items_requested_from_peer.end())
@@ -1486,17 +3111,26 @@ namespace bts { namespace net {
       }
       else
       {
+        _items_to_fetch.remove(iter->first);
         originating_peer->items_requested_from_peer.erase(iter);
         trigger_fetch_items_loop();
+        ++originating_peer->quality.number_of_items_received;
+
+        if (message_to_process.msg_type == bts::client::trx_message_type)
+        {
+          queue_transaction(originating_peer, message_to_process);
+          return;
+        }
 
         // Next: have the delegate process the message
         try
         {
-          _delegate->handle_message(message_to_process);
+          call_delegate_handle_message(message_to_process);
         }
         catch (fc::exception& e)
         {
           wlog("client rejected block sent by peer ${peer}, ${e}", ("peer", originating_peer->get_remote_endpoint())("e", e.to_string()));
+          ++originating_peer->quality.number_of_invalid_items;
           return;
         }
 
@@ -1520,8 +3154,9 @@ namespace bts { namespace net {
 
     void node_impl::new_peer_just_added(const peer_connection_ptr& peer)
     {
+      load_peer_quality(peer.get());
       start_synchronizing_with_peer(peer);
-      _delegate->connection_count_changed(_active_connections.size());
+      call_delegate([&]() { _delegate->connection_count_changed(_active_connections.size()); });
     }
 
     void node_impl::close()
@@ -1536,7 +3171,15 @@ namespace bts { namespace net {
 
     void node_impl::accept_connection_task(peer_connection_ptr new_peer)
     {
-      new_peer->accept_connection(); // this blocks until the secure connection is fully negotiated
+      try
+      {
+        new_peer->accept_connection(); // this blocks until the secure connection is fully negotiated
+      }
+      catch (const fc::exception&)
+      {
+        ++_handshake_failures;
+        throw;
+      }
     }
 
     void node_impl::accept_loop()
@@ -1544,6 +3187,7 @@ namespace bts { namespace net {
       while (!_accept_loop_complete.canceled())
       {
         peer_connection_ptr new_peer(std::make_shared<peer_connection>(std::ref(*this)));
+        apply_bandwidth_limits(new_peer.get());
         try
         {
           _tcp_server.accept(new_peer->get_socket());
@@ -1574,7 +3218,25 @@ namespace bts { namespace net {
 
       try
       {
-        new_peer->connect_to(remote_endpoint/* ,  _node_configuration.listen_endpoint */);  // blocks until the connection is established and secure connection is negotiated
+        // blocks until the connection is established and secure connection is negotiated
+        fc::future<void> connect_done = fc::async([&](){ new_peer->connect_to(remote_endpoint/* ,  _node_configuration.listen_endpoint */); });
+        try
+        {
+          connect_done.wait(_dial_timeout);
+        }
+        catch (const fc::timeout_exception&)
+        {
+          // closing the socket makes the connect or key exchange fail
+          new_peer->close_connection();
+          try
+          {
+            connect_done.wait();
+          }
+          catch (const fc::exception&)
+          {
+          }
+          throw;
+        }
 
         // connection succeeded.  record that in our database
         updated_peer_record.last_connection_disposition = last_connection_succeeded;
@@ -1588,23 +3250,30 @@ namespace bts { namespace net {
         updated_peer_record.last_connection_disposition = last_connection_failed;
         updated_peer_record.number_of_failed_connection_attempts++;
         _potential_peer_db.update_entry(updated_peer_record);
+        ++_handshake_failures;
 
+        --_number_of_dials_in_progress;
         _handshaking_connections.erase(new_peer);
         display_current_connections();
         trigger_p2p_network_connect_loop();
 
         throw except;
       }
+      --_number_of_dials_in_progress;
+      trigger_p2p_network_connect_loop();
+
       hello_message hello(_user_agent_string, core_protocol_version, _node_configuration.listen_endpoint, _node_id);
       new_peer->state = peer_connection::hello_sent;
-      new_peer->send_message(message(hello));
+      new_peer->hello_sent_time = fc::time_point::now();
+      new_peer->send_message(pack_with_capabilities(hello, local_connection_capabilities()));
       ilog("Sent \"hello\" to remote peer ${peer}", ("peer", new_peer->get_remote_endpoint()));
     }
 
     // methods implementing node's public interface
-    void node_impl::set_delegate(node_delegate* del)
+    void node_impl::set_delegate(node_delegate* del, fc::thread* delegate_thread)
     {
       _delegate = del;
+      _delegate_thread = delegate_thread;
     }
 
     void node_impl::load_configuration(const fc::path& configuration_directory)
@@ -1617,6 +3286,7 @@ namespace bts { namespace net {
         {
           _node_configuration = fc::json::from_file(configuration_file_name).as<detail::node_configuration>();
           ilog("Loaded configuration from file ${filename}", ("filename", configuration_file_name));
+          set_bandwidth_limits(_node_configuration.bandwidth);
         }
         catch (fc::parse_error_exception& parse_error)
         {
@@ -1646,6 +3316,8 @@ namespace bts { namespace net {
     {
       _p2p_network_connect_loop_done = fc::async([=]() { p2p_network_connect_loop(); });
       _fetch_sync_items_loop_done = fc::async([=]() { fetch_sync_items_loop(); });
+      _validate_sync_blocks_loop_done = fc::async([=]() { validate_sync_blocks_loop(); });
+      _validate_transactions_loop_done = fc::async([=]() { validate_transactions_loop(); });
       _fetch_item_loop_done = fc::async([=]() { fetch_items_loop(); });
       _advertise_inventory_loop_done = fc::async([=]() { advertise_inventory_loop(); });
 
@@ -1675,8 +3347,10 @@ namespace bts { namespace net {
 
       ilog("node_impl::connect_to(${endpoint})", ("endpoint", remote_endpoint));
       peer_connection_ptr new_peer(std::make_shared<peer_connection>(std::ref(*this)));
+      apply_bandwidth_limits(new_peer.get());
       new_peer->set_remote_endpoint(remote_endpoint);
       _handshaking_connections.insert(new_peer);
+      ++_number_of_dials_in_progress;
       fc::async([=](){ connect_to_task(new_peer, remote_endpoint); });
     }
 
@@ -1722,10 +3396,35 @@ namespace bts { namespace net {
     {
       _closing_connections.insert(peer_to_disconnect->shared_from_this());
       _handshaking_connections.erase(peer_to_disconnect->shared_from_this());
-      _active_connections.erase(peer_to_disconnect->shared_from_this());
+      if (_active_connections.erase(peer_to_disconnect->shared_from_this()))
+        save_peer_quality(peer_to_disconnect);
       peer_to_disconnect->close_connection();
     }
 
+    /** peers connecting from a banned address are disconnected after their hello, and we don't dial them */
+    void node_impl::ban_peer(peer_connection* peer)
+    {
+      fc::optional<fc::ip::endpoint> remote_endpoint = peer->get_remote_endpoint();
+      if (remote_endpoint)
+      {
+        wlog("banning ${address} for ${hours} hours", ("address", remote_endpoint->get_address())("hours", _ban_duration.count() / fc::hours(1).count()));
+        _banned_addresses[uint32_t(remote_endpoint->get_address())] = fc::time_point::now() + _ban_duration;
+      }
+      ++peer->quality.number_of_invalid_items;
+      disconnect_from_peer(peer);
+    }
+
+    bool node_impl::is_banned(const fc::ip::address& address)
+    {
+      auto iter = _banned_addresses.find(uint32_t(address));
+      if (iter == _banned_addresses.end())
+        return false;
+      if (iter->second > fc::time_point::now())
+        return true;
+      _banned_addresses.erase(iter);
+      return false;
+    }
+
     void node_impl::listen_on_endpoint(const fc::ip::endpoint& ep)
     {
       _node_configuration.listen_endpoint = ep;
@@ -1740,15 +3439,138 @@ namespace bts { namespace net {
 
     std::vector<peer_status> node_impl::get_connected_peers() const
     {
-      return std::vector<peer_status>();
+      std::vector<peer_status> statuses;
+      for (const peer_connection_ptr& peer : _active_connections)
+      {
+        peer_status status;
+        status.version = peer->core_protocol_version;
+        fc::optional<fc::ip::endpoint> remote_endpoint = peer->get_remote_endpoint();
+        if (remote_endpoint)
+          status.host = *remote_endpoint;
+        fc::mutable_variant_object info;
+        info["user_agent"] = peer->user_agent;
+        info["inventory_memory_usage"] = peer->inventory_peer_advertised_to_us.memory_usage() + 
+                                         peer->inventory_advertised_to_peer.memory_usage();
+        info["quality"] = peer->quality;
+        info["quality_score"] = peer->quality.score();
+        status.info = info;
+        statuses.push_back(status);
+      }
+      return statuses;
+    }
+
+    /** the types of the core and client protocols get an entry each, the map can't grow past them */
+    message_type_statistics& node_impl::statistics_of(uint32_t msg_type)
+    {
+      bool known = (msg_type >= item_ids_inventory_message_type && msg_type <= merkle_block_message_type) ||
+                   (msg_type >= bts::client::trx_message_type && msg_type <= bts::client::block_transactions_message_type);
+      return _message_statistics[known ? msg_type : unknown_message_type];
+    }
+
+    node_statistics node_impl::get_statistics() const
+    {
+      node_statistics statistics;
+      for (const auto& message_type_and_statistics : _message_statistics)
+      {
+        statistics.messages.push_back(message_type_and_statistics.second);
+        statistics.messages.back().msg_type = message_type_and_statistics.first;
+      }
+      for (const peer_connection_ptr& peer : _active_connections)
+      {
+        peer_statistics peer_stats;
+        fc::optional<fc::ip::endpoint> remote_endpoint = peer->get_remote_endpoint();
+        if (remote_endpoint)
+          peer_stats.host = *remote_endpoint;
+        peer_stats.syncing = peer->we_need_sync_items_from_peer;
+        peer_stats.bytes_sent = peer->get_message_connection().get_total_bytes_sent();
+        peer_stats.bytes_received = peer->get_message_connection().get_total_bytes_received();
+        peer_stats.messages_sent = peer->messages_sent;
+        peer_stats.messages_received = peer->messages_received;
+        peer_stats.send_queue_size = peer->get_message_connection().get_send_queue_size();
+        peer_stats.items_requested = peer->items_requested_from_peer.size();
+        peer_stats.sync_items_requested = peer->sync_items_requested_from_peer.size();
+        peer_stats.inventory_to_advertise = peer->inventory_to_advertise.size();
+        peer_stats.sync_request_latency = peer->sync_request_latency;
+        statistics.peers.push_back(peer_stats);
+      }
+      statistics.handshake_failures = _handshake_failures;
+      statistics.handle_message_time = _handle_message_time;
+      statistics.handshaking_connections = _handshaking_connections.size();
+      statistics.closing_connections = _closing_connections.size();
+      statistics.items_to_fetch = _items_to_fetch.size();
+      statistics.new_inventory = _new_inventory.size();
+      statistics.sync_blocks_received = _received_sync_items.size();
+      statistics.sync_blocks_to_validate = _sync_blocks_to_validate.size();
+      statistics.active_sync_requests = _active_sync_requests.size();
+      statistics.transactions_to_validate = _transactions_to_validate.size();
+      statistics.transactions_dropped = _transactions_dropped;
+      return statistics;
+    }
+
+    void node_impl::set_maximum_sync_backlog_size(uint64_t maximum_size_in_bytes)
+    {
+      forget_evicted_sync_items(_received_sync_items.set_maximum_size(maximum_size_in_bytes));
+      trigger_fetch_sync_items_loop();
+    }
+
+    void node_impl::set_headers_first_sync(bool enabled)
+    {
+      _headers_first_sync = enabled;
+      for (const peer_connection_ptr& peer : _active_connections)
+        request_block_headers_from_peer(peer.get());
+      trigger_fetch_sync_items_loop();
+    }
+
+    void node_impl::set_message_compression(bool enabled)
+    {
+      _message_compression = enabled;
+    }
+
+    void node_impl::set_connection_limits(uint32_t desired, uint32_t maximum)
+    {
+      FC_ASSERT(desired <= maximum && maximum > 0);
+      _desired_number_of_connections = desired;
+      _maximum_number_of_connections = maximum;
+      _most_recent_blocks_accepted.set_capacity(maximum);
+      trigger_p2p_network_connect_loop();
+    }
+
+    void node_impl::set_early_block_relay(bool enabled)
+    {
+      _early_block_relay = enabled;
+    }
+
+    void node_impl::set_bandwidth_limits(const bandwidth_limits& limits)
+    {
+      _node_configuration.bandwidth = limits;
+      _upload_limit->set_rate(limits.upload_bytes_per_second, limits.upload_bytes_per_second * limits.burst_milliseconds / 1000);
+      _download_limit->set_rate(limits.download_bytes_per_second, limits.download_bytes_per_second * limits.burst_milliseconds / 1000);
+      for (const peer_connection_ptr& peer : _handshaking_connections)
+        apply_bandwidth_limits(peer.get());
+      for (const peer_connection_ptr& peer : _active_connections)
+        apply_bandwidth_limits(peer.get());
+    }
+
+    void node_impl::apply_bandwidth_limits(peer_connection* peer)
+    {
+      peer->set_rate_limits(_upload_limit, _download_limit,
+                            _node_configuration.bandwidth.peer_upload_bytes_per_second, _node_configuration.bandwidth.peer_download_bytes_per_second);
+    }
+
+    void node_impl::set_inventory_trickle_interval(const fc::microseconds& interval)
+    {
+      _inventory_trickle_interval = interval;
     }
 
     void node_impl::broadcast(const message& item_to_broadcast)
     {
       if (item_to_broadcast.msg_type == bts::client::block_message_type)
       {
-        bts::client::block_message messageToBroadcast = item_to_broadcast.as<bts::client::block_message>();
-        _most_recent_blocks_accepted.push_back(messageToBroadcast.block_id);
+        // the id is the first field of a block_message, the block itself needn't be unpacked
+        bts::blockchain::block_id_type block_id;
+        fc::datastream<const char*> ds(item_to_broadcast.data.data(), item_to_broadcast.data.size());
+        fc::raw::unpack(ds, block_id);
+        _most_recent_blocks_accepted.push_back(block_id);
       }
       message_hash_type hash_of_item_to_broadcast = item_to_broadcast.id();
       _message_cache.cache_message(item_to_broadcast, hash_of_item_to_broadcast);
@@ -1772,6 +3594,60 @@ namespace bts { namespace net {
 
 
 
+  std::vector<bts::blockchain::signed_block_header> node_delegate::get_block_headers(const std::vector<item_hash_t>& block_ids)
+  {
+    std::vector<bts::blockchain::signed_block_header> headers;
+    headers.reserve(block_ids.size());
+    try
+    {
+      for (const item_hash_t& block_id : block_ids)
+        headers.push_back(get_item(item_id(bts::client::block_message_type, block_id)).as<bts::client::block_message>().block);
+    }
+    catch (const fc::key_not_found_exception&)
+    {
+    }
+    return headers;
+  }
+
+  void node_delegate::validate_block_header(const bts::blockchain::signed_block_header& header)
+  {
+  }
+
+  void node_delegate::handle_block(const bts::client::block_message& block)
+  {
+    handle_message(message(block));
+  }
+
+  bool node_delegate::validate_block_for_relay(const bts::client::block_message& block)
+  {
+    return false;
+  }
+
+  uint64_t node_delegate::get_transaction_priority(const message& transaction_message)
+  {
+    return 0;
+  }
+
+  void latency_histogram::add_sample(const fc::microseconds& latency)
+  {
+    ++sample_count;
+    total_microseconds += std::max<int64_t>(latency.count(), 0);
+    uint64_t milliseconds = std::max<int64_t>(latency.count(), 0) / 1000;
+    size_t bucket = 0;
+    while (milliseconds && bucket < buckets.size() - 1)
+    {
+      milliseconds >>= 1;
+      ++bucket;
+    }
+    ++buckets[bucket];
+  }
+
+  std::vector<fc::optional<bts::blockchain::signed_transaction> > node_delegate::get_transactions_by_short_id(const bts::blockchain::block_id_type& block_id,
+                                                                                                             const std::vector<uint64_t>& short_trx_ids)
+  {
+    return std::vector<fc::optional<bts::blockchain::signed_transaction> >(short_trx_ids.size());
+  }
+
   ///////////////////////////////////////////////////////////////////////
   // implement node functions, they just delegate to detail::node_impl //
 
@@ -1784,9 +3660,9 @@ namespace bts { namespace net {
   {
   }
 
-  void node::set_delegate(node_delegate* del)
+  void node::set_delegate(node_delegate* del, fc::thread* delegate_thread)
   {
-    my->set_delegate(del);
+    my->set_delegate(del, delegate_thread);
   }
 
   void node::load_configuration(const fc::path& configuration_directory)
@@ -1824,11 +3700,56 @@ namespace bts { namespace net {
     return my->get_connected_peers();
   }
 
+  node_statistics node::get_statistics() const
+  {
+    return my->get_statistics();
+  }
+
+  void node::set_maximum_sync_backlog_size(uint64_t maximum_size_in_bytes)
+  {
+    my->set_maximum_sync_backlog_size(maximum_size_in_bytes);
+  }
+
+  void node::set_headers_first_sync(bool enabled)
+  {
+    my->set_headers_first_sync(enabled);
+  }
+
+  void node::set_inventory_trickle_interval(const fc::microseconds& interval)
+  {
+    my->set_inventory_trickle_interval(interval);
+  }
+
+  void node::set_message_compression(bool enabled)
+  {
+    my->set_message_compression(enabled);
+  }
+
+  void node::set_connection_limits(uint32_t desired, uint32_t maximum)
+  {
+    my->set_connection_limits(desired, maximum);
+  }
+
+  void node::set_early_block_relay(bool enabled)
+  {
+    my->set_early_block_relay(enabled);
+  }
+
+  void node::set_bandwidth_limits(const bandwidth_limits& limits)
+  {
+    my->set_bandwidth_limits(limits);
+  }
+
   void node::broadcast(const message& msg)
   {
     my->broadcast(msg);
   }
 
+  void node::send_filtered_block(const bts::blockchain::trx_block& block, const bts::blockchain::signed_transactions& deterministic_trxs)
+  {
+    my->send_filtered_block(block, deterministic_trxs);
+  }
+
   void node::sync_from(const item_id& id)
   {
     my->sync_from(id);
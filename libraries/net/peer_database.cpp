@@ -7,11 +7,76 @@
 
 #include <fc/log/logger.hpp>
 #include <fc/io/json.hpp>
+#include <fc/optional.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
 
 #include <bts/net/peer_database.hpp>
 #include <bts/db/level_pod_map.hpp>
 
 namespace bts { namespace net {
+  using bts::db::upgrade_db_mapper;
+  REGISTER_DB_OBJECT(potential_peer_record,0)
+  // databases written before the record had a version call it by its unnumbered name
+  static int dummyResultunnumbered_potential_peer_record = 
+    upgrade_db_mapper::instance().add_type("bts::net::potential_peer_record", UpgradeDbpotential_peer_record0);
+
+  void peer_quality::add_round_trip_time(const fc::microseconds& round_trip_time)
+  {
+    uint32_t sample = (uint32_t)std::min<int64_t>(std::max<int64_t>(round_trip_time.count() / 1000, 1), std::numeric_limits<uint32_t>::max());
+    round_trip_time_ms = round_trip_time_ms == 0 ? sample : (uint32_t)(((uint64_t)round_trip_time_ms * 7 + sample) / 8);
+  }
+
+  void peer_quality::add_sync_delivery(uint64_t bytes, const fc::microseconds& elapsed)
+  {
+    // blocks that arrive back to back are timed from the one before, round them up to a millisecond
+    uint64_t sample = bytes * 1000000 / (uint64_t)std::max<int64_t>(elapsed.count(), 1000);
+    sync_bytes_per_second = sync_bytes_per_second == 0 ? sample : (sync_bytes_per_second * 7 + sample) / 8;
+  }
+
+  uint64_t peer_quality::score() const
+  {
+    const uint64_t typical_sync_block_size = 8 * 1024;
+    uint64_t round_trip_time_us = (round_trip_time_ms ? round_trip_time_ms : 500) * uint64_t(1000);
+    uint64_t bytes_per_second = sync_bytes_per_second ? sync_bytes_per_second : 32 * 1024;
+    uint64_t microseconds_per_block = round_trip_time_us + typical_sync_block_size * 1000000 / bytes_per_second;
+    uint64_t blocks_per_hour = uint64_t(3600) * 1000000 / microseconds_per_block;
+    return blocks_per_hour * (uint64_t(number_of_items_received) + 1) / 
+           (uint64_t(number_of_items_received) + 1 + uint64_t(number_of_invalid_items) * 16);
+  }
+
+  size_t choose_peer_to_evict(const std::vector<peer_quality>& active_peers, const peer_quality& candidate)
+  {
+    fc::optional<uint64_t> worst_measured_score;
+    for (const peer_quality& peer : active_peers)
+      if (peer.is_measured())
+        worst_measured_score = std::min(worst_measured_score ? *worst_measured_score : peer.score(), peer.score());
+    auto effective_score = [&](const peer_quality& quality) {
+      if (quality.is_measured() || !worst_measured_score)
+        return quality.score();
+      return std::min(quality.score(), *worst_measured_score);
+    };
+
+    size_t worst_peer = active_peers.size();
+    uint64_t worst_score = 0;
+    for (size_t i = 0; i < active_peers.size(); ++i)
+    {
+      uint64_t score = effective_score(active_peers[i]);
+      // of peers that score the same, the one that hasn't been measured goes first
+      if (worst_peer == active_peers.size() || score < worst_score ||
+          (score == worst_score && !active_peers[i].is_measured()))
+      {
+        worst_peer = i;
+        worst_score = score;
+      }
+    }
+    if (worst_peer == active_peers.size() || worst_score * 2 >= effective_score(candidate))
+      return active_peers.size();
+    return worst_peer;
+  }
+
   namespace detail
   {
     using namespace boost::multi_index;
@@ -32,6 +97,31 @@ namespace bts { namespace net {
 
       const fc::time_point_sec& get_last_seen_time() const { return peer_record.last_seen_time; }
       const fc::ip::endpoint&   get_endpoint() const { return peer_record.endpoint; }
+
+      /// (0, -quality, -score, -last seen) for peers worth trying now, (1, next retry, 0, -last seen)
+      /// for peers whose last connection failed
+      typedef std::tuple<uint8_t, int64_t, int64_t, int64_t> connection_candidate_key;
+      connection_candidate_key get_connection_candidate_key() const
+      {
+        int64_t negative_last_seen = -int64_t(peer_record.last_seen_time.sec_since_epoch());
+        if (is_backing_off())
+          return connection_candidate_key(1, get_next_connection_retry_time().sec_since_epoch(), 0, negative_last_seen);
+        int64_t score = int64_t(peer_record.number_of_successful_connection_attempts) - int64_t(peer_record.number_of_failed_connection_attempts);
+        return connection_candidate_key(0, -int64_t(peer_record.quality.score()), -score, negative_last_seen);
+      }
+      fc::time_point_sec get_next_connection_retry_time() const
+      {
+        const uint32_t initial_retry_delay_in_seconds = 10;
+        const uint32_t maximum_retry_delay_in_seconds = 60 * 60;
+        uint32_t doublings = std::min<uint32_t>(std::max<uint32_t>(peer_record.number_of_failed_connection_attempts, 1) - 1, 16);
+        uint32_t retry_delay = std::min(initial_retry_delay_in_seconds << doublings, maximum_retry_delay_in_seconds);
+        return peer_record.last_connection_attempt_time + retry_delay;
+      }
+      bool is_backing_off() const
+      {
+        return peer_record.last_connection_disposition == last_connection_failed || 
+               peer_record.last_connection_disposition == last_connection_rejected;
+      }
     };
 
     class peer_database_impl
@@ -39,21 +129,37 @@ namespace bts { namespace net {
     public:
       struct last_seen_time_index {};
       struct endpoint_index {};
+      struct connection_candidate_index {};
       typedef boost::multi_index_container<potential_peer_database_entry, 
                                            indexed_by<ordered_non_unique<tag<last_seen_time_index>, const_mem_fun<potential_peer_database_entry, const fc::time_point_sec&, &potential_peer_database_entry::get_last_seen_time> >,
-                                                      hashed_unique<tag<endpoint_index>, const_mem_fun<potential_peer_database_entry, const fc::ip::endpoint&, &potential_peer_database_entry::get_endpoint>, std::hash<fc::ip::endpoint>  > > > potential_peer_set;
+                                                      hashed_unique<tag<endpoint_index>, const_mem_fun<potential_peer_database_entry, const fc::ip::endpoint&, &potential_peer_database_entry::get_endpoint>, std::hash<fc::ip::endpoint>  >,
+                                                      ordered_non_unique<tag<connection_candidate_index>, const_mem_fun<potential_peer_database_entry, potential_peer_database_entry::connection_candidate_key, &potential_peer_database_entry::get_connection_candidate_key> > > > potential_peer_set;
     private:
       typedef bts::db::level_pod_map<uint32_t, potential_peer_record> potential_peer_leveldb;
       potential_peer_leveldb    _leveldb;
 
       potential_peer_set     _potential_peer_set;
+      uint32_t               _next_database_key;
+
+      /// updates are staged in a batch that stays open between flushes
+      // @{
+      bool                   _is_open;
+      fc::time_point         _last_flush_time;
+      fc::microseconds       _flush_interval;
+      // @}
 
     public:
+      peer_database_impl();
+      ~peer_database_impl();
+
       void open(const fc::path& databaseFilename);
       void close();
 
       void update_entry(const potential_peer_record& updatedRecord);
       potential_peer_record lookup_or_create_entry_for_endpoint(const fc::ip::endpoint& endpointToLookup);
+      std::vector<potential_peer_record> get_connection_candidates(size_t max_count, const fc::time_point_sec& now) const;
+      void flush();
+      void set_flush_interval(const fc::microseconds& interval);
 
       peer_database::iterator begin();
       peer_database::iterator end();
@@ -72,38 +178,103 @@ namespace bts { namespace net {
     peer_database_iterator::peer_database_iterator( const peer_database_iterator& c )
     :boost::iterator_facade<peer_database_iterator, const potential_peer_record, boost::forward_traversal_tag>(c){}
 
+    peer_database_impl::peer_database_impl() :
+      _next_database_key(1),
+      _is_open(false),
+      _flush_interval(fc::seconds(30))
+    {
+    }
+
+    peer_database_impl::~peer_database_impl()
+    {
+      try
+      {
+        close();
+      }
+      catch (const fc::exception& e)
+      {
+        wlog("unable to save the peer database: ${e}", ("e", e.to_detail_string()));
+      }
+    }
+
     void peer_database_impl::open(const fc::path& databaseFilename)
     {
       _leveldb.open(databaseFilename, true);
       _potential_peer_set.clear();
 
+      _next_database_key = 1;
       for (auto iter = _leveldb.begin(); iter.valid(); ++iter)
+      {
         _potential_peer_set.insert(potential_peer_database_entry(iter.key(), iter.value()));
+        _next_database_key = std::max(_next_database_key, iter.key() + 1);
+      }
+
+      _is_open = true;
+      _leveldb.begin_batch();
+      _last_flush_time = fc::time_point::now();
     }
 
     void peer_database_impl::close()
     {
+      if (_is_open)
+      {
+        _is_open = false;
+        _leveldb.commit_batch();
+      }
       _leveldb.close();
       _potential_peer_set.clear();
     }
 
+    void peer_database_impl::flush()
+    {
+      if (!_is_open)
+        return;
+      _leveldb.commit_batch();
+      _leveldb.begin_batch();
+      _last_flush_time = fc::time_point::now();
+    }
+
+    void peer_database_impl::set_flush_interval(const fc::microseconds& interval)
+    {
+      _flush_interval = interval;
+    }
+
     void peer_database_impl::update_entry(const potential_peer_record& updatedRecord)
     {
+      // entries are only written when the batch is flushed, so address gossip doesn't cost a
+      // database write per address
       auto iter = _potential_peer_set.get<endpoint_index>().find(updatedRecord.endpoint);
       if (iter != _potential_peer_set.get<endpoint_index>().end())
       {
         _potential_peer_set.get<endpoint_index>().modify(iter, [&updatedRecord](potential_peer_database_entry& entry) { entry.peer_record = updatedRecord; });
-        _leveldb.store(iter->database_key, updatedRecord);
+        if (_is_open)
+          _leveldb.store(iter->database_key, updatedRecord);
       }
       else
       {
-        uint32_t last_database_key;
-        _leveldb.last(last_database_key);
-        uint32_t new_database_key = last_database_key + 1;
+        uint32_t new_database_key = _next_database_key++;
         potential_peer_database_entry new_database_entry(new_database_key, updatedRecord);
         _potential_peer_set.get<endpoint_index>().insert(new_database_entry);
-        _leveldb.store(new_database_key, updatedRecord);
+        if (_is_open)
+          _leveldb.store(new_database_key, updatedRecord);
+      }
+
+      if (fc::time_point::now() - _last_flush_time >= _flush_interval)
+        flush();
+    }
+
+    std::vector<potential_peer_record> peer_database_impl::get_connection_candidates(size_t max_count, const fc::time_point_sec& now) const
+    {
+      std::vector<potential_peer_record> candidates;
+      const auto& candidate_index = _potential_peer_set.get<connection_candidate_index>();
+      for (auto iter = candidate_index.begin(); iter != candidate_index.end() && candidates.size() < max_count; ++iter)
+      {
+        // the peers we're backing off from come last, in the order they are due
+        if (iter->is_backing_off() && iter->get_next_connection_retry_time() > now)
+          break;
+        candidates.push_back(iter->peer_record);
       }
+      return candidates;
     }
 
     potential_peer_record peer_database_impl::lookup_or_create_entry_for_endpoint(const fc::ip::endpoint& endpointToLookup)
@@ -204,4 +375,19 @@ namespace bts { namespace net {
     return my->size();
   }
 
+  std::vector<potential_peer_record> peer_database::get_connection_candidates(size_t max_count, const fc::time_point_sec& now) const
+  {
+    return my->get_connection_candidates(max_count, now);
+  }
+
+  void peer_database::flush()
+  {
+    my->flush();
+  }
+
+  void peer_database::set_flush_interval(const fc::microseconds& interval)
+  {
+    my->set_flush_interval(interval);
+  }
+
 } } // end namespace bts::net
@@ -1,6 +1,7 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <string.h>
 
 #include <fc/crypto/hex.hpp>
 #include <fc/crypto/aes.hpp>
@@ -9,10 +10,120 @@
 #include <fc/network/ip.hpp>
 #include <fc/exception/exception.hpp>
 
+#include <openssl/evp.h>
+
+#include <deque>
+#include <mutex>
+
+#include <bts/db/executor.hpp>
+#include <bts/net/aead_cipher.hpp>
 #include <bts/net/stcp_socket.hpp>
 
 namespace bts { namespace net {
 
+namespace detail
+{
+  /**
+   *  Ephemeral key pairs generated ahead of the handshakes that use them, on the network
+   *  thread pool.  Each pair is handed out once and forgotten, so a handshake keeps its
+   *  forward secrecy; the pool only moves the generation off the connecting fiber.
+   */
+  class ephemeral_key_pool
+  {
+    public:
+      typedef std::pair<fc::ecc::private_key, fc::ecc::public_key_data> key_pair;
+
+      static const size_t capacity = 64;
+
+      static ephemeral_key_pool& instance()
+      {
+        static ephemeral_key_pool pool;
+        return pool;
+      }
+
+      ephemeral_key_pool():_refilling(false){}
+
+      /** a pooled pair if there is one, otherwise one generated now */
+      key_pair take()
+      {
+        key_pair pair;
+        bool have_pair = false;
+        {
+          std::unique_lock<std::mutex> lock( _mutex );
+          if( !_pairs.empty() )
+          {
+            pair = std::move( _pairs.front() );
+            _pairs.pop_front();
+            have_pair = true;
+          }
+        }
+        refill();
+        return have_pair ? pair : generate();
+      }
+
+    private:
+      static key_pair generate()
+      {
+        auto priv = fc::ecc::private_key::generate();
+        return key_pair( priv, priv.get_public_key().serialize() );
+      }
+
+      /** tops the pool up once it is half empty, one refill runs at a time */
+      void refill()
+      {
+        {
+          std::unique_lock<std::mutex> lock( _mutex );
+          if( _refilling || _pairs.size() > capacity / 2 )
+            return;
+          _refilling = true;
+        }
+        bts::db::executor::instance().pool( "network" ).async( [this]()
+        {
+          for( ;; )
+          {
+            key_pair pair = generate();
+            std::unique_lock<std::mutex> lock( _mutex );
+            _pairs.push_back( std::move( pair ) );
+            if( _pairs.size() >= capacity )
+              break;
+          }
+          std::unique_lock<std::mutex> lock( _mutex );
+          _refilling = false;
+        } );
+      }
+
+      std::mutex            _mutex;
+      std::deque<key_pair>  _pairs;
+      bool                  _refilling;
+  };
+
+  /** what both ends derive from the shared secret */
+  struct session_keys
+  {
+    fc::sha256   aes_key;
+    fc::uint128  aes_iv;
+    fc::sha256   send_key;
+    fc::sha256   recv_key;
+  };
+} // namespace detail
+
+stcp_socket::cipher_suite stcp_socket::preferred_cipher_suite()
+{
+#ifdef OPENSSL_NO_CHACHA
+  return aes_256_gcm;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  // OpenSSL picks AES-NI and PCLMUL for GCM itself, without them ChaCha20 is several times faster
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") )
+    return aes_256_gcm;
+  return chacha20_poly1305;
+#elif defined(_MSC_VER)
+  return aes_256_gcm;
+#else
+  return chacha20_poly1305;
+#endif
+}
+
 stcp_socket::stcp_socket()
 :_buf_len(0)
 {
@@ -23,19 +134,40 @@ stcp_socket::~stcp_socket()
 
 void stcp_socket::do_key_exchange()
 {
-  _priv_key = fc::ecc::private_key::generate();
-  fc::ecc::public_key pub = _priv_key.get_public_key();
-  auto s = pub.serialize();
+  detail::ephemeral_key_pool::key_pair pair = detail::ephemeral_key_pool::instance().take();
+  fc::ecc::public_key_data s = pair.second;
   _sock.write( (char*)&s, sizeof(s) );
   fc::ecc::public_key_data rpub;
   _sock.read( (char*)&rpub, sizeof(rpub) );
+  // our own key sent back would derive the same key for both directions, so records could be reflected
+  if( memcmp( &rpub, &s, sizeof(s) ) == 0 )
+    FC_THROW_EXCEPTION( exception, "the peer sent back our own public key" );
+
+  // ECDH and the derivations run on the network pool, waiting lets this thread serve other peers
+  fc::ecc::private_key priv = pair.first;
+  detail::session_keys keys = bts::db::executor::instance().pool( "network" ).async( [priv, s, rpub]()
+  {
+    auto shared_secret = priv.get_shared_secret( rpub );
+    detail::session_keys derived;
+    derived.aes_key = fc::sha256::hash( (char*)&shared_secret, sizeof(shared_secret) );
+    derived.aes_iv  = fc::city_hash_crc_128( (char*)&shared_secret, sizeof(shared_secret) );
+
+    // records get a key per direction, bound to the sender's public key
+    fc::sha256::encoder send_key;
+    send_key.write( (char*)&shared_secret, sizeof(shared_secret) );
+    send_key.write( (char*)&s, sizeof(s) );
+    derived.send_key = send_key.result();
+    fc::sha256::encoder recv_key;
+    recv_key.write( (char*)&shared_secret, sizeof(shared_secret) );
+    recv_key.write( (char*)&rpub, sizeof(rpub) );
+    derived.recv_key = recv_key.result();
+    return derived;
+  } ).wait();
 
-  auto shared_secret = _priv_key.get_shared_secret( rpub );
-//    ilog("shared secret ${s}", ("s", shared_secret) );
-  _send_aes.init( fc::sha256::hash( (char*)&shared_secret, sizeof(shared_secret) ), 
-                  fc::city_hash_crc_128((char*)&shared_secret,sizeof(shared_secret) ) );
-  _recv_aes.init( fc::sha256::hash( (char*)&shared_secret, sizeof(shared_secret) ), 
-                  fc::city_hash_crc_128((char*)&shared_secret,sizeof(shared_secret) ) );
+  _send_aes.init( keys.aes_key, keys.aes_iv );
+  _recv_aes.init( keys.aes_key, keys.aes_iv );
+  _send_key = keys.send_key;
+  _recv_key = keys.recv_key;
 }
 
 
@@ -53,23 +185,22 @@ void stcp_socket::connect_to( const fc::ip::endpoint& remote_endpoint, const fc:
 
 /**
  *   This method must read at least 16 bytes at a time from
- *   the underlying TCP socket so that it can decrypt them. It
- *   will buffer any left-over.
+ *   the underlying TCP socket so that it can decrypt them.  It
+ *   reads as much as is available, up to len, and decrypts it
+ *   in place so that large reads cost one syscall and no copy.
  */
 size_t stcp_socket::readsome( char* buffer, size_t len )
 { try {
     assert( (len % 16) == 0 );
     assert( len >= 16 );
-    char crypt_buf[4096];
-    len = std::min<size_t>(sizeof(crypt_buf),len);
 
-    size_t s = _sock.readsome( crypt_buf, len );
+    size_t s = _sock.readsome( buffer, len );
     if( s % 16 ) 
     {
-        _sock.read( crypt_buf + s, 16 - (s%16) );
+        _sock.read( buffer + s, 16 - (s%16) );
         s += 16-(s%16);
     }
-    _recv_aes.decode( crypt_buf, s, buffer );
+    _recv_aes.decode( buffer, s, buffer );
     return s;
 } FC_RETHROW_EXCEPTIONS( warn, "", ("len",len) ) }
 
@@ -82,9 +213,9 @@ size_t stcp_socket::writesome( const char* buffer, size_t len )
 { try {
     assert( len % 16 == 0 );
     assert( len > 0 );
+    FC_ASSERT( !is_sending_records() );
     char crypt_buf[4096];
     len = std::min<size_t>(sizeof(crypt_buf),len);
-    memcpy( crypt_buf, buffer, len );
     /**
      * every sizeof(crypt_buf) bytes the aes channel
      * has an error and doesn't decrypt properly...  disable
@@ -100,6 +231,45 @@ size_t stcp_socket::writesome( const char* buffer, size_t len )
     return len;
 } FC_RETHROW_EXCEPTIONS( warn, "", ("len",len) ) }
 
+size_t stcp_socket::readsome_raw( char* buffer, size_t max )
+{
+  return _sock.readsome( buffer, max );
+}
+
+void stcp_socket::decrypt( char* buffer, size_t len )
+{
+  assert( (len % 16) == 0 );
+  _recv_aes.decode( buffer, len, buffer );
+}
+
+void stcp_socket::start_sending_records( cipher_suite suite )
+{
+  _send_aead.reset( new detail::aead_cipher( suite, _send_key, true ) );
+}
+
+void stcp_socket::start_receiving_records( cipher_suite suite )
+{
+  _recv_aead.reset( new detail::aead_cipher( suite, _recv_key, false ) );
+}
+
+void stcp_socket::write_record( std::vector<char>& record )
+{ try {
+    FC_ASSERT( is_sending_records() );
+    FC_ASSERT( record.size() >= record_header_size );
+    uint32_t len = record.size() - record_header_size;
+    memcpy( record.data(), (char*)&len, record_header_size );
+    record.resize( record.size() + record_tag_size );
+    _send_aead->seal( record.data(), record.data() + record_header_size, len,
+                      record.data() + record_header_size + len );
+    _sock.write( record.data(), record.size() );
+} FC_RETHROW_EXCEPTIONS( warn, "", ("size",record.size()) ) }
+
+void stcp_socket::open_record( char* record, uint32_t len )
+{
+  FC_ASSERT( is_receiving_records() );
+  _recv_aead->open( record, record + record_header_size, len, record + record_header_size + len );
+}
+
 void stcp_socket::flush()
 {
    _sock.flush();
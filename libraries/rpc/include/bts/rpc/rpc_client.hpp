@@ -7,6 +7,8 @@
 
 #include <fc/network/ip.hpp>
 #include <fc/filesystem.hpp>
+#include <fc/thread/future.hpp>
+#include <fc/variant.hpp>
 
 namespace bts { namespace rpc {
   namespace detail { class rpc_client_impl; }
@@ -22,13 +24,35 @@ namespace bts { namespace rpc {
     rpc_client();
     ~rpc_client();
 
-    void connect_to(const fc::ip::endpoint& remote_endpoint);
+    /**
+     *  Opens pool_size connections that calls are spread over in turn, so that the calls of
+     *  callers on several threads do not queue behind each other on one socket.
+     */
+    void connect_to(const fc::ip::endpoint& remote_endpoint, uint32_t pool_size = 1);
 
+    /**
+     *  Writes the call without waiting for the replies to the calls before it, replies are
+     *  matched to their calls by id.  May be called from any thread.
+     */
+    fc::future<fc::variant> async_call(const std::string& method, const fc::variants& params = fc::variants());
+
+    typedef std::pair<std::string, fc::variants> batch_call;
+    /**
+     *  Sends calls as one request that the server runs in order.
+     *
+     *  @return the result of every call
+     *  @throw  if a call failed, with the error of the first that did
+     */
+    fc::variants call_batch(const std::vector<batch_call>& calls);
+
+    /** logs in every connection of the pool */
     bool login(const std::string& username, const std::string& password);
     bool walletpassphrase(const std::string& passphrase, const fc::microseconds& timeout);
     bts::blockchain::address getnewaddress(const std::string& account = "");
     bts::blockchain::transaction_id_type sendtoaddress(const bts::blockchain::address& address, const bts::blockchain::asset& amount,
                                                        const std::string& comment = "", const std::string& comment_to = "");
+    bts::blockchain::transaction_id_type sendmany(const std::unordered_map<bts::blockchain::address,int64_t>& amounts,
+                                                  const std::string& comment = "");
     std::unordered_map<bts::blockchain::address,std::string> listrecvaddresses();
     bts::blockchain::asset getbalance(bts::blockchain::asset_type asset_type);
     bts::blockchain::signed_transaction get_transaction(bts::blockchain::transaction_id_type trascaction_id);
@@ -3,6 +3,7 @@
 #include <fc/variant.hpp>
 #include <fc/exception/exception.hpp>
 #include <fc/log/log_message.hpp>
+#include <fc/time.hpp>
 #include <bts/client/client.hpp>
 
 namespace bts { namespace rpc {
@@ -18,18 +19,32 @@ namespace bts { namespace rpc {
   class rpc_server 
   {
   public:
+    /** how much of each call is logged */
+    enum call_logging
+    {
+      log_no_calls     = 0,
+      log_call_methods = 1,
+      log_call_params  = 2 ///< includes passwords and keys passed as parameters
+    };
+
     struct config
     {
       config():rpc_user("user"),
                rpc_password("password"),
                rpc_endpoint(fc::ip::endpoint::from_string("127.0.0.1:9988")),
                httpd_endpoint(fc::ip::endpoint::from_string("127.0.0.1:9989")),
-               htdocs("./htdocs"){}
+               htdocs("./htdocs"),
+               http_keep_alive(true),
+               call_logging(log_call_methods),
+               read_threads(2){}
       std::string      rpc_user;
       std::string      rpc_password;
       fc::ip::endpoint rpc_endpoint;
       fc::ip::endpoint httpd_endpoint;
       fc::path         htdocs;
+      bool             http_keep_alive; ///< keep http connections open for clients that ask to
+      rpc_server::call_logging call_logging;
+      uint32_t         read_threads;   ///< that serve the read_only methods, unless the rpc thread pool is configured
 
       bool is_valid() const;
     };
@@ -48,6 +63,8 @@ namespace bts { namespace rpc {
       bool        required;
     };
     typedef std::function<fc::variant(const fc::variants& params)> json_api_method_type;
+    typedef std::function<fc::variant(const bts::blockchain::chain_snapshot& chain,
+                                      const fc::variants& params)> json_api_read_method_type;
     struct method_data
     {
       std::string                 name;
@@ -56,6 +73,45 @@ namespace bts { namespace rpc {
       std::string                 return_type;
       std::vector<parameter_data> parameters;
       uint32_t                    prerequisites;
+      /**
+       *  Set for methods that only read the chain, which are served by read_method on a pool
+       *  of threads instead of by method on the thread that pushes blocks.  The snapshot of
+       *  the chain they read is taken on the thread that pushes blocks, as of the call.
+       */
+      bool                        read_only;
+      json_api_read_method_type   read_method;
+      /**
+       *  Optional, of read_only methods: the same result packed with fc::raw as a base64 string,
+       *  returned to json connections that asked for the "raw" encoding at login.
+       */
+      json_api_read_method_type   packed_read_method;
+    };
+
+    /** the calls of one method since the server started, as returned by getrpcstats */
+    struct method_statistics
+    {
+      method_statistics():calls(0),errors(0),max_microseconds(0),p50_milliseconds(0),p99_milliseconds(0){}
+
+      std::string                  method;
+      uint64_t                     calls;
+      uint64_t                     errors;           ///< calls that threw, rejected ones included
+      uint64_t                     max_microseconds;
+      uint64_t                     p50_milliseconds; ///< upper bound of the latency bucket holding the median
+      uint64_t                     p99_milliseconds;
+      bts::net::latency_histogram  latency;          ///< from dispatch until the result or error
+      bts::net::latency_histogram  queue_time;       ///< of read_only methods, waiting for a read thread
+    };
+
+    /** the cpu time and memory of the whole process, as returned by getprocessstats */
+    struct process_statistics
+    {
+      process_statistics():user_cpu_microseconds(0),system_cpu_microseconds(0),resident_bytes(0),peak_resident_bytes(0){}
+
+      fc::time_point  sampled_at;
+      uint64_t        user_cpu_microseconds;
+      uint64_t        system_cpu_microseconds;
+      uint64_t        resident_bytes;        ///< 0 where the platform doesn't tell
+      uint64_t        peak_resident_bytes;
     };
 
     rpc_server();
@@ -109,4 +165,7 @@ RPC_DECLARE_EXCEPTION(rpc_wallet_open_needed_exception)
 } } // bts::rpc
 
 #include <fc/reflect/reflect.hpp>
-FC_REFLECT( bts::rpc::rpc_server::config, (rpc_user)(rpc_password)(rpc_endpoint)(httpd_endpoint)(htdocs) )
+FC_REFLECT_ENUM( bts::rpc::rpc_server::call_logging, (log_no_calls)(log_call_methods)(log_call_params) )
+FC_REFLECT( bts::rpc::rpc_server::method_statistics, (method)(calls)(errors)(max_microseconds)(p50_milliseconds)(p99_milliseconds)(latency)(queue_time) )
+FC_REFLECT( bts::rpc::rpc_server::process_statistics, (sampled_at)(user_cpu_microseconds)(system_cpu_microseconds)(resident_bytes)(peak_resident_bytes) )
+FC_REFLECT( bts::rpc::rpc_server::config, (rpc_user)(rpc_password)(rpc_endpoint)(httpd_endpoint)(htdocs)(http_keep_alive)(call_logging)(read_threads) )
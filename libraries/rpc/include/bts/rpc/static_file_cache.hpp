@@ -0,0 +1,57 @@
+#pragma once
+#include <fc/filesystem.hpp>
+#include <fc/time.hpp>
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bts { namespace rpc {
+
+    /** a file of htdocs as it was when it was last loaded */
+    struct static_file
+    {
+       std::vector<char>  content;
+       std::vector<char>  gzipped;      ///< empty if compressing doesn't make it smaller
+       std::string        etag;
+       std::string        content_type;
+       std::time_t        last_write;
+       uint64_t           size;
+    };
+    typedef std::shared_ptr<const static_file> static_file_ptr;
+
+    /**
+     *  The files served from htdocs, read and compressed once on the storage thread pool.
+     *  A file is checked for changes at most once per check_interval, requests in between
+     *  are served from memory without touching the file system.  Only used on the thread
+     *  of the http server, whose other requests are served while one waits for a load.
+     */
+    class static_file_cache
+    {
+       public:
+          static const int64_t check_interval_us = 2000000;
+
+          /** @return nullptr if filename is not a file */
+          static_file_ptr get( const fc::path& filename );
+
+          /** the number of files remembered */
+          size_t size()const { return _files.size(); }
+
+       private:
+          struct cache_entry
+          {
+             static_file_ptr file;
+             fc::time_point  checked;
+          };
+
+          static bool            stat( const fc::path& filename, std::time_t& last_write, uint64_t& size );
+          static static_file_ptr load( const fc::path& filename, std::time_t last_write, uint64_t size );
+          static std::string     content_type( const fc::path& filename );
+          static std::vector<char> gzip( const std::vector<char>& content );
+
+          std::unordered_map<std::string, cache_entry> _files;
+    };
+
+} } // bts::rpc
@@ -8,6 +8,8 @@
 #include <fc/thread/thread.hpp>
 #include <fc/thread/future.hpp>
 
+#include <atomic>
+
 
 namespace bts { namespace rpc { 
 
@@ -16,16 +18,33 @@ namespace bts { namespace rpc {
     class rpc_client_impl
     {
     public:      
-      fc::rpc::json_connection_ptr _json_connection;
-      fc::future<void> _json_exec_loop_complete;
+      rpc_client_impl():_next_connection(0),_thread(nullptr){}
+
+      /** the pool, every connection is served by the thread connect_to was called on */
+      std::vector<fc::rpc::json_connection_ptr> _json_connections;
+      std::vector<fc::future<void> >            _json_exec_loop_completes;
+      std::atomic<uint32_t>                     _next_connection;
+      fc::thread*                               _thread;
+
+      void connect_to(const fc::ip::endpoint& remote_endpoint, uint32_t pool_size);
+
+      fc::future<fc::variant> async_call_on(const fc::rpc::json_connection_ptr& con, const std::string& method, const fc::variants& params);
+      fc::future<fc::variant> async_call(const std::string& method, const fc::variants& params);
+      fc::variants call_batch(const std::vector<rpc_client::batch_call>& calls);
 
-      void connect_to(const fc::ip::endpoint& remote_endpoint);
+      template<typename T, typename... Args>
+      T call(const std::string& method, const Args&... args)
+      {
+        return async_call(method, fc::variants{ fc::variant(args)... }).wait().template as<T>();
+      }
 
       bool login(const std::string& username, const std::string& password);
       bool walletpassphrase(const std::string& passphrase, const fc::microseconds& timeout);
       bts::blockchain::address getnewaddress(const std::string& account);
       bts::blockchain::transaction_id_type sendtoaddress(const bts::blockchain::address& address, const bts::blockchain::asset& amount,
                                                          const std::string& comment, const std::string& comment_to);
+      bts::blockchain::transaction_id_type sendmany(const std::unordered_map<bts::blockchain::address,int64_t>& amounts,
+                                                    const std::string& comment);
       std::unordered_map<bts::blockchain::address,std::string> listrecvaddresses();
       bts::blockchain::asset getbalance(bts::blockchain::asset_type asset_type);
       bts::blockchain::signed_transaction get_transaction(bts::blockchain::transaction_id_type trascaction_id);
@@ -40,104 +59,163 @@ namespace bts { namespace rpc {
       bool closewallet();
     };
 
-    void rpc_client_impl::connect_to(const fc::ip::endpoint& remote_endpoint)
+    void rpc_client_impl::connect_to(const fc::ip::endpoint& remote_endpoint, uint32_t pool_size)
     {
-      fc::tcp_socket_ptr socket = std::make_shared<fc::tcp_socket>();
-      try 
-      {
-        socket->connect_to(remote_endpoint);
-      }
-      catch ( const fc::exception& e )
+      FC_ASSERT( pool_size > 0 );
+      _thread = &fc::thread::current();
+      for( uint32_t i = 0; i < pool_size; ++i )
       {
-        elog( "fatal: error opening RPC socket to endpoint ${endpoint}: ${e}", ("endpoint", remote_endpoint)("e", e.to_detail_string() ) );
-        throw;
+        fc::tcp_socket_ptr socket = std::make_shared<fc::tcp_socket>();
+        try 
+        {
+          socket->connect_to(remote_endpoint);
+        }
+        catch ( const fc::exception& e )
+        {
+          elog( "fatal: error opening RPC socket to endpoint ${endpoint}: ${e}", ("endpoint", remote_endpoint)("e", e.to_detail_string() ) );
+          throw;
+        }
+
+        fc::buffered_istream_ptr buffered_istream = std::make_shared<fc::buffered_istream>(socket);
+        fc::buffered_ostream_ptr buffered_ostream = std::make_shared<fc::buffered_ostream>(socket);
+
+        auto json_connection = std::make_shared<fc::rpc::json_connection>(std::move(buffered_istream), 
+                                                                          std::move(buffered_ostream));
+        _json_connections.push_back(json_connection);
+        _json_exec_loop_completes.push_back(fc::async([=](){ json_connection->exec(); }, "json exec loop"));
       }
+    }
 
-      fc::buffered_istream_ptr buffered_istream = std::make_shared<fc::buffered_istream>(socket);
-      fc::buffered_ostream_ptr buffered_ostream = std::make_shared<fc::buffered_ostream>(socket);
+    fc::future<fc::variant> rpc_client_impl::async_call_on(const fc::rpc::json_connection_ptr& con, const std::string& method,
+                                                           const fc::variants& params)
+    {
+      if( &fc::thread::current() == _thread )
+        return con->async_call(method, params);
+      // a json_connection may only be used by the thread that serves it
+      return _thread->async([=](){ return con->async_call(method, params); }).wait();
+    }
 
-      _json_connection = std::make_shared<fc::rpc::json_connection>(std::move(buffered_istream), 
-                                                                    std::move(buffered_ostream));
-      _json_exec_loop_complete = fc::async([=](){ _json_connection->exec(); }, "json exec loop");
+    fc::future<fc::variant> rpc_client_impl::async_call(const std::string& method, const fc::variants& params)
+    {
+      FC_ASSERT( _json_connections.size(), "not connected" );
+      auto& con = _json_connections[_next_connection++ % _json_connections.size()];
+      return async_call_on(con, method, params);
+    }
+
+    fc::variants rpc_client_impl::call_batch(const std::vector<rpc_client::batch_call>& calls)
+    {
+      fc::variants batch;
+      batch.reserve(calls.size());
+      for( const rpc_client::batch_call& call : calls )
+        batch.push_back(fc::mutable_variant_object("method", call.first)("params", call.second));
+
+      fc::variants replies = async_call("batch", fc::variants{ fc::variant(batch) }).wait().get_array();
+      FC_ASSERT( replies.size() == calls.size(), "expected ${n} replies, got ${r}", ("n",calls.size())("r",replies.size()) );
+      fc::variants results;
+      results.reserve(replies.size());
+      for( uint32_t i = 0; i < replies.size(); ++i )
+      {
+        const fc::variant_object& reply = replies[i].get_object();
+        if( reply.find("error") != reply.end() )
+          FC_THROW_EXCEPTION( exception, "call ${i} of the batch, ${method}, failed: ${e}",
+                              ("i",i)("method",calls[i].first)("e",reply["error"]) );
+        results.push_back(reply["result"]);
+      }
+      return results;
     }
 
     bool rpc_client_impl::login(const std::string& username, const std::string& password)
     {
-      return _json_connection->call<bool>("login", username, password);
+      std::vector<fc::future<fc::variant> > logins;
+      for( const fc::rpc::json_connection_ptr& con : _json_connections )
+        logins.push_back(async_call_on(con, "login", fc::variants{ fc::variant(username), fc::variant(password) }));
+      bool logged_in = true;
+      for( fc::future<fc::variant>& login : logins )
+        logged_in = login.wait().as_bool() && logged_in;
+      return logged_in;
     }
 
     bool rpc_client_impl::walletpassphrase(const std::string& passphrase, const fc::microseconds& timeout)
     {
       uint32_t timeout_seconds = timeout.count() / fc::seconds(1).count();
-      return _json_connection->call<bool>("walletpassphrase", passphrase, fc::variant(timeout_seconds));
+      return call<bool>("walletpassphrase", passphrase, fc::variant(timeout_seconds));
     }
 
     bts::blockchain::address rpc_client_impl::getnewaddress(const std::string& account)
     {
-      return _json_connection->call<bts::blockchain::address>("getnewaddress", account);
+      return call<bts::blockchain::address>("getnewaddress", account);
     }
 
     bts::blockchain::transaction_id_type rpc_client_impl::sendtoaddress(const bts::blockchain::address& address, const bts::blockchain::asset& amount,
                                                                         const std::string& comment, const std::string& comment_to)
     {
-      return _json_connection->call<bts::blockchain::transaction_id_type>("sendtoaddress", fc::variant((std::string)address), fc::variant(amount), fc::variant(comment), fc::variant(comment_to));
+      return call<bts::blockchain::transaction_id_type>("sendtoaddress", fc::variant((std::string)address), fc::variant(amount), fc::variant(comment), fc::variant(comment_to));
+    }
+
+    bts::blockchain::transaction_id_type rpc_client_impl::sendmany(const std::unordered_map<bts::blockchain::address,int64_t>& amounts,
+                                                                   const std::string& comment)
+    {
+      fc::mutable_variant_object amounts_object;
+      for( auto itr = amounts.begin(); itr != amounts.end(); ++itr )
+        amounts_object[(std::string)itr->first] = itr->second;
+      return call<bts::blockchain::transaction_id_type>("sendmany", fc::variant(amounts_object), fc::variant(comment));
     }
 
     std::unordered_map<bts::blockchain::address,std::string> rpc_client_impl::listrecvaddresses()
     {
-      return _json_connection->call<std::unordered_map<bts::blockchain::address,std::string> >("listrecvaddresses");
+      return call<std::unordered_map<bts::blockchain::address,std::string> >("listrecvaddresses");
     }
 
     bts::blockchain::asset rpc_client_impl::getbalance(bts::blockchain::asset_type asset_type)
     {
-      return _json_connection->call<bts::blockchain::asset>("getbalance", fc::variant(asset_type));
+      return call<bts::blockchain::asset>("getbalance", fc::variant(asset_type));
     }
 
     bts::blockchain::signed_transaction rpc_client_impl::get_transaction(bts::blockchain::transaction_id_type trascaction_id)
     {
-      return _json_connection->call<bts::blockchain::signed_transaction>("get_transaction", fc::variant(trascaction_id));
+      return call<bts::blockchain::signed_transaction>("get_transaction", fc::variant(trascaction_id));
     }
 
     bts::blockchain::signed_block_header rpc_client_impl::getblock(uint32_t block_num)
     {
-      return _json_connection->call<bts::blockchain::signed_block_header>("getblock", fc::variant(block_num));
+      return call<bts::blockchain::signed_block_header>("getblock", fc::variant(block_num));
     }
 
     bool rpc_client_impl::validateaddress(bts::blockchain::address address)
     {
-      return _json_connection->call<bool>("getblock", fc::variant(address));
+      return call<bool>("getblock", fc::variant(address));
     }
 
     bool rpc_client_impl::rescan(uint32_t block_num)
     {
-      return _json_connection->call<bool>("rescan", fc::variant(block_num));
+      return call<bool>("rescan", fc::variant(block_num));
     }
 
     bool rpc_client_impl::import_bitcoin_wallet(const fc::path& wallet_filename, const std::string& password)
     {
-      return _json_connection->call<bool>("import_bitcoin_wallet", wallet_filename.string(), password);
+      return call<bool>("import_bitcoin_wallet", wallet_filename.string(), password);
     }
 
     bool rpc_client_impl::import_private_key(const fc::sha256& hash, const std::string& label)
     {
-      return _json_connection->call<bool>("import_private_key", (std::string)hash, label);
+      return call<bool>("import_private_key", (std::string)hash, label);
     }
     bool rpc_client_impl::openwallet(const std::string& wallet_username, const std::string& wallet_passphrase)
     {
-      return _json_connection->call<bool>("openwallet", wallet_username, wallet_passphrase);
+      return call<bool>("openwallet", wallet_username, wallet_passphrase);
     }
     bool rpc_client_impl::createwallet(const std::string& wallet_username, const std::string& wallet_passphrase, const std::string& spending_passphrase)
     {
-      return _json_connection->call<bool>("createwallet", wallet_username, wallet_passphrase, spending_passphrase);
+      return call<bool>("createwallet", wallet_username, wallet_passphrase, spending_passphrase);
     }
     fc::optional<std::string> rpc_client_impl::currentwallet()
     {
-      fc::variant result = _json_connection->async_call("currentwallet").wait();
+      fc::variant result = async_call("currentwallet", fc::variants()).wait();
       return result.is_null() ? fc::optional<std::string>() : result.as_string();
     }
     bool rpc_client_impl::closewallet()
     {
-      return _json_connection->call<bool>("closewallet");
+      return call<bool>("closewallet");
     }
   } // end namespace detail
 
@@ -151,9 +229,19 @@ namespace bts { namespace rpc {
   {
   }
 
-  void rpc_client::connect_to(const fc::ip::endpoint& remote_endpoint)
+  void rpc_client::connect_to(const fc::ip::endpoint& remote_endpoint, uint32_t pool_size /* = 1 */)
+  {
+    my->connect_to(remote_endpoint, pool_size);
+  }
+
+  fc::future<fc::variant> rpc_client::async_call(const std::string& method, const fc::variants& params /* = fc::variants() */)
+  {
+    return my->async_call(method, params);
+  }
+
+  fc::variants rpc_client::call_batch(const std::vector<batch_call>& calls)
   {
-    my->connect_to(remote_endpoint);
+    return my->call_batch(calls);
   }
 
   bool rpc_client::login(const std::string& username, const std::string& password)
@@ -177,6 +265,12 @@ namespace bts { namespace rpc {
     return my->sendtoaddress(address, amount, comment, comment_to);
   }
 
+  bts::blockchain::transaction_id_type rpc_client::sendmany(const std::unordered_map<bts::blockchain::address,int64_t>& amounts,
+                                                            const std::string& comment)
+  {
+    return my->sendmany(amounts, comment);
+  }
+
   std::unordered_map<bts::blockchain::address,std::string> rpc_client::listrecvaddresses()
   {
     return my->listrecvaddresses();
@@ -1,15 +1,28 @@
 #include <bts/rpc/rpc_server.hpp>
+#include <bts/rpc/static_file_cache.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/network/tcp_socket.hpp>
 #include <fc/rpc/json_connection.hpp>
 #include <fc/io/json.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/crypto/base64.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/network/http/server.hpp>
-#include <fc/interprocess/file_mapping.hpp>
+#include <bts/db/executor.hpp>
+#include <bts/db/trace.hpp>
 #include <boost/bind.hpp>
 #include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <fstream>
 #include <sstream>
 #include <limits>
+#include <memory>
+#include <unordered_map>
+
+#ifndef WIN32
+# include <sys/resource.h>
+# include <unistd.h>
+#endif
 
 
 namespace bts { namespace rpc { 
@@ -26,17 +39,102 @@ namespace bts { namespace rpc {
          fc::future<void>    _accept_loop_complete;
          rpc_server*         _self;
          std::string         _username;
+         /** the wallet of _username when the client has a wallet manager, held while it is open */
+         bts::wallet::wallet_ptr _managed_wallet;
 
          typedef std::map<std::string, rpc_server::method_data> method_map_type;
          method_map_type _method_map;
 
          /** the set of connections that have successfully logged in */
          std::unordered_set<fc::rpc::json_connection*> _authenticated_connection_set;
+         /** the connections that asked at login for packed results */
+         std::unordered_set<fc::rpc::json_connection*> _packed_connection_set;
+
+         /** what a json connection has subscribed to */
+         enum subscription_topic
+         {
+            subscribe_blocks = 1, ///< the header of each new block
+            subscribe_wallet = 2  ///< the wallet transactions of each new block
+         };
+         /** topics by connection, connections are removed once they close */
+         std::unordered_map<fc::rpc::json_connection*, uint32_t> _subscriptions;
+         /** the thread the connections are served on, configure() runs on it */
+         fc::thread*                                   _thread;
+
+         /** of the chain as of its head block when taken, replaced once the head moves, only used on the chain thread */
+         bts::blockchain::chain_snapshot_ptr              _chain_snapshot;
+
+         /** by method name, only updated on _thread */
+         std::map<std::string, rpc_server::method_statistics> _method_statistics;
+
+         static_file_cache                                _static_files;
+
+         rpc_server_impl():_thread(nullptr){}
+
+         /** must be called inside run_on_chain_thread, the snapshot can then be read on any thread */
+         bts::blockchain::chain_snapshot_ptr get_chain_snapshot()
+         {
+            auto chain = _client->get_chain();
+            if( !_chain_snapshot || _chain_snapshot->head_block_id() != chain->head_block_id() )
+               _chain_snapshot = chain->get_snapshot();
+            return _chain_snapshot;
+         }
+
+         /** @param packed call packed_read_method instead of read_method */
+         fc::variant dispatch_read_method( const rpc_server::method_data& method_data, const bts::blockchain::chain_snapshot_ptr& snapshot,
+                                           const fc::variants& arguments, bool packed )
+         {
+            auto read_method = packed ? method_data.packed_read_method : method_data.read_method;
+            auto& workers    = bts::db::executor::instance().pool( "rpc" );
+            auto queued      = fc::time_point::now();
+            fc::time_point started;
+            // waiting yields to the other tasks of this thread, block import included
+            auto result = workers.async( [snapshot,read_method,arguments,&started]()
+            {
+               started = fc::time_point::now();
+               return read_method( *snapshot, arguments );
+            } ).wait();
+            _method_statistics[method_data.name].queue_time.add_sample( started - queued );
+            return result;
+         }
+
+         /**
+          *  Browsers revalidate with the ETag on every load and get a 304 while the file is
+          *  unchanged, the compressed copy goes to those that accept gzip.
+          */
+         void send_static_file( const fc::http::request& r, const fc::http::server::response& s, const static_file& file )
+         {
+            s.add_header( "ETag", file.etag );
+            s.add_header( "Cache-Control", "no-cache" );
+            if( file.gzipped.size() )
+               s.add_header( "Vary", "Accept-Encoding" );
+            if( r.get_header( "If-None-Match" ) == file.etag )
+            {
+               s.set_status( fc::http::reply::status_code( 304 ) );
+               s.set_length( 0 );
+               return;
+            }
+            s.add_header( "Content-Type", file.content_type );
+            const std::vector<char>* body = &file.content;
+            if( file.gzipped.size() && r.get_header( "Accept-Encoding" ).find( "gzip" ) != std::string::npos )
+            {
+               s.add_header( "Content-Encoding", "gzip" );
+               body = &file.gzipped;
+            }
+            s.set_status( fc::http::reply::OK );
+            s.set_length( body->size() );
+            if( body->size() )
+               s.write( body->data(), body->size() );
+         }
 
          void handle_request( const fc::http::request& r, const fc::http::server::response& s )
          {
-             s.add_header( "Connection", "close" );
-             ilog( "handle request ${r}", ("r",r.path) );
+             if( _config.http_keep_alive && boost::iequals( r.get_header( "Connection" ), "keep-alive" ) )
+                s.add_header( "Connection", "keep-alive" );
+             else
+                s.add_header( "Connection", "close" );
+             if( _config.call_logging != rpc_server::log_no_calls )
+                ilog( "handle request ${r}", ("r",r.path) );
 
              try {
                 auto auth_value = r.get_header( "Authorization" );
@@ -49,7 +147,6 @@ namespace bts { namespace rpc {
                    username    = userpass.substr( 0, split );
                    password    = userpass.substr( split + 1 );
                 }
-                ilog( "username: '${u}' password: '${p}' config ${c}", ("u",username)("p",password)("c",_config) );
                 if( _config.rpc_user     != username ||
                     _config.rpc_password != password )
                 {
@@ -58,6 +155,7 @@ namespace bts { namespace rpc {
                    s.set_length( message.size() );
                    s.set_status( fc::http::reply::NotAuthorized );
                    s.write( message.c_str(), message.size() );
+                   return;
                 }
 
                 auto dotpos = r.path.find( ".." );
@@ -67,19 +165,9 @@ namespace bts { namespace rpc {
                 {
                     filename = _config.htdocs / "index.html";
                 }
-                if( fc::exists( filename ) )
+                if( auto file = _static_files.get( filename ) )
                 {
-                    FC_ASSERT( !fc::is_directory( filename ) );
-                    uint64_t file_size = fc::file_size( filename );
-                    FC_ASSERT( file_size != 0 );
-                    FC_ASSERT(file_size <= std::numeric_limits<size_t>::max());
-
-                    fc::file_mapping fm( filename.generic_string().c_str(), fc::read_only );
-                    fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size( filename ) );
-
-                    s.set_status( fc::http::reply::OK );
-                    s.set_length( file_size );
-                    s.write( (const char*)mr.get_address(), mr.get_size() );
+                    send_static_file( r, s, *file );
                     return;
                 }
                 if( r.path == fc::path("/rpc") )
@@ -87,17 +175,19 @@ namespace bts { namespace rpc {
                    handle_http_rpc( r, s );
                    return;
                 }
+                if( r.path == fc::path("/metrics") )
+                {
+                   auto reply = fc::json::to_string( getrpcstats( fc::variants() ) );
+                   s.add_header( "Content-Type", "application/json" );
+                   s.set_status( fc::http::reply::OK );
+                   s.set_length( reply.size() );
+                   s.write( reply.c_str(), reply.size() );
+                   return;
+                }
                 filename = _config.htdocs / "404.html";
-                FC_ASSERT( !fc::is_directory( filename ) );
-                auto file_size = fc::file_size( filename );
-                FC_ASSERT( file_size != 0 );
-
-                fc::file_mapping fm( filename.generic_string().c_str(), fc::read_only );
-                fc::mapped_region mr( fm, fc::read_only, 0, fc::file_size( filename ) );
-
-                s.set_status( fc::http::reply::OK );
-                s.set_length( file_size );
-                s.write( (const char*)mr.get_address(), mr.get_size() );
+                auto not_found = _static_files.get( filename );
+                FC_ASSERT( not_found, "${f} not found", ("f",filename) );
+                send_static_file( r, s, *not_found );
              } 
              catch ( const fc::exception& e )
              {
@@ -119,52 +209,87 @@ namespace bts { namespace rpc {
         
          }
 
+         /**
+          *  @param status set to what the reply to a call on its own reports
+          *  @return the reply to rpc_call, with its id and jsonrpc version
+          */
+         fc::mutable_variant_object handle_rpc_call( const fc::variant_object& rpc_call, fc::http::reply::status_code& status )
+         {
+                fc::mutable_variant_object  result;
+                if( rpc_call.find( "jsonrpc" ) != rpc_call.end() )
+                   result["jsonrpc"] = rpc_call["jsonrpc"];
+                result["id"] = rpc_call.find( "id" ) != rpc_call.end() ? rpc_call["id"] : fc::variant();
+
+                auto method_name = rpc_call["method"].as_string();
+                auto call_itr = _method_map.find( method_name );
+                if( call_itr == _method_map.end() )
+                {
+                   status = fc::http::reply::NotFound;
+                   result["error"] = fc::mutable_variant_object( "message", "Invalid Method: " + method_name );
+                   return result;
+                }
+
+                try {
+                   fc::variants params;
+                   if( rpc_call.find( "params" ) != rpc_call.end() )
+                      params = rpc_call["params"].get_array();
+                   result["result"] = dispatch_authenticated_method( call_itr->second, params );
+                   status = fc::http::reply::OK;
+                }
+                catch ( const fc::exception& e )
+                {
+                   status = fc::http::reply::InternalServerError;
+                   result["error"] = fc::mutable_variant_object( "message",e.to_detail_string() );
+                }
+                return result;
+         }
+
+         /**
+          *  The body is a single call or, as in JSON-RPC 2.0, an array of calls that are answered
+          *  in order by one array.  Calls of a batch without an id are notifications that are
+          *  executed without a reply.  An empty batch is an invalid request, answered with one
+          *  error object rather than an array.
+          */
          void handle_http_rpc(const fc::http::request& r, const fc::http::server::response& s )
          {
                 std::string str(r.body.data(),r.body.size());
                 try {
-                   auto rpc_call = fc::json::from_string( str ).get_object();
-                   auto method_name = rpc_call["method"].as_string();
-                   auto params = rpc_call["params"].get_array();
-
-                   ilog( "method: ${m}  params: ${p}", ("m", method_name)("p",params) );
-                   ilog( "call: ${c}", ("c", str) );
-                   
-                   auto call_itr = _method_map.find( method_name );
-                   if( call_itr != _method_map.end() )
+                   auto request = fc::json::from_string( str );
+                   fc::http::reply::status_code status = fc::http::reply::OK;
+                   std::string reply;
+                   if( request.is_array() && request.get_array().empty() )
+                   {
+                      status = fc::http::reply::BadRequest;
+                      reply  = fc::json::to_string( fc::mutable_variant_object( "jsonrpc", "2.0" )( "id", fc::variant() )
+                                                    ( "error", fc::mutable_variant_object( "message", "Invalid RPC Request: the batch is empty" ) ) );
+                   }
+                   else if( request.is_array() )
                    {
-                      fc::mutable_variant_object  result;
-                      result["id"]     =  rpc_call["id"];
-                      try {
-                         result["result"] =  dispatch_authenticated_method(call_itr->second, params);
-                         auto reply = fc::json::to_string( result );
-                         s.set_status( fc::http::reply::OK );
-                      } 
-                      catch ( const fc::exception& e )
+                      fc::variants replies;
+                      for( const fc::variant& call : request.get_array() )
                       {
-                         s.set_status( fc::http::reply::InternalServerError );
-                         result["error"] = fc::mutable_variant_object( "message",e.to_detail_string() );
+                         try {
+                            const fc::variant_object& rpc_call = call.get_object();
+                            fc::http::reply::status_code call_status;
+                            auto result = handle_rpc_call( rpc_call, call_status );
+                            if( rpc_call.find( "id" ) != rpc_call.end() )
+                               replies.push_back( result );
+                         }
+                         catch ( const fc::exception& e )
+                         {
+                            replies.push_back( fc::mutable_variant_object( "id", fc::variant() )
+                                               ( "error", fc::mutable_variant_object( "message", "Invalid RPC Request\n" + e.to_detail_string() ) ) );
+                         }
                       }
-                      ilog( "${e}", ("e",result) );
-                      auto reply = fc::json::to_string( result );
-                      s.set_length( reply.size() );
-                      s.write( reply.c_str(), reply.size() );
-                      return;
+                      reply = fc::json::to_string( replies );
                    }
                    else
                    {
-                       std::string message = "Invalid Method: " + method_name;
-                       fc::mutable_variant_object  result;
-                       result["id"]     =  rpc_call["id"];
-                       s.set_status( fc::http::reply::NotFound );
-                       result["error"] = fc::mutable_variant_object( "message", message );
-
-                       ilog( "${e}", ("e",result) );
-                       auto reply = fc::json::to_string( result );
-                       s.set_length( reply.size() );
-                       s.write( reply.c_str(), reply.size() );
-                       return;
+                      reply = fc::json::to_string( handle_rpc_call( request.get_object(), status ) );
                    }
+                   s.set_status( status );
+                   s.set_length( reply.size() );
+                   s.write( reply.c_str(), reply.size() );
                 } 
                 catch ( const fc::exception& e )
                 {
@@ -220,7 +345,20 @@ namespace bts { namespace rpc {
          //   TODO  0.5 BTC: handle connection errors and and connection closed without
          //   creating an entirely new context... this is waistful
          //     json_con->exec(); 
-              fc::async( [json_con]{ json_con->exec().wait(); } );
+              fc::async( [this,json_con]
+              {
+                 try
+                 {
+                    json_con->exec().wait();
+                 }
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "json connection closed: ${e}", ("e",e.to_string()) );
+                 }
+                 _subscriptions.erase( json_con.get() );
+                 _authenticated_connection_set.erase( json_con.get() );
+                 _packed_connection_set.erase( json_con.get() );
+              } );
            }
          }
 
@@ -232,6 +370,10 @@ namespace bts { namespace rpc {
             // the login method is a special case that is only used for raw json connections
             // (not for the CLI or HTTP(s) json rpc)
             con->add_method("login", boost::bind(&rpc_server_impl::login, this, capture_con, _1));
+            // so are subscriptions, their notifications are pushed over the connection
+            con->add_method("subscribe", boost::bind(&rpc_server_impl::subscribe, this, capture_con, _1));
+            con->add_method("unsubscribe", boost::bind(&rpc_server_impl::unsubscribe, this, capture_con, _1));
+            con->add_method("batch", boost::bind(&rpc_server_impl::batch, this, capture_con, _1));
             for (const method_map_type::value_type& method : _method_map)
             {
               con->add_method(method.first, boost::bind(&rpc_server_impl::dispatch_method_from_json_connection,
@@ -243,21 +385,68 @@ namespace bts { namespace rpc {
                                                          const rpc_server::method_data& method_data, 
                                                          const fc::variants& arguments)
         {
-          ilog( "arguments: ${params}", ("params",arguments) );
           if ((method_data.prerequisites & rpc_server::json_authenticated) &&
               _authenticated_connection_set.find(con) == _authenticated_connection_set.end())
             FC_THROW_EXCEPTION(exception, "not logged in"); 
-          return dispatch_authenticated_method(method_data, arguments);
+          bool packed = _packed_connection_set.find(con) != _packed_connection_set.end();
+          return dispatch_authenticated_method(method_data, arguments, packed);
         }
 
+        /**
+         *  Times the call and counts it in _method_statistics.
+         *
+         *  @param packed for methods with a packed_read_method, return their result packed
+         */
         fc::variant dispatch_authenticated_method(const rpc_server::method_data& method_data, 
-                                                  const fc::variants& arguments)
+                                                  const fc::variants& arguments, bool packed = false)
+        {
+          BTS_TRACE_SPAN("rpc_server::dispatch");
+          auto start = fc::time_point::now();
+          try
+          {
+            auto result = invoke_authenticated_method(method_data, arguments, packed);
+            record_call(method_data.name, start, false);
+            return result;
+          }
+          catch (...)
+          {
+            record_call(method_data.name, start, true);
+            throw;
+          }
+        }
+
+        void record_call(const std::string& method_name, const fc::time_point& start, bool failed)
+        {
+          auto latency = fc::time_point::now() - start;
+          auto& stats  = _method_statistics[method_name];
+          ++stats.calls;
+          if (failed)
+            ++stats.errors;
+          stats.max_microseconds = std::max<uint64_t>(stats.max_microseconds, std::max<int64_t>(latency.count(), 0));
+          stats.latency.add_sample(latency);
+        }
+
+        /** @return the upper bound in ms of the latency_histogram bucket that holds fraction of the samples */
+        static uint64_t percentile_milliseconds(const bts::net::latency_histogram& histogram, double fraction)
+        {
+          uint64_t rank = uint64_t(histogram.sample_count * fraction);
+          uint64_t seen = 0;
+          for (size_t bucket = 0; bucket < histogram.buckets.size(); ++bucket)
+          {
+            seen += histogram.buckets[bucket];
+            if (seen > rank)
+              return uint64_t(1) << bucket;
+          }
+          return uint64_t(1) << (histogram.buckets.size() - 1);
+        }
+
+        fc::variant invoke_authenticated_method(const rpc_server::method_data& method_data,
+                                                const fc::variants& arguments, bool packed)
         {
-          ilog( "arguments: ${params}", ("params",arguments) );
-          if (method_data.prerequisites & rpc_server::wallet_open)
-            check_wallet_is_open();
-          if (method_data.prerequisites & rpc_server::wallet_unlocked)
-            check_wallet_unlocked();
+          if (_config.call_logging == rpc_server::log_call_params)
+            ilog( "method: ${m}  params: ${p}", ("m",method_data.name)("p",arguments) );
+          else if (_config.call_logging == rpc_server::log_call_methods)
+            ilog( "method: ${m}", ("m",method_data.name) );
           if (method_data.prerequisites & rpc_server::connected_to_network)
             check_connected_to_network();
           if (arguments.size() > method_data.parameters.size())
@@ -273,13 +462,28 @@ namespace bts { namespace rpc {
           if (arguments.size() < required_argument_count)
             FC_THROW_EXCEPTION(exception, "too few arguments (expected at least ${count})", ("count", required_argument_count));
 
-          return method_data.method(arguments);
+          // the wallet and the chain are only used on the thread that applies blocks
+          fc::variant result;
+          bts::blockchain::chain_snapshot_ptr snapshot;
+          _client->run_on_chain_thread([&]()
+          {
+            if (method_data.prerequisites & rpc_server::wallet_open)
+              check_wallet_is_open();
+            if (method_data.prerequisites & rpc_server::wallet_unlocked)
+              check_wallet_unlocked();
+            if (method_data.read_only)
+              snapshot = get_chain_snapshot();
+            else
+              result = method_data.method(arguments);
+          });
+          if (method_data.read_only)
+            return dispatch_read_method(method_data, snapshot, arguments, packed && method_data.packed_read_method);
+          return result;
         }
 
         // This method invokes the function directly, called by the CLI intepreter.
         fc::variant direct_invoke_method(const std::string& method_name, const fc::variants& arguments)
         {
-          ilog( "method: ${method} arguments: ${params}", ("method",method_name)("params",arguments) );
           auto iter = _method_map.find(method_name);
           if (iter == _method_map.end())
             FC_THROW_EXCEPTION(exception, "Invalid command ${command}", ("command", method_name));
@@ -300,19 +504,100 @@ namespace bts { namespace rpc {
           }
         }
 
+        /** the open wallet of the manager, or the client's own wallet when it has no manager */
+        bts::wallet::wallet_ptr get_wallet()const
+        {
+          if (_client->get_wallet_manager())
+            return _managed_wallet;
+          return _client->get_wallet();
+        }
+
         void check_wallet_unlocked()
         {
-          if (_client->get_wallet()->is_locked())
+          if (!get_wallet() || get_wallet()->is_locked())
             throw rpc_wallet_unlock_needed_exception(FC_LOG_MESSAGE(error, "The wallet's spending key must be unlocked before executing this command"));
         }
 
         void check_wallet_is_open()
         {
-          if (!_client->get_wallet()->is_open())
+          if (!get_wallet() || !get_wallet()->is_open())
             throw rpc_wallet_open_needed_exception(FC_LOG_MESSAGE(error, "The wallet must be open before executing this command"));
         }
 
+        /**
+         *  Called on the thread that pushed the block, collects what the wallet found in it there
+         *  and leaves the notifications to _thread.
+         */
+        void on_new_block( const bts::blockchain::signed_block_header& header )
+        {
+           fc::variant wallet_update;
+           auto wallet = get_wallet();
+           if( wallet && wallet->is_open() )
+           {
+              std::vector<bts::wallet::transaction_state> trxs;
+              bts::wallet::transaction_history_cursor start( header.block_num, 0 );
+              bool more = true;
+              while( more )
+              {
+                 auto page = wallet->get_transaction_history( start, 100 );
+                 more = page.next && page.next->block_num == header.block_num;
+                 for( const bts::wallet::transaction_state& state : page.transactions )
+                 {
+                    if( state.block_num == header.block_num )
+                       trxs.push_back( state );
+                 }
+                 if( more ) start = *page.next;
+              }
+              if( trxs.size() )
+              {
+                 wallet_update = fc::mutable_variant_object( "block_num", header.block_num )
+                                                           ( "transactions", trxs )
+                                                           ( "balance", wallet->get_balance( 0 ) );
+              }
+           }
+           _thread->async( [this,header,wallet_update]() { notify_subscribers( header, wallet_update ); } );
+        }
+
+        void notify_subscribers( const bts::blockchain::signed_block_header& header, const fc::variant& wallet_update )
+        {
+           // sending yields, connections may close meanwhile
+           std::vector<fc::rpc::json_connection*> connections;
+           for( auto itr = _subscriptions.begin(); itr != _subscriptions.end(); ++itr )
+              connections.push_back( itr->first );
+
+           for( fc::rpc::json_connection* con : connections )
+           {
+              auto itr = _subscriptions.find( con );
+              if( itr == _subscriptions.end() ) continue;
+              uint32_t topics = itr->second;
+              try
+              {
+                 if( topics & subscribe_blocks )
+                    con->notice( "block_added", fc::variants{ fc::variant( header ) } );
+                 if( (topics & subscribe_wallet) && !wallet_update.is_null() )
+                    con->notice( "wallet_updated", fc::variants{ wallet_update } );
+              }
+              catch ( const fc::exception& e )
+              {
+                 wlog( "unable to notify subscriber: ${e}", ("e",e.to_string()) );
+                 _subscriptions.erase( con );
+              }
+           }
+        }
+
+        /** @return the topic named by param */
+        uint32_t subscription_topic_from_name( const fc::variant& param )
+        {
+           auto name = param.as_string();
+           if( name == "blocks" ) return subscribe_blocks;
+           if( name == "wallet" ) return subscribe_wallet;
+           FC_THROW_EXCEPTION( exception, "unknown subscription topic ${t}, expected blocks or wallet", ("t",name) );
+        }
+
         fc::variant login( fc::rpc::json_connection* json_connection, const fc::variants& params );
+        fc::variant subscribe( fc::rpc::json_connection* json_connection, const fc::variants& params );
+        fc::variant unsubscribe( fc::rpc::json_connection* json_connection, const fc::variants& params );
+        fc::variant batch( fc::rpc::json_connection* json_connection, const fc::variants& params );
         fc::variant help( const fc::variants& params );
         fc::variant openwallet( const fc::variants& params );
         fc::variant createwallet( const fc::variants& params );
@@ -324,29 +609,114 @@ namespace bts { namespace rpc {
         fc::variant _create_sendtoaddress_transaction( const fc::variants& params );
         fc::variant sendtransaction( const fc::variants& params );
         fc::variant sendtoaddress( const fc::variants& params );
+        fc::variant sendmany( const fc::variants& params );
         fc::variant listrecvaddresses( const fc::variants& params );
         fc::variant list_send_addresses( const fc::variants& params );
         fc::variant get_send_address_label( const fc::variants& params );
         fc::variant getbalance( const fc::variants& params );
-        fc::variant get_transaction( const fc::variants& params );
+        fc::variant get_transaction( const bts::blockchain::chain_snapshot& chain, const fc::variants& params );
         fc::variant get_transaction_history( const fc::variants& params );
-        fc::variant getblock( const fc::variants& params );
+        fc::variant getblock( const bts::blockchain::chain_snapshot& chain, const fc::variants& params );
+        fc::variant getblock_packed( const bts::blockchain::chain_snapshot& chain, const fc::variants& params );
+        fc::variant get_transaction_packed( const bts::blockchain::chain_snapshot& chain, const fc::variants& params );
+
+        /** @return v packed with fc::raw as a base64 string, without building a variant of v */
+        template<typename T>
+        static fc::variant pack_result( const T& v )
+        {
+          auto packed = fc::raw::pack( v );
+          return fc::variant( fc::base64_encode( packed.data(), packed.size() ) );
+        }
         fc::variant validateaddress( const fc::variants& params );
         fc::variant rescan( const fc::variants& params );
         fc::variant import_bitcoin_wallet( const fc::variants& params );
         fc::variant import_private_key( const fc::variants& params );
         fc::variant importprivkey( const fc::variants& params );
+        fc::variant get_network_statistics( const fc::variants& params );
+        fc::variant getrpcstats( const fc::variants& params );
+        fc::variant getstoragestats( const fc::variants& params );
+        fc::variant getthreadpoolstats( const fc::variants& params );
+        fc::variant getprocessstats( const fc::variants& params );
+        fc::variant estimatefee( const fc::variants& params );
     };
 
     fc::variant rpc_server_impl::login(fc::rpc::json_connection* json_connection, const fc::variants& params)
     {
-      FC_ASSERT( params.size() == 2 );
+      FC_ASSERT( params.size() == 2 || params.size() == 3 );
       FC_ASSERT( params[0].as_string() == _config.rpc_user )
       FC_ASSERT( params[1].as_string() == _config.rpc_password )
       _authenticated_connection_set.insert( json_connection );
+      // the optional encoding of results, "raw" for fc::raw packed ones where methods offer them
+      if( params.size() == 3 )
+      {
+        auto encoding = params[2].as_string();
+        FC_ASSERT( encoding == "json" || encoding == "raw", "unknown encoding ${e}, expected json or raw", ("e",encoding) );
+        if( encoding == "raw" )
+          _packed_connection_set.insert( json_connection );
+        else
+          _packed_connection_set.erase( json_connection );
+      }
+      return fc::variant( true );
+    }
+
+    fc::variant rpc_server_impl::subscribe(fc::rpc::json_connection* json_connection, const fc::variants& params)
+    {
+      check_json_connection_authenticated( json_connection );
+      FC_ASSERT( params.size() >= 1, "expected the topics to subscribe to: blocks, wallet" );
+      uint32_t topics = 0;
+      for( const fc::variant& param : params )
+        topics |= subscription_topic_from_name( param );
+      _subscriptions[json_connection] |= topics;
+      return fc::variant( true );
+    }
+
+    fc::variant rpc_server_impl::unsubscribe(fc::rpc::json_connection* json_connection, const fc::variants& params)
+    {
+      check_json_connection_authenticated( json_connection );
+      auto itr = _subscriptions.find( json_connection );
+      if( itr == _subscriptions.end() ) return fc::variant( true );
+      if( params.empty() ) // from everything
+        itr->second = 0;
+      for( const fc::variant& param : params )
+        itr->second &= ~subscription_topic_from_name( param );
+      if( itr->second == 0 )
+        _subscriptions.erase( itr );
       return fc::variant( true );
     }
 
+    /**
+     *  Runs the calls of params[0], an array of {"method","params"} objects, in order and
+     *  answers with an array that holds a {"result"} or an {"error"} object per call, as
+     *  batches sent over HTTP are answered.  An empty array is an error.
+     */
+    fc::variant rpc_server_impl::batch(fc::rpc::json_connection* json_connection, const fc::variants& params)
+    {
+      FC_ASSERT( params.size() == 1, "expected an array of calls" );
+      FC_ASSERT( !params[0].get_array().empty(), "Invalid RPC Request: the batch is empty" );
+      fc::variants replies;
+      for( const fc::variant& call : params[0].get_array() )
+      {
+        fc::mutable_variant_object reply;
+        try {
+          const fc::variant_object& rpc_call = call.get_object();
+          auto method_name = rpc_call["method"].as_string();
+          auto call_itr = _method_map.find( method_name );
+          if( call_itr == _method_map.end() )
+            FC_THROW_EXCEPTION( exception, "Invalid Method: ${m}", ("m",method_name) );
+          fc::variants arguments;
+          if( rpc_call.find( "params" ) != rpc_call.end() )
+            arguments = rpc_call["params"].get_array();
+          reply["result"] = dispatch_method_from_json_connection( json_connection, call_itr->second, arguments );
+        }
+        catch ( const fc::exception& e )
+        {
+          reply["error"] = fc::mutable_variant_object( "message", e.to_detail_string() );
+        }
+        replies.push_back( reply );
+      }
+      return fc::variant( replies );
+    }
+
     fc::variant rpc_server_impl::help(const fc::variants& params)
     {
       std::vector<std::vector<std::string> > help_strings;
@@ -383,7 +753,13 @@ namespace bts { namespace rpc {
       try
       {
         _username = username;
-        _client->get_wallet()->open( _client->get_wallet()->get_wallet_filename_for_user(username), passphrase );
+        if (auto manager = _client->get_wallet_manager())
+        {
+          _managed_wallet.reset();
+          _managed_wallet = manager->open_wallet(username, passphrase);
+        }
+        else
+          get_wallet()->open( get_wallet()->get_wallet_filename_for_user(username), passphrase );
         return fc::variant(true);
       }
       catch( const fc::exception& e )
@@ -414,9 +790,15 @@ namespace bts { namespace rpc {
       try
       {
         _username = username;
-        _client->get_wallet()->create( _client->get_wallet()->get_wallet_filename_for_user(username),
-                                       passphrase, 
-                                       keypassword );
+        if (auto manager = _client->get_wallet_manager())
+        {
+          _managed_wallet.reset();
+          _managed_wallet = manager->create_wallet(username, passphrase, keypassword);
+        }
+        else
+          get_wallet()->create( get_wallet()->get_wallet_filename_for_user(username),
+                                passphrase, 
+                                keypassword );
         return fc::variant(true);
       }
       catch (...) // TODO: this is an invalid conversion to rpc_wallet_passphrase exception...
@@ -428,14 +810,21 @@ namespace bts { namespace rpc {
 
     fc::variant rpc_server_impl::currentwallet(const fc::variants& params)
     {
-       if( !_client->get_wallet()->is_open() )
+       if( !get_wallet() || !get_wallet()->is_open() )
           return fc::variant(nullptr);
        return fc::variant(_username);
     }
 
     fc::variant rpc_server_impl::closewallet(const fc::variants& params)
     {
-       return fc::variant( _client->get_wallet()->close() );
+       if( auto manager = _client->get_wallet_manager() )
+       {
+          if( !_managed_wallet ) return fc::variant(false);
+          _managed_wallet.reset();
+          manager->close_wallet( _username );
+          return fc::variant(true);
+       }
+       return fc::variant( get_wallet()->close() );
     }
 
     fc::variant rpc_server_impl::walletpassphrase(const fc::variants& params)
@@ -444,7 +833,7 @@ namespace bts { namespace rpc {
        uint32_t timeout_sec = (uint32_t)params[1].as_uint64();
        try
        {
-         _client->get_wallet()->unlock_wallet(passphrase, fc::seconds(timeout_sec));
+         get_wallet()->unlock_wallet(passphrase, fc::seconds(timeout_sec));
          return fc::variant(true);
        }
        catch (...)
@@ -458,7 +847,7 @@ namespace bts { namespace rpc {
        auto foreign_address = params[0].as<address>();
        auto label = params[1].as_string();
        
-       _client->get_wallet()->add_send_address( foreign_address, label );
+       get_wallet()->add_send_address( foreign_address, label );
        return fc::variant(true);
     }
 
@@ -467,7 +856,7 @@ namespace bts { namespace rpc {
        std::string account;
        if (params.size() == 1)
          account = params[0].as_string();
-       bts::blockchain::address new_address = _client->get_wallet()->new_receive_address(account);
+       bts::blockchain::address new_address = get_wallet()->new_receive_address(account);
        return fc::variant(new_address);
     }
     fc::variant rpc_server_impl::_create_sendtoaddress_transaction(const fc::variants& params)
@@ -478,7 +867,7 @@ namespace bts { namespace rpc {
        if (params.size() >= 3)
          comment = params[2].as_string();
        // TODO: we're currently ignoring optional parameter 4, [to-comment]
-       return fc::variant(_client->get_wallet()->transfer(amount, destination_address, comment));
+       return fc::variant(get_wallet()->transfer(amount, destination_address, comment));
     }
     fc::variant rpc_server_impl::sendtransaction(const fc::variants& params)
     {
@@ -494,27 +883,41 @@ namespace bts { namespace rpc {
       if (params.size() >= 3)
         comment = params[2].as_string();
       // TODO: we're currently ignoring optional 4, [to-comment]
-      bts::blockchain::signed_transaction trx = _client->get_wallet()->transfer( asset(amount,0), destination_address, comment);
+      bts::blockchain::signed_transaction trx = get_wallet()->transfer( asset(amount,0), destination_address, comment);
       _client->broadcast_transaction(trx);
       return fc::variant( trx.id() ); 
     }
+    fc::variant rpc_server_impl::sendmany(const fc::variants& params)
+    {
+      std::vector< std::pair<bts::blockchain::address,asset> > payments;
+      const fc::variant_object& amounts = params[0].get_object();
+      for( auto itr = amounts.begin(); itr != amounts.end(); ++itr )
+        payments.push_back( std::make_pair( bts::blockchain::address( itr->key() ), asset( itr->value().as_int64(), 0 ) ) );
+      std::string comment;
+      if (params.size() >= 2)
+        comment = params[1].as_string();
+      bts::blockchain::signed_transaction trx = get_wallet()->transfer_batch( payments, comment );
+      get_wallet()->save();
+      _client->broadcast_transaction(trx);
+      return fc::variant( trx.id() );
+    }
 
     fc::variant rpc_server_impl::listrecvaddresses(const fc::variants& params)
     {
-      std::unordered_map<bts::blockchain::address,std::string> addresses = _client->get_wallet()->get_receive_addresses();
+      std::unordered_map<bts::blockchain::address,std::string> addresses = get_wallet()->get_receive_addresses();
       return fc::variant( addresses ); 
     }
 
     fc::variant rpc_server_impl::get_send_address_label( const fc::variants& params )
     {
-      std::unordered_map<bts::blockchain::address,std::string> addresses = _client->get_wallet()->get_send_addresses();
+      std::unordered_map<bts::blockchain::address,std::string> addresses = get_wallet()->get_send_addresses();
       auto itr = addresses.find( params[0].as<address>() );
       if( itr == addresses.end() ) return fc::variant();
       return fc::variant(itr->second);
     }
     fc::variant rpc_server_impl::list_send_addresses(const fc::variants& params)
     {
-      std::unordered_map<bts::blockchain::address,std::string> addresses = _client->get_wallet()->get_send_addresses();
+      std::unordered_map<bts::blockchain::address,std::string> addresses = get_wallet()->get_send_addresses();
       return fc::variant( addresses ); 
     }
 
@@ -523,22 +926,113 @@ namespace bts { namespace rpc {
       bts::blockchain::asset_type unit = 0;
       if (params.size() == 1)
         unit = params[0].as<bts::blockchain::asset_type>();
-      return fc::variant( _client->get_wallet()->get_balance( unit ) ); 
+      return fc::variant( get_wallet()->get_balance( unit ) ); 
     }
 
     fc::variant rpc_server_impl::get_transaction_history(const fc::variants& params)
     {
-      return fc::variant( _client->get_wallet()->get_transaction_history() );
+      bts::wallet::transaction_history_cursor start( 0, 0 );
+      uint32_t                  limit = 100;
+      fc::optional<bts::blockchain::address>    addr;
+      fc::optional<bts::blockchain::asset_type> unit;
+      if( params.size() >= 1 && !params[0].is_null() ) start.block_num = params[0].as<uint32_t>();
+      if( params.size() >= 2 && !params[1].is_null() ) start.trx_idx   = params[1].as<uint32_t>();
+      if( params.size() >= 3 && !params[2].is_null() ) limit           = params[2].as<uint32_t>();
+      if( params.size() >= 4 && !params[3].is_null() ) addr            = params[3].as<bts::blockchain::address>();
+      if( params.size() >= 5 && !params[4].is_null() ) unit            = params[4].as<bts::blockchain::asset_type>();
+      FC_ASSERT( limit <= 1000, "at most 1000 transactions are returned at once" );
+      return fc::variant( get_wallet()->get_transaction_history( start, limit, addr, unit ) );
     }
 
-    fc::variant rpc_server_impl::get_transaction(const fc::variants& params)
+    fc::variant rpc_server_impl::get_transaction(const bts::blockchain::chain_snapshot& chain, const fc::variants& params)
     {
-      return fc::variant( _client->get_chain()->fetch_transaction( params[0].as<transaction_id_type>() )  ); 
+      return fc::variant( chain.fetch_transaction( params[0].as<transaction_id_type>() )  ); 
     }
 
-    fc::variant rpc_server_impl::getblock(const fc::variants& params)
+    fc::variant rpc_server_impl::get_network_statistics(const fc::variants& params)
     {
-      return fc::variant( _client->get_chain()->fetch_block( (uint32_t)params[0].as_int64() )  ); 
+      bts::net::node_ptr node = _client->get_node();
+      if (!node)
+        return fc::variant(nullptr);
+      return fc::variant( node->get_statistics() );
+    }
+
+    fc::variant rpc_server_impl::getrpcstats(const fc::variants& params)
+    {
+      std::vector<rpc_server::method_statistics> result;
+      for (auto itr = _method_statistics.begin(); itr != _method_statistics.end(); ++itr)
+      {
+        rpc_server::method_statistics stats = itr->second;
+        stats.method           = itr->first;
+        stats.p50_milliseconds = percentile_milliseconds(stats.latency, 0.50);
+        stats.p99_milliseconds = percentile_milliseconds(stats.latency, 0.99);
+        result.push_back(stats);
+      }
+      return fc::variant( result );
+    }
+
+    fc::variant rpc_server_impl::getstoragestats(const fc::variants& params)
+    {
+      fc::mutable_variant_object result;
+      result["chain"]              = _client->get_storage_stats();
+      result["block_cache_hits"]   = _client->block_cache_hits();
+      result["block_cache_misses"] = _client->block_cache_misses();
+      result["memory_budget"]      = _client->get_memory_usage();
+      return fc::variant( result );
+    }
+
+    fc::variant rpc_server_impl::getthreadpoolstats(const fc::variants& params)
+    {
+      return fc::variant( bts::db::executor::instance().get_stats() );
+    }
+
+    fc::variant rpc_server_impl::getprocessstats(const fc::variants& params)
+    {
+      rpc_server::process_statistics stats;
+      stats.sampled_at = fc::time_point::now();
+#ifndef WIN32
+      struct rusage usage;
+      if( getrusage( RUSAGE_SELF, &usage ) == 0 )
+      {
+        stats.user_cpu_microseconds   = uint64_t(usage.ru_utime.tv_sec) * 1000000 + usage.ru_utime.tv_usec;
+        stats.system_cpu_microseconds = uint64_t(usage.ru_stime.tv_sec) * 1000000 + usage.ru_stime.tv_usec;
+# ifdef __APPLE__
+        stats.peak_resident_bytes     = uint64_t(usage.ru_maxrss);
+# else
+        stats.peak_resident_bytes     = uint64_t(usage.ru_maxrss) * 1024;
+# endif
+      }
+# ifdef __linux__
+      // the second field of statm is the resident set in pages
+      std::ifstream statm( "/proc/self/statm" );
+      uint64_t total_pages = 0, resident_pages = 0;
+      if( statm >> total_pages >> resident_pages )
+        stats.resident_bytes = resident_pages * uint64_t(sysconf( _SC_PAGESIZE ));
+# endif
+#endif
+      return fc::variant( stats );
+    }
+
+    fc::variant rpc_server_impl::estimatefee(const fc::variants& params)
+    {
+      uint32_t target_blocks = params.size() >= 1 && !params[0].is_null() ? (uint32_t)params[0].as_int64() : 1;
+      FC_ASSERT( target_blocks >= 1, "expected a target of at least one block" );
+      return fc::variant( _client->estimate_fee( target_blocks ) );
+    }
+
+    fc::variant rpc_server_impl::getblock(const bts::blockchain::chain_snapshot& chain, const fc::variants& params)
+    {
+      return fc::variant( chain.fetch_block( (uint32_t)params[0].as_int64() )  ); 
+    }
+
+    fc::variant rpc_server_impl::getblock_packed(const bts::blockchain::chain_snapshot& chain, const fc::variants& params)
+    {
+      return pack_result( chain.fetch_block( (uint32_t)params[0].as_int64() ) );
+    }
+
+    fc::variant rpc_server_impl::get_transaction_packed(const bts::blockchain::chain_snapshot& chain, const fc::variants& params)
+    {
+      return pack_result( chain.fetch_transaction( params[0].as<transaction_id_type>() ) );
     }
 
     fc::variant rpc_server_impl::validateaddress(const fc::variants& params)
@@ -557,7 +1051,7 @@ namespace bts { namespace rpc {
       uint32_t block_num = 0;
       if (params.size() == 1)
         block_num = (uint32_t)params[0].as_int64();
-      _client->get_wallet()->scan_chain(*_client->get_chain(), block_num);
+      get_wallet()->scan_chain(*_client->get_chain(), block_num);
       return fc::variant(true); 
     }
 
@@ -565,7 +1059,7 @@ namespace bts { namespace rpc {
     {
       auto wallet_dat      = params[0].as<fc::path>();
       auto wallet_password = params[1].as_string();
-      _client->get_wallet()->import_bitcoin_wallet( wallet_dat, wallet_password );
+      get_wallet()->import_bitcoin_wallet( wallet_dat, wallet_password );
       return fc::variant(true);
     }
 
@@ -573,8 +1067,8 @@ namespace bts { namespace rpc {
     {
       ilog( "${params}", ("params",params) );
       auto label = params[1].as_string();
-      _client->get_wallet()->import_key(params[0].as<fc::ecc::private_key>(), label);
-      _client->get_wallet()->save();
+      get_wallet()->import_key(params[0].as<fc::ecc::private_key>(), label);
+      get_wallet()->save();
       return fc::variant(true);
     }
     fc::variant rpc_server_impl::importprivkey(const fc::variants& params)
@@ -586,11 +1080,11 @@ namespace bts { namespace rpc {
         rescan = true;
       FC_ASSERT( !"Importing from WIF format not yet implemented" );
       // TODO: convert bitcoin wallet import format wif to privakey
-      //_client->get_wallet()->import_key(privkey, label);
-      _client->get_wallet()->save();
+      //get_wallet()->import_key(privkey, label);
+      get_wallet()->save();
 
       if (rescan)
-        _client->get_wallet()->scan_chain(*_client->get_chain(), 0);
+        get_wallet()->scan_chain(*_client->get_chain(), 0);
         
       return fc::variant(true);
     }
@@ -615,6 +1109,8 @@ namespace bts { namespace rpc {
 
 #define JSON_METHOD_IMPL(METHODNAME) \
     boost::bind(&detail::rpc_server_impl::METHODNAME, my.get(), _1)
+#define JSON_READ_METHOD_IMPL(METHODNAME) \
+    boost::bind(&detail::rpc_server_impl::METHODNAME, my.get(), _1, _2)
 
     method_data help_metadata{"help", JSON_METHOD_IMPL(help),
             /* description */ "list the available commands",
@@ -709,6 +1205,15 @@ namespace bts { namespace rpc {
                    /* prerequisites */ json_authenticated | wallet_open | wallet_unlocked | connected_to_network};
     register_method(sendtoaddress_metadata);
 
+    method_data sendmany_metadata{"sendmany", JSON_METHOD_IMPL(sendmany),
+                     /* description */ "Sends the given amounts to the given addresses with one transaction, assumes shares in DAC",
+                     /* returns: */    "transaction_id",
+                     /* params:          name       type                  required */ 
+                                       {{"amounts", "map<address,int64>", true},
+                                        {"comment", "string",             false}},
+                   /* prerequisites */ json_authenticated | wallet_open | wallet_unlocked | connected_to_network};
+    register_method(sendmany_metadata);
+
     method_data listrecvaddresses_metadata{"listrecvaddresses", JSON_METHOD_IMPL(listrecvaddresses),
                          /* description */ "Lists all receive addresses and their labels associated with this wallet",
                          /* returns: */    "map<address,string>",
@@ -742,28 +1247,81 @@ namespace bts { namespace rpc {
 
 
     method_data get_transaction_history_metadata{"get_transaction_history", JSON_METHOD_IMPL(get_transaction_history),
-                               /* description */ "Retrieves all transactions into or out of this wallet.",
-                               /* returns: */    "map<transaction_id,transaction_state>",
-                               /* params:     */ {},
-                             /* prerequisites */ json_authenticated};
+                               /* description */ "Retrieves a page of the transactions into or out of this wallet in the order they are "
+                                                 "included in the chain, pass the next of the result as start_block and start_trx for the next page",
+                               /* returns: */    "transaction_history_page",
+                               /* params:          name           type          required */
+                                                 {{"start_block", "uint32_t",   false},
+                                                  {"start_trx",   "uint32_t",   false},
+                                                  {"limit",       "uint32_t",   false},
+                                                  {"address",     "address",    false},
+                                                  {"asset",       "unit",       false}},
+                             /* prerequisites */ json_authenticated | wallet_open};
     register_method(get_transaction_history_metadata);
 
-    method_data get_transaction_metadata{"get_transaction", JSON_METHOD_IMPL(get_transaction),
+    method_data get_transaction_metadata{"get_transaction", json_api_method_type(),
                        /* description */ "Retrieves the signed transaction matching the given transaction id",
                        /* returns: */    "signed_transaction",
                        /* params:          name              type               required */ 
                                          {{"transaction_id", "transaction_id",  true}},
-                     /* prerequisites */ json_authenticated};
+                     /* prerequisites */ json_authenticated,
+                     /* read_only */     true, JSON_READ_METHOD_IMPL(get_transaction),
+                     /* packed */        JSON_READ_METHOD_IMPL(get_transaction_packed)};
     register_method(get_transaction_metadata);
 
-    method_data getblock_metadata{"getblock", JSON_METHOD_IMPL(getblock),
+    method_data getblock_metadata{"getblock", json_api_method_type(),
                 /* description */ "Retrieves the block header for the given block",
                 /* returns: */    "block_header",
                 /* params:          name              type        required */ 
                                   {{"block_number",   "uint32_t", true}},
-              /* prerequisites */ json_authenticated};
+              /* prerequisites */ json_authenticated,
+              /* read_only */     true, JSON_READ_METHOD_IMPL(getblock),
+              /* packed */        JSON_READ_METHOD_IMPL(getblock_packed)};
     register_method(getblock_metadata);
 
+    method_data get_network_statistics_metadata{"get_network_statistics", JSON_METHOD_IMPL(get_network_statistics),
+                              /* description */ "Returns the p2p node's traffic by message type and peer, queue depths and latencies",
+                              /* returns: */    "node_statistics",
+                              /* params:     */ {},
+                            /* prerequisites */ json_authenticated};
+    register_method(get_network_statistics_metadata);
+
+    method_data getrpcstats_metadata{"getrpcstats", JSON_METHOD_IMPL(getrpcstats),
+                   /* description */ "Returns the calls, errors and latencies of each method since the server started, also served at /metrics",
+                   /* returns: */    "vector<method_statistics>",
+                   /* params:     */ {},
+                 /* prerequisites */ json_authenticated};
+    register_method(getrpcstats_metadata);
+
+    method_data getstoragestats_metadata{"getstoragestats", JSON_METHOD_IMPL(getstoragestats),
+                   /* description */ "Returns the reads, writes and latencies of each chain index, the LevelDB statistics, the hit rates of the caches and their share of the memory budget",
+                   /* returns: */    "storage_stats",
+                   /* params:     */ {},
+                 /* prerequisites */ json_authenticated};
+    register_method(getstoragestats_metadata);
+
+    method_data getthreadpoolstats_metadata{"getthreadpoolstats", JSON_METHOD_IMPL(getthreadpoolstats),
+                   /* description */ "Returns the size of each thread pool and how long its tasks waited and ran",
+                   /* returns: */    "vector<thread_pool_stats>",
+                   /* params:     */ {},
+                 /* prerequisites */ json_authenticated};
+    register_method(getthreadpoolstats_metadata);
+
+    method_data getprocessstats_metadata{"getprocessstats", JSON_METHOD_IMPL(getprocessstats),
+                   /* description */ "Returns the cpu time the client used so far and its resident memory",
+                   /* returns: */    "process_statistics",
+                   /* params:     */ {},
+                 /* prerequisites */ json_authenticated};
+    register_method(getprocessstats_metadata);
+
+    method_data estimatefee_metadata{"estimatefee", JSON_METHOD_IMPL(estimatefee),
+               /* description */ "Returns the fee rate in milli-shares per byte that gets a transaction included within target_blocks, from recent blocks and the pending transactions",
+               /* returns: */    "fee_estimate",
+               /* params:          name              type        required */
+                                 {{"target_blocks",  "uint32_t", false}},
+             /* prerequisites */ json_authenticated};
+    register_method(estimatefee_metadata);
+
     method_data validateaddress_metadata{"validateaddress", JSON_METHOD_IMPL(validateaddress),
                        /* description */ "Checks that the given address is valid",
                        /* returns: */    "bool",
@@ -826,12 +1384,15 @@ namespace bts { namespace rpc {
                                                             {"to_comment", "string",  false}},
                                        /* prerequisites */ json_authenticated | wallet_open | wallet_unlocked};
     register_method(_create_sendtoaddress_transaction_metadata);
+#undef JSON_READ_METHOD_IMPL
 #undef JSON_METHOD_IMPL
   }
 
   rpc_server::~rpc_server()
   { 
      try {
+         if( my->_client && my->_thread )
+            my->_client->set_new_block_handler( bts::client::new_block_handler() );
          my->_tcp_serv.close();
          if( my->_accept_loop_complete.valid() )
          {
@@ -863,6 +1424,13 @@ namespace bts { namespace rpc {
     try 
     {
       my->_config = cfg;
+      my->_thread = &fc::thread::current();
+      bts::db::executor::instance().pool( "rpc" ).set_default_size( cfg.read_threads );
+      if( my->_client )
+      {
+         auto m = my.get();
+         my->_client->set_new_block_handler( [m]( const bts::blockchain::signed_block_header& header ){ m->on_new_block( header ); } );
+      }
       my->_tcp_serv.listen( cfg.rpc_endpoint );
       ilog( "listening for json rpc connections on port ${port}", ("port",my->_tcp_serv.get_port()) );
      
@@ -0,0 +1,128 @@
+#include <bts/rpc/static_file_cache.hpp>
+#include <bts/db/executor.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/crypto/hex.hpp>
+#include <fc/exception/exception.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/filesystem.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+#ifdef BTS_RPC_HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+namespace bts { namespace rpc {
+
+    /**
+     *  Loading waits on the storage pool, which lets the http thread serve other requests
+     *  that may add or remove entries meanwhile, so no reference into _files is held
+     *  across the wait.
+     */
+    static_file_ptr static_file_cache::get( const fc::path& filename )
+    {
+       auto now = fc::time_point::now();
+       auto key = filename.generic_string();
+       static_file_ptr file;
+       {
+          auto itr = _files.find( key );
+          if( itr != _files.end() )
+          {
+             if( itr->second.file && (now - itr->second.checked).count() < check_interval_us )
+                return itr->second.file;
+             itr->second.checked = now;
+             file = itr->second.file;
+          }
+       }
+
+       std::time_t last_write = 0;
+       uint64_t    size = 0;
+       if( !stat( filename, last_write, size ) )
+       {
+          // missing files are not remembered, so that requests for them can't grow the cache
+          _files.erase( key );
+          return static_file_ptr();
+       }
+       if( !file || file->last_write != last_write || file->size != size )
+       {
+          file = bts::db::executor::instance().pool( "storage" ).async( [=]()
+          {
+             return load( filename, last_write, size );
+          } ).wait();
+       }
+
+       cache_entry& entry = _files[key];
+       entry.file    = file;
+       entry.checked = now;
+       return file;
+    }
+
+    bool static_file_cache::stat( const fc::path& filename, std::time_t& last_write, uint64_t& size )
+    {
+       boost::system::error_code ec;
+       boost::filesystem::path p( filename.generic_string() );
+       if( !boost::filesystem::is_regular_file( p, ec ) || ec ) return false;
+       last_write = boost::filesystem::last_write_time( p, ec );
+       if( ec ) return false;
+       size = boost::filesystem::file_size( p, ec );
+       return !ec;
+    }
+
+    static_file_ptr static_file_cache::load( const fc::path& filename, std::time_t last_write, uint64_t size )
+    {
+       auto file = std::make_shared<static_file>();
+       std::ifstream in( filename.generic_string().c_str(), std::ios::binary );
+       FC_ASSERT( in, "unable to read ${f}", ("f",filename) );
+       file->content.assign( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+       file->last_write   = last_write;
+       file->size         = size;
+       uint64_t hash      = fc::city_hash64( file->content.data(), file->content.size() );
+       file->etag         = "\"" + fc::to_hex( (const char*)&hash, sizeof(hash) ) + "\"";
+       file->content_type = content_type( filename );
+       file->gzipped      = gzip( file->content );
+       if( file->gzipped.size() >= file->content.size() )
+          file->gzipped.clear();
+       return file;
+    }
+
+    std::string static_file_cache::content_type( const fc::path& filename )
+    {
+       static const std::map<std::string, std::string> types = {
+          { ".html", "text/html; charset=utf-8" }, { ".htm",  "text/html; charset=utf-8" },
+          { ".js",   "application/javascript" },   { ".css",  "text/css" },
+          { ".json", "application/json" },         { ".svg",  "image/svg+xml" },
+          { ".png",  "image/png" },                { ".jpg",  "image/jpeg" },
+          { ".gif",  "image/gif" },                { ".ico",  "image/x-icon" },
+          { ".woff", "application/font-woff" },    { ".ttf",  "application/x-font-ttf" },
+          { ".txt",  "text/plain; charset=utf-8" }
+       };
+       auto ext  = boost::filesystem::path( filename.generic_string() ).extension().string();
+       auto itr  = types.find( boost::algorithm::to_lower_copy( ext ) );
+       return itr == types.end() ? std::string( "application/octet-stream" ) : itr->second;
+    }
+
+    std::vector<char> static_file_cache::gzip( const std::vector<char>& content )
+    {
+       std::vector<char> compressed;
+#ifdef BTS_RPC_HAVE_ZLIB
+       z_stream stream;
+       memset( &stream, 0, sizeof(stream) );
+       // 16 more window bits asks for a gzip header instead of a zlib one
+       if( content.empty() || deflateInit2( &stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+          return compressed;
+       compressed.resize( deflateBound( &stream, content.size() ) );
+       stream.next_in   = (Bytef*)content.data();
+       stream.avail_in  = content.size();
+       stream.next_out  = (Bytef*)compressed.data();
+       stream.avail_out = compressed.size();
+       int status = deflate( &stream, Z_FINISH );
+       compressed.resize( status == Z_STREAM_END ? stream.total_out : 0 );
+       deflateEnd( &stream );
+#endif
+       return compressed;
+    }
+
+} } // bts::rpc
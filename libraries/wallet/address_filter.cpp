@@ -0,0 +1,84 @@
+#include <bts/wallet/address_filter.hpp>
+#include <fc/crypto/city.hpp>
+
+#include <algorithm>
+
+namespace bts { namespace wallet {
+
+   namespace
+   {
+      const uint32_t words_per_block = 8;
+      const uint32_t bits_per_block  = words_per_block * 64;
+   }
+
+   address_filter::address_filter( uint32_t bits_per_key )
+   :_bits_per_key( std::max( 1u, bits_per_key ) ),
+    // ln(2) * bits_per_key probes minimize the false positive rate
+    _probes( std::max( 1u, (bits_per_key * 69) / 100 ) )
+   {
+   }
+
+   uint64_t address_filter::hash( const address& a )
+   {
+      return fc::city_hash64( (const char*)&a.addr._hash[0], sizeof(a.addr._hash) );
+   }
+
+   uint64_t address_filter::hash( const pts_address& a )
+   {
+      return fc::city_hash64( a.addr.data, sizeof(a.addr) );
+   }
+
+   void address_filter::insert( const address& a )             { insert( hash(a) ); }
+   void address_filter::insert( const pts_address& a )         { insert( hash(a) ); }
+   bool address_filter::may_contain( const address& a )const     { return may_contain( hash(a) ); }
+   bool address_filter::may_contain( const pts_address& a )const { return may_contain( hash(a) ); }
+
+   void address_filter::clear()
+   {
+      _blocks.clear();
+      _hashes.clear();
+   }
+
+   void address_filter::insert( uint64_t h )
+   {
+      _hashes.push_back( h );
+      if( _hashes.size() * _bits_per_key > _blocks.size() * 64 )
+         resize( _hashes.size() * 2 );
+      else
+         set_bits( h );
+   }
+
+   /** the high half of h picks the block, the low half the bits within it */
+   void address_filter::set_bits( uint64_t h )
+   {
+      uint64_t* block = &_blocks[ (uint32_t(h >> 32) & (_blocks.size() / words_per_block - 1)) * words_per_block ];
+      uint32_t  bit   = uint32_t(h);
+      uint32_t  step  = (bit >> 17) | 1;
+      for( uint32_t i = 0; i < _probes; ++i, bit += step )
+         block[ (bit % bits_per_block) / 64 ] |= uint64_t(1) << (bit % 64);
+   }
+
+   bool address_filter::may_contain( uint64_t h )const
+   {
+      if( _blocks.empty() ) return false;
+      const uint64_t* block = &_blocks[ (uint32_t(h >> 32) & (_blocks.size() / words_per_block - 1)) * words_per_block ];
+      uint32_t  bit   = uint32_t(h);
+      uint32_t  step  = (bit >> 17) | 1;
+      for( uint32_t i = 0; i < _probes; ++i, bit += step )
+      {
+         if( !(block[ (bit % bits_per_block) / 64 ] & (uint64_t(1) << (bit % 64))) )
+            return false;
+      }
+      return true;
+   }
+
+   /** rebuilds the filter with room for keys keys */
+   void address_filter::resize( size_t keys )
+   {
+      size_t blocks = 1;
+      while( blocks * bits_per_block < keys * _bits_per_key ) blocks *= 2;
+      _blocks.assign( blocks * words_per_block, 0 );
+      for( uint64_t h : _hashes ) set_bits( h );
+   }
+
+} } // bts::wallet
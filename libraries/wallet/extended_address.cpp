@@ -1,6 +1,6 @@
 #include <bts/wallet/extended_address.hpp>
+#include <bts/blockchain/base58.hpp>
 #include <fc/exception/exception.hpp>
-#include <fc/crypto/base58.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/raw.hpp>
 
@@ -104,7 +104,7 @@ namespace bts { namespace wallet {
    { try {
 
       uint32_t checksum = 0;
-      std::vector<char> data = fc::from_base58( base58str );
+      std::vector<char> data = bts::blockchain::base58_decode( base58str );
       FC_ASSERT( data.size() == (33+32+4) );
 
       fc::datastream<const char*> ds(data.data(),data.size());
@@ -134,7 +134,7 @@ namespace bts { namespace wallet {
       data.resize( data.size() + 4 );
       memcpy( data.data() + data.size() - 4, (char*)&checksum, sizeof(checksum) );
 
-      return fc::to_base58( data.data(), data.size() );
+      return bts::blockchain::base58_encode( data.data(), data.size() );
    }
 
    extended_address::operator extended_public_key()const
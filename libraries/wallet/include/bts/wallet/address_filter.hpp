@@ -0,0 +1,48 @@
+#pragma once
+#include <bts/blockchain/address.hpp>
+#include <bts/blockchain/pts_address.hpp>
+
+#include <vector>
+
+namespace bts { namespace wallet {
+    using namespace bts::blockchain;
+
+    /**
+     *  A blocked bloom filter of the addresses of a wallet, checked before the exact lookup
+     *  so that most outputs that are not ours cost one cache line instead of a hash map probe.
+     *
+     *  Each address sets bits_per_key bits of a single 64 byte block which gives about 1.5%
+     *  false positives at 10 bits per key.  The 64 bit hash of every key is kept so that the
+     *  filter can double in size as keys are added without asking for them again.
+     */
+    class address_filter
+    {
+       public:
+          address_filter( uint32_t bits_per_key = 10 );
+
+          void insert( const address& a );
+          void insert( const pts_address& a );
+
+          /** false if a was never inserted, true if it probably was */
+          bool may_contain( const address& a )const;
+          bool may_contain( const pts_address& a )const;
+
+          size_t size()const { return _hashes.size(); }
+          void   clear();
+
+       private:
+          static uint64_t hash( const address& a );
+          static uint64_t hash( const pts_address& a );
+
+          void insert( uint64_t h );
+          bool may_contain( uint64_t h )const;
+          void set_bits( uint64_t h );
+          void resize( size_t keys );
+
+          uint32_t               _bits_per_key;
+          uint32_t               _probes;
+          std::vector<uint64_t>  _blocks; ///< 8 words per block, the number of blocks is a power of 2
+          std::vector<uint64_t>  _hashes;
+    };
+
+} } // bts::wallet
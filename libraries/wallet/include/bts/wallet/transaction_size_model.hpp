@@ -0,0 +1,49 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <fc/io/raw.hpp>
+
+namespace bts { namespace wallet {
+    using namespace bts::blockchain;
+
+    /**
+     *  The packed size a transaction will have once inputs are added and it is signed, without
+     *  packing or signing it again.  A signature is a fixed size compact_signature and the
+     *  counts of inputs and signatures are varints.
+     */
+    class transaction_size_model
+    {
+       public:
+          /** trx must not be signed yet */
+          transaction_size_model( const signed_transaction& trx )
+          :_inputs(trx.inputs.size()),_input_bytes(0)
+          {
+             trx.invalidate_cache();
+             _base = trx.size() - varint_size( _inputs ) - varint_size( trx.sigs.size() );
+          }
+
+          void   add_input( const trx_input& in )
+          {
+             ++_inputs;
+             _input_bytes += fc::raw::pack_size( in );
+          }
+
+          size_t size( size_t signatures )const
+          {
+             static const size_t signature_size = fc::raw::pack_size( fc::ecc::compact_signature() );
+             return _base + varint_size( _inputs ) + _input_bytes + varint_size( signatures ) + signatures * signature_size;
+          }
+
+          static size_t varint_size( uint64_t v )
+          {
+             size_t n = 1;
+             while( v >= 0x80 ) { v >>= 7; ++n; }
+             return n;
+          }
+
+       private:
+          size_t _base;
+          size_t _inputs;
+          size_t _input_bytes;
+    };
+
+} } // bts::wallet
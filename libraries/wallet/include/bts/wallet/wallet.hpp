@@ -3,17 +3,18 @@
 #include <bts/blockchain/block.hpp>
 
 #include <functional>
+#include <memory>
 #include <unordered_map>
 #include <map>
 
 namespace bts {
 
-namespace blockchain { class chain_database; }
+namespace blockchain { class chain_database; class fee_estimator; typedef std::shared_ptr<fee_estimator> fee_estimator_ptr; }
 
 namespace wallet {
    using namespace bts::blockchain;
 
-   namespace detail { class wallet_impl; }
+   namespace detail { class wallet_impl; struct scanned_transaction; }
 
    struct output_index
    {
@@ -75,6 +76,26 @@ namespace wallet {
       }
    };
 
+   /**
+    *  Where a page of wallet::get_transaction_history starts.  Within a block trx_idx is the
+    *  position of a transaction.  With an invalid block_num it counts the transactions no scan
+    *  has placed, which can be more than a trx_num position holds.
+    */
+   struct transaction_history_cursor
+   {
+      transaction_history_cursor( uint32_t b = 0, uint32_t t = 0 ):block_num(b),trx_idx(t){}
+
+      uint32_t block_num;
+      uint32_t trx_idx;
+   };
+
+   /** a page of the history returned by wallet::get_transaction_history */
+   struct transaction_history_page
+   {
+      std::vector<transaction_state>              transactions;
+      fc::optional<transaction_history_cursor>    next; ///< the start of the next page, unset after the last one
+   };
+
    /** takes 4 parameters, current block, last block, current trx, last trx */
    typedef std::function<void(uint32_t,uint32_t,uint32_t,uint32_t)> scan_progress_callback;
 
@@ -120,6 +141,8 @@ namespace wallet {
            fc::ecc::public_key                     new_public_key( const std::string& label = "" );
 
            std::unordered_map<address,std::string> get_receive_addresses()const;
+           /** the pts forms of the keys of the receive addresses */
+           std::vector<pts_address>                get_receive_pts_addresses()const;
            std::string                             get_send_address_label( const address& addr )const;
 
            bool                                    is_my_address( const address& a )const;
@@ -133,6 +156,12 @@ namespace wallet {
 
            /** @return milli-shares per byte */
            uint64_t                                get_fee_rate();
+
+           /** transfers pay what estimator says gets them included within target_blocks */
+           void                                    set_fee_estimator( const bts::blockchain::fee_estimator_ptr& estimator,
+                                                                      uint32_t target_blocks = 1 );
+           /** @return milli-shares per byte, never less than get_fee_rate() */
+           uint64_t                                get_transfer_fee_rate();
            uint64_t                                last_scanned()const;
 
            output_reference                        get_ref_from_output_idx(output_index idx);
@@ -149,13 +178,75 @@ namespace wallet {
 
            signed_transaction    transfer( const asset& amnt, const address& to, const std::string& memo = "change" );
 
+           /**
+            *  Pays every recipient of payments with one transaction, one coin selection per unit
+            *  and one signature per key, all change going to a single new address.
+            */
+           signed_transaction    transfer_batch( const std::vector< std::pair<address,asset> >& payments,
+                                                 const std::string& memo = "change" );
+
            /** returns all transactions issued */
            std::unordered_map<transaction_id_type, transaction_state> get_transaction_history()const;
 
+           /**
+            *  Returns up to limit transactions of the history starting with start, in the order
+            *  they are included in the chain, followed by those no scan has found in a block
+            *  yet.  Only the transactions that pay to or from addr and change the balance
+            *  of unit are returned when they are given.
+            *
+            *  @param start (0,0) for the first page, then the next of the previous page
+            */
+           transaction_history_page get_transaction_history( const transaction_history_cursor& start, uint32_t limit,
+                                                             const fc::optional<address>& addr = fc::optional<address>(),
+                                                             const fc::optional<asset_type>& unit = fc::optional<asset_type>() )const;
+
            void sign_transaction( signed_transaction& trx, const address& addr );
            void sign_transaction( signed_transaction& trx, const std::unordered_set<address>& addresses, bool mark_output_as_used = true);
 
            bool scan_chain( bts::blockchain::chain_database& chain, uint32_t from_block_num = 0,  scan_progress_callback cb = scan_progress_callback() );
+
+           /**
+            *  Scans the transactions of block block_num that a wallet_manager found to pay to or
+            *  spend from this wallet, each with its position in the block, as scan_chain would.
+            *  The block is not recorded as scanned, see mark_scanned, but
+            *  revert_block can undo it once it is.
+            *
+            *  @return true if a new output was found
+            */
+           bool scan_block_transactions( uint32_t block_num,
+                                         const std::vector< std::pair<uint32_t,signed_transaction> >& trxs );
+
+           /**
+            *  Scans blk, which was just pushed, from memory instead of reading it back from the
+            *  chain as scan_chain would.  The changes are remembered for the last undo_depth
+            *  blocks so that revert_block can undo them when the chain pops blk.
+            *
+            *  @param deterministic_trxs as the chain generated them for blk
+            *  @return true if a new output was found
+            */
+           bool apply_block( const trx_block& blk, const signed_transactions& deterministic_trxs = signed_transactions() );
+
+           /**
+            *  Undoes apply_block or scan_block_transactions of block_num, which must be the
+            *  last block scanned.
+            *
+            *  @return false if block_num was not applied by apply_block or is too old, the wallet
+            *          must then be scanned again from before the fork
+            */
+           bool revert_block( uint32_t block_num );
+
+           /** records that every block up to block_num was scanned, as scan_chain does when done */
+           void mark_scanned( bts::blockchain::chain_database& chain, uint32_t block_num );
+
+           /**
+            *  Adds the unspent outputs of addrs, and of the PTS forms of their keys, found with
+            *  the owner index of chain instead of a scan.  The history of the addresses is not
+            *  found this way.  import_key and import_bitcoin_wallet call it once the wallet has
+            *  scanned a chain that keeps an owner index.
+            *
+            *  @return true if a new output was found
+            */
+           bool scan_owned_outputs( bts::blockchain::chain_database& chain, const std::vector<address>& addrs );
            void mark_as_spent( const output_reference& r );
 
            void dump_txs(bts::blockchain::chain_database& db, uint32_t count);
@@ -188,6 +279,9 @@ namespace wallet {
 
         private:
            bool scan_transaction( transaction_state& trx, uint32_t block_idx, uint32_t trx_idx );
+           bool merge_scanned( std::vector<detail::scanned_transaction>& range, uint32_t head_block_num,
+                               const scan_progress_callback& cb );
+           bool merge_block( std::vector<detail::scanned_transaction>& range, uint32_t block_num );
            std::unique_ptr<detail::wallet_impl> my;
    };
 
@@ -196,4 +290,6 @@ namespace wallet {
 
 FC_REFLECT( bts::wallet::transaction_state, (trx)(memo)(block_num)(to)(from)(delta_balance)(valid) )
 FC_REFLECT( bts::wallet::output_index, (block_idx)(trx_idx)(output_idx) )
+FC_REFLECT( bts::wallet::transaction_history_cursor, (block_num)(trx_idx) )
+FC_REFLECT( bts::wallet::transaction_history_page, (transactions)(next) )
 
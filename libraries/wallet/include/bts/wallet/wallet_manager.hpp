@@ -0,0 +1,62 @@
+#pragma once
+#include <bts/wallet/wallet.hpp>
+#include <fc/time.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bts { namespace wallet {
+
+   namespace detail { class wallet_manager_impl; }
+
+   /**
+    *  Keeps the wallets of many users open at once and scans each new block for all of them
+    *  in a single pass.  Outputs are routed to the wallets that own them through one index
+    *  of the receive addresses of every open wallet, and inputs through one index of the
+    *  outputs those wallets found, so a block costs the same to scan for one wallet as for
+    *  thousands.
+    *
+    *  A wallet that nobody holds a wallet_ptr to and that was not asked for within the
+    *  idle timeout is saved and unloaded, it is opened and caught up again by the next
+    *  open_wallet.  The addresses a wallet adds while it is held are indexed again before
+    *  the next block is scanned.
+    */
+   class wallet_manager
+   {
+      public:
+         wallet_manager();
+         ~wallet_manager();
+
+         /** the wallets are the files wallet::get_wallet_filename_for_user names in dir */
+         void       set_data_directory( const fc::path& dir );
+         void       set_chain( bts::blockchain::chain_database* chain );
+         void       set_idle_timeout( const fc::microseconds& timeout );
+
+         /** opens the wallet of username if it is not open yet and scans the blocks it missed */
+         wallet_ptr open_wallet( const std::string& username, const std::string& password );
+         /** creates the wallet of username, which must not exist yet, and opens it */
+         wallet_ptr create_wallet( const std::string& username, const std::string& password,
+                                   const std::string& key_password );
+         /** @return null if the wallet of username is not open */
+         wallet_ptr get_wallet( const std::string& username );
+         /** saves and closes the wallet of username, it must not be used anymore */
+         void       close_wallet( const std::string& username );
+         void       close_all();
+
+         /** scans block_num for every open wallet, blocks must be scanned in order */
+         void       scan_block( uint32_t block_num );
+         /** undoes scan_block of block_num, the head block, after the chain popped it */
+         void       revert_block( uint32_t block_num );
+         /** saves and unloads the wallets that have been idle for longer than the idle timeout */
+         void       unload_idle_wallets();
+
+         std::vector<std::string> open_wallets()const;
+
+      private:
+         std::unique_ptr<detail::wallet_manager_impl> my;
+   };
+
+   typedef std::shared_ptr<wallet_manager> wallet_manager_ptr;
+
+} } // bts::wallet
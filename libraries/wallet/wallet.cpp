@@ -1,14 +1,23 @@
 #include <bts/wallet/wallet.hpp>
 #include <bts/wallet/extended_address.hpp>
+#include <bts/wallet/address_filter.hpp>
+#include <bts/wallet/transaction_size_model.hpp>
 #include <bts/blockchain/config.hpp>
 #include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/fee_estimator.hpp>
+#include <bts/blockchain/flat_hash.hpp>
+#include <bts/blockchain/parallel.hpp>
 #include <bts/blockchain/pts_address.hpp>
+#include <bts/blockchain/signature_cache.hpp>
 #include <bts/import_bitcoin_wallet.hpp>
+#include <bts/db/executor.hpp>
+#include <bts/db/trace.hpp>
 #include <unordered_map>
 #include <map>
 #include <fc/filesystem.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/io/json.hpp>
+#include <fc/io/enum_type.hpp>
 #include <fc/log/logger.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/crypto/aes.hpp>
@@ -19,6 +28,11 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <thread>
 
 struct trx_stat
 {
@@ -61,12 +75,17 @@ namespace bts { namespace wallet {
 
 
        //std::vector<fc::ecc::private_key>                 keys;
-       // an aes encrypted std::unordered_map<address,fc::ecc::private_key>
+       // an aes encrypted std::unordered_map<address,fc::ecc::private_key>, only read from
+       // wallets saved before encrypted_key_store, unlock moves its keys to the store
        std::vector<char>                                        encrypted_keys;
        std::vector<char>                                        encrypted_base_key;
+       /** each key aes encrypted on its own so that adding one doesn't re-encrypt the others */
+       std::unordered_map<address,std::vector<char> >           encrypted_key_store;
 
        
        std::unordered_map<transaction_id_type, transaction_state> transactions; //map of all transactions affecting wallet balance
+       /** the transactions found by a scan by position in the chain, the order of the history */
+       std::map<trx_num, transaction_id_type>                     transaction_order;
        std::map<output_index, trx_output>                         unspent_outputs;
        std::map<output_index, trx_output>                         spent_outputs;
 
@@ -88,6 +107,29 @@ namespace bts { namespace wallet {
           return keys;
        } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
+       /** @return the keys of encrypted_key_store */
+       std::unordered_map<address,fc::ecc::private_key>    decrypt_key_store( const std::string& password )
+       { try {
+          std::unordered_map<address, fc::ecc::private_key> keys;
+          auto password_hash = fc::sha512::hash( password.c_str(), password.size() );
+          for( auto itr = encrypted_key_store.begin(); itr != encrypted_key_store.end(); ++itr )
+             keys[itr->first] = fc::raw::unpack<fc::ecc::private_key>( fc::aes_decrypt( password_hash, itr->second ) );
+          return keys;
+       } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+       /** @return k encrypted the way encrypted_key_store holds it */
+       static std::vector<char> seal_key( const fc::ecc::private_key& k, const std::string& password )
+       {
+          return fc::aes_encrypt( fc::sha512::hash( password.c_str(), password.size() ), fc::raw::pack( k ) );
+       }
+
+       const std::vector<char>& store_key( const address& addr, const fc::ecc::private_key& k, const std::string& password )
+       {
+          auto& sealed = encrypted_key_store[addr];
+          sealed = seal_key( k, password );
+          return sealed;
+       }
+
        extended_private_key                                     get_base_key( const std::string& password )
        {
           //ilog( "get_base_key  with password '${pass}'  encrypted_base_key ${ebk}", ("pass",password)("ebk",encrypted_base_key.size()) );
@@ -109,6 +151,9 @@ namespace bts { namespace wallet {
        void change_password( const std::string& old_password, const std::string& new_password )
        {
           set_keys( decrypt_keys( old_password ), new_password );
+          auto keys = decrypt_key_store( old_password );
+          for( auto itr = keys.begin(); itr != keys.end(); ++itr )
+             store_key( itr->first, itr->second, new_password );
           set_base_key( get_base_key( old_password ), new_password );
        }
 
@@ -141,8 +186,61 @@ FC_REFLECT( bts::wallet::wallet_data,
             (delegate_keys)
             (trusted_delegates)
             (distrusted_delegates)
+            (encrypted_key_store)
+            (transaction_order)
           )
 
+namespace bts { namespace wallet { namespace detail {
+   /** the members of wallet_data that a wallet_record can change */
+   enum wallet_field
+   {
+      receive_address_field     = 0,
+      receive_pts_address_field = 1,
+      send_address_field        = 2,
+      encrypted_keys_field      = 3,
+      last_used_key_field       = 4,
+      last_scanned_block_field  = 5,
+      transaction_field         = 6,
+      unspent_output_field      = 7,
+      spent_output_field        = 8,
+      output_ref_field          = 9,
+      vote_field                = 10,
+      delegate_key_field        = 11,
+      trusted_delegate_field    = 12,
+      distrusted_delegate_field = 13,
+      encrypted_key_field       = 14,
+      transaction_order_field   = 15
+   };
+
+   /**
+    *  One change of wallet_data as written to the journal, data is the packed key followed
+    *  by an fc::optional of the new value which is empty if the key was erased.  Fields
+    *  that are a single value only hold the packed value.
+    */
+   struct wallet_record
+   {
+      fc::enum_type<uint8_t,wallet_field>  field;
+      std::vector<char>                    data;
+   };
+
+   /** starts the binary form of wallet_data, files without it hold JSON */
+   const char wallet_file_magic[8]    = { 'b','t','s','w','a','l','0','3' };
+   /** wallet_data before transaction_order was appended to it */
+   const char wallet_file_magic_v2[8] = { 'b','t','s','w','a','l','0','2' };
+   /** wallet_data before encrypted_key_store was appended to it */
+   const char wallet_file_magic_v1[8] = { 'b','t','s','w','a','l','0','1' };
+
+   /** the journal is folded into the wallet file once it is larger than both */
+   const uint64_t min_journal_compaction_size = 1024*1024;
+} } } // bts::wallet::detail
+
+FC_REFLECT_ENUM( bts::wallet::detail::wallet_field,
+                 (receive_address_field)(receive_pts_address_field)(send_address_field)(encrypted_keys_field)
+                 (last_used_key_field)(last_scanned_block_field)(transaction_field)(unspent_output_field)
+                 (spent_output_field)(output_ref_field)(vote_field)(delegate_key_field)
+                 (trusted_delegate_field)(distrusted_delegate_field)(encrypted_key_field)(transaction_order_field) )
+FC_REFLECT( bts::wallet::detail::wallet_record, (field)(data) )
+
 namespace bts { namespace wallet {
 
    output_index::operator std::string()const
@@ -154,10 +252,113 @@ namespace bts { namespace wallet {
 
    namespace detail
    {
+      /** the number of blocks a scan worker decodes at a time */
+      const uint32_t scan_range_size = 200;
+
+      /** pending transactions evaluated by each thread of generate_next_block */
+      const uint32_t generate_evaluation_per_thread = 32;
+
+      /** the number of blocks applied by apply_block that revert_block can undo */
+      const uint32_t undo_depth = 100;
+
+      /** the number of keys after last_used_key that are derived ahead while the wallet is unlocked */
+      const uint32_t key_lookahead = 20;
+
+      /** a transaction decoded by a scan worker */
+      struct scanned_transaction
+      {
+         uint32_t            block_num;
+         /** as passed to scan_transaction, the trx_num of the transaction like the chain's, so
+          *  deterministic transactions follow the others instead of starting again at 0 */
+         uint32_t            trx_idx;
+         uint16_t            position;        ///< in the block, deterministic transactions follow the others
+         uint32_t            block_trx_count; ///< reported to the scan_progress_callback, 0 for deterministic transactions
+         bool                may_match;       ///< an output may belong to the wallet
+         signed_transaction  trx;
+      };
+
+      /**
+       *  A copy of what identifies the outputs of the wallet, taken when a scan starts so that
+       *  workers can match outputs while the wallet keeps changing.
+       */
+      struct scan_keys
+      {
+         address_filter                   addresses; ///< and pts addresses
+         std::unordered_set<uint32_t>     delegates;
+
+         /** false only if scan_output cannot find anything in out, unknown claims are left to it */
+         bool may_match( const trx_output& out )const
+         {
+            switch( out.claim_func )
+            {
+               case claim_by_signature:
+                  return addresses.may_contain( out.as<claim_by_signature_output>().owner );
+               case claim_by_pts:
+                  return addresses.may_contain( out.as<claim_by_pts_output>().owner );
+               case claim_name:
+                  return delegates.find( out.as<claim_name_output>().delegate_id ) != delegates.end();
+               default:
+                  return true;
+            }
+         }
+      };
+
+      /** decodes the transactions of blocks [first,last] and matches their outputs against keys */
+      std::vector<scanned_transaction> scan_blocks( const chain_snapshot& chain, const scan_keys& keys,
+                                                    uint32_t first, uint32_t last )
+      {
+         std::vector<scanned_transaction> result;
+         for( uint32_t block_num = first; block_num <= last; ++block_num )
+         {
+            auto blk = chain.fetch_digest_block( block_num );
+            uint32_t count = blk.trx_ids.size() + blk.deterministic_ids.size();
+            for( uint32_t t = 0; t < count; ++t )
+            {
+               scanned_transaction scanned;
+               scanned.block_num       = block_num;
+               bool deterministic      = t >= blk.trx_ids.size();
+               scanned.trx_idx         = t;
+               scanned.position        = t;
+               scanned.block_trx_count = deterministic ? 0 : blk.trx_ids.size();
+               scanned.trx             = chain.fetch_trx( trx_num( block_num, t ) );
+               scanned.may_match       = false;
+               for( const trx_output& out : scanned.trx.outputs )
+               {
+                  if( keys.may_match( out ) ) { scanned.may_match = true; break; }
+               }
+               result.push_back( std::move(scanned) );
+            }
+         }
+         return result;
+      }
+
+      /** a key and everything add_key derives from it, which may be computed on any thread */
+      struct prepared_key
+      {
+         prepared_key( const fc::ecc::private_key& k, const std::string& password )
+         :key(k),addr(k.get_public_key()),pts_addrs( pts_address::all_forms( k.get_public_key() ) ),
+          sealed( wallet_data::seal_key( k, password ) ){}
+
+         /** the form bitcoin wallets show, the uncompressed key with version 0 */
+         const pts_address& btc_address()const { return pts_addrs[2]; }
+
+         fc::ecc::private_key        key;
+         address                     addr;
+         std::array<pts_address,4>   pts_addrs;
+         std::vector<char>           sealed;
+      };
+
+      /** the unspent outputs of one unit that the wallet can spend and their total */
+      struct spendable_outputs
+      {
+         asset                                          balance;
+         std::set< std::pair<uint64_t,output_index> >   by_amount;
+      };
+
       class wallet_impl
       {
           public:
-              wallet_impl():_stake(0),_is_open(false),_blockchain(nullptr){}
+              wallet_impl():_stake(0),_confirmation_target(1),_is_open(false),_spent_log(nullptr),_blockchain(nullptr),_journal_size(0),_snapshot_size(0),_needs_compaction(false){}
               std::string _wallet_base_password; // used for saving/loading the wallet
               std::string _wallet_key_password;  // used to access private keys
               fc::time_point _wallet_relock_time;
@@ -169,22 +370,410 @@ namespace bts { namespace wallet {
               /** millishares per byte */
               uint64_t                                                   _current_fee_rate;
               uint64_t                                                   _stake;
+              /** sizes the fees of transfers, null until a client provides one */
+              bts::blockchain::fee_estimator_ptr                         _fee_estimator;
+              /** the blocks a transfer should be included within */
+              uint32_t                                                   _confirmation_target;
               bool                                                       _is_open;
 
               //std::map<output_index, output_reference>                 _output_index_to_ref;
               // cached data for rapid lookup
-              std::unordered_map<output_reference, output_index>         _output_ref_to_index;
+              flat_hash_map<output_reference, output_index>              _output_ref_to_index;
+              /** the reverse of _data.transaction_order */
+              flat_hash_map<transaction_id_type, trx_num>                _transaction_positions;
+
+              /** the outputs each block applied by apply_block spent, newest last, for revert_block */
+              std::deque< std::pair< uint32_t, std::vector<output_index> > > _undo_log;
+              /** where scan_transaction records the outputs it spends while a block is applied */
+              std::vector<output_index>*                                 _spent_log;
 
               // keep sorted so we spend oldest first to maximize CDD
               //std::map<output_index, trx_output>                       _unspent_outputs;
               //std::map<output_index, trx_output>                       _spent_outputs;
 
               // maps address to private key index
-              std::unordered_map<address,fc::ecc::private_key>             _my_keys;
+              flat_hash_map<address,fc::ecc::private_key>                  _my_keys;
               std::unordered_map<transaction_id_type,signed_transaction>   _id_to_signed_transaction;
 
               chain_database*                                              _blockchain;
 
+              /** changes of _data since the wallet was last saved, save() appends them to the journal */
+              std::vector<wallet_record>                                   _journal;
+              uint64_t                                                     _journal_size;  ///< bytes in the journal file
+              uint64_t                                                     _snapshot_size; ///< bytes in the wallet file
+              bool                                                         _needs_compaction;
+
+              template<typename Key, typename Value>
+              void journal_store( wallet_field field, const Key& k, const Value& v )
+              {
+                 wallet_record rec;
+                 rec.field = field;
+                 rec.data  = fc::raw::pack( k );
+                 auto value = fc::raw::pack( fc::optional<Value>( v ) );
+                 rec.data.insert( rec.data.end(), value.begin(), value.end() );
+                 _journal.push_back( std::move(rec) );
+              }
+
+              template<typename Key>
+              void journal_erase( wallet_field field, const Key& k )
+              {
+                 wallet_record rec;
+                 rec.field = field;
+                 rec.data  = fc::raw::pack( k );
+                 rec.data.push_back( 0 ); // an empty fc::optional
+                 _journal.push_back( std::move(rec) );
+              }
+
+              template<typename Value>
+              void journal_value( wallet_field field, const Value& v )
+              {
+                 wallet_record rec;
+                 rec.field = field;
+                 rec.data  = fc::raw::pack( v );
+                 _journal.push_back( std::move(rec) );
+              }
+
+              template<typename Map>
+              static void apply_entry( Map& m, const std::vector<char>& data )
+              {
+                 fc::datastream<const char*> ds( data.data(), data.size() );
+                 typename Map::key_type                       k;
+                 fc::optional<typename Map::mapped_type>      v;
+                 fc::raw::unpack( ds, k );
+                 fc::raw::unpack( ds, v );
+                 if( v ) m[k] = *v;
+                 else    m.erase( k );
+              }
+
+              template<typename Set>
+              static void apply_member( Set& s, const std::vector<char>& data )
+              {
+                 fc::datastream<const char*> ds( data.data(), data.size() );
+                 typename Set::key_type  k;
+                 fc::optional<bool>      present;
+                 fc::raw::unpack( ds, k );
+                 fc::raw::unpack( ds, present );
+                 if( present ) s.insert( k );
+                 else          s.erase( k );
+              }
+
+              void apply( const wallet_record& rec )
+              {
+                 switch( rec.field )
+                 {
+                    case receive_address_field:     apply_entry( _data.receive_addresses, rec.data );      break;
+                    case receive_pts_address_field: apply_entry( _data.receive_pts_addresses, rec.data );  break;
+                    case send_address_field:        apply_entry( _data.send_addresses, rec.data );         break;
+                    case encrypted_keys_field:      _data.encrypted_keys = fc::raw::unpack<std::vector<char> >( rec.data ); break;
+                    case last_used_key_field:       _data.last_used_key = fc::raw::unpack<uint32_t>( rec.data ); break;
+                    case last_scanned_block_field:  _data.last_scanned_block_num = fc::raw::unpack<uint32_t>( rec.data ); break;
+                    case transaction_field:         apply_entry( _data.transactions, rec.data );           break;
+                    case unspent_output_field:      apply_entry( _data.unspent_outputs, rec.data );        break;
+                    case spent_output_field:        apply_entry( _data.spent_outputs, rec.data );          break;
+                    case output_ref_field:          apply_entry( _data.output_index_to_ref, rec.data );    break;
+                    case vote_field:                apply_entry( _data.votes, rec.data );                  break;
+                    case delegate_key_field:        apply_entry( _data.delegate_keys, rec.data );          break;
+                    case trusted_delegate_field:    apply_member( _data.trusted_delegates, rec.data );     break;
+                    case distrusted_delegate_field: apply_member( _data.distrusted_delegates, rec.data );  break;
+                    case encrypted_key_field:       apply_entry( _data.encrypted_key_store, rec.data );    break;
+                    case transaction_order_field:   apply_entry( _data.transaction_order, rec.data );      break;
+                    default:
+                       FC_THROW_EXCEPTION( exception, "unknown wallet journal record ${f}", ("f",rec.field) );
+                 }
+              }
+
+              fc::path journal_path()const { return fc::path( _wallet_dat.generic_string() + ".log" ); }
+
+              fc::sha512 file_key()const
+              {
+                 return fc::sha512::hash( _wallet_base_password.c_str(), _wallet_base_password.size() );
+              }
+
+              /** writes all of _data to path in the binary format, encrypted if there is a base password */
+              void write_snapshot( const fc::path& path )
+              {
+                 std::vector<char> data( wallet_file_magic, wallet_file_magic + sizeof(wallet_file_magic) );
+                 auto packed = fc::raw::pack( _data );
+                 data.insert( data.end(), packed.begin(), packed.end() );
+                 if( _wallet_base_password.size() )
+                 {
+                    fc::aes_save( path, file_key(), data );
+                    return;
+                 }
+                 std::ofstream out( path.generic_string().c_str(), std::ios::binary | std::ios::trunc );
+                 out.write( data.data(), data.size() );
+                 out.close();
+                 FC_ASSERT( out.good(), "unable to write ${path}", ("path",path) );
+              }
+
+              /** replaces the wallet file with all of _data and starts a new journal */
+              void compact()
+              {
+                 if( fc::exists( _wallet_dat ) )
+                 {
+                   auto new_tmp = fc::unique_path();
+                   auto old_tmp = fc::unique_path();
+                   write_snapshot( new_tmp );
+                   fc::rename( _wallet_dat, old_tmp );
+                   fc::rename( new_tmp, _wallet_dat );
+                   fc::remove( old_tmp );
+                 }
+                 else
+                 {
+                    write_snapshot( _wallet_dat );
+                 }
+                 if( fc::exists( journal_path() ) ) fc::remove( journal_path() );
+                 _journal.clear();
+                 _journal_size     = 0;
+                 _snapshot_size    = fc::file_size( _wallet_dat );
+                 _needs_compaction = false;
+              }
+
+              /** appends _journal as one chunk: its size followed by the packed, encrypted records */
+              void append_journal()
+              {
+                 auto chunk = fc::raw::pack( _journal );
+                 if( _wallet_base_password.size() ) chunk = fc::aes_encrypt( file_key(), chunk );
+                 uint32_t size = chunk.size();
+
+                 std::ofstream out( journal_path().generic_string().c_str(), std::ios::binary | std::ios::app );
+                 out.write( (const char*)&size, sizeof(size) );
+                 out.write( chunk.data(), chunk.size() );
+                 out.close();
+                 FC_ASSERT( out.good(), "unable to write ${path}", ("path",journal_path()) );
+                 _journal.clear();
+                 _journal_size += sizeof(size) + chunk.size();
+              }
+
+              /** applies every complete chunk of the journal, a torn chunk at the end is dropped by the next save */
+              void replay_journal()
+              {
+                 _journal_size = 0;
+                 if( !fc::exists( journal_path() ) ) return;
+
+                 std::ifstream in( journal_path().generic_string().c_str(), std::ios::binary );
+                 std::vector<char> log( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+                 size_t pos = 0;
+                 while( pos < log.size() )
+                 {
+                    uint32_t size = 0;
+                    if( log.size() - pos < sizeof(size) ) break;
+                    memcpy( &size, log.data() + pos, sizeof(size) );
+                    if( log.size() - pos - sizeof(size) < size ) break;
+
+                    std::vector<char> chunk( log.data() + pos + sizeof(size), log.data() + pos + sizeof(size) + size );
+                    std::vector<wallet_record> records;
+                    try {
+                       if( _wallet_base_password.size() ) chunk = fc::aes_decrypt( file_key(), chunk );
+                       records = fc::raw::unpack<std::vector<wallet_record> >( chunk );
+                    }
+                    catch ( const fc::exception& e )
+                    {
+                       wlog( "dropping the end of the wallet journal: ${e}", ("e",e.to_detail_string()) );
+                       break;
+                    }
+                    for( const wallet_record& rec : records ) apply( rec );
+                    pos += sizeof(size) + size;
+                 }
+                 _journal_size     = pos;
+                 _needs_compaction = pos != log.size();
+              }
+
+              /** the claim_by_signature and claim_by_pts outputs of _data.unspent_outputs by unit */
+              std::unordered_map<asset_type,spendable_outputs>             _spendable;
+
+              static bool is_spendable( const trx_output& out )
+              {
+                 return out.claim_func == claim_by_signature || out.claim_func == claim_by_pts;
+              }
+
+              void index_output( const output_index& idx, const trx_output& out )
+              {
+                 if( !is_spendable( out ) ) return;
+                 auto& outputs = _spendable[out.amount.unit];
+                 if( outputs.by_amount.insert( std::make_pair( out.amount.get_rounded_amount(), idx ) ).second )
+                 {
+                    outputs.balance.unit = out.amount.unit;
+                    outputs.balance += out.amount;
+                 }
+              }
+
+              void unindex_output( const output_index& idx, const trx_output& out )
+              {
+                 if( !is_spendable( out ) ) return;
+                 auto itr = _spendable.find( out.amount.unit );
+                 if( itr == _spendable.end() ) return;
+                 if( itr->second.by_amount.erase( std::make_pair( out.amount.get_rounded_amount(), idx ) ) )
+                    itr->second.balance -= out.amount;
+              }
+
+              void rebuild_spendable_index()
+              {
+                 _spendable.clear();
+                 for( auto itr = _data.unspent_outputs.begin(); itr != _data.unspent_outputs.end(); ++itr )
+                    index_output( itr->first, itr->second );
+              }
+
+              /** moves trx_id to pos in the history, it may have been included elsewhere by a fork */
+              void set_transaction_position( const transaction_id_type& trx_id, const trx_num& pos )
+              {
+                 auto itr = _transaction_positions.find( trx_id );
+                 if( itr != _transaction_positions.end() )
+                 {
+                    if( itr->second == pos ) return;
+                    _data.transaction_order.erase( itr->second );
+                    journal_erase( transaction_order_field, itr->second );
+                 }
+                 _transaction_positions[trx_id] = pos;
+                 _data.transaction_order[pos]   = trx_id;
+                 journal_store( transaction_order_field, pos, trx_id );
+              }
+
+              /** of every receive address and pts address, checked before _data */
+              address_filter                                               _address_filter;
+
+              /** decode blocks for scan_chain and prepare imported keys, created on first use */
+              std::vector<std::unique_ptr<fc::thread> >                   _workers;
+
+              std::vector<std::unique_ptr<fc::thread> >& workers()
+              {
+                 uint32_t num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+                 while( _workers.size() < num_threads )
+                    _workers.emplace_back( new fc::thread( "wallet_worker" ) );
+                 return _workers;
+              }
+
+              /** prepares keys on the workers, a slice per worker */
+              std::vector<prepared_key> prepare_keys( const std::vector<fc::ecc::private_key>& keys )
+              {
+                 auto& pool = workers();
+                 size_t slice = (keys.size() + pool.size() - 1) / pool.size();
+                 std::string password = _wallet_key_password;
+                 std::vector< fc::future< std::vector<prepared_key> > > slices;
+                 for( size_t first = 0; first < keys.size(); first += slice )
+                 {
+                    size_t last = std::min( first + slice, keys.size() );
+                    slices.push_back( pool[slices.size()]->async( [&keys,password,first,last]()
+                    {
+                       std::vector<prepared_key> prepared;
+                       prepared.reserve( last - first );
+                       for( size_t i = first; i < last; ++i )
+                          prepared.push_back( prepared_key( keys[i], password ) );
+                       return prepared;
+                    } ) );
+                 }
+                 std::vector<prepared_key> result;
+                 result.reserve( keys.size() );
+                 for( auto& f : slices )
+                 {
+                    auto prepared = f.wait();
+                    result.insert( result.end(), prepared.begin(), prepared.end() );
+                 }
+                 return result;
+              }
+
+              /** derives the children of the base key for new_public_key ahead of time */
+              std::unique_ptr<fc::thread>                                  _key_thread;
+              std::map<uint32_t, fc::future<fc::ecc::private_key> >        _derived_keys;
+
+              /** starts deriving the keys that follow last_used_key which aren't derived yet */
+              void derive_ahead( const extended_private_key& base_key )
+              {
+                 if( !_key_thread ) _key_thread.reset( new fc::thread( "wallet_keys" ) );
+                 for( uint32_t i = _data.last_used_key + 1; i <= _data.last_used_key + key_lookahead; ++i )
+                 {
+                    if( _derived_keys.find( i ) != _derived_keys.end() ) continue;
+                    _derived_keys[i] = _key_thread->async( [base_key,i]() { return fc::ecc::private_key( base_key.child( i ) ); } );
+                 }
+              }
+
+              /** @return child idx of base_key, derived ahead if it was, and drops the keys before it */
+              fc::ecc::private_key derive_key( const extended_private_key& base_key, uint32_t idx )
+              {
+                 auto itr = _derived_keys.find( idx );
+                 if( itr == _derived_keys.end() ) return base_key.child( idx );
+                 auto key = itr->second.wait();
+                 _derived_keys.erase( _derived_keys.begin(), ++itr );
+                 return key;
+              }
+
+              /** decrypted on first use while the wallet is unlocked */
+              fc::optional<extended_private_key>                           _base_key;
+
+              const extended_private_key& get_base_key()
+              {
+                 if( !_base_key ) _base_key = _data.get_base_key( _wallet_key_password );
+                 return *_base_key;
+              }
+
+              /** moves the keys of a wallet saved before encrypted_key_store to the store */
+              void upgrade_key_store()
+              {
+                 if( _data.encrypted_keys.size() == 0 ) return;
+                 auto keys = _data.decrypt_keys( _wallet_key_password );
+                 for( auto itr = keys.begin(); itr != keys.end(); ++itr )
+                 {
+                    if( _data.encrypted_key_store.find( itr->first ) != _data.encrypted_key_store.end() ) continue;
+                    journal_store( encrypted_key_field, itr->first, _data.store_key( itr->first, itr->second, _wallet_key_password ) );
+                 }
+                 _data.encrypted_keys.clear();
+                 journal_value( encrypted_keys_field, _data.encrypted_keys );
+              }
+
+              /** adds key and encrypts it alone into the key store, the wallet must be unlocked */
+              address add_key( const fc::ecc::private_key& key, const std::string& label )
+              {
+                 return add_key( prepared_key( key, _wallet_key_password ), label );
+              }
+
+              /** listings convert every address of the wallet to a string */
+              void memoize_addresses()
+              {
+                 for( const auto& item : _data.receive_addresses ) address::memoize( item.first );
+                 for( const auto& item : _data.send_addresses )    address::memoize( item.first );
+              }
+
+              address add_key( const prepared_key& prepared, const std::string& label )
+              {
+                 const auto& addr = prepared.addr;
+                 _my_keys[addr] = prepared.key;
+                 _data.encrypted_key_store[addr] = prepared.sealed;
+                 journal_store( encrypted_key_field, addr, prepared.sealed );
+                 if( _data.receive_addresses.find( addr ) == _data.receive_addresses.end() )
+                    _address_filter.insert( addr );
+                 _data.receive_addresses[addr] = label;
+                 journal_store( receive_address_field, addr, label );
+                 address::memoize( addr );
+
+                 const auto& pts_addrs = prepared.pts_addrs;
+                 for( auto itr = pts_addrs.begin(); itr != pts_addrs.end(); ++itr )
+                 {
+                    if( _data.receive_pts_addresses.find( *itr ) == _data.receive_pts_addresses.end() )
+                       _address_filter.insert( *itr );
+                    _data.receive_pts_addresses[ *itr ] = addr;
+                    journal_store( receive_pts_address_field, *itr, addr );
+                 }
+                 return addr;
+              }
+
+              void rebuild_address_filter()
+              {
+                 _address_filter.clear();
+                 for( auto itr = _data.receive_addresses.begin(); itr != _data.receive_addresses.end(); ++itr )
+                    _address_filter.insert( itr->first );
+                 for( auto itr = _data.receive_pts_addresses.begin(); itr != _data.receive_pts_addresses.end(); ++itr )
+                    _address_filter.insert( itr->first );
+              }
+
+              scan_keys get_scan_keys()const
+              {
+                 scan_keys keys;
+                 keys.addresses = _address_filter;
+                 for( auto itr = _data.delegate_keys.begin(); itr != _data.delegate_keys.end(); ++itr )
+                    keys.delegates.insert( itr->first );
+                 return keys;
+              }
+
               uint64_t get_fee_rate()
               {
                   return _current_fee_rate;
@@ -192,20 +781,10 @@ namespace bts { namespace wallet {
 
               asset get_balance( asset_type balance_type )
               {
-                   asset total_balance( static_cast<uint64_t>(0ull), balance_type);
-                   for( auto out : _data.unspent_outputs )
-                   {
-                      //ilog( "unspent outputs ${o}", ("o",*itr) );
-                       if( out.second.claim_func == claim_by_signature && out.second.amount.unit == balance_type )
-                       {
-                         total_balance += out.second.amount; // TODO: apply interest earned
-                       }
-                       if( out.second.claim_func == claim_by_pts && out.second.amount.unit == balance_type )
-                       {
-                         total_balance += out.second.amount; // TODO: apply interest earned
-                       }
-                   }
-                   return total_balance;
+                   auto itr = _spendable.find( balance_type );
+                   if( itr == _spendable.end() || itr->second.by_amount.empty() )
+                      return asset( static_cast<uint64_t>(0ull), balance_type );
+                   return itr->second.balance; // TODO: apply interest earned
               }
 
               output_reference get_output_ref( const output_index& idx )
@@ -222,74 +801,84 @@ namespace bts { namespace wallet {
                  return pts_addr_itr->second;
               }
 
+              /** @return the address that must sign to spend the spendable output out */
+              address owner_of( const trx_output& out )
+              {
+                   if( out.claim_func == claim_by_signature )
+                      return out.as<claim_by_signature_output>().owner;
+                   return pts_to_bts_address( out.as<claim_by_pts_output>().owner );
+              }
+
+              void add_input( const output_index& idx, std::vector<trx_input>& inputs,
+                              asset& total_input, std::unordered_set<address>& required_signatures )
+              {
+                   auto itr = _data.unspent_outputs.find( idx );
+                   FC_ASSERT( itr != _data.unspent_outputs.end() );
+                   inputs.push_back( trx_input( get_output_ref( idx ) ) );
+                   total_input += itr->second.amount;
+                   required_signatures.insert( owner_of( itr->second ) );
+              }
+
+              /**
+               *  Picks the base unit output with the most coin days destroyed.  Outputs are visited
+               *  largest first and the visit stops once an output could not beat the best even if it
+               *  were as old as the oldest unspent output.
+               */
               std::vector<trx_input> collect_mining_input( asset& total_input, std::unordered_set<address>& required_signatures )
               {
-                   uint64_t best_cdd = 0;
-                   std::vector<trx_input> inputs;
-                   inputs.resize(1);
-                   address mine_addr;
+                   auto spendable = _spendable.find( 0 );
+                   FC_ASSERT( spendable != _spendable.end() && !spendable->second.by_amount.empty() );
+                   uint64_t max_age = _data.last_scanned_block_num - _data.unspent_outputs.begin()->first.block_idx + 1;
 
-                   for( auto out : _data.unspent_outputs  )
+                   uint64_t best_cdd = 0;
+                   output_index best;
+                   const auto& by_amount = spendable->second.by_amount;
+                   for( auto itr = by_amount.rbegin(); itr != by_amount.rend(); ++itr )
                    {
-                       //ilog( "unspent outputs ${o}", ("o",*itr) );
-                       if( out.second.claim_func == claim_by_signature && out.second.amount.unit == 0 )
-                       {
-                           auto cdd = out.second.amount.get_rounded_amount() * (_data.last_scanned_block_num - out.first.block_idx+1);
-                           if( cdd > best_cdd )
-                           {
-                              inputs.back() = trx_input( get_output_ref(out.first) );
-                              best_cdd = cdd;
-                              mine_addr = out.second.as<claim_by_signature_output>().owner;
-                              total_input = out.second.amount;
-                           }
-                       }
-                       else if( out.second.claim_func == claim_by_pts && out.second.amount.unit == 0 )
+                       if( itr->first * max_age <= best_cdd ) break;
+                       auto cdd = itr->first * (_data.last_scanned_block_num - itr->second.block_idx+1);
+                       if( cdd > best_cdd )
                        {
-                           auto cdd = out.second.amount.get_rounded_amount() * (_data.last_scanned_block_num - out.first.block_idx+1);
-                           if( cdd > best_cdd )
-                           {
-                              inputs.back() = trx_input( get_output_ref(out.first) );
-                              best_cdd = cdd;
-                              total_input = out.second.amount;
-                              mine_addr = pts_to_bts_address(out.second.as<claim_by_pts_output>().owner);
-                           }
+                          best_cdd = cdd;
+                          best     = itr->second;
                        }
                    }
                    FC_ASSERT( best_cdd != 0 );
-                   FC_ASSERT( mine_addr != address() );
-                   ilog( "mine addr ${addr}", ("addr",mine_addr) );
-                   required_signatures.insert( mine_addr );
+
+                   std::vector<trx_input> inputs;
+                   total_input = asset();
+                   add_input( best, inputs, total_input, required_signatures );
+                   ilog( "mine input ${idx}", ("idx",std::string(best)) );
                    return inputs;
 
               } // collect_mining_input
 
 
               /**
-               *  Collect inputs that total to at least requested_amount.
+               *  Collect inputs that total to at least requested_amount.  The smallest output that
+               *  covers what is missing is used if there is one, leaving the least change, otherwise
+               *  the largest outputs are used so that there are as few inputs to sign as possible.
                */
               std::vector<trx_input> collect_inputs( const asset& requested_amount, asset& total_input, std::unordered_set<address>& required_signatures )
               {
                    std::vector<trx_input> inputs;
-                   for( auto out : _data.unspent_outputs )
+                   auto spendable = _spendable.find( requested_amount.unit );
+                   if( spendable != _spendable.end() )
                    {
-                      //ilog( "unspent outputs ${o}", ("o",out) );
-                       if( out.second.claim_func == claim_by_signature && out.second.amount.unit == requested_amount.unit )
+                       const auto& by_amount = spendable->second.by_amount;
+                       uint64_t needed = 0;
+                       if( total_input.get_rounded_amount() < requested_amount.get_rounded_amount() )
+                          needed = requested_amount.get_rounded_amount() - total_input.get_rounded_amount();
+
+                       auto single = by_amount.lower_bound( std::make_pair( needed, output_index() ) );
+                       if( single != by_amount.end() )
                        {
-                           inputs.push_back( trx_input( get_output_ref(out.first) ) );
-                           total_input += out.second.amount;
-                           required_signatures.insert( out.second.as<claim_by_signature_output>().owner );
-                       //    ilog( "total in ${in}  min ${min}", ( "in",total_input)("min",requested_amount) );
-                           if( total_input.get_rounded_amount() >= requested_amount.get_rounded_amount() )
-                           {
-                              return inputs;
-                           }
+                           add_input( single->second, inputs, total_input, required_signatures );
+                           return inputs;
                        }
-                       else if( out.second.claim_func == claim_by_pts && out.second.amount.unit == requested_amount.unit )
+                       for( auto itr = by_amount.rbegin(); itr != by_amount.rend(); ++itr )
                        {
-                           inputs.push_back( trx_input( get_output_ref(out.first) ) );
-                           total_input += out.second.amount;
-                           required_signatures.insert( _data.receive_pts_addresses[out.second.as<claim_by_pts_output>().owner] );
-                        //   ilog( "total in ${in}  min ${min}", ( "in",total_input)("min",requested_amount) );
+                           add_input( itr->second, inputs, total_input, required_signatures );
                            if( total_input.get_rounded_amount() >= requested_amount.get_rounded_amount() )
                            {
                               return inputs;
@@ -299,6 +888,88 @@ namespace bts { namespace wallet {
                    FC_ASSERT( !"Unable to collect sufficient unspent inputs", "", ("requested_amount",requested_amount)("total_collected",total_input) );
               }
 
+              /**
+               *  Adds base unit inputs to trx that cover requested_amount and the fee at fee_rate of
+               *  the transaction they make, in one pass over the spendable outputs and without
+               *  signing.  As in collect_inputs the smallest output that covers everything is
+               *  preferred, otherwise the largest outputs are taken until the fee of what was taken
+               *  is covered.
+               *
+               *  @param signed_size the size the fee is for, of trx once signed for required_signatures
+               *  @return the fee
+               */
+              uint64_t collect_inputs_with_fee( signed_transaction& trx, const asset& requested_amount, uint64_t fee_rate,
+                                                 asset& total_input, std::unordered_set<address>& required_signatures,
+                                                 size_t& signed_size )
+              {
+                   transaction_size_model model( trx );
+                   auto fee_of = [&]( const transaction_size_model& m, size_t signers ) -> uint64_t
+                   {
+                      return (fee_rate * m.size( signers )) / 1000;
+                   };
+                   uint64_t requested = requested_amount.get_rounded_amount();
+
+                   auto spendable = _spendable.find( requested_amount.unit );
+                   FC_ASSERT( spendable != _spendable.end() && !spendable->second.by_amount.empty(),
+                              "Unable to collect sufficient unspent inputs", ("requested_amount",requested_amount) );
+                   const auto& by_amount = spendable->second.by_amount;
+
+                   // one more input whose owner may need one more signature
+                   transaction_size_model with_one( model );
+                   with_one.add_input( trx_input( get_output_ref( by_amount.begin()->second ) ) );
+                   uint64_t single_needed = requested + fee_of( with_one, required_signatures.size() + 1 );
+                   auto single = by_amount.lower_bound( std::make_pair( single_needed, output_index() ) );
+                   if( single != by_amount.end() )
+                   {
+                       add_input( single->second, trx.inputs, total_input, required_signatures );
+                       model.add_input( trx.inputs.back() );
+                       signed_size = model.size( required_signatures.size() );
+                       return fee_of( model, required_signatures.size() );
+                   }
+
+                   for( auto itr = by_amount.rbegin(); itr != by_amount.rend(); ++itr )
+                   {
+                       add_input( itr->second, trx.inputs, total_input, required_signatures );
+                       model.add_input( trx.inputs.back() );
+                       uint64_t fee = fee_of( model, required_signatures.size() );
+                       if( total_input.get_rounded_amount() >= requested + fee )
+                       {
+                          signed_size = model.size( required_signatures.size() );
+                          return fee;
+                       }
+                   }
+                   FC_ASSERT( !"Unable to collect sufficient unspent inputs", "", ("requested_amount",requested_amount)("total_collected",total_input) );
+              }
+
+              /**
+               *  Signs trx for each of addresses.  A transaction with several owners is signed on the
+               *  signature pool, one signature per task, as each one signs the same digest.
+               */
+              void sign_for( signed_transaction& trx, const std::unordered_set<address>& addresses )
+              {
+                   if( addresses.size() < 2 )
+                   {
+                      for( auto itr = addresses.begin(); itr != addresses.end(); ++itr )
+                         self->sign_transaction( trx, *itr );
+                      return;
+                   }
+                   FC_ASSERT( !self->is_locked() );
+                   fc::sha256 digest = trx.transaction::digest();
+                   auto& pool = bts::db::executor::instance().pool( "signature" );
+                   std::vector< fc::future<fc::ecc::compact_signature> > signatures;
+                   signatures.reserve( addresses.size() );
+                   for( auto itr = addresses.begin(); itr != addresses.end(); ++itr )
+                   {
+                      auto key = _my_keys.find( *itr );
+                      FC_ASSERT( key != _my_keys.end(), "unable to sign transaction for ${addr}", ("addr",*itr) );
+                      fc::ecc::private_key priv_key = key->second;
+                      signatures.push_back( pool.async( [priv_key,digest]() { return priv_key.sign_compact( digest ); } ) );
+                   }
+                   for( auto& signature : signatures )
+                      trx.sigs.insert( signature.wait() );
+                   trx.invalidate_cache();
+              }
+
               /**
                *  This method should select the trusted delegate with the least votes or vote against
                *  any untrusted delegates that are in the top 200
@@ -322,20 +993,23 @@ namespace bts { namespace wallet {
                    trx.stake = _stake;
                    trx.vote  = select_delegate_vote();
 
-                   for( auto itr = addresses.begin(); itr != addresses.end(); ++itr )
-                   {
-                      self->sign_transaction( trx, *itr );
-                   }
+                   sign_for( trx, addresses );
                    if( mark_output_as_used )
+                      record_spend( trx );
+              } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+              /** marks the inputs of the signed trx as spent and logs it */
+              void record_spend( const signed_transaction& trx )
+              {
+                   for( auto itr = trx.inputs.begin(); itr != trx.inputs.end(); ++itr )
                    {
-                      for( auto itr = trx.inputs.begin(); itr != trx.inputs.end(); ++itr )
-                      {
-                          elog( "MARK AS SPENT ${B}", ("B",itr->output_ref) );
-                          self->mark_as_spent( itr->output_ref );
-                      }
-                      _data.transactions[trx.id()].trx = trx;
+                       elog( "MARK AS SPENT ${B}", ("B",itr->output_ref) );
+                       self->mark_as_spent( itr->output_ref );
                    }
-              } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+                   auto& state = _data.transactions[trx.id()];
+                   state.trx = trx;
+                   journal_store( transaction_field, trx.id(), state );
+              }
               wallet* self;
       };
    } // namespace detail
@@ -368,6 +1042,11 @@ namespace bts { namespace wallet {
       my->_wallet_dat           = fc::path();
       my->_data                 = wallet_data();
       my->_wallet_base_password = std::string();
+      my->_journal.clear();
+      my->_undo_log.clear();
+      my->_derived_keys.clear();
+      my->_base_key.reset();
+      my->_is_open              = false;
       return true;
    }
    void wallet::open( const fc::path& wallet_dat, const fc::string& password )
@@ -378,20 +1057,55 @@ namespace bts { namespace wallet {
 
            FC_ASSERT( fc::exists( wallet_dat ), "", ("wallet_dat",wallet_dat) )
 
+           std::vector<char> plain_txt;
            if( password == std::string() ) //if no password, just open wallet
            {
-               my->_data = fc::json::from_file<bts::wallet::wallet_data>( wallet_dat );
+               std::ifstream in( wallet_dat.generic_string().c_str(), std::ios::binary );
+               plain_txt.assign( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
            }
            else //open password-protected wallet
            {
-               std::vector<char> plain_txt = aes_load( wallet_dat, fc::sha512::hash( password.c_str(), password.size() ) );
-               FC_ASSERT( plain_txt.size() > 0 );
+               plain_txt = aes_load( wallet_dat, fc::sha512::hash( password.c_str(), password.size() ) );
+           }
+           FC_ASSERT( plain_txt.size() > 0 );
+
+           const size_t magic_size = sizeof(detail::wallet_file_magic);
+           my->_journal.clear();
+           my->_derived_keys.clear();
+           my->_base_key.reset();
+           auto has_magic = [&]( const char* magic )
+           {
+               return plain_txt.size() >= magic_size && memcmp( plain_txt.data(), magic, magic_size ) == 0;
+           };
+           // earlier binary forms lack the members appended since, each reads as an empty container
+           uint32_t missing_members = has_magic( detail::wallet_file_magic_v1 ) ? 2 :
+                                      has_magic( detail::wallet_file_magic_v2 ) ? 1 : 0;
+           if( missing_members || has_magic( detail::wallet_file_magic ) )
+           {
+               std::vector<char> packed( plain_txt.begin() + magic_size, plain_txt.end() );
+               packed.insert( packed.end(), missing_members, 0 ); // the size of each empty container
+               fc::datastream<const char*> ds( packed.data(), packed.size() );
+               my->_data = wallet_data();
+               fc::raw::unpack( ds, my->_data );
+               my->_needs_compaction = missing_members != 0;
+           }
+           else // wallets saved before the journal are JSON, the next save() converts them
+           {
                std::string str( plain_txt.begin(), plain_txt.end() );
                my->_data = fc::json::from_string(str).as<wallet_data>();
+               my->_needs_compaction = true;
            }
+           my->_snapshot_size = fc::file_size( wallet_dat );
+           my->replay_journal();
+           my->memoize_addresses();
            //create a reverse mapping of reference-to-index from the index-to-reference stored in the wallet file
-           for( auto item : my->_data.output_index_to_ref )
+           for( const auto& item : my->_data.output_index_to_ref )
                my->_output_ref_to_index[item.second] = item.first;
+           my->_transaction_positions.clear();
+           for( const auto& item : my->_data.transaction_order )
+               my->_transaction_positions[item.second] = item.first;
+           my->rebuild_address_filter();
+           my->rebuild_spendable_index();
 
            my->_is_open = true;
        }catch( fc::exception& er ) {
@@ -427,6 +1141,12 @@ namespace bts { namespace wallet {
       FC_ASSERT( key_password.size() >= 8 );
 
       my->_data = wallet_data();
+      my->_address_filter.clear();
+      my->_spendable.clear();
+      my->_transaction_positions.clear();
+      my->_journal.clear();
+      my->_derived_keys.clear();
+      my->_base_key.reset();
 
       my->_wallet_dat = wallet_dat;
       my->_wallet_base_password = base_password;
@@ -449,9 +1169,8 @@ namespace bts { namespace wallet {
          my->_data.set_base_key( extended_private_key( fc::ecc::private_key::generate().get_secret(),
                                                        fc::ecc::private_key::generate().get_secret() ), key_password );
       }
-      my->_data.set_keys( std::unordered_map<address,fc::ecc::private_key>(), key_password );
       my->_is_open = true;
-      save();
+      my->compact();
    } FC_RETHROW_EXCEPTIONS( warn, "unable to create wallet ${wal}", ("wal",wallet_dat) ) }
 
   bool wallet::is_open() const
@@ -462,17 +1181,8 @@ namespace bts { namespace wallet {
    void wallet::backup_wallet( const fc::path& backup_path )
    { try {
       FC_ASSERT( !fc::exists( backup_path ) );
-      auto tmp = my->_wallet_dat;
-      my->_wallet_dat = backup_path;
-      try {
-        save();
-        my->_wallet_dat = tmp;
-      }
-      catch ( ... )
-      {
-        my->_wallet_dat = tmp;
-        throw;
-      }
+      FC_ASSERT( is_open() );
+      my->write_snapshot( backup_path );
    } FC_RETHROW_EXCEPTIONS( warn, "unable to backup to ${path}", ("path",backup_path) ) }
 
    /**
@@ -481,51 +1191,39 @@ namespace bts { namespace wallet {
     */
    void wallet::import_bitcoin_wallet( const fc::path& wallet_dat, const std::string& passphrase )
    { try {
-      auto priv_keys = bts::import_bitcoin_wallet(  wallet_dat, passphrase );
-   //   ilog( "keys: ${keys}", ("keys",priv_keys) );
-      for( auto key : priv_keys )
+      FC_ASSERT( !is_locked() );
+      std::vector<address> addrs;
+      bts::import_bitcoin_wallet( wallet_dat, passphrase, [&]( const std::vector<fc::ecc::private_key>& keys )
       {
-         auto btc_addr = pts_address( key.get_public_key(), false, 0 );
-         import_key( key, std::string( btc_addr ) );
-      }
+         // the keys of a batch are hashed and encrypted in parallel, then added in one go
+         auto prepared = my->prepare_keys( keys );
+         for( const detail::prepared_key& key : prepared )
+            addrs.push_back( my->add_key( key, std::string( key.btc_address() ) ) );
+      } );
+      ilog( "imported ${n} keys from ${wallet_dat}", ("n",addrs.size())("wallet_dat",wallet_dat) );
+      if( my->_blockchain && my->_blockchain->has_owner_index() )
+         scan_owned_outputs( *my->_blockchain, addrs );
    } FC_RETHROW_EXCEPTIONS( warn, "Unable to import bitcoin wallet ${wallet_dat}", ("wallet_dat",wallet_dat) ) }
 
 
+   /**
+    *  Appends the changes since the last save to the journal, unless the journal has grown
+    *  larger than the wallet file in which case the whole wallet is written and the journal
+    *  removed.
+    */
    void wallet::save()
    { try {
-      ilog( "saving wallet\n" );
       FC_ASSERT(is_open());
 
-      auto wallet_json = fc::json::to_pretty_string( my->_data );
-      std::vector<char> data( wallet_json.begin(), wallet_json.end() );
-
-      if( fc::exists( my->_wallet_dat ) )
+      if( my->_needs_compaction || !fc::exists( my->_wallet_dat ) ||
+          my->_journal_size > std::max( my->_snapshot_size, detail::min_journal_compaction_size ) )
       {
-        auto new_tmp = fc::unique_path();
-        auto old_tmp = fc::unique_path();
-        if( my->_wallet_base_password.size() )
-        {
-          fc::aes_save( new_tmp, fc::sha512::hash( my->_wallet_base_password.c_str(), my->_wallet_base_password.size() ), data );
-        }
-        else
-        {
-           fc::json::save_to_file( my->_data, new_tmp, true );
-        }
-        fc::rename( my->_wallet_dat, old_tmp );
-        fc::rename( new_tmp, my->_wallet_dat );
-        fc::remove( old_tmp );
+         ilog( "saving wallet\n" );
+         my->compact();
       }
-      else
+      else if( my->_journal.size() )
       {
-         if( my->_wallet_base_password.size() != 0 )
-         {
-            fc::aes_save( my->_wallet_dat, fc::sha512::hash( my->_wallet_base_password.c_str(), my->_wallet_base_password.size() ), data );
-         }
-         else
-         {
-            ilog( "my->_wallet_dat: ${d}", ("d",my->_wallet_dat) );
-            fc::json::save_to_file( my->_data, my->_wallet_dat, true );
-         }
+         my->append_journal();
       }
    } FC_RETHROW_EXCEPTIONS( warn, "Unable to save wallet ${wallet}", ("wallet",my->_wallet_dat) ) }
 
@@ -537,26 +1235,39 @@ namespace bts { namespace wallet {
    address   wallet::import_key( const fc::ecc::private_key& key, const std::string& label )
    { try {
       FC_ASSERT( !is_locked() );
-      auto addr = address(key.get_public_key());
-      my->_my_keys[addr] = key;
-      my->_data.set_keys( my->_my_keys, my->_wallet_key_password );
-      my->_data.receive_addresses[addr] = label;
-
-      my->_data.receive_pts_addresses[ pts_address( key.get_public_key() ) ]           = addr;
-      my->_data.receive_pts_addresses[ pts_address( key.get_public_key(), true ) ]     = addr;
-      my->_data.receive_pts_addresses[ pts_address( key.get_public_key(), false, 0 ) ] = addr;
-      my->_data.receive_pts_addresses[ pts_address( key.get_public_key(), true, 0 ) ]  = addr;
-
+      auto addr = my->add_key( key, label );
+      if( my->_blockchain && my->_blockchain->has_owner_index() )
+         scan_owned_outputs( *my->_blockchain, std::vector<address>( 1, addr ) );
       return addr;
    } FC_RETHROW_EXCEPTIONS( warn, "unable to import private key" ) }
 
+   bool wallet::scan_owned_outputs( chain_database& chain, const std::vector<address>& addrs )
+   { try {
+      std::unordered_set<address> owners( addrs.begin(), addrs.end() );
+      std::vector<pts_address>    pts_owners;
+      for( auto itr = my->_data.receive_pts_addresses.begin(); itr != my->_data.receive_pts_addresses.end(); ++itr )
+         if( owners.find( itr->second ) != owners.end() ) pts_owners.push_back( itr->first );
+
+      bool found = false;
+      auto outputs = chain.get_snapshot()->fetch_owned_outputs( addrs, pts_owners );
+      for( const owned_output& out : outputs )
+      {
+         if( my->_output_ref_to_index.find( out.ref ) != my->_output_ref_to_index.end() ) continue;
+         cache_output( out.vote, out.output, out.ref, output_index( out.source.block_num, out.source.trx_idx, out.ref.output_idx.value ) );
+         found = true;
+      }
+      return found;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("addrs",addrs.size()) ) }
+
    fc::ecc::public_key   wallet::new_public_key( const std::string& label )
    { try {
       FC_ASSERT( !is_locked() );
       my->_data.last_used_key++;
-      auto base_key = my->_data.get_base_key( my->_wallet_key_password );
-      auto new_key = base_key.child( my->_data.last_used_key );
+      my->journal_value( last_used_key_field, my->_data.last_used_key );
+      const auto& base_key = my->get_base_key();
+      auto new_key = my->derive_key( base_key, my->_data.last_used_key );
       import_key(new_key, label);
+      my->derive_ahead( base_key );
       return new_key.get_public_key();
    } FC_RETHROW_EXCEPTIONS( warn, "unable to create new address with label '${label}'", ("label",label) ) }
 
@@ -568,12 +1279,22 @@ namespace bts { namespace wallet {
    void wallet::add_send_address( const address& addr, const std::string& label )
    { try {
       my->_data.send_addresses[addr] = label;
+      my->journal_store( send_address_field, addr, label );
+      address::memoize( addr );
    } FC_RETHROW_EXCEPTIONS( warn, "unable to add send address ${addr} with label ${label}", ("addr",addr)("label",label) ) }
 
    std::unordered_map<address,std::string> wallet::get_receive_addresses()const
    {
       return my->_data.receive_addresses;
    }
+   std::vector<pts_address> wallet::get_receive_pts_addresses()const
+   {
+      std::vector<pts_address> addrs;
+      addrs.reserve( my->_data.receive_pts_addresses.size() );
+      for( const auto& item : my->_data.receive_pts_addresses )
+         addrs.push_back( item.first );
+      return addrs;
+   }
    std::unordered_map<address,std::string> wallet::get_send_addresses()const
    {
       return my->_data.send_addresses;
@@ -584,11 +1305,30 @@ namespace bts { namespace wallet {
       my->_current_fee_rate = milli_shares_per_byte;
    }
 
+   void wallet::set_fee_estimator( const bts::blockchain::fee_estimator_ptr& estimator, uint32_t target_blocks )
+   {
+      my->_fee_estimator       = estimator;
+      my->_confirmation_target = target_blocks;
+   }
+
+   uint64_t wallet::get_transfer_fee_rate()
+   {
+      if( !my->_fee_estimator ) return get_fee_rate();
+      return std::max( get_fee_rate(), my->_fee_estimator->estimate( my->_confirmation_target ).fee_rate );
+   }
+
    void wallet::unlock_wallet( const std::string& key_password, const fc::microseconds& duration )
    { try {
-      my->_data.get_base_key( key_password );
+      my->_base_key = my->_data.get_base_key( key_password );
       my->_wallet_key_password = key_password;
-      my->_my_keys = my->_data.decrypt_keys(key_password);
+      auto stored_keys = my->_data.decrypt_key_store( key_password );
+      my->_my_keys.clear();
+      my->_my_keys.reserve( stored_keys.size() );
+      my->_my_keys.insert( stored_keys.begin(), stored_keys.end() );
+      auto legacy_keys = my->_data.decrypt_keys( key_password );
+      my->_my_keys.insert( legacy_keys.begin(), legacy_keys.end() );
+      my->upgrade_key_store();
+      my->derive_ahead( *my->_base_key );
 
       fc::time_point requested_relocking_time = fc::time_point::now() + duration;
       my->_wallet_relock_time = std::max(my->_wallet_relock_time, requested_relocking_time);
@@ -641,6 +1381,8 @@ namespace bts { namespace wallet {
       // TODO: overwrite memory
       my->_wallet_key_password = std::string();
       my->_my_keys.clear();
+      my->_derived_keys.clear();
+      my->_base_key.reset();
    }
 
    bool wallet::is_locked()const { return my->_wallet_key_password.size() == 0; }
@@ -654,6 +1396,36 @@ namespace bts { namespace wallet {
        return collect_inputs_and_sign(trx, amnt, memo);
    } FC_RETHROW_EXCEPTIONS( warn, "${amnt} to ${to}", ("amnt",amnt)("to",to) ) }
 
+   signed_transaction wallet::transfer_batch( const std::vector< std::pair<address,asset> >& payments, const std::string& memo )
+   { try {
+       FC_ASSERT( payments.size() > 0 );
+       signed_transaction trx;
+       std::map<asset_type,asset> totals;
+       for( auto itr = payments.begin(); itr != payments.end(); ++itr )
+       {
+          trx.outputs.push_back( trx_output( claim_by_signature_output( itr->first ), itr->second ) );
+          auto total = totals.find( itr->second.unit );
+          if( total == totals.end() ) totals[itr->second.unit] = itr->second;
+          else                        total->second += itr->second;
+       }
+
+       // fees are paid in the base unit, so every other unit is collected up front
+       std::unordered_set<address> required_signatures;
+       address change_addr = new_receive_address( "Change: " + memo );
+       for( auto itr = totals.begin(); itr != totals.end(); ++itr )
+       {
+          if( itr->first == asset().unit ) continue;
+          asset total_input( static_cast<uint64_t>(0ull), itr->first );
+          auto inputs = collect_inputs( itr->second, total_input, required_signatures );
+          trx.inputs.insert( trx.inputs.end(), inputs.begin(), inputs.end() );
+          if( total_input > itr->second )
+             trx.outputs.push_back( trx_output( claim_by_signature_output( change_addr ), total_input - itr->second ) );
+       }
+
+       auto base = totals.find( asset().unit );
+       return collect_inputs_and_sign( trx, base == totals.end() ? asset() : base->second, required_signatures, change_addr );
+   } FC_RETHROW_EXCEPTIONS( warn, "${n} payments", ("n",payments.size()) ) }
+
    signed_transaction wallet::register_delegate( const std::string& name, const fc::variant& data )
    {
       FC_ASSERT( claim_name_output::is_valid_name(name), "", ("name",name)  );
@@ -676,8 +1448,11 @@ namespace bts { namespace wallet {
       {
           return;
       }
+      my->unindex_output( itr->first, itr->second );
       my->_data.spent_outputs[ref_itr->second] = itr->second;
+      my->journal_store( spent_output_field, ref_itr->second, itr->second );
       my->_data.unspent_outputs.erase(ref_itr->second);
+      my->journal_erase( unspent_output_field, ref_itr->second );
    }
 
    void wallet::sign_transaction( signed_transaction& trx, const address& addr )
@@ -700,6 +1475,65 @@ namespace bts { namespace wallet {
       return my->_data.transactions;
    }
 
+   transaction_history_page wallet::get_transaction_history( const transaction_history_cursor& start, uint32_t limit,
+                                                             const fc::optional<address>& addr,
+                                                             const fc::optional<asset_type>& unit )const
+   { try {
+      transaction_history_page page;
+      if( limit == 0 ) return page;
+
+      auto matches = [&]( const transaction_state& state )
+      {
+         if( addr && std::find( state.to.begin(), state.to.end(), *addr ) == state.to.end() &&
+                     std::find( state.from.begin(), state.from.end(), *addr ) == state.from.end() )
+            return false;
+         if( unit && state.delta_balance.find( *unit ) == state.delta_balance.end() )
+            return false;
+         return true;
+      };
+
+      if( start.block_num != trx_num::invalid_block_num )
+      {
+         // no position in a block is past what a trx_num holds
+         trx_num first = start.trx_idx < trx_num::invalid_trx_idx ? trx_num( start.block_num, start.trx_idx )
+                                                                  : trx_num( start.block_num + 1, 0 );
+         for( auto itr = my->_data.transaction_order.lower_bound( first ); itr != my->_data.transaction_order.end(); ++itr )
+         {
+            auto state = my->_data.transactions.find( itr->second );
+            if( state == my->_data.transactions.end() || !matches( state->second ) ) continue;
+            if( page.transactions.size() == limit )
+            {
+               page.next = transaction_history_cursor( itr->first.block_num, itr->first.trx_idx );
+               return page;
+            }
+            page.transactions.push_back( state->second );
+         }
+      }
+
+      // those not found by a scan follow in the order of their ids, start.trx_idx of them are skipped
+      std::vector<transaction_id_type> pending;
+      for( auto itr = my->_data.transactions.begin(); itr != my->_data.transactions.end(); ++itr )
+      {
+         if( my->_transaction_positions.find( itr->first ) == my->_transaction_positions.end() )
+            pending.push_back( itr->first );
+      }
+      std::sort( pending.begin(), pending.end() );
+
+      uint32_t skip = start.block_num == trx_num::invalid_block_num ? start.trx_idx : 0;
+      for( uint32_t i = skip; i < pending.size(); ++i )
+      {
+         const transaction_state& state = my->_data.transactions.find( pending[i] )->second;
+         if( !matches( state ) ) continue;
+         if( page.transactions.size() == limit )
+         {
+            page.next = transaction_history_cursor( trx_num::invalid_block_num, i );
+            return page;
+         }
+         page.transactions.push_back( state );
+      }
+      return page;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("start",start)("limit",limit) ) }
+
    //if output index is an output we control (is an unspent or spent output), decrease our wallet balance based on this output's amount
    //Notes: The output here is an output we control that is the source of an input, that's why we decrease our balance.
    //       We are required to spend the entire amount, hence we can decrease the balance by the amount of the output.
@@ -735,6 +1569,8 @@ namespace bts { namespace wallet {
               continue;
            }
            auto& output_index = output_index_itr->second;
+           if( my->_spent_log && my->_data.unspent_outputs.count( output_index ) )
+              my->_spent_log->push_back( output_index );
            scan_input( state, output_ref, output_index);
            mark_as_spent( output_ref );
        }
@@ -755,46 +1591,299 @@ namespace bts { namespace wallet {
     *  Scan the blockchain starting from_block_num until the head block, check every
     *  transaction for inputs or outputs accessable by this wallet.
     *
+    *  Blocks are read from a snapshot of the chain in ranges of scan_range_size, each range
+    *  is decoded on a worker thread, one per core, which also matches its outputs against
+    *  the keys of the wallet.  The ranges are merged in (block, trx) order on the calling
+    *  thread where scan_transaction is run for every transaction with an output that may
+    *  match or an input that spends one of ours, so unspent_outputs is built in the same
+    *  order as a sequential scan.
+    *
     *  @return true if a new input was found or output spent
     */
    bool wallet::scan_chain( chain_database& chain, uint32_t from_block_num, scan_progress_callback cb )
    { try {
+       BTS_TRACE_SPAN( "wallet::scan_chain" );
        my->_blockchain = &chain;
        bool found = false;
-       auto head_block_num = chain.head_block_num();
+       auto snapshot       = chain.get_snapshot();
+       auto head_block_num = snapshot->head_block_num();
        if( head_block_num == uint32_t(-1) ) return false;
 
-       // for each block
-       for( uint32_t i = from_block_num; i <= head_block_num; ++i )
+       auto keys = std::make_shared<const detail::scan_keys>( my->get_scan_keys() );
+
+       auto merge = [&]( std::vector<detail::scanned_transaction>& range )
+       {
+          found |= merge_scanned( range, head_block_num, cb );
+       };
+
+       if( from_block_num <= head_block_num && head_block_num - from_block_num < detail::scan_range_size )
+       {
+          // the latest blocks, as scanned after each block is pushed, are not worth a worker
+          auto range = detail::scan_blocks( *snapshot, *keys, from_block_num, head_block_num );
+          merge( range );
+       }
+       else if( from_block_num <= head_block_num )
+       {
+          auto& pool = my->workers();
+          uint32_t num_threads = pool.size();
+
+          std::deque< fc::future< std::vector<detail::scanned_transaction> > > ranges;
+          uint32_t next_block = from_block_num;
+          auto prefetch = [&]()
+          {
+             if( next_block > head_block_num ) return;
+             uint32_t first = next_block;
+             uint32_t last  = uint32_t( std::min<uint64_t>( uint64_t(first) + detail::scan_range_size - 1, head_block_num ) );
+             next_block     = last + 1;
+             auto& worker   = *pool[ ((first - from_block_num) / detail::scan_range_size) % num_threads ];
+             ranges.push_back( worker.async( [snapshot,keys,first,last]()
+             {
+                return detail::scan_blocks( *snapshot, *keys, first, last );
+             } ) );
+          };
+
+          // every worker stays a range ahead of the merge
+          for( uint32_t i = 0; i < num_threads * 2; ++i ) prefetch();
+          while( !ranges.empty() )
+          {
+             auto range = ranges.front().wait();
+             ranges.pop_front();
+             prefetch();
+             merge( range );
+          }
+       }
+       mark_scanned( chain, head_block_num );
+       return found;
+   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+   /** runs scan_transaction, in order, for the transactions of range that may concern the wallet */
+   bool wallet::merge_scanned( std::vector<detail::scanned_transaction>& range, uint32_t head_block_num,
+                               const scan_progress_callback& cb )
+   {
+       bool found = false;
+       for( detail::scanned_transaction& scanned : range )
        {
-          auto blk = chain.fetch_digest_block( i );
-          // for each transaction
-          for( uint32_t trx_idx = 0; trx_idx < blk.trx_ids.size(); ++trx_idx )
+          if( cb && scanned.block_trx_count )
+             cb( scanned.block_num, head_block_num, scanned.trx_idx, scanned.block_trx_count );
+
+          bool spends_ours = false;
+          for( const trx_input& in : scanned.trx.inputs )
           {
-              if( cb ) cb( i, head_block_num, trx_idx, blk.trx_ids.size() );
-
-              transaction_state state;
-              state.trx = chain.fetch_trx(trx_num(i, trx_idx));
-              bool found_output = scan_transaction( state, i, trx_idx );
-              if( found_output )
-                 my->_data.transactions[state.trx.id()] = state;
-              found |= found_output;
+             if( my->_output_ref_to_index.find( in.output_ref ) != my->_output_ref_to_index.end() )
+             {
+                spends_ours = true;
+                break;
+             }
           }
-          for( uint32_t trx_idx = 0; trx_idx < blk.deterministic_ids.size(); ++trx_idx )
+          if( !scanned.may_match && !spends_ours ) continue;
+
+          transaction_state state;
+          state.trx = std::move( scanned.trx );
+          bool found_output = scan_transaction( state, scanned.block_num, scanned.trx_idx );
+          if( found_output )
           {
-              transaction_state state;
-              state.trx = chain.fetch_trx( trx_num( i, blk.trx_ids.size() + trx_idx ) );
-              bool found_output = scan_transaction( state, i, trx_idx );
-              if( found_output )
-                 my->_data.transactions[state.trx.id()] = state;
-              found |= found_output;
+             auto trx_id     = state.trx.id();
+             state.block_num = scanned.block_num;
+             my->_data.transactions[trx_id] = state;
+             my->journal_store( transaction_field, trx_id, state );
+             my->set_transaction_position( trx_id, trx_num( scanned.block_num, scanned.position ) );
           }
+          found |= found_output;
        }
+       return found;
+   }
+
+   /** merge_scanned of the transactions of one block, remembering what it spent for revert_block */
+   bool wallet::merge_block( std::vector<detail::scanned_transaction>& range, uint32_t block_num )
+   {
+       std::vector<output_index> spent;
+       my->_spent_log = &spent;
+       bool found = false;
+       try {
+          found = merge_scanned( range, block_num, scan_progress_callback() );
+       }
+       catch ( ... )
+       {
+          my->_spent_log = nullptr;
+          throw;
+       }
+       my->_spent_log = nullptr;
+
+       my->_undo_log.push_back( std::make_pair( block_num, std::move(spent) ) );
+       while( my->_undo_log.size() > detail::undo_depth ) my->_undo_log.pop_front();
+       return found;
+   }
+
+   bool wallet::scan_block_transactions( uint32_t block_num,
+                                         const std::vector< std::pair<uint32_t,signed_transaction> >& trxs )
+   { try {
+       std::vector<detail::scanned_transaction> range;
+       range.reserve( trxs.size() );
+       for( const auto& trx : trxs )
+       {
+          detail::scanned_transaction scanned;
+          scanned.block_num       = block_num;
+          scanned.trx_idx         = trx.first;
+          scanned.position        = trx.first;
+          scanned.block_trx_count = 0;
+          scanned.may_match       = true;
+          scanned.trx             = trx.second;
+          range.push_back( std::move(scanned) );
+       }
+       return merge_block( range, block_num );
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   void wallet::mark_scanned( chain_database& chain, uint32_t block_num )
+   {
        set_fee_rate( chain.get_fee_rate() );
-       my->_stake                       = chain.get_stake();
-       my->_data.last_scanned_block_num = head_block_num;
+       my->_stake = chain.get_stake();
+       if( my->_data.last_scanned_block_num == block_num ) return;
+       my->_data.last_scanned_block_num = block_num;
+       my->journal_value( last_scanned_block_field, block_num );
+   }
+
+   /**
+    *  The wallet must have been scanned through blk.block_num - 1.  Only the transactions that
+    *  may pay to a receive address or delegate key, or that spend a known output, are copied
+    *  and scanned.
+    */
+   bool wallet::apply_block( const trx_block& blk, const signed_transactions& deterministic_trxs )
+   { try {
+       BTS_TRACE_SPAN( "wallet::apply_block" );
+       FC_ASSERT( blk.block_num == my->_data.last_scanned_block_num + 1,
+                  "the blocks before must be scanned first", ("last_scanned",my->_data.last_scanned_block_num) );
+
+       auto may_concern = [&]( const signed_transaction& trx ) -> bool
+       {
+          for( const trx_output& out : trx.outputs )
+          {
+             switch( out.claim_func )
+             {
+                case claim_by_signature:
+                   if( my->_address_filter.may_contain( out.as<claim_by_signature_output>().owner ) ) return true;
+                   break;
+                case claim_by_pts:
+                   if( my->_address_filter.may_contain( out.as<claim_by_pts_output>().owner ) ) return true;
+                   break;
+                case claim_name:
+                   if( my->_data.delegate_keys.count( out.as<claim_name_output>().delegate_id ) ) return true;
+                   break;
+                default:
+                   return true;
+             }
+          }
+          for( const trx_input& in : trx.inputs )
+             if( my->_output_ref_to_index.find( in.output_ref ) != my->_output_ref_to_index.end() ) return true;
+          return false;
+       };
+
+       std::vector<detail::scanned_transaction> range;
+       uint32_t count = blk.trxs.size() + deterministic_trxs.size();
+       for( uint32_t t = 0; t < count; ++t )
+       {
+          bool deterministic = t >= blk.trxs.size();
+          const signed_transaction& trx = deterministic ? deterministic_trxs[t - blk.trxs.size()] : blk.trxs[t];
+          if( !may_concern( trx ) ) continue;
+
+          detail::scanned_transaction scanned;
+          scanned.block_num       = blk.block_num;
+          scanned.trx_idx         = t;
+          scanned.position        = t;
+          scanned.block_trx_count = 0;
+          scanned.may_match       = true;
+          scanned.trx             = trx;
+          range.push_back( std::move(scanned) );
+       }
+
+       bool found = merge_block( range, blk.block_num );
+       set_fee_rate( blk.next_fee );
+       my->_stake = blk.id()._hash[0];
+       my->_data.last_scanned_block_num = blk.block_num;
+       my->journal_value( last_scanned_block_field, blk.block_num );
        return found;
-   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",blk.block_num) ) }
+
+   /**
+    *  Removes the outputs block_num created, makes the outputs it spent unspent again and
+    *  takes its transactions out of the history.  Transactions of the wallet's own stay
+    *  as unconfirmed.
+    */
+   bool wallet::revert_block( uint32_t block_num )
+   { try {
+       if( my->_undo_log.empty() || my->_undo_log.back().first != block_num ||
+           my->_data.last_scanned_block_num != block_num )
+          return false;
+
+       const output_index first( block_num, 0, 0 );
+       const output_index last( block_num + 1, 0, 0 );
+       auto drop_outputs = [&]( std::map<output_index,trx_output>& outputs, detail::wallet_field field, bool unspent )
+       {
+          auto itr = outputs.lower_bound( first );
+          while( itr != outputs.end() && itr->first < last )
+          {
+             if( unspent ) my->unindex_output( itr->first, itr->second );
+             auto ref = my->_data.output_index_to_ref.find( itr->first );
+             if( ref != my->_data.output_index_to_ref.end() )
+             {
+                my->_output_ref_to_index.erase( ref->second );
+                my->_data.output_index_to_ref.erase( ref );
+                my->journal_erase( output_ref_field, itr->first );
+             }
+             my->_data.votes.erase( itr->first );
+             my->journal_erase( vote_field, itr->first );
+             my->journal_erase( field, itr->first );
+             itr = outputs.erase( itr );
+          }
+       };
+       drop_outputs( my->_data.unspent_outputs, unspent_output_field, true );
+       drop_outputs( my->_data.spent_outputs, spent_output_field, false );
+
+       for( const output_index& idx : my->_undo_log.back().second )
+       {
+          auto itr = my->_data.spent_outputs.find( idx );
+          if( itr == my->_data.spent_outputs.end() ) continue;
+          my->_data.unspent_outputs[idx] = itr->second;
+          my->index_output( idx, itr->second );
+          my->journal_store( unspent_output_field, idx, itr->second );
+          my->_data.spent_outputs.erase( itr );
+          my->journal_erase( spent_output_field, idx );
+       }
+
+       auto itr = my->_data.transaction_order.lower_bound( trx_num( block_num, 0 ) );
+       while( itr != my->_data.transaction_order.end() && itr->first.block_num == block_num )
+       {
+          auto trx_id = itr->second;
+          my->_transaction_positions.erase( trx_id );
+          my->journal_erase( transaction_order_field, itr->first );
+          itr = my->_data.transaction_order.erase( itr );
+
+          auto state = my->_data.transactions.find( trx_id );
+          if( state == my->_data.transactions.end() ) continue;
+          bool ours = false;
+          for( const trx_input& in : state->second.trx.inputs )
+             ours |= my->_output_ref_to_index.find( in.output_ref ) != my->_output_ref_to_index.end();
+          if( ours )
+          {
+             state->second.block_num = -1;
+             my->journal_store( transaction_field, trx_id, state->second );
+          }
+          else
+          {
+             my->_data.transactions.erase( state );
+             my->journal_erase( transaction_field, trx_id );
+          }
+       }
+
+       my->_undo_log.pop_back();
+       my->_data.last_scanned_block_num = block_num - 1;
+       my->journal_value( last_scanned_block_field, block_num - 1 );
+       return true;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   uint64_t wallet::last_scanned()const
+   {
+       return my->_data.last_scanned_block_num;
+   }
 
    /* @brief Dumps info strings for this wallet's last N transactions
     */
@@ -815,7 +1904,7 @@ namespace bts { namespace wallet {
    {
        std::cerr<<"===========================================================\n";
        std::cerr<<"Unspent Outputs: \n";
-       for( auto out : my->_data.unspent_outputs )
+       for( const auto& out : my->_data.unspent_outputs )
        {
           std::cerr<<std::setw(13)<<std::string(out.first)<<"]  ";
           dump_output(out.second);
@@ -901,14 +1990,16 @@ namespace bts { namespace wallet {
 
    bool wallet::is_my_address( const address& address_to_check )const
    {
+     if( !my->_address_filter.may_contain( address_to_check ) ) return false;
      return my->_data.receive_addresses.find(address_to_check) != my->_data.receive_addresses.end();
    }
 
    bool wallet::is_my_address(const pts_address& address_to_check)const
    {
+     if( !my->_address_filter.may_contain( address_to_check ) ) return false;
      if (my->_data.receive_pts_addresses.find(address_to_check) == my->_data.receive_pts_addresses.end())
          return false;
-     ilog("found my address ${a}", ("a", address_to_check));
+     dlog("found my address ${a}", ("a", address_to_check));
       return true;
    }
 
@@ -918,7 +2009,7 @@ namespace bts { namespace wallet {
       {
          case claim_by_pts: //for genesis block
          {
-           auto claim = out.as<claim_by_pts_output>();           
+           auto claim = out.as<claim_by_pts_output>();
            if (is_my_address(claim.owner))
             {
                 cache_output( state.trx.vote, out, out_ref, oidx );
@@ -969,8 +2060,14 @@ namespace bts { namespace wallet {
    {
        my->_data.output_index_to_ref[oidx]  = out_ref;
        my->_output_ref_to_index[out_ref]    = oidx;
+       auto existing = my->_data.unspent_outputs.find( oidx );
+       if( existing != my->_data.unspent_outputs.end() ) my->unindex_output( oidx, existing->second );
        my->_data.unspent_outputs[oidx]      = out;
+       my->index_output( oidx, out );
        my->_data.votes[oidx]                = vote;
+       my->journal_store( output_ref_field, oidx, out_ref );
+       my->journal_store( unspent_output_field, oidx, out );
+       my->journal_store( vote_field, oidx, vote );
    }
    const std::map<output_index,trx_output>&  wallet::get_unspent_outputs()const
    {
@@ -994,13 +2091,44 @@ namespace bts { namespace wallet {
          std::vector<trx_stat>  stats;
          stats.reserve(in_trxs.size());
 
+         // recovering the signers is most of the cost of evaluating a transaction and doesn't
+         // touch the chain, so it runs on every core.  Both evaluation passes then hit the cache
+         signature_cache::instance().recover( in_trxs );
+
+         // each transaction is evaluated in isolation, against a new block state, to maximize fees.
+         // A validator that supports it reads the chain under lock_reads() and keeps what it adds
+         // in that state, so the transactions are evaluated on the worker threads
+         auto validator = chain_db.get_transaction_validator();
+         std::vector<transaction_summary>         evals( in_trxs.size() );
+         std::vector<fc::optional<fc::exception>> errors( in_trxs.size() );
+         auto evaluate_range = [&]( size_t begin, size_t end )
+         {
+            for( size_t i = begin; i < end; ++i )
+            {
+               try {
+                  evals[i] = validator->evaluate( in_trxs[i], validator->create_block_state() );
+               }
+               catch ( const fc::exception& e )
+               {
+                  errors[i] = e;
+               }
+            }
+         };
+         if( validator->supports_parallel_evaluation() )
+            parallel_for( in_trxs.size(), detail::generate_evaluation_per_thread, evaluate_range );
+         else
+            evaluate_range( 0, in_trxs.size() );
+
          for( uint32_t i = 0; i < in_trxs.size(); ++i )
          {
             try {
-                // create a new block state to evaluate transactions in isolation to maximize fees
-                auto block_state = chain_db.get_transaction_validator()->create_block_state();
+                if( errors[i] )
+                {
+                   wlog( "unable to use trx ${t}\n ${e}", ("t", in_trxs[i] )("e",errors[i]->to_detail_string()) );
+                   continue;
+                }
                 trx_stat s;
-                s.eval = chain_db.get_transaction_validator()->evaluate( in_trxs[i], block_state ); //evaluate_signed_transaction( in_trxs[i] );
+                s.eval = evals[i];
                 ilog( "eval: ${eval}  size: ${size} get_fee_rate ${r}", ("eval",s.eval)("size",in_trxs[i].size())("r",get_fee_rate()) );
 
                // TODO: enforce fees
@@ -1039,7 +2167,7 @@ namespace bts { namespace wallet {
             }
             try {
                summary += chain_db.get_transaction_validator()->evaluate( trx, block_state );
-               result.trxs.push_back(trx);
+               result.add_transaction(trx);
             }
             catch ( const fc::exception& e )
             {
@@ -1066,73 +2194,58 @@ namespace bts { namespace wallet {
       {
          my->_data.trusted_delegates.insert(delegate_id);
          my->_data.distrusted_delegates.erase(delegate_id);
+         my->journal_store( trusted_delegate_field, delegate_id, true );
+         my->journal_erase( distrusted_delegate_field, delegate_id );
       }
       else
       {
          my->_data.distrusted_delegates.insert(delegate_id);
          my->_data.trusted_delegates.erase(delegate_id);
+         my->journal_store( distrusted_delegate_field, delegate_id, true );
+         my->journal_erase( trusted_delegate_field, delegate_id );
       }
    }
 
    void wallet::import_delegate( uint32_t delegate_id, const fc::ecc::private_key& delegate_key )
    {
      my->_data.delegate_keys[delegate_id] = delegate_key;
+     my->journal_store( delegate_key_field, delegate_id, delegate_key );
    }
 
 signed_transaction wallet::collect_inputs_and_sign(signed_transaction& trx, const asset& requested_amount,
                                                    std::unordered_set<address>& required_signatures, const address& change_addr)
 {
-    /* Save original transaction inputs and outputs */
-    auto original_inputs   = trx.inputs;
-    auto original_outputs  = trx.outputs;
-    auto original_required_signatures = required_signatures;
-
-    auto required_input_amount = requested_amount;
-    asset total_input;
-    asset change_amount;
-    do
-    { /* Start with original transaction */
-        trx.inputs = original_inputs;
-        trx.outputs = original_outputs;
-        required_signatures = original_required_signatures;
-
-        /* Collect necessary inputs */
-        total_input = asset(required_input_amount.unit);
-        auto new_inputs = collect_inputs(required_input_amount, total_input, required_signatures); /* Throws if insufficient funds */
+    /* Fees are paid in base units, any other unit is collected first and the fee along with the base unit change */
+    if (requested_amount.unit != asset().unit)
+    {
+        asset total_input(0, requested_amount.unit);
+        auto new_inputs = collect_inputs(requested_amount, total_input, required_signatures); /* Throws if insufficient funds */
         trx.inputs.insert(trx.inputs.end(), new_inputs.begin(), new_inputs.end());
+        asset change_amount = total_input - requested_amount;
+        if (change_amount.amount > 0)
+            trx.outputs.push_back(trx_output(claim_by_signature_output(change_addr), change_amount));
+        return collect_inputs_and_sign(trx, asset(), required_signatures, change_addr);
+    }
 
-        /* Return change: we always initially assume there will be change, and delete the output if not needed further down in this function */
-        change_amount = total_input - required_input_amount; //note: this will assert if we didn't collect enough inputs (i.e. a bug in collect_inputs)
-        trx.outputs.push_back(trx_output(claim_by_signature_output(change_addr), change_amount));
-
-        /* Ensure fee is paid in base units */
-        if (change_amount.unit != asset().unit)
-            return collect_inputs_and_sign(trx, asset(), required_signatures, change_addr);
-
-        /* Calculate fee required for signed transaction */
-        trx.sigs.clear();
-        sign_transaction(trx, required_signatures, false);
-        auto fee = (get_fee_rate() * trx.size())/1000;
-        ilog("required fee ${f} for bytes ${b} at rate ${r} milli-shares per byte", ("f", fee) ("b", trx.size()) ("r", get_fee_rate()));
-
-        /* Calculate new minimum input amount */
-        required_input_amount += fee;
-        if (total_input < required_input_amount)
-        {
-            wlog("not enough to cover amount + fee... grabbing more..");
-        }
-    } while (total_input < required_input_amount); /* Try again with the new minimum input amount if the fee ended up too high */
+    /* The change output is sized in before the inputs are picked, its amount doesn't change the size */
+    trx.sigs.clear();
+    trx.outputs.push_back(trx_output(claim_by_signature_output(change_addr), asset()));
+    asset total_input;
+    size_t signed_size = 0;
+    uint64_t fee = my->collect_inputs_with_fee(trx, requested_amount, get_transfer_fee_rate(), total_input, required_signatures, signed_size);
 
-    /* Recalculate leftover change amount */
-    change_amount = total_input - required_input_amount;
-    if (change_amount > asset()) //if the new change amount is non-zero, update the change amount of the change output
+    asset change_amount = total_input - requested_amount - asset(fee);
+    if (change_amount > asset()) //there is change, it goes to the output sized in above
       trx.outputs.back() = trx_output(claim_by_signature_output(change_addr), change_amount);
-    else //there's no change now (this is an exact transaction), so discard the change output
+    else //there's no change (this is an exact transaction), so discard the change output
       trx.outputs.pop_back();
 
     //TODO: randomize output order here
-    trx.sigs.clear();
-    sign_transaction(trx, required_signatures, true);
+    sign_transaction(trx, required_signatures, false);
+    // the fee only covers the modelled size, nothing is spent if the model was wrong
+    FC_ASSERT(trx.size() <= signed_size, "the signed transaction is larger than its fee was computed for",
+              ("size", trx.size())("modelled_size", signed_size));
+    my->record_spend(trx);
 
     return trx;
 }
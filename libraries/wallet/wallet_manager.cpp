@@ -0,0 +1,335 @@
+#include <bts/wallet/wallet_manager.hpp>
+#include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/flat_hash.hpp>
+#include <bts/db/trace.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+namespace bts { namespace wallet {
+
+   namespace detail
+   {
+      struct managed_wallet
+      {
+         managed_wallet():scanned_through(0){}
+
+         std::string      username;
+         wallet_ptr       wall;
+         fc::time_point   last_used;
+         /** the last block the wallet was scanned for, it is only told so when handed out or closed */
+         uint32_t         scanned_through;
+      };
+
+      class wallet_manager_impl
+      {
+         public:
+            wallet_manager_impl()
+            :_chain(nullptr),_idle_timeout( fc::seconds( 10 * 60 ) ){}
+
+            fc::path                                                      _data_dir;
+            bts::blockchain::chain_database*                              _chain;
+            fc::microseconds                                              _idle_timeout;
+            std::map<std::string, std::unique_ptr<managed_wallet> >       _wallets;
+
+            /**
+             *  The combined index, which open wallets own an address or an unspent output.  A key
+             *  imported into several wallets makes all of them owners, so every key may map to
+             *  more than one wallet, but to each wallet at most once.
+             */
+            std::unordered_multimap<address, managed_wallet*, id_hash<address> >               _by_address;
+            std::unordered_multimap<pts_address, managed_wallet*>                              _by_pts_address;
+            std::unordered_multimap<output_reference, managed_wallet*, id_hash<output_reference> > _by_output;
+
+            /** the wallet may have been changed by whoever holds it since it was indexed */
+            bool is_held( const managed_wallet& entry )const
+            {
+               return entry.wall.use_count() > 1;
+            }
+
+            template<typename Index, typename Key>
+            static void add( Index& idx, const Key& key, managed_wallet* entry )
+            {
+               auto range = idx.equal_range( key );
+               for( auto itr = range.first; itr != range.second; ++itr )
+                  if( itr->second == entry ) return;
+               idx.emplace( key, entry );
+            }
+
+            /** by value of the entries, the wallet may no longer list all the keys it was indexed by */
+            template<typename Index>
+            static void remove( Index& idx, managed_wallet* entry )
+            {
+               for( auto itr = idx.begin(); itr != idx.end(); )
+               {
+                  if( itr->second == entry ) itr = idx.erase( itr );
+                  else ++itr;
+               }
+            }
+
+            void index( managed_wallet& entry )
+            {
+               for( const auto& item : entry.wall->get_receive_addresses() )
+                  add( _by_address, item.first, &entry );
+               for( const pts_address& addr : entry.wall->get_receive_pts_addresses() )
+                  add( _by_pts_address, addr, &entry );
+               for( const auto& item : entry.wall->get_unspent_outputs() )
+                  add( _by_output, entry.wall->get_ref_from_output_idx( item.first ), &entry );
+            }
+
+            void unindex( managed_wallet& entry )
+            {
+               remove( _by_address, &entry );
+               remove( _by_pts_address, &entry );
+               remove( _by_output, &entry );
+            }
+
+            /** appends the wallets that may claim out, claim_name outputs are left to the caller */
+            void owners_of( const trx_output& out, std::vector<managed_wallet*>& owners )const
+            {
+               switch( out.claim_func )
+               {
+                  case claim_by_signature:
+                  {
+                     auto range = _by_address.equal_range( out.as<claim_by_signature_output>().owner );
+                     for( auto itr = range.first; itr != range.second; ++itr ) owners.push_back( itr->second );
+                     break;
+                  }
+                  case claim_by_pts:
+                  {
+                     auto range = _by_pts_address.equal_range( out.as<claim_by_pts_output>().owner );
+                     for( auto itr = range.first; itr != range.second; ++itr ) owners.push_back( itr->second );
+                     break;
+                  }
+                  default:
+                     break;
+               }
+            }
+
+            wallet_ptr hand_out( managed_wallet& entry )
+            {
+               entry.last_used = fc::time_point::now();
+               if( _chain ) entry.wall->mark_scanned( *_chain, entry.scanned_through );
+               return entry.wall;
+            }
+
+            void close( managed_wallet& entry )
+            {
+               unindex( entry );
+               if( _chain ) entry.wall->mark_scanned( *_chain, entry.scanned_through );
+               entry.wall->close();
+            }
+      };
+
+   } // namespace detail
+
+   wallet_manager::wallet_manager()
+   :my( new detail::wallet_manager_impl() )
+   {
+   }
+
+   wallet_manager::~wallet_manager()
+   {
+      try {
+         close_all();
+      }
+      catch ( const fc::exception& e )
+      {
+         wlog( "${e}", ("e",e.to_detail_string()) );
+      }
+   }
+
+   void wallet_manager::set_data_directory( const fc::path& dir )
+   {
+      my->_data_dir = dir;
+   }
+
+   void wallet_manager::set_chain( bts::blockchain::chain_database* chain )
+   {
+      my->_chain = chain;
+   }
+
+   void wallet_manager::set_idle_timeout( const fc::microseconds& timeout )
+   {
+      my->_idle_timeout = timeout;
+   }
+
+   /**
+    *  The password is only checked when the wallet is loaded, callers that hand the wallets
+    *  of different users to different clients must authenticate them first.
+    */
+   wallet_ptr wallet_manager::open_wallet( const std::string& username, const std::string& password )
+   { try {
+      FC_ASSERT( my->_chain != nullptr );
+      auto itr = my->_wallets.find( username );
+      if( itr != my->_wallets.end() ) return my->hand_out( *itr->second );
+
+      std::unique_ptr<detail::managed_wallet> entry( new detail::managed_wallet() );
+      entry->username = username;
+      entry->wall     = std::make_shared<wallet>();
+      entry->wall->set_data_directory( my->_data_dir );
+      entry->wall->open( entry->wall->get_wallet_filename_for_user( username ), password );
+      entry->wall->scan_chain( *my->_chain, entry->wall->last_scanned() );
+      entry->scanned_through = my->_chain->head_block_num();
+
+      my->index( *entry );
+      auto& result = *entry;
+      my->_wallets[username] = std::move(entry);
+      return my->hand_out( result );
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to open wallet of ${user}", ("user",username) ) }
+
+   /** the keys of a new wallet are new as well, so it has no blocks to catch up on */
+   wallet_ptr wallet_manager::create_wallet( const std::string& username, const std::string& password,
+                                             const std::string& key_password )
+   { try {
+      FC_ASSERT( my->_chain != nullptr );
+      FC_ASSERT( my->_wallets.find( username ) == my->_wallets.end() );
+
+      std::unique_ptr<detail::managed_wallet> entry( new detail::managed_wallet() );
+      entry->username = username;
+      entry->wall     = std::make_shared<wallet>();
+      entry->wall->set_data_directory( my->_data_dir );
+      entry->wall->create( entry->wall->get_wallet_filename_for_user( username ), password, key_password );
+      entry->scanned_through = my->_chain->head_block_num();
+
+      my->index( *entry );
+      auto& result = *entry;
+      my->_wallets[username] = std::move(entry);
+      return my->hand_out( result );
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to create wallet of ${user}", ("user",username) ) }
+
+   wallet_ptr wallet_manager::get_wallet( const std::string& username )
+   {
+      auto itr = my->_wallets.find( username );
+      if( itr == my->_wallets.end() ) return wallet_ptr();
+      return my->hand_out( *itr->second );
+   }
+
+   void wallet_manager::close_wallet( const std::string& username )
+   { try {
+      auto itr = my->_wallets.find( username );
+      if( itr == my->_wallets.end() ) return;
+      my->close( *itr->second );
+      my->_wallets.erase( itr );
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("user",username) ) }
+
+   void wallet_manager::close_all()
+   {
+      for( auto& item : my->_wallets ) my->close( *item.second );
+      my->_wallets.clear();
+   }
+
+   /**
+    *  Every transaction is fetched once and looked up in the combined index, each wallet only
+    *  scans the transactions that pay to one of its addresses or spend one of its outputs.
+    *  Outputs of delegate registrations are given to every wallet, which knows whether it holds
+    *  the delegate key.
+    */
+   void wallet_manager::scan_block( uint32_t block_num )
+   { try {
+      BTS_TRACE_SPAN( "wallet_manager::scan_block" );
+      FC_ASSERT( my->_chain != nullptr );
+
+      for( auto& item : my->_wallets )
+         if( my->is_held( *item.second ) ) my->index( *item.second );
+
+      auto snapshot = my->_chain->get_snapshot();
+      auto blk      = snapshot->fetch_digest_block( block_num );
+      uint32_t count = blk.trx_ids.size() + blk.deterministic_ids.size();
+
+      std::unordered_map< detail::managed_wallet*, std::vector< std::pair<uint32_t,signed_transaction> > > routed;
+      std::vector<detail::managed_wallet*> targets;
+      std::vector<detail::managed_wallet*> owners;
+      for( uint32_t t = 0; t < count; ++t )
+      {
+         signed_transaction trx = snapshot->fetch_trx( trx_num( block_num, t ) );
+         targets.clear();
+         for( const trx_input& in : trx.inputs )
+         {
+            auto range = my->_by_output.equal_range( in.output_ref );
+            if( range.first == range.second ) continue;
+            for( auto itr = range.first; itr != range.second; ++itr ) targets.push_back( itr->second );
+            my->_by_output.erase( range.first, range.second );
+         }
+
+         fc::optional<transaction_id_type> trx_id;
+         for( uint32_t o = 0; o < trx.outputs.size(); ++o )
+         {
+            const trx_output& out = trx.outputs[o];
+            if( out.claim_func == claim_name )
+            {
+               for( auto& item : my->_wallets ) targets.push_back( item.second.get() );
+               continue;
+            }
+            owners.clear();
+            my->owners_of( out, owners );
+            if( owners.empty() ) continue;
+            if( !trx_id ) trx_id = trx.id();
+            for( auto owner : owners )
+            {
+               detail::wallet_manager_impl::add( my->_by_output, output_reference( *trx_id, o ), owner );
+               targets.push_back( owner );
+            }
+         }
+
+         std::sort( targets.begin(), targets.end() );
+         targets.erase( std::unique( targets.begin(), targets.end() ), targets.end() );
+         for( auto target : targets )
+            if( target->scanned_through < block_num )
+               routed[target].push_back( std::make_pair( t, trx ) );
+      }
+
+      // every wallet is told, even of nothing, so that it can revert the block
+      static const std::vector< std::pair<uint32_t,signed_transaction> > none;
+      for( auto& item : my->_wallets )
+      {
+         auto& entry = *item.second;
+         if( entry.scanned_through >= block_num ) continue;
+         auto r = routed.find( &entry );
+         entry.wall->scan_block_transactions( block_num, r != routed.end() ? r->second : none );
+         entry.scanned_through = block_num;
+      }
+
+      unload_idle_wallets();
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   void wallet_manager::revert_block( uint32_t block_num )
+   { try {
+      FC_ASSERT( my->_chain != nullptr );
+      for( auto& item : my->_wallets )
+      {
+         auto& entry = *item.second;
+         if( entry.scanned_through != block_num ) continue;
+         entry.wall->mark_scanned( *my->_chain, block_num );
+         if( !entry.wall->revert_block( block_num ) )
+            wlog( "unable to revert block ${b} for the wallet of ${user}", ("b",block_num)("user",entry.username) );
+         entry.scanned_through = block_num - 1;
+         my->index( entry );
+      }
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   void wallet_manager::unload_idle_wallets()
+   {
+      auto now = fc::time_point::now();
+      for( auto itr = my->_wallets.begin(); itr != my->_wallets.end(); )
+      {
+         auto& entry = *itr->second;
+         if( my->is_held( entry ) || now - entry.last_used < my->_idle_timeout ) { ++itr; continue; }
+         dlog( "unloading idle wallet of ${user}", ("user",entry.username) );
+         my->close( entry );
+         itr = my->_wallets.erase( itr );
+      }
+   }
+
+   std::vector<std::string> wallet_manager::open_wallets()const
+   {
+      std::vector<std::string> names;
+      names.reserve( my->_wallets.size() );
+      for( const auto& item : my->_wallets ) names.push_back( item.first );
+      return names;
+   }
+
+} } // bts::wallet
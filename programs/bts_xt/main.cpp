@@ -4,8 +4,11 @@
 #include <bts/client/client.hpp>
 #include <bts/blockchain/chain_database.hpp>
 #include <bts/wallet/wallet.hpp>
+#include <bts/wallet/wallet_manager.hpp>
 #include <bts/rpc/rpc_server.hpp>
 #include <bts/cli/cli.hpp>
+#include <bts/db/executor.hpp>
+#include <bts/db/trace.hpp>
 #include <fc/filesystem.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/log/file_appender.hpp>
@@ -17,19 +20,24 @@
 
 struct config
 {
-   config():ignore_console(false){}
-   bts::rpc::rpc_server::config rpc;
-   bool                         ignore_console;
+   config():ignore_console(false),single_chain_database(false),owner_index(false),memory_budget_mb(0){}
+   bts::rpc::rpc_server::config                 rpc;
+   bool                                         ignore_console;
+   bool                                         single_chain_database; ///< only applies when creating a new chain database
+   bool                                         owner_index; ///< index outputs by owner so imported keys don't need a rescan
+   bts::blockchain::chain_database_tuning       chain_tuning;
+   uint32_t                                     memory_budget_mb; ///< shared by the caches and pools, 0 for no budget
+   std::vector<bts::db::thread_pool_config>     thread_pools; ///< by name: network, validation, signature, storage, rpc, mining
 };
 
-FC_REFLECT( config, (rpc)(ignore_console) )
+FC_REFLECT( config, (rpc)(ignore_console)(single_chain_database)(owner_index)(chain_tuning)(memory_budget_mb)(thread_pools) )
 
 
 void print_banner();
-void configure_logging(const fc::path&);
+void configure_logging(const fc::path&, bool debug);
 fc::path get_data_dir(const boost::program_options::variables_map& option_variables);
 config   load_config( const fc::path& datadir );
-bts::blockchain::chain_database_ptr load_and_configure_chain_database(const fc::path& datadir, 
+bts::blockchain::chain_database_ptr load_and_configure_chain_database(const fc::path& datadir, const config& cfg,
                                                                       const boost::program_options::variables_map& option_variables);
 
 int main( int argc, char** argv )
@@ -48,7 +56,13 @@ int main( int argc, char** argv )
                               ("httpport", boost::program_options::value<uint16_t>(), "port to listen for HTTP JSON-RPC connections")
                               ("trustee-private-key", boost::program_options::value<std::string>(), "act as a trustee using the given private key")
                               ("trustee-address", boost::program_options::value<std::string>(), "trust the given BTS address to generate blocks")
-                              ("genesis-json", boost::program_options::value<std::string>(), "generate a genesis block with the given json file (only for testing, only accepted when the blockchain is empty)");
+                              ("genesis-json", boost::program_options::value<std::string>(), "generate a genesis block with the given json file (only for testing, only accepted when the blockchain is empty)")
+                             ("batch-file", boost::program_options::value<std::string>(), "run the commands of the given file, or of stdin if it is -, and write their results as JSON lines instead of starting the console")
+                             ("batch-concurrency", boost::program_options::value<uint32_t>()->default_value(8), "the number of read only batch commands run at once")
+                             ("debug-log", "also log the per transaction and per output messages")
+                             ("trace-file", boost::program_options::value<std::string>(), "on exit, write the timed spans of the hot paths in chrome://tracing format to the given file")
+                             ("multi-wallet", "keep the wallet of every user that opens one through the JSON-RPC server open, and scan each block once for all of them")
+                             ("storage-stats-interval", boost::program_options::value<uint32_t>(), "log the LevelDB statistics and cache hit rates of the chain database every given number of seconds");
 
    boost::program_options::positional_options_description positional_config;
    positional_config.add("data-dir", 1);
@@ -76,18 +90,29 @@ int main( int argc, char** argv )
    bool p2p_mode = option_variables.count("p2p") != 0;
 
    try {
-      print_banner();
+      // the results of a batch are the only output on stdout
+      if (!option_variables.count("batch-file"))
+        print_banner();
       fc::path datadir = get_data_dir(option_variables);
-      ::configure_logging(datadir);
+      ::configure_logging(datadir, option_variables.count("debug-log") != 0);
 
       auto cfg   = load_config(datadir);
-      auto chain = load_and_configure_chain_database(datadir, option_variables);
+      bts::db::executor::instance().configure(cfg.thread_pools);
+      auto chain = load_and_configure_chain_database(datadir, cfg, option_variables);
       auto wall  = std::make_shared<bts::wallet::wallet>();
       wall->set_data_directory( datadir );
 
       auto c = std::make_shared<bts::client::client>(p2p_mode);
       c->set_chain( chain );
       c->set_wallet( wall );
+      if (option_variables.count("multi-wallet"))
+      {
+        auto manager = std::make_shared<bts::wallet::wallet_manager>();
+        manager->set_data_directory( datadir );
+        c->set_wallet_manager( manager );
+      }
+      if (option_variables.count("storage-stats-interval"))
+        c->log_storage_stats(fc::seconds(option_variables["storage-stats-interval"].as<uint32_t>()));
 
       if (option_variables.count("trustee-private-key"))
       {
@@ -123,9 +148,9 @@ int main( int argc, char** argv )
         rpc_server->configure(rpc_config);
       }
       
+      c->configure( datadir, uint64_t(cfg.memory_budget_mb) * 1024 * 1024 );
       if (p2p_mode)
       {
-        c->configure( datadir );
         if (option_variables.count("port"))
           c->listen_on_port(option_variables["port"].as<uint16_t>());
         c->connect_to_p2p_network();
@@ -140,9 +165,17 @@ int main( int argc, char** argv )
            c->add_node( "127.0.0.1:4569" );
       }
 
-      auto cli = std::make_shared<bts::cli::cli>( c, rpc_server );
+      std::shared_ptr<bts::cli::cli> cli;
+      if (option_variables.count("batch-file"))
+        cli = std::make_shared<bts::cli::cli>( c, rpc_server, fc::path(option_variables["batch-file"].as<std::string>()),
+                                               option_variables["batch-concurrency"].as<uint32_t>() );
+      else
+        cli = std::make_shared<bts::cli::cli>( c, rpc_server );
       cli->wait();
 
+      if (option_variables.count("trace-file"))
+        bts::db::tracer::instance().dump(option_variables["trace-file"].as<std::string>());
+
    } 
    catch ( const fc::exception& e ) 
    {
@@ -167,7 +200,7 @@ void print_banner()
     std::cout<<"================================================================\n";
 }
 
-void configure_logging(const fc::path& data_dir)
+void configure_logging(const fc::path& data_dir, bool debug)
 {
    fc::file_appender::config ac;
    ac.filename = data_dir / "log.txt";
@@ -178,7 +211,7 @@ void configure_logging(const fc::path& data_dir)
    cfg.appenders.push_back(fc::appender_config( "default", "file", fc::variant(ac)));
 
    fc::logger_config dlc;
-   dlc.level = fc::log_level::debug;
+   dlc.level = debug ? fc::log_level::debug : fc::log_level::info;
    dlc.name = "default";
    dlc.appenders.push_back("default");
    cfg.loggers.push_back(dlc);
@@ -207,11 +240,13 @@ fc::path get_data_dir(const boost::program_options::variables_map& option_variab
 
 } FC_RETHROW_EXCEPTIONS( warn, "error loading config" ) }
 
-bts::blockchain::chain_database_ptr load_and_configure_chain_database(const fc::path& datadir, 
+bts::blockchain::chain_database_ptr load_and_configure_chain_database(const fc::path& datadir, const config& cfg,
                                                                       const boost::program_options::variables_map& option_variables)
 {
   bts::blockchain::chain_database_ptr chain = std::make_shared<bts::blockchain::chain_database>();
-  chain->open( datadir / "chain", true );
+  chain->set_single_database( cfg.single_chain_database );
+  chain->set_owner_index( cfg.owner_index );
+  chain->open( datadir / "chain", true, cfg.chain_tuning );
   if (option_variables.count("trustee-address"))
     chain->set_trustee(bts::blockchain::address(option_variables["trustee-address"].as<std::string>()));
   else
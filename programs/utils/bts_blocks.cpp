@@ -0,0 +1,82 @@
+#include <bts/blockchain/chain_database.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/time.hpp>
+
+#include <iostream>
+#include <string>
+
+/**
+ *  Copies blocks between chain databases without the network:
+ *
+ *    bts_blocks export CHAIN_DIR FILE [FIRST [LAST]]
+ *    bts_blocks import CHAIN_DIR FILE [--trusted] [--defer-indexes] [--trustee ADDRESS]
+ *
+ *  CHAIN_DIR is the chain directory of a client data directory, the client must not be running.
+ */
+int main( int argc, char** argv )
+{
+   if( argc < 4 )
+   {
+      std::cerr << "usage: " << argv[0] << " export CHAIN_DIR FILE [FIRST [LAST]]\n"
+                << "       " << argv[0] << " import CHAIN_DIR FILE [--trusted] [--defer-indexes] [--trustee ADDRESS]\n";
+      return 1;
+   }
+
+   try {
+      std::string command = argv[1];
+      fc::path    chain_dir( argv[2] );
+      fc::path    file( argv[3] );
+
+      bts::blockchain::chain_database chain;
+      if( command == "export" )
+      {
+         chain.open( chain_dir, false );
+         uint32_t first = argc > 4 ? std::stoul( argv[4] ) : 0;
+         uint32_t last  = argc > 5 ? std::stoul( argv[5] ) : chain.head_block_num();
+         chain.export_blocks( first, last, file );
+         std::cout << "exported blocks " << first << " to " << last << " to " << file.generic_string() << "\n";
+      }
+      else if( command == "import" )
+      {
+         bool trusted       = false;
+         bool defer_indexes = false;
+         // the trustee of bts_xt_client unless trustee-address was passed to it
+         std::string trustee = "43cgLS17F2uWJKKFbPoJnnoMSacj";
+         for( int i = 4; i < argc; ++i )
+         {
+            std::string arg = argv[i];
+            if( arg == "--trusted" )                      trusted = true;
+            else if( arg == "--defer-indexes" )           defer_indexes = true;
+            else if( arg == "--trustee" && i + 1 < argc ) trustee = argv[++i];
+            else
+            {
+               std::cerr << "unknown option " << arg << "\n";
+               return 1;
+            }
+         }
+
+         chain.open( chain_dir, true );
+         chain.set_trustee( bts::blockchain::address( trustee ) );
+         auto start    = fc::time_point::now();
+         chain.set_defer_indexes( defer_indexes );
+         auto imported = chain.import_blocks( file, trusted );
+         chain.set_defer_indexes( false );
+         auto seconds  = double( (fc::time_point::now() - start).count() ) / 1000000;
+         std::cout << "imported " << imported << " blocks in " << seconds << " seconds, head block "
+                   << chain.head_block_num() << "\n";
+      }
+      else
+      {
+         std::cerr << "unknown command " << command << ", expected export or import\n";
+         return 1;
+      }
+      chain.close();
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,45 @@
+#include <bts/blockchain/genesis_balances.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <iostream>
+
+/**
+ *  Converts the balances of a genesis file to the binary balance file the chain server reads
+ *  faster than JSON:
+ *
+ *    bts_genesis GENESIS_FILE BALANCE_FILE
+ *
+ *  GENESIS_FILE is the JSON of a genesis_block_config, or a binary balance file to copy.
+ */
+int main( int argc, char** argv )
+{
+   if( argc != 3 )
+   {
+      std::cerr << "usage: " << argv[0] << " GENESIS_FILE BALANCE_FILE\n";
+      return 1;
+   }
+
+   try {
+      bts::blockchain::genesis_balance_reader balances( fc::path( argv[1] ) );
+      bts::blockchain::genesis_balance_writer writer( fc::path( argv[2] ) );
+      bts::blockchain::pts_address owner;
+      uint64_t amount = 0;
+      uint64_t count  = 0;
+      uint64_t total  = 0;
+      while( balances.next( owner, amount ) )
+      {
+         writer.write( owner, amount );
+         ++count;
+         total += amount;
+      }
+      writer.close();
+      std::cout << "wrote " << count << " balances of " << total << " shares in total\n";
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,74 @@
+#include <bts/blockchain/transaction.hpp>
+#include <fc/crypto/elliptic.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/time.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+using namespace bts::blockchain;
+
+double ns_per_op( const fc::microseconds& t, uint64_t ops ) { return t.count() * 1000.0 / ops; }
+
+template<typename Op>
+double time_op( uint32_t rounds, size_t count, Op&& op )
+{
+   uint64_t sink = 0;
+   auto start = fc::time_point::now();
+   for( uint32_t r = 0; r < rounds; ++r )
+      for( size_t i = 0; i < count; ++i )
+         sink += op( i );
+   auto elapsed = fc::time_point::now() - start;
+   if( sink == 42 ) std::cout << ""; // keep the results alive
+   return ns_per_op( elapsed, uint64_t(rounds) * count );
+}
+
+/**
+ *  Reports what trx_output::as<T>() costs for the claims the validator and the wallet
+ *  read, next to copying the output, to show whether caching decoded claims could pay.
+ *
+ *  usage: claim_bench [outputs] [rounds]
+ */
+int main( int argc, char** argv )
+{
+   uint32_t count  = argc > 1 ? std::stoi( argv[1] ) : 1000;
+   uint32_t rounds = argc > 2 ? std::stoi( argv[2] ) : 100;
+
+   try {
+      std::vector<trx_output> signature_outputs;
+      std::vector<trx_output> pts_outputs;
+      std::vector<trx_output> name_outputs;
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         auto key = fc::ecc::private_key::generate().get_public_key();
+         signature_outputs.push_back( trx_output( claim_by_signature_output( address( key ) ), asset( uint64_t(i + 1) ) ) );
+         pts_outputs.push_back( trx_output( claim_by_pts_output( pts_address( key ) ), asset( uint64_t(i + 1) ) ) );
+         name_outputs.push_back( trx_output( claim_name_output( "delegate-" + std::to_string( i ), std::string( 64, 'x' ), i + 1, key ), asset() ) );
+      }
+
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "claim                  bytes  as_ns  copy_ns\n";
+      auto report = [&]( const char* name, const std::vector<trx_output>& outputs, double as_ns )
+      {
+         double copy_ns = time_op( rounds, outputs.size(), [&]( size_t i ) { trx_output copy( outputs[i] ); return copy.claim_data.size(); } );
+         std::cout << std::left << std::setw(21) << name << std::right
+                   << std::setw(7) << outputs.front().claim_data.size() << "  "
+                   << std::setw(5) << as_ns << "  " << std::setw(7) << copy_ns << "\n";
+      };
+
+      report( "claim_by_signature", signature_outputs,
+              time_op( rounds, count, [&]( size_t i ) { return uint64_t( signature_outputs[i].as<claim_by_signature_output>().owner.addr._hash[0] ); } ) );
+      report( "claim_by_pts", pts_outputs,
+              time_op( rounds, count, [&]( size_t i ) { return uint64_t( uint8_t( pts_outputs[i].as<claim_by_pts_output>().owner.addr.data[1] ) ); } ) );
+      report( "claim_name", name_outputs,
+              time_op( rounds, count, [&]( size_t i ) { return uint64_t( name_outputs[i].as<claim_name_output>().delegate_id ); } ) );
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,117 @@
+#include <bts/blockchain/momentum.hpp>
+#include <bts/blockchain/small_hash.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/time.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace bts::blockchain;
+
+/** @return the peak resident set size of the process in MB, 0 if unknown */
+double peak_memory_mb()
+{
+#ifndef WIN32
+   struct rusage usage;
+   if( getrusage( RUSAGE_SELF, &usage ) == 0 )
+   {
+#ifdef __APPLE__
+      return usage.ru_maxrss / (1024.0*1024.0);
+#else
+      return usage.ru_maxrss / 1024.0;
+#endif
+   }
+#endif
+   return 0;
+}
+
+double seconds( const fc::microseconds& t ) { return t.count() / 1000000.0; }
+
+/**
+ *  Reports momentum search, verify and small_hash throughput.
+ *
+ *  usage: momentum_bench [max_threads] [searches_per_thread_count]
+ *
+ *  Thread counts are swept in powers of two up to max_threads.  PARTITION_BITS
+ *  is a compile time constant of momentum.cpp, sweep it by rebuilding with
+ *  -DPARTITION_BITS=n, the value in use is reported with each result.
+ */
+int main( int argc, char** argv )
+{
+   uint32_t max_threads = argc > 1 ? std::stoi( argv[1] ) : std::max( 1u, std::thread::hardware_concurrency() );
+   uint32_t searches    = argc > 2 ? std::stoi( argv[2] ) : 3;
+
+   std::cout << std::fixed << std::setprecision(2);
+   std::cout << "threads  partition_bits  huge_pages  birthdays/s    collisions/s  generate_s  find_s  store_mb\n";
+
+   std::vector< std::pair<uint32_t,uint32_t> > collisions;
+   pow_seed_type                               collision_seed;
+   for( uint32_t threads = 1; threads <= max_threads; threads *= 2 )
+   {
+      momentum_search_context context( threads );
+      fc::microseconds generate_time, find_time;
+      uint64_t found = 0;
+      for( uint32_t i = 0; i < searches; ++i )
+      {
+         auto seed = fc::sha256::hash( (char*)&i, sizeof(i) );
+         auto result = context.search( seed );
+         if( collisions.empty() )
+         {
+            collisions     = result;
+            collision_seed = seed;
+         }
+         generate_time += context.last_stats().generate_time;
+         find_time     += context.last_stats().find_time;
+         found         += result.size();
+      }
+      double total = seconds( generate_time + find_time );
+      std::cout << std::setw(7)  << threads
+                << std::setw(16) << context.last_stats().partition_bits
+                << std::setw(12) << (context.uses_huge_pages() ? "yes" : "no")
+                << std::setw(13) << (double(MAX_MOMENTUM_NONCE) * searches / total)
+                << std::setw(16) << (found / total)
+                << std::setw(12) << seconds( generate_time ) / searches
+                << std::setw(8)  << seconds( find_time ) / searches
+                << std::setw(10) << context.memory_size() / (1024.0*1024.0)
+                << "\n";
+   }
+
+   // momentum_verify of real collisions, as done when validating a block
+   if( !collisions.empty() )
+   {
+      const uint32_t verifies = 100000;
+      auto start = fc::time_point::now();
+      uint32_t valid = 0;
+      for( uint32_t i = 0; i < verifies; ++i )
+      {
+         auto& c = collisions[ i % collisions.size() ];
+         valid += momentum_verify( collision_seed, c.first, c.second );
+      }
+      auto t = seconds( fc::time_point::now() - start );
+      std::cout << "momentum_verify: " << verifies / t << " /s (" << valid << " valid)\n";
+   }
+
+   {
+      const uint32_t hashes = 1000000;
+      std::vector<char> data( 256 );
+      auto start = fc::time_point::now();
+      uint160 h;
+      for( uint32_t i = 0; i < hashes; ++i )
+      {
+         data[0] = char(i);
+         h = small_hash( data.data(), data.size() );
+      }
+      auto t = seconds( fc::time_point::now() - start );
+      std::cout << "small_hash(256 bytes): " << hashes / t << " /s\n";
+   }
+
+   std::cout << "peak memory: " << peak_memory_mb() << " MB\n";
+   return 0;
+}
@@ -0,0 +1,117 @@
+#include <bts/blockchain/asset.hpp>
+#include <fc/crypto/bigint.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/time.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace bts::blockchain;
+
+/** the fc::bigint arithmetic asset.cpp used before fixed_point.hpp */
+namespace legacy
+{
+   uint64_t multiply_fix6464( uint64_t amount, const fc::uint128& fix6464 )
+   {
+      fc::bigint bi(amount);
+      bi *= fix6464;
+      bi >>= 64;
+      return fc::uint128(bi).high_bits();
+   }
+
+   uint64_t multiply_price( uint64_t amount, const fc::uint128& ratio )
+   {
+      fc::bigint amnt = fc::bigint( amount ) * fc::bigint( ratio );
+      amnt >>= 64;
+      return fc::uint128(amnt).low_bits();
+   }
+
+   uint64_t divide_price( uint64_t amount, const fc::uint128& ratio )
+   {
+      fc::bigint amt( amount );
+      amt <<= 64;
+      return fc::uint128( amt / fc::bigint( ratio ) ).low_bits();
+   }
+
+   fc::uint128 divide_assets( uint64_t l, uint64_t r )
+   {
+      fc::bigint bl = l;
+      return fc::uint128( (bl <<= 64) / fc::bigint( r ) );
+   }
+}
+
+double ns_per_op( const fc::microseconds& t, uint64_t ops ) { return t.count() * 1000.0 / ops; }
+
+template<typename Op>
+double time_op( uint32_t rounds, size_t count, Op&& op )
+{
+   uint64_t sink = 0;
+   auto start = fc::time_point::now();
+   for( uint32_t r = 0; r < rounds; ++r )
+      for( size_t i = 0; i < count; ++i )
+         sink += op( i );
+   auto elapsed = fc::time_point::now() - start;
+   if( sink == 42 ) std::cout << ""; // keep the results alive
+   return ns_per_op( elapsed, uint64_t(rounds) * count );
+}
+
+/**
+ *  Compares the fc::bigint and native 128 bit paths of asset * fix6464, asset * price
+ *  and asset / asset, checking that both give the same result for every input.
+ *
+ *  usage: price_bench [inputs] [rounds]
+ */
+int main( int argc, char** argv )
+{
+   uint32_t inputs = argc > 1 ? std::stoi( argv[1] ) : 10000;
+   uint32_t rounds = argc > 2 ? std::stoi( argv[2] ) : 20;
+
+   // amounts below 2^47 and prices between 2^-16 and 2^16 keep every result below 2^64
+   std::mt19937_64 rng( 7 );
+   std::vector<uint64_t>    amounts( inputs );
+   std::vector<fc::uint128> ratios( inputs );
+   for( uint32_t i = 0; i < inputs; ++i )
+   {
+      amounts[i] = (rng() >> 17) + 1;
+      ratios[i]  = fc::uint128( rng() >> 48, rng() | (uint64_t(1) << 48) );
+   }
+
+   uint64_t mismatches = 0;
+   for( uint32_t i = 0; i < inputs; ++i )
+   {
+      price p( ratios[i], 0, 1 );
+      if( (asset( amounts[i] ) * ratios[i]).amount != legacy::multiply_fix6464( amounts[i], ratios[i] ) ) ++mismatches;
+      if( (asset( amounts[i], 0 ) * p).amount != legacy::multiply_price( amounts[i], ratios[i] ) )        ++mismatches;
+      if( (asset( amounts[i], 1 ) * p).amount != legacy::divide_price( amounts[i], ratios[i] ) )          ++mismatches;
+      uint64_t r = amounts[(i+1) % inputs];
+      if( (asset( amounts[i], 1 ) / asset( r, 0 )).ratio != legacy::divide_assets( amounts[i], r ) )      ++mismatches;
+   }
+
+   std::cout << std::fixed << std::setprecision(1);
+   std::cout << "operation          bigint_ns  native_ns  speedup\n";
+   auto report = [&]( const char* name, double old_ns, double new_ns )
+   {
+      std::cout << std::left << std::setw(19) << name << std::right
+                << std::setw(9) << old_ns << "  " << std::setw(9) << new_ns << "  "
+                << std::setw(6) << old_ns / new_ns << "x\n";
+   };
+
+   report( "asset * fix6464",
+           time_op( rounds, inputs, [&]( size_t i ) { return legacy::multiply_fix6464( amounts[i], ratios[i] ); } ),
+           time_op( rounds, inputs, [&]( size_t i ) { return (asset( amounts[i] ) * ratios[i]).amount; } ) );
+   report( "base * price",
+           time_op( rounds, inputs, [&]( size_t i ) { return legacy::multiply_price( amounts[i], ratios[i] ); } ),
+           time_op( rounds, inputs, [&]( size_t i ) { return (asset( amounts[i], 0 ) * price( ratios[i], 0, 1 )).amount; } ) );
+   report( "quote * price",
+           time_op( rounds, inputs, [&]( size_t i ) { return legacy::divide_price( amounts[i], ratios[i] ); } ),
+           time_op( rounds, inputs, [&]( size_t i ) { return (asset( amounts[i], 1 ) * price( ratios[i], 0, 1 )).amount; } ) );
+   report( "asset / asset",
+           time_op( rounds, inputs, [&]( size_t i ) { return legacy::divide_assets( amounts[i], amounts[(i+1) % inputs] ).low_bits(); } ),
+           time_op( rounds, inputs, [&]( size_t i ) { return (asset( amounts[i], 1 ) / asset( amounts[(i+1) % inputs], 0 )).ratio.low_bits(); } ) );
+
+   std::cout << "mismatches: " << mismatches << "\n";
+   return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/transaction_validator.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/time.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::atomic<uint64_t> allocation_count( 0 );
+
+void* operator new( size_t size )
+{
+   ++allocation_count;
+   if( void* p = malloc( size ? size : 1 ) ) return p;
+   throw std::bad_alloc();
+}
+
+void operator delete( void* p ) noexcept { free( p ); }
+
+using namespace bts::blockchain;
+
+/** delegates as the genesis block of the tests has them and one output of amount per key */
+trx_block make_genesis( const std::vector<fc::ecc::private_key>& keys, uint64_t amount )
+{
+   trx_block genesis;
+   genesis.version      = 0;
+   genesis.block_num    = 0;
+   genesis.timestamp    = fc::time_point::now();
+   genesis.next_fee     = block_header::min_fee();
+   genesis.total_shares = 0;
+
+   signed_transaction dtrx;
+   dtrx.vote = 0;
+   for( uint32_t i = 0; i < 100; ++i )
+   {
+      auto name = "delegate-" + fc::to_string( int64_t(i+1) );
+      auto key  = fc::ecc::private_key::regenerate( fc::sha256::hash( name.c_str(), name.size() ) );
+      dtrx.outputs.push_back( trx_output( claim_name_output( name, std::string(), i+1, key.get_public_key() ), asset() ) );
+   }
+   genesis.trxs.push_back( dtrx );
+
+   for( uint32_t i = 0; i < keys.size(); ++i )
+   {
+      signed_transaction trx;
+      trx.vote = i % 100 + 1;
+      trx.outputs.push_back( trx_output( claim_by_signature_output( address( keys[i].get_public_key() ) ), asset( amount ) ) );
+      genesis.total_shares += amount;
+      genesis.trxs.push_back( trx );
+   }
+   genesis.trx_mroot = genesis.calculate_merkle_root( signed_transactions() );
+   return genesis;
+}
+
+/**
+ *  Counts the heap allocations and time of evaluating transfers against the head block,
+ *  once with a block state per transaction and once with every transfer evaluated for the
+ *  same block state, as chain_database::validate does.  Signatures are recovered by a
+ *  first pass that is not counted.
+ *
+ *  usage: validation_bench [transactions]
+ */
+int main( int argc, char** argv )
+{
+   try {
+      uint32_t count = argc > 1 ? std::stoi( argv[1] ) : 1000;
+
+      fc::temp_directory dir;
+      chain_database db;
+      db.open( dir.path() / "chain" );
+
+      std::vector<fc::ecc::private_key> keys( count );
+      for( auto& key : keys ) key = fc::ecc::private_key::generate();
+      auto genesis = make_genesis( keys, 1000000 );
+      db.push_block( genesis );
+
+      std::vector<signed_transaction> trxs( count );
+      for( uint32_t i = 0; i < count; ++i )
+      {
+         trxs[i].vote = i % 100 + 1;
+         trxs[i].inputs.push_back( trx_input( output_reference( genesis.trxs[i+1].id(), 0 ) ) );
+         trxs[i].outputs.push_back( trx_output( claim_by_signature_output( address( keys[(i+1) % count].get_public_key() ) ),
+                                                asset( uint64_t(990000) ) ) );
+         trxs[i].sign( keys[i] );
+      }
+
+      auto validator = db.get_transaction_validator();
+      for( const signed_transaction& trx : trxs ) db.evaluate_transaction( trx );
+
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "evaluation        allocs/trx  us/trx\n";
+      auto report = [&]( const char* name, uint64_t allocs, const fc::microseconds& elapsed )
+      {
+         std::cout << std::left << std::setw(18) << name << std::right
+                   << std::setw(10) << double(allocs) / count << "  "
+                   << std::setw(6) << double(elapsed.count()) / count << "\n";
+      };
+
+      uint64_t before = allocation_count;
+      auto start = fc::time_point::now();
+      for( const signed_transaction& trx : trxs ) db.evaluate_transaction( trx );
+      report( "own block state", allocation_count - before, fc::time_point::now() - start );
+
+      before = allocation_count;
+      start  = fc::time_point::now();
+      {
+         auto block_state = validator->create_block_state();
+         for( const signed_transaction& trx : trxs ) validator->evaluate( trx, block_state );
+      }
+      report( "shared block state", allocation_count - before, fc::time_point::now() - start );
+      return 0;
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+}
@@ -0,0 +1,353 @@
+#include <bts/wallet/wallet.hpp>
+#include <bts/blockchain/chain_database.hpp>
+#include <bts/blockchain/signature_cache.hpp>
+#include <bts/blockchain/config.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/log/logger_config.hpp>
+#include <fc/log/console_appender.hpp>
+#include <fc/reflect/variant.hpp>
+#include "genesis_helpers.hpp"
+
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+
+using namespace bts::wallet;
+using namespace bts::blockchain;
+
+struct bench_config
+{
+   bench_config()
+   :blocks(20),trxs_per_block(100),inputs(1),outputs(2),keys(1000),lookups(1000),seed(7){}
+
+   uint32_t    blocks;
+   uint32_t    trxs_per_block;
+   uint32_t    inputs;   ///< per transaction
+   uint32_t    outputs;  ///< per transaction
+   uint32_t    keys;
+   uint32_t    lookups;  ///< of fetch_trx_block and evaluate_transaction
+   uint32_t    seed;
+   std::string out;      ///< the JSON report is written here when set, to stdout otherwise
+};
+
+FC_REFLECT( bench_config, (blocks)(trxs_per_block)(inputs)(outputs)(keys)(lookups)(seed)(out) )
+
+/** accumulated time of a phase of push_block */
+struct phase_timer
+{
+   phase_timer():total(0),count(0){}
+
+   void add( const fc::microseconds& t ) { total += t.count(); ++count; }
+   double total_ms()const                { return total / 1000.0; }
+   double average_us()const              { return count ? double(total) / count : 0; }
+
+   int64_t  total;
+   uint64_t count;
+};
+
+/** times validate and store of every block pushed */
+class bench_chain_database : public chain_database
+{
+   public:
+      phase_timer validate_time;
+      phase_timer store_time;
+
+   protected:
+      virtual block_evaluation_state_ptr validate( const trx_block& blk, const signed_transactions& deterministic_trxs )
+      {
+         auto start = fc::time_point::now();
+         auto state = chain_database::validate( blk, deterministic_trxs );
+         validate_time.add( fc::time_point::now() - start );
+         return state;
+      }
+
+      virtual void store( const trx_block& blk, const signed_transactions& deterministic_trxs,
+                          const block_evaluation_state_ptr& state )
+      {
+         auto start = fc::time_point::now();
+         chain_database::store( blk, deterministic_trxs, state );
+         store_time.add( fc::time_point::now() - start );
+      }
+};
+
+struct spendable
+{
+   output_reference ref;
+   uint64_t         amount;
+};
+
+/**
+ *  Builds transactions from the unspent outputs of the benchmark keys.  Outputs are only
+ *  offered for spending once the block that creates them has been pushed.
+ */
+class trx_generator
+{
+   public:
+      trx_generator( const bench_config& cfg, const std::vector<fc::ecc::private_key>& keys )
+      :_cfg(cfg),_keys(keys),_unspent(keys.size()),_rng(cfg.seed),_next_key(0)
+      {
+         for( uint32_t i = 0; i < keys.size(); ++i )
+            _owners[address( keys[i].get_public_key() )] = i;
+      }
+
+      /** adds the outputs of blk that pay to a benchmark key */
+      void add_outputs( const trx_block& blk )
+      {
+         for( const signed_transaction& trx : blk.trxs )
+         {
+            auto trx_id = trx.id();
+            for( uint32_t o = 0; o < trx.outputs.size(); ++o )
+            {
+               if( trx.outputs[o].claim_func != claim_by_signature ) continue;
+               auto owner = _owners.find( trx.outputs[o].as<claim_by_signature_output>().owner );
+               if( owner == _owners.end() ) continue;
+               spendable s;
+               s.ref    = output_reference( trx_id, o );
+               s.amount = trx.outputs[o].amount.get_rounded_amount();
+               _unspent[owner->second].push_back( s );
+            }
+         }
+      }
+
+      /** @return false when no key has enough outputs left */
+      bool next( uint64_t fee_rate, signed_transaction& trx )
+      {
+         for( uint32_t tries = 0; tries < _keys.size(); ++tries )
+         {
+            uint32_t k = _next_key++ % _keys.size();
+            auto& outputs = _unspent[k];
+            if( outputs.size() < _cfg.inputs ) continue;
+
+            trx = signed_transaction();
+            trx.vote = k % 100 + 1;
+            uint64_t total = 0;
+            for( uint32_t i = 0; i < _cfg.inputs; ++i )
+            {
+               trx.inputs.push_back( trx_input( outputs.front().ref ) );
+               total += outputs.front().amount;
+               outputs.pop_front();
+            }
+
+            // every output is a new trx_output to a random key, the fee is paid for the signed size
+            uint64_t fee = ((_cfg.inputs + _cfg.outputs) * 64 + 200) * fee_rate / 1000;
+            if( total <= fee + _cfg.outputs ) continue;
+            uint64_t each = (total - fee) / _cfg.outputs;
+            std::uniform_int_distribution<uint32_t> pick( 0, _keys.size() - 1 );
+            for( uint32_t o = 0; o < _cfg.outputs; ++o )
+               trx.outputs.push_back( trx_output( claim_by_signature_output( address( _keys[pick(_rng)].get_public_key() ) ),
+                                                  asset( each ) ) );
+            trx.sign( _keys[k] );
+            return true;
+         }
+         return false;
+      }
+
+   private:
+      const bench_config&                               _cfg;
+      const std::vector<fc::ecc::private_key>&          _keys;
+      std::unordered_map<address,uint32_t>              _owners;
+      std::vector< std::deque<spendable> >              _unspent;
+      std::mt19937                                      _rng;
+      uint32_t                                          _next_key;
+};
+
+/** outputs of amount to every key, enough for each to fund a transaction per block */
+trx_block make_genesis( const bench_config& cfg, const std::vector<fc::ecc::private_key>& keys )
+{
+   trx_block genesis = make_test_genesis();
+   uint32_t per_key = std::max<uint32_t>( cfg.inputs, (cfg.blocks * cfg.trxs_per_block * cfg.inputs) / keys.size() + cfg.inputs );
+   fund_test_genesis( genesis, keys, per_key );
+   return genesis;
+}
+
+double rate( uint64_t count, const phase_timer& t ) { return t.total ? count * 1000000.0 / t.total : 0; }
+
+fc::variant report_phase( const phase_timer& t )
+{
+   fc::mutable_variant_object obj;
+   obj["total_ms"]   = t.total_ms();
+   obj["average_us"] = t.average_us();
+   return fc::variant( obj );
+}
+
+void set_option( bench_config& cfg, const std::string& arg )
+{
+   auto eq = arg.find( '=' );
+   FC_ASSERT( arg.compare( 0, 2, "--" ) == 0 && eq != std::string::npos, "expected --name=value, got ${a}", ("a",arg) );
+   auto name  = arg.substr( 2, eq - 2 );
+   auto value = arg.substr( eq + 1 );
+   if( name == "out" ) { cfg.out = value; return; }
+
+   uint32_t v = std::stoul( value );
+   if(      name == "blocks" )         cfg.blocks         = v;
+   else if( name == "trxs-per-block" ) cfg.trxs_per_block = v;
+   else if( name == "inputs" )         cfg.inputs         = v;
+   else if( name == "outputs" )        cfg.outputs        = v;
+   else if( name == "keys" )           cfg.keys           = v;
+   else if( name == "lookups" )        cfg.lookups        = v;
+   else if( name == "seed" )           cfg.seed           = v;
+   else FC_THROW_EXCEPTION( invalid_arg_exception, "unknown option ${n}", ("n",name) );
+}
+
+/**
+ *  Builds a synthetic chain and reports, as JSON, push_block throughput broken down into
+ *  signature recovery, fetch_inputs, validate and store, the evaluate_transaction rate,
+ *  fetch_trx_block latency, wallet::scan_chain blocks per second and generate_next_block
+ *  latency.
+ *
+ *  Signature recovery is timed with a cache of its own, generate_next_block has already
+ *  recovered the signatures of the block for push_block.  fetch_inputs is timed before the
+ *  block is pushed and validate fetches the same inputs again, warm.
+ *
+ *  usage: bts_bench [--blocks=20] [--trxs-per-block=100] [--inputs=1] [--outputs=2]
+ *                   [--keys=1000] [--lookups=1000] [--seed=7] [--out=report.json]
+ */
+int main( int argc, char** argv )
+{
+   try {
+      bench_config cfg;
+      for( int i = 1; i < argc; ++i ) set_option( cfg, argv[i] );
+      FC_ASSERT( cfg.keys > 0 && cfg.inputs > 0 && cfg.outputs > 0 );
+
+      fc::logging_config log_cfg = fc::logging_config::default_config();
+      for( auto& logger : log_cfg.loggers ) logger.level = fc::log_level::error;
+      fc::configure_logging( log_cfg );
+
+      fc::temp_directory dir;
+      fc::ecc::private_key auth = fc::ecc::private_key::generate();
+      auto sim_validator = std::make_shared<sim_pow_validator>( fc::time_point::now() );
+
+      bench_chain_database db;
+      db.set_trustee( auth.get_public_key() );
+      db.set_pow_validator( sim_validator );
+      db.open( dir.path() / "chain" );
+
+      std::vector<fc::ecc::private_key> keys( cfg.keys );
+      for( auto& key : keys ) key = fc::ecc::private_key::generate();
+
+      wallet producer;
+      producer.create( dir.path() / "producer.dat", "password", "password", true );
+      producer.unlock_wallet( "password" );
+
+      auto genesis = make_genesis( cfg, keys );
+      genesis.sign( auth );
+      db.push_block( genesis );
+      producer.scan_chain( db );
+
+      trx_generator generator( cfg, keys );
+      generator.add_outputs( genesis );
+
+      phase_timer recover_time, fetch_inputs_time, push_time, generate_time;
+      uint64_t trx_count = 0;
+      for( uint32_t b = 0; b < cfg.blocks; ++b )
+      {
+         signed_transactions trxs;
+         signed_transaction trx;
+         while( trxs.size() < cfg.trxs_per_block && generator.next( db.get_fee_rate(), trx ) )
+            trxs.push_back( trx );
+         if( trxs.empty() ) { wlog( "the keys have no outputs left" ); break; }
+
+         sim_validator->skip_time( fc::seconds( 60 * 5 ) );
+         auto start = fc::time_point::now();
+         auto blk   = producer.generate_next_block( db, trxs );
+         generate_time.add( fc::time_point::now() - start );
+         blk.sign( auth );
+
+         {
+            signature_cache cold;
+            start = fc::time_point::now();
+            cold.recover( blk.trxs );
+            recover_time.add( fc::time_point::now() - start );
+         }
+
+         start = fc::time_point::now();
+         for( const signed_transaction& t : blk.trxs ) db.fetch_inputs( t.inputs );
+         fetch_inputs_time.add( fc::time_point::now() - start );
+
+         start = fc::time_point::now();
+         db.push_block( blk );
+         push_time.add( fc::time_point::now() - start );
+
+         trx_count += blk.trxs.size();
+         generator.add_outputs( blk );
+      }
+
+      // transactions that are valid against the head block, evaluated without being pushed
+      signed_transactions pending;
+      signed_transaction trx;
+      while( pending.size() < cfg.lookups && generator.next( db.get_fee_rate(), trx ) )
+         pending.push_back( trx );
+      signature_cache::instance().recover( pending );
+      phase_timer evaluate_time;
+      for( const signed_transaction& t : pending )
+      {
+         auto start = fc::time_point::now();
+         db.evaluate_transaction( t );
+         evaluate_time.add( fc::time_point::now() - start );
+      }
+
+      phase_timer fetch_block_time;
+      std::mt19937 rng( cfg.seed );
+      std::uniform_int_distribution<uint32_t> pick_block( 0, db.head_block_num() );
+      for( uint32_t i = 0; i < cfg.lookups; ++i )
+      {
+         uint32_t block_num = pick_block( rng );
+         auto start = fc::time_point::now();
+         db.fetch_trx_block( block_num );
+         fetch_block_time.add( fc::time_point::now() - start );
+      }
+
+      wallet scanner;
+      scanner.create( dir.path() / "scanner.dat", "password", "password", true );
+      scanner.unlock_wallet( "password" );
+      for( const auto& key : keys ) scanner.import_key( key );
+      phase_timer scan_time;
+      {
+         auto start = fc::time_point::now();
+         scanner.scan_chain( db );
+         scan_time.add( fc::time_point::now() - start );
+      }
+
+      fc::mutable_variant_object push;
+      push["blocks"]          = push_time.count;
+      push["transactions"]    = trx_count;
+      push["blocks_per_sec"]  = rate( push_time.count, push_time );
+      push["trxs_per_sec"]    = rate( trx_count, push_time );
+      push["total"]           = report_phase( push_time );
+      push["recover"]         = report_phase( recover_time );
+      push["fetch_inputs"]    = report_phase( fetch_inputs_time );
+      push["validate"]        = report_phase( db.validate_time );
+      push["store"]           = report_phase( db.store_time );
+
+      fc::mutable_variant_object result;
+      result["config"]                 = fc::variant( cfg );
+      result["push_block"]             = fc::variant( push );
+      result["evaluate_trxs_per_sec"]  = rate( evaluate_time.count, evaluate_time );
+      result["fetch_trx_block_us"]     = fetch_block_time.average_us();
+      result["scan_chain_blocks_per_sec"] = rate( db.head_block_num() + 1, scan_time );
+      result["generate_next_block_us"] = generate_time.average_us();
+
+      auto json = fc::json::to_pretty_string( fc::variant( result ) );
+      if( cfg.out.empty() )
+      {
+         std::cout << json << "\n";
+      }
+      else
+      {
+         std::ofstream out( cfg.out.c_str() );
+         out << json << "\n";
+         FC_ASSERT( out.good(), "unable to write ${file}", ("file",cfg.out) );
+      }
+      return 0;
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+}
@@ -5,10 +5,13 @@
 #include <boost/scope_exit.hpp>
 #include <boost/algorithm/string/join.hpp>
 
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <random>
 
 #include <fc/exception/exception.hpp>
 #include <fc/log/logger.hpp>
@@ -16,12 +19,15 @@
 #include <fc/filesystem.hpp>
 #include <fc/network/ip.hpp>
 #include <fc/io/json.hpp>
+#include <fc/variant_object.hpp>
 
 #include <fc/interprocess/process.hpp>
 
 #include <fc/reflect/variant.hpp>
 #include <bts/wallet/wallet.hpp>
 #include <bts/rpc/rpc_client.hpp>
+#include <bts/rpc/rpc_server.hpp>
+#include <bts/rpc/static_file_cache.hpp>
 #include <bts/blockchain/asset.hpp>
 #include <bts/net/chain_server.hpp>
 
@@ -37,6 +43,13 @@ struct bts_xt_client_test_config
   static uint16_t base_p2p_port;
   static bool test_client_server;
 
+  // rpc_load_test
+  static uint32_t load_clients;
+  static uint32_t load_callers;
+  static uint32_t load_seconds;
+  static std::string load_mix;
+  static fc::path load_report;
+
   bts_xt_client_test_config() 
   {
     // parse command-line options
@@ -44,6 +57,11 @@ struct bts_xt_client_test_config
     option_config.add_options()("bts-client-exe", boost::program_options::value<std::string>(), "full path to the executable to test")
                                ("bts-server-exe", boost::program_options::value<std::string>(), "full path to the server executable for testing client-server mode")
                                ("client-server", "test client-server mode instead of p2p")
+                               ("load-clients", boost::program_options::value<uint32_t>(), "number of clients rpc_load_test launches")
+                               ("load-callers", boost::program_options::value<uint32_t>(), "number of concurrent callers rpc_load_test spreads over the clients")
+                               ("load-seconds", boost::program_options::value<uint32_t>(), "how long rpc_load_test calls for")
+                               ("load-mix", boost::program_options::value<std::string>(), "relative weights of the methods rpc_load_test calls, e.g. sendtoaddress=1,getbalance=4,get_transaction_history=2,getblock=3")
+                               ("load-report", boost::program_options::value<std::string>(), "file rpc_load_test writes its json report to")
                                ("extra-help", "display this help message");
 
 
@@ -74,6 +92,19 @@ struct bts_xt_client_test_config
     if (option_variables.count("bts-server-exe"))
       bts_server_exe = option_variables["bts-server-exe"].as<std::string>().c_str();
 
+    if (option_variables.count("load-clients"))
+      load_clients = std::max<uint32_t>(1, option_variables["load-clients"].as<uint32_t>());
+    if (option_variables.count("load-callers"))
+      load_callers = std::max<uint32_t>(1, option_variables["load-callers"].as<uint32_t>());
+    if (option_variables.count("load-seconds"))
+      load_seconds = option_variables["load-seconds"].as<uint32_t>();
+    if (option_variables.count("load-mix"))
+      load_mix = option_variables["load-mix"].as<std::string>();
+    if (option_variables.count("load-report"))
+      load_report = option_variables["load-report"].as<std::string>().c_str();
+    else
+      load_report = config_directory / "rpc_load_report.json";
+
     std::cout << "Testing " << bts_client_exe.string() << "\n";
     std::cout << "Using config directory " << config_directory.string() << "\n";
     fc::create_directories(config_directory);
@@ -87,6 +118,11 @@ fc::path bts_xt_client_test_config::config_directory = fc::temp_directory_path()
 uint16_t bts_xt_client_test_config::base_rpc_port = 20100;
 uint16_t bts_xt_client_test_config::base_p2p_port = 21100;
 bool bts_xt_client_test_config::test_client_server = false;
+uint32_t bts_xt_client_test_config::load_clients = 3;
+uint32_t bts_xt_client_test_config::load_callers = 8;
+uint32_t bts_xt_client_test_config::load_seconds = 30;
+std::string bts_xt_client_test_config::load_mix = "sendtoaddress=1,getbalance=4,get_transaction_history=2,getblock=3";
+fc::path bts_xt_client_test_config::load_report;
 
 #define RPC_USERNAME "test"
 #define RPC_PASSWORD "test"
@@ -306,7 +342,7 @@ struct bts_client_launcher_fixture
   void create_trustee_and_genesis_block();
   void launch_server();
   void launch_clients();
-  void establish_rpc_connections();
+  void establish_rpc_connections(uint32_t pool_size = 1);
   void import_initial_balances();
 };
 
@@ -347,13 +383,13 @@ void bts_client_launcher_fixture::launch_clients()
   }
 }
 
-void bts_client_launcher_fixture::establish_rpc_connections()
+void bts_client_launcher_fixture::establish_rpc_connections(uint32_t pool_size /* = 1 */)
 {
   BOOST_TEST_MESSAGE("Establishing JSON-RPC connections to all processes");
   for (unsigned i = 0; i < client_processes.size(); ++i)
   {
     client_processes[i].rpc_client = std::make_shared<bts::rpc::rpc_client>();
-    client_processes[i].rpc_client->connect_to(fc::ip::endpoint(fc::ip::address("127.0.0.1"), client_processes[i].rpc_port));
+    client_processes[i].rpc_client->connect_to(fc::ip::endpoint(fc::ip::address("127.0.0.1"), client_processes[i].rpc_port), pool_size);
   }
 
   BOOST_TEST_MESSAGE("Logging in to JSON-RPC connections");
@@ -373,6 +409,83 @@ void bts_client_launcher_fixture::import_initial_balances()
 }
 
 
+// the calls rpc_load_test made of one method
+struct rpc_load_method_stats
+{
+  std::vector<uint64_t> latencies_us; // of every call, the failed ones included
+  uint64_t errors;
+
+  rpc_load_method_stats() : errors(0) {}
+};
+
+// the process statistics rpc_load_test sampled from one client
+struct rpc_load_node_stats
+{
+  fc::optional<bts::rpc::rpc_server::process_statistics> first_sample;
+  fc::optional<bts::rpc::rpc_server::process_statistics> last_sample;
+  uint64_t peak_resident_bytes;
+  uint32_t sample_count;
+
+  rpc_load_node_stats() : peak_resident_bytes(0), sample_count(0) {}
+  void add_sample(const bts::rpc::rpc_server::process_statistics& sample);
+  uint64_t cpu_microseconds() const;
+  double cpu_percent() const; // of one core, averaged over the samples
+};
+
+void rpc_load_node_stats::add_sample(const bts::rpc::rpc_server::process_statistics& sample)
+{
+  if (!first_sample)
+    first_sample = sample;
+  last_sample = sample;
+  peak_resident_bytes = std::max(peak_resident_bytes, std::max(sample.resident_bytes, sample.peak_resident_bytes));
+  ++sample_count;
+}
+
+uint64_t rpc_load_node_stats::cpu_microseconds() const
+{
+  if (!first_sample)
+    return 0;
+  return last_sample->user_cpu_microseconds + last_sample->system_cpu_microseconds -
+         first_sample->user_cpu_microseconds - first_sample->system_cpu_microseconds;
+}
+
+double rpc_load_node_stats::cpu_percent() const
+{
+  if (!first_sample)
+    return 0;
+  int64_t wall_microseconds = (last_sample->sampled_at - first_sample->sampled_at).count();
+  return wall_microseconds > 0 ? 100.0 * cpu_microseconds() / wall_microseconds : 0;
+}
+
+// sorted_latencies must not be empty
+uint64_t latency_percentile(const std::vector<uint64_t>& sorted_latencies, double p)
+{
+  return sorted_latencies[std::min<size_t>(sorted_latencies.size() - 1, size_t(p * sorted_latencies.size()))];
+}
+
+// the requests for other files that are served while one waits for its load must not invalidate it
+BOOST_AUTO_TEST_CASE(static_file_cache_serves_concurrent_loads)
+{
+  fc::temp_directory htdocs;
+  const uint32_t file_count = 64;
+  for (uint32_t i = 0; i < file_count; ++i)
+    std::ofstream((htdocs.path() / (fc::to_string(uint64_t(i)) + ".txt")).generic_string().c_str()) << "file " << i;
+
+  bts::rpc::static_file_cache cache;
+  std::vector<fc::future<bool> > requests;
+  for (uint32_t round = 0; round < 2; ++round)
+    for (uint32_t i = 0; i < file_count; ++i)
+      requests.push_back(fc::async([&cache, &htdocs, i]() -> bool
+      {
+        bts::rpc::static_file_ptr file = cache.get(htdocs.path() / (fc::to_string(uint64_t(i)) + ".txt"));
+        return file && std::string(file->content.begin(), file->content.end()) == "file " + fc::to_string(uint64_t(i));
+      }));
+  requests.push_back(fc::async([&cache, &htdocs]() -> bool { return !cache.get(htdocs.path() / "missing.txt"); }));
+  for (fc::future<bool>& request : requests)
+    BOOST_CHECK(request.wait());
+  BOOST_CHECK_EQUAL(cache.size(), file_count);
+}
+
 BOOST_FIXTURE_TEST_SUITE(bts_xt_client_test_suite, bts_client_launcher_fixture)
 
 #if 0
@@ -602,4 +715,223 @@ BOOST_AUTO_TEST_CASE(thousand_transactions_per_block)
   BOOST_CHECK(total_balances_recieved == total_amount_to_transfer);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_load_test)
+{
+  /* Spread the callers over the clients, each calling a method picked at random by the weights
+   * of --load-mix as soon as its last call returned, and report the throughput, latencies and
+   * errors of each method along with the cpu time and memory of each client. */
+  const uint32_t client_count = bts_xt_client_test_config::load_clients;
+  const uint32_t caller_count = bts_xt_client_test_config::load_callers;
+  const uint64_t amount_of_each_transfer = 1000;
+
+  std::vector<std::pair<std::string, uint32_t> > mix;
+  uint32_t total_weight = 0;
+  {
+    std::istringstream mix_stream(bts_xt_client_test_config::load_mix);
+    std::string entry;
+    while (std::getline(mix_stream, entry, ','))
+    {
+      size_t equals = entry.find('=');
+      std::string method = entry.substr(0, equals);
+      uint32_t weight = equals == std::string::npos ? 1 : boost::lexical_cast<uint32_t>(entry.substr(equals + 1));
+      BOOST_REQUIRE_MESSAGE(method == "sendtoaddress" || method == "getbalance" || 
+                            method == "get_transaction_history" || method == "getblock",
+                            "rpc_load_test does not know how to call " << method);
+      if (weight)
+      {
+        mix.push_back(std::make_pair(method, weight));
+        total_weight += weight;
+      }
+    }
+  }
+  BOOST_REQUIRE_MESSAGE(total_weight > 0, "--load-mix gives no method a weight");
+
+  client_processes.resize(client_count);
+  for (unsigned i = 0; i < client_processes.size(); ++i)
+    client_processes[i].initial_balance = INITIAL_BALANCE;
+
+  create_trustee_and_genesis_block();
+
+  if (bts_xt_client_test_config::test_client_server)
+    launch_server();
+
+  launch_clients();
+
+  // a connection for every caller, so that no call waits behind another caller's on a socket
+  establish_rpc_connections((caller_count + client_count - 1) / client_count);
+
+  BOOST_TEST_MESSAGE("Opening and unlocking wallets");
+  for (unsigned i = 0; i < client_processes.size(); ++i)
+  {
+    client_processes[i].rpc_client->openwallet();
+    BOOST_CHECK(client_processes[i].rpc_client->walletpassphrase(WALLET_PASPHRASE, fc::microseconds::maximum()));
+  }
+
+  import_initial_balances();
+
+  std::vector<bts::blockchain::address> receive_addresses(client_count);
+  for (unsigned i = 0; i < client_processes.size(); ++i)
+    receive_addresses[i] = client_processes[i].rpc_client->getnewaddress("load_test");
+
+  std::map<std::string, rpc_load_method_stats> method_stats;
+  for (const auto& method : mix)
+    method_stats[method.first];
+  std::vector<rpc_load_node_stats> node_stats(client_count);
+  uint32_t head_block_num = 0; // the highest block known to exist, getblock reads below it
+
+  auto sample_nodes = [&]()
+  {
+    for (unsigned i = 0; i < client_processes.size(); ++i)
+    {
+      try
+      {
+        auto sample = client_processes[i].rpc_client->async_call("getprocessstats").wait();
+        node_stats[i].add_sample(sample.as<bts::rpc::rpc_server::process_statistics>());
+      }
+      catch (const fc::exception& e)
+      {
+        wlog("unable to sample client ${i}: ${e}", ("i", i)("e", e.to_detail_string()));
+      }
+    }
+    try
+    {
+      for (;;)
+      {
+        client_processes[0].rpc_client->getblock(head_block_num + 1);
+        ++head_block_num;
+      }
+    }
+    catch (const fc::exception&)
+    {}
+  };
+
+  BOOST_TEST_MESSAGE("Calling " << bts_xt_client_test_config::load_mix << " from " << caller_count << " callers for " 
+                     << bts_xt_client_test_config::load_seconds << " seconds");
+  sample_nodes();
+  const fc::time_point start_time = fc::time_point::now();
+  const fc::time_point end_time = start_time + fc::seconds(bts_xt_client_test_config::load_seconds);
+
+  std::vector<fc::future<void> > callers;
+  for (uint32_t caller = 0; caller < caller_count; ++caller)
+  {
+    callers.push_back(fc::async([&, caller]()
+      {
+        std::mt19937 random(caller);
+        const uint32_t client_index = caller % client_count;
+        const bts::rpc::rpc_client_ptr rpc_client = client_processes[client_index].rpc_client;
+        while (fc::time_point::now() < end_time)
+        {
+          uint32_t pick = random() % total_weight;
+          auto method = mix.begin();
+          while (pick >= method->second)
+            pick -= (method++)->second;
+
+          fc::variants params;
+          if (method->first == "sendtoaddress")
+            params = fc::variants{ fc::variant((std::string)receive_addresses[(client_index + 1) % client_count]),
+                                   fc::variant(bts::blockchain::asset(amount_of_each_transfer)) };
+          else if (method->first == "getbalance")
+            params = fc::variants{ fc::variant(bts::blockchain::asset_type(0)) };
+          else if (method->first == "getblock")
+            params = fc::variants{ fc::variant(uint32_t(random() % (head_block_num + 1))) };
+
+          rpc_load_method_stats& stats = method_stats[method->first];
+          fc::time_point call_time = fc::time_point::now();
+          try
+          {
+            rpc_client->async_call(method->first, params).wait();
+          }
+          catch (const fc::exception&)
+          {
+            ++stats.errors;
+          }
+          stats.latencies_us.push_back((fc::time_point::now() - call_time).count());
+        }
+      }));
+  }
+
+  while (fc::time_point::now() < end_time)
+  {
+    fc::usleep(fc::seconds(1));
+    sample_nodes();
+  }
+  for (auto& caller : callers)
+    caller.wait();
+  const double elapsed_seconds = (fc::time_point::now() - start_time).count() / 1000000.0;
+  sample_nodes();
+
+  fc::mutable_variant_object report;
+  report["clients"] = client_count;
+  report["callers"] = caller_count;
+  report["mix"] = bts_xt_client_test_config::load_mix;
+  report["seconds"] = elapsed_seconds;
+
+  fc::variants method_reports;
+  uint64_t total_calls = 0;
+  uint64_t total_errors = 0;
+  for (auto& entry : method_stats)
+  {
+    std::vector<uint64_t>& latencies = entry.second.latencies_us;
+    BOOST_CHECK_MESSAGE(!latencies.empty(), entry.first << " was never called");
+    if (latencies.empty())
+      continue;
+    std::sort(latencies.begin(), latencies.end());
+    total_calls += latencies.size();
+    total_errors += entry.second.errors;
+
+    fc::mutable_variant_object method_report;
+    method_report["method"] = entry.first;
+    method_report["calls"] = uint64_t(latencies.size());
+    method_report["errors"] = entry.second.errors;
+    method_report["error_rate"] = double(entry.second.errors) / latencies.size();
+    method_report["calls_per_second"] = latencies.size() / elapsed_seconds;
+    method_report["p50_microseconds"] = latency_percentile(latencies, 0.50);
+    method_report["p90_microseconds"] = latency_percentile(latencies, 0.90);
+    method_report["p99_microseconds"] = latency_percentile(latencies, 0.99);
+    method_report["max_microseconds"] = latencies.back();
+    method_reports.push_back(fc::variant(method_report));
+
+    BOOST_TEST_MESSAGE(entry.first << ": " << latencies.size() << " calls, " << entry.second.errors << " errors, " 
+                       << latencies.size() / elapsed_seconds << " calls/s, p50 " << latency_percentile(latencies, 0.50) 
+                       << "us, p99 " << latency_percentile(latencies, 0.99) << "us");
+
+    // transfers may be rejected while the change of the last one is unconfirmed, reads must not fail
+    if (entry.first != "sendtoaddress")
+      BOOST_CHECK_MESSAGE(entry.second.errors == 0, entry.first << " failed " << entry.second.errors << " times");
+    else
+      BOOST_CHECK_MESSAGE(entry.second.errors < latencies.size(), "every one of the " << latencies.size() << " transfers failed");
+  }
+  report["methods"] = method_reports;
+  report["calls"] = total_calls;
+  report["errors"] = total_errors;
+  report["calls_per_second"] = total_calls / elapsed_seconds;
+
+  fc::variants node_reports;
+  for (unsigned i = 0; i < client_processes.size(); ++i)
+  {
+    fc::mutable_variant_object node_report;
+    node_report["client"] = i;
+    node_report["samples"] = node_stats[i].sample_count;
+    node_report["cpu_microseconds"] = node_stats[i].cpu_microseconds();
+    node_report["cpu_percent"] = node_stats[i].cpu_percent();
+    node_report["resident_bytes"] = node_stats[i].last_sample.valid() ? node_stats[i].last_sample->resident_bytes : 0;
+    node_report["peak_resident_bytes"] = node_stats[i].peak_resident_bytes;
+    try
+    {
+      // the latencies the client itself measured, without the network and the json client
+      node_report["rpc_stats"] = client_processes[i].rpc_client->async_call("getrpcstats").wait();
+    }
+    catch (const fc::exception&)
+    {}
+    node_reports.push_back(fc::variant(node_report));
+
+    BOOST_TEST_MESSAGE("client " << i << ": " << node_stats[i].cpu_percent() << "% cpu, " 
+                       << node_stats[i].peak_resident_bytes / (1024 * 1024) << "MB peak resident");
+  }
+  report["nodes"] = node_reports;
+
+  fc::json::save_to_file(fc::variant(report), bts_xt_client_test_config::load_report, true);
+  BOOST_TEST_MESSAGE("Wrote the report to " << bts_xt_client_test_config::load_report.string());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
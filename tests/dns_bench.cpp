@@ -0,0 +1,507 @@
+#include <bts/dns/dns_db.hpp>
+#include <bts/dns/dns_wallet.hpp>
+#include <bts/blockchain/pow_validator.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/log/logger_config.hpp>
+#include <fc/log/console_appender.hpp>
+#include <fc/reflect/variant.hpp>
+#include "genesis_helpers.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+
+using namespace bts::blockchain;
+using namespace bts::dns;
+using namespace bts::wallet;
+
+struct dns_bench_config
+{
+   dns_bench_config()
+   :blocks(30),bids_per_block(100),outbids_per_block(20),updates_per_block(20),transfers_per_block(5),
+    wallets(4),lookups(1000),report_every(10),seed(7){}
+
+   uint32_t    blocks;
+   uint32_t    bids_per_block;      ///< on new names and on expired ones
+   uint32_t    outbids_per_block;   ///< on names in auction
+   uint32_t    updates_per_block;   ///< of owned names, which also keeps them from expiring
+   uint32_t    transfers_per_block; ///< of owned names to another wallet
+   uint32_t    wallets;
+   uint32_t    lookups;             ///< of lookup_value and resolve at each report
+   uint32_t    report_every;        ///< blocks between reports of how reads scale with the names
+   uint32_t    seed;
+   std::string out;                 ///< the JSON report is written here when set, to stdout otherwise
+};
+
+FC_REFLECT( dns_bench_config, (blocks)(bids_per_block)(outbids_per_block)(updates_per_block)(transfers_per_block)
+                              (wallets)(lookups)(report_every)(seed)(out) )
+
+/** accumulated time of a phase */
+struct phase_timer
+{
+   phase_timer():total(0),count(0){}
+
+   void add( const fc::microseconds& t ) { total += t.count(); ++count; }
+   double total_ms()const                { return total / 1000.0; }
+   double average_us()const              { return count ? double(total) / count : 0; }
+
+   int64_t  total;
+   uint64_t count;
+};
+
+/** times validate and store of every block pushed */
+class bench_dns_db : public dns_db
+{
+   public:
+      phase_timer validate_time;
+      phase_timer store_time;
+
+      virtual void store( const trx_block& blk, const signed_transactions& deterministic_trxs,
+                          const block_evaluation_state_ptr& state )
+      {
+         auto start = fc::time_point::now();
+         dns_db::store( blk, deterministic_trxs, state );
+         store_time.add( fc::time_point::now() - start );
+      }
+
+   protected:
+      virtual block_evaluation_state_ptr validate( const trx_block& blk, const signed_transactions& deterministic_trxs )
+      {
+         auto start = fc::time_point::now();
+         auto state = dns_db::validate( blk, deterministic_trxs );
+         validate_time.add( fc::time_point::now() - start );
+         return state;
+      }
+};
+
+/** the kinds of domain transactions the generator issues */
+enum domain_op { op_bid_new, op_bid_expired, op_outbid, op_update, op_transfer, domain_op_count };
+static const char* domain_op_names[domain_op_count] = { "bid_new", "bid_expired", "outbid", "update", "transfer" };
+
+struct op_stats
+{
+   op_stats():issued(0),rejected(0){}
+
+   uint64_t    issued;
+   uint64_t    rejected;     ///< by the wallet, the name was no longer in the state the generator assumed
+   phase_timer evaluate;     ///< evaluate_transaction, which recovers the signatures cold
+};
+
+/**
+ *  A name as the generator last left it.  A later transaction on the name supersedes the
+ *  entry, which is recognized by its block no longer being the block of the name's record.
+ */
+struct domain_entry
+{
+   std::string name;
+   uint32_t    wallet;
+   uint32_t    block_num;
+};
+
+/**
+ *  Issues the transactions of each block from a set of dns_wallets.  Names move from the
+ *  auctions, ordered by their last bid, to the owned names, ordered by their last update, to
+ *  the expired ones, as auction_is_closed and domain_is_expired say once a block is pushed.
+ */
+class domain_generator
+{
+   public:
+      domain_generator( const dns_bench_config& cfg, bench_dns_db& db, std::vector<std::unique_ptr<dns_wallet> >& wallets )
+      :_cfg(cfg),_db(db),_wallets(wallets),_rng(cfg.seed),_next_name(0){}
+
+      signed_transactions next_block()
+      {
+         signed_transactions trxs;
+         dns_name_pool       used;
+
+         for( uint32_t i = 0; i < _cfg.updates_per_block; ++i )
+         {
+            domain_entry e;
+            if( !pick( _owned, used, e ) ) break;
+            issue( op_update, trxs, used, e.name, [&]() {
+               return _wallets[e.wallet]->update_domain( e.name, fc::variant( "value-" + fc::to_string( int64_t(_next_name) ) ), used, _db );
+            } );
+         }
+         for( uint32_t i = 0; i < _cfg.transfers_per_block; ++i )
+         {
+            domain_entry e;
+            if( !pick( _owned, used, e ) ) break;
+            auto& recipient = *_wallets[(e.wallet + 1) % _wallets.size()];
+            issue( op_transfer, trxs, used, e.name, [&]() {
+               return _wallets[e.wallet]->transfer_domain( e.name, recipient.new_receive_address(), used, _db );
+            } );
+         }
+         for( uint32_t i = 0; i < _cfg.outbids_per_block; ++i )
+         {
+            domain_entry e;
+            if( !pick( _auctions, used, e ) ) break;
+            const dns_record* record = _db.find_dns_record( e.name );
+            asset price( DNS_MIN_BID_FROM( record->amount.get_rounded_amount() ) + 1 );
+            uint32_t bidder = (e.wallet + 1) % _wallets.size();
+            issue( op_outbid, trxs, used, e.name, [&]() {
+               return _wallets[bidder]->bid_on_domain( e.name, price, used, _db );
+            } );
+         }
+         for( uint32_t i = 0; i < _cfg.bids_per_block; ++i )
+         {
+            bool expired = false;
+            std::string name;
+            while( !_expired.empty() && name.empty() )
+            {
+               if( !used.count( _expired.back() ) ) name = _expired.back();
+               _expired.pop_back();
+               expired = !name.empty();
+            }
+            if( name.empty() ) name = "bench-" + fc::to_string( int64_t(_next_name++) );
+            uint32_t bidder = i % _wallets.size();
+            issue( expired ? op_bid_expired : op_bid_new, trxs, used, name, [&]() {
+               return _wallets[bidder]->bid_on_domain( name, asset( uint64_t(100) ), used, _db );
+            } );
+         }
+         return trxs;
+      }
+
+      /** follows the names of blk to the lists they now belong to */
+      void apply_block( const trx_block& blk )
+      {
+         for( const signed_transaction& trx : blk.trxs )
+         {
+            for( const trx_output& out : trx.outputs )
+            {
+               if( !is_domain_output( out ) ) continue;
+               auto domain = to_domain_output( out );
+               domain_entry e;
+               e.name      = domain.name;
+               e.wallet    = owner_of( domain.owner );
+               e.block_num = blk.block_num;
+               if( domain.last_tx_type == claim_domain_output::bid_or_auction ) _auctions.push_back( e );
+               else                                                              _owned.push_back( e );
+               _names.insert( e.name );
+            }
+         }
+
+         while( !_auctions.empty() )
+         {
+            const dns_record* record = current( _auctions.front() );
+            if( record && !auction_is_closed( *record, _db ) ) break;
+            if( record ) _owned.push_back( _auctions.front() );
+            _auctions.pop_front();
+         }
+         while( !_owned.empty() )
+         {
+            const dns_record* record = current( _owned.front() );
+            if( record && !domain_is_expired( *record, _db ) ) break;
+            if( record ) _expired.push_back( _owned.front().name );
+            _owned.pop_front();
+         }
+      }
+
+      /** the names ever bid on */
+      const std::unordered_set<std::string>& names()const { return _names; }
+      uint64_t                               auctions()const { return _auctions.size(); }
+      uint64_t                               owned()const    { return _owned.size(); }
+      op_stats                               stats[domain_op_count];
+
+   private:
+      template<typename MakeTrx>
+      void issue( domain_op op, signed_transactions& trxs, dns_name_pool& used, const std::string& name, MakeTrx&& make )
+      {
+         try {
+            signed_transaction trx = make();
+            auto start = fc::time_point::now();
+            _db.evaluate_transaction( trx );
+            stats[op].evaluate.add( fc::time_point::now() - start );
+            trxs.push_back( trx );
+            add_names_from_tx( trx, used );
+            ++stats[op].issued;
+         }
+         catch ( const fc::exception& )
+         {
+            ++stats[op].rejected;
+            used.insert( name );
+         }
+      }
+
+      /** a random entry of list that is still current and not used by this block yet */
+      bool pick( std::deque<domain_entry>& list, const dns_name_pool& used, domain_entry& e )
+      {
+         for( uint32_t tries = 0; tries < 8 && !list.empty(); ++tries )
+         {
+            std::uniform_int_distribution<size_t> index( 0, list.size() - 1 );
+            e = list[index( _rng )];
+            if( !used.count( e.name ) && current( e ) ) return true;
+         }
+         return false;
+      }
+
+      /** the record of e's name if e is its last transaction */
+      const dns_record* current( const domain_entry& e )
+      {
+         const dns_record* record = _db.find_dns_record( e.name );
+         return record && record->block_num == e.block_num ? record : nullptr;
+      }
+
+      uint32_t owner_of( const address& owner )const
+      {
+         for( uint32_t w = 0; w < _wallets.size(); ++w )
+            if( _wallets[w]->is_my_address( owner ) ) return w;
+         return 0;
+      }
+
+      const dns_bench_config&                        _cfg;
+      bench_dns_db&                                  _db;
+      std::vector<std::unique_ptr<dns_wallet> >&     _wallets;
+      std::mt19937                                   _rng;
+      uint64_t                                       _next_name;
+      std::deque<domain_entry>                       _auctions;
+      std::deque<domain_entry>                       _owned;
+      std::vector<std::string>                       _expired;
+      std::unordered_set<std::string>                _names;
+};
+
+/** the test delegates, then outputs to every funding key, enough for any wallet to issue all the transactions of a block */
+trx_block make_genesis( const dns_bench_config& cfg, const std::vector<fc::ecc::private_key>& keys )
+{
+   trx_block genesis = make_test_genesis();
+   // change returns to the wallets, so each funding output can pay for one transaction per block
+   uint32_t per_block = cfg.bids_per_block + cfg.outbids_per_block + cfg.updates_per_block + cfg.transfers_per_block;
+   uint32_t per_key   = per_block + 2; // the owners of the names updated in a block are not spread evenly
+   fund_test_genesis( genesis, keys, per_key );
+   return genesis;
+}
+
+double rate( uint64_t count, const phase_timer& t ) { return t.total ? count * 1000000.0 / t.total : 0; }
+
+fc::variant report_phase( const phase_timer& t )
+{
+   fc::mutable_variant_object obj;
+   obj["total_ms"]   = t.total_ms();
+   obj["average_us"] = t.average_us();
+   return fc::variant( obj );
+}
+
+/** how the reads of the chain and the wallet rescan cost with the names bid on so far */
+fc::variant report_reads( const dns_bench_config& cfg, bench_dns_db& db, const domain_generator& generator,
+                          dns_wallet& scanner, std::mt19937& rng )
+{
+   phase_timer auctions_time;
+   size_t active = 0;
+   {
+      auto start = fc::time_point::now();
+      active = get_active_auctions( db ).size();
+      auctions_time.add( fc::time_point::now() - start );
+   }
+
+   std::vector<std::string> sample( generator.names().begin(), generator.names().end() );
+   std::shuffle( sample.begin(), sample.end(), rng );
+   if( sample.size() > cfg.lookups ) sample.resize( cfg.lookups );
+
+   phase_timer lookup_time;
+   uint64_t found = 0;
+   for( const std::string& name : sample )
+   {
+      auto start = fc::time_point::now();
+      if( !lookup_value( name, db ).is_null() ) ++found; // null in its first auction
+      lookup_time.add( fc::time_point::now() - start );
+   }
+
+   phase_timer resolve_time;
+   if( !sample.empty() )
+   {
+      auto start = fc::time_point::now();
+      db.resolve( sample );
+      resolve_time.add( fc::time_point::now() - start );
+   }
+
+   phase_timer scan_time;
+   {
+      auto start = fc::time_point::now();
+      scanner.scan_chain( db, 0 );
+      scan_time.add( fc::time_point::now() - start );
+   }
+
+   fc::mutable_variant_object obj;
+   obj["block_num"]                 = db.head_block_num();
+   obj["names"]                     = generator.names().size();
+   obj["in_auction"]                = generator.auctions();
+   obj["owned"]                     = generator.owned();
+   obj["get_active_auctions_us"]    = auctions_time.average_us();
+   obj["active_auctions"]           = active;
+   obj["lookup_us"]                 = lookup_time.average_us();
+   obj["lookups_with_value"]        = found;
+   obj["resolve_batch_us"]          = resolve_time.average_us();
+   obj["resolve_batch_size"]        = sample.size();
+   obj["scan_chain_ms"]             = scan_time.total_ms();
+   obj["scan_chain_blocks_per_sec"] = rate( db.head_block_num() + 1, scan_time );
+   return fc::variant( obj );
+}
+
+void set_option( dns_bench_config& cfg, const std::string& arg )
+{
+   auto eq = arg.find( '=' );
+   FC_ASSERT( arg.compare( 0, 2, "--" ) == 0 && eq != std::string::npos, "expected --name=value, got ${a}", ("a",arg) );
+   auto name  = arg.substr( 2, eq - 2 );
+   auto value = arg.substr( eq + 1 );
+   if( name == "out" ) { cfg.out = value; return; }
+
+   uint32_t v = std::stoul( value );
+   if(      name == "blocks" )              cfg.blocks              = v;
+   else if( name == "bids-per-block" )      cfg.bids_per_block      = v;
+   else if( name == "outbids-per-block" )   cfg.outbids_per_block   = v;
+   else if( name == "updates-per-block" )   cfg.updates_per_block   = v;
+   else if( name == "transfers-per-block" ) cfg.transfers_per_block = v;
+   else if( name == "wallets" )             cfg.wallets             = v;
+   else if( name == "lookups" )             cfg.lookups             = v;
+   else if( name == "report-every" )        cfg.report_every        = v;
+   else if( name == "seed" )                cfg.seed                = v;
+   else FC_THROW_EXCEPTION( invalid_arg_exception, "unknown option ${n}", ("n",name) );
+}
+
+/**
+ *  Builds a DNS chain of many concurrent auctions, bids, updates, transfers and expiries and
+ *  reports, as JSON, push_block throughput broken down into validate and store, the cost of
+ *  evaluating each kind of domain transaction, generate_next_block latency, the time the
+ *  wallets take to apply each block, and every report_every blocks the latency of
+ *  get_active_auctions, lookup_value and resolve and a full dns_wallet rescan as the names
+ *  grow.
+ *
+ *  The chain is the same as that of dns_tests, on a sim_pow_validator with the auction and
+ *  expiry durations of the build.  Names are bid on at a fixed price, outbid at the lowest
+ *  valid bid and updated with a new value.
+ *
+ *  usage: dns_bench [--blocks=30] [--bids-per-block=100] [--outbids-per-block=20]
+ *                   [--updates-per-block=20] [--transfers-per-block=5] [--wallets=4]
+ *                   [--lookups=1000] [--report-every=10] [--seed=7] [--out=report.json]
+ */
+int main( int argc, char** argv )
+{
+   try {
+      dns_bench_config cfg;
+      for( int i = 1; i < argc; ++i ) set_option( cfg, argv[i] );
+      FC_ASSERT( cfg.wallets > 0 && cfg.report_every > 0 );
+
+      fc::logging_config log_cfg = fc::logging_config::default_config();
+      for( auto& logger : log_cfg.loggers ) logger.level = fc::log_level::error;
+      fc::configure_logging( log_cfg );
+
+      fc::temp_directory dir;
+      fc::ecc::private_key auth = fc::ecc::private_key::generate();
+      auto sim_validator = std::make_shared<sim_pow_validator>( fc::time_point::now() );
+
+      bench_dns_db db;
+      db.set_trustee( auth.get_public_key() );
+      db.set_pow_validator( sim_validator );
+      db.open( dir.path() / "dns_chain" );
+
+      // one funding key per wallet, the scanner watches all of them
+      std::vector<fc::ecc::private_key> keys( cfg.wallets );
+      std::vector<std::unique_ptr<dns_wallet> > wallets;
+      dns_wallet scanner;
+      scanner.create( dir.path() / "scanner.dat", "password", "password", true );
+      scanner.unlock_wallet( "password" );
+      for( uint32_t w = 0; w < cfg.wallets; ++w )
+      {
+         keys[w] = fc::ecc::private_key::generate();
+         wallets.emplace_back( new dns_wallet() );
+         wallets[w]->create( dir.path() / ("wallet" + fc::to_string( int64_t(w) ) + ".dat"), "password", "password", true );
+         wallets[w]->unlock_wallet( "password" );
+         wallets[w]->import_key( keys[w] );
+         scanner.import_key( keys[w] );
+      }
+
+      auto genesis = make_genesis( cfg, keys );
+      genesis.sign( auth );
+      db.push_block( genesis );
+      for( auto& w : wallets ) w->scan_chain( db );
+
+      domain_generator generator( cfg, db, wallets );
+      std::mt19937 rng( cfg.seed );
+      std::vector<fc::variant> reads;
+
+      phase_timer issue_time, generate_time, push_time, wallet_time;
+      uint64_t trx_count = 0;
+      for( uint32_t b = 1; b <= cfg.blocks; ++b )
+      {
+         auto start = fc::time_point::now();
+         signed_transactions trxs = generator.next_block();
+         issue_time.add( fc::time_point::now() - start );
+
+         // an empty block still ages the auctions and expiries
+         sim_validator->skip_time( fc::seconds( 60 * 5 ) );
+         start = fc::time_point::now();
+         auto blk = wallets[0]->generate_next_block( db, trxs );
+         generate_time.add( fc::time_point::now() - start );
+         blk.sign( auth );
+
+         start = fc::time_point::now();
+         db.push_block( blk );
+         push_time.add( fc::time_point::now() - start );
+         trx_count += blk.trxs.size();
+
+         start = fc::time_point::now();
+         for( auto& w : wallets )
+         {
+            if( w->last_scanned() + 1 == blk.block_num ) w->apply_block( blk );
+            else                                         w->scan_chain( db, blk.block_num );
+         }
+         wallet_time.add( fc::time_point::now() - start );
+
+         generator.apply_block( blk );
+         if( b % cfg.report_every == 0 || b == cfg.blocks )
+            reads.push_back( report_reads( cfg, db, generator, scanner, rng ) );
+      }
+
+      fc::mutable_variant_object push;
+      push["blocks"]         = push_time.count;
+      push["transactions"]   = trx_count;
+      push["blocks_per_sec"] = rate( push_time.count, push_time );
+      push["trxs_per_sec"]   = rate( trx_count, push_time );
+      push["total"]          = report_phase( push_time );
+      push["validate"]       = report_phase( db.validate_time );
+      push["store"]          = report_phase( db.store_time );
+
+      fc::mutable_variant_object ops;
+      for( uint32_t op = 0; op < domain_op_count; ++op )
+      {
+         fc::mutable_variant_object stats;
+         stats["issued"]      = generator.stats[op].issued;
+         stats["rejected"]    = generator.stats[op].rejected;
+         stats["evaluate_us"] = generator.stats[op].evaluate.average_us();
+         ops[domain_op_names[op]] = fc::variant( stats );
+      }
+
+      fc::mutable_variant_object result;
+      result["config"]                  = fc::variant( cfg );
+      result["push_block"]              = fc::variant( push );
+      result["domain_transactions"]     = fc::variant( ops );
+      result["issue_block_ms"]          = issue_time.total_ms() / std::max<uint64_t>( 1, issue_time.count );
+      result["generate_next_block_us"]  = generate_time.average_us();
+      result["wallets_apply_block_us"]  = wallet_time.average_us();
+      result["reads"]                   = fc::variant( reads );
+
+      auto json = fc::json::to_pretty_string( fc::variant( result ) );
+      if( cfg.out.empty() )
+      {
+         std::cout << json << "\n";
+      }
+      else
+      {
+         std::ofstream out( cfg.out.c_str() );
+         out << json << "\n";
+         FC_ASSERT( out.good(), "unable to write ${file}", ("file",cfg.out) );
+      }
+      return 0;
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+}
@@ -8,6 +8,7 @@
 
 #include <bts/dns/dns_db.hpp>
 #include <bts/dns/dns_wallet.hpp>
+#include "genesis_helpers.hpp"
 
 #define DNS_TEST_NUM_WALLET_ADDRS   10
 #define DNS_TEST_BLOCK_SECS         (5 * 60)
@@ -24,24 +25,7 @@ using namespace bts::wallet;
 
 trx_block generate_genesis_block( const std::vector<address>& addr )
 {
-    trx_block genesis;
-    genesis.version           = 0;
-    genesis.block_num         = 0;
-    genesis.timestamp         = fc::time_point::now();
-    genesis.next_fee          = block_header::min_fee();
-    genesis.total_shares      = 0;
-
-    signed_transaction dtrx;
-    dtrx.vote = 0;
-    // create initial delegates
-    for( uint32_t i = 0; i < 100; ++i )
-    {
-       auto name     = "delegate-"+fc::to_string( int64_t(i+1) );
-       auto key_hash = fc::sha256::hash( name.c_str(), name.size() );
-       auto key      = fc::ecc::private_key::regenerate(key_hash);
-       dtrx.outputs.push_back( trx_output( claim_name_output( name, std::string(), i+1, key.get_public_key() ), asset() ) );
-    }
-    genesis.trxs.push_back( dtrx );
+    trx_block genesis = make_test_genesis();
 
     // generate an initial genesis block that evenly allocates votes among all
     // delegates.
@@ -3143,3 +3127,98 @@ BOOST_AUTO_TEST_CASE (wallet_auction_tx_pool_conflict_fail)
         throw;
     }
 }
+
+/* The auction and expiry indexes follow bids, updates and popped blocks */
+BOOST_AUTO_TEST_CASE (db_deadline_indexes)
+{
+    try
+    {
+        DNSTestState state;
+        signed_transactions txs;
+        signed_transaction tx;
+
+        /* Initial domain bid */
+        tx = state.wallet1.bid_on_domain(DNS_TEST_NAME, DNS_TEST_PRICE1, txs, state.db);
+        txs.push_back(tx);
+        state.next_block(txs);
+
+        BOOST_CHECK(state.db.get_active_auction_names() == std::vector<std::string>{DNS_TEST_NAME});
+        BOOST_CHECK(get_active_auctions(state.db).size() == 1);
+        BOOST_CHECK(state.db.get_expiring_names(DNS_AUCTION_DURATION_BLOCKS + DNS_EXPIRE_DURATION_BLOCKS).size() == 1);
+        BOOST_CHECK(state.db.get_expiring_names(DNS_AUCTION_DURATION_BLOCKS + DNS_EXPIRE_DURATION_BLOCKS - 1).empty());
+
+        /* Let auction end */
+        for (auto i = 0; i < DNS_AUCTION_DURATION_BLOCKS; i++)
+            state.next_block(txs);
+
+        BOOST_CHECK(state.db.get_active_auction_names().empty());
+
+        /* Update domain record, which moves the expiry */
+        tx = state.wallet1.update_domain(DNS_TEST_NAME, DNS_TEST_VALUE, txs, state.db);
+        txs.push_back(tx);
+        state.next_block(txs);
+
+        BOOST_CHECK(state.db.get_expiring_names(DNS_EXPIRE_DURATION_BLOCKS).size() == 1);
+        BOOST_CHECK(state.db.get_expiring_names(DNS_EXPIRE_DURATION_BLOCKS - 1).empty());
+
+        /* Undoing the update restores the deadline of the bid */
+        state.db.pop_block();
+        BOOST_CHECK(state.db.get_expiring_names(DNS_EXPIRE_DURATION_BLOCKS + 1).size() == 1);
+        BOOST_CHECK(state.db.get_expiring_names(DNS_EXPIRE_DURATION_BLOCKS - 1).empty());
+    }
+    catch (const fc::exception &e)
+    {
+        std::cerr << e.to_detail_string() << "\n";
+        elog("${e}", ("e", e.to_detail_string()));
+        throw;
+    }
+}
+
+/* The resolver table follows updates and popped blocks */
+BOOST_AUTO_TEST_CASE (db_resolve)
+{
+    try
+    {
+        DNSTestState state;
+        signed_transactions txs;
+        signed_transaction tx;
+
+        /* Initial domain bid */
+        tx = state.wallet1.bid_on_domain(DNS_TEST_NAME, DNS_TEST_PRICE1, txs, state.db);
+        txs.push_back(tx);
+        state.next_block(txs);
+        BOOST_CHECK(lookup_value(DNS_TEST_NAME, state.db).is_null());
+
+        /* Let auction end */
+        for (auto i = 0; i < DNS_AUCTION_DURATION_BLOCKS; i++)
+            state.next_block(txs);
+
+        std::vector<std::string> names{DNS_TEST_NAME, "DNS_TEST_UNKNOWN_NAME"};
+        BOOST_CHECK(!state.db.resolve(names)[0].valid());
+        BOOST_CHECK(lookup_value(DNS_TEST_NAME, state.db).is_null());
+
+        /* Update domain record */
+        tx = state.wallet1.update_domain(DNS_TEST_NAME, DNS_TEST_VALUE, txs, state.db);
+        txs.push_back(tx);
+        state.next_block(txs);
+
+        auto values = state.db.resolve(names);
+        BOOST_REQUIRE(values[0].valid());
+        BOOST_CHECK(unserialize_value(*values[0]).as_string() == DNS_TEST_VALUE);
+        BOOST_CHECK(!values[1].valid());
+        BOOST_CHECK(lookup_value(DNS_TEST_NAME, state.db).as_string() == DNS_TEST_VALUE);
+
+        auto stats = state.db.get_resolver_stats();
+        BOOST_CHECK(stats.names == 1);
+        BOOST_CHECK(stats.hits == 2);
+
+        state.db.pop_block();
+        BOOST_CHECK(!state.db.resolve(names)[0].valid());
+    }
+    catch (const fc::exception &e)
+    {
+        std::cerr << e.to_detail_string() << "\n";
+        elog("${e}", ("e", e.to_detail_string()));
+        throw;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <bts/blockchain/block.hpp>
+#include <bts/blockchain/outputs.hpp>
+#include <fc/crypto/elliptic.hpp>
+#include <fc/crypto/sha256.hpp>
+
+#include <vector>
+
+/**
+ *  The genesis blocks the tests and benchmarks build on: the 100 delegates every test
+ *  chain starts with, then outputs to whoever the test funds.
+ */
+
+/** the key of delegate *id*, importing it makes a wallet able to sign for the delegate */
+inline fc::ecc::private_key test_delegate_key( uint32_t id )
+{
+   auto name = "delegate-" + fc::to_string( int64_t(id) );
+   return fc::ecc::private_key::regenerate( fc::sha256::hash( name.c_str(), name.size() ) );
+}
+
+/** a block 0 at now with the transaction that registers delegates 1 to 100 */
+inline bts::blockchain::trx_block make_test_genesis()
+{
+   using namespace bts::blockchain;
+   trx_block genesis;
+   genesis.version      = 0;
+   genesis.block_num    = 0;
+   genesis.timestamp    = fc::time_point::now();
+   genesis.next_fee     = block_header::min_fee();
+   genesis.total_shares = 0;
+
+   signed_transaction dtrx;
+   dtrx.vote = 0;
+   for( uint32_t i = 1; i <= 100; ++i )
+   {
+      auto name = "delegate-" + fc::to_string( int64_t(i) );
+      dtrx.outputs.push_back( trx_output( claim_name_output( name, std::string(), i, test_delegate_key( i ).get_public_key() ), asset() ) );
+   }
+   genesis.trxs.push_back( dtrx );
+   return genesis;
+}
+
+/**
+ *  Adds a transaction per key with per_key outputs of amount to it, their votes spread
+ *  over the delegates, and sets the merkle root of the finished block.
+ */
+inline void fund_test_genesis( bts::blockchain::trx_block& genesis, const std::vector<fc::ecc::private_key>& keys,
+                               uint32_t per_key, uint64_t amount = 100000000 )
+{
+   using namespace bts::blockchain;
+   for( uint32_t k = 0; k < keys.size(); ++k )
+   {
+      signed_transaction trx;
+      trx.vote = k % 100 + 1;
+      for( uint32_t o = 0; o < per_key; ++o )
+      {
+         trx.outputs.push_back( trx_output( claim_by_signature_output( address( keys[k].get_public_key() ) ), asset( amount ) ) );
+         genesis.total_shares += amount;
+      }
+      genesis.trxs.push_back( trx );
+   }
+   genesis.trx_mroot = genesis.calculate_merkle_root( signed_transactions() );
+}
@@ -0,0 +1,126 @@
+#define BOOST_TEST_MODULE LottoTests
+#include <boost/test/unit_test.hpp>
+#include <bts/lotto/lotto_db.hpp>
+#include <bts/lotto/lotto_outputs.hpp>
+#include <bts/lotto/lotto_transaction_validator.hpp>
+#include <bts/blockchain/pow_validator.hpp>
+#include <bts/wallet/wallet.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/log/logger.hpp>
+#include "genesis_helpers.hpp"
+
+#include <algorithm>
+
+using namespace bts::blockchain;
+using namespace bts::lotto;
+
+/**
+ *  A ticket wins when the draw modulo odds times the tickets of the drawing is below
+ *  amount / odds, so a single ticket that paid anything always wins its drawing.
+ */
+BOOST_AUTO_TEST_CASE( lotto_is_winner )
+{
+   fc::sha256 winning_number = fc::sha256::hash( "winning", 7 );
+   BOOST_CHECK( lotto_transaction_validator::is_winner( 42, 1, 1, winning_number, 1 ) );
+   BOOST_CHECK( !lotto_transaction_validator::is_winner( 42, 1, 0, winning_number, 1 ) );
+
+   // with 100 tickets, a ticket that paid 50 wins about half of the draws
+   uint32_t wins = 0;
+   for( uint64_t lucky_number = 0; lucky_number < 1000; ++lucky_number )
+      if( lotto_transaction_validator::is_winner( lucky_number, 1, 50, winning_number, 100 ) ) ++wins;
+   BOOST_CHECK_GT( wins, 400u );
+   BOOST_CHECK_LT( wins, 600u );
+
+   // higher odds make winning less likely for the same amount
+   uint32_t long_shot_wins = 0;
+   for( uint64_t lucky_number = 0; lucky_number < 1000; ++lucky_number )
+      if( lotto_transaction_validator::is_winner( lucky_number, 5, 50, winning_number, 100 ) ) ++long_shot_wins;
+   BOOST_CHECK_LT( long_shot_wins, wins );
+}
+
+/**
+ *  Storing a block adds its tickets to its summary and its drawing, popping it takes
+ *  them away again.
+ */
+BOOST_AUTO_TEST_CASE( lotto_block_summaries_follow_the_chain )
+{
+   try {
+       fc::temp_directory dir;
+       bts::wallet::wallet wall;
+       wall.create( dir.path() / "wallet.dat", "password", "password", true );
+
+       fc::ecc::private_key auth  = fc::ecc::private_key::generate();
+       fc::ecc::private_key buyer = fc::ecc::private_key::generate();
+       auto sim_validator = std::make_shared<sim_pow_validator>( fc::time_point::now() );
+
+       lotto_db db;
+       db.set_trustee( auth.get_public_key() );
+       db.set_pow_validator( sim_validator );
+       db.open( dir.path() / "lotto" );
+
+       auto genblk = make_test_genesis();
+       fund_test_genesis( genblk, { buyer }, 1 );
+       genblk.sign( auth );
+       db.push_block( genblk );
+       auto funding = genblk.trxs.back();
+
+       const uint64_t lucky_numbers[] = { 77, 3, 77 };
+       const uint64_t ticket_price    = 1000000;
+       signed_transaction tickets;
+       tickets.vote  = 1;
+       tickets.stake = db.get_stake();
+       tickets.inputs.push_back( trx_input( output_reference( funding.id(), 0 ) ) );
+       for( uint64_t lucky_number : lucky_numbers )
+       {
+          claim_ticket_output ticket;
+          ticket.lucky_number = lucky_number;
+          ticket.owner        = address( buyer.get_public_key() );
+          tickets.outputs.push_back( trx_output( ticket, asset( ticket_price ) ) );
+       }
+       tickets.outputs.push_back( trx_output( claim_by_signature_output( address( buyer.get_public_key() ) ),
+                                              asset( funding.outputs[0].amount.get_rounded_amount() - 4 * ticket_price ) ) );
+       tickets.sign( buyer );
+
+       sim_validator->skip_time( fc::seconds(60*5) );
+       auto next_block = wall.generate_next_block( db, signed_transactions{ tickets } );
+       BOOST_REQUIRE_EQUAL( next_block.trxs.size(), 1u );
+       next_block.sign( auth );
+       db.push_block( next_block );
+
+       auto summary = db.get_block_summary( 1 );
+       BOOST_CHECK_EQUAL( summary.drawing, lotto_db::drawing_for_block( 1 ) );
+       BOOST_CHECK_EQUAL( summary.ticket_sales, 3 * ticket_price );
+       BOOST_CHECK( std::is_sorted( summary.lucky_numbers.begin(), summary.lucky_numbers.end() ) );
+       BOOST_CHECK_EQUAL( summary.lucky_numbers.size(), 3u );
+       BOOST_CHECK_EQUAL( db.count_tickets( 1, 77 ), 2u );
+       BOOST_CHECK_EQUAL( db.count_tickets( 1, 3 ), 1u );
+       BOOST_CHECK_EQUAL( db.count_tickets( 1, 4 ), 0u );
+       BOOST_CHECK_EQUAL( db.count_tickets( 2, 77 ), 0u );
+
+       auto drawing = db.get_drawing( summary.drawing );
+       BOOST_CHECK_EQUAL( drawing.total_jackpot, 3 * ticket_price );
+       BOOST_CHECK_EQUAL( drawing.ticket_count, 3u );
+       BOOST_CHECK_EQUAL( drawing.remaining_jackpot(), 3 * ticket_price );
+       // the drawing is only drawn by the first block of the next one
+       fc::sha256 winning_number;
+       uint64_t   global_odds = 0;
+       BOOST_CHECK_THROW( db.get_jackpot_for_ticket( 1, winning_number, global_odds ), fc::exception );
+
+       db.pop_block();
+       BOOST_CHECK_THROW( db.get_block_summary( 1 ), fc::exception );
+       BOOST_CHECK_EQUAL( db.count_tickets( 1, 77 ), 0u );
+       drawing = db.get_drawing( summary.drawing );
+       BOOST_CHECK_EQUAL( drawing.total_jackpot, 0u );
+       BOOST_CHECK_EQUAL( drawing.ticket_count, 0u );
+
+       // pushed again the block counts once
+       db.push_block( next_block );
+       BOOST_CHECK_EQUAL( db.get_drawing( summary.drawing ).ticket_count, 3u );
+       db.close();
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "${e}", ( "e", e.to_detail_string() ) );
+      throw;
+   }
+}
@@ -0,0 +1,591 @@
+#include <bts/net/node.hpp>
+#include <bts/net/token_bucket.hpp>
+#include <bts/client/messages.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/log/logger_config.hpp>
+#include <fc/network/tcp_socket.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+
+using namespace bts::blockchain;
+using namespace bts::net;
+using namespace bts::client;
+
+struct sim_config
+{
+   sim_config()
+   :nodes(50),degree(8),blocks(10),trxs_per_block(200),block_interval_ms(3000),
+    latency_ms(50),jitter_ms(20),loss_percent(0),link_bytes_per_second(0),
+    fresh_nodes(2),settle_seconds(30),base_port(21000),seed(7){}
+
+   uint32_t    nodes;
+   uint32_t    degree;                ///< connections per node, half of them dialed by the node
+   uint32_t    blocks;                ///< broadcast by node 0 once the network is connected
+   uint32_t    trxs_per_block;
+   uint32_t    block_interval_ms;
+   uint32_t    latency_ms;            ///< one way, each direction of each link
+   uint32_t    jitter_ms;             ///< added to the latency, uniformly distributed
+   uint32_t    loss_percent;          ///< of the reads forwarded by a link
+   uint32_t    link_bytes_per_second; ///< each direction of each link, 0 is unlimited
+   uint32_t    fresh_nodes;           ///< join after the last block and synchronize the chain
+   uint32_t    settle_seconds;        ///< how long to wait for the network to catch up
+   uint32_t    base_port;
+   uint32_t    seed;
+   std::string out;                   ///< the JSON report is written here when set, to stdout otherwise
+};
+
+FC_REFLECT( sim_config, (nodes)(degree)(blocks)(trxs_per_block)(block_interval_ms)(latency_ms)(jitter_ms)(loss_percent)
+                        (link_bytes_per_second)(fresh_nodes)(settle_seconds)(base_port)(seed)(out) )
+
+fc::ip::endpoint loopback( uint32_t port ) { return fc::ip::endpoint( fc::ip::address( "127.0.0.1" ), uint16_t(port) ); }
+
+/**
+ *  A link between two simulated nodes.  The dialing node connects to the port of the link,
+ *  which connects to the other node and forwards what either sends after the link's latency,
+ *  jitter and bandwidth.  The nodes only speak TCP, so a lost read is delivered late, as TCP
+ *  would once it retransmitted it, rather than dropped.  Bytes are never reordered.
+ */
+class sim_link
+{
+   public:
+      sim_link( const sim_config& cfg, uint32_t port, uint32_t target_port, uint32_t seed )
+      :_cfg(cfg),_port(port),_target_port(target_port),_rng(seed)
+      {
+         for( auto& d : _directions )
+            d.bandwidth.set_rate( cfg.link_bytes_per_second, cfg.link_bytes_per_second / 10 + 1 );
+      }
+
+      fc::ip::endpoint endpoint()const { return loopback( _port ); }
+      uint64_t         bytes_forwarded()const { return _directions[0].bytes + _directions[1].bytes; }
+
+      void start()
+      {
+         _server.listen( uint16_t(_port) );
+         _accept_loop_done = fc::async( [this](){ accept_loop(); } );
+      }
+
+   private:
+      struct chunk
+      {
+         fc::time_point    due;
+         std::vector<char> data;
+      };
+      struct direction
+      {
+         direction():closed(false),bytes(0){}
+
+         std::deque<chunk>      queue;
+         fc::promise<void>::ptr ready;
+         fc::time_point         last_due;
+         token_bucket           bandwidth;
+         bool                   closed;
+         uint64_t               bytes;
+      };
+
+      /** one connection at a time, a node that was disconnected may dial the link again */
+      void accept_loop()
+      {
+         for( ;; )
+         {
+            fc::tcp_socket dialer, target;
+            try
+            {
+               _server.accept( dialer );
+               target.connect_to( loopback( _target_port ) );
+            }
+            catch ( const fc::exception& e )
+            {
+               wlog( "link ${port} failed to connect: ${e}", ("port",_port)("e",e.to_string()) );
+               dialer.close();
+               continue;
+            }
+            for( auto& d : _directions ) { d.closed = false; d.queue.clear(); d.last_due = fc::time_point(); }
+            auto up_read    = fc::async( [&](){ read_loop( dialer, target, _directions[0] ); } );
+            auto up_write   = fc::async( [&](){ write_loop( target, dialer, _directions[0] ); } );
+            auto down_read  = fc::async( [&](){ read_loop( target, dialer, _directions[1] ); } );
+            auto down_write = fc::async( [&](){ write_loop( dialer, target, _directions[1] ); } );
+            up_read.wait(); up_write.wait(); down_read.wait(); down_write.wait();
+         }
+      }
+
+      fc::microseconds delay_of( size_t bytes, direction& d )
+      {
+         std::uniform_int_distribution<uint32_t> jitter( 0, _cfg.jitter_ms );
+         std::uniform_int_distribution<uint32_t> loss( 0, 99 );
+         fc::microseconds delay = fc::milliseconds( _cfg.latency_ms + jitter( _rng ) ) + d.bandwidth.consume( bytes );
+         if( loss( _rng ) < _cfg.loss_percent )
+            delay += std::max( fc::milliseconds( 200 ), fc::milliseconds( 3 * _cfg.latency_ms ) ); // the retransmission timeout
+         return delay;
+      }
+
+      static void wake( direction& d )
+      {
+         if( d.ready )
+         {
+            d.ready->set_value();
+            d.ready.reset();
+         }
+      }
+
+      /** closing either socket ends the reads and writes of both */
+      void shut_down( fc::tcp_socket& a, fc::tcp_socket& b )
+      {
+         for( auto& d : _directions )
+         {
+            d.closed = true;
+            wake( d );
+         }
+         try { a.close(); } catch ( const fc::exception& ) {}
+         try { b.close(); } catch ( const fc::exception& ) {}
+      }
+
+      void read_loop( fc::tcp_socket& from, fc::tcp_socket& to, direction& d )
+      {
+         std::vector<char> buffer( 64 * 1024 );
+         try
+         {
+            while( !d.closed )
+            {
+               size_t bytes_read = from.readsome( buffer.data(), buffer.size() );
+               chunk c;
+               c.data.assign( buffer.begin(), buffer.begin() + bytes_read );
+               c.due = std::max( fc::time_point::now() + delay_of( bytes_read, d ), d.last_due );
+               d.last_due = c.due;
+               d.bytes += bytes_read;
+               d.queue.push_back( std::move( c ) );
+               wake( d );
+            }
+         }
+         catch ( const fc::exception& )
+         {
+         }
+         shut_down( from, to );
+      }
+
+      void write_loop( fc::tcp_socket& to, fc::tcp_socket& from, direction& d )
+      {
+         try
+         {
+            while( !d.closed )
+            {
+               if( d.queue.empty() )
+               {
+                  fc::promise<void>::ptr ready( new fc::promise<void>() );
+                  d.ready = ready;
+                  ready->wait();
+                  continue;
+               }
+               fc::time_point now = fc::time_point::now();
+               if( d.queue.front().due > now )
+               {
+                  fc::usleep( d.queue.front().due - now );
+                  continue;
+               }
+               to.write( d.queue.front().data.data(), d.queue.front().data.size() );
+               d.queue.pop_front();
+            }
+         }
+         catch ( const fc::exception& )
+         {
+         }
+         shut_down( to, from );
+      }
+
+      const sim_config&  _cfg;
+      uint32_t           _port;
+      uint32_t           _target_port;
+      std::mt19937       _rng;
+      fc::tcp_server     _server;
+      fc::future<void>   _accept_loop_done;
+      direction          _directions[2]; ///< from the dialer, to the dialer
+};
+
+class sim_network;
+
+/** a chain of blocks in memory, every block that follows the head is accepted */
+class sim_node : public node_delegate
+{
+   public:
+      sim_node( sim_network& network, uint32_t index, const block_message& genesis );
+
+      void start( const fc::path& dir, uint32_t port, uint32_t maximum_connections );
+      void add_block( const block_message& block );
+
+      node                         net;
+      std::vector<block_message>   chain;
+      uint32_t                     blocks_to_sync;
+      uint32_t                     blocks_rejected;
+
+      /* Implement node_delegate */
+      bool has_item( const item_id& id ) override;
+      void handle_message( const message& message_to_handle ) override;
+      void handle_block( const block_message& block ) override;
+      std::vector<item_hash_t> get_item_ids( const item_id& from_id, uint32_t& remaining_item_count,
+                                             uint32_t limit = 2000 ) override;
+      message get_item( const item_id& id ) override;
+      void sync_status( uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation ) override;
+      void connection_count_changed( uint32_t c ) override {}
+
+   private:
+      sim_network&                     _network;
+      uint32_t                         _index;
+      std::map<block_id_type,uint32_t> _block_numbers;
+};
+
+/** the nodes, their links and when each node received each block */
+class sim_network
+{
+   public:
+      sim_network( const sim_config& cfg ):_cfg(cfg),_rng(cfg.seed),blocks_received(0) {}
+
+      void add_node( const fc::path& dir, const block_message& genesis )
+      {
+         uint32_t index = nodes.size();
+         nodes.emplace_back( new sim_node( *this, index, genesis ) );
+         nodes.back()->start( dir / ("node-" + fc::to_string( int64_t(index) )), _cfg.base_port + index, 2 * _cfg.degree + _cfg.fresh_nodes );
+      }
+
+      /** node from dials node to through a new link */
+      void link( uint32_t from, uint32_t to )
+      {
+         uint32_t port = _cfg.base_port + _cfg.nodes + _cfg.fresh_nodes + links.size();
+         links.emplace_back( new sim_link( _cfg, port, _cfg.base_port + to, _cfg.seed + port ) );
+         links.back()->start();
+         _linked.insert( std::make_pair( std::min( from, to ), std::max( from, to ) ) );
+         nodes[from]->net.connect_to( links.back()->endpoint() );
+      }
+
+      /** node dials count random nodes below first_excluded that it isn't linked to yet */
+      void link_randomly( uint32_t node, uint32_t count, uint32_t first_excluded )
+      {
+         std::uniform_int_distribution<uint32_t> pick( 0, first_excluded - 1 );
+         for( uint32_t tries = 0; count > 0 && tries < 100 * count; ++tries )
+         {
+            uint32_t other = pick( _rng );
+            if( other == node || _linked.count( std::make_pair( std::min( node, other ), std::max( node, other ) ) ) )
+               continue;
+            link( node, other );
+            --count;
+         }
+      }
+
+      void broadcast_block( const block_message& block )
+      {
+         _broadcast_times[block.block_id] = fc::time_point::now();
+         nodes[0]->add_block( block );
+         nodes[0]->net.broadcast( message( block ) );
+      }
+
+      void block_received( uint32_t index, const block_id_type& block_id )
+      {
+         auto broadcast = _broadcast_times.find( block_id );
+         if( broadcast == _broadcast_times.end() || index >= _cfg.nodes )
+            return; // the fresh nodes synchronize blocks broadcast before they joined
+         propagation_times.push_back( (fc::time_point::now() - broadcast->second).count() );
+         ++blocks_received;
+      }
+
+      /** @return true once every node up to count has block_count blocks after the genesis block */
+      bool have_blocks( uint32_t first, uint32_t count, uint32_t block_count )const
+      {
+         for( uint32_t i = first; i < first + count; ++i )
+            if( nodes[i]->chain.size() < block_count + 1 )
+               return false;
+         return true;
+      }
+
+      std::vector< std::unique_ptr<sim_node> > nodes;
+      std::vector< std::unique_ptr<sim_link> > links;
+      std::vector<int64_t>                     propagation_times; ///< microseconds
+      uint64_t                                 blocks_received;
+
+   private:
+      const sim_config&                        _cfg;
+      std::mt19937                             _rng;
+      std::set< std::pair<uint32_t,uint32_t> > _linked;
+      std::map<block_id_type,fc::time_point>   _broadcast_times;
+};
+
+sim_node::sim_node( sim_network& network, uint32_t index, const block_message& genesis )
+:blocks_to_sync(0),blocks_rejected(0),_network(network),_index(index)
+{
+   net.set_delegate( this );
+   add_block( genesis );
+}
+
+/** the simulator chooses the links, the nodes never dial the peers they hear about */
+void sim_node::start( const fc::path& dir, uint32_t port, uint32_t maximum_connections )
+{
+   fc::create_directories( dir );
+   net.load_configuration( dir );
+   net.set_connection_limits( 0, maximum_connections );
+   net.listen_on_endpoint( loopback( port ) );
+   net.sync_from( item_id( block_message_type, chain.back().block_id ) );
+   net.connect_to_p2p_network();
+}
+
+void sim_node::add_block( const block_message& block )
+{
+   _block_numbers[block.block_id] = chain.size();
+   chain.push_back( block );
+}
+
+bool sim_node::has_item( const item_id& id )
+{
+   return id.item_type == block_message_type && _block_numbers.count( id.item_hash );
+}
+
+void sim_node::handle_message( const message& message_to_handle )
+{
+   if( message_to_handle.msg_type == block_message_type )
+      handle_block( message_to_handle.as<block_message>() );
+}
+
+void sim_node::handle_block( const block_message& block )
+{
+   if( block.block.prev != chain.back().block_id )
+   {
+      ++blocks_rejected;
+      FC_THROW_EXCEPTION( invalid_arg_exception, "block ${id} doesn't follow our head block", ("id",block.block_id) );
+   }
+   add_block( block );
+   _network.block_received( _index, block.block_id );
+}
+
+std::vector<item_hash_t> sim_node::get_item_ids( const item_id& from_id, uint32_t& remaining_item_count, uint32_t limit )
+{
+   std::vector<item_hash_t> ids;
+   remaining_item_count = 0;
+   auto from = _block_numbers.find( from_id.item_hash );
+   if( from == _block_numbers.end() )
+      return ids;
+   for( uint32_t i = from->second + 1; i < chain.size() && ids.size() < limit; ++i )
+      ids.push_back( chain[i].block_id );
+   remaining_item_count = chain.size() - from->second - 1 - ids.size();
+   return ids;
+}
+
+message sim_node::get_item( const item_id& id )
+{
+   auto block = _block_numbers.find( id.item_hash );
+   if( id.item_type != block_message_type || block == _block_numbers.end() )
+      FC_THROW_EXCEPTION( key_not_found_exception, "I don't have the item you're looking for" );
+   return message( chain[block->second] );
+}
+
+void sim_node::sync_status( uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation )
+{
+   blocks_to_sync = item_count;
+}
+
+/** a block of trx_count transactions the size of signed ones, nothing validates them */
+block_message make_block( const block_message& prev, uint32_t trx_count, std::mt19937& rng )
+{
+   block_message result;
+   result.block.block_num = prev.block.block_num + 1;
+   result.block.prev      = prev.block_id;
+   result.block.timestamp = fc::time_point::now();
+   for( uint32_t i = 0; i < trx_count; ++i )
+   {
+      signed_transaction trx;
+      trx.vote = i % 100 + 1;
+      uint32_t salt = rng();
+      address owner;
+      owner.addr = fc::ripemd160::hash( (const char*)&salt, sizeof(salt) );
+      trx.inputs.push_back( trx_input( output_reference( fc::ripemd160::hash( (const char*)&salt, sizeof(salt) / 2 ), 0 ) ) );
+      trx.outputs.push_back( trx_output( claim_by_signature_output( owner ), asset( uint64_t(salt) + 1 ) ) );
+      fc::ecc::compact_signature sig;
+      memcpy( sig.data, &salt, sizeof(salt) );
+      trx.sigs.insert( sig );
+      result.block.trxs.push_back( trx );
+   }
+   result.block.trx_mroot = result.block.calculate_merkle_root( signed_transactions() );
+   result.block_id = result.block.id();
+   *(uint32_t*)&result.signature.at(0) = result.block.block_num;
+   return result;
+}
+
+double percentile_ms( const std::vector<int64_t>& sorted, double fraction )
+{
+   if( sorted.empty() ) return 0;
+   return sorted[ std::min<size_t>( sorted.size() - 1, size_t( sorted.size() * fraction ) ) ] / 1000.0;
+}
+
+void set_option( sim_config& cfg, const std::string& arg )
+{
+   auto eq = arg.find( '=' );
+   FC_ASSERT( arg.compare( 0, 2, "--" ) == 0 && eq != std::string::npos, "expected --name=value, got ${a}", ("a",arg) );
+   auto name  = arg.substr( 2, eq - 2 );
+   auto value = arg.substr( eq + 1 );
+   if( name == "out" ) { cfg.out = value; return; }
+
+   uint32_t v = std::stoul( value );
+   if(      name == "nodes" )                 cfg.nodes                 = v;
+   else if( name == "degree" )                cfg.degree                = v;
+   else if( name == "blocks" )                cfg.blocks                = v;
+   else if( name == "trxs-per-block" )        cfg.trxs_per_block        = v;
+   else if( name == "block-interval-ms" )     cfg.block_interval_ms     = v;
+   else if( name == "latency-ms" )            cfg.latency_ms            = v;
+   else if( name == "jitter-ms" )             cfg.jitter_ms             = v;
+   else if( name == "loss-percent" )          cfg.loss_percent          = v;
+   else if( name == "link-bytes-per-second" ) cfg.link_bytes_per_second = v;
+   else if( name == "fresh-nodes" )           cfg.fresh_nodes           = v;
+   else if( name == "settle-seconds" )        cfg.settle_seconds        = v;
+   else if( name == "base-port" )             cfg.base_port             = v;
+   else if( name == "seed" )                  cfg.seed                  = v;
+   else FC_THROW_EXCEPTION( invalid_arg_exception, "unknown option ${n}", ("n",name) );
+}
+
+/**
+ *  Runs a network of bts::net::node instances in this process and reports, as JSON, how
+ *  long the blocks broadcast by node 0 took to reach the other nodes (percentiles over
+ *  every node and block), how long nodes that join afterwards take to synchronize the
+ *  chain, and the bytes each node sent and received.
+ *
+ *  The nodes run on one thread and talk over loopback sockets through the links of
+ *  sim_link, which apply the latency, jitter, loss and bandwidth.  The seed fixes the
+ *  topology and the draws of each link, the scheduling of the fibers still varies from run
+ *  to run, so compare the percentiles of a few runs rather than single numbers.
+ *
+ *  usage: net_simulator [--nodes=50] [--degree=8] [--blocks=10] [--trxs-per-block=200]
+ *                       [--block-interval-ms=3000] [--latency-ms=50] [--jitter-ms=20]
+ *                       [--loss-percent=0] [--link-bytes-per-second=0] [--fresh-nodes=2]
+ *                       [--settle-seconds=30] [--base-port=21000] [--seed=7] [--out=report.json]
+ */
+int main( int argc, char** argv )
+{
+   try {
+      sim_config cfg;
+      for( int i = 1; i < argc; ++i ) set_option( cfg, argv[i] );
+      FC_ASSERT( cfg.nodes > 1 && cfg.degree > 1 && cfg.loss_percent < 100 );
+
+      fc::logging_config log_cfg = fc::logging_config::default_config();
+      for( auto& logger : log_cfg.loggers ) logger.level = fc::log_level::error;
+      fc::configure_logging( log_cfg );
+
+      fc::temp_directory dir;
+      std::mt19937 rng( cfg.seed );
+      block_message genesis = make_block( block_message(), 0, rng ); // block_num 0
+
+      sim_network network( cfg );
+      for( uint32_t i = 0; i < cfg.nodes; ++i )
+         network.add_node( dir.path(), genesis );
+      for( uint32_t i = 0; i < cfg.nodes; ++i )
+         network.link_randomly( i, cfg.degree / 2, cfg.nodes );
+
+      auto deadline = fc::time_point::now() + fc::seconds( cfg.settle_seconds );
+      auto all_connected = [&]() {
+         for( uint32_t i = 0; i < cfg.nodes; ++i )
+            if( network.nodes[i]->net.get_connected_peers().empty() ) return false;
+         return true;
+      };
+      while( !all_connected() && fc::time_point::now() < deadline )
+         fc::usleep( fc::milliseconds( 100 ) );
+
+      for( uint32_t b = 0; b < cfg.blocks; ++b )
+      {
+         network.broadcast_block( make_block( network.nodes[0]->chain.back(), cfg.trxs_per_block, rng ) );
+         fc::usleep( fc::milliseconds( cfg.block_interval_ms ) );
+      }
+      deadline = fc::time_point::now() + fc::seconds( cfg.settle_seconds );
+      while( !network.have_blocks( 0, cfg.nodes, cfg.blocks ) && fc::time_point::now() < deadline )
+         fc::usleep( fc::milliseconds( 100 ) );
+
+      // the fresh nodes dial half as many nodes as the others, and are dialed by none
+      auto sync_start = fc::time_point::now();
+      for( uint32_t i = 0; i < cfg.fresh_nodes; ++i )
+      {
+         network.add_node( dir.path(), genesis );
+         network.link_randomly( cfg.nodes + i, std::max<uint32_t>( cfg.degree / 2, 1 ), cfg.nodes );
+      }
+      std::vector<int64_t> sync_times( cfg.fresh_nodes, -1 );
+      deadline = fc::time_point::now() + fc::seconds( cfg.settle_seconds );
+      while( fc::time_point::now() < deadline &&
+             std::find( sync_times.begin(), sync_times.end(), -1 ) != sync_times.end() )
+      {
+         for( uint32_t i = 0; i < cfg.fresh_nodes; ++i )
+            if( sync_times[i] < 0 && network.have_blocks( cfg.nodes + i, 1, cfg.blocks ) )
+               sync_times[i] = (fc::time_point::now() - sync_start).count();
+         fc::usleep( fc::milliseconds( 50 ) );
+      }
+
+      std::vector<int64_t> propagation = network.propagation_times;
+      std::sort( propagation.begin(), propagation.end() );
+      fc::mutable_variant_object propagation_report;
+      propagation_report["received"] = network.blocks_received;
+      propagation_report["expected"] = uint64_t( cfg.nodes - 1 ) * cfg.blocks;
+      propagation_report["p50_ms"]   = percentile_ms( propagation, 0.5 );
+      propagation_report["p90_ms"]   = percentile_ms( propagation, 0.9 );
+      propagation_report["p99_ms"]   = percentile_ms( propagation, 0.99 );
+      propagation_report["max_ms"]   = percentile_ms( propagation, 1.0 );
+
+      std::vector<fc::variant> sync_report;
+      for( int64_t t : sync_times )
+         sync_report.push_back( t < 0 ? fc::variant() : fc::variant( t / 1000.0 ) );
+
+      uint64_t bytes_sent = 0, bytes_received = 0, max_bytes_sent = 0, connections = 0, rejected = 0;
+      for( const auto& n : network.nodes )
+      {
+         node_statistics stats = n->net.get_statistics();
+         uint64_t node_bytes_sent = 0;
+         for( const peer_statistics& peer : stats.peers )
+         {
+            node_bytes_sent += peer.bytes_sent;
+            bytes_received  += peer.bytes_received;
+         }
+         bytes_sent    += node_bytes_sent;
+         max_bytes_sent = std::max( max_bytes_sent, node_bytes_sent );
+         connections   += stats.peers.size();
+         rejected      += n->blocks_rejected;
+      }
+      uint64_t link_bytes = 0;
+      for( const auto& l : network.links ) link_bytes += l->bytes_forwarded();
+
+      fc::mutable_variant_object traffic;
+      traffic["bytes_sent_per_node"]       = bytes_sent / network.nodes.size();
+      traffic["bytes_received_per_node"]   = bytes_received / network.nodes.size();
+      traffic["max_bytes_sent_by_a_node"]  = max_bytes_sent;
+      traffic["bytes_sent_per_connection"] = connections ? bytes_sent / connections : 0;
+      traffic["bytes_forwarded_by_links"]  = link_bytes;
+      traffic["connections"]               = connections / 2;
+
+      fc::mutable_variant_object result;
+      result["config"]            = fc::variant( cfg );
+      result["block_size"]        = network.nodes[0]->chain.back().block.block_size();
+      result["propagation"]       = fc::variant( propagation_report );
+      result["fresh_node_sync_ms"] = fc::variant( sync_report );
+      result["traffic"]           = fc::variant( traffic );
+      result["blocks_rejected"]   = rejected;
+
+      auto json = fc::json::to_pretty_string( fc::variant( result ) );
+      if( cfg.out.empty() )
+      {
+         std::cout << json << "\n";
+      }
+      else
+      {
+         std::ofstream out( cfg.out.c_str() );
+         out << json << "\n";
+         FC_ASSERT( out.good(), "unable to write ${file}", ("file",cfg.out) );
+      }
+      return 0;
+   }
+   catch ( const fc::exception& e )
+   {
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+}
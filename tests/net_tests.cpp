@@ -0,0 +1,240 @@
+#define BOOST_TEST_MODULE NetTests
+#include <boost/test/unit_test.hpp>
+#include <bts/net/aead_cipher.hpp>
+#include <bts/net/bloom_filter.hpp>
+#include <bts/net/peer_database.hpp>
+#include <bts/net/token_bucket.hpp>
+#include <fc/crypto/elliptic.hpp>
+#include <fc/crypto/hex.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace bts::net;
+
+namespace
+{
+  peer_quality measured_peer(uint32_t round_trip_time_ms, uint64_t sync_bytes_per_second)
+  {
+    peer_quality quality;
+    quality.round_trip_time_ms = round_trip_time_ms;
+    quality.sync_bytes_per_second = sync_bytes_per_second;
+    quality.number_of_items_received = 100;
+    return quality;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( eviction_needs_twice_the_score )
+{
+  std::vector<peer_quality> active_peers;
+  active_peers.push_back(measured_peer(50, 1024 * 1024));
+  active_peers.push_back(measured_peer(2000, 8 * 1024));
+  active_peers.push_back(measured_peer(100, 512 * 1024));
+
+  // a much better candidate replaces the slowest peer
+  BOOST_CHECK_EQUAL(choose_peer_to_evict(active_peers, measured_peer(50, 1024 * 1024)), 1u);
+  // one about as good as the slowest doesn't
+  BOOST_CHECK_EQUAL(choose_peer_to_evict(active_peers, measured_peer(1800, 8 * 1024)), active_peers.size());
+  // nor does anyone when nobody is connected
+  BOOST_CHECK_EQUAL(choose_peer_to_evict(std::vector<peer_quality>(), measured_peer(50, 1024 * 1024)), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( eviction_never_favors_unmeasured_peers )
+{
+  std::vector<peer_quality> active_peers;
+  active_peers.push_back(measured_peer(2000, 4 * 1024));
+  active_peers.push_back(measured_peer(1500, 8 * 1024));
+  BOOST_REQUIRE(peer_quality().score() > active_peers[0].score() * 2);
+
+  // the assumed speeds of a newcomer beat both, but it hasn't proven them
+  BOOST_CHECK_EQUAL(choose_peer_to_evict(active_peers, peer_quality()), active_peers.size());
+
+  // an unmeasured active peer is the first to go for a candidate that did prove itself
+  active_peers.push_back(peer_quality());
+  BOOST_CHECK_EQUAL(choose_peer_to_evict(active_peers, measured_peer(50, 1024 * 1024)), 2u);
+}
+
+BOOST_AUTO_TEST_CASE( eviction_counts_invalid_items )
+{
+  std::vector<peer_quality> active_peers;
+  active_peers.push_back(measured_peer(50, 1024 * 1024));
+  active_peers.push_back(measured_peer(50, 1024 * 1024));
+  active_peers[0].number_of_invalid_items = 50;
+
+  BOOST_CHECK(active_peers[0].score() * 2 < active_peers[1].score());
+  BOOST_CHECK_EQUAL(choose_peer_to_evict(active_peers, measured_peer(50, 1024 * 1024)), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( bloom_filter_false_positive_rate )
+{
+  bloom_filter filter(1000, 0.01, 7);
+  BOOST_CHECK(filter.is_within_limits());
+  for (uint64_t key = 0; key < 1000; ++key)
+    filter.insert(key);
+  for (uint64_t key = 0; key < 1000; ++key)
+    BOOST_CHECK(filter.may_contain(key));
+
+  uint32_t false_positives = 0;
+  for (uint64_t key = 1000; key < 21000; ++key)
+    if (filter.may_contain(key))
+      ++false_positives;
+  // 1% of 20000 keys is 200, a broken hash would be far off
+  BOOST_CHECK_LT(false_positives, 400u);
+  BOOST_CHECK_GT(false_positives, 50u);
+
+  // a different tweak picks different bits for the same keys
+  bloom_filter untweaked(1000, 0.01, 7);
+  bloom_filter tweaked(1000, 0.01, 8);
+  untweaked.insert(uint64_t(1));
+  tweaked.insert(uint64_t(1));
+  BOOST_CHECK(tweaked.may_contain(uint64_t(1)));
+  BOOST_CHECK(tweaked.bits != untweaked.bits);
+
+  bloom_filter too_large;
+  too_large.bits.resize(maximum_bloom_filter_size + 1);
+  too_large.number_of_hash_functions = 1;
+  BOOST_CHECK(!too_large.is_within_limits());
+}
+
+BOOST_AUTO_TEST_CASE( match_transaction_follows_the_outputs_it_pays )
+{
+  using namespace bts::blockchain;
+  address mine(fc::ecc::private_key::generate().get_public_key());
+  address theirs(fc::ecc::private_key::generate().get_public_key());
+
+  bloom_filter filter(10, 0.000001, 0);
+  filter.insert(mine);
+
+  signed_transaction payment;
+  payment.outputs.push_back(trx_output(claim_by_signature_output(theirs), asset(uint64_t(100))));
+  payment.outputs.push_back(trx_output(claim_by_signature_output(mine), asset(uint64_t(200))));
+  BOOST_CHECK(match_transaction(filter, payment));
+  BOOST_CHECK(filter.may_contain(output_reference(payment.id(), 1)));
+
+  // the transaction that spends the matched output matches without paying to the filter
+  signed_transaction spend;
+  spend.inputs.push_back(trx_input(output_reference(payment.id(), 1)));
+  spend.outputs.push_back(trx_output(claim_by_signature_output(theirs), asset(uint64_t(200))));
+  BOOST_CHECK(match_transaction(filter, spend));
+
+  // nor does the filter learn of outputs that don't pay to it
+  signed_transaction unrelated;
+  unrelated.inputs.push_back(trx_input(output_reference(payment.id(), 0)));
+  unrelated.outputs.push_back(trx_output(claim_by_signature_output(theirs), asset(uint64_t(100))));
+  BOOST_CHECK(!match_transaction(filter, unrelated));
+  BOOST_CHECK(!filter.may_contain(output_reference(unrelated.id(), 0)));
+}
+
+BOOST_AUTO_TEST_CASE( token_bucket_limits_to_its_rate )
+{
+  token_bucket bucket;
+  BOOST_CHECK(!bucket.is_limited());
+  BOOST_CHECK_EQUAL(bucket.consume(1000000).count(), 0);
+
+  // 100 bytes a second, so the moments between set_rate() and start don't earn a token
+  bucket.set_rate(100, 50);
+  fc::time_point start = fc::time_point::now();
+  BOOST_CHECK_EQUAL(bucket.consume(50, start).count(), 0);
+
+  // a message larger than what is left gets through, the debt delays what follows
+  BOOST_CHECK_EQUAL(bucket.consume(100, start).count(), 1000000);
+  BOOST_CHECK_EQUAL(bucket.consume(0, start + fc::seconds(1)).count(), 0);
+  BOOST_CHECK_EQUAL(bucket.consume(1, start + fc::seconds(1)).count(), 10000);
+
+  // an idle bucket fills up to its burst and no further
+  fc::time_point later = start + fc::seconds(100);
+  BOOST_CHECK_EQUAL(bucket.consume(60, later).count(), 100000);
+
+  // removing the rate forgives the debt
+  bucket.set_rate(0, 0);
+  BOOST_CHECK(!bucket.is_limited());
+  BOOST_CHECK_EQUAL(bucket.consume(1000000, later).count(), 0);
+}
+
+namespace
+{
+  struct record_vector
+  {
+    const char* plaintext;
+    const char* ciphertext;
+    const char* tag;
+  };
+
+  const fc::sha256 record_test_key("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+
+  /** the header authenticated with a record, its plaintext length little endian */
+  void make_record_header(char (&header)[stcp_socket::record_header_size], uint32_t length)
+  {
+    for (size_t i = 0; i < sizeof(header); ++i)
+      header[i] = char(length >> (8 * i));
+  }
+
+  /**
+   *  Seals the records in order under the key 00 01 .. 1f, so their nonces are the sequence
+   *  numbers 0, 1, .., and checks them against what OpenSSL's EVP interface gave for the
+   *  same key, nonces and headers.  Then opens them, and checks that a tampered tag or
+   *  header doesn't open.
+   */
+  void check_record_vectors(stcp_socket::cipher_suite suite, const record_vector* vectors, size_t count)
+  {
+    detail::aead_cipher sealer(suite, record_test_key, true);
+    detail::aead_cipher opener(suite, record_test_key, false);
+    for (size_t i = 0; i < count; ++i)
+    {
+      std::string data(vectors[i].plaintext);
+      char header[stcp_socket::record_header_size];
+      make_record_header(header, data.size());
+      char tag[stcp_socket::record_tag_size];
+      sealer.seal(header, &data[0], data.size(), tag);
+      BOOST_CHECK_EQUAL(fc::to_hex(data.data(), data.size()), vectors[i].ciphertext);
+      BOOST_CHECK_EQUAL(fc::to_hex(tag, sizeof(tag)), vectors[i].tag);
+
+      opener.open(header, &data[0], data.size(), tag);
+      BOOST_CHECK_EQUAL(data, vectors[i].plaintext);
+    }
+
+    for (int tampered_byte = 0; tampered_byte < 2; ++tampered_byte)
+    {
+      detail::aead_cipher tampered_sealer(suite, record_test_key, true);
+      detail::aead_cipher tampered_opener(suite, record_test_key, false);
+      std::string data(vectors[0].plaintext);
+      char header[stcp_socket::record_header_size];
+      make_record_header(header, data.size());
+      char tag[stcp_socket::record_tag_size];
+      tampered_sealer.seal(header, &data[0], data.size(), tag);
+      if (tampered_byte == 0)
+        tag[0] ^= 1;
+      else
+        header[3] ^= 1;
+      BOOST_CHECK_THROW(tampered_opener.open(header, &data[0], data.size(), tag), fc::exception);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( aes_256_gcm_records_match_known_answers )
+{
+  const record_vector vectors[] = {
+    { "the first record", "7ad4d0fed345f1ce7c88db507b43e3fd", "576812a6edc1f1bbe6b5681e6ba352e4" },
+    { "and the second one, a little longer", "8342e61fd0c78927396166ac52a5a8a4a204e30e1d88077b3a6b319b3d4ae81e8b9982",
+      "a200935ea365522fdb2d2d592816b8c5" }
+  };
+  BOOST_REQUIRE(detail::aead_cipher::is_supported(stcp_socket::aes_256_gcm));
+  check_record_vectors(stcp_socket::aes_256_gcm, vectors, 2);
+}
+
+BOOST_AUTO_TEST_CASE( chacha20_poly1305_records_match_known_answers )
+{
+  if (!detail::aead_cipher::is_supported(stcp_socket::chacha20_poly1305))
+  {
+    // OpenSSL was built without it, it must never be preferred then
+    BOOST_CHECK_EQUAL(int(stcp_socket::preferred_cipher_suite()), int(stcp_socket::aes_256_gcm));
+    BOOST_CHECK_THROW(detail::aead_cipher(stcp_socket::chacha20_poly1305, record_test_key, true), fc::exception);
+    return;
+  }
+  const record_vector vectors[] = {
+    { "the first record", "6cd02711cb8fd4a267412e04cc2c3c43", "7f5ab7fa3fa30615f9faac35b5891445" },
+    { "and the second one, a little longer", "f5511fceb08bf90a043eb09c035bfd344fdddcf84cd9b554e1349b3c37cd7ea306cb2e",
+      "f4580b15e83eddcd5b7649c8e9da913f" }
+  };
+  check_record_vectors(stcp_socket::chacha20_poly1305, vectors, 2);
+}
@@ -163,7 +163,7 @@ class simple_net_test_miner : public bts::net::node_delegate
                                            uint32_t& remaining_item_count,
                                            uint32_t limit = 2000) override;
      message get_item(const item_id& id) override; 
-     void sync_status(uint32_t item_type, uint32_t item_count) override;
+     void sync_status(uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation) override;
      void connection_count_changed(uint32_t c) override;
 };
 
@@ -422,7 +422,7 @@ message simple_net_test_miner::get_item(const item_id& id)
   FC_THROW_EXCEPTION(key_not_found_exception, "I don't have the item you're looking for");
 }
 
-void simple_net_test_miner::sync_status(uint32_t item_type, uint32_t item_count)
+void simple_net_test_miner::sync_status(uint32_t item_type, uint32_t item_count, uint32_t items_awaiting_validation)
 {
   _remaining_items_to_sync = item_count;
   _synchronized = _remaining_items_to_sync == 0;